@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <libinput.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -17,10 +18,12 @@
 #include <wlr/config.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/util/log.h>
+#include <wlr/util/realtime.h>
 #include "backend/backend.h"
 #include "backend/multi.h"
 #include "render/allocator.h"
 #include "util/signal.h"
+#include "util/startup.h"
 
 #if WLR_HAS_X11_BACKEND
 #include <wlr/backend/x11.h>
@@ -118,6 +121,18 @@ uint32_t backend_get_buffer_caps(struct wlr_backend *backend) {
 	return backend->impl->get_buffer_caps(backend);
 }
 
+bool backend_supports_commit_outputs(struct wlr_backend *backend) {
+	return backend->impl->commit_outputs != NULL;
+}
+
+bool backend_commit_outputs(struct wlr_backend *backend,
+		struct wlr_output *const *outputs, size_t outputs_len,
+		bool test_only) {
+	assert(backend->impl->commit_outputs);
+	return backend->impl->commit_outputs(backend, outputs, outputs_len,
+		test_only);
+}
+
 struct wlr_allocator *backend_get_allocator(struct wlr_backend *backend) {
 	if (backend->allocator != NULL) {
 		return backend->allocator;
@@ -151,6 +166,94 @@ static size_t parse_outputs_env(const char *name) {
 	return outputs;
 }
 
+static bool parse_cpus_env(const char *name, struct wl_array *cpus) {
+	const char *str = getenv(name);
+	if (str == NULL) {
+		return true;
+	}
+
+	// Comma-separated list of CPUs and ranges, e.g. "0,2-3"
+	const char *cur = str;
+	while (*cur != '\0') {
+		char *end;
+		long first = strtol(cur, &end, 10);
+		long last = first;
+		if (end == cur) {
+			goto error;
+		}
+		if (*end == '-') {
+			cur = end + 1;
+			last = strtol(cur, &end, 10);
+			if (end == cur) {
+				goto error;
+			}
+		}
+		if (first < 0 || last < first || last >= 4096) {
+			goto error;
+		}
+		for (long cpu = first; cpu <= last; cpu++) {
+			int *ptr = wl_array_add(cpus, sizeof(*ptr));
+			if (ptr == NULL) {
+				return false;
+			}
+			*ptr = (int)cpu;
+		}
+		if (*end == ',') {
+			end++;
+		} else if (*end != '\0') {
+			goto error;
+		}
+		cur = end;
+	}
+	return true;
+
+error:
+	wlr_log(WLR_ERROR, "%s specified with invalid CPU list, ignoring", name);
+	return false;
+}
+
+static void apply_realtime_env(void) {
+	const char *policy_str = getenv("WLR_REALTIME");
+	if (policy_str == NULL && getenv("WLR_REALTIME_CPUS") == NULL) {
+		return;
+	}
+
+	struct wlr_realtime_options options = { .policy = SCHED_OTHER };
+	if (policy_str != NULL) {
+		// "fifo" or "rr", optionally followed by ":<priority>"
+		size_t name_len = strcspn(policy_str, ":");
+		if (name_len == 4 && strncmp(policy_str, "fifo", 4) == 0) {
+			options.policy = SCHED_FIFO;
+		} else if (name_len == 2 && strncmp(policy_str, "rr", 2) == 0) {
+			options.policy = SCHED_RR;
+		} else {
+			wlr_log(WLR_ERROR, "WLR_REALTIME specified with unknown policy, "
+				"ignoring");
+			return;
+		}
+
+		if (policy_str[name_len] == ':') {
+			char *end;
+			long priority = strtol(&policy_str[name_len + 1], &end, 10);
+			if (*end != '\0' || priority <= 0 || priority > 99) {
+				wlr_log(WLR_ERROR, "WLR_REALTIME specified with invalid "
+					"priority, ignoring");
+				return;
+			}
+			options.priority = (int)priority;
+		}
+	}
+
+	struct wl_array cpus;
+	wl_array_init(&cpus);
+	if (parse_cpus_env("WLR_REALTIME_CPUS", &cpus)) {
+		options.cpus = cpus.data;
+		options.cpus_len = cpus.size / sizeof(int);
+		wlr_realtime_set_thread(&options);
+	}
+	wl_array_release(&cpus);
+}
+
 static struct wlr_backend *attempt_wl_backend(struct wl_display *display) {
 	struct wlr_backend *backend = wlr_wl_backend_create(display, NULL);
 	if (backend == NULL) {
@@ -275,7 +378,7 @@ static struct wlr_backend *attempt_backend_by_name(struct wl_display *display,
 	return NULL;
 }
 
-struct wlr_backend *wlr_backend_autocreate(struct wl_display *display) {
+static struct wlr_backend *backend_autocreate(struct wl_display *display) {
 	struct wlr_backend *backend = wlr_multi_backend_create(display);
 	struct wlr_multi_backend *multi = (struct wlr_multi_backend *)backend;
 	if (!backend) {
@@ -355,8 +458,10 @@ struct wlr_backend *wlr_backend_autocreate(struct wl_display *display) {
 		return NULL;
 	}
 
+	int64_t libinput_start = startup_phase_begin("libinput");
 	struct wlr_backend *libinput = wlr_libinput_backend_create(display,
 		multi->session);
+	startup_phase_end("libinput", libinput_start);
 	if (!libinput) {
 		wlr_log(WLR_ERROR, "Failed to start libinput backend");
 		wlr_session_destroy(multi->session);
@@ -365,8 +470,10 @@ struct wlr_backend *wlr_backend_autocreate(struct wl_display *display) {
 	}
 	wlr_multi_backend_add(backend, libinput);
 
+	int64_t drm_start = startup_phase_begin("drm");
 	struct wlr_backend *primary_drm =
 		attempt_drm_backend(display, backend, multi->session);
+	startup_phase_end("drm", drm_start);
 	if (!primary_drm) {
 		wlr_log(WLR_ERROR, "Failed to open any DRM device");
 		wlr_backend_destroy(libinput);
@@ -381,3 +488,11 @@ error:
 	wlr_backend_destroy(backend);
 	return NULL;
 }
+
+struct wlr_backend *wlr_backend_autocreate(struct wl_display *display) {
+	int64_t start = startup_phase_begin("backend");
+	apply_realtime_env();
+	struct wlr_backend *backend = backend_autocreate(display);
+	startup_phase_end("backend", start);
+	return backend;
+}
@@ -1,12 +1,27 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
 #include <gbm.h>
+#include <math.h>
+#include <pixman.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wlr/interfaces/wlr_output.h>
 #include <wlr/util/log.h>
+#include <wlr/util/region.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include "backend/drm/drm.h"
 #include "backend/drm/iface.h"
 #include "backend/drm/util.h"
 
+// Drivers handle a few damage clips better than many small ones
+#define FB_DAMAGE_CLIPS_MAX 16
+
+// Minimum interval between two steps of a gamma transition
+#define GAMMA_TRANSITION_STEP_MS 16
+
 struct atomic {
 	drmModeAtomicReq *req;
 	bool failed;
@@ -23,20 +38,36 @@ static void atomic_begin(struct atomic *atom) {
 	}
 }
 
-static bool atomic_commit(struct atomic *atom,
+static bool atomic_commit(struct atomic *atom, struct wlr_drm_backend *drm,
 		struct wlr_drm_connector *conn, uint32_t flags) {
-	struct wlr_drm_backend *drm = conn->backend;
 	if (atom->failed) {
 		return false;
 	}
 
 	int ret = drmModeAtomicCommit(drm->fd, atom->req, flags, drm);
+	if (ret != 0 && errno == EBUSY &&
+			(flags & DRM_MODE_ATOMIC_ALLOW_MODESET) &&
+			(flags & DRM_MODE_ATOMIC_NONBLOCK)) {
+		// A previous commit touching one of the CRTCs is still in flight,
+		// wait for it
+		wlr_log(WLR_DEBUG, "Non-blocking modeset rejected, retrying blocking");
+		flags &= ~DRM_MODE_ATOMIC_NONBLOCK;
+		ret = drmModeAtomicCommit(drm->fd, atom->req, flags, drm);
+	}
 	if (ret != 0) {
-		wlr_drm_conn_log_errno(conn,
-			(flags & DRM_MODE_ATOMIC_TEST_ONLY) ? WLR_DEBUG : WLR_ERROR,
-			"Atomic %s failed (%s)",
-			(flags & DRM_MODE_ATOMIC_TEST_ONLY) ? "test" : "commit",
-			(flags & DRM_MODE_ATOMIC_ALLOW_MODESET) ? "modeset" : "pageflip");
+		enum wlr_log_importance verb =
+			(flags & DRM_MODE_ATOMIC_TEST_ONLY) ? WLR_DEBUG : WLR_ERROR;
+		const char *what =
+			(flags & DRM_MODE_ATOMIC_TEST_ONLY) ? "test" : "commit";
+		const char *kind =
+			(flags & DRM_MODE_ATOMIC_ALLOW_MODESET) ? "modeset" : "pageflip";
+		if (conn != NULL) {
+			wlr_drm_conn_log_errno(conn, verb, "Atomic %s failed (%s)",
+				what, kind);
+		} else {
+			wlr_log_errno(verb, "Atomic %s of multiple connectors failed (%s)",
+				what, kind);
+		}
 		return false;
 	}
 
@@ -62,11 +93,13 @@ static bool create_mode_blob(struct wlr_drm_backend *drm,
 		return true;
 	}
 
+	struct wlr_drm_crtc *crtc = conn->crtc;
 	drmModeModeInfo mode = {0};
 	drm_connector_state_mode(conn, state, &mode);
-	if (drmModeCreatePropertyBlob(drm->fd, &mode,
-			sizeof(drmModeModeInfo), blob_id)) {
-		wlr_log_errno(WLR_ERROR, "Unable to create mode property blob");
+	*blob_id = drm_blob_cache_get(drm->fd, &crtc->mode_blobs, &mode,
+		sizeof(drmModeModeInfo), crtc->mode_id);
+	if (*blob_id == 0) {
+		wlr_log(WLR_ERROR, "Unable to create mode property blob");
 		return false;
 	}
 
@@ -74,7 +107,8 @@ static bool create_mode_blob(struct wlr_drm_backend *drm,
 }
 
 static bool create_gamma_lut_blob(struct wlr_drm_backend *drm,
-		size_t size, const uint16_t *lut, uint32_t *blob_id) {
+		struct wlr_drm_crtc *crtc, size_t size, const uint16_t *lut,
+		uint32_t *blob_id) {
 	if (size == 0) {
 		*blob_id = 0;
 		return true;
@@ -95,36 +129,135 @@ static bool create_gamma_lut_blob(struct wlr_drm_backend *drm,
 		gamma[i].blue = b[i];
 	}
 
-	if (drmModeCreatePropertyBlob(drm->fd, gamma,
-			size * sizeof(struct drm_color_lut), blob_id) != 0) {
-		wlr_log_errno(WLR_ERROR, "Unable to create gamma LUT property blob");
-		free(gamma);
+	*blob_id = drm_blob_cache_get(drm->fd, &crtc->gamma_blobs, gamma,
+		size * sizeof(struct drm_color_lut), crtc->gamma_lut);
+	free(gamma);
+	if (*blob_id == 0) {
+		wlr_log(WLR_ERROR, "Unable to create gamma LUT property blob");
 		return false;
 	}
-	free(gamma);
 
 	return true;
 }
 
-static void commit_blob(struct wlr_drm_backend *drm,
-		uint32_t *current, uint32_t next) {
-	if (*current == next) {
-		return;
+static void set_identity_lut(uint16_t *lut, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		uint16_t v = size > 1 ? (uint32_t)i * 0xFFFF / (size - 1) : 0xFFFF;
+		lut[i] = lut[size + i] = lut[2 * size + i] = v;
 	}
-	if (*current != 0) {
-		drmModeDestroyPropertyBlob(drm->fd, *current);
+}
+
+static int64_t get_time_ms(struct wlr_drm_backend *drm) {
+	struct timespec now;
+	clock_gettime(drm->clock, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static bool gamma_transition_ensure_size(struct wlr_drm_connector *conn,
+		size_t size) {
+	if (conn->gamma_transition.size == size) {
+		return true;
 	}
-	*current = next;
+	drm_connector_reset_gamma_transition(conn);
+
+	size_t len = 3 * size * sizeof(uint16_t);
+	uint16_t *current = malloc(len);
+	uint16_t *from = malloc(len);
+	uint16_t *to = malloc(len);
+	if (current == NULL || from == NULL || to == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		free(current);
+		free(from);
+		free(to);
+		return false;
+	}
+	conn->gamma_transition.current = current;
+	conn->gamma_transition.from = from;
+	conn->gamma_transition.to = to;
+	conn->gamma_transition.size = size;
+	return true;
 }
 
-static void rollback_blob(struct wlr_drm_backend *drm,
-		uint32_t *current, uint32_t next) {
-	if (*current == next) {
-		return;
+/**
+ * Whether a gamma LUT change can be faded from the LUT currently applied.
+ */
+static bool gamma_transition_can_start(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	return conn->gamma_transition.duration_ms > 0 &&
+		conn->gamma_transition.size == conn->crtc->gamma_lut_size &&
+		conn->gamma_transition.size > 0 &&
+		(state->gamma_lut_size == 0 ||
+		state->gamma_lut_size == conn->gamma_transition.size) &&
+		!drm_connector_state_is_modeset(state);
+}
+
+/**
+ * Compute the LUT of the transition at the given time. Returns true if this
+ * is the last step.
+ */
+static bool gamma_transition_interpolate(struct wlr_drm_connector *conn,
+		int64_t now, uint16_t *lut) {
+	double progress = (double)(now - conn->gamma_transition.start_ms) /
+		conn->gamma_transition.duration_ms;
+	if (progress >= 1) {
+		memcpy(lut, conn->gamma_transition.to,
+			3 * conn->gamma_transition.size * sizeof(uint16_t));
+		return true;
+	}
+	if (progress < 0) {
+		progress = 0;
+	}
+
+	const uint16_t *from = conn->gamma_transition.from;
+	const uint16_t *to = conn->gamma_transition.to;
+	for (size_t i = 0; i < 3 * conn->gamma_transition.size; i++) {
+		lut[i] = round(from[i] + (to[i] - (double)from[i]) * progress);
+	}
+	return false;
+}
+
+static bool create_fb_damage_clips_blob(struct wlr_drm_backend *drm,
+		int width, int height, const pixman_region32_t *damage,
+		uint32_t *blob_id) {
+	pixman_region32_t clipped;
+	pixman_region32_init(&clipped);
+	pixman_region32_intersect_rect(&clipped, damage, 0, 0, width, height);
+	wlr_region_coalesce(&clipped, &clipped, FB_DAMAGE_CLIPS_MAX);
+
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(&clipped, &rects_len);
+
+	// The kernel rejects empty blobs: use a single zero-sized rectangle to
+	// indicate that nothing has changed
+	struct drm_mode_rect empty = {0};
+	struct drm_mode_rect *clips = &empty;
+	if (rects_len > 0) {
+		clips = calloc(rects_len, sizeof(*clips));
+		if (clips == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			pixman_region32_fini(&clipped);
+			return false;
+		}
+		for (int i = 0; i < rects_len; i++) {
+			clips[i].x1 = rects[i].x1;
+			clips[i].y1 = rects[i].y1;
+			clips[i].x2 = rects[i].x2;
+			clips[i].y2 = rects[i].y2;
+		}
+	}
+
+	int ret = drmModeCreatePropertyBlob(drm->fd, clips,
+		(rects_len > 0 ? rects_len : 1) * sizeof(*clips), blob_id);
+	if (clips != &empty) {
+		free(clips);
 	}
-	if (next != 0) {
-		drmModeDestroyPropertyBlob(drm->fd, next);
+	pixman_region32_fini(&clipped);
+	if (ret != 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to create FB_DAMAGE_CLIPS property blob");
+		return false;
 	}
+
+	return true;
 }
 
 static void plane_disable(struct atomic *atom, struct wlr_drm_plane *plane) {
@@ -134,8 +267,28 @@ static void plane_disable(struct atomic *atom, struct wlr_drm_plane *plane) {
 	atomic_add(atom, id, props->crtc_id, 0);
 }
 
+static uint64_t drm_rotation_from_transform(enum wl_output_transform tr) {
+	// Both wl_output and KMS rotations are counter-clockwise, and KMS
+	// reflections are applied before rotations
+	static const uint64_t rotations[] = {
+		[WL_OUTPUT_TRANSFORM_NORMAL] = DRM_MODE_ROTATE_0,
+		[WL_OUTPUT_TRANSFORM_90] = DRM_MODE_ROTATE_90,
+		[WL_OUTPUT_TRANSFORM_180] = DRM_MODE_ROTATE_180,
+		[WL_OUTPUT_TRANSFORM_270] = DRM_MODE_ROTATE_270,
+		[WL_OUTPUT_TRANSFORM_FLIPPED] = DRM_MODE_REFLECT_X | DRM_MODE_ROTATE_0,
+		[WL_OUTPUT_TRANSFORM_FLIPPED_90] =
+			DRM_MODE_REFLECT_X | DRM_MODE_ROTATE_90,
+		[WL_OUTPUT_TRANSFORM_FLIPPED_180] =
+			DRM_MODE_REFLECT_X | DRM_MODE_ROTATE_180,
+		[WL_OUTPUT_TRANSFORM_FLIPPED_270] =
+			DRM_MODE_REFLECT_X | DRM_MODE_ROTATE_270,
+	};
+	return rotations[tr];
+}
+
 static void set_plane_props(struct atomic *atom, struct wlr_drm_backend *drm,
-		struct wlr_drm_plane *plane, uint32_t crtc_id, int32_t x, int32_t y) {
+		struct wlr_drm_plane *plane, uint32_t crtc_id, int32_t x, int32_t y,
+		uint64_t rotation) {
 	uint32_t id = plane->id;
 	const union wlr_drm_plane_props *props = &plane->props;
 	struct wlr_drm_fb *fb = plane_get_next_fb(plane);
@@ -147,17 +300,34 @@ static void set_plane_props(struct atomic *atom, struct wlr_drm_backend *drm,
 	uint32_t width = gbm_bo_get_width(fb->bo);
 	uint32_t height = gbm_bo_get_height(fb->bo);
 
+	struct wlr_fbox src_box = plane->layer_src_box;
+	if (src_box.width <= 0 || src_box.height <= 0) {
+		src_box = (struct wlr_fbox){ .width = width, .height = height };
+	}
+	uint32_t crtc_w = plane->layer_width > 0 ? (uint32_t)plane->layer_width :
+		(uint32_t)round(src_box.width);
+	uint32_t crtc_h = plane->layer_height > 0 ? (uint32_t)plane->layer_height :
+		(uint32_t)round(src_box.height);
+	if (rotation & (DRM_MODE_ROTATE_90 | DRM_MODE_ROTATE_270)) {
+		uint32_t tmp = crtc_w;
+		crtc_w = crtc_h;
+		crtc_h = tmp;
+	}
+
 	// The src_* properties are in 16.16 fixed point
-	atomic_add(atom, id, props->src_x, 0);
-	atomic_add(atom, id, props->src_y, 0);
-	atomic_add(atom, id, props->src_w, (uint64_t)width << 16);
-	atomic_add(atom, id, props->src_h, (uint64_t)height << 16);
-	atomic_add(atom, id, props->crtc_w, width);
-	atomic_add(atom, id, props->crtc_h, height);
+	atomic_add(atom, id, props->src_x, (uint64_t)(src_box.x * (1 << 16)));
+	atomic_add(atom, id, props->src_y, (uint64_t)(src_box.y * (1 << 16)));
+	atomic_add(atom, id, props->src_w, (uint64_t)(src_box.width * (1 << 16)));
+	atomic_add(atom, id, props->src_h, (uint64_t)(src_box.height * (1 << 16)));
+	atomic_add(atom, id, props->crtc_w, crtc_w);
+	atomic_add(atom, id, props->crtc_h, crtc_h);
 	atomic_add(atom, id, props->fb_id, fb->id);
 	atomic_add(atom, id, props->crtc_id, crtc_id);
 	atomic_add(atom, id, props->crtc_x, (uint64_t)x);
 	atomic_add(atom, id, props->crtc_y, (uint64_t)y);
+	if (rotation != 0 && props->rotation != 0) {
+		atomic_add(atom, id, props->rotation, rotation);
+	}
 
 	return;
 
@@ -166,109 +336,481 @@ error:
 	atom->failed = true;
 }
 
-static bool atomic_crtc_commit(struct wlr_drm_backend *drm,
-		struct wlr_drm_connector *conn, const struct wlr_output_state *state,
-		uint32_t flags) {
+// Per-connector state of an atomic request, kept until the request has been
+// committed or rolled back
+struct atomic_connector {
+	struct wlr_drm_connector *conn;
+	const struct wlr_output_state *state;
+	bool modeset, active;
+	// The mode switch may be accepted without a modeset
+	bool seamless;
+	uint32_t mode_id, gamma_lut, fb_damage_clips;
+	// Gamma transition: the new target, or the step applied with this commit
+	bool gamma_transition_start, gamma_transition_done;
+	uint16_t *gamma_step;
+	int64_t now_ms;
+	bool prev_vrr_enabled, vrr_enabled;
+	uint64_t rotation; // of the primary plane, zero to leave unchanged
+	// Filled by the kernel with a fence signalled when the new state is
+	// latched, i.e. when the previous buffers aren't scanned out anymore
+	int out_fence_fd;
+	// Writeback connector capturing this commit, if any, and the fence
+	// signalled once it's done writing
+	struct wlr_drm_writeback *capture;
+	int capture_fence_fd;
+};
+
+static bool atomic_connector_prepare(struct atomic_connector *ac,
+		struct wlr_drm_backend *drm, struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
 	struct wlr_output *output = &conn->output;
 	struct wlr_drm_crtc *crtc = conn->crtc;
 
-	bool modeset = drm_connector_state_is_modeset(state);
-	bool active = drm_connector_state_active(conn, state);
+	ac->conn = conn;
+	ac->state = state;
+	ac->modeset = drm_connector_state_is_modeset(state);
+	ac->seamless = ac->modeset && drm_connector_state_is_seamless(conn, state);
+	ac->active = drm_connector_state_active(conn, state);
+	ac->out_fence_fd = -1;
+
+	ac->capture = NULL;
+	ac->capture_fence_fd = -1;
+	if (conn->capture != NULL && ac->active &&
+			(state->committed & WLR_OUTPUT_STATE_BUFFER)) {
+		ac->capture = conn->capture;
+	}
 
-	uint32_t mode_id = crtc->mode_id;
-	if (modeset) {
-		if (!create_mode_blob(drm, conn, state, &mode_id)) {
+	ac->mode_id = crtc->mode_id;
+	if (ac->modeset) {
+		if (!create_mode_blob(drm, conn, state, &ac->mode_id)) {
 			return false;
 		}
 	}
 
-	uint32_t gamma_lut = crtc->gamma_lut;
+	ac->gamma_lut = crtc->gamma_lut;
+	ac->gamma_transition_start = false;
+	ac->gamma_transition_done = false;
+	ac->gamma_step = NULL;
+	ac->now_ms = 0;
 	if (state->committed & WLR_OUTPUT_STATE_GAMMA_LUT) {
 		// Fallback to legacy gamma interface when gamma properties are not
 		// available (can happen on older Intel GPUs that support gamma but not
 		// degamma).
+		bool ok = true;
 		if (crtc->props.gamma_lut == 0) {
-			if (!drm_legacy_crtc_set_gamma(drm, crtc,
-					state->gamma_lut_size,
-					state->gamma_lut)) {
+			ok = drm_legacy_crtc_set_gamma(drm, crtc,
+				state->gamma_lut_size, state->gamma_lut);
+		} else if (gamma_transition_can_start(conn, state)) {
+			// The current LUT is kept, the transition starts with the
+			// next frame
+			ac->gamma_transition_start = true;
+		} else {
+			ok = create_gamma_lut_blob(drm, crtc, state->gamma_lut_size,
+				state->gamma_lut, &ac->gamma_lut);
+		}
+		if (!ok) {
+			return false;
+		}
+	} else if (conn->gamma_transition.active && crtc->props.gamma_lut != 0 &&
+			!ac->modeset && (state->committed & WLR_OUTPUT_STATE_BUFFER)) {
+		ac->now_ms = get_time_ms(drm);
+		if (ac->now_ms - conn->gamma_transition.last_step_ms >=
+				GAMMA_TRANSITION_STEP_MS) {
+			size_t size = conn->gamma_transition.size;
+			ac->gamma_step = malloc(3 * size * sizeof(uint16_t));
+			if (ac->gamma_step == NULL) {
+				wlr_log_errno(WLR_ERROR, "Allocation failed");
 				return false;
 			}
-		} else {
-			if (!create_gamma_lut_blob(drm, state->gamma_lut_size,
-					state->gamma_lut, &gamma_lut)) {
+			ac->gamma_transition_done =
+				gamma_transition_interpolate(conn, ac->now_ms, ac->gamma_step);
+			bool ok;
+			if (ac->gamma_transition_done && conn->gamma_transition.to_reset) {
+				ac->gamma_lut = 0;
+				ok = true;
+			} else {
+				ok = create_gamma_lut_blob(drm, crtc, size, ac->gamma_step,
+					&ac->gamma_lut);
+			}
+			if (!ok) {
+				free(ac->gamma_step);
+				ac->gamma_step = NULL;
 				return false;
 			}
 		}
 	}
 
-	bool prev_vrr_enabled =
+	// Let the driver only upload or refresh the changed area of the primary
+	// plane. Without damage clips, the whole plane is considered damaged. This
+	// is optional, so failing to create the blob isn't fatal.
+	ac->fb_damage_clips = 0;
+	if (!ac->modeset && ac->active &&
+			crtc->primary->props.fb_damage_clips != 0 &&
+			(state->committed & WLR_OUTPUT_STATE_BUFFER) &&
+			(state->committed & WLR_OUTPUT_STATE_DAMAGE) &&
+			!(state->committed & WLR_OUTPUT_STATE_BUFFER_TRANSFORM)) {
+		create_fb_damage_clips_blob(drm, output->width, output->height,
+			&state->damage, &ac->fb_damage_clips);
+	}
+
+	// Reset the rotation when a buffer is committed without a transform, but
+	// leave it untouched if it's never been set, in case another client (e.g.
+	// fbcon) left the plane rotated on purpose
+	ac->rotation = crtc->primary->rotation;
+	if (state->committed & WLR_OUTPUT_STATE_BUFFER_TRANSFORM) {
+		ac->rotation = drm_rotation_from_transform(state->buffer_transform);
+	} else if ((state->committed & WLR_OUTPUT_STATE_BUFFER) &&
+			ac->rotation != 0) {
+		ac->rotation = DRM_MODE_ROTATE_0;
+	}
+
+	ac->prev_vrr_enabled =
 		output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED;
-	bool vrr_enabled = prev_vrr_enabled;
+	ac->vrr_enabled = ac->prev_vrr_enabled;
 	if ((state->committed & WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED) &&
 			drm_connector_supports_vrr(conn)) {
-		vrr_enabled = state->adaptive_sync_enabled;
+		ac->vrr_enabled = state->adaptive_sync_enabled;
 	}
 
-	if (modeset) {
-		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
-	} else if (!(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
-		flags |= DRM_MODE_ATOMIC_NONBLOCK;
+	return true;
+}
+
+static void atomic_connector_add(struct atomic *atom,
+		struct wlr_drm_backend *drm, struct atomic_connector *ac,
+		uint32_t flags) {
+	struct wlr_drm_connector *conn = ac->conn;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	const struct wlr_output_state *state = ac->state;
+
+	if (flags & DRM_MODE_PAGE_FLIP_ASYNC) {
+		// Async commits can only change the primary plane's FB, see
+		// drm_connector_can_tear
+		struct wlr_drm_fb *fb = plane_get_next_fb(crtc->primary);
+		if (fb == NULL) {
+			wlr_log(WLR_ERROR, "Failed to acquire FB");
+			atom->failed = true;
+			return;
+		}
+		atomic_add(atom, crtc->primary->id, crtc->primary->props.fb_id,
+			fb->id);
+		if (state->committed & WLR_OUTPUT_STATE_IN_FENCE) {
+			atomic_add(atom, crtc->primary->id,
+				crtc->primary->props.in_fence_fd, state->in_fence_fd);
+		}
+		return;
 	}
 
-	struct atomic atom;
-	atomic_begin(&atom);
-	atomic_add(&atom, conn->id, conn->props.crtc_id, active ? crtc->id : 0);
-	if (modeset && active && conn->props.link_status != 0) {
-		atomic_add(&atom, conn->id, conn->props.link_status,
+	atomic_add(atom, conn->id, conn->props.crtc_id, ac->active ? crtc->id : 0);
+	if (ac->modeset && ac->active && conn->props.link_status != 0) {
+		atomic_add(atom, conn->id, conn->props.link_status,
 			DRM_MODE_LINK_STATUS_GOOD);
 	}
-	atomic_add(&atom, crtc->id, crtc->props.mode_id, mode_id);
-	atomic_add(&atom, crtc->id, crtc->props.active, active);
-	if (active) {
+	atomic_add(atom, crtc->id, crtc->props.mode_id, ac->mode_id);
+	atomic_add(atom, crtc->id, crtc->props.active, ac->active);
+	if (ac->active) {
 		if (crtc->props.gamma_lut != 0) {
-			atomic_add(&atom, crtc->id, crtc->props.gamma_lut, gamma_lut);
+			atomic_add(atom, crtc->id, crtc->props.gamma_lut, ac->gamma_lut);
 		}
 		if (crtc->props.vrr_enabled != 0) {
-			atomic_add(&atom, crtc->id, crtc->props.vrr_enabled, vrr_enabled);
+			atomic_add(atom, crtc->id, crtc->props.vrr_enabled,
+				ac->vrr_enabled);
+		}
+		if (crtc->props.out_fence_ptr != 0 &&
+				!(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+			atomic_add(atom, crtc->id, crtc->props.out_fence_ptr,
+				(uintptr_t)&ac->out_fence_fd);
+		}
+		set_plane_props(atom, drm, crtc->primary, crtc->id, 0, 0,
+			ac->rotation);
+		if (crtc->primary->props.fb_damage_clips != 0) {
+			atomic_add(atom, crtc->primary->id,
+				crtc->primary->props.fb_damage_clips, ac->fb_damage_clips);
+		}
+		if (state->committed & WLR_OUTPUT_STATE_IN_FENCE) {
+			atomic_add(atom, crtc->primary->id,
+				crtc->primary->props.in_fence_fd, state->in_fence_fd);
+		}
+		if (ac->capture != NULL) {
+			struct wlr_drm_writeback *wb = ac->capture;
+			atomic_add(atom, wb->id, wb->props.crtc_id, crtc->id);
+			atomic_add(atom, wb->id, wb->props.writeback_fb_id,
+				wb->pending_fb->id);
+			if (!(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+				atomic_add(atom, wb->id, wb->props.writeback_out_fence_ptr,
+					(uintptr_t)&ac->capture_fence_fd);
+			}
 		}
-		set_plane_props(&atom, drm, crtc->primary, crtc->id, 0, 0);
 		if (crtc->cursor) {
 			if (drm_connector_is_cursor_visible(conn)) {
-				set_plane_props(&atom, drm, crtc->cursor, crtc->id,
-					conn->cursor_x, conn->cursor_y);
+				set_plane_props(atom, drm, crtc->cursor, crtc->id,
+					conn->cursor_x, conn->cursor_y, 0);
 			} else {
-				plane_disable(&atom, crtc->cursor);
+				plane_disable(atom, crtc->cursor);
+			}
+		}
+		if (state->committed & WLR_OUTPUT_STATE_LAYERS) {
+			for (size_t i = 0; i < crtc->num_overlays; i++) {
+				struct wlr_drm_plane *plane = crtc->overlays[i];
+				if (plane->pending_fb != NULL) {
+					set_plane_props(atom, drm, plane, crtc->id,
+						plane->layer_x, plane->layer_y, 0);
+				} else {
+					plane_disable(atom, plane);
+				}
 			}
 		}
 	} else {
-		plane_disable(&atom, crtc->primary);
+		// An inactive CRTC can't have connectors
+		struct wlr_drm_writeback *wb;
+		wl_list_for_each(wb, &drm->writebacks, link) {
+			if (wb->crtc == crtc) {
+				atomic_add(atom, wb->id, wb->props.crtc_id, 0);
+			}
+		}
+
+		plane_disable(atom, crtc->primary);
 		if (crtc->cursor) {
-			plane_disable(&atom, crtc->cursor);
+			plane_disable(atom, crtc->cursor);
+		}
+		for (size_t i = 0; i < crtc->num_overlays; i++) {
+			plane_disable(atom, crtc->overlays[i]);
 		}
 	}
+}
 
-	bool ok = atomic_commit(&atom, conn, flags);
-	atomic_finish(&atom);
+/**
+ * Update the gamma transition after a successful commit.
+ */
+static void atomic_connector_finish_gamma(struct atomic_connector *ac,
+		struct wlr_drm_backend *drm) {
+	struct wlr_drm_connector *conn = ac->conn;
+	const struct wlr_output_state *state = ac->state;
+	size_t crtc_size = conn->crtc->gamma_lut_size;
+
+	if (ac->gamma_transition_start) {
+		if (!gamma_transition_ensure_size(conn, crtc_size)) {
+			return;
+		}
+		size_t len = 3 * crtc_size * sizeof(uint16_t);
+		memcpy(conn->gamma_transition.from, conn->gamma_transition.current, len);
+		conn->gamma_transition.to_reset = state->gamma_lut_size == 0;
+		if (conn->gamma_transition.to_reset) {
+			set_identity_lut(conn->gamma_transition.to, crtc_size);
+		} else {
+			memcpy(conn->gamma_transition.to, state->gamma_lut, len);
+		}
+		conn->gamma_transition.active = true;
+		conn->gamma_transition.start_ms = get_time_ms(drm);
+		conn->gamma_transition.last_step_ms = conn->gamma_transition.start_ms;
+		wlr_output_update_needs_frame(&conn->output);
+	} else if (ac->gamma_step != NULL) {
+		memcpy(conn->gamma_transition.current, ac->gamma_step,
+			3 * conn->gamma_transition.size * sizeof(uint16_t));
+		conn->gamma_transition.last_step_ms = ac->now_ms;
+		conn->gamma_transition.active = !ac->gamma_transition_done;
+	} else if ((state->committed & WLR_OUTPUT_STATE_GAMMA_LUT) &&
+			conn->gamma_transition.duration_ms > 0 && crtc_size > 0 &&
+			conn->crtc->props.gamma_lut != 0) {
+		// Applied right away: remember it to fade the next change from it
+		if (state->gamma_lut_size != 0 && state->gamma_lut_size != crtc_size) {
+			drm_connector_reset_gamma_transition(conn);
+			return;
+		}
+		if (!gamma_transition_ensure_size(conn, crtc_size)) {
+			return;
+		}
+		conn->gamma_transition.active = false;
+		if (state->gamma_lut_size == 0) {
+			set_identity_lut(conn->gamma_transition.current, crtc_size);
+		} else {
+			memcpy(conn->gamma_transition.current, state->gamma_lut,
+				3 * crtc_size * sizeof(uint16_t));
+		}
+	}
+}
+
+static void atomic_connector_finish(struct atomic_connector *ac,
+		struct wlr_drm_backend *drm, bool ok, uint32_t flags) {
+	struct wlr_drm_connector *conn = ac->conn;
+	struct wlr_output *output = &conn->output;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+
+	// The kernel keeps a reference to the damage clips blob during the commit
+	if (ac->fb_damage_clips != 0) {
+		drmModeDestroyPropertyBlob(drm->fd, ac->fb_damage_clips);
+	}
 
 	if (ok && !(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
-		commit_blob(drm, &crtc->mode_id, mode_id);
-		commit_blob(drm, &crtc->gamma_lut, gamma_lut);
+		// Blobs stay in the caches, to be re-used
+		crtc->mode_id = ac->mode_id;
+		crtc->gamma_lut = ac->gamma_lut;
+		crtc->primary->rotation = ac->rotation;
+		atomic_connector_finish_gamma(ac, drm);
+
+		if (output->out_fence_fd >= 0) {
+			close(output->out_fence_fd);
+		}
+		output->out_fence_fd = ac->out_fence_fd;
+
+		if (ac->modeset && !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"Switched mode without a modeset");
+		}
 
-		if (vrr_enabled != prev_vrr_enabled) {
-			output->adaptive_sync_status = vrr_enabled ?
+		if (ac->vrr_enabled != ac->prev_vrr_enabled) {
+			output->adaptive_sync_status = ac->vrr_enabled ?
 				WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED :
 				WLR_OUTPUT_ADAPTIVE_SYNC_DISABLED;
 			wlr_drm_conn_log(conn, WLR_DEBUG, "VRR %s",
-				vrr_enabled ? "enabled" : "disabled");
+				ac->vrr_enabled ? "enabled" : "disabled");
+		}
+
+		if (!ac->active) {
+			struct wlr_drm_writeback *wb;
+			wl_list_for_each(wb, &drm->writebacks, link) {
+				if (wb->crtc == crtc) {
+					wb->crtc = NULL;
+				}
+			}
 		}
 	} else {
-		rollback_blob(drm, &crtc->mode_id, mode_id);
-		rollback_blob(drm, &crtc->gamma_lut, gamma_lut);
+		if (ac->out_fence_fd >= 0) {
+			close(ac->out_fence_fd);
+		}
+	}
+
+	// Tearing page-flips can't carry the writeback job, it stays pending
+	if (ac->capture != NULL && !(flags & DRM_MODE_ATOMIC_TEST_ONLY) &&
+			!(flags & DRM_MODE_PAGE_FLIP_ASYNC)) {
+		drm_writeback_commit_done(ac->capture, ok, ac->capture_fence_fd);
+	}
+
+	free(ac->gamma_step);
+}
+
+static uint32_t atomic_nonblock_flags(uint32_t flags) {
+	if (flags & DRM_MODE_ATOMIC_TEST_ONLY) {
+		return flags;
+	}
+	// Modesets are only non-blocking when a page-flip event tells us about
+	// their completion, so that they don't stall the event loop
+	if (!(flags & DRM_MODE_ATOMIC_ALLOW_MODESET) ||
+			(flags & DRM_MODE_PAGE_FLIP_EVENT)) {
+		flags |= DRM_MODE_ATOMIC_NONBLOCK;
+	}
+	return flags;
+}
+
+/**
+ * Check whether the connectors need a modeset. Drivers accept some mode
+ * switches without one, e.g. when they can stretch the vertical blanking on
+ * the fly. Those are tested first, to fall back to a modeset otherwise.
+ */
+static bool atomic_needs_modeset(struct wlr_drm_backend *drm,
+		struct atomic_connector *acs, size_t acs_len, uint32_t flags) {
+	bool modeset = false;
+	for (size_t i = 0; i < acs_len; i++) {
+		if (acs[i].modeset && !acs[i].seamless) {
+			return true;
+		}
+		// Routing a writeback connector to the CRTC is a modeset
+		if (acs[i].capture != NULL &&
+				acs[i].capture->crtc != acs[i].conn->crtc) {
+			return true;
+		}
+		modeset = modeset || acs[i].modeset;
 	}
+	if (!modeset) {
+		return false;
+	}
+	if (flags & DRM_MODE_ATOMIC_TEST_ONLY) {
+		// Accepted either way
+		return true;
+	}
+
+	flags = (flags & ~DRM_MODE_PAGE_FLIP_EVENT) | DRM_MODE_ATOMIC_TEST_ONLY;
+	struct atomic atom;
+	atomic_begin(&atom);
+	for (size_t i = 0; i < acs_len; i++) {
+		atomic_connector_add(&atom, drm, &acs[i], flags);
+	}
+	bool ok = atomic_commit(&atom, drm, acs_len == 1 ? acs[0].conn : NULL,
+		flags);
+	atomic_finish(&atom);
+	if (!ok) {
+		wlr_log(WLR_DEBUG, "Seamless mode switch rejected, "
+			"falling back to a modeset");
+	}
+	return !ok;
+}
 
+static bool atomic_crtc_commit(struct wlr_drm_backend *drm,
+		struct wlr_drm_connector *conn, const struct wlr_output_state *state,
+		uint32_t flags) {
+	struct atomic_connector ac;
+	if (!atomic_connector_prepare(&ac, drm, conn, state)) {
+		return false;
+	}
+
+	if (atomic_needs_modeset(drm, &ac, 1, flags)) {
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+	flags = atomic_nonblock_flags(flags);
+
+	struct atomic atom;
+	atomic_begin(&atom);
+	atomic_connector_add(&atom, drm, &ac, flags);
+	bool ok = atomic_commit(&atom, drm, conn, flags);
+	atomic_finish(&atom);
+
+	atomic_connector_finish(&ac, drm, ok, flags);
+	return ok;
+}
+
+static bool atomic_commit_connectors(struct wlr_drm_backend *drm,
+		const struct wlr_drm_connector_commit *commits, size_t commits_len,
+		uint32_t flags) {
+	struct atomic_connector *acs = calloc(commits_len, sizeof(*acs));
+	if (acs == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+
+	bool ok = true;
+	size_t prepared = 0;
+	for (; prepared < commits_len; prepared++) {
+		const struct wlr_drm_connector_commit *commit = &commits[prepared];
+		if (!atomic_connector_prepare(&acs[prepared], drm, commit->conn,
+				&commit->state)) {
+			ok = false;
+			break;
+		}
+	}
+
+	if (ok) {
+		if (atomic_needs_modeset(drm, acs, commits_len, flags)) {
+			flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+		}
+		flags = atomic_nonblock_flags(flags);
+
+		struct atomic atom;
+		atomic_begin(&atom);
+		for (size_t i = 0; i < commits_len; i++) {
+			atomic_connector_add(&atom, drm, &acs[i], flags);
+		}
+		ok = atomic_commit(&atom, drm,
+			commits_len == 1 ? commits[0].conn : NULL, flags);
+		atomic_finish(&atom);
+	}
+
+	for (size_t i = 0; i < prepared; i++) {
+		atomic_connector_finish(&acs[i], drm, ok, flags);
+	}
+	free(acs);
 	return ok;
 }
 
 const struct wlr_drm_interface atomic_iface = {
 	.crtc_commit = atomic_crtc_commit,
+	.commit_connectors = atomic_commit_connectors,
 };
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <drm_fourcc.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +13,7 @@
 #include <wlr/util/log.h>
 #include <xf86drm.h>
 #include "backend/drm/drm.h"
+#include "util/priority_loop.h"
 #include "util/signal.h"
 
 struct wlr_drm_backend *get_drm_backend_from_backend(
@@ -22,7 +24,7 @@ struct wlr_drm_backend *get_drm_backend_from_backend(
 
 static bool backend_start(struct wlr_backend *backend) {
 	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
-	scan_drm_connectors(drm);
+	scan_drm_connectors(drm, NULL);
 	return true;
 }
 
@@ -33,6 +35,7 @@ static void backend_destroy(struct wlr_backend *backend) {
 
 	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
 
+	cancel_drm_connector_probe(drm);
 	restore_drm_outputs(drm);
 
 	struct wlr_drm_connector *conn, *next;
@@ -40,12 +43,23 @@ static void backend_destroy(struct wlr_backend *backend) {
 		destroy_drm_connector(conn);
 	}
 
+	struct wlr_drm_writeback *wb, *wb_tmp;
+	wl_list_for_each_safe(wb, wb_tmp, &drm->writebacks, link) {
+		drm_writeback_destroy(wb);
+	}
+
 	wlr_backend_finish(backend);
 
+	wlr_log(WLR_DEBUG, "DRM framebuffer cache: %"PRIu64" hits, "
+		"%"PRIu64" misses, %"PRIu64" evictions",
+		drm->fb_cache_stats.hits, drm->fb_cache_stats.misses,
+		drm->fb_cache_stats.evictions);
+
 	struct wlr_drm_fb *fb, *fb_tmp;
 	wl_list_for_each_safe(fb, fb_tmp, &drm->fbs, link) {
 		drm_fb_destroy(fb);
 	}
+	drm_modeset_tests_clear(drm);
 
 	wl_list_remove(&drm->display_destroy.link);
 	wl_list_remove(&drm->session_destroy.link);
@@ -93,6 +107,13 @@ static uint32_t backend_get_buffer_caps(struct wlr_backend *backend) {
 	return WLR_BUFFER_CAP_DMABUF;
 }
 
+static bool backend_commit_outputs(struct wlr_backend *backend,
+		struct wlr_output *const *outputs, size_t outputs_len,
+		bool test_only) {
+	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
+	return drm_commit_outputs(drm, outputs, outputs_len, test_only);
+}
+
 static const struct wlr_backend_impl backend_impl = {
 	.start = backend_start,
 	.destroy = backend_destroy,
@@ -100,6 +121,7 @@ static const struct wlr_backend_impl backend_impl = {
 	.get_presentation_clock = backend_get_presentation_clock,
 	.get_drm_fd = backend_get_drm_fd,
 	.get_buffer_caps = backend_get_buffer_caps,
+	.commit_outputs = backend_commit_outputs,
 };
 
 bool wlr_backend_is_drm(struct wlr_backend *b) {
@@ -113,7 +135,13 @@ static void handle_session_active(struct wl_listener *listener, void *data) {
 
 	if (session->active) {
 		wlr_log(WLR_INFO, "DRM fd resumed");
-		scan_drm_connectors(drm);
+		// Another DRM master may have changed the hardware state
+		drm_modeset_tests_clear(drm);
+		scan_drm_connectors(drm, NULL);
+
+		if (drm_resume_outputs(drm)) {
+			return;
+		}
 
 		struct wlr_drm_connector *conn;
 		wl_list_for_each(conn, &drm->outputs, link) {
@@ -141,8 +169,9 @@ static void handle_dev_change(struct wl_listener *listener, void *data) {
 		return;
 	}
 
+	struct wlr_device_change_event *event = data;
 	wlr_log(WLR_DEBUG, "%s invalidated", drm->name);
-	scan_drm_connectors(drm);
+	scan_drm_connectors(drm, event);
 }
 
 static void handle_dev_remove(struct wl_listener *listener, void *data) {
@@ -191,6 +220,8 @@ struct wlr_backend *wlr_drm_backend_create(struct wl_display *display,
 	drm->session = session;
 	wl_list_init(&drm->fbs);
 	wl_list_init(&drm->outputs);
+	wl_list_init(&drm->writebacks);
+	wl_list_init(&drm->modeset_tests);
 
 	drm->dev = dev;
 	drm->fd = dev->fd;
@@ -213,9 +244,14 @@ struct wlr_backend *wlr_drm_backend_create(struct wl_display *display,
 
 	drm->display = display;
 
-	struct wl_event_loop *event_loop = wl_display_get_event_loop(display);
-	drm->drm_event = wl_event_loop_add_fd(event_loop, drm->fd,
-		WL_EVENT_READABLE, handle_drm_event, NULL);
+	// Page-flip events drive frame scheduling, don't queue them behind
+	// clients
+	struct wl_event_loop *event_loop = get_priority_event_loop(display);
+	drm->drm_event = NULL;
+	if (event_loop != NULL) {
+		drm->drm_event = wl_event_loop_add_fd(event_loop, drm->fd,
+			WL_EVENT_READABLE, handle_drm_event, NULL);
+	}
 	if (!drm->drm_event) {
 		wlr_log(WLR_ERROR, "Failed to create DRM event source");
 		goto error_fd;
@@ -272,6 +308,8 @@ struct wlr_backend *wlr_drm_backend_create(struct wl_display *display,
 	drm->display_destroy.notify = handle_display_destroy;
 	wl_display_add_destroy_listener(display, &drm->display_destroy);
 
+	start_drm_connector_probe(drm);
+
 	return &drm->backend;
 
 error_event:
@@ -28,14 +28,23 @@
 #include "render/drm_format_set.h"
 #include "render/swapchain.h"
 #include "render/wlr_renderer.h"
+#include "util/realtime.h"
 #include "util/signal.h"
+#include "util/time.h"
+#include "util/trace.h"
+
+#ifndef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+#define DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP 0x15
+#endif
 
 static const uint32_t SUPPORTED_OUTPUT_STATE =
 	WLR_OUTPUT_STATE_BACKEND_OPTIONAL |
 	WLR_OUTPUT_STATE_BUFFER |
 	WLR_OUTPUT_STATE_MODE |
 	WLR_OUTPUT_STATE_ENABLED |
-	WLR_OUTPUT_STATE_GAMMA_LUT;
+	WLR_OUTPUT_STATE_GAMMA_LUT |
+	WLR_OUTPUT_STATE_IN_FENCE |
+	WLR_OUTPUT_STATE_BUFFER_TRANSFORM;
 
 bool check_drm_features(struct wlr_drm_backend *drm) {
 	if (drmGetCap(drm->fd, DRM_CAP_CURSOR_WIDTH, &drm->cursor_width)) {
@@ -83,11 +92,23 @@ bool check_drm_features(struct wlr_drm_backend *drm) {
 	} else {
 		wlr_log(WLR_DEBUG, "Using atomic DRM interface");
 		drm->iface = &atomic_iface;
+
+		// Writeback connectors are only exposed to clients asking for them
+		if (drmSetClientCap(drm->fd, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1)) {
+			wlr_log(WLR_DEBUG, "Writeback connectors unsupported");
+		}
 	}
 
 	int ret = drmGetCap(drm->fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap);
 	drm->clock = (ret == 0 && cap == 1) ? CLOCK_MONOTONIC : CLOCK_REALTIME;
 
+	uint64_t async_cap = drm->iface == &legacy_iface ?
+		DRM_CAP_ASYNC_PAGE_FLIP : DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP;
+	ret = drmGetCap(drm->fd, async_cap, &cap);
+	drm->async_page_flip = ret == 0 && cap == 1;
+	wlr_log(WLR_DEBUG, "Tearing page-flips %s",
+		drm->async_page_flip ? "supported" : "unsupported");
+
 	const char *no_modifiers = getenv("WLR_DRM_NO_MODIFIERS");
 	if (no_modifiers != NULL && strcmp(no_modifiers, "1") == 0) {
 		wlr_log(WLR_DEBUG, "WLR_DRM_NO_MODIFIERS set, disabling modifiers");
@@ -117,6 +138,11 @@ static bool add_plane(struct wlr_drm_backend *drm,
 	p->id = drm_plane->plane_id;
 	p->props = *props;
 
+	if (p->props.zpos != 0 &&
+			!get_drm_prop(drm->fd, p->id, p->props.zpos, &p->zpos)) {
+		p->zpos = 0;
+	}
+
 	for (size_t j = 0; j < drm_plane->count_formats; ++j) {
 		wlr_drm_format_set_add(&p->formats, drm_plane->formats[j],
 			DRM_FORMAT_MOD_INVALID);
@@ -165,6 +191,24 @@ static bool add_plane(struct wlr_drm_backend *drm,
 	case DRM_PLANE_TYPE_CURSOR:
 		crtc->cursor = p;
 		break;
+	case DRM_PLANE_TYPE_OVERLAY:;
+		struct wlr_drm_plane **overlays = realloc(crtc->overlays,
+			(crtc->num_overlays + 1) * sizeof(crtc->overlays[0]));
+		if (overlays == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			goto error;
+		}
+		crtc->overlays = overlays;
+
+		// Keep the list sorted by stacking order
+		size_t i = crtc->num_overlays;
+		while (i > 0 && crtc->overlays[i - 1]->zpos > p->zpos) {
+			crtc->overlays[i] = crtc->overlays[i - 1];
+			i--;
+		}
+		crtc->overlays[i] = p;
+		crtc->num_overlays++;
+		break;
 	default:
 		abort();
 	}
@@ -172,6 +216,7 @@ static bool add_plane(struct wlr_drm_backend *drm,
 	return true;
 
 error:
+	wlr_drm_format_set_finish(&p->formats);
 	free(p);
 	return false;
 }
@@ -206,13 +251,6 @@ static bool init_planes(struct wlr_drm_backend *drm) {
 			goto error;
 		}
 
-		// We don't really care about overlay planes, as we don't support them
-		// yet.
-		if (type == DRM_PLANE_TYPE_OVERLAY) {
-			drmModeFreePlane(plane);
-			continue;
-		}
-
 		assert(drm->num_crtcs <= 32);
 		struct wlr_drm_crtc *crtc = NULL;
 		for (size_t j = 0; j < drm->num_crtcs ; j++) {
@@ -222,7 +260,15 @@ static bool init_planes(struct wlr_drm_backend *drm) {
 			}
 
 			struct wlr_drm_crtc *candidate = &drm->crtcs[j];
-			if ((type == DRM_PLANE_TYPE_PRIMARY && !candidate->primary) ||
+			if (type == DRM_PLANE_TYPE_OVERLAY) {
+				// Overlay planes are often usable by multiple CRTCs. Spread
+				// them evenly, since a plane can only be used by a single
+				// CRTC at a time.
+				if (crtc == NULL ||
+						candidate->num_overlays < crtc->num_overlays) {
+					crtc = candidate;
+				}
+			} else if ((type == DRM_PLANE_TYPE_PRIMARY && !candidate->primary) ||
 					(type == DRM_PLANE_TYPE_CURSOR && !candidate->cursor)) {
 				crtc = candidate;
 				break;
@@ -275,6 +321,13 @@ bool init_drm_resources(struct wlr_drm_backend *drm) {
 		crtc->id = res->crtcs[i];
 		crtc->legacy_crtc = drmModeGetCrtc(drm->fd, crtc->id);
 		get_drm_crtc_props(drm->fd, crtc->id, &crtc->props);
+
+		uint64_t gamma_lut_size;
+		if (crtc->props.gamma_lut_size != 0 &&
+				get_drm_prop(drm->fd, crtc->id, crtc->props.gamma_lut_size,
+				&gamma_lut_size)) {
+			crtc->gamma_lut_size = gamma_lut_size;
+		}
 	}
 
 	if (!init_planes(drm)) {
@@ -301,13 +354,10 @@ void finish_drm_resources(struct wlr_drm_backend *drm) {
 		struct wlr_drm_crtc *crtc = &drm->crtcs[i];
 
 		drmModeFreeCrtc(crtc->legacy_crtc);
+		drm_legacy_crtc_finish(crtc);
 
-		if (crtc->mode_id) {
-			drmModeDestroyPropertyBlob(drm->fd, crtc->mode_id);
-		}
-		if (crtc->gamma_lut) {
-			drmModeDestroyPropertyBlob(drm->fd, crtc->gamma_lut);
-		}
+		drm_blob_cache_finish(drm->fd, &crtc->mode_blobs);
+		drm_blob_cache_finish(drm->fd, &crtc->gamma_blobs);
 
 		if (crtc->primary) {
 			wlr_drm_format_set_finish(&crtc->primary->formats);
@@ -317,6 +367,11 @@ void finish_drm_resources(struct wlr_drm_backend *drm) {
 			wlr_drm_format_set_finish(&crtc->cursor->formats);
 			free(crtc->cursor);
 		}
+		for (size_t j = 0; j < crtc->num_overlays; j++) {
+			wlr_drm_format_set_finish(&crtc->overlays[j]->formats);
+			free(crtc->overlays[j]);
+		}
+		free(crtc->overlays);
 	}
 
 	free(drm->crtcs);
@@ -331,7 +386,12 @@ static struct wlr_drm_connector *get_drm_connector_from_output(
 static bool drm_connector_attach_render(struct wlr_output *output,
 		int *buffer_age) {
 	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
-	return drm_surface_make_current(&conn->crtc->primary->surf, buffer_age);
+	struct wlr_drm_surface *surf = &conn->crtc->primary->surf;
+	if (output->swapchain_depth != 0 && surf->swapchain != NULL &&
+			surf->swapchain->num_slots != output->swapchain_depth) {
+		wlr_swapchain_set_num_slots(surf->swapchain, output->swapchain_depth);
+	}
+	return drm_surface_make_current(surf, buffer_age);
 }
 
 static void drm_plane_set_committed(struct wlr_drm_plane *plane) {
@@ -343,34 +403,96 @@ static void drm_plane_set_committed(struct wlr_drm_plane *plane) {
 	}
 }
 
+static void drm_connector_set_committed(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	conn->cursor_committed = crtc->cursor != NULL &&
+		drm_connector_state_active(conn, state) &&
+		drm_connector_is_cursor_visible(conn);
+
+	drm_plane_set_committed(crtc->primary);
+	if (crtc->cursor != NULL) {
+		drm_plane_set_committed(crtc->cursor);
+	}
+	if (state->committed & WLR_OUTPUT_STATE_LAYERS) {
+		for (size_t i = 0; i < crtc->num_overlays; i++) {
+			struct wlr_drm_plane *plane = crtc->overlays[i];
+			drm_plane_set_committed(plane);
+			plane->layer_enabled = plane->queued_fb != NULL;
+		}
+	}
+}
+
+static void drm_crtc_clear_pending(struct wlr_drm_crtc *crtc) {
+	drm_fb_clear(&crtc->primary->pending_fb);
+	if (crtc->cursor != NULL) {
+		drm_fb_clear(&crtc->cursor->pending_fb);
+	}
+	for (size_t i = 0; i < crtc->num_overlays; i++) {
+		drm_fb_clear(&crtc->overlays[i]->pending_fb);
+	}
+}
+
 static bool drm_crtc_commit(struct wlr_drm_connector *conn,
 		const struct wlr_output_state *state, uint32_t flags) {
 	struct wlr_drm_backend *drm = conn->backend;
 	struct wlr_drm_crtc *crtc = conn->crtc;
 	bool ok = drm->iface->crtc_commit(drm, conn, state, flags);
 	if (ok && !(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
-		drm_plane_set_committed(crtc->primary);
-		if (crtc->cursor != NULL) {
-			drm_plane_set_committed(crtc->cursor);
-		}
+		drm_connector_set_committed(conn, state);
 	} else {
-		drm_fb_clear(&crtc->primary->pending_fb);
-		if (crtc->cursor != NULL) {
-			drm_fb_clear(&crtc->cursor->pending_fb);
-		}
+		drm_crtc_clear_pending(crtc);
 	}
 	return ok;
 }
 
+/**
+ * Check whether a tearing page-flip can be used for the state. Atomic async
+ * commits can only change the primary plane's FB, so anything else in the
+ * state requires a regular page-flip.
+ */
+static bool drm_connector_can_tear(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+
+	if (!(state->committed & WLR_OUTPUT_STATE_TEARING_PAGE_FLIP) ||
+			!drm->async_page_flip || drm_connector_state_is_modeset(state)) {
+		return false;
+	}
+	if (drm->iface == &legacy_iface) {
+		// Cursor and gamma updates are applied separately
+		return true;
+	}
+
+	if (state->committed & (WLR_OUTPUT_STATE_GAMMA_LUT |
+			WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED | WLR_OUTPUT_STATE_LAYERS |
+			WLR_OUTPUT_STATE_BUFFER_TRANSFORM)) {
+		return false;
+	}
+	if (crtc->primary->rotation > DRM_MODE_ROTATE_0) {
+		return false;
+	}
+	if (crtc->cursor != NULL && (conn->cursor_deferred ||
+			crtc->cursor->pending_fb != NULL ||
+			conn->cursor_committed != drm_connector_is_cursor_visible(conn))) {
+		return false;
+	}
+
+	// Drivers may refuse e.g. a modifier change in an async commit
+	return drm->iface->crtc_commit(drm, conn, state,
+		DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_PAGE_FLIP_ASYNC);
+}
+
 static bool drm_crtc_page_flip(struct wlr_drm_connector *conn,
 		const struct wlr_output_state *state) {
 	struct wlr_drm_crtc *crtc = conn->crtc;
 	assert(crtc != NULL);
 
 	// wlr_drm_interface.crtc_commit will perform either a non-blocking
-	// page-flip, either a blocking modeset. When performing a blocking modeset
-	// we'll wait for all queued page-flips to complete, so we don't need this
-	// safeguard.
+	// page-flip, either a modeset. Modesets wait for all queued page-flips to
+	// complete (non-blocking atomic modesets fall back to blocking ones when
+	// the kernel is busy), so we don't need this safeguard.
 	if (conn->pending_page_flip_crtc && !drm_connector_state_is_modeset(state)) {
 		wlr_drm_conn_log(conn, WLR_ERROR, "Failed to page-flip output: "
 			"a page-flip is already pending");
@@ -379,11 +501,17 @@ static bool drm_crtc_page_flip(struct wlr_drm_connector *conn,
 
 	assert(drm_connector_state_active(conn, state));
 	assert(plane_get_next_fb(crtc->primary));
-	if (!drm_crtc_commit(conn, state, DRM_MODE_PAGE_FLIP_EVENT)) {
+	bool tearing = drm_connector_can_tear(conn, state);
+	uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT;
+	if (tearing) {
+		flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+	}
+	if (!drm_crtc_commit(conn, state, flags)) {
 		return false;
 	}
 
 	conn->pending_page_flip_crtc = crtc->id;
+	conn->pending_page_flip_tearing = tearing;
 
 	// wlr_output's API guarantees that submitting a buffer will schedule a
 	// frame event. However the DRM backend will also schedule a frame event
@@ -432,33 +560,99 @@ static bool drm_connector_set_pending_fb(struct wlr_drm_connector *conn,
 	return true;
 }
 
+/**
+ * Assign output layers to overlay planes.
+ *
+ * If test is true, TEST_ONLY commits are used to find out which layers can be
+ * displayed with a plane, and their accepted field is updated. Otherwise, the
+ * layers which have been accepted by a previous test are assigned.
+ *
+ * Layers are assigned from top to bottom. The first layer which can't be
+ * displayed with a plane needs to be composited, and so do all layers below
+ * it.
+ */
+static void drm_connector_set_pending_layers(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state, bool test) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+
+	if (test) {
+		for (size_t i = 0; i < state->layers_len; i++) {
+			state->layers[i].accepted = false;
+		}
+	}
+
+	// Multi-GPU setups would need to blit each layer, and legacy KMS doesn't
+	// support overlay planes
+	if (crtc == NULL || crtc->num_overlays == 0 || drm->parent != NULL ||
+			drm->iface == &legacy_iface ||
+			plane_get_next_fb(crtc->primary) == NULL) {
+		return;
+	}
+
+	size_t plane_idx = crtc->num_overlays;
+	for (size_t i = state->layers_len; i-- > 0 && plane_idx > 0;) {
+		struct wlr_output_layer_state *layer_state = &state->layers[i];
+		if (layer_state->buffer == NULL) {
+			// Nothing to display
+			layer_state->accepted = true;
+			continue;
+		}
+		if (!test && !layer_state->accepted) {
+			break;
+		}
+
+		struct wlr_drm_plane *plane = crtc->overlays[plane_idx - 1];
+		if (!drm_fb_import(&plane->pending_fb, drm, layer_state->buffer,
+				&plane->formats)) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"Failed to import layer buffer on plane %"PRIu32, plane->id);
+			break;
+		}
+		plane->layer_x = layer_state->x;
+		plane->layer_y = layer_state->y;
+		plane->layer_src_box = layer_state->src_box;
+		plane->layer_width = layer_state->dst_width;
+		plane->layer_height = layer_state->dst_height;
+
+		if (test && !drm->iface->crtc_commit(drm, conn, state,
+				DRM_MODE_ATOMIC_TEST_ONLY)) {
+			drm_fb_clear(&plane->pending_fb);
+			break;
+		}
+
+		layer_state->accepted = true;
+		plane_idx--;
+	}
+}
+
 static bool drm_connector_alloc_crtc(struct wlr_drm_connector *conn);
 
-static bool drm_connector_test(struct wlr_output *output) {
-	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
+static bool drm_connector_check_state(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	struct wlr_output *output = &conn->output;
 
 	if (!conn->backend->session->active) {
 		return false;
 	}
 
-	uint32_t unsupported = output->pending.committed & ~SUPPORTED_OUTPUT_STATE;
+	uint32_t unsupported = state->committed & ~SUPPORTED_OUTPUT_STATE;
 	if (unsupported != 0) {
 		wlr_log(WLR_DEBUG, "Unsupported output state fields: 0x%"PRIx32,
 			unsupported);
 		return false;
 	}
 
-	if ((output->pending.committed & WLR_OUTPUT_STATE_ENABLED) &&
-			output->pending.enabled) {
+	if ((state->committed & WLR_OUTPUT_STATE_ENABLED) && state->enabled) {
 		if (output->current_mode == NULL &&
-				!(output->pending.committed & WLR_OUTPUT_STATE_MODE)) {
+				!(state->committed & WLR_OUTPUT_STATE_MODE)) {
 			wlr_drm_conn_log(conn, WLR_DEBUG,
 				"Can't enable an output without a mode");
 			return false;
 		}
 	}
 
-	if (drm_connector_state_active(conn, &output->pending)) {
+	if (drm_connector_state_active(conn, state)) {
 		if (!drm_connector_alloc_crtc(conn)) {
 			wlr_drm_conn_log(conn, WLR_DEBUG,
 				"No CRTC available for this connector");
@@ -466,31 +660,69 @@ static bool drm_connector_test(struct wlr_output *output) {
 		}
 	}
 
-	if ((output->pending.committed & WLR_OUTPUT_STATE_BUFFER) &&
-			output->pending.buffer_type == WLR_OUTPUT_STATE_BUFFER_SCANOUT) {
-		if (!drm_connector_set_pending_fb(conn, &output->pending)) {
+	if (state->committed & WLR_OUTPUT_STATE_IN_FENCE) {
+		// Multi-GPU blits read the buffer right away, and the legacy API
+		// can't wait for fences
+		if (conn->backend->iface == &legacy_iface ||
+				conn->backend->parent != NULL || conn->crtc == NULL ||
+				conn->crtc->primary->props.in_fence_fd == 0) {
+			wlr_drm_conn_log(conn, WLR_DEBUG, "In-fences are not supported");
 			return false;
 		}
+	}
+
+	if (state->committed & WLR_OUTPUT_STATE_BUFFER_TRANSFORM) {
+		// Whether the transform itself is supported is checked by the
+		// TEST_ONLY commit
+		if (conn->backend->iface == &legacy_iface ||
+				conn->backend->parent != NULL || conn->crtc == NULL ||
+				conn->crtc->primary->props.rotation == 0) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"Buffer transforms are not supported");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool drm_connector_test(struct wlr_output *output) {
+	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
+
+	if (!drm_connector_check_state(conn, &output->pending)) {
+		return false;
+	}
+
+	bool scanout = (output->pending.committed & WLR_OUTPUT_STATE_BUFFER) &&
+		output->pending.buffer_type == WLR_OUTPUT_STATE_BUFFER_SCANOUT;
+	if (scanout && !drm_connector_set_pending_fb(conn, &output->pending)) {
+		return false;
+	}
+
+	if (output->pending.committed & WLR_OUTPUT_STATE_LAYERS) {
+		drm_connector_set_pending_layers(conn, &output->pending, true);
+	}
+
+	if (scanout) {
 		if (!drm_crtc_commit(conn, &output->pending, DRM_MODE_ATOMIC_TEST_ONLY)) {
 			return false;
 		}
+	} else if (conn->crtc != NULL) {
+		for (size_t i = 0; i < conn->crtc->num_overlays; i++) {
+			drm_fb_clear(&conn->crtc->overlays[i]->pending_fb);
+		}
 	}
 
 	return true;
 }
 
 bool drm_connector_supports_vrr(struct wlr_drm_connector *conn) {
-	struct wlr_drm_backend *drm = conn->backend;
-
 	struct wlr_drm_crtc *crtc = conn->crtc;
 	if (!crtc) {
 		return false;
 	}
 
-	uint64_t vrr_capable;
-	if (conn->props.vrr_capable == 0 ||
-			!get_drm_prop(drm->fd, conn->id, conn->props.vrr_capable,
-			&vrr_capable) || !vrr_capable) {
+	if (!conn->vrr_capable) {
 		wlr_drm_conn_log(conn, WLR_DEBUG, "Failed to enable adaptive sync: "
 			"connector doesn't support VRR");
 		return false;
@@ -531,6 +763,10 @@ bool drm_connector_commit_state(struct wlr_drm_connector *conn,
 		}
 	}
 
+	if (state.committed & WLR_OUTPUT_STATE_LAYERS) {
+		drm_connector_set_pending_layers(conn, &state, false);
+	}
+
 	if (state.committed & (WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_ENABLED)) {
 		if ((state.committed & WLR_OUTPUT_STATE_MODE) &&
 				state.mode_type == WLR_OUTPUT_STATE_MODE_CUSTOM) {
@@ -570,7 +806,20 @@ static bool drm_connector_commit(struct wlr_output *output) {
 		return false;
 	}
 
-	return drm_connector_commit_state(conn, &output->pending);
+	trace_begin("%s drm_connector_commit", conn->name);
+	bool ok = drm_connector_commit_state(conn, &output->pending);
+	trace_end();
+	if (!ok) {
+		return false;
+	}
+
+	// Deferred cursor moves are part of this commit
+	if (conn->cursor_deferred) {
+		wl_event_source_timer_update(conn->cursor_timer, 0);
+		conn->cursor_deferred = false;
+	}
+
+	return true;
 }
 
 static void drm_connector_rollback_render(struct wlr_output *output) {
@@ -584,14 +833,7 @@ size_t drm_crtc_get_gamma_lut_size(struct wlr_drm_backend *drm,
 		return (size_t)crtc->legacy_crtc->gamma_size;
 	}
 
-	uint64_t gamma_lut_size;
-	if (!get_drm_prop(drm->fd, crtc->id, crtc->props.gamma_lut_size,
-			&gamma_lut_size)) {
-		wlr_log(WLR_ERROR, "Unable to get gamma lut size");
-		return 0;
-	}
-
-	return gamma_lut_size;
+	return crtc->gamma_lut_size;
 }
 
 static size_t drm_connector_get_gamma_size(struct wlr_output *output) {
@@ -642,6 +884,15 @@ static bool drm_connector_export_dmabuf(struct wlr_output *output,
 	return wlr_dmabuf_attributes_copy(attribs, &buf_attribs);
 }
 
+static struct wlr_buffer *drm_connector_get_committed_buffer(
+		struct wlr_output *output) {
+	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
+	if (conn->crtc == NULL || conn->crtc->primary->queued_fb == NULL) {
+		return NULL;
+	}
+	return conn->crtc->primary->queued_fb->wlr_buf;
+}
+
 struct wlr_drm_fb *plane_get_next_fb(struct wlr_drm_plane *plane) {
 	if (plane->pending_fb) {
 		return plane->pending_fb;
@@ -680,6 +931,108 @@ out:
 	return ok;
 }
 
+static void modeset_test_destroy(struct wlr_drm_backend *drm,
+		struct wlr_drm_modeset_test *test) {
+	wl_list_remove(&test->link);
+	drm->modeset_tests_len--;
+	free(test);
+}
+
+void drm_modeset_tests_clear(struct wlr_drm_backend *drm) {
+	struct wlr_drm_modeset_test *test, *tmp;
+	wl_list_for_each_safe(test, tmp, &drm->modeset_tests, link) {
+		modeset_test_destroy(drm, test);
+	}
+}
+
+static void drm_connector_clear_modeset_tests(struct wlr_drm_connector *conn) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_modeset_test *test, *tmp;
+	wl_list_for_each_safe(test, tmp, &drm->modeset_tests, link) {
+		if (test->conn_id == conn->id) {
+			modeset_test_destroy(drm, test);
+		}
+	}
+}
+
+static struct wlr_drm_modeset_test *drm_connector_get_modeset_test(
+		struct wlr_drm_connector *conn, const drmModeModeInfo *mode,
+		uint32_t format, bool with_modifiers) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_modeset_test *test;
+	wl_list_for_each(test, &drm->modeset_tests, link) {
+		if (test->conn_id == conn->id && test->crtc_id == conn->crtc->id &&
+				test->format == format &&
+				test->with_modifiers == with_modifiers &&
+				memcmp(&test->mode, mode, sizeof(*mode)) == 0) {
+			wl_list_remove(&test->link);
+			wl_list_insert(&drm->modeset_tests, &test->link);
+			return test;
+		}
+	}
+	return NULL;
+}
+
+static void drm_connector_add_modeset_test(struct wlr_drm_connector *conn,
+		const drmModeModeInfo *mode, uint32_t format, bool with_modifiers,
+		bool ok) {
+	struct wlr_drm_backend *drm = conn->backend;
+
+	struct wlr_drm_modeset_test *test = calloc(1, sizeof(*test));
+	if (test == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	test->conn_id = conn->id;
+	test->crtc_id = conn->crtc->id;
+	test->mode = *mode;
+	test->format = format;
+	test->with_modifiers = with_modifiers;
+	test->ok = ok;
+	wl_list_insert(&drm->modeset_tests, &test->link);
+	drm->modeset_tests_len++;
+
+	if (drm->modeset_tests_len > WLR_DRM_MODESET_TEST_CACHE_SIZE) {
+		struct wlr_drm_modeset_test *last =
+			wl_container_of(drm->modeset_tests.prev, last, link);
+		modeset_test_destroy(drm, last);
+	}
+}
+
+/**
+ * Initialize the primary plane's surface and check whether it can be used to
+ * light up the connector. TEST_ONLY results are remembered, so that switching
+ * back and forth between modes doesn't need to render and test again.
+ */
+static bool drm_connector_init_surface(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state, const drmModeModeInfo *mode,
+		uint32_t format, bool with_modifiers) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_plane *plane = conn->crtc->primary;
+
+	struct wlr_drm_modeset_test *test = drm_connector_get_modeset_test(conn,
+		mode, format, with_modifiers);
+	if (test != NULL && !test->ok) {
+		wlr_drm_conn_log(conn, WLR_DEBUG, "Skipping primary FB %s modifiers: "
+			"known to fail", with_modifiers ? "with" : "without");
+		return false;
+	}
+
+	if (!drm_plane_init_surface(plane, drm, mode->hdisplay, mode->vdisplay,
+			format, with_modifiers)) {
+		return false;
+	}
+	if (test != NULL) {
+		return true;
+	}
+
+	bool ok = drm_connector_test_renderer(conn, state);
+	if (drm->iface != &legacy_iface) {
+		drm_connector_add_modeset_test(conn, mode, format, with_modifiers, ok);
+	}
+	return ok;
+}
+
 static bool drm_connector_init_renderer(struct wlr_drm_connector *conn,
 		const struct wlr_output_state *state) {
 	struct wlr_drm_backend *drm = conn->backend;
@@ -697,13 +1050,18 @@ static bool drm_connector_init_renderer(struct wlr_drm_connector *conn,
 	drm_connector_state_mode(conn, state, &mode);
 
 	struct wlr_drm_plane *plane = conn->crtc->primary;
-	int width = mode.hdisplay;
-	int height = mode.vdisplay;
+	uint32_t format = DRM_FORMAT_INVALID;
+	struct wlr_drm_format *render_format =
+		drm_plane_pick_render_format(plane, &drm->renderer,
+		conn->output.render_format);
+	if (render_format != NULL) {
+		format = render_format->format;
+		free(render_format);
+	}
 
 	if (drm->addfb2_modifiers) {
 		// Modifiers are supported, try to use them
-		if (drm_plane_init_surface(plane, drm, width, height, true) &&
-				drm_connector_test_renderer(conn, state)) {
+		if (drm_connector_init_surface(conn, state, &mode, format, true)) {
 			return true;
 		}
 
@@ -714,8 +1072,7 @@ static bool drm_connector_init_renderer(struct wlr_drm_connector *conn,
 			"retrying without modifiers");
 	}
 
-	if (drm_plane_init_surface(plane, drm, width, height, false) &&
-			drm_connector_test_renderer(conn, state)) {
+	if (drm_connector_init_surface(conn, state, &mode, format, false)) {
 		return true;
 	}
 
@@ -802,42 +1159,374 @@ static bool drm_connector_set_mode(struct wlr_drm_connector *conn,
 		return false;
 	}
 
-	wlr_drm_conn_log(conn, WLR_INFO,
-		"Modesetting with '%" PRId32 "x%" PRId32 "@%" PRId32 "mHz'",
-		wlr_mode->width, wlr_mode->height, wlr_mode->refresh);
-
-	if (!drm_connector_init_renderer(conn, state)) {
-		wlr_drm_conn_log(conn, WLR_ERROR,
-			"Failed to initialize renderer for plane");
-		return false;
+	wlr_drm_conn_log(conn, WLR_INFO,
+		"Modesetting with '%" PRId32 "x%" PRId32 "@%" PRId32 "mHz'",
+		wlr_mode->width, wlr_mode->height, wlr_mode->refresh);
+
+	struct wlr_drm_plane *plane = conn->crtc->primary;
+	bool keep_surface = drm_connector_state_is_seamless(conn, state) &&
+		plane_get_next_fb(plane) != NULL;
+	if (!keep_surface && !drm_connector_init_renderer(conn, state)) {
+		wlr_drm_conn_log(conn, WLR_ERROR,
+			"Failed to initialize renderer for plane");
+		return false;
+	}
+
+	// drm_crtc_page_flip expects a FB to be available
+	if (!plane_get_next_fb(plane)) {
+		if (!drm_surface_render_black_frame(&plane->surf)) {
+			return false;
+		}
+		if (!drm_plane_lock_surface(plane, drm)) {
+			return false;
+		}
+	}
+
+	if (!drm_crtc_page_flip(conn, state)) {
+		// Don't trust the test results which led to this modeset anymore
+		drm_connector_clear_modeset_tests(conn);
+		return false;
+	}
+
+	conn->state = WLR_DRM_CONN_CONNECTED;
+	conn->desired_mode = NULL;
+	wlr_output_update_mode(&conn->output, wlr_mode);
+	wlr_output_update_enabled(&conn->output, true);
+	conn->desired_enabled = true;
+
+	// When switching VTs, the mode is not updated but the buffers become
+	// invalid, so we need to manually damage the output here
+	wlr_output_damage_whole(&conn->output);
+
+	return true;
+}
+
+static bool drm_connector_commit_needs_kms(
+		const struct wlr_drm_connector_commit *commit) {
+	return commit->conn->crtc != NULL && (commit->state.committed &
+		(WLR_OUTPUT_STATE_BUFFER | WLR_OUTPUT_STATE_MODE |
+		WLR_OUTPUT_STATE_ENABLED | WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED |
+		WLR_OUTPUT_STATE_GAMMA_LUT | WLR_OUTPUT_STATE_LAYERS));
+}
+
+/**
+ * Prepare the planes of a connector for a commit of several connectors at
+ * once, doing everything drm_connector_commit_state does except for the actual
+ * commit. Render buffers can only be locked once, so they're left out of
+ * tests.
+ */
+static bool drm_connector_prepare_commit(
+		struct wlr_drm_connector_commit *commit, struct wlr_drm_connector *conn,
+		bool test_only) {
+	struct wlr_output_state *state = &commit->state;
+	commit->conn = conn;
+	commit->state = conn->output.pending;
+	commit->mode = NULL;
+
+	if (!drm_connector_check_state(conn, state)) {
+		return false;
+	}
+
+	if (state->committed & WLR_OUTPUT_STATE_BUFFER) {
+		bool scanout = state->buffer_type == WLR_OUTPUT_STATE_BUFFER_SCANOUT;
+		if ((scanout || !test_only) &&
+				!drm_connector_set_pending_fb(conn, state)) {
+			return false;
+		}
+	}
+
+	if (state->committed & WLR_OUTPUT_STATE_LAYERS) {
+		drm_connector_set_pending_layers(conn, state, test_only);
+	}
+
+	if (!(state->committed &
+			(WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_ENABLED))) {
+		if (!test_only && conn->pending_page_flip_crtc &&
+				drm_connector_commit_needs_kms(commit)) {
+			wlr_drm_conn_log(conn, WLR_ERROR, "Failed to page-flip output: "
+				"a page-flip is already pending");
+			return false;
+		}
+		return true;
+	}
+
+	if ((state->committed & WLR_OUTPUT_STATE_MODE) &&
+			state->mode_type == WLR_OUTPUT_STATE_MODE_CUSTOM) {
+		drmModeModeInfo mode = {0};
+		drm_connector_state_mode(conn, state, &mode);
+
+		state->mode_type = WLR_OUTPUT_STATE_MODE_FIXED;
+		state->mode = wlr_drm_connector_add_mode(&conn->output, &mode);
+		if (state->mode == NULL) {
+			return false;
+		}
+	}
+
+	if (drm_connector_state_active(conn, state)) {
+		if (state->committed & WLR_OUTPUT_STATE_MODE) {
+			commit->mode = state->mode;
+		} else {
+			commit->mode = conn->output.current_mode;
+		}
+	}
+	if (commit->mode == NULL) {
+		return true;
+	}
+
+	if (conn->state != WLR_DRM_CONN_CONNECTED &&
+			conn->state != WLR_DRM_CONN_NEEDS_MODESET) {
+		wlr_drm_conn_log(conn, WLR_ERROR,
+			"Cannot modeset a disconnected output");
+		return false;
+	}
+
+	if (test_only) {
+		return true;
+	}
+
+	wlr_drm_conn_log(conn, WLR_INFO,
+		"Modesetting with '%" PRId32 "x%" PRId32 "@%" PRId32 "mHz'",
+		commit->mode->width, commit->mode->height, commit->mode->refresh);
+
+	struct wlr_drm_plane *plane = conn->crtc->primary;
+	bool keep_surface = drm_connector_state_is_seamless(conn, state) &&
+		plane_get_next_fb(plane) != NULL;
+	if (!keep_surface && !drm_connector_init_renderer(conn, state)) {
+		wlr_drm_conn_log(conn, WLR_ERROR,
+			"Failed to initialize renderer for plane");
+		return false;
+	}
+
+	if (!plane_get_next_fb(plane)) {
+		if (!drm_surface_render_black_frame(&plane->surf)) {
+			return false;
+		}
+		if (!drm_plane_lock_surface(plane, conn->backend)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void drm_connector_apply_commit(
+		const struct wlr_drm_connector_commit *commit) {
+	struct wlr_drm_connector *conn = commit->conn;
+	const struct wlr_output_state *state = &commit->state;
+
+	if (drm_connector_commit_needs_kms(commit)) {
+		drm_connector_set_committed(conn, state);
+		if (drm_connector_state_active(conn, state)) {
+			conn->pending_page_flip_crtc = conn->crtc->id;
+			conn->pending_page_flip_tearing = false;
+			conn->output.frame_pending = true;
+		}
+	}
+
+	if (conn->cursor_deferred) {
+		wl_event_source_timer_update(conn->cursor_timer, 0);
+		conn->cursor_deferred = false;
+	}
+
+	if (!(state->committed &
+			(WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_ENABLED))) {
+		return;
+	}
+
+	if (commit->mode == NULL) {
+		conn->desired_enabled = false;
+		conn->desired_mode = NULL;
+		wlr_output_update_enabled(&conn->output, false);
+		return;
+	}
+
+	conn->state = WLR_DRM_CONN_CONNECTED;
+	conn->desired_mode = NULL;
+	wlr_output_update_mode(&conn->output, commit->mode);
+	wlr_output_update_enabled(&conn->output, true);
+	conn->desired_enabled = true;
+	wlr_output_damage_whole(&conn->output);
+}
+
+bool drm_commit_outputs(struct wlr_drm_backend *drm,
+		struct wlr_output *const *outputs, size_t outputs_len,
+		bool test_only) {
+	if (!drm->session->active) {
+		return false;
+	}
+
+	if (outputs_len == 1) {
+		return test_only ? drm_connector_test(outputs[0]) :
+			drm_connector_commit(outputs[0]);
+	}
+
+	struct wlr_drm_connector_commit *commits =
+		calloc(outputs_len, sizeof(*commits));
+	struct wlr_drm_connector_commit *kms_commits =
+		calloc(outputs_len, sizeof(*kms_commits));
+	if (commits == NULL || kms_commits == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		free(commits);
+		free(kms_commits);
+		return false;
+	}
+
+	bool ok = true;
+	size_t prepared = 0;
+	while (prepared < outputs_len) {
+		struct wlr_drm_connector *conn =
+			get_drm_connector_from_output(outputs[prepared]);
+		ok = drm_connector_prepare_commit(&commits[prepared], conn, test_only);
+		prepared++;
+		if (!ok) {
+			break;
+		}
+	}
+
+	size_t kms_len = 0;
+	bool active = false;
+	if (ok) {
+		for (size_t i = 0; i < outputs_len; i++) {
+			const struct wlr_drm_connector_commit *commit = &commits[i];
+			if (!drm_connector_commit_needs_kms(commit)) {
+				continue;
+			}
+			bool conn_active = drm_connector_state_active(commit->conn,
+				&commit->state);
+			// Tests can't use render buffers: skip modesets without a
+			// scan-out buffer, the previous FB may not fit the new mode
+			struct wlr_drm_plane *primary = commit->conn->crtc->primary;
+			if (test_only && conn_active && primary->pending_fb == NULL &&
+					(drm_connector_state_is_modeset(&commit->state) ||
+					plane_get_next_fb(primary) == NULL)) {
+				continue;
+			}
+			active |= conn_active;
+			kms_commits[kms_len++] = *commit;
+		}
+	}
+
+	if (ok && kms_len > 0) {
+		uint32_t flags = 0;
+		if (test_only) {
+			flags = DRM_MODE_ATOMIC_TEST_ONLY;
+		} else if (active) {
+			flags = DRM_MODE_PAGE_FLIP_EVENT;
+		}
+		ok = drm->iface->commit_connectors(drm, kms_commits, kms_len, flags);
+	}
+
+	bool disabled = false;
+	for (size_t i = 0; i < prepared; i++) {
+		const struct wlr_drm_connector_commit *commit = &commits[i];
+		if (ok && !test_only) {
+			disabled |= drm_connector_commit_needs_kms(commit) &&
+				!drm_connector_state_active(commit->conn, &commit->state);
+			drm_connector_apply_commit(commit);
+		} else if (commit->conn->crtc != NULL) {
+			drm_crtc_clear_pending(commit->conn->crtc);
+			if (!test_only && commit->mode != NULL) {
+				drm_connector_clear_modeset_tests(commit->conn);
+			}
+		}
+	}
+
+	free(commits);
+	free(kms_commits);
+
+	if (disabled) {
+		realloc_crtcs(drm);
+		attempt_enable_needs_modeset(drm);
+	}
+
+	return ok;
+}
+
+bool drm_resume_outputs(struct wlr_drm_backend *drm) {
+	// The legacy API can't restore several CRTCs at once
+	if (drm->iface == &legacy_iface || !drm->session->active) {
+		return false;
+	}
+
+	size_t conns_len = wl_list_length(&drm->outputs);
+	struct wlr_drm_connector_commit *commits =
+		calloc(conns_len + 1, sizeof(*commits));
+	if (commits == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+
+	// Everything needed to restore the outputs is still around: the last
+	// committed FBs of each plane, and the gamma LUT and VRR state of each
+	// CRTC. Only the mode blob is re-created.
+	size_t commits_len = 0;
+	bool active = false;
+	struct wlr_drm_connector *conn;
+	wl_list_for_each(conn, &drm->outputs, link) {
+		if (conn->crtc == NULL) {
+			if (conn->output.enabled) {
+				goto out;
+			}
+			continue;
+		}
+
+		struct wlr_output_mode *mode = NULL;
+		if (conn->output.enabled && conn->output.current_mode != NULL) {
+			mode = conn->output.current_mode;
+			if (conn->state != WLR_DRM_CONN_CONNECTED ||
+					plane_get_next_fb(conn->crtc->primary) == NULL) {
+				goto out;
+			}
+		}
+
+		struct wlr_drm_connector_commit *commit = &commits[commits_len++];
+		commit->conn = conn;
+		commit->mode = mode;
+		commit->state = (struct wlr_output_state){
+			// Layers are disabled until the compositor commits them again
+			.committed = WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_ENABLED |
+				WLR_OUTPUT_STATE_LAYERS,
+			.enabled = mode != NULL,
+			.mode_type = WLR_OUTPUT_STATE_MODE_FIXED,
+			.mode = mode,
+		};
+		active |= mode != NULL;
+	}
+
+	if (commits_len == 0) {
+		free(commits);
+		return true;
 	}
 
-	// drm_crtc_page_flip expects a FB to be available
-	struct wlr_drm_plane *plane = conn->crtc->primary;
-	if (!plane_get_next_fb(plane)) {
-		if (!drm_surface_render_black_frame(&plane->surf)) {
-			return false;
-		}
-		if (!drm_plane_lock_surface(plane, drm)) {
-			return false;
+	uint32_t flags = active ? DRM_MODE_PAGE_FLIP_EVENT : 0;
+	if (!drm->iface->commit_connectors(drm, commits, commits_len, flags)) {
+		wlr_log(WLR_DEBUG, "Failed to restore the state of %s in a single "
+			"commit", drm->name);
+		for (size_t i = 0; i < commits_len; i++) {
+			drm_crtc_clear_pending(commits[i].conn->crtc);
 		}
+		goto out;
 	}
 
-	if (!drm_crtc_page_flip(conn, state)) {
-		return false;
+	// The buffers are still valid, so unlike a regular modeset there is no
+	// need to damage the outputs
+	for (size_t i = 0; i < commits_len; i++) {
+		struct wlr_drm_connector_commit *commit = &commits[i];
+		drm_connector_set_committed(commit->conn, &commit->state);
+		if (commit->mode != NULL) {
+			commit->conn->pending_page_flip_crtc = commit->conn->crtc->id;
+			commit->conn->pending_page_flip_tearing = false;
+			commit->conn->output.frame_pending = true;
+		}
 	}
 
-	conn->state = WLR_DRM_CONN_CONNECTED;
-	conn->desired_mode = NULL;
-	wlr_output_update_mode(&conn->output, wlr_mode);
-	wlr_output_update_enabled(&conn->output, true);
-	conn->desired_enabled = true;
-
-	// When switching VTs, the mode is not updated but the buffers become
-	// invalid, so we need to manually damage the output here
-	wlr_output_damage_whole(&conn->output);
-
+	free(commits);
+	wlr_log(WLR_INFO, "Restored the state of %s", drm->name);
 	return true;
+
+out:
+	free(commits);
+	return false;
 }
 
 struct wlr_output_mode *wlr_drm_connector_add_mode(struct wlr_output *output,
@@ -890,6 +1579,9 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 		return false;
 	}
 
+	// The plane needs to be updated by the next commit
+	conn->cursor_committed = false;
+
 	if (conn->cursor_hotspot_x != hotspot_x ||
 			conn->cursor_hotspot_y != hotspot_y) {
 		// Update cursor hotspot
@@ -910,9 +1602,13 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 		}
 
 		struct wlr_buffer *local_buf;
-		if (drm->parent) {
+		if (drm->parent && drm_plane_import_mgpu(plane, drm, buffer,
+				&plane->current_fb)) {
+			local_buf = NULL;
+		} else if (drm->parent) {
 			struct wlr_drm_format *format =
-				drm_plane_pick_render_format(plane, &drm->renderer);
+				drm_plane_pick_render_format(plane, &drm->renderer,
+				DRM_FORMAT_ARGB8888);
 			if (format == NULL) {
 				wlr_log(WLR_ERROR, "Failed to pick cursor plane format");
 				return false;
@@ -933,11 +1629,13 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 			local_buf = wlr_buffer_lock(buffer);
 		}
 
-		bool ok = drm_fb_import(&plane->current_fb, drm, local_buf,
-			&plane->formats);
-		wlr_buffer_unlock(local_buf);
-		if (!ok) {
-			return false;
+		if (local_buf != NULL) {
+			bool ok = drm_fb_import(&plane->current_fb, drm, local_buf,
+				&plane->formats);
+			wlr_buffer_unlock(local_buf);
+			if (!ok) {
+				return false;
+			}
 		}
 
 		conn->cursor_enabled = true;
@@ -949,6 +1647,78 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 	return true;
 }
 
+static int cursor_handle_timer(void *data) {
+	struct wlr_drm_connector *conn = data;
+	conn->cursor_deferred = false;
+	wlr_output_update_needs_frame(&conn->output);
+	return 0;
+}
+
+/**
+ * With adaptive sync, each commit starts a new refresh cycle. Committing for
+ * every cursor move makes the refresh rate follow the pointer instead of the
+ * content, and disrupts low framerate compensation. Defer cursor-only updates
+ * to the next frame instead, and only force a frame if none has been
+ * committed within the longest refresh period supported by the panel.
+ */
+static bool defer_cursor_update(struct wlr_drm_connector *conn) {
+	if (conn->cursor_deferred) {
+		return true;
+	}
+
+	if (conn->cursor_timer == NULL) {
+		struct wl_event_loop *ev =
+			wl_display_get_event_loop(conn->backend->display);
+		conn->cursor_timer =
+			wl_event_loop_add_timer(ev, cursor_handle_timer, conn);
+		if (conn->cursor_timer == NULL) {
+			return false;
+		}
+	}
+
+	int32_t min_refresh = conn->min_refresh;
+	if (min_refresh <= 0) {
+		// Assume the panel can at least halve its refresh rate
+		min_refresh = conn->output.refresh / 2;
+	}
+	if (min_refresh <= 0) {
+		return false;
+	}
+
+	wl_event_source_timer_update(conn->cursor_timer, 1000000 / min_refresh);
+	conn->cursor_deferred = true;
+	return true;
+}
+
+/**
+ * Move the cursor plane right away, without waiting for the next output
+ * commit. The legacy cursor IOCTL is used with both interfaces: atomic
+ * drivers apply it as an asynchronous plane update, which doesn't wait for
+ * vblank nor conflict with a pending page-flip, unlike a cursor-only atomic
+ * commit.
+ *
+ * This is only possible when the cursor image displayed by the plane is up to
+ * date and the cursor stays visible. Otherwise, the next commit needs to
+ * update the plane.
+ */
+static bool move_cursor_now(struct wlr_drm_connector *conn) {
+	struct wlr_drm_backend *drm = conn->backend;
+	if (!conn->cursor_committed || !drm->session->active ||
+			!drm_connector_is_cursor_visible(conn)) {
+		return false;
+	}
+
+	if (drmModeMoveCursor(drm->fd, conn->crtc->id,
+			conn->cursor_x, conn->cursor_y) != 0) {
+		wlr_drm_conn_log_errno(conn, WLR_DEBUG, "drmModeMoveCursor failed");
+		// Leave it to the next commit
+		conn->cursor_committed = false;
+		return false;
+	}
+
+	return true;
+}
+
 static bool drm_connector_move_cursor(struct wlr_output *output,
 		int x, int y) {
 	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
@@ -975,6 +1745,15 @@ static bool drm_connector_move_cursor(struct wlr_output *output,
 	conn->cursor_x = box.x;
 	conn->cursor_y = box.y;
 
+	if (output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED &&
+			defer_cursor_update(conn)) {
+		return true;
+	}
+
+	if (move_cursor_now(conn)) {
+		return true;
+	}
+
 	wlr_output_update_needs_frame(output);
 	return true;
 }
@@ -999,6 +1778,23 @@ static void drm_connector_destroy_output(struct wlr_output *output) {
 	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
 
 	dealloc_crtc(conn);
+	drm_connector_cancel_capture(conn);
+
+	if (conn->cursor_timer != NULL) {
+		wl_event_source_remove(conn->cursor_timer);
+		conn->cursor_timer = NULL;
+	}
+	conn->cursor_deferred = false;
+
+	if (conn->content_rate.timer != NULL) {
+		wl_event_source_remove(conn->content_rate.timer);
+		conn->content_rate.timer = NULL;
+	}
+	conn->content_rate.rate = 0;
+	conn->content_rate.paced_refresh = 0;
+
+	drm_connector_reset_gamma_transition(conn);
+	conn->gamma_transition.duration_ms = 0;
 
 	conn->state = WLR_DRM_CONN_DISCONNECTED;
 	conn->desired_enabled = false;
@@ -1041,6 +1837,12 @@ static void drm_connector_get_cursor_size(struct wlr_output *output,
 	*height = (int)drm->cursor_height;
 }
 
+static bool drm_connector_capture_next_commit(struct wlr_output *output,
+		struct wlr_buffer *buffer) {
+	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
+	return drm_connector_request_capture(conn, buffer);
+}
+
 static const struct wlr_output_impl output_impl = {
 	.set_cursor = drm_connector_set_cursor,
 	.move_cursor = drm_connector_move_cursor,
@@ -1053,6 +1855,8 @@ static const struct wlr_output_impl output_impl = {
 	.export_dmabuf = drm_connector_export_dmabuf,
 	.get_cursor_formats = drm_connector_get_cursor_formats,
 	.get_cursor_size = drm_connector_get_cursor_size,
+	.get_committed_buffer = drm_connector_get_committed_buffer,
+	.capture_next_commit = drm_connector_capture_next_commit,
 };
 
 bool wlr_output_is_drm(struct wlr_output *output) {
@@ -1064,11 +1868,151 @@ uint32_t wlr_drm_connector_get_id(struct wlr_output *output) {
 	return conn->id;
 }
 
+void drm_connector_reset_gamma_transition(struct wlr_drm_connector *conn) {
+	free(conn->gamma_transition.current);
+	free(conn->gamma_transition.from);
+	free(conn->gamma_transition.to);
+	conn->gamma_transition.current = NULL;
+	conn->gamma_transition.from = NULL;
+	conn->gamma_transition.to = NULL;
+	conn->gamma_transition.size = 0;
+	conn->gamma_transition.active = false;
+}
+
+void wlr_drm_connector_set_gamma_transition(struct wlr_output *output,
+		int duration_ms) {
+	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
+	if (conn->backend->iface != &atomic_iface) {
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Gamma transitions require atomic modesetting");
+		return;
+	}
+
+	conn->gamma_transition.duration_ms = duration_ms > 0 ? duration_ms : 0;
+	if (conn->gamma_transition.duration_ms == 0) {
+		// A transition in progress stops at its current step
+		drm_connector_reset_gamma_transition(conn);
+	}
+}
+
+/**
+ * Check whether refresh is a multiple of rate, with a tolerance tight enough
+ * to tell e.g. 24 Hz and 23.976 Hz apart.
+ */
+static bool refresh_is_multiple(int32_t refresh, int32_t rate, int *factor) {
+	int k = (refresh + rate / 2) / rate;
+	if (k < 1) {
+		return false;
+	}
+	int64_t diff = (int64_t)refresh - (int64_t)k * rate;
+	if (diff < 0) {
+		diff = -diff;
+	}
+	*factor = k;
+	return diff * 2000 <= (int64_t)k * rate;
+}
+
+struct wlr_output_mode *wlr_drm_connector_set_content_rate(
+		struct wlr_output *output, int32_t rate) {
+	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
+	conn->content_rate.rate = rate > 0 ? rate : 0;
+	conn->content_rate.paced_refresh = 0;
+	if (conn->content_rate.timer != NULL) {
+		wl_event_source_timer_update(conn->content_rate.timer, 0);
+	}
+	if (conn->content_rate.rate == 0 || output->current_mode == NULL) {
+		return NULL;
+	}
+
+	struct wlr_drm_mode *current = (struct wlr_drm_mode *)output->current_mode;
+	int factor;
+	if (refresh_is_multiple(current->wlr_mode.refresh, rate, &factor)) {
+		return &current->wlr_mode;
+	}
+
+	// Prefer the lowest refresh rate, which saves the most power
+	struct wlr_drm_mode *best = NULL;
+	int best_factor = 0;
+	struct wlr_drm_mode *mode;
+	wl_list_for_each(mode, &output->modes, wlr_mode.link) {
+		if (!drm_mode_is_seamless_switch(&current->drm_mode, &mode->drm_mode) ||
+				!refresh_is_multiple(mode->wlr_mode.refresh, rate, &factor)) {
+			continue;
+		}
+		if (best == NULL || factor < best_factor) {
+			best = mode;
+			best_factor = factor;
+		}
+	}
+	if (best != NULL) {
+		wlr_drm_conn_log(conn, WLR_DEBUG, "Content rate %"PRId32" mHz "
+			"matches mode %"PRId32"x%"PRId32"@%"PRId32"mHz", rate,
+			best->wlr_mode.width, best->wlr_mode.height,
+			best->wlr_mode.refresh);
+		return &best->wlr_mode;
+	}
+
+	// Otherwise, emulate a fixed refresh rate with adaptive sync, using the
+	// lowest multiple of the content rate in the display's range
+	if (conn->min_refresh > 0 && conn->max_refresh >= conn->min_refresh &&
+			drm_connector_supports_vrr(conn)) {
+		int64_t k = (conn->min_refresh + rate - 1) / rate;
+		int64_t refresh = (k > 1 ? k : 1) * rate;
+		if (refresh <= conn->max_refresh) {
+			conn->content_rate.paced_refresh = refresh;
+			wlr_drm_conn_log(conn, WLR_DEBUG, "Pacing frames at %"PRId64" mHz "
+				"for content rate %"PRId32" mHz with adaptive sync",
+				refresh, rate);
+		}
+	}
+	return NULL;
+}
+
+const struct wlr_drm_format_set *wlr_drm_connector_get_primary_formats(
+		struct wlr_output *output) {
+	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
+	// On multi-GPU setups, client buffers are allocated on the parent GPU
+	// and usually need to be copied before being scanned out
+	if (conn->crtc == NULL || conn->backend->parent != NULL) {
+		return NULL;
+	}
+	return &conn->crtc->primary->formats;
+}
+
+const struct wlr_drm_format_set *wlr_drm_connector_get_overlay_formats(
+		struct wlr_output *output) {
+	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	// Same restrictions as drm_connector_set_pending_layers
+	if (crtc == NULL || crtc->num_overlays == 0 ||
+			conn->backend->parent != NULL ||
+			conn->backend->iface == &legacy_iface) {
+		return NULL;
+	}
+	return &crtc->overlays[crtc->num_overlays - 1]->formats;
+}
+
 bool drm_connector_state_is_modeset(const struct wlr_output_state *state) {
 	return state->committed &
 		(WLR_OUTPUT_STATE_ENABLED | WLR_OUTPUT_STATE_MODE);
 }
 
+bool drm_connector_state_is_seamless(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	if (!(state->committed & WLR_OUTPUT_STATE_MODE) ||
+			conn->state != WLR_DRM_CONN_CONNECTED || conn->crtc == NULL ||
+			!conn->output.enabled || conn->output.current_mode == NULL ||
+			!drm_connector_state_active(conn, state)) {
+		return false;
+	}
+
+	struct wlr_drm_mode *current =
+		(struct wlr_drm_mode *)conn->output.current_mode;
+	drmModeModeInfo mode = {0};
+	drm_connector_state_mode(conn, state, &mode);
+	return drm_mode_is_seamless_switch(&current->drm_mode, &mode);
+}
+
 bool drm_connector_state_active(struct wlr_drm_connector *conn,
 		const struct wlr_output_state *state) {
 	if (state->committed & WLR_OUTPUT_STATE_ENABLED) {
@@ -1132,8 +2076,13 @@ static void dealloc_crtc(struct wlr_drm_connector *conn) {
 
 	drm_plane_finish_surface(conn->crtc->primary);
 	drm_plane_finish_surface(conn->crtc->cursor);
+	for (size_t i = 0; i < conn->crtc->num_overlays; i++) {
+		drm_plane_finish_surface(conn->crtc->overlays[i]);
+		conn->crtc->overlays[i]->layer_enabled = false;
+	}
 
 	conn->cursor_enabled = false;
+	conn->cursor_committed = false;
 	conn->crtc = NULL;
 }
 
@@ -1282,7 +2231,160 @@ static uint32_t get_possible_crtcs(int fd, drmModeRes *res,
 
 static void disconnect_drm_connector(struct wlr_drm_connector *conn);
 
-void scan_drm_connectors(struct wlr_drm_backend *drm) {
+static void *connector_probe_run(void *data) {
+	struct wlr_drm_connector_probe *probe = data;
+	for (int i = 0; i < probe->res->count_connectors; ++i) {
+		probe->conns[i] = drmModeGetConnector(probe->fd,
+			probe->res->connectors[i]);
+	}
+	return NULL;
+}
+
+void start_drm_connector_probe(struct wlr_drm_backend *drm) {
+	assert(drm->probe == NULL);
+	if (drm->num_crtcs == 0) {
+		return;
+	}
+
+	struct wlr_drm_connector_probe *probe = calloc(1, sizeof(*probe));
+	if (probe == NULL) {
+		return;
+	}
+	probe->fd = drm->fd;
+	probe->res = drmModeGetResources(drm->fd);
+	if (probe->res == NULL) {
+		free(probe);
+		return;
+	}
+	probe->conns = calloc(probe->res->count_connectors + 1,
+		sizeof(probe->conns[0]));
+	if (probe->conns == NULL) {
+		drmModeFreeResources(probe->res);
+		free(probe);
+		return;
+	}
+
+	int ret = worker_thread_create(&probe->thread, connector_probe_run,
+		probe);
+	if (ret != 0) {
+		wlr_log(WLR_DEBUG, "Failed to start connector probe thread: %s",
+			strerror(ret));
+		free(probe->conns);
+		drmModeFreeResources(probe->res);
+		free(probe);
+		return;
+	}
+
+	drm->probe = probe;
+}
+
+/**
+ * Wait for the probe thread and take ownership of its results.
+ */
+static struct wlr_drm_connector_probe *join_drm_connector_probe(
+		struct wlr_drm_backend *drm) {
+	struct wlr_drm_connector_probe *probe = drm->probe;
+	if (probe == NULL) {
+		return NULL;
+	}
+	drm->probe = NULL;
+	pthread_join(probe->thread, NULL);
+	return probe;
+}
+
+static void connector_probe_destroy(struct wlr_drm_connector_probe *probe) {
+	if (probe == NULL) {
+		return;
+	}
+	free(probe->conns);
+	drmModeFreeResources(probe->res);
+	free(probe);
+}
+
+void cancel_drm_connector_probe(struct wlr_drm_backend *drm) {
+	struct wlr_drm_connector_probe *probe = join_drm_connector_probe(drm);
+	if (probe == NULL) {
+		return;
+	}
+	for (int i = 0; i < probe->res->count_connectors; ++i) {
+		drmModeFreeConnector(probe->conns[i]);
+	}
+	connector_probe_destroy(probe);
+}
+
+/**
+ * Get the state of a connector. Probing a connector makes the kernel read the
+ * EDID and the mode list from the display, which is slow. The kernel keeps
+ * the connection status up to date on its own (hotplug interrupts or
+ * polling), so only probe connectors where a display may have appeared.
+ */
+static drmModeConnector *get_drm_connector(struct wlr_drm_backend *drm,
+		struct wlr_drm_connector *wlr_conn, uint32_t id) {
+	drmModeConnector *drm_conn = drmModeGetConnectorCurrent(drm->fd, id);
+	if (drm_conn == NULL) {
+		return NULL;
+	}
+
+	bool connected = wlr_conn != NULL &&
+		wlr_conn->state != WLR_DRM_CONN_DISCONNECTED;
+	if (!connected && drm_conn->connection != DRM_MODE_DISCONNECTED) {
+		drmModeFreeConnector(drm_conn);
+		drm_conn = drmModeGetConnector(drm->fd, id);
+	}
+	return drm_conn;
+}
+
+/**
+ * Fill the output's make, model, serial and the connector's refresh range
+ * from the EDID, re-using the previous results if the EDID didn't change.
+ */
+static void connector_parse_edid(struct wlr_drm_connector *wlr_conn,
+		uint8_t *edid, size_t edid_len) {
+	struct wlr_output *output = &wlr_conn->output;
+	if (edid != NULL && wlr_conn->edid_cache.data != NULL &&
+			wlr_conn->edid_cache.len == edid_len &&
+			memcmp(wlr_conn->edid_cache.data, edid, edid_len) == 0) {
+		wlr_drm_conn_log(wlr_conn, WLR_DEBUG, "EDID unchanged, "
+			"re-using parsed information");
+		memcpy(output->make, wlr_conn->edid_cache.make, sizeof(output->make));
+		memcpy(output->model, wlr_conn->edid_cache.model,
+			sizeof(output->model));
+		memcpy(output->serial, wlr_conn->edid_cache.serial,
+			sizeof(output->serial));
+		wlr_conn->min_refresh = wlr_conn->edid_cache.min_refresh;
+		wlr_conn->max_refresh = wlr_conn->edid_cache.max_refresh;
+		free(edid);
+		return;
+	}
+
+	parse_edid(output, edid_len, edid);
+	wlr_conn->min_refresh = wlr_conn->max_refresh = 0;
+	parse_edid_refresh_range(edid_len, edid,
+		&wlr_conn->min_refresh, &wlr_conn->max_refresh);
+
+	// Takes ownership of the EDID blob
+	free(wlr_conn->edid_cache.data);
+	wlr_conn->edid_cache.data = edid;
+	wlr_conn->edid_cache.len = edid_len;
+	memcpy(wlr_conn->edid_cache.make, output->make,
+		sizeof(wlr_conn->edid_cache.make));
+	memcpy(wlr_conn->edid_cache.model, output->model,
+		sizeof(wlr_conn->edid_cache.model));
+	memcpy(wlr_conn->edid_cache.serial, output->serial,
+		sizeof(wlr_conn->edid_cache.serial));
+	wlr_conn->edid_cache.min_refresh = wlr_conn->min_refresh;
+	wlr_conn->edid_cache.max_refresh = wlr_conn->max_refresh;
+}
+
+static void connector_update_vrr_capable(struct wlr_drm_connector *conn) {
+	uint64_t vrr_capable;
+	conn->vrr_capable = conn->props.vrr_capable != 0 &&
+		get_drm_prop(conn->backend->fd, conn->id, conn->props.vrr_capable,
+		&vrr_capable) && vrr_capable;
+}
+
+void scan_drm_connectors(struct wlr_drm_backend *drm,
+		const struct wlr_device_change_event *event) {
 	/*
 	 * This GPU is not really a modesetting device.
 	 * It's just being used as a renderer.
@@ -1291,12 +2393,28 @@ void scan_drm_connectors(struct wlr_drm_backend *drm) {
 		return;
 	}
 
-	wlr_log(WLR_INFO, "Scanning DRM connectors on %s", drm->name);
+	// Use the results of the startup probe if there is one
+	struct wlr_drm_connector_probe *probe = join_drm_connector_probe(drm);
 
-	drmModeRes *res = drmModeGetResources(drm->fd);
-	if (!res) {
-		wlr_log_errno(WLR_ERROR, "Failed to get DRM resources");
-		return;
+	uint32_t target_id = 0;
+	if (event != NULL && probe == NULL) {
+		target_id = event->connector_id;
+	}
+	if (target_id != 0) {
+		wlr_log(WLR_INFO, "Scanning DRM connector %"PRIu32" on %s",
+			target_id, drm->name);
+	} else {
+		wlr_log(WLR_INFO, "Scanning DRM connectors on %s", drm->name);
+	}
+	drmModeRes *res;
+	if (probe != NULL) {
+		res = probe->res;
+	} else {
+		res = drmModeGetResources(drm->fd);
+		if (!res) {
+			wlr_log_errno(WLR_ERROR, "Failed to get DRM resources");
+			return;
+		}
 	}
 
 	size_t seen_len = wl_list_length(&drm->outputs);
@@ -1308,25 +2426,44 @@ void scan_drm_connectors(struct wlr_drm_backend *drm) {
 	struct wlr_drm_connector *new_outputs[res->count_connectors + 1];
 
 	for (int i = 0; i < res->count_connectors; ++i) {
-		drmModeConnector *drm_conn = drmModeGetConnector(drm->fd,
-			res->connectors[i]);
-		if (!drm_conn) {
-			wlr_log_errno(WLR_ERROR, "Failed to get DRM connector");
-			continue;
-		}
-		drmModeEncoder *curr_enc = drmModeGetEncoder(drm->fd,
-			drm_conn->encoder_id);
-
 		ssize_t index = -1;
 		struct wlr_drm_connector *c, *wlr_conn = NULL;
 		wl_list_for_each(c, &drm->outputs, link) {
 			index++;
-			if (c->id == drm_conn->connector_id) {
+			if (c->id == res->connectors[i]) {
 				wlr_conn = c;
 				break;
 			}
 		}
 
+		// Leave the other connectors alone on a targeted rescan
+		if (target_id != 0 && res->connectors[i] != target_id) {
+			if (wlr_conn != NULL) {
+				seen[index] = true;
+			}
+			continue;
+		}
+
+		drmModeConnector *drm_conn;
+		if (probe != NULL) {
+			drm_conn = probe->conns[i];
+		} else {
+			drm_conn = get_drm_connector(drm, wlr_conn, res->connectors[i]);
+		}
+		if (!drm_conn) {
+			wlr_log_errno(WLR_ERROR, "Failed to get DRM connector");
+			continue;
+		}
+		if (drm_conn->connector_type == DRM_MODE_CONNECTOR_WRITEBACK) {
+			// Not an output, only used to capture other outputs
+			drm_writeback_create(drm, drm_conn->connector_id,
+				get_possible_crtcs(drm->fd, res, drm_conn));
+			drmModeFreeConnector(drm_conn);
+			continue;
+		}
+		drmModeEncoder *curr_enc = drmModeGetEncoder(drm->fd,
+			drm_conn->encoder_id);
+
 		if (!wlr_conn) {
 			wlr_conn = calloc(1, sizeof(*wlr_conn));
 			if (!wlr_conn) {
@@ -1383,6 +2520,10 @@ void scan_drm_connectors(struct wlr_drm_backend *drm) {
 			}
 		}
 
+		if (wlr_conn->state != WLR_DRM_CONN_DISCONNECTED) {
+			connector_update_vrr_capable(wlr_conn);
+		}
+
 		if (wlr_conn->state == WLR_DRM_CONN_DISCONNECTED &&
 				drm_conn->connection == DRM_MODE_CONNECTED) {
 			wlr_log(WLR_INFO, "'%s' connected", wlr_conn->name);
@@ -1402,12 +2543,16 @@ void scan_drm_connectors(struct wlr_drm_backend *drm) {
 			wlr_conn->output.subpixel = subpixel_map[drm_conn->subpixel];
 
 			get_drm_connector_props(drm->fd, wlr_conn->id, &wlr_conn->props);
+			connector_update_vrr_capable(wlr_conn);
 
 			size_t edid_len = 0;
 			uint8_t *edid = get_drm_prop_blob(drm->fd,
 				wlr_conn->id, wlr_conn->props.edid, &edid_len);
-			parse_edid(&wlr_conn->output, edid_len, edid);
-			free(edid);
+			connector_parse_edid(wlr_conn, edid, edid_len);
+			if (wlr_conn->max_refresh != 0) {
+				wlr_log(WLR_INFO, "Refresh rate range: %"PRId32"-%"PRId32" mHz",
+					wlr_conn->min_refresh, wlr_conn->max_refresh);
+			}
 
 			char *subconnector = NULL;
 			if (wlr_conn->props.subconnector) {
@@ -1481,7 +2626,12 @@ void scan_drm_connectors(struct wlr_drm_backend *drm) {
 		drmModeFreeConnector(drm_conn);
 	}
 
-	drmModeFreeResources(res);
+	if (probe != NULL) {
+		// Frees res
+		connector_probe_destroy(probe);
+	} else {
+		drmModeFreeResources(res);
+	}
 
 	// Iterate in reverse order because we'll remove items from the list and
 	// still want indices to remain correct.
@@ -1514,6 +2664,51 @@ static int mhz_to_nsec(int mhz) {
 	return 1000000000000LL / mhz;
 }
 
+static int content_rate_handle_timer(void *data) {
+	struct wlr_drm_connector *conn = data;
+	if (conn->backend->session->active && conn->output.enabled) {
+		wlr_output_send_frame(&conn->output);
+	}
+	return 0;
+}
+
+/**
+ * With adaptive sync, the display refreshes as soon as a new frame is
+ * flipped. To emulate a fixed refresh rate, hold the frame event back so that
+ * the next page-flip lands one period after this one, leaving the compositor
+ * a quarter of the period to render.
+ */
+static bool pace_frame(struct wlr_drm_connector *conn,
+		const struct timespec *present_time) {
+	if (conn->content_rate.paced_refresh == 0 ||
+			conn->output.adaptive_sync_status !=
+			WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED) {
+		return false;
+	}
+
+	if (conn->content_rate.timer == NULL) {
+		struct wl_event_loop *ev =
+			wl_display_get_event_loop(conn->backend->display);
+		conn->content_rate.timer =
+			wl_event_loop_add_timer(ev, content_rate_handle_timer, conn);
+		if (conn->content_rate.timer == NULL) {
+			return false;
+		}
+	}
+
+	struct timespec now;
+	clock_gettime(conn->backend->clock, &now);
+	int64_t period = mhz_to_nsec(conn->content_rate.paced_refresh);
+	int64_t deadline = timespec_to_nsec(present_time) + period - period / 4;
+	// The timer has a millisecond granularity
+	int64_t delay_ms = (deadline - timespec_to_nsec(&now)) / 1000000;
+	if (delay_ms <= 0) {
+		return false;
+	}
+	wl_event_source_timer_update(conn->content_rate.timer, delay_ms);
+	return true;
+}
+
 static void handle_page_flip(int fd, unsigned seq,
 		unsigned tv_sec, unsigned tv_usec, unsigned crtc_id, void *data) {
 	struct wlr_drm_backend *drm = data;
@@ -1533,6 +2728,12 @@ static void handle_page_flip(int fd, unsigned seq,
 
 	conn->pending_page_flip_crtc = 0;
 
+	trace_instant("%s page_flip (seq %u)", conn->name, seq);
+
+	if (drm->iface == &legacy_iface && conn->crtc != NULL) {
+		drm_legacy_crtc_apply_pending(drm, conn);
+	}
+
 	if (conn->state != WLR_DRM_CONN_CONNECTED || conn->crtc == NULL) {
 		wlr_drm_conn_log(conn, WLR_DEBUG,
 			"Ignoring page-flip event for disabled connector");
@@ -1547,9 +2748,20 @@ static void handle_page_flip(int fd, unsigned seq,
 		drm_fb_move(&conn->crtc->cursor->current_fb,
 			&conn->crtc->cursor->queued_fb);
 	}
+	for (size_t i = 0; i < conn->crtc->num_overlays; i++) {
+		struct wlr_drm_plane *overlay = conn->crtc->overlays[i];
+		if (overlay->queued_fb) {
+			drm_fb_move(&overlay->current_fb, &overlay->queued_fb);
+		} else if (!overlay->layer_enabled) {
+			drm_fb_clear(&overlay->current_fb);
+		}
+	}
 
-	uint32_t present_flags = WLR_OUTPUT_PRESENT_VSYNC |
+	uint32_t present_flags =
 		WLR_OUTPUT_PRESENT_HW_CLOCK | WLR_OUTPUT_PRESENT_HW_COMPLETION;
+	if (!conn->pending_page_flip_tearing) {
+		present_flags |= WLR_OUTPUT_PRESENT_VSYNC;
+	}
 	/* Don't report ZERO_COPY in multi-gpu situations, because we had to copy
 	 * data between the GPUs, even if we were using the direct scanout
 	 * interface.
@@ -1575,7 +2787,13 @@ static void handle_page_flip(int fd, unsigned seq,
 	wlr_output_send_present(&conn->output, &present_event);
 
 	if (drm->session->active && conn->output.enabled) {
-		wlr_output_send_frame(&conn->output);
+		if (conn->gamma_transition.active) {
+			// Keep frames coming until the transition is done
+			wlr_output_update_needs_frame(&conn->output);
+		}
+		if (!pace_frame(conn, &present_time)) {
+			wlr_output_send_frame(&conn->output);
+		}
 	}
 }
 
@@ -1639,6 +2857,9 @@ static void disconnect_drm_connector(struct wlr_drm_connector *conn) {
 		return;
 	}
 
+	// The next monitor plugged into this connector may not behave the same
+	drm_connector_clear_modeset_tests(conn);
+
 	// This will cleanup the compositor-facing wlr_output, but won't destroy
 	// our wlr_drm_connector.
 	wlr_output_destroy(&conn->output);
@@ -1650,6 +2871,8 @@ void destroy_drm_connector(struct wlr_drm_connector *conn) {
 	disconnect_drm_connector(conn);
 
 	drmModeFreeCrtc(conn->old_crtc);
+	drm_connector_reset_gamma_transition(conn);
+	free(conn->edid_cache.data);
 	wl_list_remove(&conn->link);
 	free(conn);
 }
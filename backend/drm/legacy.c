@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <gbm.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/util/log.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -8,6 +9,100 @@
 #include "backend/drm/iface.h"
 #include "backend/drm/util.h"
 
+static bool set_cursor(struct wlr_drm_backend *drm,
+		struct wlr_drm_connector *conn) {
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	struct wlr_drm_plane *cursor = crtc->cursor;
+
+	if (cursor != NULL && drm_connector_is_cursor_visible(conn)) {
+		struct wlr_drm_fb *cursor_fb = plane_get_next_fb(cursor);
+		if (cursor_fb == NULL) {
+			wlr_drm_conn_log(conn, WLR_DEBUG, "Failed to acquire cursor FB");
+			return false;
+		}
+
+		uint32_t cursor_handle = gbm_bo_get_handle(cursor_fb->bo).u32;
+		if (cursor_handle != crtc->legacy_cursor_handle) {
+			uint32_t cursor_width = gbm_bo_get_width(cursor_fb->bo);
+			uint32_t cursor_height = gbm_bo_get_height(cursor_fb->bo);
+			if (drmModeSetCursor(drm->fd, crtc->id, cursor_handle,
+					cursor_width, cursor_height)) {
+				wlr_drm_conn_log_errno(conn, WLR_DEBUG,
+					"drmModeSetCursor failed");
+				crtc->legacy_cursor_handle = 0;
+				return false;
+			}
+			crtc->legacy_cursor_handle = cursor_handle;
+		}
+
+		if (drmModeMoveCursor(drm->fd,
+			crtc->id, conn->cursor_x, conn->cursor_y) != 0) {
+			wlr_drm_conn_log_errno(conn, WLR_ERROR, "drmModeMoveCursor failed");
+			return false;
+		}
+	} else if (crtc->legacy_cursor_handle != 0) {
+		if (drmModeSetCursor(drm->fd, crtc->id, 0, 0, 0)) {
+			wlr_drm_conn_log_errno(conn, WLR_DEBUG, "drmModeSetCursor failed");
+			return false;
+		}
+		crtc->legacy_cursor_handle = 0;
+	}
+
+	return true;
+}
+
+static void clear_pending_gamma(struct wlr_drm_crtc *crtc) {
+	free(crtc->legacy_pending.gamma_lut);
+	crtc->legacy_pending.gamma_lut = NULL;
+	crtc->legacy_pending.gamma_lut_size = 0;
+	crtc->legacy_pending.gamma = false;
+}
+
+static bool queue_gamma(struct wlr_drm_crtc *crtc, size_t size,
+		const uint16_t *lut) {
+	uint16_t *copy = NULL;
+	if (size > 0) {
+		copy = malloc(3 * size * sizeof(uint16_t));
+		if (copy == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			return false;
+		}
+		memcpy(copy, lut, 3 * size * sizeof(uint16_t));
+	}
+
+	// Only the latest LUT matters
+	clear_pending_gamma(crtc);
+	crtc->legacy_pending.gamma = true;
+	crtc->legacy_pending.gamma_lut = copy;
+	crtc->legacy_pending.gamma_lut_size = size;
+	return true;
+}
+
+void drm_legacy_crtc_apply_pending(struct wlr_drm_backend *drm,
+		struct wlr_drm_connector *conn) {
+	struct wlr_drm_crtc *crtc = conn->crtc;
+
+	if (crtc->legacy_pending.gamma) {
+		drm_legacy_crtc_set_gamma(drm, crtc,
+			crtc->legacy_pending.gamma_lut_size,
+			crtc->legacy_pending.gamma_lut);
+		clear_pending_gamma(crtc);
+	}
+
+	if (crtc->legacy_pending.cursor) {
+		crtc->legacy_pending.cursor = false;
+		if (!set_cursor(drm, conn)) {
+			// Let the next commit retry
+			conn->cursor_committed = false;
+		}
+	}
+}
+
+void drm_legacy_crtc_finish(struct wlr_drm_crtc *crtc) {
+	clear_pending_gamma(crtc);
+	crtc->legacy_pending.cursor = false;
+}
+
 static bool legacy_crtc_commit(struct wlr_drm_backend *drm,
 		struct wlr_drm_connector *conn, const struct wlr_output_state *state,
 		uint32_t flags) {
@@ -16,6 +111,16 @@ static bool legacy_crtc_commit(struct wlr_drm_backend *drm,
 	struct wlr_drm_plane *cursor = crtc->cursor;
 
 	bool active = drm_connector_state_active(conn, state);
+	bool modeset = drm_connector_state_is_modeset(state);
+
+	// Anything still queued from a previous frame goes out now
+	drm_legacy_crtc_apply_pending(drm, conn);
+
+	// Cursor and gamma updates can't be synchronized with the page-flip
+	// anyway, and the IOCTLs can block for a while on some drivers: apply
+	// them once the flip completes, so that they don't delay it. Changes
+	// made in the meantime are coalesced.
+	bool defer = !modeset && (flags & DRM_MODE_PAGE_FLIP_EVENT);
 
 	uint32_t fb_id = 0;
 	if (active) {
@@ -28,7 +133,10 @@ static bool legacy_crtc_commit(struct wlr_drm_backend *drm,
 		fb_id = fb->id;
 	}
 
-	if (drm_connector_state_is_modeset(state)) {
+	if (modeset) {
+		// Another DRM master may have changed the cursor in the meantime
+		crtc->legacy_cursor_handle = UINT32_MAX;
+
 		uint32_t *conns = NULL;
 		size_t conns_len = 0;
 		drmModeModeInfo *mode = NULL;
@@ -56,7 +164,11 @@ static bool legacy_crtc_commit(struct wlr_drm_backend *drm,
 	}
 
 	if (state->committed & WLR_OUTPUT_STATE_GAMMA_LUT) {
-		if (!drm_legacy_crtc_set_gamma(drm, crtc,
+		if (defer) {
+			if (!queue_gamma(crtc, state->gamma_lut_size, state->gamma_lut)) {
+				return false;
+			}
+		} else if (!drm_legacy_crtc_set_gamma(drm, crtc,
 				state->gamma_lut_size, state->gamma_lut)) {
 			return false;
 		}
@@ -78,37 +190,21 @@ static bool legacy_crtc_commit(struct wlr_drm_backend *drm,
 			state->adaptive_sync_enabled ? "enabled" : "disabled");
 	}
 
-	if (cursor != NULL && drm_connector_is_cursor_visible(conn)) {
-		struct wlr_drm_fb *cursor_fb = plane_get_next_fb(cursor);
-		if (cursor_fb == NULL) {
-			wlr_drm_conn_log(conn, WLR_DEBUG, "Failed to acquire cursor FB");
-			return false;
-		}
-
-		uint32_t cursor_handle = gbm_bo_get_handle(cursor_fb->bo).u32;
-		uint32_t cursor_width = gbm_bo_get_width(cursor_fb->bo);
-		uint32_t cursor_height = gbm_bo_get_height(cursor_fb->bo);
-		if (drmModeSetCursor(drm->fd, crtc->id, cursor_handle,
-				cursor_width, cursor_height)) {
-			wlr_drm_conn_log_errno(conn, WLR_DEBUG, "drmModeSetCursor failed");
-			return false;
-		}
-
-		if (drmModeMoveCursor(drm->fd,
-			crtc->id, conn->cursor_x, conn->cursor_y) != 0) {
-			wlr_drm_conn_log_errno(conn, WLR_ERROR, "drmModeMoveCursor failed");
-			return false;
-		}
-	} else {
-		if (drmModeSetCursor(drm->fd, crtc->id, 0, 0, 0)) {
-			wlr_drm_conn_log_errno(conn, WLR_DEBUG, "drmModeSetCursor failed");
-			return false;
-		}
+	if (cursor != NULL && drm_connector_is_cursor_visible(conn) &&
+			plane_get_next_fb(cursor) == NULL) {
+		wlr_drm_conn_log(conn, WLR_DEBUG, "Failed to acquire cursor FB");
+		return false;
+	}
+	if (defer) {
+		crtc->legacy_pending.cursor = true;
+	} else if (!set_cursor(drm, conn)) {
+		return false;
 	}
 
 	if (flags & DRM_MODE_PAGE_FLIP_EVENT) {
-		if (drmModePageFlip(drm->fd, crtc->id, fb_id,
-				DRM_MODE_PAGE_FLIP_EVENT, drm)) {
+		uint32_t flip_flags = flags &
+			(DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC);
+		if (drmModePageFlip(drm->fd, crtc->id, fb_id, flip_flags, drm)) {
 			wlr_drm_conn_log_errno(conn, WLR_ERROR, "drmModePageFlip failed");
 			return false;
 		}
@@ -158,6 +254,26 @@ bool drm_legacy_crtc_set_gamma(struct wlr_drm_backend *drm,
 	return true;
 }
 
+static bool legacy_commit_connectors(struct wlr_drm_backend *drm,
+		const struct wlr_drm_connector_commit *commits, size_t commits_len,
+		uint32_t flags) {
+	// The legacy API can't apply several CRTC changes at once. Committing
+	// them one after the other would leave the first CRTCs flipped when a
+	// later one fails, while the caller rolls back the state of all of them.
+	if (commits_len > 1) {
+		wlr_log(WLR_DEBUG, "Committing several connectors at once "
+			"requires the atomic API");
+		return false;
+	}
+
+	const struct wlr_drm_connector_commit *commit = &commits[0];
+	if (!drm_connector_state_active(commit->conn, &commit->state)) {
+		flags &= ~DRM_MODE_PAGE_FLIP_EVENT;
+	}
+	return legacy_crtc_commit(drm, commit->conn, &commit->state, flags);
+}
+
 const struct wlr_drm_interface legacy_iface = {
 	.crtc_commit = legacy_crtc_commit,
+	.commit_connectors = legacy_commit_connectors,
 };
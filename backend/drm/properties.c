@@ -24,6 +24,9 @@ static const struct prop_info connector_info[] = {
 	{ "DPMS", INDEX(dpms) },
 	{ "EDID", INDEX(edid) },
 	{ "PATH", INDEX(path) },
+	{ "WRITEBACK_FB_ID", INDEX(writeback_fb_id) },
+	{ "WRITEBACK_OUT_FENCE_PTR", INDEX(writeback_out_fence_ptr) },
+	{ "WRITEBACK_PIXEL_FORMATS", INDEX(writeback_pixel_formats) },
 	{ "link-status", INDEX(link_status) },
 	{ "subconnector", INDEX(subconnector) },
 	{ "vrr_capable", INDEX(vrr_capable) },
@@ -36,6 +39,7 @@ static const struct prop_info crtc_info[] = {
 	{ "GAMMA_LUT", INDEX(gamma_lut) },
 	{ "GAMMA_LUT_SIZE", INDEX(gamma_lut_size) },
 	{ "MODE_ID", INDEX(mode_id) },
+	{ "OUT_FENCE_PTR", INDEX(out_fence_ptr) },
 	{ "VRR_ENABLED", INDEX(vrr_enabled) },
 #undef INDEX
 };
@@ -47,7 +51,9 @@ static const struct prop_info plane_info[] = {
 	{ "CRTC_W", INDEX(crtc_w) },
 	{ "CRTC_X", INDEX(crtc_x) },
 	{ "CRTC_Y", INDEX(crtc_y) },
+	{ "FB_DAMAGE_CLIPS", INDEX(fb_damage_clips) },
 	{ "FB_ID", INDEX(fb_id) },
+	{ "IN_FENCE_FD", INDEX(in_fence_fd) },
 	{ "IN_FORMATS", INDEX(in_formats) },
 	{ "SRC_H", INDEX(src_h) },
 	{ "SRC_W", INDEX(src_w) },
@@ -55,6 +61,7 @@ static const struct prop_info plane_info[] = {
 	{ "SRC_Y", INDEX(src_y) },
 	{ "rotation", INDEX(rotation) },
 	{ "type", INDEX(type) },
+	{ "zpos", INDEX(zpos) },
 #undef INDEX
 };
 
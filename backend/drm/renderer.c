@@ -126,6 +126,11 @@ void drm_surface_unset_current(struct wlr_drm_surface *surf) {
 	surf->back_buffer = NULL;
 }
 
+/**
+ * Copy a parent GPU buffer into a buffer of this surface. The import of the
+ * source buffer is cached by the renderer, so only the copy itself is
+ * repeated each time a swapchain buffer comes back.
+ */
 struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
 		struct wlr_buffer *buffer) {
 	struct wlr_renderer *renderer = surf->renderer->wlr_rend;
@@ -192,7 +197,8 @@ static struct wlr_drm_format *create_linear_format(uint32_t format) {
 }
 
 struct wlr_drm_format *drm_plane_pick_render_format(
-		struct wlr_drm_plane *plane, struct wlr_drm_renderer *renderer) {
+		struct wlr_drm_plane *plane, struct wlr_drm_renderer *renderer,
+		uint32_t preferred_format) {
 	const struct wlr_drm_format_set *render_formats =
 		wlr_renderer_get_render_formats(renderer->wlr_rend);
 	if (render_formats == NULL) {
@@ -202,6 +208,22 @@ struct wlr_drm_format *drm_plane_pick_render_format(
 
 	const struct wlr_drm_format_set *plane_formats = &plane->formats;
 
+	if (preferred_format != DRM_FORMAT_ARGB8888) {
+		const struct wlr_drm_format *plane_format =
+			wlr_drm_format_set_get(plane_formats, preferred_format);
+		const struct wlr_drm_format *render_format =
+			wlr_drm_format_set_get(render_formats, preferred_format);
+		struct wlr_drm_format *format = NULL;
+		if (plane_format != NULL && render_format != NULL) {
+			format = wlr_drm_format_intersect(plane_format, render_format);
+		}
+		if (format != NULL) {
+			return format;
+		}
+		wlr_log(WLR_DEBUG, "Plane %"PRIu32" can't use format 0x%"PRIX32
+			", falling back to ARGB8888", plane->id, preferred_format);
+	}
+
 	uint32_t fmt = DRM_FORMAT_ARGB8888;
 	if (!wlr_drm_format_set_has(&plane->formats, fmt, DRM_FORMAT_MOD_INVALID)) {
 		const struct wlr_pixel_format_info *format_info =
@@ -237,11 +259,71 @@ struct wlr_drm_format *drm_plane_pick_render_format(
 	return format;
 }
 
+/**
+ * Pick a format for the parent GPU's buffers on multi-GPU setups. Buffers are
+ * scanned out directly by the secondary GPU if possible, and copied otherwise,
+ * so the modifiers need to be supported by the parent GPU for rendering, by
+ * the plane for scanout and by the secondary GPU for texturing. Implicit
+ * modifiers aren't shared across GPUs: fall back to linear if there's no
+ * common explicit modifier.
+ */
+static struct wlr_drm_format *pick_mgpu_format(struct wlr_drm_plane *plane,
+		struct wlr_drm_backend *drm, uint32_t fmt) {
+	const struct wlr_drm_format_set *parent_formats =
+		wlr_renderer_get_render_formats(drm->parent->renderer.wlr_rend);
+	const struct wlr_drm_format *parent_format = parent_formats != NULL ?
+		wlr_drm_format_set_get(parent_formats, fmt) : NULL;
+	const struct wlr_drm_format *plane_format =
+		wlr_drm_format_set_get(&plane->formats, fmt);
+	const struct wlr_drm_format *texture_format =
+		wlr_drm_format_set_get(&drm->mgpu_formats, fmt);
+	if (parent_format == NULL || plane_format == NULL ||
+			texture_format == NULL) {
+		return create_linear_format(fmt);
+	}
+
+	struct wlr_drm_format *scanout_format =
+		wlr_drm_format_intersect(parent_format, plane_format);
+	if (scanout_format == NULL) {
+		return create_linear_format(fmt);
+	}
+	struct wlr_drm_format *shared_format =
+		wlr_drm_format_intersect(scanout_format, texture_format);
+	free(scanout_format);
+	if (shared_format == NULL) {
+		return create_linear_format(fmt);
+	}
+
+	struct wlr_drm_format *format = wlr_drm_format_create(fmt);
+	if (format == NULL) {
+		free(shared_format);
+		return NULL;
+	}
+	for (size_t i = 0; i < shared_format->len; i++) {
+		uint64_t mod = shared_format->modifiers[i];
+		if (mod != DRM_FORMAT_MOD_INVALID &&
+				!wlr_drm_format_add(&format, mod)) {
+			free(shared_format);
+			free(format);
+			return NULL;
+		}
+	}
+	free(shared_format);
+
+	if (format->len == 0 && !wlr_drm_format_add(&format,
+			DRM_FORMAT_MOD_LINEAR)) {
+		free(format);
+		return NULL;
+	}
+
+	return format;
+}
+
 bool drm_plane_init_surface(struct wlr_drm_plane *plane,
 		struct wlr_drm_backend *drm, int32_t width, uint32_t height,
-		bool with_modifiers) {
+		uint32_t preferred_format, bool with_modifiers) {
 	struct wlr_drm_format *format =
-		drm_plane_pick_render_format(plane, &drm->renderer);
+		drm_plane_pick_render_format(plane, &drm->renderer, preferred_format);
 	if (format == NULL) {
 		wlr_log(WLR_ERROR, "Failed to pick render format for plane %"PRIu32,
 			plane->id);
@@ -262,15 +344,18 @@ bool drm_plane_init_surface(struct wlr_drm_plane *plane,
 		ok = init_drm_surface(&plane->surf, &drm->renderer,
 			width, height, format);
 	} else {
-		struct wlr_drm_format *format_linear = create_linear_format(format->format);
-		if (format_linear == NULL) {
+		struct wlr_drm_format *format_mgpu = with_modifiers ?
+			pick_mgpu_format(plane, drm, format->format) :
+			create_linear_format(format->format);
+		if (format_mgpu == NULL) {
 			free(format);
 			return false;
 		}
 
 		ok = init_drm_surface(&plane->surf, &drm->parent->renderer,
-			width, height, format_linear);
-		free(format_linear);
+			width, height, format_mgpu);
+		free(format_mgpu);
+		plane->mgpu_needs_blit = false;
 
 		if (ok && !init_drm_surface(&plane->mgpu_surf, &drm->renderer,
 				width, height, format)) {
@@ -290,11 +375,30 @@ void drm_fb_clear(struct wlr_drm_fb **fb_ptr) {
 	}
 
 	struct wlr_drm_fb *fb = *fb_ptr;
+	assert(fb->n_refs > 0);
+	fb->n_refs--;
 	wlr_buffer_unlock(fb->wlr_buf); // may destroy the buffer
 
 	*fb_ptr = NULL;
 }
 
+bool drm_plane_import_mgpu(struct wlr_drm_plane *plane,
+		struct wlr_drm_backend *drm, struct wlr_buffer *buf,
+		struct wlr_drm_fb **fb_ptr) {
+	assert(drm->parent != NULL);
+	if (plane->mgpu_needs_blit) {
+		return false;
+	}
+
+	if (!drm_fb_import(fb_ptr, drm, buf, &plane->formats)) {
+		wlr_log(WLR_DEBUG, "Failed to import parent GPU buffer on plane "
+			"%"PRIu32", falling back to copying", plane->id);
+		plane->mgpu_needs_blit = true;
+		return false;
+	}
+	return true;
+}
+
 bool drm_plane_lock_surface(struct wlr_drm_plane *plane,
 		struct wlr_drm_backend *drm) {
 	assert(plane->surf.back_buffer != NULL);
@@ -305,7 +409,11 @@ bool drm_plane_lock_surface(struct wlr_drm_plane *plane,
 	drm_surface_unset_current(&plane->surf);
 
 	struct wlr_buffer *local_buf;
-	if (drm->parent) {
+	if (drm->parent && drm_plane_import_mgpu(plane, drm, buf,
+			&plane->pending_fb)) {
+		wlr_buffer_unlock(buf);
+		return true;
+	} else if (drm->parent) {
 		// Perform a copy across GPUs
 		local_buf = drm_surface_blit(&plane->mgpu_surf, buf);
 		if (!local_buf) {
@@ -362,12 +470,16 @@ static struct gbm_bo *get_bo_for_dmabuf(struct gbm_device *gbm,
 	}
 }
 
-static void drm_fb_handle_wlr_buf_destroy(struct wl_listener *listener,
-		void *data) {
-	struct wlr_drm_fb *fb = wl_container_of(listener, fb, wlr_buf_destroy);
+static void drm_fb_handle_wlr_buf_destroy(struct wlr_addon *addon) {
+	struct wlr_drm_fb *fb = wl_container_of(addon, fb, addon);
 	drm_fb_destroy(fb);
 }
 
+static const struct wlr_addon_interface fb_addon_impl = {
+	.name = "wlr_drm_fb",
+	.destroy = drm_fb_handle_wlr_buf_destroy,
+};
+
 static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
 		struct wlr_buffer *buf, const struct wlr_drm_format_set *formats) {
 	struct wlr_drm_fb *fb = calloc(1, sizeof(*fb));
@@ -418,11 +530,12 @@ static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
 	}
 
 	fb->wlr_buf = buf;
+	fb->drm = drm;
 
-	fb->wlr_buf_destroy.notify = drm_fb_handle_wlr_buf_destroy;
-	wl_signal_add(&buf->events.destroy, &fb->wlr_buf_destroy);
+	wlr_addon_init(&fb->addon, &buf->addons, drm, &fb_addon_impl);
 
 	wl_list_insert(&drm->fbs, &fb->link);
+	drm->fbs_len++;
 
 	return fb;
 
@@ -435,7 +548,8 @@ error_get_dmabuf:
 
 void drm_fb_destroy(struct wlr_drm_fb *fb) {
 	wl_list_remove(&fb->link);
-	wl_list_remove(&fb->wlr_buf_destroy.link);
+	wlr_addon_finish(&fb->addon);
+	fb->drm->fbs_len--;
 
 	struct gbm_device *gbm = gbm_bo_get_device(fb->bo);
 	if (drmModeRmFB(gbm_device_get_fd(gbm), fb->id) != 0) {
@@ -448,25 +562,54 @@ void drm_fb_destroy(struct wlr_drm_fb *fb) {
 
 static struct wlr_drm_fb *drm_fb_get(struct wlr_drm_backend *drm,
 		struct wlr_buffer *local_buf) {
-	struct wlr_drm_fb *fb;
-	wl_list_for_each(fb, &drm->fbs, link) {
-		if (fb->wlr_buf == local_buf) {
-			return fb;
+	struct wlr_addon *addon =
+		wlr_addon_find(&local_buf->addons, drm, &fb_addon_impl);
+	if (addon == NULL) {
+		return NULL;
+	}
+	struct wlr_drm_fb *fb = wl_container_of(addon, fb, addon);
+	return fb;
+}
+
+/**
+ * Destroy the least recently used framebuffers which aren't referenced by a
+ * plane, so that buffers which aren't scanned out anymore don't keep their
+ * GEM handles and KMS framebuffers forever.
+ */
+static void drm_fb_cache_evict(struct wlr_drm_backend *drm) {
+	struct wlr_drm_fb *fb, *fb_tmp;
+	wl_list_for_each_reverse_safe(fb, fb_tmp, &drm->fbs, link) {
+		if (drm->fbs_len <= WLR_DRM_FB_CACHE_SIZE) {
+			break;
+		}
+		if (fb->n_refs > 0) {
+			continue;
 		}
+		drm_fb_destroy(fb);
+		drm->fb_cache_stats.evictions++;
 	}
-	return NULL;
 }
 
 bool drm_fb_import(struct wlr_drm_fb **fb_ptr, struct wlr_drm_backend *drm,
 		struct wlr_buffer *buf, const struct wlr_drm_format_set *formats) {
 	struct wlr_drm_fb *fb = drm_fb_get(drm, buf);
-	if (!fb) {
+	if (fb) {
+		drm->fb_cache_stats.hits++;
+		wl_list_remove(&fb->link);
+		wl_list_insert(&drm->fbs, &fb->link);
+	} else {
+		drm->fb_cache_stats.misses++;
 		fb = drm_fb_create(drm, buf, formats);
 		if (!fb) {
 			return false;
 		}
 	}
 
+	fb->n_refs++;
+	if (drm->fbs_len > WLR_DRM_FB_CACHE_SIZE) {
+		drm_fb_cache_evict(drm);
+	}
+
 	wlr_buffer_lock(buf);
 	drm_fb_move(fb_ptr, &fb);
 	return true;
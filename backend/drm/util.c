@@ -3,7 +3,10 @@
 #include <drm_mode.h>
 #include <drm.h>
 #include <gbm.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <wlr/util/log.h>
 #include "backend/drm/util.h"
@@ -27,6 +30,19 @@ int32_t calculate_refresh_rate(const drmModeModeInfo *mode) {
 	return refresh;
 }
 
+bool drm_mode_is_seamless_switch(const drmModeModeInfo *a,
+		const drmModeModeInfo *b) {
+	// The pixel clock and horizontal timings must stay the same, only the
+	// vertical front porch is stretched or shrunk
+	return a->clock == b->clock &&
+		a->hdisplay == b->hdisplay && a->hsync_start == b->hsync_start &&
+		a->hsync_end == b->hsync_end && a->htotal == b->htotal &&
+		a->hskew == b->hskew && a->vdisplay == b->vdisplay &&
+		a->vscan == b->vscan && a->flags == b->flags &&
+		(a->vsync_start != b->vsync_start || a->vsync_end != b->vsync_end ||
+		a->vtotal != b->vtotal);
+}
+
 // Constructed from http://edid.tv/manufacturer
 static const char *get_manufacturer(uint16_t id) {
 #define ID(a, b, c) ((a & 0x1f) << 10) | ((b & 0x1f) << 5) | (c & 0x1f)
@@ -144,6 +160,41 @@ void parse_edid(struct wlr_output *restrict output, size_t len, const uint8_t *d
 	}
 }
 
+bool parse_edid_refresh_range(size_t len, const uint8_t *data,
+		int32_t *min_refresh, int32_t *max_refresh) {
+	if (!data || len < 128) {
+		return false;
+	}
+
+	for (size_t i = 54; i <= 108; i += 18) {
+		uint16_t flag = (data[i] << 8) | data[i + 1];
+		if (flag != 0 || data[i + 3] != 0xFD) {
+			continue;
+		}
+
+		// Display range limits descriptor, the offset flags extend the rates
+		// beyond 255 Hz
+		uint8_t offsets = data[i + 4];
+		int32_t min_hz = data[i + 5];
+		int32_t max_hz = data[i + 6];
+		if ((offsets & 0x3) == 0x3) {
+			min_hz += 255;
+		}
+		if (offsets & 0x2) {
+			max_hz += 255;
+		}
+		if (min_hz == 0 || max_hz < min_hz) {
+			return false;
+		}
+
+		*min_refresh = min_hz * 1000;
+		*max_refresh = max_hz * 1000;
+		return true;
+	}
+
+	return false;
+}
+
 const char *conn_get_name(uint32_t type_id) {
 	switch (type_id) {
 	case DRM_MODE_CONNECTOR_Unknown:     return "Unknown";
@@ -222,148 +273,175 @@ uint32_t get_fb_for_bo(struct gbm_bo *bo, bool with_modifiers) {
 	return id;
 }
 
-static bool is_taken(size_t n, const uint32_t arr[static n], uint32_t key) {
-	for (size_t i = 0; i < n; ++i) {
-		if (arr[i] == key) {
-			return true;
-		}
-	}
-	return false;
-}
-
 /*
- * Store all of the non-recursive state in a struct, so we aren't literally
- * passing 12 arguments to a function.
- */
-struct match_state {
-	const size_t num_objs;
-	const uint32_t *restrict objs;
-	const size_t num_res;
-	size_t score;
-	size_t replaced;
-	uint32_t *restrict res;
-	uint32_t *restrict best;
-	const uint32_t *restrict orig;
-	bool exit_early;
-};
-
-/*
- * skips: The number of SKIP elements encountered so far.
- * score: The number of resources we've matched so far.
- * replaced: The number of changes from the original solution.
- * i: The index of the current element.
- *
- * This tries to match a solution as close to st->orig as it can.
+ * Gain of matching resource i with object obj, compared to leaving the
+ * resource unmatched, or zero if they can't be matched.
  *
- * Returns whether we've set a new best element with this solution.
+ * Each matched object with constraints counts towards the score, and each
+ * change from the original solution is a penalty. The score always dominates
+ * the penalty. The original match is kept if possible, even if the object's
+ * constraints don't allow it anymore.
  */
-static bool match_obj_(struct match_state *st, size_t skips, size_t score, size_t replaced, size_t i) {
-	// Finished
-	if (i >= st->num_res) {
-		if (score > st->score ||
-				(score == st->score && replaced < st->replaced)) {
-			st->score = score;
-			st->replaced = replaced;
-			memcpy(st->best, st->res, sizeof(st->best[0]) * st->num_res);
-
-			st->exit_early = (st->score == st->num_res - skips
-					|| st->score == st->num_objs)
-					&& st->replaced == 0;
-
-			return true;
-		} else {
-			return false;
-		}
+static int64_t match_gain(size_t num_objs, const uint32_t objs[],
+		size_t num_res, const uint32_t orig[], size_t i, size_t obj) {
+	if (i >= num_res || obj >= num_objs || orig[i] == SKIP) {
+		return 0;
 	}
 
-	if (st->orig[i] == SKIP) {
-		st->res[i] = SKIP;
-		return match_obj_(st, skips + 1, score, replaced, i + 1);
-	}
-
-	bool has_best = false;
-
-	/*
-	 * Attempt to use the current solution first, to try and avoid
-	 * recalculating everything
-	 */
-	if (st->orig[i] != UNMATCHED && !is_taken(i, st->res, st->orig[i])) {
-		st->res[i] = st->orig[i];
-		size_t obj_score = st->objs[st->res[i]] != 0 ? 1 : 0;
-		if (match_obj_(st, skips, score + obj_score, replaced, i + 1)) {
-			has_best = true;
-		}
+	int64_t score_weight = (int64_t)num_res + 1;
+	if (obj == orig[i]) {
+		// Leaving the resource unmatched would replace the original match
+		return (objs[obj] != 0 ? score_weight : 0) + 1;
 	}
-	if (st->orig[i] == UNMATCHED) {
-		st->res[i] = UNMATCHED;
-		if (match_obj_(st, skips, score, replaced, i + 1)) {
-			has_best = true;
-		}
-	}
-	if (st->exit_early) {
-		return true;
+	if (!(objs[obj] & (1 << i))) {
+		return 0;
 	}
+	// Replaces the original match, if any, just like leaving the resource
+	// unmatched would
+	return score_weight;
+}
 
-	if (st->orig[i] != UNMATCHED) {
-		++replaced;
-	}
+uint32_t drm_blob_cache_get(int fd, struct drm_blob_cache *cache,
+		const void *data, size_t size, uint32_t keep_id) {
+	cache->counter++;
 
-	for (size_t candidate = 0; candidate < st->num_objs; ++candidate) {
-		// We tried this earlier
-		if (candidate == st->orig[i]) {
-			continue;
+	size_t slot = DRM_BLOB_CACHE_LEN;
+	for (size_t i = 0; i < DRM_BLOB_CACHE_LEN; i++) {
+		if (cache->entries[i].id != 0 && cache->entries[i].size == size &&
+				memcmp(cache->entries[i].data, data, size) == 0) {
+			cache->entries[i].last_used = cache->counter;
+			return cache->entries[i].id;
 		}
 
-		// Not compatible
-		if (!(st->objs[candidate] & (1 << i))) {
+		// Evict the least recently used entry, free slots first
+		if (cache->entries[i].id == keep_id && keep_id != 0) {
 			continue;
 		}
-
-		// Already taken
-		if (is_taken(i, st->res, candidate)) {
-			continue;
+		if (slot == DRM_BLOB_CACHE_LEN ||
+				cache->entries[i].last_used < cache->entries[slot].last_used) {
+			slot = i;
 		}
+	}
+	assert(slot < DRM_BLOB_CACHE_LEN);
 
-		st->res[i] = candidate;
-		size_t obj_score = st->objs[candidate] != 0 ? 1 : 0;
-		if (match_obj_(st, skips, score + obj_score, replaced, i + 1)) {
-			has_best = true;
-		}
+	void *copy = malloc(size);
+	if (copy == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return 0;
+	}
+	memcpy(copy, data, size);
 
-		if (st->exit_early) {
-			return true;
-		}
+	uint32_t id;
+	if (drmModeCreatePropertyBlob(fd, data, size, &id) != 0) {
+		wlr_log_errno(WLR_ERROR, "Unable to create property blob");
+		free(copy);
+		return 0;
 	}
 
-	if (has_best) {
-		return true;
+	if (cache->entries[slot].id != 0) {
+		drmModeDestroyPropertyBlob(fd, cache->entries[slot].id);
+		free(cache->entries[slot].data);
 	}
+	cache->entries[slot].id = id;
+	cache->entries[slot].data = copy;
+	cache->entries[slot].size = size;
+	cache->entries[slot].last_used = cache->counter;
+	return id;
+}
 
-	// Maybe this resource can't be matched
-	st->res[i] = UNMATCHED;
-	return match_obj_(st, skips, score, replaced, i + 1);
+void drm_blob_cache_finish(int fd, struct drm_blob_cache *cache) {
+	for (size_t i = 0; i < DRM_BLOB_CACHE_LEN; i++) {
+		if (cache->entries[i].id != 0) {
+			drmModeDestroyPropertyBlob(fd, cache->entries[i].id);
+			free(cache->entries[i].data);
+		}
+	}
+	memset(cache, 0, sizeof(*cache));
 }
 
 size_t match_obj(size_t num_objs, const uint32_t objs[static restrict num_objs],
 		size_t num_res, const uint32_t res[static restrict num_res],
 		uint32_t out[static restrict num_res]) {
-	uint32_t solution[num_res];
 	for (size_t i = 0; i < num_res; ++i) {
-		solution[i] = UNMATCHED;
+		out[i] = res[i] == SKIP ? SKIP : UNMATCHED;
+	}
+
+	size_t n = num_res > num_objs ? num_res : num_objs;
+	if (n == 0) {
+		return 0;
 	}
 
-	struct match_state st = {
-		.num_objs = num_objs,
-		.num_res = num_res,
-		.score = 0,
-		.replaced = SIZE_MAX,
-		.objs = objs,
-		.res = solution,
-		.best = out,
-		.orig = res,
-		.exit_early = false,
-	};
-
-	match_obj_(&st, 0, 0, 0, 0);
-	return st.score;
+	/*
+	 * Maximum weight matching with the Hungarian algorithm, in O(n^3). Rows
+	 * are resources and columns are objects, padded to a square matrix with
+	 * zero gains. Indices are 1-based, 0 is a sentinel.
+	 */
+	int64_t max_gain = (int64_t)num_res + 2;
+	int64_t u[n + 1], v[n + 1], min_v[n + 1];
+	size_t row_of[n + 1], way[n + 1];
+	bool used[n + 1];
+	for (size_t j = 0; j <= n; ++j) {
+		u[j] = v[j] = 0;
+		row_of[j] = 0;
+		way[j] = 0;
+	}
+
+	for (size_t row = 1; row <= n; ++row) {
+		row_of[0] = row;
+		size_t col = 0;
+		for (size_t j = 0; j <= n; ++j) {
+			min_v[j] = INT64_MAX;
+			used[j] = false;
+		}
+
+		do {
+			used[col] = true;
+			size_t cur_row = row_of[col], next_col = 0;
+			int64_t delta = INT64_MAX;
+			for (size_t j = 1; j <= n; ++j) {
+				if (used[j]) {
+					continue;
+				}
+				int64_t cost = max_gain - match_gain(num_objs, objs,
+					num_res, res, cur_row - 1, j - 1);
+				int64_t reduced = cost - u[cur_row] - v[j];
+				if (reduced < min_v[j]) {
+					min_v[j] = reduced;
+					way[j] = col;
+				}
+				if (min_v[j] < delta) {
+					delta = min_v[j];
+					next_col = j;
+				}
+			}
+			for (size_t j = 0; j <= n; ++j) {
+				if (used[j]) {
+					u[row_of[j]] += delta;
+					v[j] -= delta;
+				} else {
+					min_v[j] -= delta;
+				}
+			}
+			col = next_col;
+		} while (row_of[col] != 0);
+
+		do {
+			size_t prev_col = way[col];
+			row_of[col] = row_of[prev_col];
+			col = prev_col;
+		} while (col != 0);
+	}
+
+	size_t score = 0;
+	for (size_t j = 1; j <= n; ++j) {
+		size_t i = row_of[j] - 1, obj = j - 1;
+		if (match_gain(num_objs, objs, num_res, res, i, obj) == 0) {
+			continue;
+		}
+		out[i] = obj;
+		if (objs[obj] != 0) {
+			++score;
+		}
+	}
+	return score;
 }
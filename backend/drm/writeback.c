@@ -0,0 +1,207 @@
+#define _POSIX_C_SOURCE 200809L
+#include <drm_fourcc.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wlr/interfaces/wlr_output.h>
+#include <wlr/util/log.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "backend/drm/drm.h"
+#include "backend/drm/iface.h"
+#include "backend/drm/properties.h"
+#include "backend/drm/renderer.h"
+#include "render/drm_format_set.h"
+
+bool drm_writeback_create(struct wlr_drm_backend *drm, uint32_t id,
+		uint32_t possible_crtcs) {
+	struct wlr_drm_writeback *wb;
+	wl_list_for_each(wb, &drm->writebacks, link) {
+		if (wb->id == id) {
+			return true;
+		}
+	}
+
+	wb = calloc(1, sizeof(*wb));
+	if (wb == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+	wb->backend = drm;
+	wb->id = id;
+	wb->possible_crtcs = possible_crtcs;
+	wb->inflight.fence_fd = -1;
+
+	if (!get_drm_connector_props(drm->fd, id, &wb->props) ||
+			wb->props.crtc_id == 0 || wb->props.writeback_fb_id == 0 ||
+			wb->props.writeback_out_fence_ptr == 0 ||
+			wb->props.writeback_pixel_formats == 0) {
+		wlr_log(WLR_DEBUG, "Writeback connector %"PRIu32" is missing "
+			"properties, ignoring", id);
+		free(wb);
+		return false;
+	}
+
+	size_t formats_len = 0;
+	uint32_t *formats = get_drm_prop_blob(drm->fd, id,
+		wb->props.writeback_pixel_formats, &formats_len);
+	if (formats == NULL) {
+		wlr_log(WLR_ERROR, "Failed to get writeback connector formats");
+		free(wb);
+		return false;
+	}
+	formats_len /= sizeof(formats[0]);
+	for (size_t i = 0; i < formats_len; i++) {
+		// Writeback framebuffers are written to linearly
+		wlr_drm_format_set_add(&wb->formats, formats[i],
+			DRM_FORMAT_MOD_LINEAR);
+		wlr_drm_format_set_add(&wb->formats, formats[i],
+			DRM_FORMAT_MOD_INVALID);
+	}
+	free(formats);
+
+	wl_list_insert(drm->writebacks.prev, &wb->link);
+	wlr_log(WLR_INFO, "Found writeback connector %"PRIu32
+		" (%zu formats)", id, formats_len);
+	return true;
+}
+
+static void writeback_send_capture(struct wlr_drm_connector *conn,
+		struct wlr_drm_fb **fb_ptr, bool success) {
+	struct wlr_output_event_capture event = {
+		.buffer = (*fb_ptr)->wlr_buf,
+		.success = success,
+	};
+	struct wlr_buffer *buffer = wlr_buffer_lock((*fb_ptr)->wlr_buf);
+	drm_fb_clear(fb_ptr);
+	wlr_output_send_capture(&conn->output, &event);
+	wlr_buffer_unlock(buffer);
+}
+
+static void writeback_finish_inflight(struct wlr_drm_writeback *wb,
+		bool success) {
+	struct wlr_drm_connector *conn = wb->inflight.conn;
+	if (conn == NULL) {
+		return;
+	}
+	wb->inflight.conn = NULL;
+	if (wb->inflight.fence_source != NULL) {
+		wl_event_source_remove(wb->inflight.fence_source);
+		wb->inflight.fence_source = NULL;
+	}
+	if (wb->inflight.fence_fd >= 0) {
+		close(wb->inflight.fence_fd);
+		wb->inflight.fence_fd = -1;
+	}
+	writeback_send_capture(conn, &wb->inflight.fb, success);
+}
+
+static void writeback_cancel_pending(struct wlr_drm_writeback *wb) {
+	struct wlr_drm_connector *conn = wb->pending_conn;
+	if (conn == NULL) {
+		return;
+	}
+	wb->pending_conn = NULL;
+	conn->capture = NULL;
+	writeback_send_capture(conn, &wb->pending_fb, false);
+}
+
+void drm_writeback_destroy(struct wlr_drm_writeback *wb) {
+	writeback_cancel_pending(wb);
+	writeback_finish_inflight(wb, false);
+	wlr_drm_format_set_finish(&wb->formats);
+	wl_list_remove(&wb->link);
+	free(wb);
+}
+
+static int writeback_handle_fence(int fd, uint32_t mask, void *data) {
+	struct wlr_drm_writeback *wb = data;
+	// The fence is signalled once the display engine is done writing
+	writeback_finish_inflight(wb, !(mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)));
+	return 0;
+}
+
+bool drm_connector_request_capture(struct wlr_drm_connector *conn,
+		struct wlr_buffer *buffer) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	if (drm->iface != &atomic_iface || drm->parent != NULL || crtc == NULL ||
+			conn->capture != NULL) {
+		return false;
+	}
+	if (buffer->width != conn->output.width ||
+			buffer->height != conn->output.height) {
+		return false;
+	}
+
+	// Prefer the writeback connector already routed to the CRTC, attaching
+	// one requires a modeset
+	uint32_t crtc_bit = 1 << (crtc - drm->crtcs);
+	struct wlr_drm_writeback *wb, *found = NULL;
+	wl_list_for_each(wb, &drm->writebacks, link) {
+		if (!(wb->possible_crtcs & crtc_bit) || wb->pending_conn != NULL ||
+				wb->inflight.conn != NULL) {
+			continue;
+		}
+		if (wb->crtc == crtc) {
+			found = wb;
+			break;
+		} else if (wb->crtc == NULL && found == NULL) {
+			found = wb;
+		}
+	}
+	if (found == NULL) {
+		return false;
+	}
+
+	if (!drm_fb_import(&found->pending_fb, drm, buffer, &found->formats)) {
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Failed to import buffer for writeback");
+		return false;
+	}
+
+	found->pending_conn = conn;
+	conn->capture = found;
+	return true;
+}
+
+void drm_connector_cancel_capture(struct wlr_drm_connector *conn) {
+	struct wlr_drm_writeback *wb;
+	wl_list_for_each(wb, &conn->backend->writebacks, link) {
+		if (wb->pending_conn == conn) {
+			writeback_cancel_pending(wb);
+		}
+		if (wb->inflight.conn == conn) {
+			writeback_finish_inflight(wb, false);
+		}
+	}
+}
+
+void drm_writeback_commit_done(struct wlr_drm_writeback *wb, bool ok,
+		int fence_fd) {
+	struct wlr_drm_connector *conn = wb->pending_conn;
+	if (!ok || fence_fd < 0) {
+		if (fence_fd >= 0) {
+			close(fence_fd);
+		}
+		writeback_cancel_pending(wb);
+		return;
+	}
+
+	wb->crtc = conn->crtc;
+	wb->pending_conn = NULL;
+	conn->capture = NULL;
+
+	wb->inflight.conn = conn;
+	drm_fb_move(&wb->inflight.fb, &wb->pending_fb);
+	wb->inflight.fence_fd = fence_fd;
+
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(wb->backend->display);
+	wb->inflight.fence_source = wl_event_loop_add_fd(loop, fence_fd,
+		WL_EVENT_READABLE, writeback_handle_fence, wb);
+	if (wb->inflight.fence_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add writeback fence event source");
+		writeback_finish_inflight(wb, false);
+	}
+}
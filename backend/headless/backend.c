@@ -3,6 +3,7 @@
 #include <drm_fourcc.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <wlr/interfaces/wlr_input_device.h>
 #include <wlr/interfaces/wlr_output.h>
@@ -26,10 +27,12 @@ static bool backend_start(struct wlr_backend *wlr_backend) {
 	struct wlr_headless_backend *backend =
 		headless_backend_from_backend(wlr_backend);
 	wlr_log(WLR_INFO, "Starting headless backend");
+	backend->started = true;
 
 	struct wlr_headless_output *output;
 	wl_list_for_each(output, &backend->outputs, link) {
-		wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+		output->frame_requested = true;
+		headless_output_schedule_frame(output);
 		wlr_output_update_enabled(&output->wlr_output, true);
 		wlr_signal_emit_safe(&backend->backend.events.new_output,
 			&output->wlr_output);
@@ -42,7 +45,6 @@ static bool backend_start(struct wlr_backend *wlr_backend) {
 			&input_device->wlr_input_device);
 	}
 
-	backend->started = true;
 	return true;
 }
 
@@ -70,6 +72,7 @@ static void backend_destroy(struct wlr_backend *wlr_backend) {
 	wlr_backend_finish(wlr_backend);
 
 	close(backend->drm_fd);
+	free(backend->render_node);
 	free(backend);
 }
 
@@ -149,53 +152,42 @@ static bool backend_init(struct wlr_headless_backend *backend,
 	return true;
 }
 
-static int open_drm_render_node(void) {
-	uint32_t flags = 0;
-	int devices_len = drmGetDevices2(flags, NULL, 0);
-	if (devices_len < 0) {
-		wlr_log(WLR_ERROR, "drmGetDevices2 failed: %s", strerror(-devices_len));
-		return -1;
-	}
-	drmDevice **devices = calloc(devices_len, sizeof(drmDevice *));
-	if (devices == NULL) {
-		wlr_log_errno(WLR_ERROR, "Allocation failed");
-		return -1;
-	}
-	devices_len = drmGetDevices2(flags, devices, devices_len);
-	if (devices_len < 0) {
-		free(devices);
-		wlr_log(WLR_ERROR, "drmGetDevices2 failed: %s", strerror(-devices_len));
-		return -1;
+static bool parse_render_node_env(struct wlr_headless_backend_options *options) {
+	const char *env = getenv("WLR_HEADLESS_RENDER_NODE");
+	if (env == NULL || env[0] == '\0') {
+		return true;
 	}
 
-	int fd = -1;
-	for (int i = 0; i < devices_len; i++) {
-		drmDevice *dev = devices[i];
-		if (dev->available_nodes & (1 << DRM_NODE_RENDER)) {
-			const char *name = dev->nodes[DRM_NODE_RENDER];
-			wlr_log(WLR_DEBUG, "Opening DRM render node '%s'", name);
-			fd = open(name, O_RDWR | O_CLOEXEC);
-			if (fd < 0) {
-				wlr_log_errno(WLR_ERROR, "Failed to open '%s'", name);
-				goto out;
-			}
-			break;
-		}
-	}
-	if (fd < 0) {
-		wlr_log(WLR_ERROR, "Failed to find any DRM render node");
+	if (env[0] == '/') {
+		options->render_node = env;
+	} else if (strcmp(env, "first") == 0) {
+		options->render_node_policy = WLR_HEADLESS_RENDER_NODE_FIRST;
+	} else if (strcmp(env, "least-loaded") == 0) {
+		options->render_node_policy = WLR_HEADLESS_RENDER_NODE_LEAST_LOADED;
+	} else if (strcmp(env, "round-robin") == 0) {
+		options->render_node_policy = WLR_HEADLESS_RENDER_NODE_ROUND_ROBIN;
+	} else if (strcmp(env, "numa-local") == 0) {
+		options->render_node_policy = WLR_HEADLESS_RENDER_NODE_NUMA_LOCAL;
+	} else {
+		wlr_log(WLR_ERROR, "Invalid WLR_HEADLESS_RENDER_NODE value: %s", env);
+		return false;
 	}
+	return true;
+}
 
-out:
-	for (int i = 0; i < devices_len; i++) {
-		drmFreeDevice(&devices[i]);
+struct wlr_backend *wlr_headless_backend_create(struct wl_display *display) {
+	struct wlr_headless_backend_options options = {
+		.render_node_policy = WLR_HEADLESS_RENDER_NODE_FIRST,
+	};
+	if (!parse_render_node_env(&options)) {
+		return NULL;
 	}
-	free(devices);
-
-	return fd;
+	return wlr_headless_backend_create_with_options(display, &options);
 }
 
-struct wlr_backend *wlr_headless_backend_create(struct wl_display *display) {
+struct wlr_backend *wlr_headless_backend_create_with_options(
+		struct wl_display *display,
+		const struct wlr_headless_backend_options *options) {
 	wlr_log(WLR_INFO, "Creating headless backend");
 
 	struct wlr_headless_backend *backend =
@@ -205,7 +197,7 @@ struct wlr_backend *wlr_headless_backend_create(struct wl_display *display) {
 		return NULL;
 	}
 
-	backend->drm_fd = open_drm_render_node();
+	backend->drm_fd = headless_open_render_node(options, &backend->render_node);
 	if (backend->drm_fd < 0) {
 		wlr_log(WLR_ERROR, "Failed to open DRM render node");
 	}
@@ -218,6 +210,7 @@ struct wlr_backend *wlr_headless_backend_create(struct wl_display *display) {
 
 error_init:
 	close(backend->drm_fd);
+	free(backend->render_node);
 	free(backend);
 	return NULL;
 }
@@ -242,6 +235,7 @@ struct wlr_backend *wlr_headless_backend_create_with_renderer(
 		if (backend->drm_fd < 0) {
 			wlr_log_errno(WLR_ERROR, "fcntl(F_DUPFD_CLOEXEC) failed");
 		}
+		backend->render_node = drmGetRenderDeviceNameFromFd(drm_fd);
 	}
 
 	if (!backend_init(backend, display, renderer)) {
@@ -252,10 +246,17 @@ struct wlr_backend *wlr_headless_backend_create_with_renderer(
 
 error_init:
 	close(backend->drm_fd);
+	free(backend->render_node);
 	free(backend);
 	return NULL;
 }
 
+const char *wlr_headless_backend_get_render_node(struct wlr_backend *wlr_backend) {
+	struct wlr_headless_backend *backend =
+		headless_backend_from_backend(wlr_backend);
+	return backend->render_node;
+}
+
 bool wlr_backend_is_headless(struct wlr_backend *backend) {
 	return backend->impl == &backend_impl;
 }
@@ -1,11 +1,15 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/util/log.h>
 #include "backend/headless.h"
 #include "util/signal.h"
+#include "util/time.h"
 
 static const uint32_t SUPPORTED_OUTPUT_STATE =
 	WLR_OUTPUT_STATE_BACKEND_OPTIONAL |
@@ -27,7 +31,16 @@ static bool output_set_custom_mode(struct wlr_output *wlr_output, int32_t width,
 		refresh = HEADLESS_DEFAULT_REFRESH;
 	}
 
-	output->frame_delay = 1000000 / refresh;
+	// Restart the vblank grid at the new rate
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t now_ns = timespec_to_nsec(&now);
+	if (output->refresh_ns > 0 && now_ns >= output->vblank_base_ns) {
+		output->msc_base +=
+			(now_ns - output->vblank_base_ns) / output->refresh_ns;
+	}
+	output->vblank_base_ns = now_ns;
+	output->refresh_ns = 1000000000000LL / refresh;
 
 	wlr_output_update_custom_mode(&output->wlr_output, width, height, refresh);
 	return true;
@@ -73,7 +86,22 @@ static bool output_commit(struct wlr_output *wlr_output) {
 		wlr_buffer_unlock(output->front_buffer);
 		output->front_buffer = wlr_buffer_lock(wlr_output->pending.buffer);
 
-		wlr_output_send_present(wlr_output, NULL);
+		output->present_pending = true;
+		output->present_commit_seq = wlr_output->commit_seq + 1;
+		headless_output_schedule_frame(output);
+
+		if (output->frame_sink != NULL) {
+			if (wlr_output->pending.committed & WLR_OUTPUT_STATE_DAMAGE) {
+				pixman_region32_union(&output->frame_sink_damage,
+					&output->frame_sink_damage,
+					&wlr_output->pending.damage);
+			} else {
+				struct wlr_buffer *buffer = wlr_output->pending.buffer;
+				pixman_region32_union_rect(&output->frame_sink_damage,
+					&output->frame_sink_damage, 0, 0,
+					buffer->width, buffer->height);
+			}
+		}
 	}
 
 	return true;
@@ -99,26 +127,152 @@ static bool output_export_dmabuf(struct wlr_output *wlr_output,
 static void output_destroy(struct wlr_output *wlr_output) {
 	struct wlr_headless_output *output =
 		headless_output_from_output(wlr_output);
+	wlr_headless_output_set_frame_sink(wlr_output, NULL);
+	pixman_region32_fini(&output->frame_sink_damage);
 	wl_list_remove(&output->link);
 	wl_event_source_remove(output->frame_timer);
 	wlr_buffer_unlock(output->front_buffer);
 	free(output);
 }
 
+static void output_schedule_frame(struct wlr_output *wlr_output) {
+	struct wlr_headless_output *output =
+		headless_output_from_output(wlr_output);
+	output->frame_requested = true;
+	headless_output_schedule_frame(output);
+}
+
 static const struct wlr_output_impl output_impl = {
 	.destroy = output_destroy,
 	.commit = output_commit,
 	.export_dmabuf = output_export_dmabuf,
+	.schedule_frame = output_schedule_frame,
 };
 
 bool wlr_output_is_headless(struct wlr_output *wlr_output) {
 	return wlr_output->impl == &output_impl;
 }
 
+void wlr_headless_frame_sink_init(struct wlr_headless_frame_sink *sink,
+		const struct wlr_headless_frame_sink_impl *impl) {
+	assert(impl->present && impl->destroy);
+	memset(sink, 0, sizeof(*sink));
+	sink->impl = impl;
+}
+
+void wlr_headless_output_set_frame_sink(struct wlr_output *wlr_output,
+		struct wlr_headless_frame_sink *sink) {
+	struct wlr_headless_output *output =
+		headless_output_from_output(wlr_output);
+	if (output->frame_sink == sink) {
+		return;
+	}
+
+	if (output->frame_sink != NULL) {
+		struct wlr_headless_frame_sink *old = output->frame_sink;
+		output->frame_sink = NULL;
+		old->output = NULL;
+		old->impl->destroy(old);
+	}
+
+	output->frame_sink = sink;
+	if (sink == NULL) {
+		return;
+	}
+	assert(sink->output == NULL);
+	sink->output = wlr_output;
+
+	// The sink hasn't seen any frame yet
+	pixman_region32_clear(&output->frame_sink_damage);
+	if (output->front_buffer != NULL) {
+		pixman_region32_union_rect(&output->frame_sink_damage,
+			&output->frame_sink_damage, 0, 0,
+			output->front_buffer->width, output->front_buffer->height);
+	}
+}
+
+static void output_send_frame_sink(struct wlr_headless_output *output,
+		const struct timespec *when) {
+	if (output->frame_sink == NULL || output->front_buffer == NULL) {
+		return;
+	}
+
+	struct wlr_headless_frame_sink_event event = {
+		.buffer = output->front_buffer,
+		.damage = &output->frame_sink_damage,
+		.when = when,
+		.seq = output->msc,
+		.refresh = output->refresh_ns,
+	};
+	output->frame_sink->impl->present(output->frame_sink, &event);
+	pixman_region32_clear(&output->frame_sink_damage);
+}
+
+void headless_output_schedule_frame(struct wlr_headless_output *output) {
+	if (output->frame_timer_armed || !output->backend->started) {
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t now_ns = timespec_to_nsec(&now);
+
+	int64_t elapsed = now_ns - output->vblank_base_ns;
+	if (elapsed < 0) {
+		elapsed = 0;
+	}
+	int64_t next_ns = output->vblank_base_ns +
+		(elapsed / output->refresh_ns + 1) * output->refresh_ns;
+
+	// The timer has a millisecond granularity, round up so that we never
+	// fire before the vblank
+	int delay_ms = (next_ns - now_ns + 999999) / 1000000;
+	if (delay_ms < 1) {
+		delay_ms = 1;
+	}
+	wl_event_source_timer_update(output->frame_timer, delay_ms);
+	output->frame_timer_armed = true;
+}
+
 static int signal_frame(void *data) {
 	struct wlr_headless_output *output = data;
-	wlr_output_send_frame(&output->wlr_output);
-	wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+	output->frame_timer_armed = false;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t elapsed = timespec_to_nsec(&now) - output->vblank_base_ns;
+	if (elapsed < 0) {
+		elapsed = 0;
+	}
+	uint64_t vblank = elapsed / output->refresh_ns;
+	output->msc = output->msc_base + vblank;
+
+	struct timespec when;
+	timespec_from_nsec(&when,
+		output->vblank_base_ns + (int64_t)vblank * output->refresh_ns);
+
+	bool needs_frame = output->frame_requested;
+	output->frame_requested = false;
+	if (output->present_pending) {
+		output->present_pending = false;
+		needs_frame = true;
+
+		output_send_frame_sink(output, &when);
+
+		struct wlr_output_event_present event = {
+			.commit_seq = output->present_commit_seq,
+			.when = &when,
+			.seq = output->msc,
+			.refresh = output->refresh_ns,
+			.flags = WLR_OUTPUT_PRESENT_VSYNC,
+		};
+		wlr_output_send_present(&output->wlr_output, &event);
+	}
+
+	// Don't tick while the compositor has nothing to show
+	if (needs_frame) {
+		wlr_output_send_frame(&output->wlr_output);
+	}
 	return 0;
 }
 
@@ -134,6 +288,7 @@ struct wlr_output *wlr_headless_add_output(struct wlr_backend *wlr_backend,
 		return NULL;
 	}
 	output->backend = backend;
+	pixman_region32_init(&output->frame_sink_damage);
 	wlr_output_init(&output->wlr_output, &backend->backend, &output_impl,
 		backend->display);
 	struct wlr_output *wlr_output = &output->wlr_output;
@@ -155,7 +310,9 @@ struct wlr_output *wlr_headless_add_output(struct wlr_backend *wlr_backend,
 	wl_list_insert(&backend->outputs, &output->link);
 
 	if (backend->started) {
-		wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+		// Kick off the first frame
+		output->frame_requested = true;
+		headless_output_schedule_frame(output);
 		wlr_output_update_enabled(wlr_output, true);
 		wlr_signal_emit_safe(&backend->backend.events.new_output, wlr_output);
 	}
@@ -0,0 +1,400 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include <xf86drm.h>
+#include "backend/headless.h"
+
+#define MAX_CPUS 4096
+#define CPU_SET_WORDS (MAX_CPUS / 64)
+
+struct cpu_set {
+	uint64_t words[CPU_SET_WORDS];
+};
+
+struct render_node {
+	const char *name;
+	dev_t devs[2]; // render and primary nodes, 0 if missing
+	int numa_node; // -1 if unknown
+	size_t users; // processes having the device open
+};
+
+/**
+ * Parse a CPU list such as "0-3,8,10-11".
+ */
+static bool parse_cpu_list(const char *str, struct cpu_set *set) {
+	memset(set, 0, sizeof(*set));
+	while (*str != '\0' && *str != '\n') {
+		char *end;
+		errno = 0;
+		unsigned long first = strtoul(str, &end, 10);
+		if (errno != 0 || end == str) {
+			return false;
+		}
+		unsigned long last = first;
+		if (*end == '-') {
+			str = end + 1;
+			last = strtoul(str, &end, 10);
+			if (errno != 0 || end == str || last < first) {
+				return false;
+			}
+		}
+		for (unsigned long cpu = first; cpu <= last && cpu < MAX_CPUS; cpu++) {
+			set->words[cpu / 64] |= (uint64_t)1 << (cpu % 64);
+		}
+		str = end;
+		if (*str == ',') {
+			str++;
+		}
+	}
+	return true;
+}
+
+static bool cpu_sets_intersect(const struct cpu_set *a,
+		const struct cpu_set *b) {
+	for (size_t i = 0; i < CPU_SET_WORDS; i++) {
+		if (a->words[i] & b->words[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool read_line(const char *path, char *buf, size_t size) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return false;
+	}
+	bool ok = fgets(buf, size, f) != NULL;
+	fclose(f);
+	return ok;
+}
+
+static bool get_allowed_cpus(struct cpu_set *set) {
+	FILE *f = fopen("/proc/self/status", "r");
+	if (f == NULL) {
+		return false;
+	}
+	static const char prefix[] = "Cpus_allowed_list:";
+	char *line = NULL;
+	size_t line_size = 0;
+	bool ok = false;
+	while (getline(&line, &line_size, f) > 0) {
+		if (strncmp(line, prefix, strlen(prefix)) == 0) {
+			const char *list = line + strlen(prefix);
+			list += strspn(list, " \t");
+			ok = parse_cpu_list(list, set);
+			break;
+		}
+	}
+	free(line);
+	fclose(f);
+	return ok;
+}
+
+static bool numa_node_is_local(int numa_node, const struct cpu_set *allowed) {
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+		numa_node);
+	char buf[1024];
+	struct cpu_set node_cpus;
+	if (!read_line(path, buf, sizeof(buf)) ||
+			!parse_cpu_list(buf, &node_cpus)) {
+		return false;
+	}
+	return cpu_sets_intersect(&node_cpus, allowed);
+}
+
+static int get_numa_node(dev_t dev) {
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/numa_node",
+		major(dev), minor(dev));
+	char buf[16];
+	if (!read_line(path, buf, sizeof(buf))) {
+		return -1;
+	}
+	return atoi(buf);
+}
+
+/**
+ * Count the processes using each device, by looking at the file descriptors
+ * of all the processes we're allowed to inspect.
+ */
+static void count_users(struct render_node *nodes, size_t nodes_len) {
+	DIR *proc = opendir("/proc");
+	if (proc == NULL) {
+		wlr_log_errno(WLR_DEBUG, "Failed to open /proc");
+		return;
+	}
+
+	bool *used = calloc(nodes_len, sizeof(bool));
+	if (used == NULL) {
+		closedir(proc);
+		return;
+	}
+
+	pid_t self = getpid();
+	struct dirent *proc_ent;
+	while ((proc_ent = readdir(proc)) != NULL) {
+		char *end;
+		long pid = strtol(proc_ent->d_name, &end, 10);
+		if (*end != '\0' || pid <= 0 || pid == self) {
+			continue;
+		}
+
+		char fd_path[64];
+		snprintf(fd_path, sizeof(fd_path), "/proc/%ld/fd", pid);
+		DIR *fds = opendir(fd_path);
+		if (fds == NULL) {
+			continue;
+		}
+
+		memset(used, 0, nodes_len * sizeof(bool));
+		struct dirent *fd_ent;
+		while ((fd_ent = readdir(fds)) != NULL) {
+			if (fd_ent->d_name[0] == '.') {
+				continue;
+			}
+			struct stat st;
+			if (fstatat(dirfd(fds), fd_ent->d_name, &st, 0) != 0 ||
+					!S_ISCHR(st.st_mode)) {
+				continue;
+			}
+			for (size_t i = 0; i < nodes_len; i++) {
+				if (st.st_rdev == nodes[i].devs[0] ||
+						st.st_rdev == nodes[i].devs[1]) {
+					used[i] = true;
+				}
+			}
+		}
+		closedir(fds);
+
+		for (size_t i = 0; i < nodes_len; i++) {
+			if (used[i]) {
+				nodes[i].users++;
+			}
+		}
+	}
+
+	free(used);
+	closedir(proc);
+}
+
+/**
+ * Get the next round-robin index. The counter is shared by all the processes
+ * of the user through a file in XDG_RUNTIME_DIR.
+ */
+static size_t get_round_robin_index(void) {
+	static size_t local_counter = 0;
+
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (runtime_dir == NULL) {
+		return local_counter++;
+	}
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/wlroots-headless-render-node",
+		runtime_dir);
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		wlr_log_errno(WLR_DEBUG, "Failed to open '%s'", path);
+		return local_counter++;
+	}
+
+	struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+	if (fcntl(fd, F_SETLKW, &lock) != 0) {
+		wlr_log_errno(WLR_DEBUG, "Failed to lock '%s'", path);
+		close(fd);
+		return local_counter++;
+	}
+
+	char buf[32] = {0};
+	ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+	size_t index = n > 0 ? strtoul(buf, NULL, 10) : 0;
+
+	int len = snprintf(buf, sizeof(buf), "%zu\n", index + 1);
+	if (ftruncate(fd, 0) != 0 || pwrite(fd, buf, len, 0) != len) {
+		wlr_log_errno(WLR_DEBUG, "Failed to write '%s'", path);
+	}
+
+	close(fd); // releases the lock
+	return index;
+}
+
+static const char *policy_name(enum wlr_headless_render_node_policy policy) {
+	switch (policy) {
+	case WLR_HEADLESS_RENDER_NODE_FIRST:
+		return "first";
+	case WLR_HEADLESS_RENDER_NODE_LEAST_LOADED:
+		return "least-loaded";
+	case WLR_HEADLESS_RENDER_NODE_ROUND_ROBIN:
+		return "round-robin";
+	case WLR_HEADLESS_RENDER_NODE_NUMA_LOCAL:
+		return "numa-local";
+	}
+	abort(); // unreachable
+}
+
+static size_t pick_least_loaded(const struct render_node *nodes,
+		size_t nodes_len, const bool *candidates) {
+	size_t best = nodes_len;
+	for (size_t i = 0; i < nodes_len; i++) {
+		if (candidates != NULL && !candidates[i]) {
+			continue;
+		}
+		if (best == nodes_len || nodes[i].users < nodes[best].users) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+static size_t pick_render_node(struct render_node *nodes, size_t nodes_len,
+		enum wlr_headless_render_node_policy policy) {
+	switch (policy) {
+	case WLR_HEADLESS_RENDER_NODE_FIRST:
+		return 0;
+	case WLR_HEADLESS_RENDER_NODE_ROUND_ROBIN:
+		return get_round_robin_index() % nodes_len;
+	case WLR_HEADLESS_RENDER_NODE_LEAST_LOADED:
+		count_users(nodes, nodes_len);
+		return pick_least_loaded(nodes, nodes_len, NULL);
+	case WLR_HEADLESS_RENDER_NODE_NUMA_LOCAL:;
+		// Least-loaded among the devices attached to a NUMA node the
+		// process can run on
+		struct cpu_set allowed;
+		bool *local = calloc(nodes_len, sizeof(bool));
+		if (local == NULL || !get_allowed_cpus(&allowed)) {
+			wlr_log(WLR_DEBUG, "Failed to get allowed CPUs, "
+				"ignoring NUMA locality");
+			free(local);
+			count_users(nodes, nodes_len);
+			return pick_least_loaded(nodes, nodes_len, NULL);
+		}
+		bool any_local = false;
+		for (size_t i = 0; i < nodes_len; i++) {
+			local[i] = nodes[i].numa_node < 0 ||
+				numa_node_is_local(nodes[i].numa_node, &allowed);
+			any_local = any_local || local[i];
+		}
+		if (!any_local) {
+			wlr_log(WLR_DEBUG, "No DRM render node is NUMA-local");
+		}
+		count_users(nodes, nodes_len);
+		size_t index = pick_least_loaded(nodes, nodes_len,
+			any_local ? local : NULL);
+		free(local);
+		return index;
+	}
+	abort(); // unreachable
+}
+
+static dev_t get_node_dev(const char *name) {
+	struct stat st;
+	if (name == NULL || stat(name, &st) != 0) {
+		return 0;
+	}
+	return st.st_rdev;
+}
+
+static int open_render_node(const char *name, char **path) {
+	wlr_log(WLR_DEBUG, "Opening DRM render node '%s'", name);
+	int fd = open(name, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to open '%s'", name);
+		return -1;
+	}
+	*path = strdup(name);
+	return fd;
+}
+
+int headless_open_render_node(const struct wlr_headless_backend_options *options,
+		char **path) {
+	*path = NULL;
+
+	if (options->render_node != NULL) {
+		int fd = open_render_node(options->render_node, path);
+		if (fd >= 0) {
+			wlr_log(WLR_INFO, "Using DRM render node '%s'",
+				options->render_node);
+		}
+		return fd;
+	}
+
+	uint32_t flags = 0;
+	int devices_len = drmGetDevices2(flags, NULL, 0);
+	if (devices_len < 0) {
+		wlr_log(WLR_ERROR, "drmGetDevices2 failed: %s", strerror(-devices_len));
+		return -1;
+	}
+	drmDevice **devices = calloc(devices_len, sizeof(drmDevice *));
+	struct render_node *nodes = calloc(devices_len, sizeof(*nodes));
+	if (devices == NULL || nodes == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		free(devices);
+		free(nodes);
+		return -1;
+	}
+	devices_len = drmGetDevices2(flags, devices, devices_len);
+	if (devices_len < 0) {
+		free(devices);
+		free(nodes);
+		wlr_log(WLR_ERROR, "drmGetDevices2 failed: %s", strerror(-devices_len));
+		return -1;
+	}
+
+	size_t nodes_len = 0;
+	for (int i = 0; i < devices_len; i++) {
+		drmDevice *dev = devices[i];
+		if (!(dev->available_nodes & (1 << DRM_NODE_RENDER))) {
+			continue;
+		}
+		struct render_node *node = &nodes[nodes_len++];
+		node->name = dev->nodes[DRM_NODE_RENDER];
+		node->devs[0] = get_node_dev(node->name);
+		if (dev->available_nodes & (1 << DRM_NODE_PRIMARY)) {
+			node->devs[1] = get_node_dev(dev->nodes[DRM_NODE_PRIMARY]);
+		}
+		node->numa_node = get_numa_node(node->devs[0]);
+	}
+
+	int fd = -1;
+	if (nodes_len == 0) {
+		wlr_log(WLR_ERROR, "Failed to find any DRM render node");
+		goto out;
+	}
+
+	size_t index = pick_render_node(nodes, nodes_len, options->render_node_policy);
+	struct render_node *node = &nodes[index];
+	fd = open_render_node(node->name, path);
+	bool counted_users =
+		options->render_node_policy == WLR_HEADLESS_RENDER_NODE_LEAST_LOADED ||
+		options->render_node_policy == WLR_HEADLESS_RENDER_NODE_NUMA_LOCAL;
+	if (fd >= 0 && counted_users) {
+		wlr_log(WLR_INFO, "Using DRM render node '%s' (policy: %s, "
+			"%zu of %zu, NUMA node %d, %zu other users)", node->name,
+			policy_name(options->render_node_policy), index + 1, nodes_len,
+			node->numa_node, node->users);
+	} else if (fd >= 0) {
+		wlr_log(WLR_INFO, "Using DRM render node '%s' (policy: %s, "
+			"%zu of %zu, NUMA node %d)", node->name,
+			policy_name(options->render_node_policy), index + 1, nodes_len,
+			node->numa_node);
+	}
+
+out:
+	for (int i = 0; i < devices_len; i++) {
+		drmFreeDevice(&devices[i]);
+	}
+	free(devices);
+	free(nodes);
+
+	return fd;
+}
@@ -6,6 +6,7 @@
 #include <wlr/backend/session.h>
 #include <wlr/util/log.h>
 #include "backend/libinput.h"
+#include "util/priority_loop.h"
 #include "util/signal.h"
 
 static struct wlr_libinput_backend *get_libinput_backend_from_backend(
@@ -120,7 +121,10 @@ static bool backend_start(struct wlr_backend *wlr_backend) {
 	}
 
 	struct wl_event_loop *event_loop =
-		wl_display_get_event_loop(backend->display);
+		get_priority_event_loop(backend->display);
+	if (event_loop == NULL) {
+		return false;
+	}
 	if (backend->input_event) {
 		wl_event_source_remove(backend->input_event);
 	}
@@ -228,6 +232,16 @@ struct wlr_backend *wlr_libinput_backend_create(struct wl_display *display,
 	return &backend->backend;
 }
 
+void wlr_libinput_backend_dispatch(struct wlr_backend *wlr_backend) {
+	struct wlr_libinput_backend *backend =
+		get_libinput_backend_from_backend(wlr_backend);
+	if (backend->input_event == NULL || !backend->session->active) {
+		return;
+	}
+	handle_libinput_readable(libinput_get_fd(backend->libinput_context),
+		WL_EVENT_READABLE, backend);
+}
+
 struct libinput_device *wlr_libinput_get_device_handle(
 		struct wlr_input_device *wlr_dev) {
 	struct wlr_libinput_input_device *dev =
@@ -1,5 +1,6 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <inttypes.h>
 #include <libudev.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -17,11 +18,14 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include "backend/session/session.h"
+#include "util/priority_loop.h"
 #include "util/signal.h"
+#include "util/startup.h"
 
 #include <libseat.h>
 
 #define WAIT_GPU_TIMEOUT 10000 // ms
+#define DEFAULT_CHANGE_DEBOUNCE_MS 50
 
 static void handle_enable_seat(struct libseat *seat, void *data) {
 	struct wlr_session *session = data;
@@ -92,9 +96,12 @@ static int libseat_session_init(struct wlr_session *session, struct wl_display *
 	}
 	snprintf(session->seat, sizeof(session->seat), "%s", seat_name);
 
-	struct wl_event_loop *event_loop = wl_display_get_event_loop(disp);
-	session->libseat_event = wl_event_loop_add_fd(event_loop, libseat_get_fd(session->seat_handle),
-		WL_EVENT_READABLE, libseat_event, session);
+	struct wl_event_loop *event_loop = get_priority_event_loop(disp);
+	if (event_loop != NULL) {
+		session->libseat_event = wl_event_loop_add_fd(event_loop,
+			libseat_get_fd(session->seat_handle), WL_EVENT_READABLE,
+			libseat_event, session);
+	}
 	if (session->libseat_event == NULL) {
 		wlr_log(WLR_ERROR, "Failed to create libseat event source");
 		goto error;
@@ -139,6 +146,70 @@ static bool is_drm_card(const char *sysname) {
 	return true;
 }
 
+static uint32_t get_udev_property_u32(struct udev_device *udev_dev,
+		const char *name) {
+	const char *str = udev_device_get_property_value(udev_dev, name);
+	if (str == NULL) {
+		return 0;
+	}
+	char *end;
+	unsigned long value = strtoul(str, &end, 10);
+	if (end == str || *end != '\0' || value > UINT32_MAX) {
+		return 0;
+	}
+	return value;
+}
+
+static void device_emit_change(struct wlr_device *dev,
+		const struct wlr_device_change_event *event) {
+	// Events arriving until the timer fires are merged
+	if (dev->session->change_debounce_ms > 0 && dev->change_timer != NULL) {
+		wl_event_source_timer_update(dev->change_timer,
+			dev->session->change_debounce_ms);
+		dev->change_armed = true;
+	}
+	struct wlr_device_change_event copy = *event;
+	wlr_signal_emit_safe(&dev->events.change, &copy);
+}
+
+static int handle_change_timer(void *data) {
+	struct wlr_device *dev = data;
+	dev->change_armed = false;
+	if (!dev->change_pending) {
+		return 0;
+	}
+
+	struct wlr_device_change_event event = dev->pending_change;
+	dev->change_pending = false;
+	dev->pending_change = (struct wlr_device_change_event){0};
+	device_emit_change(dev, &event);
+	return 0;
+}
+
+static void device_handle_change(struct wlr_device *dev,
+		const struct wlr_device_change_event *event) {
+	if (!dev->change_armed || dev->session->change_debounce_ms <= 0) {
+		device_emit_change(dev, event);
+		return;
+	}
+
+	if (!dev->change_pending) {
+		dev->change_pending = true;
+		dev->pending_change = *event;
+	} else {
+		// Fall back to a full rescan if the events don't target the same
+		// connector and property
+		if (dev->pending_change.connector_id != event->connector_id ||
+				dev->pending_change.prop_id != event->prop_id) {
+			dev->pending_change = (struct wlr_device_change_event){0};
+		}
+	}
+
+	// Wait for the end of the burst
+	wl_event_source_timer_update(dev->change_timer,
+		dev->session->change_debounce_ms);
+}
+
 static int handle_udev_event(int fd, uint32_t mask, void *data) {
 	struct wlr_session *session = data;
 
@@ -179,8 +250,17 @@ static int handle_udev_event(int fd, uint32_t mask, void *data) {
 			}
 
 			if (strcmp(action, "change") == 0) {
-				wlr_log(WLR_DEBUG, "DRM device %s changed", sysname);
-				wlr_signal_emit_safe(&dev->events.change, NULL);
+				struct wlr_device_change_event event = {0};
+				if (get_udev_property_u32(udev_dev, "HOTPLUG") == 1) {
+					event.connector_id =
+						get_udev_property_u32(udev_dev, "CONNECTOR");
+					event.prop_id =
+						get_udev_property_u32(udev_dev, "PROPERTY");
+				}
+				wlr_log(WLR_DEBUG, "DRM device %s changed "
+					"(connector %"PRIu32", property %"PRIu32")",
+					sysname, event.connector_id, event.prop_id);
+				device_handle_change(dev, &event);
 			} else if (strcmp(action, "remove") == 0) {
 				wlr_log(WLR_DEBUG, "DRM device %s removed", sysname);
 				wlr_signal_emit_safe(&dev->events.remove, NULL);
@@ -202,7 +282,7 @@ static void handle_display_destroy(struct wl_listener *listener, void *data) {
 	wlr_session_destroy(session);
 }
 
-struct wlr_session *wlr_session_create(struct wl_display *disp) {
+static struct wlr_session *session_create(struct wl_display *disp) {
 	struct wlr_session *session = calloc(1, sizeof(*session));
 	if (!session) {
 		wlr_log_errno(WLR_ERROR, "Allocation failed");
@@ -213,6 +293,7 @@ struct wlr_session *wlr_session_create(struct wl_display *disp) {
 	wl_signal_init(&session->events.add_drm_card);
 	wl_signal_init(&session->events.destroy);
 	wl_list_init(&session->devices);
+	session->change_debounce_ms = DEFAULT_CHANGE_DEBOUNCE_MS;
 
 	if (libseat_session_init(session, disp) == -1) {
 		wlr_log(WLR_ERROR, "Failed to load session backend");
@@ -262,6 +343,13 @@ error_open:
 	return NULL;
 }
 
+struct wlr_session *wlr_session_create(struct wl_display *disp) {
+	int64_t start = startup_phase_begin("session");
+	struct wlr_session *session = session_create(disp);
+	startup_phase_end("session", start);
+	return session;
+}
+
 void wlr_session_destroy(struct wlr_session *session) {
 	if (!session) {
 		return;
@@ -292,7 +380,7 @@ struct wlr_device *wlr_session_open_file(struct wlr_session *session,
 		return NULL;
 	}
 
-	struct wlr_device *dev = malloc(sizeof(*dev));
+	struct wlr_device *dev = calloc(1, sizeof(*dev));
 	if (!dev) {
 		wlr_log_errno(WLR_ERROR, "Allocation failed");
 		goto error;
@@ -307,10 +395,20 @@ struct wlr_device *wlr_session_open_file(struct wlr_session *session,
 	dev->fd = fd;
 	dev->dev = st.st_rdev;
 	dev->device_id = device_id;
+	dev->session = session;
 	wl_signal_init(&dev->events.change);
 	wl_signal_init(&dev->events.remove);
 	wl_list_insert(&session->devices, &dev->link);
 
+	struct wl_event_loop *event_loop =
+		wl_display_get_event_loop(session->display);
+	dev->change_timer = wl_event_loop_add_timer(event_loop,
+		handle_change_timer, dev);
+	if (dev->change_timer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create device change timer, "
+			"change events won't be debounced");
+	}
+
 	return dev;
 
 error:
@@ -326,6 +424,9 @@ void wlr_session_close_file(struct wlr_session *session,
 		wlr_log_errno(WLR_ERROR, "Failed to close device %d", dev->device_id);
 	}
 	close(dev->fd);
+	if (dev->change_timer != NULL) {
+		wl_event_source_remove(dev->change_timer);
+	}
 	wl_list_remove(&dev->link);
 	free(dev);
 }
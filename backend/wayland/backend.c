@@ -27,6 +27,7 @@
 #include "linux-dmabuf-unstable-v1-client-protocol.h"
 #include "pointer-gestures-unstable-v1-client-protocol.h"
 #include "presentation-time-client-protocol.h"
+#include "viewporter-client-protocol.h"
 #include "xdg-decoration-unstable-v1-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 #include "tablet-unstable-v2-client-protocol.h"
@@ -100,6 +101,17 @@ static const struct zwp_linux_dmabuf_v1_listener linux_dmabuf_v1_listener = {
 	.modifier = linux_dmabuf_v1_handle_modifier,
 };
 
+static void presentation_handle_clock_id(void *data,
+		struct wp_presentation *presentation, uint32_t clock_id) {
+	struct wlr_wl_backend *wl = data;
+	// Presentation timestamps from the parent compositor are forwarded as-is
+	wl->presentation_clock = clock_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	.clock_id = presentation_handle_clock_id,
+};
+
 static bool device_has_name(const drmDevice *device, const char *name) {
 	for (size_t i = 0; i < DRM_NODE_MAX; i++) {
 		if (!(device->available_nodes & (1 << i))) {
@@ -210,6 +222,12 @@ static void registry_global(void *data, struct wl_registry *registry,
 	if (strcmp(iface, wl_compositor_interface.name) == 0) {
 		wl->compositor = wl_registry_bind(registry, name,
 			&wl_compositor_interface, 4);
+	} else if (strcmp(iface, wl_subcompositor_interface.name) == 0) {
+		wl->subcompositor = wl_registry_bind(registry, name,
+			&wl_subcompositor_interface, 1);
+	} else if (strcmp(iface, wp_viewporter_interface.name) == 0) {
+		wl->viewporter = wl_registry_bind(registry, name,
+			&wp_viewporter_interface, 1);
 	} else if (strcmp(iface, wl_seat_interface.name) == 0) {
 		struct wl_seat *wl_seat = wl_registry_bind(registry, name,
 			&wl_seat_interface, 5);
@@ -229,6 +247,8 @@ static void registry_global(void *data, struct wl_registry *registry,
 	} else if (strcmp(iface, wp_presentation_interface.name) == 0) {
 		wl->presentation = wl_registry_bind(registry, name,
 			&wp_presentation_interface, 1);
+		wp_presentation_add_listener(wl->presentation,
+			&presentation_listener, wl);
 	} else if (strcmp(iface, zwp_tablet_manager_v2_interface.name) == 0) {
 		wl->tablet_manager = wl_registry_bind(registry, name,
 			&zwp_tablet_manager_v2_interface, 1);
@@ -341,6 +361,12 @@ static void backend_destroy(struct wlr_backend *backend) {
 	if (wl->zwp_relative_pointer_manager_v1) {
 		zwp_relative_pointer_manager_v1_destroy(wl->zwp_relative_pointer_manager_v1);
 	}
+	if (wl->viewporter) {
+		wp_viewporter_destroy(wl->viewporter);
+	}
+	if (wl->subcompositor) {
+		wl_subcompositor_destroy(wl->subcompositor);
+	}
 	free(wl->drm_render_name);
 	xdg_wm_base_destroy(wl->xdg_wm_base);
 	wl_compositor_destroy(wl->compositor);
@@ -361,11 +387,17 @@ static uint32_t get_buffer_caps(struct wlr_backend *backend) {
 		| (wl->shm ? WLR_BUFFER_CAP_SHM : 0);
 }
 
+static clockid_t backend_get_presentation_clock(struct wlr_backend *backend) {
+	struct wlr_wl_backend *wl = get_wl_backend_from_backend(backend);
+	return wl->presentation_clock;
+}
+
 static const struct wlr_backend_impl backend_impl = {
 	.start = backend_start,
 	.destroy = backend_destroy,
 	.get_drm_fd = backend_get_drm_fd,
 	.get_buffer_caps = get_buffer_caps,
+	.get_presentation_clock = backend_get_presentation_clock,
 };
 
 bool wlr_backend_is_wl(struct wlr_backend *b) {
@@ -395,6 +427,7 @@ struct wlr_backend *wlr_wl_backend_create(struct wl_display *display,
 	wl_list_init(&wl->outputs);
 	wl_list_init(&wl->seats);
 	wl_list_init(&wl->buffers);
+	wl->presentation_clock = CLOCK_MONOTONIC;
 
 	wl->remote_display = wl_display_connect(remote);
 	if (!wl->remote_display) {
@@ -410,7 +443,7 @@ struct wlr_backend *wlr_wl_backend_create(struct wl_display *display,
 
 	wl_registry_add_listener(wl->registry, &registry_listener, wl);
 	wl_display_roundtrip(wl->remote_display); // get globals
-	wl_display_roundtrip(wl->remote_display); // get linux-dmabuf formats
+	wl_display_roundtrip(wl->remote_display); // get linux-dmabuf formats, presentation clock
 
 	if (!wl->compositor) {
 		wlr_log(WLR_ERROR,
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -5,6 +6,7 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <drm_fourcc.h>
@@ -20,9 +22,11 @@
 #include "render/swapchain.h"
 #include "render/wlr_renderer.h"
 #include "util/signal.h"
+#include "util/time.h"
 
 #include "linux-dmabuf-unstable-v1-client-protocol.h"
 #include "presentation-time-client-protocol.h"
+#include "viewporter-client-protocol.h"
 #include "xdg-decoration-unstable-v1-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 
@@ -31,12 +35,32 @@ static const uint32_t SUPPORTED_OUTPUT_STATE =
 	WLR_OUTPUT_STATE_BUFFER |
 	WLR_OUTPUT_STATE_MODE;
 
+// Maximum number of frames waiting for presentation feedback before we stop
+// rendering ahead of the parent's frame callbacks
+static const size_t MAX_INFLIGHT_FRAMES = 2;
+static const uint32_t DEFAULT_REFRESH_NS = 1000000000 / 60;
+
+// Maximum number of imported buffers kept around once the parent compositor
+// has released them
+static const int MAX_CACHED_BUFFERS = 8;
+
 static struct wlr_wl_output *get_wl_output_from_output(
 		struct wlr_output *wlr_output) {
 	assert(wlr_output_is_wl(wlr_output));
 	return (struct wlr_wl_output *)wlr_output;
 }
 
+static void output_send_frame(struct wlr_wl_output *output) {
+	if (output->frame_sent) {
+		return;
+	}
+	output->frame_sent = true;
+	if (output->frame_timer != NULL) {
+		wl_event_source_timer_update(output->frame_timer, 0);
+	}
+	wlr_output_send_frame(&output->wlr_output);
+}
+
 static void surface_frame_callback(void *data, struct wl_callback *cb,
 		uint32_t time) {
 	struct wlr_wl_output *output = data;
@@ -44,7 +68,41 @@ static void surface_frame_callback(void *data, struct wl_callback *cb,
 	wl_callback_destroy(cb);
 	output->frame_callback = NULL;
 
-	wlr_output_send_frame(&output->wlr_output);
+	output_send_frame(output);
+}
+
+static int handle_frame_timer(void *data) {
+	struct wlr_wl_output *output = data;
+	// The parent didn't send a frame callback in time, render ahead
+	output_send_frame(output);
+	return 0;
+}
+
+static bool output_paces_frames(struct wlr_wl_output *output) {
+	return output->frame_timer != NULL;
+}
+
+static void output_schedule_frame_timer(struct wlr_wl_output *output) {
+	uint32_t refresh_ns = output->refresh_ns;
+	if (refresh_ns == 0) {
+		refresh_ns = DEFAULT_REFRESH_NS;
+	}
+
+	struct timespec now;
+	clock_gettime(output->backend->presentation_clock, &now);
+	int64_t now_ns = timespec_to_nsec(&now);
+
+	// Predict the next parent vblank from the last presentation, and leave
+	// one refresh period of slack for the frame callback to arrive first
+	int64_t next_ns = now_ns + refresh_ns;
+	if (output->last_present_ns != 0 && output->last_present_ns <= now_ns) {
+		int64_t periods = (now_ns - output->last_present_ns) / refresh_ns + 1;
+		next_ns = output->last_present_ns + periods * refresh_ns;
+	}
+	next_ns += refresh_ns;
+
+	int delay_ms = (next_ns - now_ns + 999999) / 1000000;
+	wl_event_source_timer_update(output->frame_timer, delay_ms);
 }
 
 static const struct wl_callback_listener frame_listener = {
@@ -73,6 +131,11 @@ static void presentation_feedback_handle_presented(void *data,
 		.tv_sec = ((uint64_t)tv_sec_hi << 32) | tv_sec_lo,
 		.tv_nsec = tv_nsec,
 	};
+	feedback->output->last_present_ns = timespec_to_nsec(&t);
+	if (refresh_ns != 0) {
+		feedback->output->refresh_ns = refresh_ns;
+	}
+
 	struct wlr_output_event_present event = {
 		.commit_seq = feedback->commit_seq,
 		.when = &t,
@@ -111,29 +174,42 @@ void destroy_wl_buffer(struct wlr_wl_buffer *buffer) {
 	if (buffer == NULL) {
 		return;
 	}
-	wl_list_remove(&buffer->buffer_destroy.link);
+	if (buffer->cached) {
+		wlr_addon_finish(&buffer->addon);
+	}
 	wl_list_remove(&buffer->link);
 	wl_buffer_destroy(buffer->wl_buffer);
 	free(buffer);
 }
 
+static void release_wl_buffer(struct wlr_wl_buffer *buffer) {
+	struct wlr_buffer *wlr_buffer = buffer->buffer;
+	if (buffer->cached) {
+		buffer->released = true;
+	} else {
+		destroy_wl_buffer(buffer);
+	}
+	wlr_buffer_unlock(wlr_buffer); // might free buffer
+}
+
 static void buffer_handle_release(void *data, struct wl_buffer *wl_buffer) {
-	struct wlr_wl_buffer *buffer = data;
-	buffer->released = true;
-	wlr_buffer_unlock(buffer->buffer); // might free buffer
+	release_wl_buffer(data);
 }
 
 static const struct wl_buffer_listener buffer_listener = {
 	.release = buffer_handle_release,
 };
 
-static void buffer_handle_buffer_destroy(struct wl_listener *listener,
-		void *data) {
-	struct wlr_wl_buffer *buffer =
-		wl_container_of(listener, buffer, buffer_destroy);
+static void buffer_handle_addon_destroy(struct wlr_addon *addon) {
+	struct wlr_wl_buffer *buffer = wl_container_of(addon, buffer, addon);
 	destroy_wl_buffer(buffer);
 }
 
+static const struct wlr_addon_interface buffer_addon_impl = {
+	.name = "wlr_wl_buffer",
+	.destroy = buffer_handle_addon_destroy,
+};
+
 static bool test_buffer(struct wlr_wl_backend *wl,
 		struct wlr_buffer *wlr_buffer) {
 	struct wlr_dmabuf_attributes dmabuf;
@@ -191,7 +267,7 @@ static struct wl_buffer *import_shm(struct wlr_wl_backend *wl,
 }
 
 static struct wlr_wl_buffer *create_wl_buffer(struct wlr_wl_backend *wl,
-		struct wlr_buffer *wlr_buffer) {
+		struct wlr_buffer *wlr_buffer, bool cached) {
 	if (!test_buffer(wl, wlr_buffer)) {
 		return NULL;
 	}
@@ -221,27 +297,250 @@ static struct wlr_wl_buffer *create_wl_buffer(struct wlr_wl_backend *wl,
 
 	wl_buffer_add_listener(wl_buffer, &buffer_listener, buffer);
 
-	buffer->buffer_destroy.notify = buffer_handle_buffer_destroy;
-	wl_signal_add(&wlr_buffer->events.destroy, &buffer->buffer_destroy);
+	buffer->cached = cached;
+	if (cached) {
+		wlr_addon_init(&buffer->addon, &wlr_buffer->addons, wl,
+			&buffer_addon_impl);
+	}
 
 	return buffer;
 }
 
+/**
+ * Evict the least recently used released buffers until the cache fits.
+ * Buffers still in use by the parent compositor are never evicted.
+ */
+static void trim_wl_buffers(struct wlr_wl_backend *wl) {
+	int len = wl_list_length(&wl->buffers);
+	struct wlr_wl_buffer *buffer, *tmp;
+	wl_list_for_each_reverse_safe(buffer, tmp, &wl->buffers, link) {
+		if (len <= MAX_CACHED_BUFFERS) {
+			break;
+		}
+		if (buffer->released) {
+			destroy_wl_buffer(buffer);
+			len--;
+		}
+	}
+}
+
+/**
+ * Destroy released buffers with the given size. Used when the swapchain is
+ * re-created with a new size, these won't be re-used anymore.
+ */
+static void destroy_released_wl_buffers(struct wlr_wl_backend *wl,
+		int width, int height) {
+	struct wlr_wl_buffer *buffer, *tmp;
+	wl_list_for_each_safe(buffer, tmp, &wl->buffers, link) {
+		if (buffer->released && buffer->buffer->width == width &&
+				buffer->buffer->height == height) {
+			destroy_wl_buffer(buffer);
+		}
+	}
+}
+
 static struct wlr_wl_buffer *get_or_create_wl_buffer(struct wlr_wl_backend *wl,
 		struct wlr_buffer *wlr_buffer) {
-	struct wlr_wl_buffer *buffer;
-	wl_list_for_each(buffer, &wl->buffers, link) {
-		// We can only re-use a wlr_wl_buffer if the parent compositor has
-		// released it, because wl_buffer.release is per-wl_buffer, not per
-		// wl_surface.commit.
-		if (buffer->buffer == wlr_buffer && buffer->released) {
-			buffer->released = false;
-			wlr_buffer_lock(buffer->buffer);
-			return buffer;
+	struct wlr_wl_buffer *buffer = NULL;
+	struct wlr_addon *addon =
+		wlr_addon_find(&wlr_buffer->addons, wl, &buffer_addon_impl);
+	if (addon != NULL) {
+		buffer = wl_container_of(addon, buffer, addon);
+	}
+
+	// We can only re-use a wlr_wl_buffer if the parent compositor has
+	// released it, because wl_buffer.release is per-wl_buffer, not per
+	// wl_surface.commit.
+	if (buffer != NULL && buffer->released) {
+		buffer->released = false;
+		wlr_buffer_lock(buffer->buffer);
+		// Keep the list in most recently used order
+		wl_list_remove(&buffer->link);
+		wl_list_insert(&wl->buffers, &buffer->link);
+		return buffer;
+	}
+
+	buffer = create_wl_buffer(wl, wlr_buffer, buffer == NULL);
+	if (buffer != NULL) {
+		trim_wl_buffers(wl);
+	}
+	return buffer;
+}
+
+static void output_layer_handle_addon_destroy(struct wlr_addon *addon) {
+	struct wlr_wl_output_layer *layer = wl_container_of(addon, layer, addon);
+	wlr_addon_finish(&layer->addon);
+	wl_list_remove(&layer->link);
+	if (layer->viewport != NULL) {
+		wp_viewport_destroy(layer->viewport);
+	}
+	wl_subsurface_destroy(layer->subsurface);
+	wl_surface_destroy(layer->surface);
+	free(layer);
+}
+
+static const struct wlr_addon_interface output_layer_addon_impl = {
+	.name = "wlr_wl_output_layer",
+	.destroy = output_layer_handle_addon_destroy,
+};
+
+static struct wlr_wl_output_layer *get_or_create_output_layer(
+		struct wlr_wl_output *output, struct wlr_output_layer *wlr_layer) {
+	struct wlr_addon *addon = wlr_addon_find(&wlr_layer->addons, output,
+		&output_layer_addon_impl);
+	if (addon != NULL) {
+		struct wlr_wl_output_layer *layer =
+			wl_container_of(addon, layer, addon);
+		return layer;
+	}
+
+	struct wlr_wl_backend *wl = output->backend;
+	struct wlr_wl_output_layer *layer = calloc(1, sizeof(*layer));
+	if (layer == NULL) {
+		return NULL;
+	}
+
+	layer->surface = wl_compositor_create_surface(wl->compositor);
+	layer->subsurface = wl_subcompositor_get_subsurface(wl->subcompositor,
+		layer->surface, output->surface);
+	if (wl->viewporter != NULL) {
+		layer->viewport = wp_viewporter_get_viewport(wl->viewporter,
+			layer->surface);
+	}
+
+	// Input events must keep going to the output surface
+	struct wl_region *region = wl_compositor_create_region(wl->compositor);
+	wl_surface_set_input_region(layer->surface, region);
+	wl_region_destroy(region);
+
+	layer->output = output;
+	wl_list_insert(&output->layers, &layer->link);
+	wlr_addon_init(&layer->addon, &wlr_layer->addons, output,
+		&output_layer_addon_impl);
+	return layer;
+}
+
+static bool output_layer_needs_viewport(
+		const struct wlr_output_layer_state *state) {
+	return (state->src_box.width > 0 && state->src_box.height > 0) ||
+		state->dst_width > 0 || state->dst_height > 0;
+}
+
+/**
+ * Accept layers which the parent compositor can display as sub-surfaces.
+ * Accepted layers must be above all rejected ones, so this goes from the top
+ * and stops at the first layer which can't be forwarded.
+ */
+static void test_layers(struct wlr_wl_output *output,
+		struct wlr_output_state *state) {
+	struct wlr_wl_backend *wl = output->backend;
+	if (wl->subcompositor == NULL) {
+		return;
+	}
+
+	for (size_t i = state->layers_len; i-- > 0;) {
+		struct wlr_output_layer_state *layer_state = &state->layers[i];
+		if (layer_state->buffer != NULL &&
+				(!test_buffer(wl, layer_state->buffer) ||
+				(output_layer_needs_viewport(layer_state) &&
+				wl->viewporter == NULL))) {
+			break;
 		}
+		layer_state->accepted = true;
 	}
+}
 
-	return create_wl_buffer(wl, wlr_buffer);
+static void output_layer_hide(struct wlr_wl_output_layer *layer) {
+	if (!layer->mapped) {
+		return;
+	}
+	wl_surface_attach(layer->surface, NULL, 0, 0);
+	wl_surface_commit(layer->surface);
+	layer->mapped = false;
+}
+
+static bool output_layer_update(struct wlr_wl_output_layer *layer,
+		const struct wlr_output_layer_state *state) {
+	if (state->buffer == NULL) {
+		output_layer_hide(layer);
+		return true;
+	}
+
+	struct wlr_wl_buffer *buffer =
+		get_or_create_wl_buffer(layer->output->backend, state->buffer);
+	if (buffer == NULL) {
+		return false;
+	}
+
+	wl_subsurface_set_position(layer->subsurface, state->x, state->y);
+
+	if (layer->viewport != NULL) {
+		const struct wlr_fbox *src = &state->src_box;
+		if (src->width > 0 && src->height > 0) {
+			wp_viewport_set_source(layer->viewport,
+				wl_fixed_from_double(src->x), wl_fixed_from_double(src->y),
+				wl_fixed_from_double(src->width),
+				wl_fixed_from_double(src->height));
+		} else {
+			wp_viewport_set_source(layer->viewport, wl_fixed_from_int(-1),
+				wl_fixed_from_int(-1), wl_fixed_from_int(-1),
+				wl_fixed_from_int(-1));
+		}
+		if (state->dst_width > 0 && state->dst_height > 0) {
+			wp_viewport_set_destination(layer->viewport,
+				state->dst_width, state->dst_height);
+		} else {
+			wp_viewport_set_destination(layer->viewport, -1, -1);
+		}
+	}
+
+	wl_surface_attach(layer->surface, buffer->wl_buffer, 0, 0);
+	wl_surface_damage_buffer(layer->surface, 0, 0, INT32_MAX, INT32_MAX);
+	// Sub-surfaces are synchronized, this is applied with the output surface
+	wl_surface_commit(layer->surface);
+	layer->mapped = true;
+	return true;
+}
+
+/**
+ * Forward accepted layers to the parent compositor and restack them. This
+ * must be called before committing the output surface.
+ */
+static bool commit_layers(struct wlr_wl_output *output,
+		struct wlr_output_state *state) {
+	struct wl_list updated;
+	wl_list_init(&updated);
+
+	struct wl_surface *below = output->surface;
+	for (size_t i = 0; i < state->layers_len; i++) {
+		struct wlr_output_layer_state *layer_state = &state->layers[i];
+		if (!layer_state->accepted) {
+			continue;
+		}
+
+		struct wlr_wl_output_layer *layer =
+			get_or_create_output_layer(output, layer_state->layer);
+		if (layer == NULL || !output_layer_update(layer, layer_state)) {
+			wlr_log(WLR_ERROR, "Failed to forward output layer");
+			wl_list_insert_list(&output->layers, &updated);
+			return false;
+		}
+
+		wl_subsurface_place_above(layer->subsurface, below);
+		below = layer->surface;
+
+		wl_list_remove(&layer->link);
+		wl_list_insert(updated.prev, &layer->link);
+	}
+
+	// Layers not part of this commit are hidden
+	struct wlr_wl_output_layer *layer;
+	wl_list_for_each(layer, &output->layers, link) {
+		output_layer_hide(layer);
+	}
+
+	wl_list_insert_list(&output->layers, &updated);
+	return true;
 }
 
 static bool output_test(struct wlr_output *wlr_output) {
@@ -266,6 +565,10 @@ static bool output_test(struct wlr_output *wlr_output) {
 		return false;
 	}
 
+	if (wlr_output->pending.committed & WLR_OUTPUT_STATE_LAYERS) {
+		test_layers(output, &wlr_output->pending);
+	}
+
 	return true;
 }
 
@@ -278,6 +581,8 @@ static bool output_commit(struct wlr_output *wlr_output) {
 	}
 
 	if (wlr_output->pending.committed & WLR_OUTPUT_STATE_MODE) {
+		destroy_released_wl_buffers(output->backend,
+			wlr_output->width, wlr_output->height);
 		if (!output_set_custom_mode(wlr_output,
 				wlr_output->pending.custom_mode.width,
 				wlr_output->pending.custom_mode.height,
@@ -301,13 +606,25 @@ static bool output_commit(struct wlr_output *wlr_output) {
 			damage = &wlr_output->pending.damage;
 		}
 
-		if (output->frame_callback != NULL) {
+		if (output->frame_callback != NULL && (!output_paces_frames(output) ||
+				wl_list_length(&output->presentation_feedbacks) >=
+				(int)MAX_INFLIGHT_FRAMES)) {
 			wlr_log(WLR_ERROR, "Skipping buffer swap");
+			if (wp_feedback != NULL) {
+				wp_presentation_feedback_destroy(wp_feedback);
+			}
 			return false;
 		}
 
-		output->frame_callback = wl_surface_frame(output->surface);
-		wl_callback_add_listener(output->frame_callback, &frame_listener, output);
+		if (output->frame_callback == NULL) {
+			output->frame_callback = wl_surface_frame(output->surface);
+			wl_callback_add_listener(output->frame_callback, &frame_listener,
+				output);
+		}
+		output->frame_sent = false;
+		if (output_paces_frames(output)) {
+			output_schedule_frame_timer(output);
+		}
 
 		struct wlr_buffer *wlr_buffer = wlr_output->pending.buffer;
 		struct wlr_wl_buffer *buffer =
@@ -316,6 +633,12 @@ static bool output_commit(struct wlr_output *wlr_output) {
 			return false;
 		}
 
+		if ((wlr_output->pending.committed & WLR_OUTPUT_STATE_LAYERS) &&
+				!commit_layers(output, &wlr_output->pending)) {
+			release_wl_buffer(buffer);
+			return false;
+		}
+
 		wl_surface_attach(output->surface, buffer->wl_buffer, 0, 0);
 
 		if (damage == NULL) {
@@ -418,6 +741,9 @@ static void output_destroy(struct wlr_output *wlr_output) {
 	if (output->frame_callback) {
 		wl_callback_destroy(output->frame_callback);
 	}
+	if (output->frame_timer != NULL) {
+		wl_event_source_remove(output->frame_timer);
+	}
 
 	struct wlr_wl_presentation_feedback *feedback, *feedback_tmp;
 	wl_list_for_each_safe(feedback, feedback_tmp,
@@ -534,6 +860,18 @@ struct wlr_output *wlr_wl_output_create(struct wlr_backend *wlr_backend) {
 
 	output->backend = backend;
 	wl_list_init(&output->presentation_feedbacks);
+	wl_list_init(&output->layers);
+
+	if (backend->presentation != NULL) {
+		struct wl_event_loop *loop =
+			wl_display_get_event_loop(backend->local_display);
+		output->frame_timer =
+			wl_event_loop_add_timer(loop, handle_frame_timer, output);
+		if (output->frame_timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create frame timer, "
+				"falling back to frame callbacks only");
+		}
+	}
 
 	output->surface = wl_compositor_create_surface(backend->compositor);
 	if (!output->surface) {
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <drm_fourcc.h>
 #include <xcb/dri3.h>
@@ -12,6 +13,9 @@
 #include <xcb/shm.h>
 #include <xcb/xcb.h>
 #include <xcb/xinput.h>
+#if HAS_XSHMFENCE
+#include <X11/xshmfence.h>
+#endif
 
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/interfaces/wlr_pointer.h>
@@ -68,6 +72,9 @@ static bool output_set_custom_mode(struct wlr_output *wlr_output,
 	return true;
 }
 
+// Maximum number of imported buffers per output
+static const int MAX_CACHED_BUFFERS = 8;
+
 static void destroy_x11_buffer(struct wlr_x11_buffer *buffer);
 
 static void output_destroy(struct wlr_output *wlr_output) {
@@ -117,19 +124,28 @@ static void destroy_x11_buffer(struct wlr_x11_buffer *buffer) {
 	if (!buffer) {
 		return;
 	}
-	wl_list_remove(&buffer->buffer_destroy.link);
+	wlr_addon_finish(&buffer->addon);
 	wl_list_remove(&buffer->link);
+#if HAS_XSHMFENCE
+	if (buffer->shm_fence != NULL) {
+		xcb_sync_destroy_fence(buffer->x11->xcb, buffer->idle_fence);
+		xshmfence_unmap_shm(buffer->shm_fence);
+	}
+#endif
 	xcb_free_pixmap(buffer->x11->xcb, buffer->pixmap);
 	free(buffer);
 }
 
-static void buffer_handle_buffer_destroy(struct wl_listener *listener,
-		void *data) {
-	struct wlr_x11_buffer *buffer =
-		wl_container_of(listener, buffer, buffer_destroy);
+static void buffer_handle_addon_destroy(struct wlr_addon *addon) {
+	struct wlr_x11_buffer *buffer = wl_container_of(addon, buffer, addon);
 	destroy_x11_buffer(buffer);
 }
 
+static const struct wlr_addon_interface buffer_addon_impl = {
+	.name = "wlr_x11_buffer",
+	.destroy = buffer_handle_addon_destroy,
+};
+
 static xcb_pixmap_t import_dmabuf(struct wlr_x11_output *output,
 		struct wlr_dmabuf_attributes *dmabuf) {
 	struct wlr_x11_backend *x11 = output->x11;
@@ -208,6 +224,50 @@ static xcb_pixmap_t import_shm(struct wlr_x11_output *output,
 	return pixmap;
 }
 
+#if HAS_XSHMFENCE
+static void create_idle_fence(struct wlr_x11_buffer *buffer) {
+	struct wlr_x11_backend *x11 = buffer->x11;
+	if (!x11->have_dri3) {
+		return;
+	}
+
+	int fd = xshmfence_alloc_shm();
+	if (fd < 0) {
+		wlr_log(WLR_DEBUG, "Failed to allocate shm fence");
+		return;
+	}
+	struct xshmfence *shm_fence = xshmfence_map_shm(fd);
+	if (shm_fence == NULL) {
+		wlr_log(WLR_DEBUG, "Failed to map shm fence");
+		close(fd);
+		return;
+	}
+
+	// xcb closes the FD after sending it
+	buffer->idle_fence = xcb_generate_id(x11->xcb);
+	xcb_dri3_fence_from_fd(x11->xcb, buffer->pixmap, buffer->idle_fence,
+		false, fd);
+	buffer->shm_fence = shm_fence;
+}
+#endif
+
+/**
+ * Release the buffers whose idle fence has been triggered, without waiting
+ * for the PresentIdleNotify event.
+ */
+static void release_idle_x11_buffers(struct wlr_x11_output *output) {
+#if HAS_XSHMFENCE
+	struct wlr_x11_buffer *buffer, *tmp;
+	wl_list_for_each_safe(buffer, tmp, &output->buffers, link) {
+		if (!buffer->idle && buffer->shm_fence != NULL &&
+				xshmfence_query(buffer->shm_fence)) {
+			buffer->idle = true;
+			wlr_buffer_unlock(buffer->buffer); // may destroy buffer
+		}
+	}
+#endif
+}
+
 static struct wlr_x11_buffer *create_x11_buffer(struct wlr_x11_output *output,
 		struct wlr_buffer *wlr_buffer) {
 	struct wlr_x11_backend *x11 = output->x11;
@@ -234,24 +294,68 @@ static struct wlr_x11_buffer *create_x11_buffer(struct wlr_x11_output *output,
 	buffer->pixmap = pixmap;
 	buffer->x11 = x11;
 	wl_list_insert(&output->buffers, &buffer->link);
+#if HAS_XSHMFENCE
+	create_idle_fence(buffer);
+#endif
 
-	buffer->buffer_destroy.notify = buffer_handle_buffer_destroy;
-	wl_signal_add(&wlr_buffer->events.destroy, &buffer->buffer_destroy);
+	wlr_addon_init(&buffer->addon, &wlr_buffer->addons, output,
+		&buffer_addon_impl);
 
 	return buffer;
 }
 
+/**
+ * Evict the least recently used idle pixmaps until the cache fits. Pixmaps
+ * the X server is still using are never evicted.
+ */
+static void trim_x11_buffers(struct wlr_x11_output *output) {
+	int len = wl_list_length(&output->buffers);
+	struct wlr_x11_buffer *buffer, *tmp;
+	wl_list_for_each_reverse_safe(buffer, tmp, &output->buffers, link) {
+		if (len <= MAX_CACHED_BUFFERS) {
+			break;
+		}
+		if (buffer->idle) {
+			destroy_x11_buffer(buffer);
+			len--;
+		}
+	}
+}
+
+/**
+ * Destroy idle pixmaps with the given size. Used when the swapchain is
+ * re-created with a new size, these won't be re-used anymore.
+ */
+static void destroy_idle_x11_buffers(struct wlr_x11_output *output,
+		int width, int height) {
+	struct wlr_x11_buffer *buffer, *tmp;
+	wl_list_for_each_safe(buffer, tmp, &output->buffers, link) {
+		if (buffer->idle && buffer->buffer->width == width &&
+				buffer->buffer->height == height) {
+			destroy_x11_buffer(buffer);
+		}
+	}
+}
+
 static struct wlr_x11_buffer *get_or_create_x11_buffer(
 		struct wlr_x11_output *output, struct wlr_buffer *wlr_buffer) {
 	struct wlr_x11_buffer *buffer;
-	wl_list_for_each(buffer, &output->buffers, link) {
-		if (buffer->buffer == wlr_buffer) {
-			wlr_buffer_lock(buffer->buffer);
-			return buffer;
-		}
+	struct wlr_addon *addon =
+		wlr_addon_find(&wlr_buffer->addons, output, &buffer_addon_impl);
+	if (addon != NULL) {
+		buffer = wl_container_of(addon, buffer, addon);
+		wlr_buffer_lock(buffer->buffer);
+		buffer->idle = false;
+		wl_list_remove(&buffer->link);
+		wl_list_insert(&output->buffers, &buffer->link);
+		return buffer;
+	}
+
+	buffer = create_x11_buffer(output, wlr_buffer);
+	if (buffer != NULL) {
+		trim_x11_buffers(output);
 	}
-
-	return create_x11_buffer(output, wlr_buffer);
+	return buffer;
 }
 
 static bool output_commit_buffer(struct wlr_x11_output *output) {
@@ -300,8 +404,16 @@ static bool output_commit_buffer(struct wlr_x11_output *output) {
 	uint32_t serial = output->wlr_output.commit_seq;
 	uint32_t options = 0;
 	uint64_t target_msc = output->last_msc ? output->last_msc + 1 : 0;
+	uint32_t idle_fence = XCB_NONE;
+#if HAS_XSHMFENCE
+	if (x11_buffer->shm_fence != NULL) {
+		xshmfence_reset(x11_buffer->shm_fence);
+		idle_fence = x11_buffer->idle_fence;
+	}
+#endif
+	x11_buffer->present_serial = serial;
 	xcb_present_pixmap(x11->xcb, output->win, x11_buffer->pixmap, serial,
-		0, region, 0, 0, XCB_NONE, XCB_NONE, XCB_NONE, options, target_msc,
+		0, region, 0, 0, XCB_NONE, XCB_NONE, idle_fence, options, target_msc,
 		0, 0, 0, NULL);
 
 	if (region != XCB_NONE) {
@@ -311,7 +423,11 @@ static bool output_commit_buffer(struct wlr_x11_output *output) {
 	return true;
 
 error:
-	destroy_x11_buffer(x11_buffer);
+	if (x11_buffer != NULL) {
+		// Keep the pixmap cached, it's still valid
+		x11_buffer->idle = true;
+		wlr_buffer_unlock(x11_buffer->buffer); // may destroy x11_buffer
+	}
 	return false;
 }
 
@@ -324,6 +440,8 @@ static bool output_commit(struct wlr_output *wlr_output) {
 	}
 
 	if (wlr_output->pending.committed & WLR_OUTPUT_STATE_MODE) {
+		destroy_idle_x11_buffers(output,
+			wlr_output->width, wlr_output->height);
 		if (!output_set_custom_mode(wlr_output,
 				wlr_output->pending.custom_mode.width,
 				wlr_output->pending.custom_mode.height,
@@ -394,6 +512,19 @@ static bool output_cursor_to_picture(struct wlr_x11_output *output,
 		return true;
 	}
 
+	// Skip the read-back if the X server can access the buffer directly. The
+	// cursor is created from a copy of the picture, so the buffer can be
+	// released right away.
+	struct wlr_x11_buffer *x11_buffer = get_or_create_x11_buffer(output, buffer);
+	if (x11_buffer != NULL) {
+		output->cursor.pic = xcb_generate_id(x11->xcb);
+		xcb_render_create_picture(x11->xcb, output->cursor.pic,
+			x11_buffer->pixmap, x11->argb32, 0, 0);
+		x11_buffer->idle = true;
+		wlr_buffer_unlock(x11_buffer->buffer);
+		return true;
+	}
+
 	int depth = 32;
 	int stride = buffer->width * 4;
 
@@ -495,6 +626,7 @@ static const struct wlr_output_impl output_impl = {
 	.commit = output_commit,
 	.set_cursor = output_set_cursor,
 	.move_cursor = output_move_cursor,
+	.get_cursor_formats = output_get_primary_formats,
 	.get_primary_formats = output_get_primary_formats,
 };
 
@@ -671,6 +803,16 @@ void handle_x11_present_event(struct wlr_x11_backend *x11,
 			return;
 		}
 
+#if HAS_XSHMFENCE
+		// The buffer may have been released already via its idle fence, and
+		// even presented again since then
+		if (buffer->shm_fence != NULL && (buffer->idle ||
+				idle_notify->serial != buffer->present_serial)) {
+			return;
+		}
+#endif
+
+		buffer->idle = true;
 		wlr_buffer_unlock(buffer->buffer); // may destroy buffer
 		break;
 	case XCB_PRESENT_COMPLETE_NOTIFY:;
@@ -683,23 +825,49 @@ void handle_x11_present_event(struct wlr_x11_backend *x11,
 			return;
 		}
 
+		// Estimate the refresh period from successive vblanks
+		if (output->last_msc != 0 && complete_notify->msc > output->last_msc &&
+				complete_notify->ust > output->last_ust) {
+			output->refresh = (complete_notify->ust - output->last_ust) * 1000 /
+				(complete_notify->msc - output->last_msc);
+		}
 		output->last_msc = complete_notify->msc;
+		output->last_ust = complete_notify->ust;
 
-		struct timespec t;
-		timespec_from_nsec(&t, complete_notify->ust * 1000);
+		// Hand back buffers before the compositor renders the next frame
+		release_idle_x11_buffers(output);
 
-		uint32_t flags = 0;
-		if (complete_notify->mode == XCB_PRESENT_COMPLETE_MODE_FLIP) {
-			flags |= WLR_OUTPUT_PRESENT_ZERO_COPY;
+		if (complete_notify->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP) {
+			break;
 		}
 
 		struct wlr_output_event_present present_event = {
 			.output = &output->wlr_output,
 			.commit_seq = complete_notify->serial,
-			.when = &t,
-			.seq = complete_notify->msc,
-			.flags = flags,
 		};
+		if (complete_notify->mode == XCB_PRESENT_COMPLETE_MODE_SKIP) {
+			// The pixmap has been replaced before being displayed: there is
+			// no meaningful timestamp to report
+			wlr_output_send_present(&output->wlr_output, &present_event);
+			wlr_output_send_frame(&output->wlr_output);
+			break;
+		}
+
+		// The X server reports the UST and MSC of the vblank which latched
+		// the pixmap, UST is CLOCK_MONOTONIC in microseconds
+		struct timespec t;
+		timespec_from_nsec(&t, complete_notify->ust * 1000);
+
+		uint32_t flags = WLR_OUTPUT_PRESENT_VSYNC |
+			WLR_OUTPUT_PRESENT_HW_CLOCK | WLR_OUTPUT_PRESENT_HW_COMPLETION;
+		if (complete_notify->mode == XCB_PRESENT_COMPLETE_MODE_FLIP) {
+			flags |= WLR_OUTPUT_PRESENT_ZERO_COPY;
+		}
+
+		present_event.when = &t;
+		present_event.seq = complete_notify->msc;
+		present_event.flags = flags;
+		present_event.refresh = output->refresh;
 		wlr_output_send_present(&output->wlr_output, &present_event);
 
 		wlr_output_send_frame(&output->wlr_output);
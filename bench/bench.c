@@ -0,0 +1,93 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bench.h"
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-n iterations] [-f filter]\n", prog);
+}
+
+bool bench_init(struct bench *bench, const char *suite, size_t iterations,
+		int argc, char *argv[]) {
+	*bench = (struct bench){
+		.suite = suite,
+		.iterations = iterations,
+	};
+
+	int c;
+	while ((c = getopt(argc, argv, "n:f:h")) != -1) {
+		switch (c) {
+		case 'n':
+			bench->iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			bench->filter = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return false;
+		}
+	}
+	if (bench->iterations == 0) {
+		usage(argv[0]);
+		return false;
+	}
+
+	bench->samples = calloc(bench->iterations, sizeof(bench->samples[0]));
+	return bench->samples != NULL;
+}
+
+void bench_finish(struct bench *bench) {
+	free(bench->samples);
+}
+
+int64_t bench_now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+bool bench_start(struct bench *bench, const char *name) {
+	bench->samples_len = 0;
+	return bench->filter == NULL || strstr(name, bench->filter) != NULL;
+}
+
+void bench_add_sample(struct bench *bench, int64_t duration_ns) {
+	if (bench->samples_len < bench->iterations) {
+		bench->samples[bench->samples_len++] = duration_ns;
+	}
+}
+
+static int compare_samples(const void *a, const void *b) {
+	int64_t sa = *(const int64_t *)a, sb = *(const int64_t *)b;
+	return (sa > sb) - (sa < sb);
+}
+
+void bench_report(struct bench *bench, const char *name, size_t bytes) {
+	size_t len = bench->samples_len;
+	if (len == 0) {
+		fprintf(stderr, "%s/%s: no samples collected\n", bench->suite, name);
+		return;
+	}
+
+	qsort(bench->samples, len, sizeof(bench->samples[0]), compare_samples);
+	int64_t total = 0;
+	for (size_t i = 0; i < len; i++) {
+		total += bench->samples[i];
+	}
+	double mean = (double)total / len;
+
+	printf("{\"suite\":\"%s\",\"name\":\"%s\",\"iterations\":%zu,"
+		"\"min_ns\":%lld,\"median_ns\":%lld,\"p99_ns\":%lld,\"mean_ns\":%.1f",
+		bench->suite, name, len, (long long)bench->samples[0],
+		(long long)bench->samples[len / 2],
+		(long long)bench->samples[(len * 99) / 100], mean);
+	if (bytes > 0 && mean > 0) {
+		printf(",\"mib_per_s\":%.1f", bytes / mean * 1e9 / (1024 * 1024));
+	}
+	printf("}\n");
+	fflush(stdout);
+}
@@ -0,0 +1,46 @@
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Minimal benchmark harness. Each benchmark records one sample per
+ * iteration, and bench_report prints the statistics as a JSON object on a
+ * single line of stdout, so that results can be collected and compared by
+ * scripts.
+ */
+struct bench {
+	const char *suite;
+	size_t iterations; // samples to collect per benchmark
+	const char *filter; // only run benchmarks whose name contains this
+
+	int64_t *samples;
+	size_t samples_len;
+};
+
+/**
+ * Parse the common command-line options:
+ *   -n <iterations>  number of iterations per benchmark
+ *   -f <filter>      only run benchmarks whose name contains <filter>
+ */
+bool bench_init(struct bench *bench, const char *suite, size_t iterations,
+	int argc, char *argv[]);
+void bench_finish(struct bench *bench);
+
+int64_t bench_now_ns(void);
+
+/**
+ * Returns true if the benchmark should be run, and resets the samples.
+ */
+bool bench_start(struct bench *bench, const char *name);
+void bench_add_sample(struct bench *bench, int64_t duration_ns);
+/**
+ * Print the results of the current benchmark. If bytes is non-zero, it is
+ * the amount of data processed per iteration and a throughput is reported
+ * too.
+ */
+void bench_report(struct bench *bench, const char *name, size_t bytes);
+
+#endif
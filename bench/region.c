@@ -0,0 +1,69 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pixman.h>
+#include <stdlib.h>
+#include <wlr/util/region.h>
+#include "bench.h"
+
+// Damage of a typical frame: a grid of small rectangles, like a terminal or
+// a text editor repainting a few lines
+static void region_init_grid(pixman_region32_t *region, int rows, int cols) {
+	pixman_region32_init(region);
+	for (int y = 0; y < rows; y++) {
+		for (int x = 0; x < cols; x++) {
+			pixman_region32_union_rect(region, region,
+				x * 40 + (y % 3) * 7, y * 30, 24, 18);
+		}
+	}
+}
+
+#define BENCH_REGION_OP(bench, name, op) \
+	if (bench_start(bench, name)) { \
+		for (size_t i = 0; i < (bench)->iterations; i++) { \
+			pixman_region32_t dst; \
+			pixman_region32_init(&dst); \
+			int64_t start = bench_now_ns(); \
+			op; \
+			bench_add_sample(bench, bench_now_ns() - start); \
+			pixman_region32_fini(&dst); \
+		} \
+		bench_report(bench, name, 0); \
+	}
+
+int main(int argc, char *argv[]) {
+	struct bench bench;
+	if (!bench_init(&bench, "region", 10000, argc, argv)) {
+		return EXIT_FAILURE;
+	}
+
+	pixman_region32_t small, large;
+	region_init_grid(&small, 4, 4);
+	region_init_grid(&large, 32, 48);
+
+	BENCH_REGION_OP(&bench, "scale_integer_16",
+		wlr_region_scale(&dst, &small, 2));
+	BENCH_REGION_OP(&bench, "scale_integer_1536",
+		wlr_region_scale(&dst, &large, 2));
+	BENCH_REGION_OP(&bench, "scale_fractional_16",
+		wlr_region_scale(&dst, &small, 1.5));
+	BENCH_REGION_OP(&bench, "scale_fractional_1536",
+		wlr_region_scale(&dst, &large, 1.5));
+	BENCH_REGION_OP(&bench, "transform_90_1536",
+		wlr_region_transform(&dst, &large, WL_OUTPUT_TRANSFORM_90,
+		1920, 1080));
+	BENCH_REGION_OP(&bench, "transform_flipped_1536",
+		wlr_region_transform(&dst, &large, WL_OUTPUT_TRANSFORM_FLIPPED_180,
+		1920, 1080));
+	BENCH_REGION_OP(&bench, "expand_16",
+		wlr_region_expand(&dst, &small, 2));
+	BENCH_REGION_OP(&bench, "expand_1536",
+		wlr_region_expand(&dst, &large, 2));
+	BENCH_REGION_OP(&bench, "rotated_bounds_1536",
+		wlr_region_rotated_bounds(&dst, &large, 0.3, 960, 540));
+	BENCH_REGION_OP(&bench, "coalesce_1536",
+		wlr_region_coalesce(&dst, &large, 16));
+
+	pixman_region32_fini(&small);
+	pixman_region32_fini(&large);
+	bench_finish(&bench);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+#define _POSIX_C_SOURCE 200809L
+#include <drm_fourcc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+#include "bench.h"
+
+/**
+ * Rendering benchmarks, running on an output of the headless backend. The
+ * renderer can be selected with WLR_RENDERER (e.g. gles2 or pixman).
+ */
+
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+#define TEXTURE_SIZE 256
+
+struct render_state {
+	struct bench *bench;
+	struct wl_display *display;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_output *output;
+	struct wlr_texture *texture;
+
+	// commit-to-present benchmark
+	bool presenting;
+	uint32_t commit_seq;
+	int64_t commit_ns;
+	struct wl_listener frame;
+	struct wl_listener present;
+};
+
+static const float clear_color[] = { 0.25f, 0.25f, 0.25f, 1.0f };
+
+static bool render_frame(struct render_state *state, int n_textures,
+		bool sync) {
+	struct wlr_output *output = state->output;
+	if (!wlr_output_attach_render(output, NULL)) {
+		return false;
+	}
+	wlr_renderer_begin(state->renderer, output->width, output->height);
+	wlr_renderer_clear(state->renderer, clear_color);
+
+	int cols = output->width / TEXTURE_SIZE + 1;
+	for (int i = 0; i < n_textures; i++) {
+		struct wlr_box box = {
+			.x = (i % cols) * TEXTURE_SIZE - (i / cols) % TEXTURE_SIZE,
+			.y = ((i / cols) * TEXTURE_SIZE / 2) % output->height,
+			.width = TEXTURE_SIZE,
+			.height = TEXTURE_SIZE,
+		};
+		float matrix[9];
+		wlr_matrix_project_box(matrix, &box, WL_OUTPUT_TRANSFORM_NORMAL, 0,
+			output->transform_matrix);
+		wlr_render_texture_with_matrix(state->renderer, state->texture,
+			matrix, 0.9f);
+	}
+
+	if (sync) {
+		// Read back a pixel to wait for the GPU to finish
+		uint32_t pixel;
+		wlr_renderer_read_pixels(state->renderer, DRM_FORMAT_ARGB8888, NULL,
+			sizeof(pixel), 1, 1, 0, 0, 0, 0, &pixel);
+	}
+
+	wlr_renderer_end(state->renderer);
+	return wlr_output_commit(output);
+}
+
+static void bench_render_textures(struct render_state *state, int n_textures) {
+	char name[64];
+	snprintf(name, sizeof(name), "render_texture_%d", n_textures);
+	if (!bench_start(state->bench, name)) {
+		return;
+	}
+	for (size_t i = 0; i < state->bench->iterations; i++) {
+		int64_t start = bench_now_ns();
+		if (!render_frame(state, n_textures, true)) {
+			fprintf(stderr, "%s: failed to render frame\n", name);
+			return;
+		}
+		bench_add_sample(state->bench, bench_now_ns() - start);
+	}
+	bench_report(state->bench, name, 0);
+}
+
+static void bench_write_pixels(struct render_state *state, int size) {
+	char name[64];
+	snprintf(name, sizeof(name), "write_pixels_%d", size);
+	if (!bench_start(state->bench, name)) {
+		return;
+	}
+
+	uint32_t stride = size * 4;
+	uint32_t *data = malloc(stride * size);
+	if (data == NULL) {
+		return;
+	}
+	for (int i = 0; i < size * size; i++) {
+		data[i] = 0xFF000000 | (i * 2654435761u);
+	}
+	struct wlr_texture *texture = wlr_texture_from_pixels(state->renderer,
+		DRM_FORMAT_ARGB8888, stride, size, size, data);
+	if (texture == NULL) {
+		free(data);
+		return;
+	}
+
+	// This is what wlr_client_buffer_apply_damage does for shm buffers
+	for (size_t i = 0; i < state->bench->iterations; i++) {
+		int64_t start = bench_now_ns();
+		if (!wlr_texture_write_pixels(texture, stride, size, size,
+				0, 0, 0, 0, data)) {
+			fprintf(stderr, "%s: failed to write pixels\n", name);
+			break;
+		}
+		bench_add_sample(state->bench, bench_now_ns() - start);
+	}
+	bench_report(state->bench, name, (size_t)stride * size);
+
+	wlr_texture_destroy(texture);
+	free(data);
+}
+
+static void handle_frame(struct wl_listener *listener, void *data) {
+	struct render_state *state = wl_container_of(listener, state, frame);
+	if (!state->presenting) {
+		return;
+	}
+	state->commit_seq = state->output->commit_seq + 1;
+	state->commit_ns = bench_now_ns();
+	if (!render_frame(state, 16, false)) {
+		wl_display_terminate(state->display);
+	}
+}
+
+static void handle_present(struct wl_listener *listener, void *data) {
+	struct render_state *state = wl_container_of(listener, state, present);
+	struct wlr_output_event_present *event = data;
+	if (!state->presenting || event->commit_seq != state->commit_seq) {
+		return;
+	}
+	bench_add_sample(state->bench, bench_now_ns() - state->commit_ns);
+	if (state->bench->samples_len >= state->bench->iterations) {
+		state->presenting = false;
+		wl_display_terminate(state->display);
+	}
+}
+
+static void bench_commit_to_present(struct render_state *state) {
+	const char *name = "commit_to_present";
+	if (!bench_start(state->bench, name)) {
+		return;
+	}
+
+	state->frame.notify = handle_frame;
+	wl_signal_add(&state->output->events.frame, &state->frame);
+	state->present.notify = handle_present;
+	wl_signal_add(&state->output->events.present, &state->present);
+
+	state->presenting = true;
+	wlr_output_schedule_frame(state->output);
+	wl_display_run(state->display);
+	state->presenting = false;
+
+	wl_list_remove(&state->frame.link);
+	wl_list_remove(&state->present.link);
+	bench_report(state->bench, name, 0);
+}
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	struct bench bench;
+	if (!bench_init(&bench, "render", 200, argc, argv)) {
+		return EXIT_FAILURE;
+	}
+
+	struct render_state state = { .bench = &bench };
+	state.display = wl_display_create();
+	state.backend = wlr_headless_backend_create(state.display);
+	if (state.backend == NULL) {
+		return EXIT_FAILURE;
+	}
+	state.renderer = wlr_backend_get_renderer(state.backend);
+	state.output = wlr_headless_add_output(state.backend,
+		OUTPUT_WIDTH, OUTPUT_HEIGHT);
+	if (state.renderer == NULL || state.output == NULL ||
+			!wlr_backend_start(state.backend)) {
+		fprintf(stderr, "Failed to set up the headless backend\n");
+		return EXIT_FAILURE;
+	}
+
+	wlr_output_enable(state.output, true);
+	if (!wlr_output_commit(state.output)) {
+		fprintf(stderr, "Failed to enable output\n");
+		return EXIT_FAILURE;
+	}
+
+	uint32_t *pixels = malloc(TEXTURE_SIZE * TEXTURE_SIZE * 4);
+	if (pixels == NULL) {
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < TEXTURE_SIZE * TEXTURE_SIZE; i++) {
+		pixels[i] = 0x80000000 | (i * 2654435761u >> 8);
+	}
+	state.texture = wlr_texture_from_pixels(state.renderer,
+		DRM_FORMAT_ARGB8888, TEXTURE_SIZE * 4, TEXTURE_SIZE, TEXTURE_SIZE,
+		pixels);
+	free(pixels);
+	if (state.texture == NULL) {
+		fprintf(stderr, "Failed to create texture\n");
+		return EXIT_FAILURE;
+	}
+
+	bench_render_textures(&state, 1);
+	bench_render_textures(&state, 64);
+	bench_render_textures(&state, 512);
+	bench_write_pixels(&state, 64);
+	bench_write_pixels(&state, 512);
+	bench_write_pixels(&state, 2048);
+	bench_commit_to_present(&state);
+
+	wlr_texture_destroy(state.texture);
+	wl_display_destroy_clients(state.display);
+	wl_display_destroy(state.display);
+	bench_finish(&bench);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,274 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/util/log.h>
+#include "bench.h"
+
+/**
+ * Surface commit benchmarks. The client side runs in the same process and
+ * talks to the compositor over a socketpair, so each sample includes the
+ * request marshalling, wlr_surface commit handling and the buffer upload.
+ */
+
+#define BUFFER_SIZE 64
+
+struct surface_state {
+	struct bench *bench;
+
+	struct wl_display *server;
+	struct wl_event_loop *server_loop;
+	struct wlr_backend *backend;
+
+	struct wl_display *client;
+	struct wl_compositor *compositor;
+	struct wl_subcompositor *subcompositor;
+	struct wl_shm *shm;
+	struct wl_buffer *buffer;
+};
+
+static void registry_handle_global(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version) {
+	struct surface_state *state = data;
+	if (strcmp(interface, wl_compositor_interface.name) == 0) {
+		state->compositor = wl_registry_bind(registry, name,
+			&wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+		state->subcompositor = wl_registry_bind(registry, name,
+			&wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		state->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	}
+}
+
+static void registry_handle_global_remove(void *data,
+		struct wl_registry *registry, uint32_t name) {
+	// Who cares?
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = registry_handle_global,
+	.global_remove = registry_handle_global_remove,
+};
+
+static void sync_handle_done(void *data, struct wl_callback *callback,
+		uint32_t serial) {
+	bool *done = data;
+	*done = true;
+	wl_callback_destroy(callback);
+}
+
+static const struct wl_callback_listener sync_listener = {
+	.done = sync_handle_done,
+};
+
+/**
+ * Alternate between the client and the compositor until the compositor has
+ * processed all pending requests.
+ */
+static bool roundtrip(struct surface_state *state) {
+	bool done = false;
+	struct wl_callback *callback = wl_display_sync(state->client);
+	wl_callback_add_listener(callback, &sync_listener, &done);
+
+	while (!done) {
+		if (wl_display_flush(state->client) < 0) {
+			return false;
+		}
+		wl_event_loop_dispatch(state->server_loop, 0);
+		wl_display_flush_clients(state->server);
+
+		while (wl_display_prepare_read(state->client) != 0) {
+			wl_display_dispatch_pending(state->client);
+		}
+		struct pollfd pfd = {
+			.fd = wl_display_get_fd(state->client),
+			.events = POLLIN,
+		};
+		if (poll(&pfd, 1, 0) > 0) {
+			if (wl_display_read_events(state->client) < 0) {
+				return false;
+			}
+		} else {
+			wl_display_cancel_read(state->client);
+		}
+		if (wl_display_dispatch_pending(state->client) < 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static struct wl_buffer *create_shm_buffer(struct wl_shm *shm,
+		int width, int height) {
+	int stride = width * 4;
+	int size = stride * height;
+
+	char name[64];
+	snprintf(name, sizeof(name), "/wlroots-bench-%d", (int)getpid());
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		return NULL;
+	}
+	shm_unlink(name);
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	uint32_t *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	if (data == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	for (int i = 0; i < width * height; i++) {
+		data[i] = 0xFF000000 | (i * 2654435761u >> 8);
+	}
+	munmap(data, size);
+
+	struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
+	struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0,
+		width, height, stride, WL_SHM_FORMAT_ARGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+	return buffer;
+}
+
+static void bench_commit(struct surface_state *state, int n_subsurfaces) {
+	char name[64];
+	snprintf(name, sizeof(name), "commit_subsurfaces_%d", n_subsurfaces);
+	if (!bench_start(state->bench, name)) {
+		return;
+	}
+
+	struct wl_surface *parent =
+		wl_compositor_create_surface(state->compositor);
+	struct wl_surface **surfaces = calloc(n_subsurfaces, sizeof(*surfaces));
+	struct wl_subsurface **subsurfaces =
+		calloc(n_subsurfaces, sizeof(*subsurfaces));
+	if (surfaces == NULL || subsurfaces == NULL) {
+		goto out;
+	}
+	for (int i = 0; i < n_subsurfaces; i++) {
+		surfaces[i] = wl_compositor_create_surface(state->compositor);
+		subsurfaces[i] = wl_subcompositor_get_subsurface(
+			state->subcompositor, surfaces[i], parent);
+		wl_subsurface_set_position(subsurfaces[i], (i % 16) * BUFFER_SIZE,
+			(i / 16) * BUFFER_SIZE);
+	}
+	if (!roundtrip(state)) {
+		goto out;
+	}
+
+	for (size_t i = 0; i < state->bench->iterations; i++) {
+		int64_t start = bench_now_ns();
+		// Sub-surfaces are synchronized: their state is applied with the
+		// parent's commit
+		for (int j = 0; j < n_subsurfaces; j++) {
+			wl_surface_attach(surfaces[j], state->buffer, 0, 0);
+			wl_surface_damage_buffer(surfaces[j], 0, 0,
+				BUFFER_SIZE, BUFFER_SIZE);
+			wl_surface_commit(surfaces[j]);
+		}
+		wl_surface_attach(parent, state->buffer, 0, 0);
+		wl_surface_damage_buffer(parent, 0, 0, BUFFER_SIZE, BUFFER_SIZE);
+		wl_surface_commit(parent);
+		if (!roundtrip(state)) {
+			fprintf(stderr, "%s: connection error\n", name);
+			goto out;
+		}
+		bench_add_sample(state->bench, bench_now_ns() - start);
+	}
+	bench_report(state->bench, name, 0);
+
+out:
+	for (int i = 0; subsurfaces != NULL && i < n_subsurfaces; i++) {
+		wl_subsurface_destroy(subsurfaces[i]);
+		wl_surface_destroy(surfaces[i]);
+	}
+	free(subsurfaces);
+	free(surfaces);
+	wl_surface_destroy(parent);
+	roundtrip(state);
+}
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	struct bench bench;
+	if (!bench_init(&bench, "surface", 1000, argc, argv)) {
+		return EXIT_FAILURE;
+	}
+
+	struct surface_state state = { .bench = &bench };
+	state.server = wl_display_create();
+	state.server_loop = wl_display_get_event_loop(state.server);
+	state.backend = wlr_headless_backend_create(state.server);
+	if (state.backend == NULL) {
+		return EXIT_FAILURE;
+	}
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(state.backend);
+	wl_display_init_shm(state.server);
+	if (renderer == NULL ||
+			wlr_compositor_create(state.server, renderer) == NULL) {
+		fprintf(stderr, "Failed to create compositor\n");
+		return EXIT_FAILURE;
+	}
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		perror("socketpair");
+		return EXIT_FAILURE;
+	}
+	if (wl_client_create(state.server, fds[0]) == NULL) {
+		fprintf(stderr, "Failed to create client\n");
+		return EXIT_FAILURE;
+	}
+	state.client = wl_display_connect_to_fd(fds[1]);
+	if (state.client == NULL) {
+		fprintf(stderr, "Failed to connect client\n");
+		return EXIT_FAILURE;
+	}
+
+	struct wl_registry *registry = wl_display_get_registry(state.client);
+	wl_registry_add_listener(registry, &registry_listener, &state);
+	if (!roundtrip(&state) || state.compositor == NULL ||
+			state.subcompositor == NULL || state.shm == NULL) {
+		fprintf(stderr, "Missing globals\n");
+		return EXIT_FAILURE;
+	}
+
+	state.buffer = create_shm_buffer(state.shm, BUFFER_SIZE, BUFFER_SIZE);
+	if (state.buffer == NULL) {
+		fprintf(stderr, "Failed to create shm buffer\n");
+		return EXIT_FAILURE;
+	}
+
+	bench_commit(&state, 0);
+	bench_commit(&state, 16);
+	bench_commit(&state, 128);
+
+	wl_buffer_destroy(state.buffer);
+	wl_shm_destroy(state.shm);
+	wl_subcompositor_destroy(state.subcompositor);
+	wl_compositor_destroy(state.compositor);
+	wl_registry_destroy(registry);
+	roundtrip(&state);
+	wl_display_disconnect(state.client);
+
+	wl_display_destroy_clients(state.server);
+	wl_display_destroy(state.server);
+	bench_finish(&bench);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,976 @@
+/*
+ * Benchmark of a screen capture pipeline, in the spirit of dmabuf-capture.
+ *
+ * Frames are captured into a ring of slots kept in flight at the same time.
+ * The main thread requests and receives the frames, a map thread makes their
+ * contents CPU-readable and an encode thread consumes them. The encoder is a
+ * checksum over the pixels, which touches every byte like a real encoder
+ * would read them; dmabuf-capture is the reference for a libavcodec pipeline.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gbm.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client-protocol.h>
+#include <xf86drm.h>
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "wlr-export-dmabuf-unstable-v1-client-protocol.h"
+#include "wlr-screencopy-unstable-v1-client-protocol.h"
+
+#define MAX_PLANES 4
+
+enum bench_mode {
+	BENCH_MODE_SHM,
+	BENCH_MODE_DMABUF,
+	BENCH_MODE_EXPORT,
+};
+
+static const char *mode_names[] = {
+	[BENCH_MODE_SHM] = "screencopy-shm",
+	[BENCH_MODE_DMABUF] = "screencopy-dmabuf",
+	[BENCH_MODE_EXPORT] = "export-dmabuf",
+};
+
+enum frame_state {
+	FRAME_FREE,
+	FRAME_CAPTURING, // owned by the main thread, waiting for the compositor
+	FRAME_PROCESSING, // owned by the map and encode threads
+};
+
+struct bench_frame {
+	struct bench *bench;
+	enum frame_state state;
+	int64_t requested_ns;
+
+	// screencopy
+	struct zwlr_screencopy_frame_v1 *screencopy;
+	uint32_t format, width, height, stride;
+	bool have_shm, have_dmabuf;
+	struct wl_buffer *wl_buffer;
+	uint32_t buffer_format, buffer_width, buffer_height, buffer_stride;
+	void *shm_data;
+	size_t shm_size;
+	struct gbm_bo *bo;
+
+	// export-dmabuf
+	struct zwlr_export_dmabuf_frame_v1 *export;
+	uint64_t modifier;
+	uint32_t num_objects;
+	int fds[MAX_PLANES];
+	uint32_t offsets[MAX_PLANES], strides[MAX_PLANES];
+	struct gbm_bo *import_bo;
+
+	// set by the map thread
+	void *map_data, *map_handle;
+	uint32_t map_stride;
+	struct gbm_bo *map_bo;
+};
+
+struct frame_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct bench_frame **frames;
+	size_t cap, head, len;
+	bool closed;
+};
+
+struct frame_sample {
+	int64_t latency_ns; // from the request to the ready event
+	int64_t present_ns; // presentation timestamp of the frame
+	int64_t ready_ns;
+};
+
+struct bench {
+	enum bench_mode mode;
+	int target_frames, depth;
+	bool overlay_cursor;
+
+	struct wl_display *display;
+	struct wl_shm *shm;
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+	struct zwlr_screencopy_manager_v1 *screencopy_manager;
+	struct zwlr_export_dmabuf_manager_v1 *export_manager;
+	struct wl_output *output;
+	int output_index, outputs_seen;
+	int32_t refresh_mhz;
+
+	int drm_fd;
+	struct gbm_device *gbm;
+	pthread_mutex_t gbm_lock;
+
+	struct bench_frame *frames;
+	int requested, captured, failed, in_flight;
+	struct frame_sample *samples;
+
+	struct frame_queue map_queue, encode_queue, done_queue;
+	int wake_fds[2]; // written by the encode thread when a frame is done
+	pthread_t map_thread, encode_thread;
+
+	// encode queue depth, sampled by the map thread on each push
+	uint64_t depth_sum, depth_samples;
+	size_t depth_max;
+	uint64_t checksum;
+};
+
+static int64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t timestamp_ns(uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+		uint32_t tv_nsec) {
+	int64_t sec = ((uint64_t)tv_sec_hi << 32) | tv_sec_lo;
+	return sec * 1000000000 + tv_nsec;
+}
+
+static void queue_init(struct frame_queue *queue, size_t cap) {
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	queue->frames = calloc(cap, sizeof(queue->frames[0]));
+	queue->cap = cap;
+}
+
+static void queue_finish(struct frame_queue *queue) {
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->cond);
+	free(queue->frames);
+}
+
+/**
+ * Returns the queue length including the new frame. There are never more
+ * frames than slots, so the queue can't overflow.
+ */
+static size_t queue_push(struct frame_queue *queue, struct bench_frame *frame) {
+	pthread_mutex_lock(&queue->lock);
+	assert(queue->len < queue->cap);
+	queue->frames[(queue->head + queue->len) % queue->cap] = frame;
+	size_t len = ++queue->len;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+	return len;
+}
+
+static struct bench_frame *queue_pop_locked(struct frame_queue *queue) {
+	if (queue->len == 0) {
+		return NULL;
+	}
+	struct bench_frame *frame = queue->frames[queue->head];
+	queue->head = (queue->head + 1) % queue->cap;
+	queue->len--;
+	return frame;
+}
+
+/**
+ * Blocks until a frame is available. Returns NULL once the queue is closed
+ * and empty.
+ */
+static struct bench_frame *queue_pop(struct frame_queue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	while (queue->len == 0 && !queue->closed) {
+		pthread_cond_wait(&queue->cond, &queue->lock);
+	}
+	struct bench_frame *frame = queue_pop_locked(queue);
+	pthread_mutex_unlock(&queue->lock);
+	return frame;
+}
+
+static struct bench_frame *queue_try_pop(struct frame_queue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	struct bench_frame *frame = queue_pop_locked(queue);
+	pthread_mutex_unlock(&queue->lock);
+	return frame;
+}
+
+static void queue_close(struct frame_queue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = true;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+static void frame_map(struct bench_frame *frame) {
+	struct bench *bench = frame->bench;
+
+	frame->map_data = NULL;
+	frame->map_bo = NULL;
+	if (bench->mode == BENCH_MODE_SHM) {
+		frame->map_data = frame->shm_data;
+		frame->map_stride = frame->buffer_stride;
+		return;
+	}
+
+	pthread_mutex_lock(&bench->gbm_lock);
+	struct gbm_bo *bo = frame->bo;
+	if (bench->mode == BENCH_MODE_EXPORT) {
+		struct gbm_import_fd_modifier_data import = {
+			.width = frame->width,
+			.height = frame->height,
+			.format = frame->format,
+			.num_fds = frame->num_objects,
+			.modifier = frame->modifier,
+		};
+		memcpy(import.fds, frame->fds, sizeof(import.fds));
+		memcpy(import.strides, frame->strides, sizeof(import.strides));
+		memcpy(import.offsets, frame->offsets, sizeof(import.offsets));
+		frame->import_bo = gbm_bo_import(bench->gbm,
+			GBM_BO_IMPORT_FD_MODIFIER, &import, 0);
+		bo = frame->import_bo;
+	}
+	if (bo != NULL) {
+		frame->map_data = gbm_bo_map(bo, 0, 0, frame->width, frame->height,
+			GBM_BO_TRANSFER_READ, &frame->map_stride, &frame->map_handle);
+		if (frame->map_data != NULL) {
+			frame->map_bo = bo;
+		}
+	}
+	pthread_mutex_unlock(&bench->gbm_lock);
+}
+
+static void *map_thread_run(void *data) {
+	struct bench *bench = data;
+	struct bench_frame *frame;
+	while ((frame = queue_pop(&bench->map_queue)) != NULL) {
+		frame_map(frame);
+
+		size_t depth = queue_push(&bench->encode_queue, frame);
+		bench->depth_sum += depth;
+		bench->depth_samples++;
+		if (depth > bench->depth_max) {
+			bench->depth_max = depth;
+		}
+	}
+	queue_close(&bench->encode_queue);
+	return NULL;
+}
+
+static uint64_t frame_checksum(struct bench_frame *frame) {
+	uint64_t hash = 0xcbf29ce484222325;
+	size_t row_size = (size_t)frame->width * 4;
+	for (uint32_t y = 0; y < frame->height; y++) {
+		const unsigned char *row =
+			(const unsigned char *)frame->map_data + y * frame->map_stride;
+		for (size_t x = 0; x + 8 <= row_size; x += 8) {
+			uint64_t word;
+			memcpy(&word, row + x, sizeof(word));
+			hash = (hash ^ word) * 0x100000001b3;
+		}
+	}
+	return hash;
+}
+
+static void *encode_thread_run(void *data) {
+	struct bench *bench = data;
+	struct bench_frame *frame;
+	while ((frame = queue_pop(&bench->encode_queue)) != NULL) {
+		if (frame->map_data != NULL) {
+			bench->checksum ^= frame_checksum(frame);
+		}
+
+		queue_push(&bench->done_queue, frame);
+		char byte = 0;
+		if (write(bench->wake_fds[1], &byte, 1) < 0 && errno != EAGAIN) {
+			perror("write");
+		}
+	}
+	return NULL;
+}
+
+static void request_frame(struct bench_frame *frame);
+
+static void frame_release(struct bench_frame *frame) {
+	struct bench *bench = frame->bench;
+
+	pthread_mutex_lock(&bench->gbm_lock);
+	if (frame->map_bo != NULL) {
+		gbm_bo_unmap(frame->map_bo, frame->map_handle);
+		frame->map_bo = NULL;
+	}
+	if (frame->import_bo != NULL) {
+		gbm_bo_destroy(frame->import_bo);
+		frame->import_bo = NULL;
+	}
+	pthread_mutex_unlock(&bench->gbm_lock);
+
+	for (uint32_t i = 0; i < frame->num_objects; i++) {
+		close(frame->fds[i]);
+		frame->fds[i] = -1;
+	}
+	frame->num_objects = 0;
+	if (frame->export != NULL) {
+		zwlr_export_dmabuf_frame_v1_destroy(frame->export);
+		frame->export = NULL;
+	}
+	if (frame->screencopy != NULL) {
+		zwlr_screencopy_frame_v1_destroy(frame->screencopy);
+		frame->screencopy = NULL;
+	}
+
+	frame->state = FRAME_FREE;
+	bench->in_flight--;
+	if (bench->requested < bench->target_frames) {
+		request_frame(frame);
+	}
+}
+
+/**
+ * Called from the ready event of both protocols.
+ */
+static void frame_ready(struct bench_frame *frame, int64_t present_ns) {
+	struct bench *bench = frame->bench;
+	int64_t now = get_time_ns();
+
+	bench->samples[bench->captured++] = (struct frame_sample){
+		.latency_ns = now - frame->requested_ns,
+		.present_ns = present_ns,
+		.ready_ns = now,
+	};
+
+	frame->state = FRAME_PROCESSING;
+	queue_push(&bench->map_queue, frame);
+}
+
+static void frame_failed(struct bench_frame *frame) {
+	frame->bench->failed++;
+	frame_release(frame);
+}
+
+static struct wl_buffer *create_shm_buffer(struct bench *bench,
+		enum wl_shm_format format, int width, int height, int stride,
+		void **data_out) {
+	size_t size = (size_t)stride * height;
+
+	const char shm_name[] = "/wlroots-capture-bench";
+	int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		fprintf(stderr, "shm_open failed\n");
+		return NULL;
+	}
+	shm_unlink(shm_name);
+
+	int ret;
+	while ((ret = ftruncate(fd, size)) == EINTR) {
+		// No-op
+	}
+	if (ret < 0) {
+		close(fd);
+		fprintf(stderr, "ftruncate failed\n");
+		return NULL;
+	}
+
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		perror("mmap failed");
+		close(fd);
+		return NULL;
+	}
+
+	struct wl_shm_pool *pool = wl_shm_create_pool(bench->shm, fd, size);
+	close(fd);
+	struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0, width, height,
+		stride, format);
+	wl_shm_pool_destroy(pool);
+
+	*data_out = data;
+	return buffer;
+}
+
+static struct wl_buffer *create_dmabuf_buffer(struct bench_frame *frame) {
+	struct bench *bench = frame->bench;
+
+	pthread_mutex_lock(&bench->gbm_lock);
+	frame->bo = gbm_bo_create(bench->gbm, frame->width, frame->height,
+		frame->format, GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING);
+	pthread_mutex_unlock(&bench->gbm_lock);
+	if (frame->bo == NULL) {
+		fprintf(stderr, "failed to create GBM buffer object\n");
+		return NULL;
+	}
+
+	struct zwp_linux_buffer_params_v1 *params =
+		zwp_linux_dmabuf_v1_create_params(bench->dmabuf);
+	int fd = gbm_bo_get_fd(frame->bo);
+	uint32_t offset = gbm_bo_get_offset(frame->bo, 0);
+	uint32_t stride = gbm_bo_get_stride(frame->bo);
+	uint64_t mod = gbm_bo_get_modifier(frame->bo);
+	zwp_linux_buffer_params_v1_add(params, fd, 0, offset, stride, mod >> 32,
+		mod & 0xffffffff);
+	struct wl_buffer *buffer = zwp_linux_buffer_params_v1_create_immed(params,
+		frame->width, frame->height, frame->format, 0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	close(fd);
+	return buffer;
+}
+
+static void frame_destroy_buffer(struct bench_frame *frame) {
+	if (frame->wl_buffer != NULL) {
+		wl_buffer_destroy(frame->wl_buffer);
+		frame->wl_buffer = NULL;
+	}
+	if (frame->shm_data != NULL) {
+		munmap(frame->shm_data, frame->shm_size);
+		frame->shm_data = NULL;
+	}
+	if (frame->bo != NULL) {
+		gbm_bo_destroy(frame->bo);
+		frame->bo = NULL;
+	}
+}
+
+static void screencopy_handle_buffer(void *data,
+		struct zwlr_screencopy_frame_v1 *screencopy, uint32_t format,
+		uint32_t width, uint32_t height, uint32_t stride) {
+	struct bench_frame *frame = data;
+	if (frame->bench->mode == BENCH_MODE_SHM) {
+		frame->format = format;
+		frame->width = width;
+		frame->height = height;
+		frame->stride = stride;
+		frame->have_shm = true;
+	}
+}
+
+static void screencopy_handle_linux_dmabuf(void *data,
+		struct zwlr_screencopy_frame_v1 *screencopy, uint32_t fourcc,
+		uint32_t width, uint32_t height) {
+	struct bench_frame *frame = data;
+	if (frame->bench->mode == BENCH_MODE_DMABUF) {
+		frame->format = fourcc;
+		frame->width = width;
+		frame->height = height;
+		frame->have_dmabuf = true;
+	}
+}
+
+static void screencopy_handle_buffer_done(void *data,
+		struct zwlr_screencopy_frame_v1 *screencopy) {
+	struct bench_frame *frame = data;
+	struct bench *bench = frame->bench;
+
+	bool shm = bench->mode == BENCH_MODE_SHM;
+	if ((shm && !frame->have_shm) || (!shm && !frame->have_dmabuf)) {
+		fprintf(stderr, "compositor doesn't support %s\n",
+			mode_names[bench->mode]);
+		exit(EXIT_FAILURE);
+	}
+
+	// Buffers are kept across captures, unless the output changed
+	if (frame->wl_buffer != NULL && (frame->buffer_format != frame->format ||
+			frame->buffer_width != frame->width ||
+			frame->buffer_height != frame->height ||
+			frame->buffer_stride != frame->stride)) {
+		frame_destroy_buffer(frame);
+	}
+	if (frame->wl_buffer == NULL) {
+		if (shm) {
+			frame->shm_size = (size_t)frame->stride * frame->height;
+			frame->wl_buffer = create_shm_buffer(bench, frame->format,
+				frame->width, frame->height, frame->stride,
+				&frame->shm_data);
+		} else {
+			frame->wl_buffer = create_dmabuf_buffer(frame);
+		}
+		if (frame->wl_buffer == NULL) {
+			exit(EXIT_FAILURE);
+		}
+		frame->buffer_format = frame->format;
+		frame->buffer_width = frame->width;
+		frame->buffer_height = frame->height;
+		frame->buffer_stride = frame->stride;
+	}
+
+	zwlr_screencopy_frame_v1_copy(screencopy, frame->wl_buffer);
+}
+
+static void screencopy_handle_flags(void *data,
+		struct zwlr_screencopy_frame_v1 *screencopy, uint32_t flags) {
+	// Y-inverted frames are fine for a benchmark
+}
+
+static void screencopy_handle_ready(void *data,
+		struct zwlr_screencopy_frame_v1 *screencopy, uint32_t tv_sec_hi,
+		uint32_t tv_sec_lo, uint32_t tv_nsec) {
+	frame_ready(data, timestamp_ns(tv_sec_hi, tv_sec_lo, tv_nsec));
+}
+
+static void screencopy_handle_failed(void *data,
+		struct zwlr_screencopy_frame_v1 *screencopy) {
+	frame_failed(data);
+}
+
+static const struct zwlr_screencopy_frame_v1_listener screencopy_listener = {
+	.buffer = screencopy_handle_buffer,
+	.linux_dmabuf = screencopy_handle_linux_dmabuf,
+	.buffer_done = screencopy_handle_buffer_done,
+	.flags = screencopy_handle_flags,
+	.ready = screencopy_handle_ready,
+	.failed = screencopy_handle_failed,
+};
+
+static void export_handle_frame(void *data,
+		struct zwlr_export_dmabuf_frame_v1 *export, uint32_t width,
+		uint32_t height, uint32_t offset_x, uint32_t offset_y,
+		uint32_t buffer_flags, uint32_t flags, uint32_t format,
+		uint32_t mod_high, uint32_t mod_low, uint32_t num_objects) {
+	struct bench_frame *frame = data;
+	frame->width = width;
+	frame->height = height;
+	frame->format = format;
+	frame->modifier = ((uint64_t)mod_high << 32) | mod_low;
+	frame->num_objects = 0;
+}
+
+static void export_handle_object(void *data,
+		struct zwlr_export_dmabuf_frame_v1 *export, uint32_t index,
+		int32_t fd, uint32_t size, uint32_t offset, uint32_t stride,
+		uint32_t plane_index) {
+	struct bench_frame *frame = data;
+	if (plane_index >= MAX_PLANES) {
+		close(fd);
+		return;
+	}
+	frame->fds[plane_index] = fd;
+	frame->offsets[plane_index] = offset;
+	frame->strides[plane_index] = stride;
+	if (plane_index + 1 > frame->num_objects) {
+		frame->num_objects = plane_index + 1;
+	}
+}
+
+static void export_handle_ready(void *data,
+		struct zwlr_export_dmabuf_frame_v1 *export, uint32_t tv_sec_hi,
+		uint32_t tv_sec_lo, uint32_t tv_nsec) {
+	frame_ready(data, timestamp_ns(tv_sec_hi, tv_sec_lo, tv_nsec));
+}
+
+static void export_handle_cancel(void *data,
+		struct zwlr_export_dmabuf_frame_v1 *export, uint32_t reason) {
+	frame_failed(data);
+}
+
+static const struct zwlr_export_dmabuf_frame_v1_listener export_listener = {
+	.frame = export_handle_frame,
+	.object = export_handle_object,
+	.ready = export_handle_ready,
+	.cancel = export_handle_cancel,
+};
+
+static void request_frame(struct bench_frame *frame) {
+	struct bench *bench = frame->bench;
+	assert(frame->state == FRAME_FREE);
+
+	frame->state = FRAME_CAPTURING;
+	frame->requested_ns = get_time_ns();
+	frame->have_shm = frame->have_dmabuf = false;
+	bench->requested++;
+	bench->in_flight++;
+
+	if (bench->mode == BENCH_MODE_EXPORT) {
+		frame->export = zwlr_export_dmabuf_manager_v1_capture_output(
+			bench->export_manager, bench->overlay_cursor, bench->output);
+		zwlr_export_dmabuf_frame_v1_add_listener(frame->export,
+			&export_listener, frame);
+	} else {
+		frame->screencopy = zwlr_screencopy_manager_v1_capture_output(
+			bench->screencopy_manager, bench->overlay_cursor, bench->output);
+		zwlr_screencopy_frame_v1_add_listener(frame->screencopy,
+			&screencopy_listener, frame);
+	}
+}
+
+static void output_handle_geometry(void *data, struct wl_output *output,
+		int32_t x, int32_t y, int32_t phys_width, int32_t phys_height,
+		int32_t subpixel, const char *make, const char *model,
+		int32_t transform) {
+	// No-op
+}
+
+static void output_handle_mode(void *data, struct wl_output *output,
+		uint32_t flags, int32_t width, int32_t height, int32_t refresh) {
+	struct bench *bench = data;
+	if (flags & WL_OUTPUT_MODE_CURRENT) {
+		bench->refresh_mhz = refresh;
+	}
+}
+
+static const struct wl_output_listener output_listener = {
+	.geometry = output_handle_geometry,
+	.mode = output_handle_mode,
+};
+
+static void handle_global(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version) {
+	struct bench *bench = data;
+
+	if (strcmp(interface, wl_output_interface.name) == 0) {
+		if (bench->outputs_seen++ == bench->output_index) {
+			bench->output = wl_registry_bind(registry, name,
+				&wl_output_interface, 1);
+			wl_output_add_listener(bench->output, &output_listener, bench);
+		}
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		bench->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0 &&
+			version >= 2) {
+		bench->dmabuf = wl_registry_bind(registry, name,
+			&zwp_linux_dmabuf_v1_interface, 2);
+	} else if (strcmp(interface,
+			zwlr_screencopy_manager_v1_interface.name) == 0 && version >= 3) {
+		bench->screencopy_manager = wl_registry_bind(registry, name,
+			&zwlr_screencopy_manager_v1_interface, 3);
+	} else if (strcmp(interface,
+			zwlr_export_dmabuf_manager_v1_interface.name) == 0) {
+		bench->export_manager = wl_registry_bind(registry, name,
+			&zwlr_export_dmabuf_manager_v1_interface, 1);
+	}
+}
+
+static void handle_global_remove(void *data, struct wl_registry *registry,
+		uint32_t name) {
+	// Who cares?
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = handle_global,
+	.global_remove = handle_global_remove,
+};
+
+static bool init_gbm(struct bench *bench) {
+	drmDevice *devices[64];
+	int n = drmGetDevices2(0, devices, sizeof(devices) / sizeof(devices[0]));
+	for (int i = 0; i < n && bench->drm_fd < 0; i++) {
+		drmDevice *dev = devices[i];
+		if (dev->available_nodes & (1 << DRM_NODE_RENDER)) {
+			bench->drm_fd = open(dev->nodes[DRM_NODE_RENDER],
+				O_RDWR | O_CLOEXEC);
+		}
+	}
+	drmFreeDevices(devices, n);
+	if (bench->drm_fd < 0) {
+		fprintf(stderr, "failed to open a DRM render node\n");
+		return false;
+	}
+
+	bench->gbm = gbm_create_device(bench->drm_fd);
+	if (bench->gbm == NULL) {
+		fprintf(stderr, "failed to create GBM device\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Dispatches Wayland events and reclaims the frames processed by the encode
+ * thread, until all frames have been captured.
+ */
+static int run(struct bench *bench) {
+	struct pollfd fds[] = {
+		{ .fd = wl_display_get_fd(bench->display), .events = POLLIN },
+		{ .fd = bench->wake_fds[0], .events = POLLIN },
+	};
+
+	for (int i = 0; i < bench->depth && i < bench->target_frames; i++) {
+		request_frame(&bench->frames[i]);
+	}
+
+	while (bench->in_flight > 0) {
+		while (wl_display_prepare_read(bench->display) != 0) {
+			wl_display_dispatch_pending(bench->display);
+		}
+		if (wl_display_flush(bench->display) < 0 && errno != EAGAIN) {
+			wl_display_cancel_read(bench->display);
+			return -1;
+		}
+
+		if (poll(fds, sizeof(fds) / sizeof(fds[0]), -1) < 0) {
+			wl_display_cancel_read(bench->display);
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			return -1;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			if (wl_display_read_events(bench->display) < 0) {
+				return -1;
+			}
+		} else {
+			wl_display_cancel_read(bench->display);
+		}
+		if (fds[0].revents & (POLLERR | POLLHUP)) {
+			fprintf(stderr, "disconnected from the compositor\n");
+			return -1;
+		}
+		if (wl_display_dispatch_pending(bench->display) < 0) {
+			return -1;
+		}
+
+		if (fds[1].revents & POLLIN) {
+			char buf[64];
+			while (read(bench->wake_fds[0], buf, sizeof(buf)) > 0) {
+				// Drain
+			}
+			struct bench_frame *frame;
+			while ((frame = queue_try_pop(&bench->done_queue)) != NULL) {
+				frame_release(frame);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int compare_int64(const void *a, const void *b) {
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double timeval_ms(const struct timeval *start,
+		const struct timeval *end) {
+	return (end->tv_sec - start->tv_sec) * 1e3 +
+		(end->tv_usec - start->tv_usec) / 1e3;
+}
+
+static void print_report(struct bench *bench, int64_t elapsed_ns,
+		const struct rusage *usage_start, const struct rusage *usage_end) {
+	int n = bench->captured;
+	double elapsed = elapsed_ns / 1e9;
+	printf("mode: %s, %d frames in %.2f s (%.1f fps), %d in flight, "
+		"%d failed\n", mode_names[bench->mode], n, elapsed,
+		elapsed > 0 ? n / elapsed : 0, bench->depth, bench->failed);
+	if (n == 0) {
+		return;
+	}
+
+	int64_t *latencies = calloc(n, sizeof(latencies[0]));
+	int64_t latency_sum = 0, present_sum = 0, present_max = 0;
+	int missed = 0, duplicates = 0;
+	int64_t refresh_ns = bench->refresh_mhz > 0 ?
+		1000000000000 / bench->refresh_mhz : 0;
+	for (int i = 0; i < n; i++) {
+		const struct frame_sample *sample = &bench->samples[i];
+		latencies[i] = sample->latency_ns;
+		latency_sum += sample->latency_ns;
+
+		int64_t present_latency = sample->ready_ns - sample->present_ns;
+		present_sum += present_latency;
+		if (present_latency > present_max) {
+			present_max = present_latency;
+		}
+
+		if (i == 0) {
+			continue;
+		}
+		int64_t gap = sample->present_ns - bench->samples[i - 1].present_ns;
+		if (gap == 0) {
+			duplicates++;
+		} else if (refresh_ns > 0 && gap > refresh_ns * 3 / 2) {
+			missed += (gap + refresh_ns / 2) / refresh_ns - 1;
+		}
+	}
+	qsort(latencies, n, sizeof(latencies[0]), compare_int64);
+
+	printf("capture latency (request to ready): avg %.2f ms, p50 %.2f ms, "
+		"p99 %.2f ms, max %.2f ms\n", latency_sum / 1e6 / n,
+		latencies[n / 2] / 1e6, latencies[(n - 1) * 99 / 100] / 1e6,
+		latencies[n - 1] / 1e6);
+	printf("presentation to ready: avg %.2f ms, max %.2f ms\n",
+		present_sum / 1e6 / n, present_max / 1e6);
+	if (refresh_ns > 0) {
+		printf("dropped output frames: %d, duplicate frames: %d\n",
+			missed, duplicates);
+	} else {
+		printf("duplicate frames: %d (unknown refresh rate)\n", duplicates);
+	}
+	if (bench->depth_samples > 0) {
+		printf("encode queue depth: avg %.2f, max %zu\n",
+			(double)bench->depth_sum / bench->depth_samples,
+			bench->depth_max);
+	}
+	double user_ms = timeval_ms(&usage_start->ru_utime, &usage_end->ru_utime);
+	double sys_ms = timeval_ms(&usage_start->ru_stime, &usage_end->ru_stime);
+	printf("CPU per frame: %.3f ms (user %.3f ms, system %.3f ms)\n",
+		(user_ms + sys_ms) / n, user_ms / n, sys_ms / n);
+	printf("checksum: %016llx\n", (unsigned long long)bench->checksum);
+
+	free(latencies);
+}
+
+static const char usage[] =
+	"usage: capture-bench [options...]\n"
+	"  -m <mode>   shm, dmabuf or export (default: shm)\n"
+	"  -o <index>  index of the output to capture (default: 0)\n"
+	"  -n <count>  number of frames to capture (default: 300)\n"
+	"  -q <depth>  number of frames in flight (default: 3)\n"
+	"  -c          overlay the cursor\n"
+	"  -h          show this help message\n"
+	"\n"
+	"Dropped output frames are counted from gaps between presentation\n"
+	"timestamps, so they are only meaningful while the screen animates.\n";
+
+int main(int argc, char *argv[]) {
+	struct bench bench = {
+		.mode = BENCH_MODE_SHM,
+		.target_frames = 300,
+		.depth = 3,
+		.drm_fd = -1,
+	};
+
+	int c;
+	while ((c = getopt(argc, argv, "m:o:n:q:ch")) != -1) {
+		switch (c) {
+		case 'm':
+			if (strcmp(optarg, "shm") == 0) {
+				bench.mode = BENCH_MODE_SHM;
+			} else if (strcmp(optarg, "dmabuf") == 0) {
+				bench.mode = BENCH_MODE_DMABUF;
+			} else if (strcmp(optarg, "export") == 0) {
+				bench.mode = BENCH_MODE_EXPORT;
+			} else {
+				fprintf(stderr, "invalid mode: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'o':
+			bench.output_index = atoi(optarg);
+			break;
+		case 'n':
+			bench.target_frames = atoi(optarg);
+			break;
+		case 'q':
+			bench.depth = atoi(optarg);
+			break;
+		case 'c':
+			bench.overlay_cursor = true;
+			break;
+		case 'h':
+			printf("%s", usage);
+			return EXIT_SUCCESS;
+		default:
+			fprintf(stderr, "%s", usage);
+			return EXIT_FAILURE;
+		}
+	}
+	if (bench.target_frames <= 0 || bench.depth <= 0) {
+		fprintf(stderr, "%s", usage);
+		return EXIT_FAILURE;
+	}
+
+	bench.display = wl_display_connect(NULL);
+	if (bench.display == NULL) {
+		perror("failed to create display");
+		return EXIT_FAILURE;
+	}
+
+	struct wl_registry *registry = wl_display_get_registry(bench.display);
+	wl_registry_add_listener(registry, &registry_listener, &bench);
+	wl_display_roundtrip(bench.display);
+	wl_display_roundtrip(bench.display);
+
+	if (bench.output == NULL) {
+		fprintf(stderr, "output %d not found\n", bench.output_index);
+		return EXIT_FAILURE;
+	}
+	switch (bench.mode) {
+	case BENCH_MODE_SHM:
+		if (bench.shm == NULL || bench.screencopy_manager == NULL) {
+			fprintf(stderr, "compositor is missing wl_shm or "
+				"wlr-screencopy-unstable-v1 version 3\n");
+			return EXIT_FAILURE;
+		}
+		break;
+	case BENCH_MODE_DMABUF:
+		if (bench.dmabuf == NULL || bench.screencopy_manager == NULL) {
+			fprintf(stderr, "compositor is missing linux-dmabuf or "
+				"wlr-screencopy-unstable-v1 version 3\n");
+			return EXIT_FAILURE;
+		}
+		break;
+	case BENCH_MODE_EXPORT:
+		if (bench.export_manager == NULL) {
+			fprintf(stderr, "compositor is missing "
+				"wlr-export-dmabuf-unstable-v1\n");
+			return EXIT_FAILURE;
+		}
+		break;
+	}
+	if (bench.mode != BENCH_MODE_SHM && !init_gbm(&bench)) {
+		return EXIT_FAILURE;
+	}
+
+	if (pipe(bench.wake_fds) != 0) {
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < 2; i++) {
+		fcntl(bench.wake_fds[i], F_SETFL, O_NONBLOCK);
+		fcntl(bench.wake_fds[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	pthread_mutex_init(&bench.gbm_lock, NULL);
+	queue_init(&bench.map_queue, bench.depth);
+	queue_init(&bench.encode_queue, bench.depth);
+	queue_init(&bench.done_queue, bench.depth);
+	bench.samples = calloc(bench.target_frames, sizeof(bench.samples[0]));
+	bench.frames = calloc(bench.depth, sizeof(bench.frames[0]));
+	for (int i = 0; i < bench.depth; i++) {
+		bench.frames[i].bench = &bench;
+		for (int j = 0; j < MAX_PLANES; j++) {
+			bench.frames[i].fds[j] = -1;
+		}
+	}
+
+	pthread_create(&bench.map_thread, NULL, map_thread_run, &bench);
+	pthread_create(&bench.encode_thread, NULL, encode_thread_run, &bench);
+
+	struct rusage usage_start, usage_end;
+	getrusage(RUSAGE_SELF, &usage_start);
+	int64_t start_ns = get_time_ns();
+
+	int ret = run(&bench);
+
+	int64_t elapsed_ns = get_time_ns() - start_ns;
+	getrusage(RUSAGE_SELF, &usage_end);
+
+	queue_close(&bench.map_queue);
+	pthread_join(bench.map_thread, NULL);
+	pthread_join(bench.encode_thread, NULL);
+
+	print_report(&bench, elapsed_ns, &usage_start, &usage_end);
+
+	for (int i = 0; i < bench.depth; i++) {
+		frame_destroy_buffer(&bench.frames[i]);
+	}
+	free(bench.frames);
+	free(bench.samples);
+	queue_finish(&bench.map_queue);
+	queue_finish(&bench.encode_queue);
+	queue_finish(&bench.done_queue);
+	pthread_mutex_destroy(&bench.gbm_lock);
+	close(bench.wake_fds[0]);
+	close(bench.wake_fds[1]);
+	if (bench.gbm != NULL) {
+		gbm_device_destroy(bench.gbm);
+	}
+	if (bench.drm_fd >= 0) {
+		close(bench.drm_fd);
+	}
+	wl_display_disconnect(bench.display);
+	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,745 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <gbm.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client-protocol.h>
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "wlr-virtual-pointer-unstable-v1-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+
+/**
+ * Synthetic client load generator. Creates a number of toplevels, each with
+ * a chain of nested sub-surfaces, and commits shm or dmabuf buffers on them
+ * at a fixed rate (or as fast as frame callbacks allow). Optionally injects
+ * pointer motion through the virtual pointer protocol.
+ *
+ * Compositor-side frame timing is measured with presentation feedback and
+ * printed every second, as well as a summary at exit.
+ */
+
+#define NUM_BUFFERS 2
+
+static const char usage[] =
+	"usage: client-load [options]\n"
+	"  -n <count>     number of toplevels (default: 4)\n"
+	"  -s <WxH>       buffer size (default: 256x256)\n"
+	"  -d <fraction>  fraction of each buffer damaged per commit (default: 1)\n"
+	"  -D <depth>     nested sub-surfaces per toplevel (default: 0)\n"
+	"  -r <hz>        commit rate, 0 to follow frame callbacks (default: 0)\n"
+	"  -i <hz>        pointer motion events per second (default: 0)\n"
+	"  -b             use dmabuf buffers instead of shm\n"
+	"  -g <path>      DRM render node (default: /dev/dri/renderD128)\n"
+	"  -t <seconds>   duration, 0 to run forever (default: 10)\n";
+
+struct load_buffer {
+	struct wl_buffer *wl_buffer;
+	struct gbm_bo *bo;
+	uint32_t *data; // shm only
+	bool busy;
+};
+
+struct load_surface {
+	struct wl_surface *wl_surface;
+	struct wl_subsurface *subsurface; // NULL for the root surface
+	struct load_buffer buffers[NUM_BUFFERS];
+	int damage_y;
+};
+
+struct load_toplevel {
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	bool configured;
+	struct load_surface *surfaces; // root first, then nested sub-surfaces
+	struct wl_callback *frame_callback;
+};
+
+struct load_feedback {
+	struct wp_presentation_feedback *feedback;
+	int64_t commit_ns;
+};
+
+struct load_stats {
+	uint64_t commits, skipped, presented, discarded;
+	int64_t latency_total_ns, latency_max_ns;
+};
+
+static struct {
+	int n_toplevels;
+	int width, height;
+	double damage;
+	int depth;
+	int commit_rate, input_rate;
+	bool use_dmabuf;
+	const char *render_node;
+	int duration;
+} config = {
+	.n_toplevels = 4,
+	.width = 256,
+	.height = 256,
+	.damage = 1.0,
+	.render_node = "/dev/dri/renderD128",
+	.duration = 10,
+};
+
+static struct wl_display *display = NULL;
+static struct wl_compositor *compositor = NULL;
+static struct wl_subcompositor *subcompositor = NULL;
+static struct wl_shm *shm = NULL;
+static struct wl_seat *seat = NULL;
+static struct xdg_wm_base *wm_base = NULL;
+static struct wp_presentation *presentation = NULL;
+static struct zwp_linux_dmabuf_v1 *linux_dmabuf = NULL;
+static struct zwlr_virtual_pointer_manager_v1 *pointer_manager = NULL;
+
+static clockid_t presentation_clock = CLOCK_MONOTONIC;
+static struct gbm_device *gbm_device = NULL;
+static struct load_toplevel *toplevels = NULL;
+static struct zwlr_virtual_pointer_v1 *virtual_pointer = NULL;
+
+static struct load_stats interval_stats, total_stats;
+
+static int64_t now_ns(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void buffer_handle_release(void *data, struct wl_buffer *wl_buffer) {
+	struct load_buffer *buffer = data;
+	buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	.release = buffer_handle_release,
+};
+
+static bool create_shm_buffer(struct load_buffer *buffer) {
+	int stride = config.width * 4;
+	size_t size = (size_t)stride * config.height;
+
+	char name[64];
+	snprintf(name, sizeof(name), "/wlroots-client-load-%d", (int)getpid());
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		perror("shm_open");
+		return false;
+	}
+	shm_unlink(name);
+	if (ftruncate(fd, size) < 0) {
+		perror("ftruncate");
+		close(fd);
+		return false;
+	}
+
+	buffer->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (buffer->data == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return false;
+	}
+
+	struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
+	buffer->wl_buffer = wl_shm_pool_create_buffer(pool, 0, config.width,
+		config.height, stride, WL_SHM_FORMAT_ARGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+	return true;
+}
+
+static bool create_dmabuf_buffer(struct load_buffer *buffer) {
+	buffer->bo = gbm_bo_create(gbm_device, config.width, config.height,
+		GBM_FORMAT_ARGB8888, GBM_BO_USE_RENDERING);
+	if (buffer->bo == NULL) {
+		fprintf(stderr, "Failed to create GBM buffer object\n");
+		return false;
+	}
+
+	struct zwp_linux_buffer_params_v1 *params =
+		zwp_linux_dmabuf_v1_create_params(linux_dmabuf);
+	uint64_t mod = gbm_bo_get_modifier(buffer->bo);
+	for (int i = 0; i < gbm_bo_get_plane_count(buffer->bo); i++) {
+		int fd = gbm_bo_get_fd(buffer->bo);
+		zwp_linux_buffer_params_v1_add(params, fd, i,
+			gbm_bo_get_offset(buffer->bo, i),
+			gbm_bo_get_stride_for_plane(buffer->bo, i),
+			mod >> 32, mod & 0xffffffff);
+		close(fd);
+	}
+	buffer->wl_buffer = zwp_linux_buffer_params_v1_create_immed(params,
+		config.width, config.height, GBM_FORMAT_ARGB8888, 0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	return true;
+}
+
+static bool surface_init(struct load_surface *surface,
+		struct wl_surface *parent) {
+	surface->wl_surface = wl_compositor_create_surface(compositor);
+	if (parent != NULL) {
+		surface->subsurface = wl_subcompositor_get_subsurface(subcompositor,
+			surface->wl_surface, parent);
+		// Offset each level a bit so that every sub-surface is visible
+		wl_subsurface_set_position(surface->subsurface,
+			config.width / 8, config.height / 8);
+	}
+
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		struct load_buffer *buffer = &surface->buffers[i];
+		bool ok = config.use_dmabuf ?
+			create_dmabuf_buffer(buffer) : create_shm_buffer(buffer);
+		if (!ok) {
+			return false;
+		}
+		wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+	}
+	return true;
+}
+
+static void surface_finish(struct load_surface *surface) {
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		struct load_buffer *buffer = &surface->buffers[i];
+		if (buffer->wl_buffer != NULL) {
+			wl_buffer_destroy(buffer->wl_buffer);
+		}
+		if (buffer->bo != NULL) {
+			gbm_bo_destroy(buffer->bo);
+		}
+		if (buffer->data != NULL && buffer->data != MAP_FAILED) {
+			munmap(buffer->data, (size_t)config.width * config.height * 4);
+		}
+	}
+	if (surface->subsurface != NULL) {
+		wl_subsurface_destroy(surface->subsurface);
+	}
+	if (surface->wl_surface != NULL) {
+		wl_surface_destroy(surface->wl_surface);
+	}
+}
+
+static struct load_buffer *surface_get_buffer(struct load_surface *surface) {
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		if (!surface->buffers[i].busy) {
+			return &surface->buffers[i];
+		}
+	}
+	return NULL;
+}
+
+static void surface_draw(struct load_surface *surface,
+		struct load_buffer *buffer, uint32_t color) {
+	int band = config.damage * config.height;
+	if (band < 1) {
+		band = 1;
+	}
+	if (surface->damage_y + band > config.height) {
+		surface->damage_y = 0;
+	}
+
+	if (buffer->data != NULL) {
+		uint32_t *row = buffer->data + (size_t)surface->damage_y * config.width;
+		for (int i = 0; i < band * config.width; i++) {
+			row[i] = color;
+		}
+	}
+
+	wl_surface_attach(surface->wl_surface, buffer->wl_buffer, 0, 0);
+	wl_surface_damage_buffer(surface->wl_surface, 0, surface->damage_y,
+		config.width, band);
+	buffer->busy = true;
+	surface->damage_y += band;
+}
+
+static void feedback_handle_sync_output(void *data,
+		struct wp_presentation_feedback *feedback, struct wl_output *output) {
+	// This space intentionally left blank
+}
+
+static void feedback_handle_presented(void *data,
+		struct wp_presentation_feedback *wp_feedback, uint32_t tv_sec_hi,
+		uint32_t tv_sec_lo, uint32_t tv_nsec, uint32_t refresh,
+		uint32_t seq_hi, uint32_t seq_lo, uint32_t flags) {
+	struct load_feedback *feedback = data;
+	int64_t sec = ((int64_t)tv_sec_hi << 32) | tv_sec_lo;
+	int64_t presented_ns = sec * 1000000000 + tv_nsec;
+	int64_t latency = presented_ns - feedback->commit_ns;
+	if (latency < 0) {
+		latency = 0;
+	}
+
+	struct load_stats *stats[] = { &interval_stats, &total_stats };
+	for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++) {
+		stats[i]->presented++;
+		stats[i]->latency_total_ns += latency;
+		if (latency > stats[i]->latency_max_ns) {
+			stats[i]->latency_max_ns = latency;
+		}
+	}
+
+	wp_presentation_feedback_destroy(wp_feedback);
+	free(feedback);
+}
+
+static void feedback_handle_discarded(void *data,
+		struct wp_presentation_feedback *wp_feedback) {
+	struct load_feedback *feedback = data;
+	interval_stats.discarded++;
+	total_stats.discarded++;
+	wp_presentation_feedback_destroy(wp_feedback);
+	free(feedback);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	.sync_output = feedback_handle_sync_output,
+	.presented = feedback_handle_presented,
+	.discarded = feedback_handle_discarded,
+};
+
+static void toplevel_commit(struct load_toplevel *toplevel);
+
+static void frame_handle_done(void *data, struct wl_callback *callback,
+		uint32_t time) {
+	struct load_toplevel *toplevel = data;
+	wl_callback_destroy(callback);
+	toplevel->frame_callback = NULL;
+	if (config.commit_rate == 0) {
+		toplevel_commit(toplevel);
+	}
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done = frame_handle_done,
+};
+
+static void toplevel_commit(struct load_toplevel *toplevel) {
+	if (!toplevel->configured) {
+		return;
+	}
+
+	struct load_buffer *buffers[config.depth + 1];
+	for (int i = 0; i <= config.depth; i++) {
+		buffers[i] = surface_get_buffer(&toplevel->surfaces[i]);
+		if (buffers[i] == NULL) {
+			// The compositor is still holding on to all of our buffers
+			interval_stats.skipped++;
+			total_stats.skipped++;
+			return;
+		}
+	}
+
+	uint32_t color = 0xFF000000 | (uint32_t)(total_stats.commits * 0x010203);
+
+	// Sub-surfaces are synchronized, their state is applied with the root
+	for (int i = config.depth; i >= 0; i--) {
+		struct load_surface *surface = &toplevel->surfaces[i];
+		surface_draw(surface, buffers[i], color);
+		if (i > 0) {
+			wl_surface_commit(surface->wl_surface);
+		}
+	}
+
+	struct wl_surface *root = toplevel->surfaces[0].wl_surface;
+	if (presentation != NULL) {
+		struct load_feedback *feedback = calloc(1, sizeof(*feedback));
+		if (feedback != NULL) {
+			feedback->feedback = wp_presentation_feedback(presentation, root);
+			wp_presentation_feedback_add_listener(feedback->feedback,
+				&feedback_listener, feedback);
+			feedback->commit_ns = now_ns(presentation_clock);
+		}
+	}
+	if (toplevel->frame_callback == NULL) {
+		toplevel->frame_callback = wl_surface_frame(root);
+		wl_callback_add_listener(toplevel->frame_callback, &frame_listener,
+			toplevel);
+	}
+	wl_surface_commit(root);
+
+	interval_stats.commits++;
+	total_stats.commits++;
+}
+
+static void xdg_surface_handle_configure(void *data,
+		struct xdg_surface *xdg_surface, uint32_t serial) {
+	struct load_toplevel *toplevel = data;
+	xdg_surface_ack_configure(xdg_surface, serial);
+	if (!toplevel->configured) {
+		toplevel->configured = true;
+		toplevel_commit(toplevel);
+	}
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	.configure = xdg_surface_handle_configure,
+};
+
+static void xdg_toplevel_handle_configure(void *data,
+		struct xdg_toplevel *xdg_toplevel, int32_t width, int32_t height,
+		struct wl_array *states) {
+	// The buffer size is fixed, ignore the size suggested by the compositor
+}
+
+static void xdg_toplevel_handle_close(void *data,
+		struct xdg_toplevel *xdg_toplevel) {
+	// Keep generating load, the compositor can kill the client otherwise
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+	.configure = xdg_toplevel_handle_configure,
+	.close = xdg_toplevel_handle_close,
+};
+
+static bool toplevel_init(struct load_toplevel *toplevel, int index) {
+	toplevel->surfaces = calloc(config.depth + 1, sizeof(toplevel->surfaces[0]));
+	if (toplevel->surfaces == NULL) {
+		return false;
+	}
+	for (int i = 0; i <= config.depth; i++) {
+		struct wl_surface *parent =
+			i > 0 ? toplevel->surfaces[i - 1].wl_surface : NULL;
+		if (!surface_init(&toplevel->surfaces[i], parent)) {
+			return false;
+		}
+	}
+
+	struct wl_surface *root = toplevel->surfaces[0].wl_surface;
+	toplevel->xdg_surface = xdg_wm_base_get_xdg_surface(wm_base, root);
+	xdg_surface_add_listener(toplevel->xdg_surface, &xdg_surface_listener,
+		toplevel);
+	toplevel->xdg_toplevel = xdg_surface_get_toplevel(toplevel->xdg_surface);
+	xdg_toplevel_add_listener(toplevel->xdg_toplevel, &xdg_toplevel_listener,
+		toplevel);
+
+	char title[64];
+	snprintf(title, sizeof(title), "client-load %d", index);
+	xdg_toplevel_set_title(toplevel->xdg_toplevel, title);
+	xdg_toplevel_set_app_id(toplevel->xdg_toplevel, "client-load");
+
+	wl_surface_commit(root);
+	return true;
+}
+
+static void toplevel_finish(struct load_toplevel *toplevel) {
+	if (toplevel->frame_callback != NULL) {
+		wl_callback_destroy(toplevel->frame_callback);
+	}
+	if (toplevel->xdg_toplevel != NULL) {
+		xdg_toplevel_destroy(toplevel->xdg_toplevel);
+	}
+	if (toplevel->xdg_surface != NULL) {
+		xdg_surface_destroy(toplevel->xdg_surface);
+	}
+	for (int i = config.depth; toplevel->surfaces != NULL && i >= 0; i--) {
+		surface_finish(&toplevel->surfaces[i]);
+	}
+	free(toplevel->surfaces);
+}
+
+static void print_stats(const char *label, const struct load_stats *stats,
+		double seconds) {
+	double latency_mean = stats->presented > 0 ?
+		(double)stats->latency_total_ns / stats->presented / 1e6 : 0;
+	printf("%s: %.1f commits/s, %"PRIu64" skipped, %"PRIu64" presented, "
+		"%"PRIu64" discarded, latency mean %.2f ms, max %.2f ms\n",
+		label, stats->commits / seconds, stats->skipped, stats->presented,
+		stats->discarded, latency_mean, stats->latency_max_ns / 1e6);
+	fflush(stdout);
+}
+
+static void send_pointer_motion(void) {
+	static int direction = 1;
+	uint32_t time = now_ns(CLOCK_MONOTONIC) / 1000000;
+	zwlr_virtual_pointer_v1_motion(virtual_pointer, time,
+		wl_fixed_from_int(direction), 0);
+	zwlr_virtual_pointer_v1_frame(virtual_pointer);
+	direction = -direction;
+}
+
+static int create_timer(int hz) {
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0) {
+		perror("timerfd_create");
+		return -1;
+	}
+	long interval_ns = 1000000000L / hz;
+	struct itimerspec spec = {
+		.it_interval = { interval_ns / 1000000000, interval_ns % 1000000000 },
+		.it_value = { interval_ns / 1000000000, interval_ns % 1000000000 },
+	};
+	timerfd_settime(fd, 0, &spec, NULL);
+	return fd;
+}
+
+static uint64_t read_timer(int fd) {
+	uint64_t expirations = 0;
+	if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+		return 0;
+	}
+	return expirations;
+}
+
+static void presentation_handle_clock_id(void *data,
+		struct wp_presentation *wp_presentation, uint32_t clk_id) {
+	presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	.clock_id = presentation_handle_clock_id,
+};
+
+static void xdg_wm_base_handle_ping(void *data,
+		struct xdg_wm_base *xdg_wm_base, uint32_t serial) {
+	xdg_wm_base_pong(xdg_wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+	.ping = xdg_wm_base_handle_ping,
+};
+
+static void handle_global(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version) {
+	if (strcmp(interface, wl_compositor_interface.name) == 0) {
+		compositor = wl_registry_bind(registry, name,
+			&wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+		subcompositor = wl_registry_bind(registry, name,
+			&wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, wl_seat_interface.name) == 0 && seat == NULL) {
+		seat = wl_registry_bind(registry, name, &wl_seat_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+		wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(wm_base, &xdg_wm_base_listener, NULL);
+	} else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+		presentation = wl_registry_bind(registry, name,
+			&wp_presentation_interface, 1);
+		wp_presentation_add_listener(presentation, &presentation_listener,
+			NULL);
+	} else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0 &&
+			version >= 2) {
+		linux_dmabuf = wl_registry_bind(registry, name,
+			&zwp_linux_dmabuf_v1_interface, 2);
+	} else if (strcmp(interface,
+			zwlr_virtual_pointer_manager_v1_interface.name) == 0) {
+		pointer_manager = wl_registry_bind(registry, name,
+			&zwlr_virtual_pointer_manager_v1_interface, 1);
+	}
+}
+
+static void handle_global_remove(void *data, struct wl_registry *registry,
+		uint32_t name) {
+	// Who cares?
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = handle_global,
+	.global_remove = handle_global_remove,
+};
+
+static bool parse_args(int argc, char *argv[]) {
+	int c;
+	while ((c = getopt(argc, argv, "n:s:d:D:r:i:bg:t:h")) != -1) {
+		switch (c) {
+		case 'n':
+			config.n_toplevels = atoi(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%dx%d", &config.width, &config.height) != 2) {
+				return false;
+			}
+			break;
+		case 'd':
+			config.damage = strtod(optarg, NULL);
+			break;
+		case 'D':
+			config.depth = atoi(optarg);
+			break;
+		case 'r':
+			config.commit_rate = atoi(optarg);
+			break;
+		case 'i':
+			config.input_rate = atoi(optarg);
+			break;
+		case 'b':
+			config.use_dmabuf = true;
+			break;
+		case 'g':
+			config.render_node = optarg;
+			break;
+		case 't':
+			config.duration = atoi(optarg);
+			break;
+		default:
+			return false;
+		}
+	}
+	return config.n_toplevels > 0 && config.width > 0 && config.height > 0 &&
+		config.damage > 0 && config.damage <= 1 && config.depth >= 0 &&
+		config.commit_rate >= 0 && config.input_rate >= 0 &&
+		config.duration >= 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (!parse_args(argc, argv)) {
+		fprintf(stderr, "%s", usage);
+		return EXIT_FAILURE;
+	}
+
+	display = wl_display_connect(NULL);
+	if (display == NULL) {
+		fprintf(stderr, "Failed to create display\n");
+		return EXIT_FAILURE;
+	}
+
+	struct wl_registry *registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, NULL);
+	wl_display_roundtrip(display);
+	wl_display_roundtrip(display);
+
+	if (compositor == NULL || subcompositor == NULL || shm == NULL ||
+			wm_base == NULL) {
+		fprintf(stderr, "Compositor is missing core globals\n");
+		return EXIT_FAILURE;
+	}
+	if (presentation == NULL) {
+		fprintf(stderr, "wp_presentation not available, "
+			"frame timing won't be reported\n");
+	}
+
+	int drm_fd = -1;
+	if (config.use_dmabuf) {
+		if (linux_dmabuf == NULL) {
+			fprintf(stderr, "linux-dmabuf not available\n");
+			return EXIT_FAILURE;
+		}
+		drm_fd = open(config.render_node, O_RDWR | O_CLOEXEC);
+		if (drm_fd < 0) {
+			perror("Failed to open DRM render node");
+			return EXIT_FAILURE;
+		}
+		gbm_device = gbm_create_device(drm_fd);
+		if (gbm_device == NULL) {
+			fprintf(stderr, "Failed to create GBM device\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (config.input_rate > 0) {
+		if (pointer_manager == NULL || seat == NULL) {
+			fprintf(stderr, "Virtual pointer protocol not available\n");
+			return EXIT_FAILURE;
+		}
+		virtual_pointer = zwlr_virtual_pointer_manager_v1_create_virtual_pointer(
+			pointer_manager, seat);
+	}
+
+	toplevels = calloc(config.n_toplevels, sizeof(toplevels[0]));
+	if (toplevels == NULL) {
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < config.n_toplevels; i++) {
+		if (!toplevel_init(&toplevels[i], i)) {
+			fprintf(stderr, "Failed to create toplevel\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	enum { FD_DISPLAY, FD_REPORT, FD_COMMIT, FD_INPUT, FD_COUNT };
+	struct pollfd fds[FD_COUNT] = {
+		[FD_DISPLAY] = { .fd = wl_display_get_fd(display), .events = POLLIN },
+		[FD_REPORT] = { .fd = create_timer(1), .events = POLLIN },
+		[FD_COMMIT] = { .fd = -1, .events = POLLIN },
+		[FD_INPUT] = { .fd = -1, .events = POLLIN },
+	};
+	if (config.commit_rate > 0) {
+		fds[FD_COMMIT].fd = create_timer(config.commit_rate);
+	}
+	if (config.input_rate > 0) {
+		fds[FD_INPUT].fd = create_timer(config.input_rate);
+	}
+
+	int64_t start_ns = now_ns(CLOCK_MONOTONIC);
+	int elapsed = 0;
+	while (config.duration == 0 || elapsed < config.duration) {
+		while (wl_display_prepare_read(display) != 0) {
+			wl_display_dispatch_pending(display);
+		}
+		if (wl_display_flush(display) < 0 && errno != EAGAIN) {
+			wl_display_cancel_read(display);
+			break;
+		}
+
+		if (poll(fds, FD_COUNT, -1) < 0) {
+			wl_display_cancel_read(display);
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		if (fds[FD_DISPLAY].revents & POLLIN) {
+			if (wl_display_read_events(display) < 0) {
+				break;
+			}
+		} else {
+			wl_display_cancel_read(display);
+		}
+		if (wl_display_dispatch_pending(display) < 0) {
+			break;
+		}
+
+		if ((fds[FD_COMMIT].revents & POLLIN) && read_timer(fds[FD_COMMIT].fd)) {
+			for (int i = 0; i < config.n_toplevels; i++) {
+				toplevel_commit(&toplevels[i]);
+			}
+		}
+		if (fds[FD_INPUT].revents & POLLIN) {
+			uint64_t n = read_timer(fds[FD_INPUT].fd);
+			for (uint64_t i = 0; i < n; i++) {
+				send_pointer_motion();
+			}
+		}
+		if ((fds[FD_REPORT].revents & POLLIN) && read_timer(fds[FD_REPORT].fd)) {
+			elapsed++;
+			char label[32];
+			snprintf(label, sizeof(label), "%ds", elapsed);
+			print_stats(label, &interval_stats, 1);
+			interval_stats = (struct load_stats){0};
+		}
+	}
+
+	double total_seconds = (now_ns(CLOCK_MONOTONIC) - start_ns) / 1e9;
+	print_stats("total", &total_stats, total_seconds);
+
+	for (int i = 1; i < FD_COUNT; i++) {
+		if (fds[i].fd >= 0) {
+			close(fds[i].fd);
+		}
+	}
+	for (int i = 0; i < config.n_toplevels; i++) {
+		toplevel_finish(&toplevels[i]);
+	}
+	free(toplevels);
+	if (virtual_pointer != NULL) {
+		zwlr_virtual_pointer_v1_destroy(virtual_pointer);
+	}
+	wl_display_roundtrip(display);
+	if (gbm_device != NULL) {
+		gbm_device_destroy(gbm_device);
+		close(drm_fd);
+	}
+	wl_display_disconnect(display);
+	return EXIT_SUCCESS;
+}
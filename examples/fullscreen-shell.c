@@ -17,7 +17,8 @@
 #include <wlr/util/log.h>
 
 /**
- * A minimal fullscreen-shell server. It only supports rendering.
+ * A minimal fullscreen-shell server. It scans out the client's buffer directly
+ * when possible, and falls back to rendering otherwise.
  */
 
 struct fullscreen_server {
@@ -88,6 +89,17 @@ static void output_handle_frame(struct wl_listener *listener, void *data) {
 	int width, height;
 	wlr_output_effective_resolution(output->wlr_output, &width, &height);
 
+	// The client's buffer covers the whole output in the common case, so
+	// try to display it without any copy first
+	if (output->surface != NULL &&
+			wlr_output_attach_surface(output->wlr_output, output->surface)) {
+		if (wlr_output_commit(output->wlr_output)) {
+			wlr_surface_send_frame_done(output->surface, &now);
+			return;
+		}
+		wlr_output_rollback(output->wlr_output);
+	}
+
 	if (!wlr_output_attach_render(output->wlr_output, NULL)) {
 		return;
 	}
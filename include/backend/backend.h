@@ -1,8 +1,12 @@
 #ifndef BACKEND_WLR_BACKEND_H
 #define BACKEND_WLR_BACKEND_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <wlr/backend.h>
 
+struct wlr_output;
+
 /**
  * Get the supported buffer capabilities.
  *
@@ -16,4 +20,16 @@ uint32_t backend_get_buffer_caps(struct wlr_backend *backend);
  */
 struct wlr_allocator *backend_get_allocator(struct wlr_backend *backend);
 
+/**
+ * Check whether the backend can commit several of its outputs at once.
+ */
+bool backend_supports_commit_outputs(struct wlr_backend *backend);
+
+/**
+ * Test or commit the pending state of several outputs of the backend at once.
+ * Either all outputs are committed, or none are.
+ */
+bool backend_commit_outputs(struct wlr_backend *backend,
+	struct wlr_output *const *outputs, size_t outputs_len, bool test_only);
+
 #endif
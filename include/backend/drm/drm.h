@@ -2,6 +2,7 @@
 #define BACKEND_DRM_DRM_H
 
 #include <gbm.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -15,6 +16,7 @@
 #include "backend/drm/iface.h"
 #include "backend/drm/properties.h"
 #include "backend/drm/renderer.h"
+#include "backend/drm/util.h"
 
 struct wlr_drm_plane {
 	uint32_t type;
@@ -24,6 +26,9 @@ struct wlr_drm_plane {
 	struct wlr_drm_surface surf;
 	/* Local, only initialized on multi-GPU setups. */
 	struct wlr_drm_surface mgpu_surf;
+	/* Multi-GPU only: set if buffers of the parent can't be scanned out
+	 * directly and need to be copied to mgpu_surf */
+	bool mgpu_needs_blit;
 
 	/* Buffer to be submitted to the kernel on the next page-flip */
 	struct wlr_drm_fb *pending_fb;
@@ -34,23 +39,102 @@ struct wlr_drm_plane {
 
 	struct wlr_drm_format_set formats;
 
+	/* Stacking order, zero if unknown */
+	uint64_t zpos;
+
+	/* Overlay planes only: position of the pending layer, in CRTC
+	 * coordinates */
+	int32_t layer_x, layer_y;
+	/* Overlay planes only: region of the FB to display, empty for the whole
+	 * FB, and size in CRTC coordinates, zero for the FB size. Scaling is done
+	 * by the display engine. */
+	struct wlr_fbox layer_src_box;
+	int32_t layer_width, layer_height;
+	/* Overlay planes only: whether a layer has been committed on the plane */
+	bool layer_enabled;
+
+	/* Primary plane only: committed DRM_MODE_ROTATE_* and DRM_MODE_REFLECT_*
+	 * bitmask, zero if never set */
+	uint64_t rotation;
+
 	union wlr_drm_plane_props props;
 };
 
 struct wlr_drm_crtc {
 	uint32_t id;
 
-	// Atomic modesetting only
+	// Atomic modesetting only, owned by the blob caches
 	uint32_t mode_id;
 	uint32_t gamma_lut;
+	struct drm_blob_cache mode_blobs, gamma_blobs;
 
 	// Legacy only
 	drmModeCrtc *legacy_crtc;
+	// Cursor BO last set with drmModeSetCursor, 0 if hidden or unknown
+	uint32_t legacy_cursor_handle;
+	// Updates waiting for the pending page-flip to complete
+	struct {
+		bool cursor;
+		bool gamma;
+		uint16_t *gamma_lut; // NULL to reset
+		size_t gamma_lut_size;
+	} legacy_pending;
 
 	struct wlr_drm_plane *primary;
 	struct wlr_drm_plane *cursor;
 
+	/* Overlay planes usable by this CRTC, ordered from bottom to top */
+	struct wlr_drm_plane **overlays;
+	size_t num_overlays;
+
 	union wlr_drm_crtc_props props;
+	// Value of the immutable GAMMA_LUT_SIZE property, 0 if unsupported
+	size_t gamma_lut_size;
+};
+
+/**
+ * KMS writeback connector: the display engine writes the composed output of
+ * the CRTC it's attached to, all planes included, into a framebuffer. Used to
+ * capture outputs without rendering, atomic modesetting only.
+ */
+struct wlr_drm_writeback {
+	struct wlr_drm_backend *backend;
+	uint32_t id;
+	uint32_t possible_crtcs;
+	union wlr_drm_connector_props props;
+	// WRITEBACK_PIXEL_FORMATS, with linear and implicit modifiers
+	struct wlr_drm_format_set formats;
+
+	// CRTC the connector is routed to, NULL if none. Attaching it requires
+	// a modeset, so it's left attached between captures.
+	struct wlr_drm_crtc *crtc;
+
+	// Capture requested for the next commit of the connector
+	struct wlr_drm_connector *pending_conn; // NULL if none
+	struct wlr_drm_fb *pending_fb;
+
+	// Capture submitted to the kernel, waiting for the out fence
+	struct {
+		struct wlr_drm_connector *conn; // NULL if none
+		struct wlr_drm_fb *fb;
+		int fence_fd;
+		struct wl_event_source *fence_source;
+	} inflight;
+
+	struct wl_list link; // wlr_drm_backend.writebacks
+};
+
+/**
+ * Connector probing running in a worker thread. Probing reads EDIDs and mode
+ * lists from the displays, which can take a while: it's started as soon as
+ * the backend is created so that it overlaps with the rest of the startup,
+ * including the probing of other GPUs.
+ */
+struct wlr_drm_connector_probe {
+	pthread_t thread;
+	int fd;
+	drmModeRes *res;
+	drmModeConnector **conns; // same indices as res->connectors
 };
 
 struct wlr_drm_backend {
@@ -60,6 +144,7 @@ struct wlr_drm_backend {
 	const struct wlr_drm_interface *iface;
 	clockid_t clock;
 	bool addfb2_modifiers;
+	bool async_page_flip; // with the interface in use
 
 	int fd;
 	char *name;
@@ -79,7 +164,15 @@ struct wlr_drm_backend {
 	struct wl_listener dev_remove;
 
 	struct wl_list fbs; // wlr_drm_fb.link
+	size_t fbs_len;
+	struct {
+		uint64_t hits, misses, evictions;
+	} fb_cache_stats;
 	struct wl_list outputs;
+	struct wl_list writebacks; // wlr_drm_writeback.link
+
+	struct wl_list modeset_tests; // wlr_drm_modeset_test.link
+	size_t modeset_tests_len;
 
 	struct wlr_drm_renderer renderer;
 	struct wlr_session *session;
@@ -87,6 +180,8 @@ struct wlr_drm_backend {
 	uint64_t cursor_width, cursor_height;
 
 	struct wlr_drm_format_set mgpu_formats;
+
+	struct wlr_drm_connector_probe *probe; // NULL if not running
 };
 
 enum wlr_drm_connector_state {
@@ -98,6 +193,23 @@ enum wlr_drm_connector_state {
 	WLR_DRM_CONN_CONNECTED,
 };
 
+// Maximum number of remembered modeset test results per DRM backend
+#define WLR_DRM_MODESET_TEST_CACHE_SIZE 16
+
+/**
+ * Result of a TEST_ONLY commit checking whether a connector can be lit up on a
+ * CRTC with a mode and a primary plane format.
+ */
+struct wlr_drm_modeset_test {
+	uint32_t conn_id, crtc_id;
+	drmModeModeInfo mode;
+	uint32_t format;
+	bool with_modifiers;
+
+	bool ok;
+	struct wl_list link; // wlr_drm_backend.modeset_tests, most recent first
+};
+
 struct wlr_drm_mode {
 	struct wlr_output_mode wlr_mode;
 	drmModeModeInfo drm_mode;
@@ -117,11 +229,55 @@ struct wlr_drm_connector {
 	uint32_t possible_crtcs;
 
 	union wlr_drm_connector_props props;
+	// Cached vrr_capable value, only changes along with a hotplug event
+	bool vrr_capable;
 
 	bool cursor_enabled;
 	int cursor_x, cursor_y;
 	int cursor_width, cursor_height;
 	int cursor_hotspot_x, cursor_hotspot_y;
+	// Whether the cursor plane shows the current cursor image since the last
+	// commit, in which case cursor moves can be applied right away
+	bool cursor_committed;
+	// Forces a frame for cursor moves deferred because of adaptive sync
+	struct wl_event_source *cursor_timer;
+	bool cursor_deferred;
+
+	// Refresh rate range from the EDID, in mHz, zero if unknown
+	int32_t min_refresh, max_refresh;
+
+	// EDID of the last display plugged into this connector and the fields
+	// parsed from it, re-used if the same display is plugged back
+	struct {
+		uint8_t *data; // NULL if no display was ever connected
+		size_t len;
+		char make[56], model[16], serial[16];
+		int32_t min_refresh, max_refresh;
+	} edid_cache;
+
+	// Gamma LUT transitions, atomic modesetting only. LUTs hold the red,
+	// green and blue ramps of the CRTC's GAMMA_LUT_SIZE.
+	struct {
+		int duration_ms; // zero if disabled
+		size_t size; // of the LUTs below, zero if unknown
+		uint16_t *current; // applied to the CRTC
+		uint16_t *from, *to;
+		bool to_reset; // the target is no LUT at all
+		bool active;
+		int64_t start_ms, last_step_ms;
+	} gamma_transition;
+
+	// Writeback connector capturing the next commit, NULL if none
+	struct wlr_drm_writeback *capture;
+
+	// Content rate hint, see wlr_drm_connector_set_content_rate
+	struct {
+		int32_t rate; // mHz, zero if unset
+		// Refresh rate emulated with adaptive sync, in mHz, zero if none
+		int32_t paced_refresh;
+		// Delays frame events to pace page-flips
+		struct wl_event_source *timer;
+	} content_rate;
 
 	drmModeCrtc *old_crtc;
 
@@ -135,19 +291,59 @@ struct wlr_drm_connector {
 	 * they're sent.
 	 */
 	uint32_t pending_page_flip_crtc;
+	/* Whether the pending page-flip doesn't wait for vblank */
+	bool pending_page_flip_tearing;
+};
+
+/* Pending state of a connector, when committing several connectors at once */
+struct wlr_drm_connector_commit {
+	struct wlr_drm_connector *conn;
+	struct wlr_output_state state;
+	/* Mode to apply on a modeset, NULL if the connector is disabled */
+	struct wlr_output_mode *mode;
 };
 
+/**
+ * Forget the gamma LUT applied to the connector's CRTC and stop the
+ * transition in progress.
+ */
+void drm_connector_reset_gamma_transition(struct wlr_drm_connector *conn);
+
 struct wlr_drm_backend *get_drm_backend_from_backend(
 	struct wlr_backend *wlr_backend);
 bool check_drm_features(struct wlr_drm_backend *drm);
 bool init_drm_resources(struct wlr_drm_backend *drm);
 void finish_drm_resources(struct wlr_drm_backend *drm);
 void restore_drm_outputs(struct wlr_drm_backend *drm);
-void scan_drm_connectors(struct wlr_drm_backend *state);
+/**
+ * Scan the connectors of the device. If event is non-NULL and targets a
+ * connector, only this connector is refreshed.
+ */
+void scan_drm_connectors(struct wlr_drm_backend *state,
+	const struct wlr_device_change_event *event);
+/**
+ * Start probing connectors in a worker thread. The results are picked up by
+ * the next scan_drm_connectors call.
+ */
+void start_drm_connector_probe(struct wlr_drm_backend *drm);
+/**
+ * Wait for the probe thread and discard its results.
+ */
+void cancel_drm_connector_probe(struct wlr_drm_backend *drm);
 int handle_drm_event(int fd, uint32_t mask, void *data);
 void destroy_drm_connector(struct wlr_drm_connector *conn);
 bool drm_connector_commit_state(struct wlr_drm_connector *conn,
 	const struct wlr_output_state *state);
+void drm_modeset_tests_clear(struct wlr_drm_backend *drm);
+bool drm_commit_outputs(struct wlr_drm_backend *drm,
+	struct wlr_output *const *outputs, size_t outputs_len, bool test_only);
+/**
+ * Restore the last committed state of all outputs in a single atomic commit,
+ * re-using their current buffers. Used when the session becomes active again.
+ * Returns false if the state couldn't be restored this way, in which case
+ * nothing has been committed.
+ */
+bool drm_resume_outputs(struct wlr_drm_backend *drm);
 bool drm_connector_is_cursor_visible(struct wlr_drm_connector *conn);
 bool drm_connector_supports_vrr(struct wlr_drm_connector *conn);
 size_t drm_crtc_get_gamma_lut_size(struct wlr_drm_backend *drm,
@@ -156,11 +352,42 @@ size_t drm_crtc_get_gamma_lut_size(struct wlr_drm_backend *drm,
 struct wlr_drm_fb *plane_get_next_fb(struct wlr_drm_plane *plane);
 
 bool drm_connector_state_is_modeset(const struct wlr_output_state *state);
+/**
+ * Check whether the state switches the mode of an enabled connector to one
+ * which only differs in its vertical timings. The primary plane's surface
+ * can then be kept, and drivers may accept the switch without a modeset.
+ */
+bool drm_connector_state_is_seamless(struct wlr_drm_connector *conn,
+	const struct wlr_output_state *state);
 bool drm_connector_state_active(struct wlr_drm_connector *conn,
 	const struct wlr_output_state *state);
 void drm_connector_state_mode(struct wlr_drm_connector *conn,
 	const struct wlr_output_state *state, drmModeModeInfo *mode);
 
+/**
+ * Add a writeback connector found while scanning connectors. Does nothing if
+ * it's already known.
+ */
+bool drm_writeback_create(struct wlr_drm_backend *drm, uint32_t id,
+	uint32_t possible_crtcs);
+void drm_writeback_destroy(struct wlr_drm_writeback *wb);
+/**
+ * Capture the next commit of the connector with a writeback connector, see
+ * wlr_output_capture_next_commit().
+ */
+bool drm_connector_request_capture(struct wlr_drm_connector *conn,
+	struct wlr_buffer *buffer);
+/**
+ * Cancel the pending and in-flight captures of the connector.
+ */
+void drm_connector_cancel_capture(struct wlr_drm_connector *conn);
+/**
+ * Submit or cancel the pending capture of the writeback connector after the
+ * commit it was part of. Takes ownership of the out fence.
+ */
+void drm_writeback_commit_done(struct wlr_drm_writeback *wb, bool ok,
+	int fence_fd);
+
 #define wlr_drm_conn_log(conn, verb, fmt, ...) \
 	wlr_log(verb, "connector %s: " fmt, conn->name, ##__VA_ARGS__)
 #define wlr_drm_conn_log_errno(conn, verb, fmt, ...) \
@@ -3,12 +3,14 @@
 
 #include <gbm.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
 struct wlr_drm_backend;
 struct wlr_drm_connector;
+struct wlr_drm_connector_commit;
 struct wlr_drm_crtc;
 
 // Used to provide atomic or legacy DRM functions
@@ -17,6 +19,12 @@ struct wlr_drm_interface {
 	bool (*crtc_commit)(struct wlr_drm_backend *drm,
 		struct wlr_drm_connector *conn, const struct wlr_output_state *state,
 		uint32_t flags);
+	// Commit the pending changes of several connectors, which must all have
+	// a CRTC. DRM_MODE_PAGE_FLIP_EVENT only applies to active connectors.
+	// All-or-nothing: the legacy interface only accepts a single connector.
+	bool (*commit_connectors)(struct wlr_drm_backend *drm,
+		const struct wlr_drm_connector_commit *commits, size_t commits_len,
+		uint32_t flags);
 };
 
 extern const struct wlr_drm_interface atomic_iface;
@@ -24,5 +32,12 @@ extern const struct wlr_drm_interface legacy_iface;
 
 bool drm_legacy_crtc_set_gamma(struct wlr_drm_backend *drm,
 	struct wlr_drm_crtc *crtc, size_t size, uint16_t *lut);
+/**
+ * Apply the cursor and gamma updates which were queued by the legacy
+ * interface until the page-flip completes.
+ */
+void drm_legacy_crtc_apply_pending(struct wlr_drm_backend *drm,
+	struct wlr_drm_connector *conn);
+void drm_legacy_crtc_finish(struct wlr_drm_crtc *crtc);
 
 #endif
@@ -22,8 +22,13 @@ union wlr_drm_connector_props {
 		// atomic-modesetting only
 
 		uint32_t crtc_id;
+
+		// writeback connectors only
+		uint32_t writeback_fb_id;
+		uint32_t writeback_out_fence_ptr;
+		uint32_t writeback_pixel_formats;
 	};
-	uint32_t props[4];
+	uint32_t props[10];
 };
 
 union wlr_drm_crtc_props {
@@ -37,8 +42,9 @@ union wlr_drm_crtc_props {
 
 		uint32_t active;
 		uint32_t mode_id;
+		uint32_t out_fence_ptr;
 	};
-	uint32_t props[6];
+	uint32_t props[7];
 };
 
 union wlr_drm_plane_props {
@@ -46,6 +52,7 @@ union wlr_drm_plane_props {
 		uint32_t type;
 		uint32_t rotation; // Not guaranteed to exist
 		uint32_t in_formats; // Not guaranteed to exist
+		uint32_t zpos; // Not guaranteed to exist
 
 		// atomic-modesetting only
 
@@ -59,8 +66,10 @@ union wlr_drm_plane_props {
 		uint32_t crtc_h;
 		uint32_t fb_id;
 		uint32_t crtc_id;
+		uint32_t in_fence_fd;
+		uint32_t fb_damage_clips; // Not guaranteed to exist
 	};
-	uint32_t props[13];
+	uint32_t props[16];
 };
 
 bool get_drm_connector_props(int fd, uint32_t id,
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <wlr/backend.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/util/addon.h>
 
 struct wlr_drm_backend;
 struct wlr_drm_plane;
@@ -29,14 +30,19 @@ struct wlr_drm_surface {
 	struct wlr_buffer *back_buffer;
 };
 
+// Maximum number of unused framebuffers kept around per DRM backend
+#define WLR_DRM_FB_CACHE_SIZE 32
+
 struct wlr_drm_fb {
 	struct wlr_buffer *wlr_buf;
-	struct wl_list link; // wlr_drm_backend.fbs
+	struct wl_list link; // wlr_drm_backend.fbs, most recently used first
 
 	struct gbm_bo *bo;
 	uint32_t id;
+	struct wlr_drm_backend *drm;
+	size_t n_refs; // number of plane slots referencing the framebuffer
 
-	struct wl_listener wlr_buf_destroy;
+	struct wlr_addon addon;
 };
 
 bool init_drm_renderer(struct wlr_drm_backend *drm,
@@ -49,6 +55,14 @@ bool init_drm_surface(struct wlr_drm_surface *surf,
 bool drm_surface_make_current(struct wlr_drm_surface *surf, int *buffer_age);
 void drm_surface_unset_current(struct wlr_drm_surface *surf);
 
+/**
+ * On multi-GPU setups, try to import a buffer allocated on the parent GPU
+ * for scanout on the plane, without copying it. Once that has failed, false
+ * is returned until the plane's surface is re-initialized.
+ */
+bool drm_plane_import_mgpu(struct wlr_drm_plane *plane,
+	struct wlr_drm_backend *drm, struct wlr_buffer *buf,
+	struct wlr_drm_fb **fb_ptr);
 bool drm_fb_import(struct wlr_drm_fb **fb, struct wlr_drm_backend *drm,
 		struct wlr_buffer *buf, const struct wlr_drm_format_set *formats);
 void drm_fb_destroy(struct wlr_drm_fb *fb);
@@ -60,11 +74,17 @@ struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
 	struct wlr_buffer *buffer);
 bool drm_surface_render_black_frame(struct wlr_drm_surface *surf);
 
+/**
+ * Pick a format for rendering into buffers scanned out by a plane. The
+ * preferred format is used if both the renderer and the plane support it,
+ * ARGB8888 or its opaque substitute otherwise.
+ */
 struct wlr_drm_format *drm_plane_pick_render_format(
-		struct wlr_drm_plane *plane, struct wlr_drm_renderer *renderer);
+		struct wlr_drm_plane *plane, struct wlr_drm_renderer *renderer,
+		uint32_t preferred_format);
 bool drm_plane_init_surface(struct wlr_drm_plane *plane,
 		struct wlr_drm_backend *drm, int32_t width, uint32_t height,
-		bool with_modifiers);
+		uint32_t preferred_format, bool with_modifiers);
 void drm_plane_finish_surface(struct wlr_drm_plane *plane);
 bool drm_plane_lock_surface(struct wlr_drm_plane *plane,
 		struct wlr_drm_backend *drm);
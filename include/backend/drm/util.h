@@ -8,14 +8,46 @@
 
 // Calculates a more accurate refresh rate (mHz) than what mode itself provides
 int32_t calculate_refresh_rate(const drmModeModeInfo *mode);
+// Checks whether two different modes only differ in their vertical timings,
+// in which case drivers may be able to switch between them without a modeset
+bool drm_mode_is_seamless_switch(const drmModeModeInfo *a,
+	const drmModeModeInfo *b);
 // Populates the make/model/phys_{width,height} of output from the edid data
 void parse_edid(struct wlr_output *restrict output, size_t len,
 	const uint8_t *data);
+// Gets the vertical refresh rate range (mHz) from the edid data, if any
+bool parse_edid_refresh_range(size_t len, const uint8_t *data,
+	int32_t *min_refresh, int32_t *max_refresh);
 // Returns the string representation of a DRM output type
 const char *conn_get_name(uint32_t type_id);
 // Returns the DRM framebuffer id for a gbm_bo
 uint32_t get_fb_for_bo(struct gbm_bo *bo, bool with_modifiers);
 
+#define DRM_BLOB_CACHE_LEN 4
+
+/**
+ * Property blobs kept around to be re-used when the same contents are set
+ * again, e.g. when toggling between gamma LUTs or when testing a state before
+ * committing it. The cache owns its blobs.
+ */
+struct drm_blob_cache {
+	struct {
+		uint32_t id; // zero if unused
+		void *data;
+		size_t size;
+		uint64_t last_used;
+	} entries[DRM_BLOB_CACHE_LEN];
+	uint64_t counter;
+};
+
+/**
+ * Get a blob with the contents, creating it if it's not cached yet. The blob
+ * keep_id isn't evicted from the cache to make room. Returns 0 on failure.
+ */
+uint32_t drm_blob_cache_get(int fd, struct drm_blob_cache *cache,
+	const void *data, size_t size, uint32_t keep_id);
+void drm_blob_cache_finish(int fd, struct drm_blob_cache *cache);
+
 // Part of match_obj
 enum {
 	UNMATCHED = (uint32_t)-1,
@@ -31,7 +63,9 @@ enum {
  *
  * res contains an index of which objs it is matched with or UNMATCHED.
  *
- * This solution is left in out.
+ * This solution is left in out. Among the solutions matching the most objects,
+ * the one changing the fewest existing matches in res is picked. This is solved
+ * as a weighted bipartite matching in polynomial time.
  * Returns the total number of matched solutions.
  */
 size_t match_obj(size_t num_objs, const uint32_t objs[static restrict num_objs],
@@ -9,6 +9,7 @@
 struct wlr_headless_backend {
 	struct wlr_backend backend;
 	int drm_fd;
+	char *render_node; // path of the DRM render node, NULL if unknown
 	struct wl_display *display;
 	struct wl_list outputs;
 	size_t last_output_num;
@@ -28,7 +29,21 @@ struct wlr_headless_output {
 	struct wlr_buffer *front_buffer;
 
 	struct wl_event_source *frame_timer;
-	int frame_delay; // ms
+	int64_t refresh_ns;
+
+	// The frame timer acts as a vblank: committed buffers are presented on
+	// the next tick. Ticks are aligned on a virtual vblank grid starting at
+	// vblank_base_ns, and the timer is only armed when a frame is needed.
+	int64_t vblank_base_ns;
+	uint64_t msc_base; // msc at vblank_base_ns
+	uint64_t msc;
+	bool frame_timer_armed;
+	bool frame_requested;
+	bool present_pending;
+	uint32_t present_commit_seq;
+
+	struct wlr_headless_frame_sink *frame_sink;
+	pixman_region32_t frame_sink_damage; // accumulated since the last frame
 };
 
 struct wlr_headless_input_device {
@@ -39,5 +54,15 @@ struct wlr_headless_input_device {
 
 struct wlr_headless_backend *headless_backend_from_backend(
 	struct wlr_backend *wlr_backend);
+/**
+ * Open the DRM render node selected by the options. On success, path is set
+ * to the newly allocated path of the node.
+ */
+int headless_open_render_node(const struct wlr_headless_backend_options *options,
+	char **path);
+/**
+ * Emit a frame event on the next virtual vblank.
+ */
+void headless_output_schedule_frame(struct wlr_headless_output *output);
 
 #endif
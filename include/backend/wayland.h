@@ -2,6 +2,7 @@
 #define BACKEND_WAYLAND_H
 
 #include <stdbool.h>
+#include <time.h>
 
 #include <wayland-client.h>
 #include <wayland-server-core.h>
@@ -31,10 +32,13 @@ struct wlr_wl_backend {
 	struct wl_event_source *remote_display_src;
 	struct wl_registry *registry;
 	struct wl_compositor *compositor;
+	struct wl_subcompositor *subcompositor;
+	struct wp_viewporter *viewporter;
 	struct xdg_wm_base *xdg_wm_base;
 	struct zxdg_decoration_manager_v1 *zxdg_decoration_manager_v1;
 	struct zwp_pointer_gestures_v1 *zwp_pointer_gestures_v1;
 	struct wp_presentation *presentation;
+	clockid_t presentation_clock;
 	struct wl_shm *shm;
 	struct zwp_linux_dmabuf_v1 *zwp_linux_dmabuf_v1;
 	struct zwp_relative_pointer_manager_v1 *zwp_relative_pointer_manager_v1;
@@ -51,7 +55,11 @@ struct wlr_wl_buffer {
 	struct wl_buffer *wl_buffer;
 	bool released;
 	struct wl_list link; // wlr_wl_backend.buffers
-	struct wl_listener buffer_destroy;
+	// Cached buffers are found back through the wlr_buffer, and kept once
+	// released. Others are only created when the cached one is still in use
+	// by the parent compositor, and destroyed once released.
+	bool cached;
+	struct wlr_addon addon; // wlr_buffer.addons, if cached
 };
 
 struct wlr_wl_presentation_feedback {
@@ -61,6 +69,21 @@ struct wlr_wl_presentation_feedback {
 	uint32_t commit_seq;
 };
 
+/**
+ * An output layer forwarded to the parent compositor as a sub-surface of the
+ * output surface, so that it doesn't need to be composited.
+ */
+struct wlr_wl_output_layer {
+	struct wlr_addon addon; // wlr_output_layer.addons
+	struct wlr_wl_output *output;
+	struct wl_list link; // wlr_wl_output.layers
+
+	struct wl_surface *surface;
+	struct wl_subsurface *subsurface;
+	struct wp_viewport *viewport;
+	bool mapped;
+};
+
 struct wlr_wl_output {
 	struct wlr_output wlr_output;
 
@@ -74,6 +97,16 @@ struct wlr_wl_output {
 	struct zxdg_toplevel_decoration_v1 *zxdg_toplevel_decoration_v1;
 	struct wl_list presentation_feedbacks;
 
+	// Frame pacing: when the parent supports presentation-time, frame events
+	// are also driven by a timer aligned on the predicted parent vblank, so
+	// that throttled frame callbacks (e.g. hidden window) don't stall us
+	struct wl_event_source *frame_timer;
+	int64_t last_present_ns; // in the presentation clock, 0 if unknown
+	uint32_t refresh_ns; // parent refresh period, 0 if unknown
+	bool frame_sent; // frame event sent since the last commit
+
+	struct wl_list layers; // wlr_wl_output_layer.link
+
 	uint32_t enter_serial;
 
 	struct {
@@ -12,6 +12,9 @@
 #if HAS_XCB_ERRORS
 #include <xcb/xcb_errors.h>
 #endif
+#if HAS_XSHMFENCE
+#include <xcb/sync.h>
+#endif
 
 #include <pixman.h>
 #include <wlr/backend/x11.h>
@@ -21,6 +24,7 @@
 #include <wlr/interfaces/wlr_pointer.h>
 #include <wlr/interfaces/wlr_touch.h>
 #include <wlr/render/drm_format_set.h>
+#include <wlr/util/addon.h>
 
 #define XCB_EVENT_RESPONSE_TYPE_MASK 0x7f
 
@@ -46,6 +50,8 @@ struct wlr_x11_output {
 	pixman_region32_t exposed;
 
 	uint64_t last_msc;
+	uint64_t last_ust; // usec
+	int refresh; // nsec, estimated from MSC and UST, zero if unknown
 
 	struct {
 		struct wlr_swapchain *swapchain;
@@ -116,8 +122,15 @@ struct wlr_x11_buffer {
 	struct wlr_x11_backend *x11;
 	struct wlr_buffer *buffer;
 	xcb_pixmap_t pixmap;
-	struct wl_list link; // wlr_x11_output::buffers
-	struct wl_listener buffer_destroy;
+	bool idle; // not in use by the X server
+	uint32_t present_serial; // serial of the last PresentPixmap request
+#if HAS_XSHMFENCE
+	// Triggered by the X server when the pixmap becomes idle
+	xcb_sync_fence_t idle_fence;
+	struct xshmfence *shm_fence;
+#endif
+	struct wl_list link; // wlr_x11_output::buffers, most recently used first
+	struct wlr_addon addon; // wlr_buffer.addons
 };
 
 struct wlr_x11_format {
@@ -25,6 +25,14 @@ struct wlr_allocator {
 	struct {
 		struct wl_signal destroy;
 	} events;
+
+	// Buffers released recently, kept around for reuse by
+	// wlr_allocator_create_buffer. Private.
+	struct {
+		struct wl_list entries; // allocator_pool_entry.link, most recent first
+		struct wl_list buffers; // pooled_buffer.link, handed out buffers
+		size_t size; // in bytes
+	} pool;
 };
 
 /**
@@ -36,11 +44,16 @@ struct wlr_allocator *wlr_allocator_autocreate(struct wlr_backend *backend,
  * Destroy the allocator.
  */
 void wlr_allocator_destroy(struct wlr_allocator *alloc);
+/**
+ * Release all buffers kept around for reuse, e.g. under memory pressure.
+ */
+void wlr_allocator_trim(struct wlr_allocator *alloc);
 /**
  * Allocate a new buffer.
  *
  * When the caller is done with it, they must unreference it by calling
- * wlr_buffer_drop.
+ * wlr_buffer_drop. The underlying storage is then kept in a pool for a short
+ * while, and reused for subsequent allocations with the same size and format.
  */
 struct wlr_buffer *wlr_allocator_create_buffer(struct wlr_allocator *alloc,
 	int width, int height, const struct wlr_drm_format *format);
@@ -52,4 +65,10 @@ void wlr_allocator_init(struct wlr_allocator *alloc,
 struct wlr_allocator *allocator_autocreate_with_drm_fd(
 	struct wlr_backend *backend, struct wlr_renderer *renderer, int drm_fd);
 
+/**
+ * Get the buffer created by the allocator implementation backing a buffer
+ * returned by wlr_allocator_create_buffer. Other buffers are returned as-is.
+ */
+struct wlr_buffer *allocator_buffer_get_storage(struct wlr_buffer *buffer);
+
 #endif
@@ -0,0 +1,31 @@
+#ifndef RENDER_DMABUF_H
+#define RENDER_DMABUF_H
+
+#include <stdbool.h>
+
+/**
+ * Export the fences a reader of the DMA-BUF needs to wait on as a sync_file.
+ *
+ * Returns -1 on error or if the kernel doesn't support it.
+ */
+int dmabuf_export_sync_file(int dmabuf_fd);
+/**
+ * Export the fences a writer of the DMA-BUF needs to wait on as a sync_file,
+ * including the ones of pending reads.
+ *
+ * Returns -1 on error or if the kernel doesn't support it.
+ */
+int dmabuf_export_write_sync_file(int dmabuf_fd);
+/**
+ * Create a sync_file which signals once both sync_files have signalled. The
+ * file descriptors aren't consumed.
+ *
+ * Returns -1 on error.
+ */
+int sync_file_merge(int fd1, int fd2);
+/**
+ * Check whether a sync_file has signalled, without blocking.
+ */
+bool sync_file_is_signaled(int fd);
+
+#endif
@@ -18,7 +18,12 @@ struct wlr_drm_dumb_buffer {
 	uint32_t width, height;
 
 	uint64_t size;
-	void *data;
+	void *data; // write-combined mapping of the dumb buffer
+
+	// Copy in cached memory handed out for data pointer access, flushed to
+	// the dumb buffer at the end of the access. NULL if unavailable.
+	void *shadow;
+	uint32_t dirty_y1, dirty_y2; // rows to flush at the end of the access
 };
 
 struct wlr_drm_dumb_allocator {
@@ -34,4 +39,13 @@ struct wlr_drm_dumb_allocator {
  */
 struct wlr_allocator *wlr_drm_dumb_allocator_create(int fd);
 
+/**
+ * Restrict the rows copied to the dumb buffer at the end of the current data
+ * pointer access to [y1, y2). By default, the whole buffer is copied.
+ *
+ * Does nothing if the buffer isn't a DRM dumb buffer.
+ */
+void drm_dumb_buffer_set_dirty_rows(struct wlr_buffer *buffer,
+	int32_t y1, int32_t y2);
+
 #endif
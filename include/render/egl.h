@@ -62,6 +62,28 @@ bool wlr_egl_destroy_image(struct wlr_egl *egl, EGLImageKHR image);
 
 int wlr_egl_dup_drm_fd(struct wlr_egl *egl);
 
+/**
+ * Insert a fence in the command stream of the current context. Returns
+ * EGL_NO_SYNC_KHR on error.
+ */
+EGLSyncKHR wlr_egl_create_fence(struct wlr_egl *egl);
+
+/**
+ * Check whether the fence has been signalled, waiting at most `timeout`
+ * nanoseconds.
+ */
+bool wlr_egl_wait_sync(struct wlr_egl *egl, EGLSyncKHR sync,
+	EGLTimeKHR timeout);
+
+void wlr_egl_destroy_sync(struct wlr_egl *egl, EGLSyncKHR sync);
+
+/**
+ * Create a context sharing objects with the main context, to be made current
+ * on another thread. Must be destroyed with eglDestroyContext before the
+ * wlr_egl. Returns EGL_NO_CONTEXT on error.
+ */
+EGLContext wlr_egl_create_shared_context(struct wlr_egl *egl);
+
 /**
  * Save the current EGL context to the structure provided in the argument.
  *
@@ -3,6 +3,7 @@
 
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
@@ -12,6 +13,7 @@
 #include <wlr/render/interface.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/render/wlr_texture.h>
+#include <wlr/util/addon.h>
 #include <wlr/util/log.h>
 
 struct wlr_gles2_pixel_format {
@@ -20,6 +22,14 @@ struct wlr_gles2_pixel_format {
 	bool has_alpha;
 };
 
+struct wlr_gles2_quad_shader {
+	GLuint program;
+	GLint proj;
+	GLint color;
+	GLint pos_attrib;
+	GLint color_matrix, color_lut; // -1 without color transform
+};
+
 struct wlr_gles2_tex_shader {
 	GLuint program;
 	GLint proj;
@@ -28,6 +38,88 @@ struct wlr_gles2_tex_shader {
 	GLint alpha;
 	GLint pos_attrib;
 	GLint tex_attrib;
+	GLint color_matrix, color_lut; // -1 without color transform
+	GLint tex_uv, yuv_matrix, yuv_offset; // -1 except for tex_yuv
+};
+
+struct wlr_gles2_shaders {
+	struct wlr_gles2_quad_shader quad;
+	struct wlr_gles2_tex_shader tex_rgba;
+	struct wlr_gles2_tex_shader tex_rgbx;
+	struct wlr_gles2_tex_shader tex_ext;
+	// Two-plane YUV textures, see wlr_gles2_texture.yuv
+	struct wlr_gles2_tex_shader tex_yuv;
+};
+
+// Number of entries of the color transform LUT
+#define WLR_GLES2_COLOR_LUT_SIZE 256
+
+// Number of render passes for which timing statistics are kept
+#define WLR_GLES2_TIMER_FRAMES 16
+// Maximum number of timed texture draws per render pass
+#define WLR_GLES2_TIMER_MAX_DRAWS 32
+
+struct wlr_gles2_timer_frame {
+	uint32_t render_seq;
+	bool pending; // statistics haven't been retrieved yet
+	bool has_queries;
+	// The GPU timer was disjoint while the queries were in flight
+	bool disjoint;
+	int64_t cpu_time;
+	size_t draws;
+	// Timestamps at begin and end, then before and after each texture draw
+	GLuint queries[2 + 2 * WLR_GLES2_TIMER_MAX_DRAWS];
+};
+
+// Maximum number of textured quads drawn with a single draw call
+#define WLR_GLES2_BATCH_MAX_QUADS 256
+// Two triangles per quad, with a position and a texture coordinate per vertex
+#define WLR_GLES2_BATCH_VERTEX_LEN 4
+#define WLR_GLES2_BATCH_MAX_VERTS (6 * WLR_GLES2_BATCH_MAX_QUADS)
+
+// Maximum number of render buffers kept imported, least recently bound ones
+// are evicted first
+#define WLR_GLES2_BUFFER_CACHE_SIZE 32
+
+// Size of the shared textures small textures are packed into
+#define WLR_GLES2_ATLAS_PAGE_SIZE 1024
+// Textures bigger than this in any dimension get a texture of their own
+#define WLR_GLES2_ATLAS_MAX_SIZE 128
+
+/**
+ * A shared texture holding many small textures with the same pixel format.
+ * The page is split into shelves (rows) of slots.
+ */
+struct wlr_gles2_atlas_page {
+	struct wlr_gles2_renderer *renderer;
+	struct wl_list link; // wlr_gles2_renderer.atlas_pages
+
+	uint32_t drm_format;
+	GLuint tex;
+
+	struct wl_list shelves; // wlr_gles2_atlas_shelf.link, bottom to top
+	int shelves_height;
+	size_t slots_used;
+};
+
+struct wlr_gles2_atlas_shelf {
+	struct wl_list link; // wlr_gles2_atlas_page.shelves
+	int y, height;
+	struct wl_list slots; // wlr_gles2_atlas_slot.link, left to right
+};
+
+/**
+ * An area of an atlas page. Slots include a 1px border around the texture,
+ * filled with a copy of the texture's edges so that sampling with linear
+ * filtering doesn't bleed into neighbours.
+ */
+struct wlr_gles2_atlas_slot {
+	struct wlr_gles2_atlas_page *page;
+	struct wlr_gles2_atlas_shelf *shelf;
+	struct wl_list link; // wlr_gles2_atlas_shelf.slots
+
+	int x, width; // including the border
+	bool used;
 };
 
 struct wlr_gles2_renderer {
@@ -43,6 +135,14 @@ struct wlr_gles2_renderer {
 		bool debug_khr;
 		bool egl_image_external_oes;
 		bool egl_image_oes;
+		bool disjoint_timer_query_ext;
+		bool pixel_buffer_object; // OpenGL ES 3.0 or later
+		bool npot_mipmap; // OpenGL ES 3.0 or GL_OES_texture_npot
+		bool get_program_binary_oes;
+		bool texture_rg; // OpenGL ES 3.0 or GL_EXT_texture_rg
+		bool texture_norm16_ext;
+		bool texture_type_2_10_10_10_rev_ext;
+		bool texture_half_float_linear_oes;
 	} exts;
 
 	struct {
@@ -52,25 +152,92 @@ struct wlr_gles2_renderer {
 		PFNGLPOPDEBUGGROUPKHRPROC glPopDebugGroupKHR;
 		PFNGLPUSHDEBUGGROUPKHRPROC glPushDebugGroupKHR;
 		PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC glEGLImageTargetRenderbufferStorageOES;
+		PFNGLGENQUERIESEXTPROC glGenQueriesEXT;
+		PFNGLDELETEQUERIESEXTPROC glDeleteQueriesEXT;
+		PFNGLQUERYCOUNTEREXTPROC glQueryCounterEXT;
+		PFNGLGETQUERYOBJECTIVEXTPROC glGetQueryObjectivEXT;
+		PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
+		// Core OpenGL ES 3.0 functions, same signature as the extensions
+		PFNGLMAPBUFFERRANGEEXTPROC glMapBufferRange;
+		PFNGLUNMAPBUFFEROESPROC glUnmapBuffer;
+		PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinaryOES;
+		PFNGLPROGRAMBINARYOESPROC glProgramBinaryOES;
+		PFNGLTEXSTORAGE2DEXTPROC glTexStorage2D;
+		PFNGLBLITFRAMEBUFFERNVPROC glBlitFramebuffer;
 	} procs;
 
+	// On-disk cache of linked programs, disabled if dir is NULL
+	struct {
+		char *dir;
+		uint64_t driver_hash;
+	} program_cache;
+
+	struct wlr_gles2_shaders shaders;
+	// Variants applying the color transform, linked on first use
+	struct wlr_gles2_shaders color_transform_shaders;
+	bool has_color_transform_shaders;
+
+	// Color transform of the next render pass, see
+	// wlr_renderer_set_color_transform
+	struct {
+		bool enabled;
+		float matrix[9];
+		uint8_t lut[4 * WLR_GLES2_COLOR_LUT_SIZE]; // RGBA
+		GLuint lut_tex;
+	} color_transform;
+
+	struct wl_list buffers; // wlr_gles2_buffer.link, most recently bound first
+	size_t buffers_len;
 	struct {
-		struct {
-			GLuint program;
-			GLint proj;
-			GLint color;
-			GLint pos_attrib;
-		} quad;
-		struct wlr_gles2_tex_shader tex_rgba;
-		struct wlr_gles2_tex_shader tex_rgbx;
-		struct wlr_gles2_tex_shader tex_ext;
-	} shaders;
-
-	struct wl_list buffers; // wlr_gles2_buffer.link
+		uint64_t hits, misses, evictions;
+	} buffer_cache_stats;
 	struct wl_list textures; // wlr_gles2_texture.link
+	struct wl_list atlas_pages; // wlr_gles2_atlas_page.link
 
 	struct wlr_gles2_buffer *current_buffer;
 	uint32_t viewport_width, viewport_height;
+
+	// Mipmapped copies of minified textures, enabled with
+	// WLR_GLES2_MIPMAPS=1 on OpenGL ES 3.0
+	struct {
+		bool enabled;
+		GLuint read_fbo, draw_fbo;
+	} mipmaps;
+
+	struct {
+		struct wlr_gles2_timer_frame frames[WLR_GLES2_TIMER_FRAMES];
+		struct wlr_gles2_timer_frame *current; // NULL if not rendering
+	} timer;
+
+	// Staging memory for pixels read back in another format
+	struct {
+		void *data;
+		size_t size;
+	} read_buffer;
+
+	// Textured quads sharing the same texture and alpha, not drawn yet
+	struct {
+		struct wlr_gles2_texture *texture; // NULL if the batch is empty
+		float alpha;
+		bool minify; // sampled with mipmaps
+		size_t len; // number of vertices
+		GLfloat verts[WLR_GLES2_BATCH_VERTEX_LEN * WLR_GLES2_BATCH_MAX_VERTS];
+		GLuint vbo;
+	} batch;
+
+	// Worker thread uploading textures with a shared context, started on
+	// first use
+	struct {
+		bool running, disabled;
+		pthread_t thread;
+		EGLContext context;
+		pthread_mutex_t lock;
+		// Signalled when a job is queued, a job is done or the worker
+		// needs to stop
+		pthread_cond_t cond;
+		struct wl_list jobs; // wlr_gles2_texture_upload.link, not started
+		bool stop;
+	} upload;
 };
 
 struct wlr_gles2_buffer {
@@ -82,7 +249,35 @@ struct wlr_gles2_buffer {
 	GLuint rbo;
 	GLuint fbo;
 
-	struct wl_listener buffer_destroy;
+	struct wlr_addon addon;
+};
+
+struct wlr_gles2_read_request {
+	struct wlr_read_pixels_request base;
+	struct wlr_gles2_renderer *renderer;
+
+	const struct wlr_gles2_pixel_format *fmt;
+	uint32_t bpp;
+	GLuint pbo;
+	EGLSyncKHR fence;
+};
+
+struct wlr_gles2_texture_upload {
+	struct wlr_texture_upload base;
+	struct wlr_gles2_renderer *renderer;
+	struct wl_list link; // wlr_gles2_renderer.upload.jobs, empty once started
+
+	// Locked, with its data pointer accessed until the upload is released
+	struct wlr_buffer *buffer;
+	const struct wlr_gles2_pixel_format *fmt;
+	const void *data;
+	size_t stride;
+	int done_fd; // written to by the worker once done
+
+	bool done; // protected by the upload lock
+	// Written by the worker, only read once done
+	GLuint tex;
+	bool ok;
 };
 
 struct wlr_gles2_texture {
@@ -95,24 +290,53 @@ struct wlr_gles2_texture {
 	//   GL_TEXTURE_EXTERNAL_OES == immutable
 	GLenum target;
 	GLuint tex;
+	// If packed in an atlas page, tex is the page's texture
+	struct wlr_gles2_atlas_slot *atlas_slot;
 
 	EGLImageKHR image;
 
+	// Two-plane YUV buffers (NV12, P010) are imported as one image per plane
+	// when possible, and converted to RGB in the shader: image and tex hold
+	// the luma plane, tex_uv the chroma plane. tex_uv is 0 otherwise.
+	struct {
+		GLuint tex_uv;
+		EGLImageKHR image_uv;
+		float matrix[9];
+		float offset[3];
+	} yuv;
+
 	bool inverted_y;
 	bool has_alpha;
+	bool has_mipmaps; // mipmap levels are up to date with the contents
+
+	// Mipmapped copy of the contents, starting at half their size, used
+	// instead of the texture's own mipmap levels if enabled in the renderer.
+	// Imported buffers can be minified this way too.
+	struct {
+		GLuint tex; // 0 until the texture is first drawn minified
+		int width, height, levels;
+		pixman_region32_t damage; // in texture coordinates, not copied yet
+	} mipmaps;
 
 	// Only affects target == GL_TEXTURE_2D
 	uint32_t drm_format; // used to interpret upload data
 	// If imported from a wlr_buffer
 	struct wlr_buffer *buffer;
 
-	struct wl_listener buffer_destroy;
+	struct wlr_addon buffer_addon;
 };
 
 const struct wlr_gles2_pixel_format *get_gles2_format_from_drm(uint32_t fmt);
 const struct wlr_gles2_pixel_format *get_gles2_format_from_gl(
 	GLint gl_format, GLint gl_type, bool alpha);
-const uint32_t *get_gles2_shm_formats(size_t *len);
+/**
+ * Check whether the GL context has the extensions needed to upload and read
+ * pixels in this format.
+ */
+bool is_gles2_pixel_format_supported(const struct wlr_gles2_renderer *renderer,
+	const struct wlr_gles2_pixel_format *format);
+const uint32_t *get_gles2_shm_formats(const struct wlr_gles2_renderer *renderer,
+	size_t *len);
 
 struct wlr_gles2_renderer *gles2_get_renderer(
 	struct wlr_renderer *wlr_renderer);
@@ -124,6 +348,57 @@ struct wlr_texture *gles2_texture_from_wl_drm(struct wlr_renderer *wlr_renderer,
 struct wlr_texture *gles2_texture_from_buffer(struct wlr_renderer *wlr_renderer,
 	struct wlr_buffer *buffer);
 void gles2_texture_destroy(struct wlr_gles2_texture *texture);
+/**
+ * Wrap a GL_TEXTURE_2D texture filled elsewhere, taking ownership of it.
+ */
+struct wlr_texture *gles2_texture_from_tex(struct wlr_gles2_renderer *renderer,
+	uint32_t drm_format, uint32_t width, uint32_t height, GLuint tex);
+/**
+ * Get the area of the texture's GL texture holding its contents, in texels,
+ * and the size of the GL texture.
+ */
+void gles2_texture_get_region(struct wlr_gles2_texture *texture,
+	struct wlr_box *region, int *tex_width, int *tex_height);
+
+/**
+ * Allocate an area of an atlas page for a texture. Needs a current EGL
+ * context. Returns NULL if the texture is too big for the atlas.
+ */
+struct wlr_gles2_atlas_slot *gles2_atlas_alloc(
+	struct wlr_gles2_renderer *renderer, uint32_t drm_format,
+	int width, int height);
+void gles2_atlas_free(struct wlr_gles2_atlas_slot *slot);
+/**
+ * Get the position of the texture in the slot, i.e. without the border.
+ */
+void gles2_atlas_slot_get_origin(struct wlr_gles2_atlas_slot *slot,
+	int *x, int *y);
+void gles2_atlas_finish(struct wlr_gles2_renderer *renderer);
+
+/**
+ * Draw the pending batch of textured quads. Needs to be called before any
+ * GL state the batch depends on is changed.
+ */
+void gles2_flush_quads(struct wlr_gles2_renderer *renderer);
+
+void gles2_upload_worker_init(struct wlr_gles2_renderer *renderer);
+/**
+ * Stop the upload worker. All uploads need to be destroyed first.
+ */
+void gles2_upload_worker_finish(struct wlr_gles2_renderer *renderer);
+struct wlr_texture_upload *gles2_upload_buffer_async(
+	struct wlr_renderer *wlr_renderer, struct wlr_buffer *buffer);
+
+void gles2_program_cache_init(struct wlr_gles2_renderer *renderer);
+void gles2_program_cache_finish(struct wlr_gles2_renderer *renderer);
+/**
+ * Load a program linked from the concatenation of the given sources, returns 0
+ * on cache miss.
+ */
+GLuint gles2_program_cache_load(struct wlr_gles2_renderer *renderer,
+	const GLchar *const *srcs, size_t srcs_len);
+void gles2_program_cache_store(struct wlr_gles2_renderer *renderer,
+	const GLchar *const *srcs, size_t srcs_len, GLuint prog);
 
 void push_gles2_debug_(struct wlr_gles2_renderer *renderer,
 	const char *file, const char *func);
@@ -23,4 +23,21 @@ const struct wlr_pixel_format_info *drm_get_pixel_format_info(uint32_t fmt);
 uint32_t convert_wl_shm_format_to_drm(enum wl_shm_format fmt);
 enum wl_shm_format convert_drm_format_to_wl_shm(uint32_t fmt);
 
+/**
+ * Check whether pixel_format_convert can convert from `src_fmt` to `dst_fmt`.
+ *
+ * The 32-bit RGB formats with 8 or 10 bits per channel are supported.
+ */
+bool pixel_format_can_convert(uint32_t dst_fmt, uint32_t src_fmt);
+
+/**
+ * Convert pixels from one format to another. Strides are in bytes. If
+ * `y_invert` is set, the first row of `src` ends up as the last row of `dst`.
+ *
+ * Channels missing from the source format are set to their maximum value.
+ */
+bool pixel_format_convert(uint32_t dst_fmt, void *dst, uint32_t dst_stride,
+	uint32_t src_fmt, const void *src, uint32_t src_stride,
+	uint32_t width, uint32_t height, bool y_invert);
+
 #endif
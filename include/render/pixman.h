@@ -1,9 +1,11 @@
 #ifndef RENDER_PIXMAN_H
 #define RENDER_PIXMAN_H
 
+#include <pthread.h>
 #include <wlr/render/pixman.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/render/drm_format_set.h>
+#include <wlr/util/addon.h>
 #include "render/pixel_format.h"
 
 struct wlr_pixman_pixel_format {
@@ -13,6 +15,30 @@ struct wlr_pixman_pixel_format {
 
 struct wlr_pixman_buffer;
 
+/**
+ * A composite operation, split into horizontal bands distributed over the
+ * tile pool's worker threads.
+ */
+struct wlr_pixman_composite {
+	pixman_op_t op;
+	pixman_image_t *src, *mask, *dst;
+	pixman_box32_t box; // destination area
+	int32_t src_dx, src_dy; // offset of the source relative to the destination
+
+	int tiles_len;
+};
+
+struct wlr_pixman_tile_pool {
+	pthread_t *threads;
+	size_t threads_len;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond, done_cond;
+	struct wlr_pixman_composite *job; // NULL if idle
+	int next_tile, tiles_done;
+	bool stop;
+};
+
 struct wlr_pixman_renderer {
 	struct wlr_renderer wlr_renderer;
 
@@ -21,8 +47,17 @@ struct wlr_pixman_renderer {
 
 	struct wlr_pixman_buffer *current_buffer;
 	int32_t width, height;
+	struct wlr_box scissor; // in buffer-local coordinates
+	bool has_scissor;
+	pixman_box32_t clip_extents; // of the clip region set on the buffer
+	bool has_clip;
+	int32_t dirty_y1, dirty_y2; // rows drawn to since begin
+
+	struct wlr_pixman_tile_pool tile_pool;
 
 	struct wlr_drm_format_set drm_formats;
+
+	bool copy_buffers;
 };
 
 struct wlr_pixman_buffer {
@@ -31,7 +66,7 @@ struct wlr_pixman_buffer {
 
 	pixman_image_t *image;
 
-	struct wl_listener buffer_destroy;
+	struct wlr_addon addon; // wlr_buffer.addons
 	struct wl_list link; // wlr_pixman_renderer.buffers
 };
 
@@ -44,12 +79,23 @@ struct wlr_pixman_texture {
 	pixman_format_code_t format;
 	const struct wlr_pixel_format_info *format_info;
 
-	void *data; // if created via texture_from_pixels
+	void *data; // if the buffer contents have been copied
 	struct wlr_buffer *buffer; // if created via texture_from_buffer
+
+	struct wlr_addon buffer_addon;
 };
 
 pixman_format_code_t get_pixman_format_from_drm(uint32_t fmt);
 uint32_t get_drm_format_from_pixman(pixman_format_code_t fmt);
 const uint32_t *get_pixman_drm_formats(size_t *len);
 
+void pixman_tile_pool_init(struct wlr_pixman_tile_pool *pool);
+void pixman_tile_pool_finish(struct wlr_pixman_tile_pool *pool);
+/**
+ * Composite the job's area, using worker threads if the area is big enough.
+ * Blocks until the whole area has been composited.
+ */
+void pixman_tile_pool_composite(struct wlr_pixman_tile_pool *pool,
+	struct wlr_pixman_composite *job);
+
 #endif
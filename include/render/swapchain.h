@@ -21,7 +21,10 @@ struct wlr_swapchain {
 	int width, height;
 	struct wlr_drm_format *format;
 
+	// Only the first num_slots slots are used, the others are freed as soon
+	// as their buffer is released
 	struct wlr_swapchain_slot slots[WLR_SWAPCHAIN_CAP];
+	size_t num_slots;
 
 	struct wl_listener allocator_destroy;
 };
@@ -30,9 +33,23 @@ struct wlr_swapchain *wlr_swapchain_create(
 	struct wlr_allocator *alloc, int width, int height,
 	const struct wlr_drm_format *format);
 void wlr_swapchain_destroy(struct wlr_swapchain *swapchain);
+/**
+ * Set the maximum number of buffers in the swap chain, between 1 and
+ * WLR_SWAPCHAIN_CAP. Defaults to WLR_SWAPCHAIN_CAP.
+ *
+ * Two buffers are enough for double buffering. A third one allows rendering
+ * the next frame while one is queued for display and one is on screen.
+ * Buffers beyond the new limit are destroyed once released.
+ */
+bool wlr_swapchain_set_num_slots(struct wlr_swapchain *swapchain,
+	size_t num_slots);
 /**
  * Acquire a buffer from the swap chain.
  *
+ * Among the buffers available, the one with the smallest age is picked to
+ * keep the area to repaint small. A new buffer is only allocated if none is
+ * available.
+ *
  * The returned buffer is locked. When the caller is done with it, they must
  * unlock it by calling wlr_buffer_unlock.
  */
@@ -42,7 +59,9 @@ struct wlr_buffer *wlr_swapchain_acquire(struct wlr_swapchain *swapchain,
  * Mark the buffer as submitted for presentation. This needs to be called by
  * swap chain users on frame boundaries.
  *
- * If the buffer hasn't been created via the swap chain, the call is ignored.
+ * If the buffer hasn't been created via the swap chain (e.g. when a client
+ * buffer is directly scanned out), the age of all swap chain buffers is
+ * increased.
  */
 void wlr_swapchain_set_buffer_submitted(struct wlr_swapchain *swapchain,
 	struct wlr_buffer *buffer);
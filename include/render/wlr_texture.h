@@ -6,10 +6,29 @@
 /**
  * Create a new texture from a buffer.
  *
+ * Renderers may keep the import around for as long as the buffer lives (the
+ * GLES2 renderer does so for DMA-BUFs, as an addon owned by the renderer), so
+ * calling this repeatedly for the same buffer is cheap. In particular, on
+ * multi-GPU setups each GPU imports a given buffer once, no matter how many
+ * of its outputs use it.
+ *
  * Should not be called in a rendering block like renderer_begin()/end() or
  * between attaching a renderer to an output and committing it.
  */
 struct wlr_texture *wlr_texture_from_buffer(struct wlr_renderer *renderer,
 	struct wlr_buffer *buffer);
 
+/**
+ * Textures of single-color buffers don't hold any renderer resources, they are
+ * drawn as plain rectangles.
+ */
+struct wlr_solid_texture {
+	struct wlr_texture base;
+	float color[4]; // premultiplied RGBA
+};
+
+bool wlr_texture_is_solid(struct wlr_texture *texture);
+struct wlr_solid_texture *solid_texture_from_texture(
+	struct wlr_texture *texture);
+
 #endif
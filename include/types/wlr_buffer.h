@@ -22,9 +22,24 @@ struct wlr_shm_client_buffer {
 	struct wl_listener release;
 };
 
-struct wlr_shm_client_buffer *shm_client_buffer_create(
+/**
+ * Get the buffer wrapping a wl_shm buffer, creating it on first use. The
+ * buffer lives as long as the wl_buffer, so that renderers can keep state
+ * such as textures attached to it across commits. It is dropped when the
+ * wl_buffer is destroyed.
+ */
+struct wlr_shm_client_buffer *shm_client_buffer_get_or_create(
 	struct wl_resource *resource);
 
+/**
+ * Creates a client buffer for a wl_shm buffer whose contents have already been
+ * uploaded to the texture, and releases the wl_buffer. Takes ownership of the
+ * texture.
+ */
+struct wlr_client_buffer *client_buffer_create_from_shm_texture(
+	struct wlr_renderer *renderer, struct wl_resource *resource,
+	struct wlr_texture *texture);
+
 /**
  * A read-only buffer that holds a data pointer.
  *
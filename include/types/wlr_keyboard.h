@@ -6,3 +6,10 @@ void keyboard_key_update(struct wlr_keyboard *keyboard,
 bool keyboard_modifier_update(struct wlr_keyboard *keyboard);
 
 void keyboard_led_update(struct wlr_keyboard *keyboard);
+
+/**
+ * Find a keymap already in use whose serialized form is the given string, to
+ * avoid compiling it again. The returned keymap isn't referenced.
+ */
+struct xkb_keymap *keyboard_keymap_cache_find_string(const char *string,
+	size_t size);
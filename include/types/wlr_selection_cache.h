@@ -0,0 +1,39 @@
+#ifndef TYPES_WLR_SELECTION_CACHE_H
+#define TYPES_WLR_SELECTION_CACHE_H
+
+#include <stdbool.h>
+#include <wayland-server-core.h>
+
+/**
+ * Sends the contents of a selection source for a MIME type into a file
+ * descriptor, taking ownership of it.
+ */
+typedef void (*selection_cache_send_func_t)(void *source,
+	const char *mime_type, int fd);
+
+/**
+ * Caches the contents of a selection, so that repeated receive requests for
+ * the same MIME type only ask the source client once. Each MIME type is read
+ * lazily, on the first request.
+ */
+struct selection_cache {
+	struct wl_event_loop *event_loop;
+	void *source; // the source the entries belong to
+	struct wl_list entries; // selection_cache_entry.link
+};
+
+void selection_cache_init(struct selection_cache *cache,
+	struct wl_event_loop *loop);
+void selection_cache_finish(struct selection_cache *cache);
+/**
+ * Drop the cached contents, e.g. because the selection changed.
+ */
+void selection_cache_reset(struct selection_cache *cache);
+/**
+ * Write the selection contents for the MIME type into the file descriptor,
+ * asynchronously. Takes ownership of the file descriptor.
+ */
+void selection_cache_receive(struct selection_cache *cache, void *source,
+	selection_cache_send_func_t send, const char *mime_type, int fd);
+
+#endif
@@ -62,6 +62,15 @@ struct wlr_tablet_pad_client_v2 {
 	struct wl_resource **strips;
 };
 
+enum tablet_tool_axis_v2 {
+	TABLET_TOOL_AXIS_V2_POSITION = 1 << 0,
+	TABLET_TOOL_AXIS_V2_PRESSURE = 1 << 1,
+	TABLET_TOOL_AXIS_V2_DISTANCE = 1 << 2,
+	TABLET_TOOL_AXIS_V2_TILT = 1 << 3,
+	TABLET_TOOL_AXIS_V2_ROTATION = 1 << 4,
+	TABLET_TOOL_AXIS_V2_SLIDER = 1 << 5,
+};
+
 struct wlr_tablet_tool_client_v2 {
 	struct wl_list seat_link;
 	struct wl_list tool_link;
@@ -71,6 +80,15 @@ struct wlr_tablet_tool_client_v2 {
 	struct wlr_tablet_seat_client_v2 *seat;
 
 	struct wl_event_source *frame_source;
+
+	// Last axis values sent since proximity in, to drop redundant updates
+	struct {
+		uint32_t sent; // enum tablet_tool_axis_v2 bitmask
+		double x, y;
+		double pressure, distance;
+		double tilt_x, tilt_y;
+		double rotation, slider;
+	} axes;
 };
 
 struct wlr_tablet_client_v2 *tablet_client_from_resource(struct wl_resource *resource);
@@ -0,0 +1,42 @@
+#ifndef UTIL_CACHE_H
+#define UTIL_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/**
+ * Helpers for the on-disk caches stored under $XDG_CACHE_HOME/wlroots.
+ */
+
+#define CACHE_HASH_INIT UINT64_C(0xcbf29ce484222325)
+
+/**
+ * Hash a string into a cache key, including its terminating NUL as a
+ * separator. Start with CACHE_HASH_INIT.
+ */
+uint64_t cache_hash_string(uint64_t hash, const char *str);
+/**
+ * Hash arbitrary data into a cache key. Start with CACHE_HASH_INIT.
+ */
+uint64_t cache_hash_data(uint64_t hash, const void *data, size_t len);
+
+/**
+ * Get the default directory of the cache with the given name. Returns NULL
+ * if the cache home can't be determined. The string must be freed.
+ */
+char *cache_get_dir(const char *name);
+
+/**
+ * Atomically replace the contents of a cache file, creating its parent
+ * directories if needed. Concurrent readers never see a partial file.
+ */
+bool cache_write_file(const char *path, const void *data, size_t size);
+/**
+ * Same as cache_write_file, with the contents split in multiple parts.
+ */
+bool cache_write_filev(const char *path, const struct iovec *iov,
+	size_t iov_len);
+
+#endif
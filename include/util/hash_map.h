@@ -0,0 +1,42 @@
+#ifndef UTIL_HASH_MAP_H
+#define UTIL_HASH_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A hash map from keys to values, using open addressing.
+ *
+ * Keys are compared with the equality function passed at creation, or by
+ * pointer if there is none. Keys are not copied: they must stay valid while
+ * stored, e.g. by being part of the value. NULL keys and values can't be
+ * stored.
+ */
+struct wlr_hash_map;
+
+struct wlr_hash_map *hash_map_create(
+	bool (*key_equal)(const void *a, const void *b));
+void hash_map_destroy(struct wlr_hash_map *map);
+/**
+ * Get the value stored for a key, or NULL if there is none.
+ */
+void *hash_map_get(struct wlr_hash_map *map, uint64_t hash, const void *key);
+/**
+ * Store a value for a key, replacing any existing value. Returns false on
+ * allocation failure.
+ */
+bool hash_map_set(struct wlr_hash_map *map, uint64_t hash, const void *key,
+	void *value);
+/**
+ * Remove the value stored for a key. Returns the removed value, or NULL if
+ * there was none.
+ */
+void *hash_map_remove(struct wlr_hash_map *map, uint64_t hash,
+	const void *key);
+
+uint64_t hash_pointer(const void *ptr);
+uint64_t hash_string(const char *str);
+bool hash_map_string_equal(const void *a, const void *b);
+
+#endif
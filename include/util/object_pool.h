@@ -0,0 +1,44 @@
+#ifndef UTIL_OBJECT_POOL_H
+#define UTIL_OBJECT_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+/**
+ * Free-list allocator for small objects of a single type which are created
+ * and destroyed at a high rate, e.g. once per surface commit. Freed objects
+ * are kept for re-use up to a limit, instead of going back to malloc.
+ *
+ * Pools are meant to be static, one per object type. The free-lists and
+ * counters are kept per wl_display and released when the display is
+ * destroyed. Pools are only used from the thread dispatching the display.
+ */
+struct object_pool {
+	const char *name;
+	size_t size;
+	size_t max_cached;
+
+	// private state
+
+	size_t index; // 1-based slot in the per-display state, 0 if unused
+};
+
+#define OBJECT_POOL_INIT(pool_name, type, max) { \
+		.name = (pool_name), \
+		.size = sizeof(type), \
+		.max_cached = (max), \
+	}
+
+/**
+ * Allocate a zero-initialized object on behalf of the display. Returns NULL
+ * on error.
+ */
+void *object_pool_alloc(struct object_pool *pool, struct wl_display *display);
+/**
+ * Free an object. Objects may outlive their display, in which case they go
+ * straight back to malloc.
+ */
+void object_pool_free(struct object_pool *pool, void *obj);
+
+#endif
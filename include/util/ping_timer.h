@@ -0,0 +1,40 @@
+#ifndef UTIL_PING_TIMER_H
+#define UTIL_PING_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+/**
+ * Ping timeouts of all the clients of a display, xdg-shell and Xwayland ones
+ * alike, share a single timer.
+ *
+ * Deadlines are rounded up to slots of PING_TIMER_SLOT_MS so that pings sent
+ * around the same time expire in a single batch. The timer is only re-armed
+ * when a ping expires earlier than it's set to fire: replies don't touch it,
+ * a timer firing with nothing to expire is just re-armed for the next slot.
+ */
+#define PING_TIMER_SLOT_MS 100
+
+struct ping_timer_entry;
+
+typedef void (*ping_timer_func_t)(struct ping_timer_entry *entry, void *data);
+
+/**
+ * Create an entry on the shared timer of the display. The timer is created
+ * with the first entry and destroyed with the last one.
+ */
+struct ping_timer_entry *ping_timer_entry_create(struct wl_display *display,
+	ping_timer_func_t func, void *data);
+void ping_timer_entry_destroy(struct ping_timer_entry *entry);
+
+/**
+ * Call the entry's function in timeout_ms milliseconds, unless it's stopped
+ * before. Re-arms a pending entry.
+ */
+void ping_timer_entry_start(struct ping_timer_entry *entry,
+	uint32_t timeout_ms);
+void ping_timer_entry_stop(struct ping_timer_entry *entry);
+bool ping_timer_entry_pending(const struct ping_timer_entry *entry);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef UTIL_PRIORITY_LOOP_H
+#define UTIL_PRIORITY_LOOP_H
+
+#include <wayland-server-core.h>
+
+/**
+ * Get the event loop for the latency-sensitive sources of the display: DRM
+ * page-flip events, libinput and the session. It's nested in the display's
+ * event loop, and drained before the other sources by wlr_display_dispatch.
+ *
+ * The loop is created on first use and destroyed along with the display's
+ * event loop, after all backends. Returns NULL on error.
+ */
+struct wl_event_loop *get_priority_event_loop(struct wl_display *display);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef UTIL_REALTIME_H
+#define UTIL_REALTIME_H
+
+#include <pthread.h>
+
+/**
+ * Start a background worker thread. Unlike pthread_create, the thread
+ * doesn't inherit the real-time policy and CPU affinity which
+ * wlr_realtime_set_thread may have given to the calling thread: workers run
+ * with SCHED_OTHER on the CPUs the process was originally allowed to use.
+ *
+ * Returns zero on success, an error number otherwise.
+ */
+int worker_thread_create(pthread_t *thread, void *(*start)(void *),
+	void *data);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef UTIL_STARTUP_H
+#define UTIL_STARTUP_H
+
+#include <stdint.h>
+
+/**
+ * Startup profiling. Each phase of the compositor initialization (backend,
+ * session, EGL, renderer...) is logged at debug level with its duration and
+ * the time elapsed since the first phase began, and emitted as a trace slice
+ * when WLR_TRACE is enabled.
+ */
+
+/**
+ * Begin a phase. The returned timestamp must be passed to
+ * startup_phase_end. Phases must be properly nested.
+ */
+int64_t startup_phase_begin(const char *name);
+void startup_phase_end(const char *name, int64_t start_nsec);
+
+/**
+ * Mark the first output commit with a buffer, which ends the startup. Only
+ * the first call is logged.
+ */
+void startup_first_commit(const char *output_name);
+
+#endif
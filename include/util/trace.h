@@ -0,0 +1,40 @@
+#ifndef UTIL_TRACE_H
+#define UTIL_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wlr/util/log.h>
+
+/**
+ * Tracing markers, written to the kernel's ftrace trace_marker file in the
+ * systrace format understood by Perfetto. Tracing is enabled by setting
+ * WLR_TRACE=1; when disabled, each marker only costs a branch.
+ */
+
+/**
+ * Check whether tracing is enabled. This can be used to skip expensive work
+ * only needed to compute marker names.
+ */
+bool trace_enabled(void);
+
+/**
+ * Begin and end a slice. Slices must be properly nested.
+ */
+void trace_begin(const char *fmt, ...) _WLR_ATTRIB_PRINTF(1, 2);
+void trace_end(void);
+
+/**
+ * Begin and end an asynchronous slice, which can span multiple event loop
+ * iterations. The slice is identified by its name and cookie.
+ */
+void trace_async_begin(uint32_t cookie, const char *fmt, ...)
+	_WLR_ATTRIB_PRINTF(2, 3);
+void trace_async_end(uint32_t cookie, const char *fmt, ...)
+	_WLR_ATTRIB_PRINTF(2, 3);
+
+/**
+ * Mark an instant event.
+ */
+void trace_instant(const char *fmt, ...) _WLR_ATTRIB_PRINTF(1, 2);
+
+#endif
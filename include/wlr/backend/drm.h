@@ -14,6 +14,8 @@
 #include <wlr/backend/session.h>
 #include <wlr/types/wlr_output.h>
 
+struct wlr_drm_format_set;
+
 /**
  * Creates a DRM backend using the specified GPU file descriptor (typically from
  * a device node in /dev/dri).
@@ -40,4 +42,57 @@ typedef struct _drmModeModeInfo drmModeModeInfo;
 struct wlr_output_mode *wlr_drm_connector_add_mode(struct wlr_output *output,
 	const drmModeModeInfo *mode);
 
+/**
+ * Fade gamma LUT changes of the connector over duration_ms instead of applying
+ * them right away, e.g. for night light tools animating the color
+ * temperature. Intermediate LUTs are applied along with the next frames, at
+ * most 60 times per second, and the output requests frames until the
+ * transition is done. The first change after transitions are enabled is
+ * applied right away. Zero disables transitions, which is the default.
+ *
+ * Only supported with atomic modesetting.
+ */
+void wlr_drm_connector_set_gamma_transition(struct wlr_output *output,
+	int duration_ms);
+
+/**
+ * Hint the frame rate of the content shown on the connector in mHz, e.g. the
+ * frame rate of a fullscreen video, so that frames don't need to be repeated
+ * unevenly. Zero clears the hint.
+ *
+ * Returns a mode with the current resolution whose refresh rate is the
+ * content rate or a multiple of it, and which only differs from the current
+ * mode in its vertical timings. This is the current mode if it already
+ * matches. With atomic modesetting, switching between such modes doesn't
+ * blank the screen if the driver accepts it without a full modeset.
+ * Compositors are responsible for switching back to their preferred mode
+ * once the hint is cleared.
+ *
+ * Returns NULL if there is no such mode. If the display's adaptive sync range
+ * includes the content rate or a multiple of it, frame events are then paced
+ * at that rate while adaptive sync is enabled.
+ */
+struct wlr_output_mode *wlr_drm_connector_set_content_rate(
+	struct wlr_output *output, int32_t rate);
+
+/**
+ * Get the DMA-BUF formats which can be scanned out directly on the
+ * connector's primary plane, e.g. to build a DMA-BUF feedback scanout tranche
+ * for a fullscreen surface.
+ *
+ * Returns NULL if the connector isn't driving a CRTC, or if buffers need to
+ * be copied to another GPU before being displayed.
+ */
+const struct wlr_drm_format_set *wlr_drm_connector_get_primary_formats(
+	struct wlr_output *output);
+
+/**
+ * Get the DMA-BUF formats which can be displayed on the connector's topmost
+ * overlay plane, i.e. the first plane output layers are assigned to.
+ *
+ * Returns NULL if the connector has no usable overlay plane.
+ */
+const struct wlr_drm_format_set *wlr_drm_connector_get_overlay_formats(
+	struct wlr_output *output);
+
 #endif
@@ -9,15 +9,76 @@
 #ifndef WLR_BACKEND_HEADLESS_H
 #define WLR_BACKEND_HEADLESS_H
 
+#include <time.h>
 #include <wlr/backend.h>
 #include <wlr/types/wlr_input_device.h>
 #include <wlr/types/wlr_output.h>
 
+struct wlr_headless_frame_sink;
+
+struct wlr_headless_frame_sink_event {
+	struct wlr_buffer *buffer;
+	// Region changed since the previous frame, in buffer-local coordinates
+	const pixman_region32_t *damage;
+	const struct timespec *when; // virtual vblank time
+	uint64_t seq; // virtual vblank counter
+	int refresh; // nsec
+};
+
+struct wlr_headless_frame_sink_impl {
+	/**
+	 * Called on the virtual vblank which presents a newly committed buffer.
+	 * Nothing is called while the compositor doesn't commit new frames. The
+	 * sink can lock the buffer to keep reading it after returning, e.g. to
+	 * feed an asynchronous encoder.
+	 */
+	void (*present)(struct wlr_headless_frame_sink *sink,
+		const struct wlr_headless_frame_sink_event *event);
+	void (*destroy)(struct wlr_headless_frame_sink *sink);
+};
+
+/**
+ * A frame sink consumes the frames presented on a headless output, for
+ * instance to stream them.
+ */
+struct wlr_headless_frame_sink {
+	const struct wlr_headless_frame_sink_impl *impl;
+	struct wlr_output *output; // NULL if not attached
+};
+
+enum wlr_headless_render_node_policy {
+	// The first render node found
+	WLR_HEADLESS_RENDER_NODE_FIRST,
+	// The render node opened by the fewest processes
+	WLR_HEADLESS_RENDER_NODE_LEAST_LOADED,
+	// The next render node in a rotation shared by the user's processes
+	WLR_HEADLESS_RENDER_NODE_ROUND_ROBIN,
+	// The least-loaded render node attached to a NUMA node the process is
+	// allowed to run on
+	WLR_HEADLESS_RENDER_NODE_NUMA_LOCAL,
+};
+
+struct wlr_headless_backend_options {
+	// Path of the DRM render node to use, or NULL to pick one with the policy
+	const char *render_node;
+	enum wlr_headless_render_node_policy render_node_policy;
+};
+
 /**
  * Creates a headless backend. A headless backend has no outputs or inputs by
  * default.
+ *
+ * The DRM render node used for rendering can be selected with the
+ * WLR_HEADLESS_RENDER_NODE environment variable.
  */
 struct wlr_backend *wlr_headless_backend_create(struct wl_display *display);
+/**
+ * Creates a headless backend rendering on the DRM render node selected by the
+ * options.
+ */
+struct wlr_backend *wlr_headless_backend_create_with_options(
+	struct wl_display *display,
+	const struct wlr_headless_backend_options *options);
 /**
  * Creates a headless backend with an existing renderer.
  */
@@ -37,6 +98,24 @@ struct wlr_output *wlr_headless_add_output(struct wlr_backend *backend,
  */
 struct wlr_input_device *wlr_headless_add_input_device(
 	struct wlr_backend *backend, enum wlr_input_device_type type);
+/**
+ * Initialize a frame sink. The caller provides the memory, usually by
+ * embedding the struct in its own.
+ */
+void wlr_headless_frame_sink_init(struct wlr_headless_frame_sink *sink,
+	const struct wlr_headless_frame_sink_impl *impl);
+/**
+ * Attach a frame sink to a headless output. The previous sink, if any, is
+ * destroyed. The sink is destroyed along with the output. Pass NULL to detach
+ * the current sink.
+ */
+void wlr_headless_output_set_frame_sink(struct wlr_output *output,
+	struct wlr_headless_frame_sink *sink);
+/**
+ * Get the path of the DRM render node used by the headless backend, or NULL
+ * if it doesn't use one.
+ */
+const char *wlr_headless_backend_get_render_node(struct wlr_backend *backend);
 bool wlr_backend_is_headless(struct wlr_backend *backend);
 bool wlr_input_device_is_headless(struct wlr_input_device *device);
 bool wlr_output_is_headless(struct wlr_output *output);
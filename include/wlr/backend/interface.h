@@ -10,9 +10,12 @@
 #define WLR_BACKEND_INTERFACE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <time.h>
 #include <wlr/backend.h>
 
+struct wlr_output;
+
 struct wlr_backend_impl {
 	bool (*start)(struct wlr_backend *backend);
 	void (*destroy)(struct wlr_backend *backend);
@@ -21,6 +24,10 @@ struct wlr_backend_impl {
 	clockid_t (*get_presentation_clock)(struct wlr_backend *backend);
 	int (*get_drm_fd)(struct wlr_backend *backend);
 	uint32_t (*get_buffer_caps)(struct wlr_backend *backend);
+	// Optional: commit or test the pending state of several outputs of this
+	// backend at once, all-or-nothing
+	bool (*commit_outputs)(struct wlr_backend *backend,
+		struct wlr_output *const *outputs, size_t outputs_len, bool test_only);
 };
 
 /**
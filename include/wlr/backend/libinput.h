@@ -17,6 +17,17 @@
 
 struct wlr_backend *wlr_libinput_backend_create(struct wl_display *display,
 		struct wlr_session *session);
+/**
+ * Process the input events queued by the kernel right away, instead of
+ * waiting for the event loop to get to the libinput file descriptor.
+ *
+ * When the event loop is busy, e.g. with many clients or slow rendering,
+ * input can pile up behind other work. Calling this right before rendering an
+ * output makes the frame use the latest pointer position. Must not be called
+ * in a rendering block, since input events may trigger rendering-related
+ * changes.
+ */
+void wlr_libinput_backend_dispatch(struct wlr_backend *backend);
 /** Gets the underlying libinput_device handle for the given wlr_input_device */
 struct libinput_device *wlr_libinput_get_device_handle(
 		struct wlr_input_device *dev);
@@ -3,11 +3,22 @@
 
 #include <libudev.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <wayland-server-core.h>
 
 struct libseat;
 
+/**
+ * Data of the wlr_device.events.change signal. Zero fields mean the kernel
+ * didn't say which connector or property changed, and the whole device needs
+ * to be rescanned.
+ */
+struct wlr_device_change_event {
+	uint32_t connector_id;
+	uint32_t prop_id;
+};
+
 struct wlr_device {
 	int fd;
 	int device_id;
@@ -15,9 +26,17 @@ struct wlr_device {
 	struct wl_list link;
 
 	struct {
-		struct wl_signal change;
+		struct wl_signal change; // struct wlr_device_change_event
 		struct wl_signal remove;
 	} events;
+
+	// private state
+
+	struct wlr_session *session;
+	struct wl_event_source *change_timer;
+	bool change_armed; // a change was emitted less than a window ago
+	bool change_pending;
+	struct wlr_device_change_event pending_change;
 };
 
 struct wlr_session {
@@ -43,6 +62,13 @@ struct wlr_session {
 
 	struct wl_list devices;
 
+	/*
+	 * Change events of a device arriving within this many milliseconds of
+	 * the previous one are merged into a single event, emitted at the end of
+	 * the window. 0 disables debouncing.
+	 */
+	int change_debounce_ms;
+
 	struct wl_display *display;
 	struct wl_listener display_destroy;
 
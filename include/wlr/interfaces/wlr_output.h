@@ -22,7 +22,9 @@
 	(WLR_OUTPUT_STATE_DAMAGE | \
 	WLR_OUTPUT_STATE_SCALE | \
 	WLR_OUTPUT_STATE_TRANSFORM | \
-	WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED)
+	WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED | \
+	WLR_OUTPUT_STATE_LAYERS | \
+	WLR_OUTPUT_STATE_TEARING_PAGE_FLIP)
 
 /**
  * A backend implementation of wlr_output.
@@ -112,6 +114,25 @@ struct wlr_output_impl {
 	 */
 	const struct wlr_drm_format_set *(*get_primary_formats)(
 		struct wlr_output *output, uint32_t buffer_caps);
+	/**
+	 * Get the buffer which has just been committed after rendering via
+	 * attach_render, if any.
+	 */
+	struct wlr_buffer *(*get_committed_buffer)(struct wlr_output *output);
+	/**
+	 * Request a frame event without a commit, e.g. aligned on the next
+	 * vertical blank. The backend must eventually call
+	 * wlr_output_send_frame(). If NULL, the frame event is emitted from an
+	 * idle callback.
+	 */
+	void (*schedule_frame)(struct wlr_output *output);
+	/**
+	 * Write the composed contents of the next buffer commit into the buffer,
+	 * see wlr_output_capture_next_commit(). The backend must eventually call
+	 * wlr_output_send_capture() if it returns true.
+	 */
+	bool (*capture_next_commit)(struct wlr_output *output,
+		struct wlr_buffer *buffer);
 };
 
 /**
@@ -164,5 +185,13 @@ void wlr_output_send_frame(struct wlr_output *output);
  */
 void wlr_output_send_present(struct wlr_output *output,
 	struct wlr_output_event_present *event);
+/**
+ * Send a capture event.
+ *
+ * See wlr_output.events.capture. If the event's time is NULL, the current
+ * time is used.
+ */
+void wlr_output_send_capture(struct wlr_output *output,
+	struct wlr_output_event_capture *event);
 
 #endif
@@ -27,4 +27,12 @@ bool wlr_drm_format_set_has(const struct wlr_drm_format_set *set,
 bool wlr_drm_format_set_add(struct wlr_drm_format_set *set, uint32_t format,
 	uint64_t modifier);
 
+/**
+ * Intersect two DRM format sets: dst gets the formats present in both sets,
+ * with the modifiers supported by both. dst must be empty. Returns false on
+ * allocation failure.
+ */
+bool wlr_drm_format_set_intersect(struct wlr_drm_format_set *dst,
+	const struct wlr_drm_format_set *a, const struct wlr_drm_format_set *b);
+
 #endif
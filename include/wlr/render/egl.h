@@ -41,6 +41,7 @@ struct wlr_egl {
 		bool image_base_khr;
 		bool image_dmabuf_import_ext;
 		bool image_dmabuf_import_modifiers_ext;
+		bool fence_sync_khr;
 
 		// Device extensions
 		bool device_drm_ext;
@@ -58,6 +59,9 @@ struct wlr_egl {
 		PFNEGLDEBUGMESSAGECONTROLKHRPROC eglDebugMessageControlKHR;
 		PFNEGLQUERYDISPLAYATTRIBEXTPROC eglQueryDisplayAttribEXT;
 		PFNEGLQUERYDEVICESTRINGEXTPROC eglQueryDeviceStringEXT;
+		PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR;
+		PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR;
+		PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR;
 	} procs;
 
 	struct wl_display *wl_display;
@@ -32,6 +32,11 @@ struct wlr_gles2_texture_attribs {
 
 	bool inverted_y;
 	bool has_alpha;
+
+	/* Small textures may be packed into a texture shared with others: region
+	 * is the area of tex holding this texture, in texels */
+	struct wlr_box region;
+	int tex_width, tex_height;
 };
 
 bool wlr_renderer_is_gles2(struct wlr_renderer *wlr_renderer);
@@ -30,6 +30,14 @@ struct wlr_renderer_impl {
 		const float matrix[static 9], float alpha);
 	void (*render_quad_with_matrix)(struct wlr_renderer *renderer,
 		const float color[static 4], const float matrix[static 9]);
+	// The clip region is never empty
+	bool (*render_subtexture_with_matrix_clipped)(
+		struct wlr_renderer *renderer, struct wlr_texture *texture,
+		const struct wlr_fbox *box, const float matrix[static 9], float alpha,
+		const pixman_region32_t *clip);
+	void (*render_quad_with_matrix_clipped)(struct wlr_renderer *renderer,
+		const float color[static 4], const float matrix[static 9],
+		const pixman_region32_t *clip);
 	const uint32_t *(*get_shm_texture_formats)(struct wlr_renderer *renderer,
 		size_t *len);
 	bool (*resource_is_wl_drm_buffer)(struct wlr_renderer *renderer,
@@ -54,6 +62,16 @@ struct wlr_renderer_impl {
 	uint32_t (*get_render_buffer_caps)(struct wlr_renderer *renderer);
 	struct wlr_texture *(*texture_from_buffer)(struct wlr_renderer *renderer,
 		struct wlr_buffer *buffer);
+	bool (*get_render_stats)(struct wlr_renderer *renderer,
+		uint32_t render_seq, struct wlr_render_stats *stats);
+	struct wlr_read_pixels_request *(*read_pixels_async)(
+		struct wlr_renderer *renderer, uint32_t fmt, uint32_t width,
+		uint32_t height, uint32_t src_x, uint32_t src_y);
+	// Called with a NULL matrix and a zero ramp size to reset the transform
+	bool (*set_color_transform)(struct wlr_renderer *renderer,
+		const float *matrix, size_t ramp_size, const uint16_t *ramps);
+	struct wlr_texture_upload *(*upload_buffer_async)(
+		struct wlr_renderer *renderer, struct wlr_buffer *buffer);
 };
 
 void wlr_renderer_init(struct wlr_renderer *renderer,
@@ -65,10 +83,42 @@ struct wlr_texture_impl {
 		uint32_t stride, uint32_t width, uint32_t height,
 		uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
 		const void *data);
+	bool (*write_pixels_region)(struct wlr_texture *texture,
+		uint32_t stride, pixman_region32_t *region, const void *data);
 	void (*destroy)(struct wlr_texture *texture);
 };
 
 void wlr_texture_init(struct wlr_texture *texture,
 	const struct wlr_texture_impl *impl, uint32_t width, uint32_t height);
 
+struct wlr_read_pixels_request_impl {
+	bool (*is_ready)(struct wlr_read_pixels_request *request);
+	bool (*finish)(struct wlr_read_pixels_request *request, uint32_t *flags,
+		uint32_t stride, uint32_t dst_x, uint32_t dst_y, void *data);
+	void (*destroy)(struct wlr_read_pixels_request *request);
+};
+
+struct wlr_read_pixels_request {
+	const struct wlr_read_pixels_request_impl *impl;
+	uint32_t format;
+	uint32_t width, height;
+};
+
+void wlr_read_pixels_request_init(struct wlr_read_pixels_request *request,
+	const struct wlr_read_pixels_request_impl *impl, uint32_t format,
+	uint32_t width, uint32_t height);
+
+struct wlr_texture_upload_impl {
+	struct wlr_texture *(*finish)(struct wlr_texture_upload *upload);
+	void (*destroy)(struct wlr_texture_upload *upload);
+};
+
+struct wlr_texture_upload {
+	const struct wlr_texture_upload_impl *impl;
+	int fd;
+};
+
+void wlr_texture_upload_init(struct wlr_texture_upload *upload,
+	const struct wlr_texture_upload_impl *impl, int fd);
+
 #endif
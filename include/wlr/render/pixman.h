@@ -14,6 +14,20 @@
 #include <wlr/render/wlr_renderer.h>
 
 struct wlr_renderer *wlr_pixman_renderer_create(void);
+/**
+ * Choose whether textures copy the contents of the buffers they're created
+ * from. Disabled by default.
+ *
+ * By default, textures reference the buffer's memory, which keeps the buffer
+ * locked for as long as the texture is alive: for client buffers, the
+ * wl_buffer is only released after the next commit, and clients need to
+ * allocate more buffers. When enabled, the contents are copied instead and
+ * client buffers are released right away, trading compositor memory for client
+ * memory. Such textures also support wlr_texture_write_pixels, so that
+ * wlr_client_buffer_apply_damage only copies damaged regions.
+ */
+void wlr_pixman_renderer_set_copy_buffers(struct wlr_renderer *wlr_renderer,
+	bool copy);
 /**
  * Returns the image of current buffer.
  */
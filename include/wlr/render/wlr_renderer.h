@@ -9,6 +9,7 @@
 #ifndef WLR_RENDER_WLR_RENDERER_H
 #define WLR_RENDER_WLR_RENDERER_H
 
+#include <pixman.h>
 #include <stdint.h>
 #include <wayland-server-core.h>
 #include <wlr/backend.h>
@@ -29,17 +30,55 @@ struct wlr_renderer {
 	bool rendering;
 	bool rendering_with_buffer;
 
+	// Render pass sequence number. Incremented on each wlr_renderer_end call,
+	// may overflow.
+	uint32_t render_seq;
+
+	bool color_transform; // private, see wlr_renderer_set_color_transform
+
 	struct {
 		struct wl_signal destroy;
 	} events;
 };
 
+/**
+ * Timing statistics of a render pass. Times are in nanoseconds.
+ */
+struct wlr_render_stats {
+	// Time between wlr_renderer_begin and wlr_renderer_end
+	int64_t cpu_time;
+	// Time the GPU spent on the render pass, -1 if unknown
+	int64_t gpu_time;
+	// Number of texture draws with a GPU time measurement
+	size_t texture_draws;
+	// Total and worst GPU time spent drawing textures, -1 if unknown
+	int64_t texture_gpu_time, texture_gpu_time_max;
+};
+
 struct wlr_renderer *wlr_renderer_autocreate(struct wlr_backend *backend);
 
 void wlr_renderer_begin(struct wlr_renderer *r, uint32_t width, uint32_t height);
 bool wlr_renderer_begin_with_buffer(struct wlr_renderer *r,
 	struct wlr_buffer *buffer);
 void wlr_renderer_end(struct wlr_renderer *r);
+/**
+ * Set a color transform applied to everything drawn during the next render
+ * pass, similar to what display hardware does: colors are multiplied by the
+ * row-major 3x3 `matrix`, then each channel is mapped through its gamma ramp.
+ * `ramps` contains the red, green and blue ramps, each of `ramp_size`
+ * elements, in the same format as `wlr_output_set_gamma`.
+ *
+ * `matrix` may be NULL for the identity, and `ramp_size` zero for linear
+ * ramps. The transform is reset at the end of the render pass.
+ *
+ * The transform is applied to each drawing operation before blending, so the
+ * result is only exact for opaque content.
+ *
+ * Must be called outside of a render pass. Returns false if the renderer
+ * doesn't support color transforms.
+ */
+bool wlr_renderer_set_color_transform(struct wlr_renderer *r,
+	const float *matrix, size_t ramp_size, const uint16_t *ramps);
 void wlr_renderer_clear(struct wlr_renderer *r, const float color[static 4]);
 /**
  * Defines a scissor box. Only pixels that lie within the scissor box can be
@@ -74,6 +113,27 @@ void wlr_render_rect(struct wlr_renderer *r, const struct wlr_box *box,
  */
 void wlr_render_quad_with_matrix(struct wlr_renderer *r,
 	const float color[static 4], const float matrix[static 9]);
+/**
+ * Variants of the functions above which only modify the pixels inside the
+ * clip region, in buffer coordinates like the scissor box. This replaces
+ * looping over the rectangles of a damage region with a scissor box set for
+ * each: renderers draw the whole region at once.
+ *
+ * The scissor box must be unset. Renderers without native support fall back
+ * to one draw per rectangle with a scissor box.
+ */
+bool wlr_render_texture_with_matrix_clipped(struct wlr_renderer *r,
+	struct wlr_texture *texture, const float matrix[static 9], float alpha,
+	const pixman_region32_t *clip);
+bool wlr_render_subtexture_with_matrix_clipped(struct wlr_renderer *r,
+	struct wlr_texture *texture, const struct wlr_fbox *box,
+	const float matrix[static 9], float alpha, const pixman_region32_t *clip);
+void wlr_render_rect_clipped(struct wlr_renderer *r, const struct wlr_box *box,
+	const float color[static 4], const float projection[static 9],
+	const pixman_region32_t *clip);
+void wlr_render_quad_with_matrix_clipped(struct wlr_renderer *r,
+	const float color[static 4], const float matrix[static 9],
+	const pixman_region32_t *clip);
 /**
  * Get the shared-memory formats supporting import usage. Buffers allocated
  * with a format from this list may be imported via wlr_texture_from_pixels.
@@ -107,6 +167,68 @@ bool wlr_renderer_read_pixels(struct wlr_renderer *r, uint32_t fmt,
 	uint32_t *flags, uint32_t stride, uint32_t width, uint32_t height,
 	uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y, void *data);
 
+struct wlr_read_pixels_request;
+
+/**
+ * Start reading out pixels of the currently bound surface without waiting for
+ * the GPU. The pixels can be retrieved with wlr_read_pixels_request_finish
+ * once wlr_read_pixels_request_is_ready returns true.
+ *
+ * Returns NULL if the renderer doesn't support asynchronous read-back or on
+ * error, in which case the caller can fall back to wlr_renderer_read_pixels.
+ * The request must be destroyed before the renderer.
+ */
+struct wlr_read_pixels_request *wlr_renderer_read_pixels_async(
+	struct wlr_renderer *r, uint32_t fmt, uint32_t width, uint32_t height,
+	uint32_t src_x, uint32_t src_y);
+/**
+ * Check whether the GPU is done transferring the pixels.
+ */
+bool wlr_read_pixels_request_is_ready(struct wlr_read_pixels_request *request);
+/**
+ * Copy the pixels into data, blocking if the transfer isn't complete yet.
+ * `stride` is in bytes. `flags` has the same meaning as for
+ * wlr_renderer_read_pixels.
+ */
+bool wlr_read_pixels_request_finish(struct wlr_read_pixels_request *request,
+	uint32_t *flags, uint32_t stride, uint32_t dst_x, uint32_t dst_y,
+	void *data);
+void wlr_read_pixels_request_destroy(struct wlr_read_pixels_request *request);
+
+struct wlr_texture_upload;
+
+/**
+ * Start uploading the contents of a buffer to a new texture without blocking
+ * the calling thread. The buffer is locked and its data pointer accessed until
+ * the upload is finished or destroyed, so its contents must not change in the
+ * meantime.
+ *
+ * The upload is done once the file descriptor returned by
+ * wlr_texture_upload_get_fd becomes readable.
+ *
+ * Returns NULL if the renderer doesn't support asynchronous uploads for this
+ * buffer or on error, in which case the caller can fall back to
+ * wlr_texture_from_buffer. The upload must be destroyed before the renderer.
+ */
+struct wlr_texture_upload *wlr_renderer_upload_buffer_async(
+	struct wlr_renderer *r, struct wlr_buffer *buffer);
+/**
+ * Get a file descriptor which becomes readable once the upload is done. It is
+ * owned by the upload.
+ */
+int wlr_texture_upload_get_fd(struct wlr_texture_upload *upload);
+/**
+ * Get the uploaded texture, blocking if the upload isn't done yet, and destroy
+ * the upload. The caller takes ownership of the texture. Returns NULL if the
+ * upload failed.
+ */
+struct wlr_texture *wlr_texture_upload_finish(
+	struct wlr_texture_upload *upload);
+/**
+ * Cancel the upload, waiting for it if it has already started.
+ */
+void wlr_texture_upload_destroy(struct wlr_texture_upload *upload);
+
 /**
  * Creates necessary shm and invokes the initialization of the implementation.
  *
@@ -122,6 +244,17 @@ bool wlr_renderer_init_wl_display(struct wlr_renderer *r,
  */
 int wlr_renderer_get_drm_fd(struct wlr_renderer *r);
 
+/**
+ * Get timing statistics of a past render pass, identified by the value of
+ * render_seq right after its wlr_renderer_end call.
+ *
+ * GPU times are only known once the GPU has completed the render pass, and
+ * statistics are only kept for a few render passes. Returns false if the
+ * statistics aren't available (yet). Statistics can only be retrieved once.
+ */
+bool wlr_renderer_get_render_stats(struct wlr_renderer *r,
+	uint32_t render_seq, struct wlr_render_stats *stats);
+
 /**
  * Destroys this wlr_renderer. Textures must be destroyed separately.
  */
@@ -9,6 +9,7 @@
 #ifndef WLR_RENDER_WLR_TEXTURE_H
 #define WLR_RENDER_WLR_TEXTURE_H
 
+#include <pixman.h>
 #include <stdint.h>
 #include <wayland-server-core.h>
 #include <wlr/render/dmabuf.h>
@@ -68,6 +69,17 @@ bool wlr_texture_write_pixels(struct wlr_texture *texture,
 	uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
 	const void *data);
 
+/**
+ * Update the parts of a texture covered by a region with raw pixels. The data
+ * holds a full image of the texture's size, each rectangle of the region is
+ * copied to the same position in the texture. This is cheaper than calling
+ * wlr_texture_write_pixels() once per rectangle.
+ *
+ * The same restrictions as for wlr_texture_write_pixels() apply.
+ */
+bool wlr_texture_write_pixels_region(struct wlr_texture *texture,
+	uint32_t stride, pixman_region32_t *region, const void *data);
+
 /**
  * Destroys this wlr_texture.
  */
@@ -12,6 +12,7 @@
 #include <pixman.h>
 #include <wayland-server-core.h>
 #include <wlr/render/dmabuf.h>
+#include <wlr/util/addon.h>
 
 struct wlr_buffer;
 
@@ -66,6 +67,8 @@ struct wlr_buffer {
 		struct wl_signal destroy;
 		struct wl_signal release;
 	} events;
+
+	struct wlr_addon_set addons;
 };
 
 /**
@@ -112,6 +115,20 @@ bool wlr_buffer_get_dmabuf(struct wlr_buffer *buffer,
 bool wlr_buffer_get_shm(struct wlr_buffer *buffer,
 	struct wlr_shm_attributes *attribs);
 
+/**
+ * Create a buffer filled with a single color, in premultiplied RGBA. Renderers
+ * draw it as a plain rectangle, without uploading any pixel data. The
+ * returned buffer needs to be dropped with wlr_buffer_drop.
+ */
+struct wlr_buffer *wlr_solid_buffer_create(int width, int height,
+	const float color[static 4]);
+/**
+ * Check whether all pixels of the buffer have the same color, and if so read
+ * it back in premultiplied RGBA. This is the case for buffers created with
+ * wlr_solid_buffer_create and for 1x1 ARGB8888 or XRGB8888 buffers.
+ */
+bool wlr_buffer_get_solid_color(struct wlr_buffer *buffer, float color[static 4]);
+
 /**
  * A client buffer.
  */
@@ -132,8 +149,19 @@ struct wlr_client_buffer {
 	 */
 	struct wlr_texture *texture;
 
+	// private state
+
 	struct wl_listener resource_destroy;
 	struct wl_listener release;
+
+	struct wlr_renderer *renderer;
+	// Texture inherited from the previous buffer, lagging behind by
+	// spare_damage. Used to update our contents while we're still locked.
+	struct wlr_texture *spare_texture;
+	// Damage accumulated since the previous buffer's contents
+	pixman_region32_t spare_damage;
+	// Buffers exchanging textures with this one, if any
+	struct wlr_client_buffer *prev, *next;
 };
 
 struct wlr_renderer;
@@ -164,8 +192,11 @@ struct wlr_client_buffer *wlr_client_buffer_import(
  * and destroys the provided `buffer`. On error, `buffer` is intact and NULL is
  * returned.
  *
- * Fails if there's more than one reference to the buffer or if the texture
- * isn't mutable.
+ * If there's more than one reference to the buffer, the damage is uploaded
+ * to a texture left behind by a previous buffer and a new buffer is returned
+ * instead: the compositor can keep using the old buffer until it unlocks it.
+ *
+ * Fails if the texture isn't mutable.
  */
 struct wlr_client_buffer *wlr_client_buffer_apply_damage(
 	struct wlr_client_buffer *buffer, struct wl_resource *resource,
@@ -0,0 +1,97 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_CLIENT_ACCOUNTING_H
+#define WLR_TYPES_WLR_CLIENT_ACCOUNTING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+struct wlr_compositor;
+
+struct wlr_client_accounting_limits {
+	// Maximum number of commits per second, zero for no limit. Commits above
+	// the limit are held back, which also delays their frame callbacks. Short
+	// bursts are let through.
+	int max_commit_rate;
+	// Memory above which the limit_exceeded event is emitted, in bytes, zero
+	// for no limit
+	size_t max_shm_bytes, max_gpu_bytes;
+};
+
+/**
+ * Resources used by a client. A client is tracked while it has surfaces.
+ */
+struct wlr_client_accounting_client {
+	struct wlr_client_accounting *accounting;
+	struct wl_client *client;
+	struct wl_list link; // wlr_client_accounting.clients
+
+	size_t surfaces;
+	uint64_t commits;
+	uint32_t commit_rate; // commits during the last second
+	uint64_t delayed_commits; // commits held back by the rate limit
+	// Bytes copied from shared memory buffers to textures
+	uint64_t bytes_uploaded;
+	// Shared memory of the buffers currently attached to surfaces
+	size_t shm_bytes;
+	// Estimate of the GPU memory used for the buffers currently attached to
+	// surfaces: DMA-BUFs, and textures of shared memory buffers
+	size_t gpu_bytes;
+	bool over_limit;
+
+	// private state
+
+	struct wl_list surfaces_list; // accounting_surface.link
+	int64_t window_start; // in nanoseconds
+	uint32_t window_commits;
+	int64_t next_commit; // theoretical time of the next commit, nanoseconds
+	struct wl_list held; // held_commit.link, oldest first
+	struct wl_event_source *held_timer;
+	struct wl_event_source *limit_idle; // pending limit_exceeded event
+};
+
+/**
+ * Per-client accounting of surfaces commits and buffer memory, with optional
+ * limits.
+ */
+struct wlr_client_accounting {
+	struct wl_list clients; // wlr_client_accounting_client.link
+	struct wlr_client_accounting_limits limits;
+
+	struct {
+		// Emitted when a client goes above a memory limit. The compositor
+		// may e.g. disconnect it.
+		struct wl_signal limit_exceeded; // struct wlr_client_accounting_client
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wl_listener compositor_new_surface;
+	struct wl_listener compositor_destroy;
+};
+
+struct wlr_client_accounting *wlr_client_accounting_create(
+	struct wlr_compositor *compositor);
+void wlr_client_accounting_destroy(struct wlr_client_accounting *accounting);
+/**
+ * Set the limits applied to each client. Commits held back by a previous
+ * commit rate limit are released as scheduled.
+ */
+void wlr_client_accounting_set_limits(struct wlr_client_accounting *accounting,
+	const struct wlr_client_accounting_limits *limits);
+/**
+ * Get the resources used by a client, or NULL if it has no surface.
+ */
+struct wlr_client_accounting_client *wlr_client_accounting_get_client(
+	struct wlr_client_accounting *accounting, struct wl_client *client);
+
+#endif
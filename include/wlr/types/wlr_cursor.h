@@ -63,6 +63,7 @@ struct wlr_cursor {
 		struct wl_signal touch_down;
 		struct wl_signal touch_motion;
 		struct wl_signal touch_cancel;
+		struct wl_signal touch_frame;
 
 		struct wl_signal tablet_tool_axis;
 		struct wl_signal tablet_tool_proximity;
@@ -77,6 +78,23 @@ struct wlr_cursor *wlr_cursor_create(void);
 
 void wlr_cursor_destroy(struct wlr_cursor *cur);
 
+/**
+ * Enable or disable coalescing of relative pointer motion. When enabled,
+ * motion events are accumulated per device instead of being emitted right
+ * away, and the sum (including unaccelerated deltas) is emitted followed by a
+ * frame when wlr_cursor_flush_motion is called, or before any other event of
+ * the same device so that ordering is preserved.
+ *
+ * This is useful with high polling rate mice: compositors typically flush in
+ * their output frame handler, sending clients one motion per displayed frame.
+ * Disabling coalescing flushes pending motion.
+ */
+void wlr_cursor_set_motion_coalescing(struct wlr_cursor *cur, bool enabled);
+/**
+ * Emit the relative motion accumulated while coalescing.
+ */
+void wlr_cursor_flush_motion(struct wlr_cursor *cur);
+
 /**
  * Warp the cursor to the given x and y in layout coordinates. If x and y are
  * out of the layout boundaries or constraints, no warp will happen.
@@ -36,6 +36,11 @@ struct wlr_data_control_device_v1 {
 	struct wl_listener seat_destroy;
 	struct wl_listener seat_set_selection;
 	struct wl_listener seat_set_primary_selection;
+
+	// private state
+
+	// Contents already received from the current selection sources
+	struct selection_cache *selection_cache, *primary_selection_cache;
 };
 
 struct wlr_data_control_manager_v1 *wlr_data_control_manager_v1_create(
@@ -141,6 +141,14 @@ struct wlr_drag {
 	struct wl_listener icon_destroy;
 
 	void *data;
+
+	// private state
+
+	// Motion events are coalesced and sent to the focused client once the
+	// current batch of input events has been processed
+	struct wl_event_source *motion_idle;
+	uint32_t motion_time;
+	double motion_sx, motion_sy;
 };
 
 struct wlr_drag_motion_event {
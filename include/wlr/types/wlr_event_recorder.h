@@ -0,0 +1,113 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_EVENT_RECORDER_H
+#define WLR_TYPES_WLR_EVENT_RECORDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-server-core.h>
+
+struct wlr_backend;
+struct wlr_compositor;
+struct wlr_output;
+
+/**
+ * Records input events and surface commits to a file, to reproduce
+ * performance issues with wlr_event_replay.
+ *
+ * Pointer and keyboard events of all the backend's input devices are
+ * recorded, along with the time, client and buffer size of each surface
+ * commit. Times are relative to the creation of the recorder.
+ */
+struct wlr_event_recorder {
+	FILE *file;
+	uint64_t events;
+
+	// private state
+
+	int64_t start_nsec;
+	int next_device_id;
+	struct wl_list devices; // recorder_device.link
+	struct wl_list surfaces; // recorder_surface.link
+
+	struct wl_listener backend_new_input;
+	struct wl_listener backend_destroy;
+	struct wl_listener compositor_new_surface;
+	struct wl_listener compositor_destroy;
+};
+
+/**
+ * Start recording. The file isn't closed by the recorder. The compositor may
+ * be NULL to only record input events.
+ */
+struct wlr_event_recorder *wlr_event_recorder_create(
+	struct wlr_backend *backend, struct wlr_compositor *compositor,
+	FILE *file);
+void wlr_event_recorder_destroy(struct wlr_event_recorder *recorder);
+
+struct wlr_event_replay_commit {
+	int64_t time_usec; // since the start of the recording
+	int32_t pid; // of the client
+	uint32_t surface_id; // wl_surface object ID
+	bool buffer; // a buffer was attached
+	int32_t width, height; // of the buffer
+};
+
+/**
+ * Re-injects a recording made with wlr_event_recorder on a headless backend,
+ * with the original timing.
+ *
+ * Input events are emitted on headless input devices matching the recorded
+ * ones. Surface commits can't be re-created without their clients: they are
+ * emitted as commit events, for the caller to simulate the load. Once done,
+ * a frame timing report of the outputs added with wlr_event_replay_add_output
+ * is logged.
+ */
+struct wlr_event_replay {
+	struct wlr_backend *backend;
+
+	struct {
+		struct wl_signal commit; // struct wlr_event_replay_commit
+		struct wl_signal done;
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wl_event_loop *event_loop;
+	struct wl_array devices; // struct wlr_input_device *
+	struct wl_array records; // struct replay_record
+	size_t next_record;
+	int64_t start_nsec;
+	struct wl_event_source *timer;
+	struct wl_list outputs; // replay_output.link
+
+	struct wl_listener backend_destroy;
+};
+
+/**
+ * Load a recording. Returns NULL if the file can't be parsed. The headless
+ * input devices are created right away, so that the compositor can configure
+ * them before the replay is started.
+ */
+struct wlr_event_replay *wlr_event_replay_create(struct wlr_backend *backend,
+	struct wl_display *display, FILE *file);
+void wlr_event_replay_destroy(struct wlr_event_replay *replay);
+/**
+ * Include the output in the frame timing report.
+ */
+bool wlr_event_replay_add_output(struct wlr_event_replay *replay,
+	struct wlr_output *output);
+/**
+ * Start re-injecting the events.
+ */
+void wlr_event_replay_start(struct wlr_event_replay *replay);
+
+#endif
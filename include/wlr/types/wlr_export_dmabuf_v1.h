@@ -34,6 +34,12 @@ struct wlr_export_dmabuf_frame_v1 {
 	bool cursor_locked;
 
 	struct wl_listener output_commit;
+
+	// private state
+
+	// Committed buffer lent to the client until it destroys the frame
+	struct wlr_buffer *buffer;
+	struct wlr_output *buffer_output;
 };
 
 struct wlr_export_dmabuf_manager_v1 *wlr_export_dmabuf_manager_v1_create(
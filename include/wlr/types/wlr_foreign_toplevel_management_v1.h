@@ -25,6 +25,10 @@ struct wlr_foreign_toplevel_manager_v1 {
 	} events;
 
 	void *data;
+
+	// private state
+
+	int title_interval; // see wlr_foreign_toplevel_manager_v1_set_title_interval
 };
 
 enum wlr_foreign_toplevel_handle_v1_state {
@@ -71,6 +75,12 @@ struct wlr_foreign_toplevel_handle_v1 {
 	} events;
 
 	void *data;
+
+	// private state
+
+	uint32_t pending; // properties to send with the next done event
+	uint32_t title_sent_msec; // time at which the title was last sent
+	struct wl_event_source *title_timer;
 };
 
 struct wlr_foreign_toplevel_handle_v1_maximized_event {
@@ -102,6 +112,13 @@ struct wlr_foreign_toplevel_handle_v1_set_rectangle_event {
 
 struct wlr_foreign_toplevel_manager_v1 *wlr_foreign_toplevel_manager_v1_create(
 	struct wl_display *display);
+/**
+ * Limit how often title changes are sent to clients, in milliseconds. When a
+ * toplevel changes its title faster than that, only the latest title is sent
+ * once the interval has elapsed. Disabled (0) by default.
+ */
+void wlr_foreign_toplevel_manager_v1_set_title_interval(
+	struct wlr_foreign_toplevel_manager_v1 *manager, int interval_ms);
 
 struct wlr_foreign_toplevel_handle_v1 *wlr_foreign_toplevel_handle_v1_create(
 	struct wlr_foreign_toplevel_manager_v1 *manager);
@@ -0,0 +1,67 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_FRACTIONAL_SCALE_V1_H
+#define WLR_TYPES_WLR_FRACTIONAL_SCALE_V1_H
+
+#include <wayland-server-core.h>
+
+struct wlr_surface;
+
+/**
+ * Lets clients render at the fractional scale of the outputs their surfaces
+ * are shown on, instead of rendering at the next integer scale and having the
+ * compositor downscale every frame.
+ *
+ * Clients attach buffers at the preferred scale and use wp_viewporter to set
+ * the surface size, so the compositor samples them 1:1.
+ */
+struct wlr_fractional_scale_manager_v1 {
+	struct wl_global *global;
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wl_list scales; // wlr_fractional_scale_v1::link
+
+	struct wl_listener display_destroy;
+};
+
+struct wlr_fractional_scale_v1 {
+	struct wl_resource *resource;
+	struct wlr_surface *surface;
+	struct wl_list link; // wlr_fractional_scale_manager_v1::scales
+
+	// private state
+
+	uint32_t scale_120; // last sent preferred scale, in 1/120 units
+
+	struct wl_listener surface_destroy;
+};
+
+struct wlr_fractional_scale_manager_v1 *wlr_fractional_scale_manager_v1_create(
+	struct wl_display *display);
+
+/**
+ * Notify the client of the preferred scale of a surface. This should be
+ * called when the surface enters or leaves an output, or when the scale of
+ * one of its outputs changes, usually with the largest scale of the outputs
+ * the surface is on. Does nothing if the client didn't ask for fractional
+ * scale information for this surface, or if the scale didn't change.
+ *
+ * When the client creates the fractional scale object, the largest scale of
+ * the outputs the surface has entered is sent.
+ */
+void wlr_fractional_scale_manager_v1_notify_scale(
+	struct wlr_fractional_scale_manager_v1 *manager,
+	struct wlr_surface *surface, double scale);
+
+#endif
@@ -45,6 +45,9 @@ struct wlr_idle_timeout {
 	bool idle_state;
 	bool enabled;
 	uint32_t timeout; // milliseconds
+	// Time of the last activity, the timer is only re-armed when it fires
+	// early. Private.
+	uint32_t last_activity_msec;
 
 	struct {
 		struct wl_signal idle;
@@ -51,8 +51,13 @@ struct wlr_keyboard {
 	const struct wlr_keyboard_impl *impl;
 	struct wlr_keyboard_group *group;
 
+	// The serialized keymap and its file are shared with other keyboards
+	// using an identical keymap, and must not be modified
 	char *keymap_string;
 	size_t keymap_size;
+	int keymap_fd; // read-only, shared with all clients, -1 if no keymap
+	// Identifies the shared keymap, never reused, 0 if no keymap
+	uint64_t keymap_serial;
 	struct xkb_keymap *keymap;
 	struct xkb_state *xkb_state;
 	xkb_led_index_t led_indexes[WLR_LED_COUNT];
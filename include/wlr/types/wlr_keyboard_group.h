@@ -9,15 +9,22 @@
 #ifndef WLR_TYPES_WLR_KEYBOARD_GROUP_H
 #define WLR_TYPES_WLR_KEYBOARD_GROUP_H
 
+#include <stdint.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_keyboard.h>
 #include <wlr/types/wlr_input_device.h>
 
+#define WLR_KEYBOARD_GROUP_KEYCODES_MAX 768 // KEY_CNT
+
 struct wlr_keyboard_group {
 	struct wlr_keyboard keyboard;
 	struct wlr_input_device *input_device;
 	struct wl_list devices; // keyboard_group_device::link
-	struct wl_list keys; // keyboard_group_key::link
+	// Number of member keyboards pressing each key code. Key codes outside
+	// of this range aren't deduplicated. Private.
+	uint16_t key_counts[WLR_KEYBOARD_GROUP_KEYCODES_MAX];
+	// Set while modifiers are being synced to the member keyboards. Private.
+	bool syncing_modifiers;
 
 	struct {
 		/*
@@ -41,6 +41,11 @@ struct wlr_layer_shell_v1 {
 	} events;
 
 	void *data;
+
+	// private state
+
+	struct wl_list surfaces; // wlr_layer_surface_v1.link
+	struct wl_list outputs; // wlr_layer_output_v1.link
 };
 
 struct wlr_layer_surface_v1_state {
@@ -83,6 +88,12 @@ struct wlr_layer_surface_v1 {
 
 	struct wl_listener surface_destroy;
 
+	/**
+	 * Position and size of the surface in output-local coordinates, computed
+	 * by the output's wlr_layer_output_v1, if any.
+	 */
+	struct wlr_box geometry;
+
 	struct {
 		/**
 		 * The destroy signal indicates that the wlr_layer_surface is about to be
@@ -112,10 +123,66 @@ struct wlr_layer_surface_v1 {
 	} events;
 
 	void *data;
+
+	// private state
+
+	struct wl_list link; // wlr_layer_shell_v1.surfaces
+};
+
+/**
+ * Arranges the layer surfaces of an output according to their anchors,
+ * margins and exclusive zones, in output-local coordinates.
+ *
+ * Changes to the layer surfaces and to the output size are collected and the
+ * output is re-arranged once per event loop iteration. Layer surfaces are
+ * only sent a configure event when their size changes. The new positions are
+ * available in wlr_layer_surface_v1.geometry when the arrange event is
+ * emitted.
+ */
+struct wlr_layer_output_v1 {
+	struct wlr_layer_shell_v1 *shell;
+	struct wlr_output *output;
+
+	/**
+	 * Area left for regular windows once exclusive zones are subtracted,
+	 * in output-local coordinates.
+	 */
+	struct wlr_box usable_area;
+
+	struct {
+		// Emitted when the geometry of a layer surface has changed
+		struct wl_signal arrange;
+		// Emitted when usable_area has changed
+		struct wl_signal usable_area;
+		struct wl_signal destroy;
+	} events;
+
+	void *data;
+
+	// private state
+
+	struct wl_list link; // wlr_layer_shell_v1.outputs
+	struct wl_event_source *idle_arrange;
+	struct wl_listener output_commit;
+	struct wl_listener output_destroy;
 };
 
 struct wlr_layer_shell_v1 *wlr_layer_shell_v1_create(struct wl_display *display);
 
+/**
+ * Start arranging the layer surfaces of an output. The wlr_layer_output_v1 is
+ * destroyed with the output or the layer shell.
+ */
+struct wlr_layer_output_v1 *wlr_layer_output_v1_create(
+	struct wlr_layer_shell_v1 *shell, struct wlr_output *output);
+void wlr_layer_output_v1_destroy(struct wlr_layer_output_v1 *layer_output);
+/**
+ * Schedule a re-arrangement, e.g. after the compositor changed the output of
+ * a layer surface.
+ */
+void wlr_layer_output_v1_schedule_arrange(
+	struct wlr_layer_output_v1 *layer_output);
+
 /**
  * Notifies the layer surface to configure itself with this width/height. The
  * layer_surface will signal its map event when the surface is ready to assume
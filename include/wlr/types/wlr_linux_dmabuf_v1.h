@@ -10,9 +10,11 @@
 #define WLR_TYPES_WLR_LINUX_DMABUF_H
 
 #include <stdint.h>
+#include <sys/stat.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/render/dmabuf.h>
+#include <wlr/render/drm_format_set.h>
 
 struct wlr_dmabuf_v1_buffer {
 	struct wlr_buffer base;
@@ -43,6 +45,27 @@ struct wlr_linux_buffer_params_v1 {
 	bool has_modifier;
 };
 
+struct wlr_surface;
+
+struct wlr_linux_dmabuf_feedback_v1_tranche {
+	dev_t target_device;
+	uint32_t flags; // bitfield of enum zwp_linux_dmabuf_feedback_v1_tranche_flags
+	const struct wlr_drm_format_set *formats;
+};
+
+/**
+ * DMA-BUF feedback: a list of format/modifier tranches, ordered by decreasing
+ * preference. Clients allocating buffers with a format and modifier from the
+ * first tranches cost less to display, e.g. because they can be scanned out.
+ */
+struct wlr_linux_dmabuf_feedback_v1 {
+	dev_t main_device;
+	size_t tranches_len;
+	const struct wlr_linux_dmabuf_feedback_v1_tranche *tranches;
+};
+
+struct wlr_linux_dmabuf_feedback_v1_compiled;
+
 /* the protocol interface */
 struct wlr_linux_dmabuf_v1 {
 	struct wl_global *global;
@@ -52,6 +75,11 @@ struct wlr_linux_dmabuf_v1 {
 		struct wl_signal destroy;
 	} events;
 
+	// private state
+
+	struct wlr_linux_dmabuf_feedback_v1_compiled *default_feedback; // may be NULL
+	struct wl_list surfaces; // wlr_linux_dmabuf_v1_surface.link
+
 	struct wl_listener display_destroy;
 	struct wl_listener renderer_destroy;
 };
@@ -62,4 +90,19 @@ struct wlr_linux_dmabuf_v1 {
 struct wlr_linux_dmabuf_v1 *wlr_linux_dmabuf_v1_create(struct wl_display *display,
 	struct wlr_renderer *renderer);
 
+/**
+ * Set a surface's DMA-BUF feedback.
+ *
+ * The feedback is sent to the clients which have requested feedback for this
+ * surface, and replaces the default feedback derived from the renderer. Pass
+ * NULL to reset it to the default feedback. The feedback is copied, the
+ * format sets can be released after this call.
+ *
+ * Returns false on failure, in which case the previous surface feedback is
+ * kept.
+ */
+bool wlr_linux_dmabuf_v1_set_surface_feedback(
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf, struct wlr_surface *surface,
+	const struct wlr_linux_dmabuf_feedback_v1 *feedback);
+
 #endif
@@ -0,0 +1,82 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_LINUX_EXPLICIT_SYNCHRONIZATION_V1_H
+#define WLR_TYPES_WLR_LINUX_EXPLICIT_SYNCHRONIZATION_V1_H
+
+#include <stdbool.h>
+#include <wayland-server-core.h>
+#include <wlr/render/dmabuf.h>
+
+struct wlr_buffer;
+struct wlr_surface;
+
+struct wlr_linux_buffer_release_v1 {
+	struct wl_resource *resource;
+
+	// private state
+
+	// Slot referencing the release object until its commit is applied
+	struct wlr_linux_buffer_release_v1 **ref;
+	// Set once the commit is applied
+	struct wlr_buffer *buffer;
+	struct wlr_dmabuf_attributes dmabuf; // n_planes is zero if unset
+
+	struct wl_listener buffer_release;
+};
+
+struct wlr_linux_surface_synchronization_v1_state {
+	int acquire_fence_fd; // -1 if unset
+	struct wlr_linux_buffer_release_v1 *buffer_release; // may be NULL
+};
+
+struct wlr_linux_surface_synchronization_v1 {
+	struct wl_resource *resource; // NULL once destroyed by the client
+	struct wlr_surface *surface;
+	struct wl_list link; // wlr_linux_explicit_synchronization_v1.surfaces
+
+	// private state
+
+	struct wlr_linux_explicit_synchronization_v1 *explicit_sync;
+	struct wlr_linux_surface_synchronization_v1_state pending;
+	// Commits waiting for their acquire fence or to be applied
+	struct wl_list commits; // surface_sync_commit.link
+
+	struct wl_listener surface_destroy;
+	struct wl_listener surface_client_commit;
+	struct wl_listener surface_commit;
+};
+
+struct wlr_linux_explicit_synchronization_v1 {
+	struct wl_global *global;
+	struct wl_list surfaces; // wlr_linux_surface_synchronization_v1.link
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	struct wl_listener display_destroy;
+};
+
+/**
+ * Advertise explicit synchronization support to clients.
+ *
+ * Clients can attach an acquire fence to dmabuf buffers they commit and ask
+ * to be notified with a release fence once the compositor is done with a
+ * buffer. Clients which don't use the protocol keep relying on implicit
+ * synchronization.
+ *
+ * Commits with an acquire fence are held back until the fence signals, the
+ * previous buffer stays current in the meantime. Once a buffer is released,
+ * clients which asked for it receive a release fence covering the reads
+ * still pending on the DMA-BUF, or an immediate release if there are none.
+ */
+struct wlr_linux_explicit_synchronization_v1 *
+	wlr_linux_explicit_synchronization_v1_create(struct wl_display *display);
+
+#endif
@@ -59,4 +59,11 @@ void wlr_matrix_project_box(float mat[static 9], const struct wlr_box *box,
 	enum wl_output_transform transform, float rotation,
 	const float projection[static 9]);
 
+/** Same as wlr_matrix_project_box without rotation, for an array of boxes
+ *  sharing the same transform and projection. mats[i] is the matrix for
+ *  boxes[i]. */
+void wlr_matrix_project_boxes(float (*mats)[9], const struct wlr_box *boxes,
+	size_t len, enum wl_output_transform transform,
+	const float projection[static 9]);
+
 #endif
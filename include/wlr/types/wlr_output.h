@@ -15,6 +15,7 @@
 #include <wayland-server-protocol.h>
 #include <wayland-util.h>
 #include <wlr/render/dmabuf.h>
+#include <wlr/types/wlr_box.h>
 #include <wlr/types/wlr_buffer.h>
 
 struct wlr_output_mode {
@@ -34,13 +35,23 @@ struct wlr_output_cursor {
 	struct wl_list link;
 
 	// only when using a software cursor without a surface
-	struct wlr_texture *texture;
+	struct wlr_texture *texture; // owned by wlr_output.cursor_textures
+	uint64_t image_hash; // hash of the pixels of the texture
 
 	// only when using a cursor surface
 	struct wlr_surface *surface;
 	struct wl_listener surface_commit;
 	struct wl_listener surface_destroy;
 
+	// pixels below the software cursor in the last frame, see
+	// wlr_output_enable_cursor_save_under
+	struct wlr_texture *save_under;
+	struct wlr_box save_under_box;
+
+	// drawn in the cursor plane buffer of wlr_output.hardware_cursor, along
+	// with it, private
+	bool composited;
+
 	struct {
 		struct wl_signal destroy;
 	} events;
@@ -61,6 +72,10 @@ enum wlr_output_state_field {
 	WLR_OUTPUT_STATE_TRANSFORM = 1 << 5,
 	WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED = 1 << 6,
 	WLR_OUTPUT_STATE_GAMMA_LUT = 1 << 7,
+	WLR_OUTPUT_STATE_LAYERS = 1 << 8,
+	WLR_OUTPUT_STATE_IN_FENCE = 1 << 9,
+	WLR_OUTPUT_STATE_BUFFER_TRANSFORM = 1 << 10,
+	WLR_OUTPUT_STATE_TEARING_PAGE_FLIP = 1 << 11,
 };
 
 enum wlr_output_state_buffer_type {
@@ -99,10 +114,67 @@ struct wlr_output_state {
 	// only valid if WLR_OUTPUT_STATE_GAMMA_LUT
 	uint16_t *gamma_lut;
 	size_t gamma_lut_size;
+
+	// only valid if WLR_OUTPUT_STATE_LAYERS
+	struct wlr_output_layer_state *layers;
+	size_t layers_len;
+
+	// only valid if WLR_OUTPUT_STATE_IN_FENCE
+	int in_fence_fd;
+
+	// only valid if WLR_OUTPUT_STATE_BUFFER_TRANSFORM
+	enum wl_output_transform buffer_transform;
+};
+
+/**
+ * A layer displayed on top of the output's primary buffer.
+ *
+ * Backends may be able to display layers with hardware planes, which avoids
+ * compositing their contents into the primary buffer. See
+ * `wlr_output_set_layers`.
+ */
+struct wlr_output_layer {
+	struct wlr_output *output;
+	struct wl_list link; // wlr_output.layers
+
+	struct wlr_addon_set addons; // for backends
+
+	void *data;
+};
+
+/**
+ * State of an output layer, see `wlr_output_set_layers`.
+ */
+struct wlr_output_layer_state {
+	struct wlr_output_layer *layer;
+	// Buffer to display, or NULL to hide the layer
+	struct wlr_buffer *buffer;
+	// Position of the top-left corner, in output-buffer-local coordinates
+	int x, y;
+	// Region of the buffer to display, in buffer coordinates. The whole
+	// buffer is displayed if empty.
+	struct wlr_fbox src_box;
+	// Size of the layer on the output, in output-buffer-local coordinates.
+	// The buffer isn't scaled if zero. See wlr_surface_get_buffer_source_box
+	// to display a surface with a viewport.
+	int dst_width, dst_height;
+
+	// Set by the backend if it can display the layer without compositing
+	bool accepted;
 };
 
 struct wlr_output_impl;
 
+/**
+ * Result of the buffer format negotiation between the renderer and the
+ * output, re-used until the output's format constraints change.
+ */
+struct wlr_output_format_cache {
+	const struct wlr_drm_format_set *display_formats; // NULL if unconstrained
+	struct wlr_drm_format *format; // NULL if not negotiated yet
+};
+struct wlr_render_stats;
+
 /**
  * A compositor output region. This typically corresponds to a monitor that
  * displays part of the compositor space.
@@ -150,6 +222,10 @@ struct wlr_output {
 
 	// Commit sequence number. Incremented on each commit, may overflow.
 	uint32_t commit_seq;
+	// Fence signalled when the display engine is done with the buffers
+	// replaced by the last commit, -1 if the backend doesn't provide one.
+	// Owned by the output, valid until the next commit.
+	int out_fence_fd;
 
 	struct {
 		// Request to render a frame
@@ -166,16 +242,64 @@ struct wlr_output {
 		struct wl_signal commit; // wlr_output_event_commit
 		// Emitted right after the buffer has been presented to the user
 		struct wl_signal present; // wlr_output_event_present
+		// Emitted when timing statistics of a rendered frame are available
+		struct wl_signal render_stats; // wlr_output_event_render_stats
+		// Emitted when a capture requested with
+		// wlr_output_capture_next_commit is done
+		struct wl_signal capture; // wlr_output_event_capture
 		// Emitted after a client bound the wl_output global
 		struct wl_signal bind; // wlr_output_event_bind
 		struct wl_signal enable;
 		struct wl_signal mode;
 		struct wl_signal description;
+		// Emitted right before the done event is sent to wl_output resources,
+		// for wl_output add-on interfaces to send their pending updates
+		struct wl_signal done;
 		struct wl_signal destroy;
 	} events;
 
 	struct wl_event_source *idle_frame;
 	struct wl_event_source *idle_done;
+	// Property updates are coalesced and sent once per event loop iteration,
+	// only for the properties which differ from the ones last sent. Private.
+	struct {
+		bool done; // a done event has been explicitly requested
+		int32_t width, height, refresh;
+		int32_t scale;
+		enum wl_output_subpixel subpixel;
+		enum wl_output_transform transform;
+	} advertised;
+
+	// Frame scheduling, see wlr_output_enable_frame_scheduling. Times are in
+	// nanoseconds, on the backend's presentation clock.
+	struct {
+		bool enabled;
+		int64_t last_present; // zero if unknown
+		int refresh; // zero if unknown
+		int64_t frame_sent; // zero if no commit happened since the frame event
+		int64_t target_present; // zero if unknown
+		int render_time; // estimate of the time between frame and commit
+		int margin;
+		struct wl_event_source *timer;
+		bool delayed; // a frame event is waiting for the timer
+	} frame_sched;
+
+	// Frame grouping, see wlr_output_enable_frame_grouping. Private.
+	struct {
+		bool enabled;
+		bool waiting; // the frame event waits for another output's
+		struct wl_list link; // global list of outputs with grouping enabled
+		struct wl_event_source *timer;
+	} frame_group;
+
+	// Frame interleaving, see wlr_output_enable_frame_interleaving. Private.
+	struct {
+		bool enabled;
+		bool queued; // the frame event waits for the next loop iteration
+		int fds[2]; // pipe waking up the event loop
+		struct wl_event_source *event_source;
+		struct wl_event_source *idle; // ends the loop iteration
+	} frame_interleave;
 
 	int attach_render_locks; // number of locks forcing rendering
 
@@ -183,10 +307,46 @@ struct wlr_output {
 	struct wlr_output_cursor *hardware_cursor;
 	struct wlr_swapchain *cursor_swapchain;
 	struct wlr_buffer *cursor_front_buffer;
+	struct wlr_output_format_cache cursor_format;
+	struct wl_list cursor_buffers; // rendered cursor images, private
+	size_t cursor_buffers_len;
+	struct wl_list cursor_textures; // uploaded cursor images, private
+	size_t cursor_textures_len;
 	int software_cursor_locks; // number of locks forcing software cursors
+	// number of locks requesting damage for hardware cursor updates
+	int hardware_cursor_damage_locks;
+
+	// see wlr_output_enable_cursor_save_under
+	struct {
+		bool enabled;
+		bool saved; // the back buffer has save-unders for all software cursors
+		bool moved; // software cursors moved since the last frame
+		struct wlr_buffer *frame; // last frame, if it has valid save-unders
+	} cursor_save_under;
 
 	struct wlr_swapchain *swapchain;
 	struct wlr_buffer *back_buffer;
+	size_t swapchain_depth; // 0 for the default
+	uint32_t render_format; // see wlr_output_set_render_format
+	struct wlr_output_format_cache primary_format;
+	// see wlr_output_set_release_buffers_timeout
+	int release_buffers_timeout; // in milliseconds, 0 to keep buffers
+	struct wl_event_source *release_buffers_timer;
+
+	struct wl_list layers; // wlr_output_layer.link
+
+	// Gamma LUT applied by the renderer when the backend doesn't support
+	// gamma LUTs, see wlr_output_get_gamma_size. Private.
+	struct {
+		uint16_t *lut; // NULL if unset
+		size_t size;
+	} software_gamma;
+
+	// Rendered frames waiting for their timing statistics
+	struct {
+		uint32_t render_seq, commit_seq;
+	} pending_render_stats[2];
+	size_t pending_render_stats_len;
 
 	struct wl_listener display_destroy;
 
@@ -196,6 +356,9 @@ struct wlr_output {
 struct wlr_output_event_damage {
 	struct wlr_output *output;
 	pixman_region32_t *damage; // output-buffer-local coordinates
+	// the damage is only caused by software cursor motion, which the output
+	// can repaint on its own, see wlr_output_enable_cursor_save_under
+	bool software_cursor;
 };
 
 struct wlr_output_event_precommit {
@@ -207,6 +370,7 @@ struct wlr_output_event_commit {
 	struct wlr_output *output;
 	uint32_t committed; // bitmask of enum wlr_output_state_field
 	struct timespec *when;
+	struct wlr_buffer *buffer; // NULL if no buffer is committed or unknown
 };
 
 enum wlr_output_present_flag {
@@ -238,11 +402,30 @@ struct wlr_output_event_present {
 	uint32_t flags; // enum wlr_output_present_flag
 };
 
+struct wlr_output_event_render_stats {
+	struct wlr_output *output;
+	// Frame submission for which these statistics are (see
+	// wlr_output.commit_seq)
+	uint32_t commit_seq;
+	const struct wlr_render_stats *stats;
+};
+
 struct wlr_output_event_bind {
 	struct wlr_output *output;
 	struct wl_resource *resource;
 };
 
+struct wlr_output_event_capture {
+	struct wlr_output *output;
+	struct wlr_buffer *buffer;
+	// Whether the buffer holds the captured contents, false if the capture
+	// was cancelled, e.g. because the commit failed or the output was
+	// disabled
+	bool success;
+	// Time when the display engine was done writing the buffer
+	struct timespec *when;
+};
+
 struct wlr_surface;
 
 /**
@@ -305,7 +488,9 @@ void wlr_output_set_description(struct wlr_output *output, const char *desc);
 /**
  * Schedule a done event.
  *
- * This is intended to be used by wl_output add-on interfaces.
+ * This is intended to be used by wl_output add-on interfaces. The event is
+ * sent from an idle callback, along with any other pending wl_output update.
+ * Add-on interfaces can send their own updates from the done signal.
  */
 void wlr_output_schedule_done(struct wlr_output *output);
 void wlr_output_destroy(struct wlr_output *output);
@@ -332,6 +517,34 @@ void wlr_output_effective_resolution(struct wlr_output *output,
  * must call wlr_output_rollback.
  */
 bool wlr_output_attach_render(struct wlr_output *output, int *buffer_age);
+/**
+ * Set the number of buffers used for rendering: 2 for double buffering, 3 for
+ * triple buffering, up to 4. Fewer buffers use less memory, more buffers let
+ * the compositor render a new frame before the previous one is displayed.
+ *
+ * Returns false if the depth isn't supported.
+ */
+bool wlr_output_set_swapchain_depth(struct wlr_output *output, size_t depth);
+/**
+ * Set the preferred DRM format of the buffers the output renders into, e.g.
+ * DRM_FORMAT_XRGB2101010 or DRM_FORMAT_XBGR16161616F for higher bit-depth
+ * scanout. The default is DRM_FORMAT_ARGB8888. If the renderer or the output
+ * can't use the format, ARGB8888 is used instead.
+ *
+ * Takes effect with the next rendered frame.
+ */
+void wlr_output_set_render_format(struct wlr_output *output, uint32_t format);
+/**
+ * Release the buffers used for rendering once the output has been disabled
+ * for the specified amount of time, e.g. when turned off via
+ * wlr-output-power-management. Buffers are allocated again when the output is
+ * re-enabled and rendered to.
+ *
+ * A timeout of zero (the default) keeps the buffers around, so that the output
+ * can be re-enabled without allocating.
+ */
+void wlr_output_set_release_buffers_timeout(struct wlr_output *output,
+	int timeout_ms);
 /**
  * Attach a buffer to the output. Compositors should call `wlr_output_commit`
  * to submit the new frame. The output needs to be enabled.
@@ -341,6 +554,88 @@ bool wlr_output_attach_render(struct wlr_output *output, int *buffer_age);
  */
 void wlr_output_attach_buffer(struct wlr_output *output,
 	struct wlr_buffer *buffer);
+/**
+ * Set a fence which must be signalled before the display engine reads the
+ * buffer attached to the output, e.g. a client's acquire fence. This allows
+ * the buffer to be committed before rendering to it has completed.
+ *
+ * The file descriptor is duplicated. The fence is reset when a new buffer is
+ * attached. Not all backends support fences, compositors can check support
+ * with `wlr_output_test` and wait for the fence themselves otherwise.
+ */
+void wlr_output_set_in_fence(struct wlr_output *output, int fence_fd);
+/**
+ * Set the transform the display engine should apply to the buffer attached
+ * with `wlr_output_attach_buffer`, on top of the output transform the buffer
+ * normally already contains. For instance, an unrotated buffer can be
+ * displayed on an output with a 90 degrees transform by setting a 90 degrees
+ * buffer transform, in which case the buffer size is the output's transformed
+ * resolution.
+ *
+ * The buffer transform is reset when a new buffer is attached. Not all
+ * backends support it, compositors can check support with `wlr_output_test`.
+ */
+void wlr_output_set_buffer_transform(struct wlr_output *output,
+	enum wl_output_transform transform);
+/**
+ * Request the next buffer to be displayed as soon as possible, without
+ * waiting for the vertical blanking period. This reduces latency at the cost
+ * of tearing, e.g. for fullscreen games.
+ *
+ * This is a hint: backends which can't perform a tearing page-flip for the
+ * committed state display the buffer as usual. Presentation events for
+ * tearing page-flips don't have the WLR_OUTPUT_PRESENT_VSYNC flag. The hint
+ * only applies to the next commit, which must include a buffer.
+ */
+void wlr_output_set_tearing_page_flip(struct wlr_output *output,
+	bool enabled);
+/**
+ * Create a new layer on top of the output's primary buffer.
+ *
+ * The layer isn't displayed until it's part of a `wlr_output_set_layers`
+ * call.
+ */
+struct wlr_output_layer *wlr_output_layer_create(struct wlr_output *output);
+/**
+ * Destroy an output layer. The compositor must not reference it in the output
+ * pending state anymore.
+ */
+void wlr_output_layer_destroy(struct wlr_output_layer *layer);
+/**
+ * Set the output layers, ordered from bottom to top. Layers not part of the
+ * array are hidden. The array must stay valid until the next commit or
+ * rollback.
+ *
+ * After `wlr_output_test` or `wlr_output_commit`, the `accepted` field of
+ * each layer state indicates whether the backend is displaying the layer on
+ * its own (e.g. with a hardware plane). Layers which haven't been accepted
+ * must be composited into the primary buffer by the compositor. Accepted
+ * layers are always above all layers which haven't been accepted. The usual
+ * sequence is to set the layers, call `wlr_output_test`, render the rejected
+ * layers and commit.
+ *
+ * Layers are double-buffered state, see `wlr_output_commit`. They can only be
+ * committed along with a buffer.
+ */
+void wlr_output_set_layers(struct wlr_output *output,
+	struct wlr_output_layer_state *layers, size_t layers_len);
+/**
+ * Attempt to attach a surface's buffer to the output for direct scan-out.
+ *
+ * This only succeeds if the surface is a good candidate for direct scan-out
+ * (ie. it has no mapped subsurfaces, no viewport, and its buffer matches the
+ * output's mode and transform) and if the backend accepts the buffer, as
+ * checked by `wlr_output_test`. Buffers whose transform doesn't match the
+ * output's are scanned out if the backend can rotate them, see
+ * `wlr_output_set_buffer_transform`. On success, compositors should skip rendering
+ * and call `wlr_output_commit`. On failure, the pending buffer state is left
+ * untouched and compositors should fall back to `wlr_output_attach_render`.
+ *
+ * Compositors are still responsible for sending frame done events to the
+ * surface.
+ */
+bool wlr_output_attach_surface(struct wlr_output *output,
+	struct wlr_surface *surface);
 /**
  * Get the preferred format for reading pixels.
  * This function might change the current rendering context.
@@ -375,10 +670,73 @@ bool wlr_output_test(struct wlr_output *output);
  * On failure, the pending changes are rolled back.
  */
 bool wlr_output_commit(struct wlr_output *output);
+/**
+ * Test whether the pending state of several outputs would be accepted by the
+ * backends if committed together with `wlr_output_commit_group`.
+ *
+ * Outputs on the same DRM device are validated with a single test-only atomic
+ * request. Modesets without a scan-out buffer attached can only be partially
+ * validated.
+ */
+bool wlr_output_test_group(struct wlr_output *const *outputs,
+	size_t outputs_len);
+/**
+ * Commit the pending state of several outputs at once, e.g. to enable a set of
+ * outputs with a single modeset or to page-flip them in sync.
+ *
+ * If all outputs share a backend which supports it, the changes are applied
+ * at once: either all outputs are committed, or none are and their pending
+ * changes are rolled back. Otherwise, the outputs are committed one after the
+ * other and false is returned if any of them failed.
+ *
+ * DRM devices without atomic modesetting can't apply changes to several
+ * outputs at once: groups where more than one output needs a KMS update are
+ * rejected, and so are their tests.
+ */
+bool wlr_output_commit_group(struct wlr_output *const *outputs,
+	size_t outputs_len);
 /**
  * Discard the pending output state.
  */
 void wlr_output_rollback(struct wlr_output *output);
+/**
+ * Enable or disable frame scheduling. When enabled, the `frame` event isn't
+ * sent right after the previous frame has been presented, but as late as
+ * possible before the next vertical blank. The delay is derived from the
+ * refresh period reported by presentation events and from the time the
+ * compositor took to commit after previous `frame` events, minus a safety
+ * margin which grows when a deadline is missed.
+ *
+ * This reduces latency for compositors which render quickly. Disabled by
+ * default. Frames aren't delayed while adaptive sync is enabled, since the
+ * display then refreshes whenever a new frame is committed.
+ */
+void wlr_output_enable_frame_scheduling(struct wlr_output *output,
+	bool enabled);
+/**
+ * Enable or disable frame grouping. Outputs with frame grouping enabled which
+ * share a display try to send their `frame` events together: when an output
+ * is ready for a new frame and another one is expected to be within a couple
+ * of milliseconds, its `frame` event is held back until the other output's,
+ * so that the compositor wakes up once for both. The `frame` event is never
+ * held back by more than the grouping window.
+ *
+ * This is useful with outputs running at different refresh rates. The
+ * presentation events are used to predict the next frame of each output.
+ * Disabled by default.
+ */
+void wlr_output_enable_frame_grouping(struct wlr_output *output,
+	bool enabled);
+/**
+ * Enables or disables frame interleaving. When several outputs with
+ * interleaving enabled are due for a frame at the same time, e.g. because
+ * their page-flips completed together, only one of them gets its frame event
+ * per event loop iteration. Client requests and input events are then
+ * processed between the composites of each output, instead of waiting for
+ * all of them. Disabled by default.
+ */
+void wlr_output_enable_frame_interleaving(struct wlr_output *output,
+	bool enabled);
 /**
  * Manually schedules a `frame` event. If a `frame` event is already pending,
  * it is a no-op.
@@ -386,6 +744,10 @@ void wlr_output_rollback(struct wlr_output *output);
 void wlr_output_schedule_frame(struct wlr_output *output);
 /**
  * Returns the maximum length of each gamma ramp, or 0 if unsupported.
+ *
+ * If the backend doesn't support gamma LUTs but the renderer supports color
+ * transforms, the gamma LUT is applied by the renderer to frames rendered
+ * after `wlr_output_attach_render`. Direct scan-out is disabled in that case.
  */
 size_t wlr_output_get_gamma_size(struct wlr_output *output);
 /**
@@ -406,6 +768,18 @@ void wlr_output_set_gamma(struct wlr_output *output, size_t size,
  */
 bool wlr_output_export_dmabuf(struct wlr_output *output,
 	struct wlr_dmabuf_attributes *attribs);
+/**
+ * Ask the backend to write the composed contents of the next buffer commit
+ * into the buffer, all planes included, without rendering. This is done by
+ * the display engine if it supports it, e.g. with a KMS writeback connector.
+ * The buffer must have the size of the output's current mode.
+ *
+ * Returns false if the output can't capture into the buffer. Otherwise, the
+ * capture event is emitted once the buffer is ready or the capture has been
+ * cancelled. The buffer is locked until then.
+ */
+bool wlr_output_capture_next_commit(struct wlr_output *output,
+	struct wlr_buffer *buffer);
 /**
  * Returns the wlr_output matching the provided wl_output resource. If the
  * resource isn't a wl_output, it aborts. If the resource is inert (because the
@@ -427,14 +801,46 @@ void wlr_output_lock_attach_render(struct wlr_output *output, bool lock);
  * a lock.
  */
 void wlr_output_lock_software_cursors(struct wlr_output *output, bool lock);
+/**
+ * Locks the output to emit damage events when the hardware cursor moves or
+ * changes, as if it was a software cursor, while keeping the hardware cursor
+ * enabled. This is useful for screen capture which draws the cursor into the
+ * captured frames itself: only the cursor area needs to be repainted. Locks
+ * are counted like with wlr_output_lock_software_cursors.
+ */
+void wlr_output_lock_hardware_cursor_damage(struct wlr_output *output,
+	bool lock);
 /**
  * Renders software cursors. This is a utility function that can be called when
  * compositors render.
  */
 void wlr_output_render_software_cursors(struct wlr_output *output,
 	pixman_region32_t *damage);
+/**
+ * Enable or disable the save-under cache for software cursors.
+ *
+ * When enabled, wlr_output_render_software_cursors saves the pixels below
+ * each software cursor before drawing it. When a software cursor then moves,
+ * the damage event has its software_cursor flag set, and if no frame has been
+ * submitted by the end of the next frame event, the output submits one on its
+ * own: it copies the last frame, restores the saved pixels and draws the
+ * cursors at their new position, without re-rendering the scene.
+ *
+ * wlr_output_damage handles the flag: cursor motion alone doesn't set
+ * needs_frame, but the cursor boxes are included in the buffer damage.
+ *
+ * Only the normal transform is supported. The cache is disabled by default.
+ */
+void wlr_output_enable_cursor_save_under(struct wlr_output *output,
+	bool enabled);
 
 
+/**
+ * Create a cursor. The first cursor displayed uses the hardware cursor plane.
+ * Other cursors, e.g. from other seats, are composited with it in the cursor
+ * plane buffer while they fit in the hardware limits, and fall back to
+ * software cursors otherwise.
+ */
 struct wlr_output_cursor *wlr_output_cursor_create(struct wlr_output *output);
 /**
  * Sets the cursor image. The image must be already scaled for the output.
@@ -15,11 +15,13 @@
 #include <wlr/types/wlr_output.h>
 
 /**
- * Damage tracking requires to keep track of previous frames' damage. To allow
- * damage tracking to work with triple buffering, a history of two frames is
- * required.
+ * Damage tracking requires to keep track of previous frames' damage. The
+ * history starts with two frames, enough for triple buffering, and grows up to
+ * WLR_OUTPUT_DAMAGE_PREVIOUS_MAX when older buffers are handed back (e.g. with
+ * deeper swap chains or after direct scan-out).
  */
 #define WLR_OUTPUT_DAMAGE_PREVIOUS_LEN 2
+#define WLR_OUTPUT_DAMAGE_PREVIOUS_MAX 16
 
 /**
  * Tracks damage for an output.
@@ -37,12 +39,14 @@ struct wlr_output_damage {
 	int max_rects; // max number of damaged rectangles
 
 	pixman_region32_t current; // in output-local coordinates
+	// software cursor motion the output repaints on its own, only included in
+	// the buffer damage, see wlr_output_enable_cursor_save_under
+	pixman_region32_t cursor;
 
-	// circular queue for previous damage
-	pixman_region32_t previous[WLR_OUTPUT_DAMAGE_PREVIOUS_LEN];
-	size_t previous_idx;
-
-	enum wlr_output_state_buffer_type pending_buffer_type;
+	// previous frames' damage, most recent first
+	pixman_region32_t *previous;
+	size_t previous_len; // number of frames with known damage
+	size_t previous_cap;
 
 	struct {
 		struct wl_signal frame;
@@ -54,7 +58,6 @@ struct wlr_output_damage {
 	struct wl_listener output_needs_frame;
 	struct wl_listener output_damage;
 	struct wl_listener output_frame;
-	struct wl_listener output_precommit;
 	struct wl_listener output_commit;
 };
 
@@ -0,0 +1,92 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_OUTPUT_LATENCY_H
+#define WLR_TYPES_WLR_OUTPUT_LATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+/**
+ * Number of histogram buckets, one per millisecond. The last bucket counts
+ * all samples above.
+ */
+#define WLR_OUTPUT_LATENCY_BUCKETS 64
+/**
+ * Number of frames which can be in flight at once, waiting for their
+ * presentation event.
+ */
+#define WLR_OUTPUT_LATENCY_INFLIGHT 4
+
+struct wlr_output;
+
+struct wlr_output_latency_sample {
+	struct wlr_output_latency *latency;
+	uint32_t commit_seq; // see wlr_output.commit_seq
+	// Time between the oldest input event reflected by the frame and the
+	// frame being presented
+	uint32_t latency_usec;
+};
+
+/**
+ * Measures input-to-display latency on an output.
+ *
+ * The compositor reports input events affecting the output's contents with
+ * wlr_output_latency_notify_input. The oldest reported event is attached to
+ * the next committed frame, and each sample is the time between that event
+ * and the presentation of the frame.
+ *
+ * Input timestamps need to be on CLOCK_MONOTONIC, like the ones of the
+ * libinput backend and usually the Wayland backend. X11 backend timestamps
+ * are X server times and give no samples.
+ */
+struct wlr_output_latency {
+	struct wlr_output *output;
+
+	// Number of samples for each latency in milliseconds
+	uint64_t histogram[WLR_OUTPUT_LATENCY_BUCKETS];
+	uint64_t samples;
+	uint32_t max_usec;
+
+	struct {
+		struct wl_signal sample; // struct wlr_output_latency_sample
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	bool input_pending;
+	uint32_t input_msec; // oldest input not committed yet
+
+	struct {
+		bool used;
+		uint32_t commit_seq;
+		uint32_t input_msec;
+	} inflight[WLR_OUTPUT_LATENCY_INFLIGHT];
+
+	struct wl_listener output_commit;
+	struct wl_listener output_present;
+	struct wl_listener output_destroy;
+};
+
+struct wlr_output_latency *wlr_output_latency_create(struct wlr_output *output);
+void wlr_output_latency_destroy(struct wlr_output_latency *latency);
+/**
+ * Report an input event which changes what is displayed on the output, e.g. a
+ * pointer motion moving the cursor or a key press sent to a client shown on
+ * the output. `time_msec` is the timestamp of the input event.
+ */
+void wlr_output_latency_notify_input(struct wlr_output_latency *latency,
+	uint32_t time_msec);
+/**
+ * Clear the histogram.
+ */
+void wlr_output_latency_reset(struct wlr_output_latency *latency);
+
+#endif
@@ -41,6 +41,13 @@ struct wlr_output_manager_v1 {
 
 	struct wl_listener display_destroy;
 
+	// private state
+
+	// Recently tested configurations, most recent first, see
+	// wlr_output_configuration_v1_apply
+	struct wl_list test_results;
+	size_t test_results_len;
+
 	void *data;
 };
 
@@ -130,6 +137,25 @@ void wlr_output_configuration_v1_send_succeeded(
 void wlr_output_configuration_v1_send_failed(
 	struct wlr_output_configuration_v1 *config);
 
+/**
+ * Apply the state of each head in the configuration to its output and test
+ * or commit all of them together, with `wlr_output_test_group` or
+ * `wlr_output_commit_group`. When the backend supports it, this is a single
+ * atomic operation: a rejected configuration leaves all outputs untouched.
+ * Otherwise, some outputs may have been modified when this function fails.
+ *
+ * Only the output state is applied: positions are left to the compositor's
+ * output layout.
+ *
+ * Test results of configurations coming from clients are remembered, so that
+ * switching back and forth between known configurations doesn't need to hit
+ * the backend again. They are forgotten when heads are added or removed.
+ *
+ * Returns true on success.
+ */
+bool wlr_output_configuration_v1_apply(
+	struct wlr_output_configuration_v1 *config, bool test_only);
+
 /**
  * Create a new configuration head for the given output. This adds the head to
  * the provided output configuration.
@@ -0,0 +1,57 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_OUTPUT_MIRROR_H
+#define WLR_TYPES_WLR_OUTPUT_MIRROR_H
+
+#include <stdbool.h>
+#include <wayland-server-core.h>
+
+struct wlr_output;
+
+/**
+ * Displays the frames committed on a source output on a destination output,
+ * without rendering the scene a second time.
+ *
+ * When the destination can scan out the source buffers (same size and
+ * transform, and a format supported by the destination), they are shown
+ * as-is. Otherwise each frame is scaled onto the destination with a single
+ * render pass, keeping the aspect ratio.
+ *
+ * The compositor must not render to the destination output while it is
+ * mirroring. Mode, transform and enabled state of the destination are still
+ * up to the compositor.
+ */
+struct wlr_output_mirror {
+	struct wlr_output *src, *dst;
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wlr_buffer *pending; // source frame waiting for the destination
+	bool scanout_failed; // direct scan-out failed for the current setup
+
+	struct wl_listener src_commit;
+	struct wl_listener src_destroy;
+	struct wl_listener dst_commit;
+	struct wl_listener dst_frame;
+	struct wl_listener dst_destroy;
+};
+
+/**
+ * Start mirroring the source output onto the destination output. The mirror
+ * is destroyed when either output is destroyed.
+ */
+struct wlr_output_mirror *wlr_output_mirror_create(struct wlr_output *src,
+	struct wlr_output *dst);
+void wlr_output_mirror_destroy(struct wlr_output_mirror *mirror);
+
+#endif
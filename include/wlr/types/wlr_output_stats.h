@@ -0,0 +1,112 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_OUTPUT_STATS_H
+#define WLR_TYPES_WLR_OUTPUT_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+/**
+ * Width of a commit-to-present latency histogram bucket, in microseconds.
+ */
+#define WLR_OUTPUT_STATS_BUCKET_USEC 250
+/**
+ * Number of latency histogram buckets. The last bucket counts all samples
+ * above.
+ */
+#define WLR_OUTPUT_STATS_BUCKETS 128
+/**
+ * Number of frames which can be in flight at once, waiting for their
+ * presentation event.
+ */
+#define WLR_OUTPUT_STATS_INFLIGHT 4
+
+struct wlr_output;
+
+/**
+ * Frame timing statistics of an output, to quantify stutter.
+ *
+ * Missed vertical blanks are detected with the vertical retrace counter of
+ * presentation events when the backend provides one, and with the refresh
+ * period otherwise. A frame is late if it missed at least one vertical blank
+ * after being committed.
+ */
+struct wlr_output_stats {
+	struct wlr_output *output;
+
+	uint64_t commits; // commits with a buffer
+	uint64_t presented;
+	// Frames replaced by a later one before being presented
+	uint64_t dropped;
+	uint64_t late;
+	uint64_t missed_vblanks;
+	// Frame events which weren't followed by a buffer commit, e.g. because
+	// wlr_output_damage had nothing to repaint
+	uint64_t idle_frames;
+
+	// Time between the commit and the presentation of frames, in
+	// WLR_OUTPUT_STATS_BUCKET_USEC wide buckets
+	uint64_t latency_histogram[WLR_OUTPUT_STATS_BUCKETS];
+	uint64_t latency_samples;
+	uint32_t latency_max_usec;
+
+	// Render pass durations, in nanoseconds, see wlr_output.events.render_stats
+	uint64_t render_samples;
+	int64_t render_cpu_time_total, render_cpu_time_max;
+	uint64_t render_gpu_samples;
+	int64_t render_gpu_time_total, render_gpu_time_max;
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct {
+		bool used;
+		uint32_t commit_seq;
+		int64_t commit_nsec;
+	} inflight[WLR_OUTPUT_STATS_INFLIGHT];
+
+	int64_t last_present_nsec; // zero if unknown
+	unsigned last_present_seq;
+	bool frame_waiting; // a frame event wasn't followed by a commit yet
+
+	int log_interval; // in milliseconds, zero if disabled
+	struct wl_event_source *log_timer;
+
+	struct wl_listener output_frame;
+	struct wl_listener output_commit;
+	struct wl_listener output_present;
+	struct wl_listener output_render_stats;
+	struct wl_listener output_destroy;
+};
+
+struct wlr_output_stats *wlr_output_stats_create(struct wlr_output *output);
+void wlr_output_stats_destroy(struct wlr_output_stats *stats);
+/**
+ * Get a commit-to-present latency percentile, in microseconds. `percent` is
+ * between 0 and 100. Returns the upper bound of the histogram bucket the
+ * percentile falls in, or zero if there are no samples.
+ */
+uint32_t wlr_output_stats_get_latency_percentile(
+	struct wlr_output_stats *stats, unsigned percent);
+/**
+ * Periodically log a summary of the statistics, every `interval_msec`
+ * milliseconds. Zero disables logging, which is the default.
+ */
+void wlr_output_stats_set_log_interval(struct wlr_output_stats *stats,
+	int interval_msec);
+/**
+ * Clear the statistics.
+ */
+void wlr_output_stats_reset(struct wlr_output_stats *stats);
+
+#endif
@@ -14,6 +14,7 @@
 #include <pixman.h>
 #include <wlr/types/wlr_box.h>
 #include <wlr/types/wlr_seat.h>
+#include <wlr/util/region.h>
 #include "pointer-constraints-unstable-v1-protocol.h"
 
 struct wlr_seat;
@@ -50,6 +51,9 @@ struct wlr_pointer_constraint_v1 {
 
 	struct wlr_pointer_constraint_v1_state current, pending;
 
+	// Index of region, private
+	struct wlr_region_lookup region_lookup;
+
 	struct wl_listener surface_commit;
 	struct wl_listener surface_destroy;
 	struct wl_listener seat_destroy;
@@ -101,5 +105,15 @@ void wlr_pointer_constraint_v1_send_activated(
  */
 void wlr_pointer_constraint_v1_send_deactivated(
 	struct wlr_pointer_constraint_v1 *constraint);
+/**
+ * Confine a pointer motion from (sx1, sy1) to (sx2, sy2) to the constraint's
+ * region, in surface-local coordinates. Same as wlr_region_confine on the
+ * constraint's region, but the region is indexed once per commit instead of
+ * being walked on each motion. Returns false if the start point is outside
+ * of the region.
+ */
+bool wlr_pointer_constraint_v1_confine(
+	struct wlr_pointer_constraint_v1 *constraint, double sx1, double sy1,
+	double sx2, double sy2, double *sx_out, double *sy_out);
 
 #endif
@@ -27,10 +27,14 @@ struct wlr_presentation {
 	} events;
 
 	struct wl_listener display_destroy;
+
+	// private state
+
+	struct wl_list surfaces; // presentation_surface.link
 };
 
 struct wlr_presentation_feedback {
-	struct wlr_presentation *presentation;
+	struct wlr_presentation *presentation; // NULL if it has been destroyed
 	struct wlr_surface *surface; // NULL if the surface has been destroyed
 	struct wl_list link; // wlr_presentation::feedbacks
 
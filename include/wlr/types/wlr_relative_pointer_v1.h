@@ -47,6 +47,9 @@ struct wlr_relative_pointer_v1 {
 	struct wlr_seat *seat;
 	struct wl_list link; // wlr_relative_pointer_manager_v1::relative_pointers
 
+	// Owner of pointer_resource, used to match the focused client. Private.
+	struct wlr_seat_client *seat_client;
+
 	struct {
 		struct wl_signal destroy;
 	} events;
@@ -63,6 +66,14 @@ struct wlr_relative_pointer_manager_v1 *wlr_relative_pointer_manager_v1_create(
 /**
  * Send a relative motion event to the seat. Time is given in microseconds
  * (unlike wl_pointer which uses milliseconds).
+ *
+ * The events are grouped by wl_pointer.frame, which is sent by
+ * wlr_seat_pointer_notify_frame. While the pointer is locked by a
+ * wlr_pointer_constraint_v1, the cursor doesn't move and the pointer focus
+ * can't change. The compositor can then skip wlr_cursor_move, the surface
+ * lookup and wlr_seat_pointer_notify_motion entirely. It only needs to call
+ * this function for each motion event and wlr_seat_pointer_notify_frame on
+ * the cursor frame event.
  */
 void wlr_relative_pointer_manager_v1_send_relative_motion(
 	struct wlr_relative_pointer_manager_v1 *manager, struct wlr_seat *seat,
@@ -0,0 +1,298 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_SCENE_H
+#define WLR_TYPES_WLR_SCENE_H
+
+/**
+ * The scene-graph API provides a declarative way to display surfaces. The
+ * compositor creates a scene, adds surfaces, rectangles and buffers, then
+ * renders the scene on outputs.
+ *
+ * The scene-graph API only supports basic 2D composition operations (like the
+ * KMS API or the Wayland protocol does). For anything more complicated,
+ * compositors need to implement custom rendering logic.
+ *
+ * Damage is tracked per output: changes to the scene only cause the affected
+ * parts of the outputs to be repainted. Nodes fully covered by opaque nodes
+ * above them aren't rendered.
+ */
+
+#include <pixman.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_surface.h>
+
+struct wlr_output;
+struct wlr_output_damage;
+struct wlr_buffer;
+struct wlr_texture;
+struct wlr_renderer;
+
+enum wlr_scene_node_type {
+	WLR_SCENE_NODE_ROOT,
+	WLR_SCENE_NODE_TREE,
+	WLR_SCENE_NODE_SURFACE,
+	WLR_SCENE_NODE_RECT,
+	WLR_SCENE_NODE_BUFFER,
+};
+
+struct wlr_scene_node_state {
+	struct wl_list link; // wlr_scene_node_state.children
+
+	struct wl_list children; // wlr_scene_node_state.link
+
+	bool enabled;
+	int x, y; // relative to parent
+};
+
+/** A node is an object in the scene. */
+struct wlr_scene_node {
+	enum wlr_scene_node_type type;
+	struct wlr_scene_node *parent;
+	struct wlr_scene_node_state state;
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	void *data;
+};
+
+/** The root scene-graph node. */
+/**
+ * Damage debugging modes, selected with the WLR_SCENE_DEBUG_DAMAGE
+ * environment variable.
+ */
+enum wlr_scene_debug_damage_option {
+	WLR_SCENE_DEBUG_DAMAGE_NONE,
+	// Render the whole output on each frame
+	WLR_SCENE_DEBUG_DAMAGE_RERENDER,
+	// Tint the damaged regions, fading out over a short time
+	WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT,
+	// Tint the damaged regions with the number of times each pixel is drawn
+	WLR_SCENE_DEBUG_DAMAGE_OVERDRAW,
+};
+
+struct wlr_scene {
+	struct wlr_scene_node node;
+
+	struct wl_list outputs; // wlr_scene_output.link
+
+	// private state
+
+	enum wlr_scene_debug_damage_option debug_damage_option;
+};
+
+/** A sub-tree in the scene-graph. */
+struct wlr_scene_tree {
+	struct wlr_scene_node node;
+};
+
+/** A scene-graph node displaying a single surface. */
+struct wlr_scene_surface {
+	struct wlr_scene_node node;
+	struct wlr_surface *surface;
+
+	// private state
+
+	struct wl_listener surface_destroy;
+	struct wl_listener surface_commit;
+};
+
+/** A scene-graph node displaying a solid-colored rectangle */
+struct wlr_scene_rect {
+	struct wlr_scene_node node;
+	int width, height;
+	float color[4];
+};
+
+/** A scene-graph node displaying a buffer */
+struct wlr_scene_buffer {
+	struct wlr_scene_node node;
+	struct wlr_buffer *buffer;
+
+	// private state
+
+	struct wlr_texture *texture;
+	struct wlr_renderer *texture_renderer;
+};
+
+/** A viewport for an output in the scene-graph */
+struct wlr_scene_output {
+	struct wlr_output *output;
+	struct wl_list link; // wlr_scene.outputs
+	struct wlr_scene *scene;
+	struct wlr_output_damage *damage;
+
+	int x, y;
+
+	// private state
+
+	// see WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT
+	struct wl_list damage_highlight_regions; // highlight_region.link
+	pixman_region32_t highlight_damage; // added to repaint the highlights
+
+	struct wl_listener damage_destroy;
+};
+
+/**
+ * Immediately destroy the scene-graph node.
+ */
+void wlr_scene_node_destroy(struct wlr_scene_node *node);
+/**
+ * Enable or disable this node. If a node is disabled, all of its children are
+ * implicitly disabled as well.
+ */
+void wlr_scene_node_set_enabled(struct wlr_scene_node *node, bool enabled);
+/**
+ * Set the position of the node relative to its parent.
+ */
+void wlr_scene_node_set_position(struct wlr_scene_node *node, int x, int y);
+/**
+ * Move the node right above the specified sibling.
+ */
+void wlr_scene_node_place_above(struct wlr_scene_node *node,
+	struct wlr_scene_node *sibling);
+/**
+ * Move the node right below the specified sibling.
+ */
+void wlr_scene_node_place_below(struct wlr_scene_node *node,
+	struct wlr_scene_node *sibling);
+/**
+ * Move the node above all of its sibling nodes.
+ */
+void wlr_scene_node_raise_to_top(struct wlr_scene_node *node);
+/**
+ * Move the node below all of its sibling nodes.
+ */
+void wlr_scene_node_lower_to_bottom(struct wlr_scene_node *node);
+/**
+ * Move the node to another location in the tree.
+ */
+void wlr_scene_node_reparent(struct wlr_scene_node *node,
+	struct wlr_scene_node *new_parent);
+/**
+ * Get the node's layout-local coordinates.
+ *
+ * True is returned if the node and all of its ancestors are enabled.
+ */
+bool wlr_scene_node_coords(struct wlr_scene_node *node, int *lx, int *ly);
+/**
+ * Call `iterator` on each surface in the scene-graph, with the surface's
+ * position in layout coordinates. The function is called from root to leaves
+ * (in rendering order).
+ */
+void wlr_scene_node_for_each_surface(struct wlr_scene_node *node,
+	wlr_surface_iterator_func_t iterator, void *user_data);
+/**
+ * Find the topmost node in this scene-graph that contains the point at the
+ * given layout-local coordinates. (For surface nodes, this means accepting
+ * input events at that point.) Returns the node and coordinates relative to
+ * the returned node, or NULL if no node is found at that location.
+ */
+struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
+	double lx, double ly, double *nx, double *ny);
+
+/**
+ * Create a new scene-graph.
+ */
+struct wlr_scene *wlr_scene_create(void);
+/**
+ * Manually render the scene-graph on an output. The compositor needs to call
+ * wlr_renderer_begin before and wlr_renderer_end after calling this function.
+ * Damage is given in output-buffer-local coordinates and can be set to NULL to
+ * disable damage tracking.
+ */
+void wlr_scene_render_output(struct wlr_scene *scene, struct wlr_output *output,
+	int lx, int ly, pixman_region32_t *damage);
+
+/**
+ * Add a node displaying nothing but its children.
+ */
+struct wlr_scene_tree *wlr_scene_tree_create(struct wlr_scene_node *parent);
+
+/**
+ * Add a node displaying a single surface to the scene-graph.
+ *
+ * The child sub-surfaces are ignored, see wlr_scene_subsurface_tree_create.
+ */
+struct wlr_scene_surface *wlr_scene_surface_create(struct wlr_scene_node *parent,
+	struct wlr_surface *surface);
+
+struct wlr_scene_surface *wlr_scene_surface_from_node(
+	struct wlr_scene_node *node);
+
+/**
+ * Add a node displaying a solid-colored rectangle to the scene-graph.
+ */
+struct wlr_scene_rect *wlr_scene_rect_create(struct wlr_scene_node *parent,
+	int width, int height, const float color[static 4]);
+
+/**
+ * Change the width and height of an existing rectangle node.
+ */
+void wlr_scene_rect_set_size(struct wlr_scene_rect *rect, int width, int height);
+
+/**
+ * Change the color of an existing rectangle node.
+ */
+void wlr_scene_rect_set_color(struct wlr_scene_rect *rect, const float color[static 4]);
+
+/**
+ * Add a node displaying a buffer to the scene-graph.
+ *
+ * The buffer is locked until the node is destroyed.
+ */
+struct wlr_scene_buffer *wlr_scene_buffer_create(struct wlr_scene_node *parent,
+	struct wlr_buffer *buffer);
+
+/**
+ * Add a viewport for the specified output to the scene-graph.
+ *
+ * An output can only be added once to the scene-graph.
+ */
+struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
+	struct wlr_output *output);
+/**
+ * Destroy a scene-graph output.
+ */
+void wlr_scene_output_destroy(struct wlr_scene_output *scene_output);
+/**
+ * Set the output's position in the scene-graph.
+ */
+void wlr_scene_output_set_position(struct wlr_scene_output *scene_output,
+	int lx, int ly);
+/**
+ * Render and commit an output. Only the damaged parts of the output are
+ * repainted. If nothing has changed since the last frame, no buffer is
+ * submitted and true is returned.
+ */
+bool wlr_scene_output_commit(struct wlr_scene_output *scene_output);
+/**
+ * Call wlr_surface_send_frame_done() on all enabled surfaces in the scene
+ * which intersect with the output.
+ */
+void wlr_scene_output_send_frame_done(struct wlr_scene_output *scene_output,
+	struct timespec *now);
+/**
+ * Get a scene-graph output from a wlr_output.
+ *
+ * If the output hasn't been added to the scene-graph, returns NULL.
+ */
+struct wlr_scene_output *wlr_scene_get_scene_output(struct wlr_scene *scene,
+	struct wlr_output *output);
+
+/**
+ * Add a node displaying a surface and all of its sub-surfaces to the
+ * scene-graph.
+ */
+struct wlr_scene_node *wlr_scene_subsurface_tree_create(
+	struct wlr_scene_node *parent, struct wlr_surface *surface);
+
+#endif
@@ -9,13 +9,18 @@
 #ifndef WLR_TYPES_WLR_SCREENCOPY_V1_H
 #define WLR_TYPES_WLR_SCREENCOPY_V1_H
 
+#include <pixman.h>
 #include <stdbool.h>
+#include <time.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_box.h>
 
+struct screencopy_readback;
+
 struct wlr_screencopy_manager_v1 {
 	struct wl_global *global;
 	struct wl_list frames; // wlr_screencopy_frame_v1::link
+	struct wl_list readbacks; // private
 
 	struct wl_listener display_destroy;
 
@@ -43,12 +48,15 @@ struct wlr_screencopy_frame_v1 {
 	int stride;
 
 	bool overlay_cursor, cursor_locked;
+	// The hardware cursor is drawn into the frame by the copy itself
+	bool cursor_damage_locked;
 
 	bool with_damage;
 
 	struct wl_shm_buffer *shm_buffer;
 	struct wlr_dmabuf_v1_buffer *dma_buffer;
 
+	struct wl_resource *buffer;
 	struct wl_listener buffer_destroy;
 
 	struct wlr_output *output;
@@ -56,6 +64,13 @@ struct wlr_screencopy_frame_v1 {
 	struct wl_listener output_commit;
 	struct wl_listener output_destroy;
 	struct wl_listener output_enable;
+	struct wl_listener output_capture;
+
+	// Read-back of the output, possibly shared with other frames
+	struct screencopy_readback *readback;
+	struct pixman_region32 read_region; // in output buffer coordinates
+	struct timespec read_when;
+	struct wl_event_source *read_timer;
 
 	void *data;
 };
@@ -52,6 +52,21 @@ struct wlr_seat_client {
 	// set of serials which were sent to the client on this seat
 	// for use by wlr_seat_client_{next_serial,validate_event_serial}
 	struct wlr_serial_ringset serials;
+
+	// pointer events were sent since the last wl_pointer.frame
+	bool needs_pointer_frame;
+	// touch events were sent since the last wl_touch.frame
+	bool needs_touch_frame;
+
+	// private state
+
+	// keyboard state last sent to all of the client's wl_keyboard resources,
+	// used to skip redundant events
+	uint64_t sent_keymap_serial; // 0 if none
+	bool sent_repeat_info_valid;
+	int32_t sent_repeat_rate, sent_repeat_delay;
+	bool sent_modifiers_valid;
+	struct wlr_keyboard_modifiers sent_modifiers;
 };
 
 struct wlr_touch_point {
@@ -116,6 +131,8 @@ struct wlr_touch_grab_interface {
 			struct wlr_touch_point *point);
 	void (*enter)(struct wlr_seat_touch_grab *grab, uint32_t time_msec,
 			struct wlr_touch_point *point);
+	// optional, wlr_seat_touch_send_frame is used if NULL
+	void (*frame)(struct wlr_seat_touch_grab *grab);
 	// XXX this will conflict with the actual touch cancel which is different so
 	// we need to rename this
 	void (*cancel)(struct wlr_seat_touch_grab *grab);
@@ -197,6 +214,8 @@ struct wlr_seat_keyboard_state {
 	} events;
 };
 
+#define WLR_SEAT_TOUCH_SLOTS 16
+
 struct wlr_seat_touch_state {
 	struct wlr_seat *seat;
 	struct wl_list touch_points; // wlr_touch_point::link
@@ -206,9 +225,18 @@ struct wlr_seat_touch_state {
 
 	struct wlr_seat_touch_grab *grab;
 	struct wlr_seat_touch_grab *default_grab;
+
+	// private state
+
+	// set once the compositor sends touch frames, see
+	// wlr_seat_touch_notify_frame
+	bool batch_frames;
+	// touch points with IDs below WLR_SEAT_TOUCH_SLOTS, for fast lookups
+	struct wlr_touch_point *slots[WLR_SEAT_TOUCH_SLOTS];
 };
 
 struct wlr_primary_selection_source;
+struct wlr_hash_map;
 
 struct wlr_seat {
 	struct wl_global *global;
@@ -242,6 +270,9 @@ struct wlr_seat {
 	struct wl_listener primary_selection_source_destroy;
 	struct wl_listener drag_source_destroy;
 
+	// wlr_seat_client by wl_client, private
+	struct wlr_hash_map *client_map;
+
 	struct {
 		struct wl_signal pointer_grab_begin;
 		struct wl_signal pointer_grab_end;
@@ -607,6 +638,13 @@ void wlr_seat_touch_send_up(struct wlr_seat *seat, uint32_t time_msec,
 void wlr_seat_touch_send_motion(struct wlr_seat *seat, uint32_t time_msec,
 		int32_t touch_id, double sx, double sy);
 
+/**
+ * Send a frame event to the clients which received touch events since their
+ * last frame. This function does not respect touch grabs: you probably want
+ * `wlr_seat_touch_notify_frame()` instead.
+ */
+void wlr_seat_touch_send_frame(struct wlr_seat *seat);
+
 /**
  * Notify the seat of a touch down on the given surface. Defers to any grab of
  * the touch device.
@@ -631,6 +669,16 @@ void wlr_seat_touch_notify_up(struct wlr_seat *seat, uint32_t time_msec,
 void wlr_seat_touch_notify_motion(struct wlr_seat *seat, uint32_t time_msec,
 		int32_t touch_id, double sx, double sy);
 
+/**
+ * Notify the seat of a frame event, ending a group of touch events that
+ * happened at the same time. Defers to any grab of the touch device.
+ *
+ * Until this is called for the first time, every touch event is followed by
+ * a frame of its own. Afterwards, the events of all touch points up to the
+ * next frame are grouped together.
+ */
+void wlr_seat_touch_notify_frame(struct wlr_seat *seat);
+
 /**
  * How many touch points are currently down for the seat.
  */
@@ -16,6 +16,7 @@
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_box.h>
 #include <wlr/types/wlr_output.h>
+#include <wlr/util/addon.h>
 
 enum wlr_surface_state_field {
 	WLR_SURFACE_STATE_BUFFER = 1 << 0,
@@ -129,12 +130,39 @@ struct wlr_surface {
 	struct wlr_surface_state current, pending, previous;
 
 	struct wl_list cached; // wlr_surface_state.cached_link
+	// Cached states which have been applied, kept for re-use, private
+	struct wl_list cached_pool; // wlr_surface_state.cached_link
+	size_t cached_pool_len;
+
+	// Bounding box of the surface and its subsurfaces, valid until the next
+	// commit in the surface tree, private
+	struct wlr_box extents;
+	bool extents_valid;
+
+	// Frame callback throttling, see wlr_surface_set_hidden_frame_interval,
+	// private
+	bool hidden;
+	int hidden_frame_interval; // in milliseconds, negative if disabled
+	int64_t last_frame_done; // in milliseconds
+
+	// Commits waiting for their buffer to be ready, private
+	struct wl_list buffer_fences; // surface_buffer_fence.link
+	// Commits waiting for their buffer to be uploaded, private
+	struct wl_list buffer_uploads; // surface_buffer_upload.link
+
+	// Number of descendant subsurfaces holding back a synchronized commit,
+	// private
+	size_t cached_subsurfaces;
 
 	const struct wlr_surface_role *role; // the lifetime-bound role or NULL
 	void *role_data; // role-specific data
 
 	struct {
 		struct wl_signal commit;
+		// Emitted when the client commits, before the pending state is
+		// applied or cached. It can be held back with
+		// wlr_surface_lock_pending.
+		struct wl_signal client_commit;
 		struct wl_signal new_subsurface;
 		struct wl_signal destroy;
 	} events;
@@ -149,6 +177,8 @@ struct wlr_surface {
 
 	struct wl_list current_outputs; // wlr_surface_output::link
 
+	struct wlr_addon_set addons;
+
 	struct wl_listener renderer_destroy;
 
 	void *data;
@@ -240,9 +270,55 @@ void wlr_surface_send_enter(struct wlr_surface *surface,
 void wlr_surface_send_leave(struct wlr_surface *surface,
 		struct wlr_output *output);
 
+/**
+ * Send the frame done event to the frame callbacks of the surface.
+ *
+ * Frame callbacks of hidden surfaces may be held back, see
+ * wlr_surface_set_hidden_frame_interval.
+ */
 void wlr_surface_send_frame_done(struct wlr_surface *surface,
 		const struct timespec *when);
 
+/**
+ * Get the output driving the surface's frame callbacks: the output with the
+ * highest refresh rate among the ones the surface has entered (see
+ * wlr_surface_send_enter). Returns NULL if the surface isn't on any output.
+ */
+struct wlr_output *wlr_surface_get_primary_output(struct wlr_surface *surface);
+
+/**
+ * Send the frame done event to the frame callbacks of the surface, if the
+ * output is the surface's primary output or the surface isn't on any output.
+ * Compositors can call this for each output the surface is rendered on, so
+ * that clients spanning several outputs render at the rate of the fastest
+ * one.
+ */
+void wlr_surface_send_frame_done_for_output(struct wlr_surface *surface,
+		struct wlr_output *output, const struct timespec *when);
+
+/**
+ * Throttle the frame callbacks of the surface tree while it's hidden, so that
+ * clients stop rendering at the display rate when nobody can see them.
+ *
+ * A surface is hidden if it isn't on any output (see wlr_surface_send_enter)
+ * or if its root surface has been marked as hidden with
+ * wlr_surface_set_visible. While hidden, wlr_surface_send_frame_done only
+ * sends frame done events once per interval, or not at all if the interval is
+ * zero. A negative interval (the default) disables throttling.
+ *
+ * This needs to be set on the root surface of the tree.
+ */
+void wlr_surface_set_hidden_frame_interval(struct wlr_surface *surface,
+	int interval_ms);
+
+/**
+ * Mark the surface tree as visible to the user or not, e.g. when the window
+ * is minimized or on another workspace. Surfaces are visible by default.
+ *
+ * This needs to be set on the root surface of the tree.
+ */
+void wlr_surface_set_visible(struct wlr_surface *surface, bool visible);
+
 /**
  * Get the bounding box that contains the surface and all subsurfaces in
  * surface coordinates.
@@ -284,6 +360,45 @@ void wlr_surface_get_effective_damage(struct wlr_surface *surface,
 void wlr_surface_get_buffer_source_box(struct wlr_surface *surface,
 	struct wlr_fbox *box);
 
+/**
+ * Get the surface's opaque region in output-buffer-local coordinates. `x` and
+ * `y` are the position of the surface in output-buffer-local coordinates and
+ * `scale` is the output scale.
+ *
+ * With fractional scales, the region is rounded inwards: it never contains
+ * pixels which aren't fully covered by the surface.
+ */
+void wlr_surface_get_output_opaque_region(struct wlr_surface *surface,
+	int x, int y, float scale, pixman_region32_t *opaque);
+
+/**
+ * An entry in a stack of surfaces, see `wlr_surface_stack_cull`.
+ */
+struct wlr_surface_stack_entry {
+	struct wlr_surface *surface;
+	// Position in output-buffer-local coordinates
+	int x, y;
+	// Set by `wlr_surface_stack_cull`, in output-buffer-local coordinates
+	pixman_region32_t visible;
+};
+
+/**
+ * Compute which parts of a stack of surfaces need to be painted.
+ *
+ * The entries are ordered from bottom to top and their `visible` regions must
+ * be initialized. `region` is the part of the output to repaint (e.g. the
+ * buffer damage), in output-buffer-local coordinates.
+ *
+ * The surfaces are walked from top to bottom. Each entry's `visible` region is
+ * set to the part of `region` covered by the surface but not by the opaque
+ * regions of the surfaces above it. Surfaces with an empty visible region can
+ * be skipped entirely, the others only need to be painted inside their visible
+ * region. On return, `region` contains the parts which aren't covered by any
+ * opaque surface and still need to be cleared.
+ */
+void wlr_surface_stack_cull(struct wlr_surface_stack_entry *entries,
+	size_t entries_len, float scale, pixman_region32_t *region);
+
 /**
  * Acquire a lock for the pending surface state.
  *
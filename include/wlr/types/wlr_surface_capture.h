@@ -0,0 +1,106 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_SURFACE_CAPTURE_H
+#define WLR_TYPES_WLR_SURFACE_CAPTURE_H
+
+#include <stdbool.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_box.h>
+
+struct wlr_allocator;
+struct wlr_backend;
+struct wlr_buffer;
+struct wlr_dmabuf_v1_buffer;
+struct wlr_renderer;
+struct wlr_surface;
+struct wlr_texture;
+
+/**
+ * Helpers to capture the contents of a single window, e.g. the surface of a
+ * wlr_foreign_toplevel_handle_v1, without going through an output. The
+ * capture doesn't depend on the window being visible.
+ */
+
+/**
+ * Render a surface and its subsurfaces into a buffer. The surface tree
+ * extents (see wlr_surface_get_extends) are scaled by the given factor and
+ * rendered at the top-left corner of the buffer, the rest is cleared.
+ */
+bool wlr_surface_capture_render(struct wlr_surface *surface,
+	struct wlr_renderer *renderer, struct wlr_buffer *buffer, float scale);
+/**
+ * Get the DMA-BUF the client committed, if the surface tree consists of that
+ * single buffer, displayed as-is. It's only valid until the next commit of the
+ * surface, since the client may re-use it afterwards. Returns NULL if the
+ * surface tree needs to be rendered instead.
+ */
+struct wlr_dmabuf_v1_buffer *wlr_surface_capture_get_dmabuf(
+	struct wlr_surface *surface);
+
+#define WLR_SURFACE_SNAPSHOT_LEVELS 4
+
+/**
+ * A texture caching the rendered contents of a surface tree, including its
+ * subsurfaces and xdg popups, e.g. for window animations, overviews and live
+ * thumbnails. The tree is only re-rendered when one of its surfaces commits
+ * changes. Once the root surface is unmapped or destroyed, its last contents
+ * are kept.
+ *
+ * Besides the texture at the snapshot scale, levels downscaled by 2, 4 and 8
+ * are rendered on demand, so that small thumbnails never sample a texture
+ * more than twice their size.
+ */
+struct wlr_surface_snapshot {
+	struct wlr_surface *surface; // NULL once destroyed
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wlr_renderer *renderer;
+	struct wlr_allocator *allocator;
+	float scale;
+	struct {
+		struct wlr_buffer *buffer;
+		struct wlr_texture *texture;
+		struct wlr_box extents;
+		bool dirty;
+	} levels[WLR_SURFACE_SNAPSHOT_LEVELS];
+	struct wl_list surfaces; // snapshot_surface.link
+};
+
+/**
+ * Start tracking a surface tree, rendered at the given scale (usually the
+ * scale of the output the window is displayed on) with the backend's
+ * renderer and allocator.
+ */
+struct wlr_surface_snapshot *wlr_surface_snapshot_create(
+	struct wlr_surface *surface, struct wlr_backend *backend, float scale);
+void wlr_surface_snapshot_destroy(struct wlr_surface_snapshot *snapshot);
+/**
+ * Change the scale the tree is rendered at. All levels are re-rendered.
+ */
+void wlr_surface_snapshot_set_scale(struct wlr_surface_snapshot *snapshot,
+	float scale);
+/**
+ * Get a texture to draw the tree at the given scale, re-rendering the
+ * matching level first if needed. The texture covers the surface-local
+ * extents of the tree; the caller scales it to its destination box. It is
+ * owned by the snapshot and valid until the next call.
+ *
+ * Returns NULL if the tree was never rendered. Must not be called between
+ * wlr_renderer_begin and wlr_renderer_end.
+ */
+struct wlr_texture *wlr_surface_snapshot_get_texture(
+	struct wlr_surface_snapshot *snapshot, float scale,
+	struct wlr_box *extents);
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_SURFACE_OUTPUT_TRACKER_H
+#define WLR_TYPES_WLR_SURFACE_OUTPUT_TRACKER_H
+
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_box.h>
+
+struct wlr_output;
+struct wlr_output_layout;
+struct wlr_surface;
+
+#define WLR_SURFACE_OUTPUT_TRACKER_MAX_OUTPUTS 64
+
+/**
+ * Keeps track of the outputs of a layout that surfaces overlap, and sends
+ * wl_surface.enter and leave events when they change. Output boxes are cached
+ * and only refreshed when the layout changes, and a surface's intersections
+ * are only computed again when it moves or is resized, instead of every
+ * surface being checked against every output each frame.
+ *
+ * Only the tracked surfaces receive enter and leave events: compositors add
+ * the subsurfaces and popups they position separately.
+ */
+struct wlr_surface_output_tracker {
+	struct wlr_output_layout *layout;
+	struct wl_list surfaces; // wlr_tracked_surface.link
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wl_array outputs; // struct tracker_output, indexed by mask bit
+
+	struct wl_listener layout_change;
+	struct wl_listener layout_destroy;
+};
+
+struct wlr_tracked_surface {
+	struct wlr_surface_output_tracker *tracker;
+	struct wlr_surface *surface;
+	struct wlr_box box; // layout coordinates
+	// Output with the largest intersection, NULL if none, e.g. to pace frame
+	// callbacks or to pick the preferred buffer scale
+	struct wlr_output *primary_output;
+	struct wl_list link; // wlr_surface_output_tracker.surfaces
+
+	struct {
+		struct wl_signal primary_output; // emitted when it changes
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	uint64_t outputs; // bit i set if the surface overlaps tracker output i
+
+	struct wl_listener surface_destroy;
+};
+
+/**
+ * Create a tracker for the outputs of the layout. It's destroyed along with
+ * the layout.
+ */
+struct wlr_surface_output_tracker *wlr_surface_output_tracker_create(
+	struct wlr_output_layout *layout);
+void wlr_surface_output_tracker_destroy(
+	struct wlr_surface_output_tracker *tracker);
+
+/**
+ * Start tracking a surface. It doesn't overlap any output until its box is
+ * set. The tracked surface is destroyed along with the surface.
+ */
+struct wlr_tracked_surface *wlr_surface_output_tracker_add(
+	struct wlr_surface_output_tracker *tracker, struct wlr_surface *surface);
+/**
+ * Update the box of a tracked surface in layout coordinates, sending enter
+ * and leave events for the outputs it starts or stops overlapping. Setting
+ * the same box again is a no-op.
+ */
+void wlr_tracked_surface_set_box(struct wlr_tracked_surface *tracked,
+	const struct wlr_box *box);
+/**
+ * Stop tracking a surface, sending leave events for all of its outputs.
+ */
+void wlr_tracked_surface_destroy(struct wlr_tracked_surface *tracked);
+
+#endif
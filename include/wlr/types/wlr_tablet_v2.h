@@ -84,6 +84,12 @@ struct wlr_tablet_v2_tablet_tool {
 	uint32_t pressed_buttons[WLR_TABLET_V2_TOOL_BUTTONS_CAP];
 	uint32_t pressed_serials[WLR_TABLET_V2_TOOL_BUTTONS_CAP];
 
+	// Pressure, distance, tilt, rotation and slider updates which differ from
+	// the last value sent by at most this amount (in the units of the
+	// wlr_send_tablet_v2_tablet_tool_* functions) are dropped. Unchanged
+	// values are always dropped. Defaults to 0.
+	double axis_epsilon;
+
 	struct {
 		struct wl_signal set_cursor; // struct wlr_tablet_v2_event_cursor
 	} events;
@@ -37,6 +37,22 @@ struct wlr_virtual_pointer_v1 {
 
 	struct wl_list link;
 
+	// private state
+
+	/**
+	 * Motion requests are coalesced until the next frame request, the next
+	 * event of a different kind or the end of the current event loop
+	 * iteration, whichever comes first. Only one kind is pending at a time.
+	 */
+	enum wlr_virtual_pointer_v1_motion_type {
+		VIRTUAL_POINTER_MOTION_NONE,
+		VIRTUAL_POINTER_MOTION_RELATIVE,
+		VIRTUAL_POINTER_MOTION_ABSOLUTE,
+	} pending_motion_type;
+	struct wlr_event_pointer_motion pending_motion;
+	struct wlr_event_pointer_motion_absolute pending_motion_absolute;
+	struct wl_event_source *flush_idle;
+
 	struct {
 		struct wl_signal destroy; // struct wlr_virtual_pointer_v1*
 	} events;
@@ -11,6 +11,8 @@
 
 #include <wayland-server-core.h>
 
+struct wlr_hash_map;
+
 struct wlr_xdg_activation_token_v1 {
 	struct wlr_xdg_activation_v1 *activation;
 	// The source surface that created the token.
@@ -26,7 +28,8 @@ struct wlr_xdg_activation_token_v1 {
 
 	char *token;
 	struct wl_resource *resource; // can be NULL
-	struct wl_event_source *timeout; // can be NULL
+	int64_t expire_msec; // CLOCK_MONOTONIC, 0 if the token never expires
+	struct wl_list expiry_link; // wlr_xdg_activation_v1.expiry_queue
 
 	struct wl_listener seat_destroy;
 	struct wl_listener surface_destroy;
@@ -46,6 +49,11 @@ struct wlr_xdg_activation_v1 {
 
 	struct wl_global *global;
 
+	struct wlr_hash_map *token_map; // committed tokens by token string
+	// Expiring tokens, soonest first, and the timer for the first one
+	struct wl_list expiry_queue; // wlr_xdg_activation_token_v1.expiry_link
+	struct wl_event_source *expiry_timer;
+
 	struct wl_listener display_destroy;
 };
 
@@ -13,6 +13,8 @@
 
 #define WLR_XDG_FOREIGN_HANDLE_SIZE 37
 
+struct wlr_hash_map;
+
 /**
  * wlr_xdg_foreign_registry is used for storing a list of exported surfaces with
  * the xdg-foreign family of protocols.
@@ -23,6 +25,10 @@
 struct wlr_xdg_foreign_registry {
 	struct wl_list exported_surfaces; // struct wlr_xdg_foreign_exported_surface
 
+	// private state
+
+	struct wlr_hash_map *handle_map; // wlr_xdg_foreign_exported by handle
+
 	struct wl_listener display_destroy;
 	struct {
 		struct wl_signal destroy;
@@ -21,8 +21,14 @@ struct wlr_xdg_output_v1 {
 	int32_t x, y;
 	int32_t width, height;
 
+	// private state
+
+	// Updates waiting for the next wl_output done event
+	bool details_dirty, description_dirty;
+
 	struct wl_listener destroy;
 	struct wl_listener description;
+	struct wl_listener output_done;
 };
 
 struct wlr_xdg_output_manager_v1 {
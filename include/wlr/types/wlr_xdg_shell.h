@@ -44,7 +44,10 @@ struct wlr_xdg_client {
 	struct wl_list link; // wlr_xdg_shell::clients
 
 	uint32_t ping_serial;
-	struct wl_event_source *ping_timer;
+
+	// private state
+
+	struct ping_timer_entry *ping_entry;
 };
 
 struct wlr_xdg_positioner {
@@ -62,6 +65,15 @@ struct wlr_xdg_positioner {
 	} offset;
 };
 
+struct wlr_xdg_popup_unconstrain_cache {
+	bool valid;
+	struct wlr_box box; // in the parent's coordinate system
+	struct wlr_xdg_positioner positioner;
+	struct wlr_box geometry;
+	struct wlr_xdg_positioner result_positioner;
+	struct wlr_box result_geometry;
+};
+
 struct wlr_xdg_popup {
 	struct wlr_xdg_surface *base;
 	struct wl_list link;
@@ -78,6 +90,10 @@ struct wlr_xdg_popup {
 	struct wlr_xdg_positioner positioner;
 
 	struct wl_list grab_link; // wlr_xdg_popup_grab::popups
+
+	// private state
+
+	struct wlr_xdg_popup_unconstrain_cache unconstrain_cache;
 };
 
 // each seat gets a popup grab
@@ -353,6 +369,15 @@ void wlr_xdg_popup_get_toplevel_coords(struct wlr_xdg_popup *popup,
 void wlr_xdg_popup_unconstrain_from_box(struct wlr_xdg_popup *popup,
 		const struct wlr_box *toplevel_sx_box);
 
+/**
+ * Unconstrain all popups of this xdg-surface, including nested ones, from the
+ * box. The box should be in the root toplevel parent surface coordinate
+ * system. This is cheaper than calling wlr_xdg_popup_unconstrain_from_box()
+ * for each popup of a deep popup chain.
+ */
+void wlr_xdg_surface_unconstrain_popups(struct wlr_xdg_surface *surface,
+		const struct wlr_box *toplevel_sx_box);
+
 /**
   Invert the right/left anchor and gravity for this positioner. This can be
   used to "flip" the positioner around the anchor rect in the x direction.
@@ -420,4 +445,73 @@ void wlr_xdg_surface_for_each_popup_surface(struct wlr_xdg_surface *surface,
  */
 uint32_t wlr_xdg_surface_schedule_configure(struct wlr_xdg_surface *surface);
 
+/**
+ * A configure transaction groups state changes of several xdg-surfaces into a
+ * single configure round.
+ *
+ * The compositor adds surfaces to the transaction, changes their state with
+ * the usual functions (e.g. wlr_xdg_toplevel_set_size()) and then commits the
+ * transaction. All pending configures are sent at once, and the `ready` event
+ * is emitted when every participant has acked its configure and committed a
+ * buffer for it, or when the timeout expires. This allows compositors to lay
+ * out many surfaces at once and display the new state in a single frame.
+ *
+ * The transaction is destroyed right after the `ready` event is emitted.
+ */
+struct wlr_xdg_configure_transaction {
+	struct wl_list surfaces; // wlr_xdg_configure_transaction_surface.link
+	size_t pending; // number of surfaces which haven't committed yet
+	bool timed_out; // true if `ready` was emitted because of the timeout
+
+	struct {
+		struct wl_signal ready;
+		struct wl_signal destroy;
+	} events;
+
+	void *data;
+
+	// private state
+
+	struct wl_display *display;
+	struct wl_event_source *timer;
+	bool committed;
+};
+
+struct wlr_xdg_configure_transaction_surface {
+	struct wlr_xdg_configure_transaction *transaction;
+	struct wlr_xdg_surface *surface;
+	struct wl_list link; // wlr_xdg_configure_transaction.surfaces
+
+	// private state
+
+	uint32_t serial; // 0 if no configure was sent
+	bool done;
+
+	struct wl_listener surface_commit;
+	struct wl_listener surface_destroy;
+};
+
+struct wlr_xdg_configure_transaction *wlr_xdg_configure_transaction_create(
+	struct wl_display *display);
+/**
+ * Destroy the transaction without emitting the `ready` event.
+ */
+void wlr_xdg_configure_transaction_destroy(
+	struct wlr_xdg_configure_transaction *transaction);
+/**
+ * Add a surface to the transaction. This must be done before the transaction
+ * is committed. Adding the same surface twice is a no-op.
+ */
+bool wlr_xdg_configure_transaction_add_surface(
+	struct wlr_xdg_configure_transaction *transaction,
+	struct wlr_xdg_surface *surface);
+/**
+ * Send the pending configures of all participants. If `timeout_ms` is
+ * non-zero, the `ready` event is emitted after this delay even if some
+ * surfaces didn't commit yet. If no participant has a pending configure, the
+ * `ready` event is emitted immediately.
+ */
+void wlr_xdg_configure_transaction_commit(
+	struct wlr_xdg_configure_transaction *transaction, uint32_t timeout_ms);
+
 #endif
@@ -0,0 +1,63 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_UTIL_ADDON_H
+#define WLR_UTIL_ADDON_H
+
+#include <wayland-server-core.h>
+
+/**
+ * A set of addons attached to an object. Addons let other parts of wlroots
+ * and compositors associate data with an object, e.g. a renderer caching a
+ * texture for a buffer, and find it back without a global lookup.
+ */
+struct wlr_addon_set {
+	// private state
+	struct wl_list addons;
+};
+
+struct wlr_addon;
+
+struct wlr_addon_interface {
+	const char *name;
+	// Called when the object the addon is attached to is destroyed. Must
+	// call wlr_addon_finish.
+	void (*destroy)(struct wlr_addon *addon);
+};
+
+struct wlr_addon {
+	const struct wlr_addon_interface *impl;
+	// private state
+	const void *owner;
+	struct wl_list link;
+};
+
+void wlr_addon_set_init(struct wlr_addon_set *set);
+/**
+ * Destroy all addons of the set. Called by the object owning the set, when
+ * it's destroyed.
+ */
+void wlr_addon_set_finish(struct wlr_addon_set *set);
+
+/**
+ * Attach an addon to a set. There can be at most one addon with the same
+ * owner and interface in a set.
+ */
+void wlr_addon_init(struct wlr_addon *addon, struct wlr_addon_set *set,
+	const void *owner, const struct wlr_addon_interface *impl);
+void wlr_addon_finish(struct wlr_addon *addon);
+
+/**
+ * Find the addon with the given owner and interface, or NULL if there is
+ * none. The addon found is moved to the front of the set, so that repeated
+ * lookups of the same addon are constant time.
+ */
+struct wlr_addon *wlr_addon_find(struct wlr_addon_set *set, const void *owner,
+	const struct wlr_addon_interface *impl);
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_UTIL_ALLOC_STATS_H
+#define WLR_UTIL_ALLOC_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct wl_display;
+
+/**
+ * Allocation counters of one of the pools wlroots keeps for frequently
+ * created protocol objects, such as regions, surface outputs and
+ * presentation feedbacks.
+ */
+struct wlr_alloc_stats {
+	const char *name;
+	size_t object_size;
+	uint64_t allocated; // objects handed out, re-used ones included
+	uint64_t reused; // allocations served from the pool instead of malloc
+	uint64_t freed;
+	size_t live; // objects currently in use
+	size_t cached; // freed objects kept for re-use
+};
+
+/**
+ * Fill the array with the counters of up to len pools which have been used
+ * so far by the display. Returns the total number of such pools.
+ */
+size_t wlr_alloc_stats_get(struct wl_display *display,
+	struct wlr_alloc_stats *stats, size_t len);
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_UTIL_EVENT_LOOP_H
+#define WLR_UTIL_EVENT_LOOP_H
+
+#include <wayland-server-core.h>
+
+/**
+ * Dispatch the display's event loop once, like wl_event_loop_dispatch, but
+ * process pending backend events (DRM page-flips, input, session) before and
+ * after the other sources, so that they aren't delayed by busy clients.
+ *
+ * Compositors can replace wl_display_run with:
+ *
+ *     while (running) {
+ *         wl_display_flush_clients(display);
+ *         wlr_display_dispatch(display, -1);
+ *     }
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int wlr_display_dispatch(struct wl_display *display, int timeout);
+
+#endif
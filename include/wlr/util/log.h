@@ -19,6 +19,7 @@
 
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 
@@ -42,6 +43,18 @@ void wlr_log_init(enum wlr_log_importance verbosity, wlr_log_func_t callback);
 // Returns the log verbosity provided to wlr_log_init
 enum wlr_log_importance wlr_log_get_verbosity(void);
 
+// Keeps the last `len` messages less than or equal to `verbosity` in memory,
+// whether they are logged or not. Recording a message only costs formatting
+// it, so this can be used to keep debug messages around for post-mortem
+// analysis without printing them. A zero `len` disables the history.
+// Returns false on allocation failure.
+bool wlr_log_set_history(enum wlr_log_importance verbosity, size_t len);
+
+// Writes the messages of the history to `fd`, oldest first. This only uses
+// write(2) and doesn't wait for locks, so it can be called from a crash signal
+// handler.
+void wlr_log_dump_history(int fd);
+
 #ifdef __GNUC__
 #define _WLR_ATTRIB_PRINTF(start, end) __attribute__((format(printf, start, end)))
 #else
@@ -0,0 +1,42 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_UTIL_REALTIME_H
+#define WLR_UTIL_REALTIME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct wlr_realtime_options {
+	// SCHED_FIFO or SCHED_RR, SCHED_OTHER to leave the policy unchanged
+	int policy;
+	// Static priority, 0 picks the lowest one of the policy
+	int priority;
+	// CPUs to run on, none to leave the affinity unchanged
+	const int *cpus;
+	size_t cpus_len;
+};
+
+/**
+ * Give the calling thread a real-time scheduling policy and CPU affinity, so
+ * that page-flip and input events are handled on time even when all CPUs are
+ * busy. Call it from the thread dispatching the display, wlroots handles
+ * backend events there (see wlr_display_dispatch).
+ *
+ * The policy isn't inherited by child processes such as Xwayland or clients
+ * spawned by the compositor, nor by the worker threads wlroots starts later
+ * on. The process needs CAP_SYS_NICE or a suitable
+ * RLIMIT_RTPRIO, compositors without either can get the thread promoted by
+ * rtkit with the thread ID.
+ *
+ * Setting the same options from the WLR_REALTIME and WLR_REALTIME_CPUS
+ * environment variables is handled by wlr_backend_autocreate.
+ */
+bool wlr_realtime_set_thread(const struct wlr_realtime_options *options);
+
+#endif
@@ -56,4 +56,50 @@ void wlr_region_rotated_bounds(pixman_region32_t *dst, pixman_region32_t *src,
 bool wlr_region_confine(pixman_region32_t *region, double x1, double y1, double x2,
 	double y2, double *x2_out, double *y2_out);
 
+struct wlr_region_lookup_band {
+	int32_t y1, y2;
+	int start, end; // range of rectangles in the band
+};
+
+/**
+ * A copy of a region indexed for point lookups in logarithmic time, for
+ * regions queried much more often than they change.
+ */
+struct wlr_region_lookup {
+	pixman_box32_t *rects; // sorted by band, then by x
+	int nrects;
+	struct wlr_region_lookup_band *bands; // sorted by y
+	int nbands;
+};
+
+/**
+ * Build the index of a region. Returns false on allocation failure, in which
+ * case the lookup is empty.
+ */
+bool wlr_region_lookup_init(struct wlr_region_lookup *lookup,
+	const pixman_region32_t *region);
+void wlr_region_lookup_finish(struct wlr_region_lookup *lookup);
+/**
+ * Check whether the region contains the point. If it does and box isn't NULL,
+ * box is set to the rectangle containing it.
+ */
+bool wlr_region_lookup_contains_point(const struct wlr_region_lookup *lookup,
+	int x, int y, pixman_box32_t *box);
+/**
+ * Same as wlr_region_confine, with an indexed region.
+ */
+bool wlr_region_lookup_confine(const struct wlr_region_lookup *lookup,
+	double x1, double y1, double x2, double y2, double *x2_out, double *y2_out);
+
+/**
+ * Merges the rectangles of a region so that it's made of at most `max_rects`
+ * rectangles. The resulting region contains the original one.
+ *
+ * Rectangles are merged with the ones which add the fewest extra pixels, so
+ * that the area to repaint stays small. Regions which already have few
+ * enough rectangles are copied as-is.
+ */
+void wlr_region_coalesce(pixman_region32_t *dst, pixman_region32_t *src,
+	int max_rects);
+
 #endif
@@ -61,14 +61,28 @@ struct wlr_xcursor {
 	uint32_t total_delay; /* length of the animation in ms */
 };
 
+struct xcursor_file_entry;
+struct xcursor_cache;
+
 /**
  * Container for an Xcursor theme.
+ *
+ * Cursors are decoded on first use: cursors only contains the cursors which
+ * have been looked up with wlr_xcursor_theme_get_cursor.
  */
 struct wlr_xcursor_theme {
 	unsigned int cursor_count;
 	struct wlr_xcursor **cursors;
 	char *name;
 	int size;
+
+	// private state
+
+	// cursor files which haven't been decoded yet
+	unsigned int entry_count;
+	struct xcursor_file_entry **entries;
+	// if non-NULL, the cursor images live in the cache mapping
+	struct xcursor_cache *cache;
 };
 
 /**
@@ -33,7 +33,9 @@ struct wlr_xwayland_server {
 	char display_name[16];
 	int x_fd[2];
 	struct wl_event_source *x_fd_read_event[2];
+	struct wl_event_source *standby_timer;
 	bool lazy;
+	bool standby;
 	bool enable_wm;
 
 	struct wl_display *wl_display;
@@ -51,6 +53,13 @@ struct wlr_xwayland_server {
 
 struct wlr_xwayland_server_options {
 	bool lazy;
+	/**
+	 * Like lazy, but Xwayland is also started in the background shortly
+	 * after the compositor starts, or after Xwayland exits. This hides the
+	 * startup delay from the first X11 client without slowing down the
+	 * compositor startup. Implies lazy.
+	 */
+	bool standby;
 	bool enable_wm;
 };
 
@@ -179,7 +188,6 @@ struct wlr_xwayland_surface {
 	struct wlr_xwayland_surface_size_hints *size_hints;
 
 	bool pinging;
-	struct wl_event_source *ping_timer;
 
 	// _NET_WM_STATE
 	bool modal;
@@ -210,13 +218,55 @@ struct wlr_xwayland_surface {
 		struct wl_signal set_hints;
 		struct wl_signal set_decorations;
 		struct wl_signal set_override_redirect;
-		struct wl_signal set_geometry;
+		struct wl_signal set_geometry; // wlr_xwayland_surface_set_geometry_event
 		struct wl_signal ping_timeout;
+		// Emitted when the client has redrawn after a resize, for clients
+		// supporting _NET_WM_SYNC_REQUEST. The surface geometry is the acked
+		// one.
+		struct wl_signal configure_acked;
 	} events;
 
 	struct wl_listener surface_destroy;
 
 	void *data;
+
+	// private state
+
+	// A ConfigureRequest has been received since the last configure
+	bool configure_requested;
+	// Current value of the _NET_WM_STATE property, if known
+	xcb_atom_t net_wm_state[6];
+	size_t net_wm_state_len;
+	bool net_wm_state_valid;
+
+	struct ping_timer_entry *ping_entry; // created on the first ping
+
+	// _NET_WM_SYNC_REQUEST: while the client hasn't redrawn after a resize,
+	// the latest configure is held back
+	uint32_t sync_counter; // xcb_sync_counter_t, zero if unsupported
+	uint32_t sync_alarm; // xcb_sync_alarm_t
+	uint64_t sync_value; // value of the last sync request
+	bool sync_pending;
+	struct wl_event_source *sync_timer;
+	struct {
+		bool set;
+		int16_t x, y;
+		uint16_t width, height;
+	} sync_next_configure;
+};
+
+/**
+ * Emitted when the X11 window geometry changes from the X server side, e.g.
+ * when an override-redirect window moves or resizes itself. Compositors can
+ * damage the old and new boxes instead of the whole output, and skip damaging
+ * the surface contents on a position-only change.
+ */
+struct wlr_xwayland_surface_set_geometry_event {
+	struct wlr_xwayland_surface *surface;
+	// Geometry before the change, the new one is in the surface
+	int16_t old_x, old_y;
+	uint16_t old_width, old_height;
+	bool moved, resized;
 };
 
 struct wlr_xwayland_surface_configure_event {
@@ -253,6 +303,14 @@ void wlr_xwayland_server_destroy(struct wlr_xwayland_server *server);
 struct wlr_xwayland *wlr_xwayland_create(struct wl_display *wl_display,
 	struct wlr_compositor *compositor, bool lazy);
 
+/**
+ * Create an Xwayland server and XWM with custom server options. The
+ * enable_wm option is ignored, the XWM is always enabled.
+ */
+struct wlr_xwayland *wlr_xwayland_create_with_options(
+	struct wl_display *wl_display, struct wlr_compositor *compositor,
+	const struct wlr_xwayland_server_options *options);
+
 void wlr_xwayland_destroy(struct wlr_xwayland *wlr_xwayland);
 
 void wlr_xwayland_set_cursor(struct wlr_xwayland *wlr_xwayland,
@@ -270,6 +328,12 @@ void wlr_xwayland_surface_activate(struct wlr_xwayland_surface *surface,
 void wlr_xwayland_surface_restack(struct wlr_xwayland_surface *surface,
 	struct wlr_xwayland_surface *sibling, enum xcb_stack_mode_t mode);
 
+/**
+ * Send a configure to the X11 window. If the client supports
+ * _NET_WM_SYNC_REQUEST, configures are throttled to its redraw rate during
+ * resizes: only the latest one is sent once the client has redrawn, see the
+ * configure_acked event.
+ */
 void wlr_xwayland_surface_configure(struct wlr_xwayland_surface *surface,
 	int16_t x, int16_t y, uint16_t width, uint16_t height);
 
@@ -0,0 +1,37 @@
+#ifndef XCURSOR_CACHE_H
+#define XCURSOR_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <wlr/xcursor.h>
+#include "xcursor/xcursor.h"
+
+/**
+ * A decoded cursor theme, stored in a file under $XDG_CACHE_HOME and mapped
+ * read-only. Identical images are only stored once, and all processes using
+ * the same theme at the same size share the same pages.
+ */
+struct xcursor_cache {
+	void *data;
+	size_t len;
+};
+
+/**
+ * Map the cache of a theme at the given size. Returns NULL if there is no
+ * cache, or if the theme files have changed since it was written.
+ */
+struct xcursor_cache *xcursor_cache_open(const char *theme, int size);
+void xcursor_cache_destroy(struct xcursor_cache *cache);
+/**
+ * Decode the cursor files and write them to the cache of the theme.
+ */
+bool xcursor_cache_write(const char *theme, int size,
+	XcursorFileEntry *const *entries, size_t entries_len);
+/**
+ * Create the cursors of the cache. The image buffers point into the cache
+ * mapping and must not be freed.
+ */
+bool xcursor_cache_load_cursors(struct xcursor_cache *cache,
+	struct wlr_xcursor_theme *theme);
+
+#endif
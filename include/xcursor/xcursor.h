@@ -64,4 +64,28 @@ void
 xcursor_load_theme(const char *theme, int size,
 		    void (*load_callback)(XcursorImages *, void *),
 		    void *user_data);
+
+/*
+ * A cursor file of a theme whose images haven't been decoded yet
+ */
+typedef struct xcursor_file_entry XcursorFileEntry;
+
+void
+xcursor_index_theme(const char *theme, int size,
+		    void (*index_callback)(XcursorFileEntry *, void *),
+		    void *user_data);
+
+const char *
+XcursorFileEntryName (const XcursorFileEntry *entry);
+
+XcursorImages *
+XcursorFileEntryLoadImages (const XcursorFileEntry *entry);
+
+void
+XcursorFileEntryDestroy (XcursorFileEntry *entry);
+
+void
+xcursor_theme_files(const char *theme,
+		    void (*file_callback)(const char *, void *),
+		    void *user_data);
 #endif
@@ -3,10 +3,16 @@
 
 #include <xcb/xfixes.h>
 
+// Bounds of the size of a selection chunk, the actual size depends on the
+// maximum request length of the X server
 #define INCR_CHUNK_SIZE (64 * 1024)
+#define MAX_INCR_CHUNK_SIZE (4 * 1024 * 1024)
 
 #define XDND_VERSION 5
 
+// Maximum number of atom names kept in wlr_xwm.atom_names
+#define MAX_CACHED_ATOM_NAMES 1024
+
 struct wlr_primary_selection_source;
 
 struct wlr_xwm_selection;
@@ -39,6 +45,16 @@ struct wlr_xwm_selection {
 	xcb_window_t owner;
 	xcb_timestamp_t timestamp;
 
+	// TARGETS of the X11 owner, reused until the owner or the selection
+	// timestamp changes
+	struct {
+		bool valid;
+		bool pending; // not offered yet, no X11 surface was focused
+		xcb_window_t owner;
+		xcb_timestamp_t timestamp;
+		struct wl_array atoms; // xcb_atom_t
+	} targets;
+
 	struct wl_list incoming;
 	struct wl_list outgoing;
 };
@@ -61,6 +77,20 @@ void xwm_selection_transfer_destroy(
 void xwm_selection_transfer_destroy_outgoing(
 	struct wlr_xwm_selection_transfer *transfer);
 
+/**
+ * Atom names are looked up once per X server: the server never renames or
+ * frees an atom.
+ */
+struct xwm_atom_name {
+	xcb_atom_t atom;
+	char *name;
+};
+
+const char *xwm_atom_cache_get_name(struct wlr_xwm *xwm, xcb_atom_t atom);
+void xwm_atom_cache_add(struct wlr_xwm *xwm, xcb_atom_t atom,
+	const char *name, size_t len);
+void xwm_atom_cache_finish(struct wlr_xwm *xwm);
+
 xcb_atom_t xwm_mime_type_to_atom(struct wlr_xwm *xwm, char *mime_type);
 char *xwm_mime_type_from_atom(struct wlr_xwm *xwm, xcb_atom_t atom);
 struct wlr_xwm_selection *xwm_get_selection(struct wlr_xwm *xwm,
@@ -77,6 +107,11 @@ void xwm_handle_selection_notify(struct wlr_xwm *xwm,
 	xcb_selection_notify_event_t *event);
 int xwm_handle_xfixes_selection_notify(struct wlr_xwm *xwm,
 	xcb_xfixes_selection_notify_event_t *event);
+/**
+ * Offer the X11 selections which were held back while no X11 surface was
+ * focused.
+ */
+void xwm_selection_offer_pending(struct wlr_xwm *xwm);
 bool data_source_is_xwayland(struct wlr_data_source *wlr_source);
 bool primary_selection_source_is_xwayland(
 	struct wlr_primary_selection_source *wlr_source);
@@ -15,77 +15,99 @@
  */
 #define XCB_EVENT_RESPONSE_TYPE_MASK (0x7f)
 
+/**
+ * The atoms interned by the XWM, as ATOM(enum name, atom name) entries. Used to
+ * generate both enum atom_name and atom_map, which keeps them in sync.
+ */
+#define XWM_ATOMS(ATOM) \
+	ATOM(WL_SURFACE_ID, "WL_SURFACE_ID") \
+	ATOM(WM_DELETE_WINDOW, "WM_DELETE_WINDOW") \
+	ATOM(WM_PROTOCOLS, "WM_PROTOCOLS") \
+	ATOM(WM_HINTS, "WM_HINTS") \
+	ATOM(WM_NORMAL_HINTS, "WM_NORMAL_HINTS") \
+	ATOM(WM_SIZE_HINTS, "WM_SIZE_HINTS") \
+	ATOM(WM_WINDOW_ROLE, "WM_WINDOW_ROLE") \
+	ATOM(MOTIF_WM_HINTS, "_MOTIF_WM_HINTS") \
+	ATOM(UTF8_STRING, "UTF8_STRING") \
+	ATOM(WM_S0, "WM_S0") \
+	ATOM(NET_SUPPORTED, "_NET_SUPPORTED") \
+	ATOM(NET_WM_CM_S0, "_NET_WM_CM_S0") \
+	ATOM(NET_WM_PID, "_NET_WM_PID") \
+	ATOM(NET_WM_NAME, "_NET_WM_NAME") \
+	ATOM(NET_WM_STATE, "_NET_WM_STATE") \
+	ATOM(NET_WM_WINDOW_TYPE, "_NET_WM_WINDOW_TYPE") \
+	ATOM(WM_TAKE_FOCUS, "WM_TAKE_FOCUS") \
+	ATOM(WINDOW, "WINDOW") \
+	ATOM(NET_ACTIVE_WINDOW, "_NET_ACTIVE_WINDOW") \
+	ATOM(NET_WM_MOVERESIZE, "_NET_WM_MOVERESIZE") \
+	ATOM(NET_SUPPORTING_WM_CHECK, "_NET_SUPPORTING_WM_CHECK") \
+	ATOM(NET_WM_STATE_FOCUSED, "_NET_WM_STATE_FOCUSED") \
+	ATOM(NET_WM_STATE_MODAL, "_NET_WM_STATE_MODAL") \
+	ATOM(NET_WM_STATE_FULLSCREEN, "_NET_WM_STATE_FULLSCREEN") \
+	ATOM(NET_WM_STATE_MAXIMIZED_VERT, "_NET_WM_STATE_MAXIMIZED_VERT") \
+	ATOM(NET_WM_STATE_MAXIMIZED_HORZ, "_NET_WM_STATE_MAXIMIZED_HORZ") \
+	ATOM(NET_WM_STATE_HIDDEN, "_NET_WM_STATE_HIDDEN") \
+	ATOM(NET_WM_PING, "_NET_WM_PING") \
+	ATOM(NET_WM_SYNC_REQUEST, "_NET_WM_SYNC_REQUEST") \
+	ATOM(NET_WM_SYNC_REQUEST_COUNTER, "_NET_WM_SYNC_REQUEST_COUNTER") \
+	ATOM(WM_CHANGE_STATE, "WM_CHANGE_STATE") \
+	ATOM(WM_STATE, "WM_STATE") \
+	ATOM(CLIPBOARD, "CLIPBOARD") \
+	ATOM(PRIMARY, "PRIMARY") \
+	ATOM(WL_SELECTION, "_WL_SELECTION") \
+	ATOM(TARGETS, "TARGETS") \
+	ATOM(CLIPBOARD_MANAGER, "CLIPBOARD_MANAGER") \
+	ATOM(INCR, "INCR") \
+	ATOM(TEXT, "TEXT") \
+	ATOM(TIMESTAMP, "TIMESTAMP") \
+	ATOM(DELETE, "DELETE") \
+	ATOM(NET_WM_WINDOW_TYPE_NORMAL, "_NET_WM_WINDOW_TYPE_NORMAL") \
+	ATOM(NET_WM_WINDOW_TYPE_UTILITY, "_NET_WM_WINDOW_TYPE_UTILITY") \
+	ATOM(NET_WM_WINDOW_TYPE_TOOLTIP, "_NET_WM_WINDOW_TYPE_TOOLTIP") \
+	ATOM(NET_WM_WINDOW_TYPE_DND, "_NET_WM_WINDOW_TYPE_DND") \
+	ATOM(NET_WM_WINDOW_TYPE_DROPDOWN_MENU, "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU") \
+	ATOM(NET_WM_WINDOW_TYPE_POPUP_MENU, "_NET_WM_WINDOW_TYPE_POPUP_MENU") \
+	ATOM(NET_WM_WINDOW_TYPE_COMBO, "_NET_WM_WINDOW_TYPE_COMBO") \
+	ATOM(NET_WM_WINDOW_TYPE_MENU, "_NET_WM_WINDOW_TYPE_MENU") \
+	ATOM(NET_WM_WINDOW_TYPE_NOTIFICATION, "_NET_WM_WINDOW_TYPE_NOTIFICATION") \
+	ATOM(NET_WM_WINDOW_TYPE_SPLASH, "_NET_WM_WINDOW_TYPE_SPLASH") \
+	ATOM(DND_SELECTION, "XdndSelection") \
+	ATOM(DND_AWARE, "XdndAware") \
+	ATOM(DND_STATUS, "XdndStatus") \
+	ATOM(DND_POSITION, "XdndPosition") \
+	ATOM(DND_ENTER, "XdndEnter") \
+	ATOM(DND_LEAVE, "XdndLeave") \
+	ATOM(DND_DROP, "XdndDrop") \
+	ATOM(DND_FINISHED, "XdndFinished") \
+	ATOM(DND_PROXY, "XdndProxy") \
+	ATOM(DND_TYPE_LIST, "XdndTypeList") \
+	ATOM(DND_ACTION_MOVE, "XdndActionMove") \
+	ATOM(DND_ACTION_COPY, "XdndActionCopy") \
+	ATOM(DND_ACTION_ASK, "XdndActionAsk") \
+	ATOM(DND_ACTION_PRIVATE, "XdndActionPrivate") \
+	ATOM(NET_CLIENT_LIST, "_NET_CLIENT_LIST") \
+	ATOM(NET_CLIENT_LIST_STACKING, "_NET_CLIENT_LIST_STACKING")
+
 enum atom_name {
-	WL_SURFACE_ID,
-	WM_DELETE_WINDOW,
-	WM_PROTOCOLS,
-	WM_HINTS,
-	WM_NORMAL_HINTS,
-	WM_SIZE_HINTS,
-	WM_WINDOW_ROLE,
-	MOTIF_WM_HINTS,
-	UTF8_STRING,
-	WM_S0,
-	NET_SUPPORTED,
-	NET_WM_CM_S0,
-	NET_WM_PID,
-	NET_WM_NAME,
-	NET_WM_STATE,
-	NET_WM_WINDOW_TYPE,
-	WM_TAKE_FOCUS,
-	WINDOW,
-	NET_ACTIVE_WINDOW,
-	NET_WM_MOVERESIZE,
-	NET_SUPPORTING_WM_CHECK,
-	NET_WM_STATE_FOCUSED,
-	NET_WM_STATE_MODAL,
-	NET_WM_STATE_FULLSCREEN,
-	NET_WM_STATE_MAXIMIZED_VERT,
-	NET_WM_STATE_MAXIMIZED_HORZ,
-	NET_WM_STATE_HIDDEN,
-	NET_WM_PING,
-	WM_CHANGE_STATE,
-	WM_STATE,
-	CLIPBOARD,
-	PRIMARY,
-	WL_SELECTION,
-	TARGETS,
-	CLIPBOARD_MANAGER,
-	INCR,
-	TEXT,
-	TIMESTAMP,
-	DELETE,
-	NET_WM_WINDOW_TYPE_NORMAL,
-	NET_WM_WINDOW_TYPE_UTILITY,
-	NET_WM_WINDOW_TYPE_TOOLTIP,
-	NET_WM_WINDOW_TYPE_DND,
-	NET_WM_WINDOW_TYPE_DROPDOWN_MENU,
-	NET_WM_WINDOW_TYPE_POPUP_MENU,
-	NET_WM_WINDOW_TYPE_COMBO,
-	NET_WM_WINDOW_TYPE_MENU,
-	NET_WM_WINDOW_TYPE_NOTIFICATION,
-	NET_WM_WINDOW_TYPE_SPLASH,
-	DND_SELECTION,
-	DND_AWARE,
-	DND_STATUS,
-	DND_POSITION,
-	DND_ENTER,
-	DND_LEAVE,
-	DND_DROP,
-	DND_FINISHED,
-	DND_PROXY,
-	DND_TYPE_LIST,
-	DND_ACTION_MOVE,
-	DND_ACTION_COPY,
-	DND_ACTION_ASK,
-	DND_ACTION_PRIVATE,
-	NET_CLIENT_LIST,
-	NET_CLIENT_LIST_STACKING,
+#define ATOM_ENUM(name, str) name,
+	XWM_ATOMS(ATOM_ENUM)
+#undef ATOM_ENUM
 	ATOM_LAST // keep last
 };
 
 extern const char *const atom_map[ATOM_LAST];
 
+struct wlr_hash_map;
+
+/**
+ * Hash map from a 32-bit ID to a surface. Keys point to the ID stored in the
+ * surface. Zero isn't a valid key.
+ */
+struct xwm_surface_map {
+	struct wlr_hash_map *map; // NULL until the first insertion
+	bool incomplete; // an insertion failed, lookups must fall back to a scan
+};
+
 struct wlr_xwm {
 	struct wlr_xwayland *xwayland;
 	struct wl_event_source *event_source;
@@ -104,6 +126,8 @@ struct wlr_xwm {
 	struct wlr_xwm_selection clipboard_selection;
 	struct wlr_xwm_selection primary_selection;
 	struct wlr_xwm_selection dnd_selection;
+	size_t incr_chunk_size; // largest property written at once for selections
+	struct wl_array atom_names; // struct xwm_atom_name
 
 	struct wlr_xwayland_surface *focus_surface;
 
@@ -112,12 +136,24 @@ struct wlr_xwm {
 	// Surfaces in bottom-to-top stacking order, for _NET_CLIENT_LIST_STACKING
 	struct wl_list surfaces_in_stack_order; // wlr_xwayland_surface::stack_link
 	struct wl_list unpaired_surfaces; // wlr_xwayland_surface::unpaired_link
+	struct xwm_surface_map surfaces_by_window; // keyed by window_id
+	struct xwm_surface_map unpaired_by_id; // keyed by surface_id
+	struct wl_list pending_replies; // xwm_pending_reply::link
+
+	// Mapped windows in map order, for _NET_CLIENT_LIST
+	struct wl_array client_list; // xcb_window_t
+	size_t client_list_flushed; // bytes of client_list already sent
+	bool client_list_replace; // a window was removed since the last update
+	bool client_list_stacking_dirty;
+	struct wl_array client_list_stacking; // xcb_window_t, scratch buffer
+	struct wl_event_source *flush_idle;
 
 	struct wlr_drag *drag;
 	struct wlr_xwayland_surface *drag_focus;
 
 	const xcb_query_extension_reply_t *xfixes;
 	const xcb_query_extension_reply_t *xres;
+	const xcb_query_extension_reply_t *xsync;
 #if HAS_XCB_ERRORS
 	xcb_errors_context_t *errors_context;
 #endif
@@ -148,6 +184,13 @@ int xwm_handle_selection_client_message(struct wlr_xwm *xwm,
 
 void xwm_set_seat(struct wlr_xwm *xwm, struct wlr_seat *seat);
 
+/**
+ * Must be called after waiting on a reply. Blocking xcb calls read everything
+ * the X server has sent so far, including the replies to queued requests,
+ * which the connection's event source then isn't woken up for.
+ */
+void xwm_schedule_replies(struct wlr_xwm *xwm);
+
 char *xwm_get_atom_name(struct wlr_xwm *xwm, xcb_atom_t atom);
 bool xwm_atoms_contains(struct wlr_xwm *xwm, xcb_atom_t *atoms,
 	size_t num_atoms, enum atom_name needle);
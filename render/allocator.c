@@ -1,13 +1,45 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <wlr/types/wlr_buffer.h>
 #include <wlr/util/log.h>
 #include <xf86drm.h>
 #include "backend/backend.h"
 #include "render/allocator.h"
+#include "render/drm_format_set.h"
 #include "render/gbm_allocator.h"
 #include "render/shm_allocator.h"
 #include "render/drm_dumb_allocator.h"
 #include "render/wlr_renderer.h"
+#include "types/wlr_buffer.h"
+#include "util/time.h"
+
+// Maximum amount of memory kept in the pool of released buffers
+#define ALLOCATOR_POOL_MAX_SIZE (64 * 1024 * 1024)
+// Released buffers older than this are freed on the next allocation
+#define ALLOCATOR_POOL_MAX_AGE_MS 10000
+
+struct allocator_pool_entry {
+	struct wl_list link; // wlr_allocator.pool.entries
+	struct wlr_buffer *buffer;
+	struct wlr_drm_format *format; // as requested at allocation time
+	size_t size;
+	uint32_t released_msec;
+};
+
+/**
+ * Buffer handed out by wlr_allocator_create_buffer. The storage of the
+ * wrapped buffer goes back to the pool when the pooled buffer is destroyed.
+ */
+struct pooled_buffer {
+	struct wlr_buffer base;
+	struct wlr_allocator *alloc; // NULL if the allocator has been destroyed
+	struct wl_list link; // wlr_allocator.pool.buffers
+
+	struct wlr_buffer *buffer;
+	struct wlr_drm_format *format;
+	size_t size;
+};
 
 void wlr_allocator_init(struct wlr_allocator *alloc,
 		const struct wlr_allocator_interface *impl, uint32_t buffer_caps) {
@@ -15,6 +47,144 @@ void wlr_allocator_init(struct wlr_allocator *alloc,
 	alloc->impl = impl;
 	alloc->buffer_caps = buffer_caps;
 	wl_signal_init(&alloc->events.destroy);
+	wl_list_init(&alloc->pool.entries);
+	wl_list_init(&alloc->pool.buffers);
+}
+
+static void pool_entry_destroy(struct wlr_allocator *alloc,
+		struct allocator_pool_entry *entry) {
+	alloc->pool.size -= entry->size;
+	wl_list_remove(&entry->link);
+	wlr_buffer_drop(entry->buffer);
+	free(entry->format);
+	free(entry);
+}
+
+static void pool_expire(struct wlr_allocator *alloc) {
+	uint32_t now = get_current_time_msec();
+	struct allocator_pool_entry *entry, *tmp;
+	wl_list_for_each_reverse_safe(entry, tmp, &alloc->pool.entries, link) {
+		if (now - entry->released_msec < ALLOCATOR_POOL_MAX_AGE_MS) {
+			break;
+		}
+		pool_entry_destroy(alloc, entry);
+	}
+}
+
+static bool format_equal(const struct wlr_drm_format *a,
+		const struct wlr_drm_format *b) {
+	return a->format == b->format && a->len == b->len &&
+		memcmp(a->modifiers, b->modifiers, a->len * sizeof(a->modifiers[0])) == 0;
+}
+
+static struct allocator_pool_entry *pool_find(struct wlr_allocator *alloc,
+		int width, int height, const struct wlr_drm_format *format) {
+	struct allocator_pool_entry *entry;
+	wl_list_for_each(entry, &alloc->pool.entries, link) {
+		if (entry->buffer->width == width && entry->buffer->height == height &&
+				format_equal(entry->format, format)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static void pool_put(struct wlr_allocator *alloc, struct wlr_buffer *buffer,
+		struct wlr_drm_format *format, size_t size) {
+	struct allocator_pool_entry *entry = NULL;
+	if (size <= ALLOCATOR_POOL_MAX_SIZE) {
+		entry = calloc(1, sizeof(*entry));
+	}
+	if (entry == NULL) {
+		wlr_buffer_drop(buffer);
+		free(format);
+		return;
+	}
+	entry->buffer = buffer;
+	entry->format = format;
+	entry->size = size;
+	entry->released_msec = get_current_time_msec();
+	wl_list_insert(&alloc->pool.entries, &entry->link);
+	alloc->pool.size += size;
+
+	while (alloc->pool.size > ALLOCATOR_POOL_MAX_SIZE) {
+		struct allocator_pool_entry *oldest =
+			wl_container_of(alloc->pool.entries.prev, oldest, link);
+		pool_entry_destroy(alloc, oldest);
+	}
+}
+
+static size_t buffer_estimate_size(struct wlr_buffer *buffer) {
+	struct wlr_dmabuf_attributes dmabuf;
+	struct wlr_shm_attributes shm;
+	if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
+		size_t size = 0;
+		for (int i = 0; i < dmabuf.n_planes; i++) {
+			size += (size_t)dmabuf.stride[i] * dmabuf.height;
+		}
+		return size;
+	} else if (wlr_buffer_get_shm(buffer, &shm)) {
+		return (size_t)shm.stride * shm.height;
+	}
+	return (size_t)buffer->width * buffer->height * 4;
+}
+
+static const struct wlr_buffer_impl pooled_buffer_impl;
+
+static struct pooled_buffer *pooled_buffer_from_buffer(
+		struct wlr_buffer *wlr_buffer) {
+	assert(wlr_buffer->impl == &pooled_buffer_impl);
+	return (struct pooled_buffer *)wlr_buffer;
+}
+
+static void pooled_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct pooled_buffer *buffer = pooled_buffer_from_buffer(wlr_buffer);
+	if (buffer->alloc != NULL) {
+		pool_put(buffer->alloc, buffer->buffer, buffer->format, buffer->size);
+	} else {
+		wlr_buffer_drop(buffer->buffer);
+		free(buffer->format);
+	}
+	wl_list_remove(&buffer->link);
+	free(buffer);
+}
+
+static bool pooled_buffer_get_dmabuf(struct wlr_buffer *wlr_buffer,
+		struct wlr_dmabuf_attributes *attribs) {
+	struct pooled_buffer *buffer = pooled_buffer_from_buffer(wlr_buffer);
+	return wlr_buffer_get_dmabuf(buffer->buffer, attribs);
+}
+
+static bool pooled_buffer_get_shm(struct wlr_buffer *wlr_buffer,
+		struct wlr_shm_attributes *attribs) {
+	struct pooled_buffer *buffer = pooled_buffer_from_buffer(wlr_buffer);
+	return wlr_buffer_get_shm(buffer->buffer, attribs);
+}
+
+static bool pooled_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		void **data, uint32_t *format, size_t *stride) {
+	struct pooled_buffer *buffer = pooled_buffer_from_buffer(wlr_buffer);
+	return buffer_begin_data_ptr_access(buffer->buffer, data, format, stride);
+}
+
+static void pooled_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	struct pooled_buffer *buffer = pooled_buffer_from_buffer(wlr_buffer);
+	buffer_end_data_ptr_access(buffer->buffer);
+}
+
+static const struct wlr_buffer_impl pooled_buffer_impl = {
+	.destroy = pooled_buffer_destroy,
+	.get_dmabuf = pooled_buffer_get_dmabuf,
+	.get_shm = pooled_buffer_get_shm,
+	.begin_data_ptr_access = pooled_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = pooled_buffer_end_data_ptr_access,
+};
+
+struct wlr_buffer *allocator_buffer_get_storage(struct wlr_buffer *buffer) {
+	if (buffer->impl != &pooled_buffer_impl) {
+		return buffer;
+	}
+	return pooled_buffer_from_buffer(buffer)->buffer;
 }
 
 struct wlr_allocator *allocator_autocreate_with_drm_fd(
@@ -64,16 +234,34 @@ struct wlr_allocator *wlr_allocator_autocreate(struct wlr_backend *backend,
 	return allocator_autocreate_with_drm_fd(backend, renderer, drm_fd);
 }
 
+void wlr_allocator_trim(struct wlr_allocator *alloc) {
+	struct allocator_pool_entry *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &alloc->pool.entries, link) {
+		pool_entry_destroy(alloc, entry);
+	}
+}
+
 void wlr_allocator_destroy(struct wlr_allocator *alloc) {
 	if (alloc == NULL) {
 		return;
 	}
 	wl_signal_emit(&alloc->events.destroy, NULL);
+
+	// Buffers still in use are freed when they're destroyed
+	wlr_allocator_trim(alloc);
+	struct pooled_buffer *buffer, *tmp;
+	wl_list_for_each_safe(buffer, tmp, &alloc->pool.buffers, link) {
+		buffer->alloc = NULL;
+		wl_list_remove(&buffer->link);
+		wl_list_init(&buffer->link);
+	}
+
 	alloc->impl->destroy(alloc);
 }
 
-struct wlr_buffer *wlr_allocator_create_buffer(struct wlr_allocator *alloc,
-		int width, int height, const struct wlr_drm_format *format) {
+static struct wlr_buffer *allocator_create_storage(
+		struct wlr_allocator *alloc, int width, int height,
+		const struct wlr_drm_format *format) {
 	struct wlr_buffer *buffer =
 		alloc->impl->create_buffer(alloc, width, height, format);
 	if (buffer == NULL) {
@@ -91,3 +279,43 @@ struct wlr_buffer *wlr_allocator_create_buffer(struct wlr_allocator *alloc,
 	}
 	return buffer;
 }
+
+struct wlr_buffer *wlr_allocator_create_buffer(struct wlr_allocator *alloc,
+		int width, int height, const struct wlr_drm_format *format) {
+	struct pooled_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	pool_expire(alloc);
+
+	struct allocator_pool_entry *entry =
+		pool_find(alloc, width, height, format);
+	if (entry != NULL) {
+		buffer->buffer = entry->buffer;
+		buffer->format = entry->format;
+		buffer->size = entry->size;
+		alloc->pool.size -= entry->size;
+		wl_list_remove(&entry->link);
+		free(entry);
+	} else {
+		buffer->buffer =
+			allocator_create_storage(alloc, width, height, format);
+		if (buffer->buffer == NULL) {
+			free(buffer);
+			return NULL;
+		}
+		buffer->format = wlr_drm_format_dup(format);
+		if (buffer->format == NULL) {
+			wlr_buffer_drop(buffer->buffer);
+			free(buffer);
+			return NULL;
+		}
+		buffer->size = buffer_estimate_size(buffer->buffer);
+	}
+
+	wlr_buffer_init(&buffer->base, &pooled_buffer_impl, width, height);
+	buffer->alloc = alloc;
+	wl_list_insert(&alloc->pool.buffers, &buffer->link);
+	return &buffer->base;
+}
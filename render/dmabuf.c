@@ -1,8 +1,17 @@
 #define _POSIX_C_SOURCE 200809L
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <wlr/render/dmabuf.h>
 #include <wlr/util/log.h>
+#include "render/dmabuf.h"
+
+#ifdef __linux__
+#include <linux/dma-buf.h>
+#include <linux/sync_file.h>
+#include <sys/ioctl.h>
+#endif
 
 void wlr_dmabuf_attributes_finish(struct wlr_dmabuf_attributes *attribs) {
 	for (int i = 0; i < attribs->n_planes; ++i) {
@@ -35,3 +44,60 @@ error:
 	dst->n_planes = 0;
 	return false;
 }
+
+#ifdef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+static int export_sync_file(int dmabuf_fd, uint32_t flags) {
+	struct dma_buf_export_sync_file data = {
+		.flags = flags,
+		.fd = -1,
+	};
+	if (ioctl(dmabuf_fd, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &data) != 0) {
+		if (errno != ENOTTY) {
+			wlr_log_errno(WLR_DEBUG, "DMA_BUF_IOCTL_EXPORT_SYNC_FILE failed");
+		}
+		return -1;
+	}
+	return data.fd;
+}
+#endif
+
+int dmabuf_export_sync_file(int dmabuf_fd) {
+#ifdef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+	// Fences which need to signal before the buffer can be read
+	return export_sync_file(dmabuf_fd, DMA_BUF_SYNC_READ);
+#else
+	return -1;
+#endif
+}
+
+int dmabuf_export_write_sync_file(int dmabuf_fd) {
+#ifdef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+	// Fences which need to signal before the buffer can be written, pending
+	// reads included
+	return export_sync_file(dmabuf_fd, DMA_BUF_SYNC_WRITE);
+#else
+	return -1;
+#endif
+}
+
+int sync_file_merge(int fd1, int fd2) {
+#ifdef SYNC_IOC_MERGE
+	struct sync_merge_data data = {
+		.name = "wlroots",
+		.fd2 = fd2,
+		.fence = -1,
+	};
+	if (ioctl(fd1, SYNC_IOC_MERGE, &data) != 0) {
+		wlr_log_errno(WLR_DEBUG, "SYNC_IOC_MERGE failed");
+		return -1;
+	}
+	return data.fence;
+#else
+	return -1;
+#endif
+}
+
+bool sync_file_is_signaled(int fd) {
+	struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+	return poll(&pollfd, 1, 0) != 0;
+}
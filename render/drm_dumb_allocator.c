@@ -25,6 +25,7 @@ static struct wlr_drm_dumb_buffer *drm_dumb_buffer_from_buffer(
 }
 
 static void finish_buffer(struct wlr_drm_dumb_buffer *buf) {
+	free(buf->shadow);
 	if (buf->data) {
 		munmap(buf->data, buf->size);
 	}
@@ -97,6 +98,17 @@ static struct wlr_drm_dumb_buffer *create_buffer(
 
 	memset(buffer->data, 0, create.size);
 
+	// Dumb buffers are usually mapped write-combined: reads are uncached and
+	// scattered writes are slow, which is exactly what compositing does.
+	// Render into a cached copy instead, and only stream out the result.
+	if (posix_memalign(&buffer->shadow, 64, create.size) == 0) {
+		memset(buffer->shadow, 0, create.size);
+	} else {
+		buffer->shadow = NULL;
+		wlr_log(WLR_DEBUG, "Failed to allocate DRM dumb buffer shadow, "
+			"rendering directly into the dumb buffer");
+	}
+
 	int prime_fd;
 	if (drmPrimeHandleToFD(alloc->drm_fd, buffer->handle, DRM_CLOEXEC,
 			&prime_fd) != 0) {
@@ -130,14 +142,46 @@ create_err:
 static bool drm_dumb_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
 		void **data, uint32_t *format, size_t *stride) {
 	struct wlr_drm_dumb_buffer *buf = drm_dumb_buffer_from_buffer(wlr_buffer);
-	*data = buf->data;
+	*data = buf->shadow != NULL ? buf->shadow : buf->data;
 	*stride = buf->stride;
 	*format = buf->format;
+	buf->dirty_y1 = 0;
+	buf->dirty_y2 = buf->height;
 	return true;
 }
 
 static void drm_dumb_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
-	// This space is intentionally left blank
+	struct wlr_drm_dumb_buffer *buf = drm_dumb_buffer_from_buffer(wlr_buffer);
+	if (buf->shadow == NULL || buf->dirty_y1 >= buf->dirty_y2) {
+		return;
+	}
+
+	// Rows are contiguous, so this is a single large sequential copy, for
+	// which memcpy uses non-temporal stores
+	size_t offset = (size_t)buf->dirty_y1 * buf->stride;
+	size_t size = (size_t)(buf->dirty_y2 - buf->dirty_y1) * buf->stride;
+	memcpy((char *)buf->data + offset, (char *)buf->shadow + offset, size);
+	buf->dirty_y1 = buf->dirty_y2 = 0;
+}
+
+void drm_dumb_buffer_set_dirty_rows(struct wlr_buffer *wlr_buffer,
+		int32_t y1, int32_t y2) {
+	wlr_buffer = allocator_buffer_get_storage(wlr_buffer);
+	if (wlr_buffer->impl != &buffer_impl) {
+		return;
+	}
+	struct wlr_drm_dumb_buffer *buf = drm_dumb_buffer_from_buffer(wlr_buffer);
+	if (y1 < 0) {
+		y1 = 0;
+	}
+	if (y2 > (int32_t)buf->height) {
+		y2 = buf->height;
+	}
+	if (y1 >= y2) {
+		y1 = y2 = 0;
+	}
+	buf->dirty_y1 = y1;
+	buf->dirty_y2 = y2;
 }
 
 static bool buffer_get_dmabuf(struct wlr_buffer *wlr_buffer,
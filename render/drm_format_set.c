@@ -193,3 +193,40 @@ struct wlr_drm_format *wlr_drm_format_intersect(
 
 	return format;
 }
+
+bool wlr_drm_format_set_intersect(struct wlr_drm_format_set *dst,
+		const struct wlr_drm_format_set *a, const struct wlr_drm_format_set *b) {
+	assert(dst->len == 0);
+
+	for (size_t i = 0; i < a->len; i++) {
+		const struct wlr_drm_format *b_format =
+			wlr_drm_format_set_get(b, a->formats[i]->format);
+		if (b_format == NULL) {
+			continue;
+		}
+
+		struct wlr_drm_format *format =
+			wlr_drm_format_intersect(a->formats[i], b_format);
+		if (format == NULL) {
+			goto error;
+		}
+
+		// Formats without any modifier only support the implicit one
+		bool ok = wlr_drm_format_set_add(dst, format->format,
+			DRM_FORMAT_MOD_INVALID);
+		for (size_t j = 0; ok && j < format->len; j++) {
+			ok = wlr_drm_format_set_add(dst, format->format,
+				format->modifiers[j]);
+		}
+		free(format);
+		if (!ok) {
+			goto error;
+		}
+	}
+
+	return true;
+
+error:
+	wlr_drm_format_set_finish(dst);
+	return false;
+}
@@ -2,8 +2,12 @@
 #include <assert.h>
 #include <drm_fourcc.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <gbm.h>
 #include <wlr/render/egl.h>
@@ -11,6 +15,9 @@
 #include <wlr/util/region.h>
 #include <xf86drm.h>
 #include "render/egl.h"
+#include "util/cache.h"
+#include "util/realtime.h"
+#include "util/startup.h"
 
 static enum wlr_log_importance egl_log_importance_to_wlr(EGLint type) {
 	switch (type) {
@@ -98,46 +105,315 @@ static int get_egl_dmabuf_formats(struct wlr_egl *egl, int **formats);
 static int get_egl_dmabuf_modifiers(struct wlr_egl *egl, int format,
 	uint64_t **modifiers, EGLBoolean **external_only);
 
-static void init_dmabuf_formats(struct wlr_egl *egl) {
+struct egl_format_modifiers {
+	int format;
+	int len; // -1 on error
+	uint64_t *modifiers;
+	EGLBoolean *external_only;
+};
+
+/*
+ * Querying modifiers can take a while on some drivers, because they need to
+ * check each format against the hardware. The queries are independent, so
+ * they're split across a few threads.
+ */
+
+#define MAX_PROBE_THREADS 4
+
+struct egl_format_probe {
+	struct wlr_egl *egl;
+	struct egl_format_modifiers *formats;
+	size_t formats_len;
+	atomic_size_t next;
+};
+
+static void probe_dmabuf_formats(struct egl_format_probe *probe) {
+	while (true) {
+		size_t i = atomic_fetch_add(&probe->next, 1);
+		if (i >= probe->formats_len) {
+			break;
+		}
+		struct egl_format_modifiers *fmt = &probe->formats[i];
+		fmt->len = get_egl_dmabuf_modifiers(probe->egl, fmt->format,
+			&fmt->modifiers, &fmt->external_only);
+	}
+}
+
+static void *probe_thread_run(void *data) {
+	probe_dmabuf_formats(data);
+	eglReleaseThread();
+	return NULL;
+}
+
+static void probe_dmabuf_modifiers(struct wlr_egl *egl,
+		struct egl_format_modifiers *formats, size_t formats_len) {
+	struct egl_format_probe probe = {
+		.egl = egl,
+		.formats = formats,
+		.formats_len = formats_len,
+	};
+	atomic_init(&probe.next, 0);
+
+	size_t threads_len = MAX_PROBE_THREADS;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0 && (size_t)cpus < threads_len) {
+		threads_len = cpus;
+	}
+	if (formats_len < threads_len) {
+		threads_len = formats_len;
+	}
+
+	// The calling thread takes part in the probe, so that it still completes
+	// if no thread can be started
+	pthread_t threads[MAX_PROBE_THREADS - 1];
+	size_t started = 0;
+	while (started + 1 < threads_len) {
+		if (worker_thread_create(&threads[started], probe_thread_run,
+				&probe) != 0) {
+			wlr_log(WLR_DEBUG, "Failed to start format probe thread");
+			break;
+		}
+		started++;
+	}
+
+	probe_dmabuf_formats(&probe);
+
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+/*
+ * With WLR_EGL_FORMAT_CACHE=1, the probe results are stored on disk, keyed by
+ * the driver and device identification. Drivers don't validate cached
+ * results, so the cache is opt-in.
+ */
+
+#define FORMAT_CACHE_HEADER "wlroots-egl-formats 1"
+
+static bool get_format_cache_path(struct wlr_egl *egl, int drm_fd,
+		const char *driver_name, const struct egl_format_modifiers *formats,
+		size_t formats_len, char *path, size_t path_size) {
+	const char *env = getenv("WLR_EGL_FORMAT_CACHE");
+	if (env == NULL || strcmp(env, "1") != 0) {
+		return false;
+	}
+
+	char *dir = cache_get_dir("egl");
+	if (dir == NULL) {
+		return false;
+	}
+
+	uint64_t hash = CACHE_HASH_INIT;
+	const char *strs[] = {
+		eglQueryString(egl->display, EGL_VENDOR),
+		eglQueryString(egl->display, EGL_VERSION),
+		eglQueryString(egl->display, EGL_EXTENSIONS),
+		driver_name,
+	};
+	for (size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+		hash = cache_hash_string(hash, strs[i] != NULL ? strs[i] : "");
+	}
+
+	char buf[256];
+	drmVersion *version = drmGetVersion(drm_fd);
+	if (version != NULL) {
+		snprintf(buf, sizeof(buf), "%s %d.%d.%d %s", version->name,
+			version->version_major, version->version_minor,
+			version->version_patchlevel, version->date);
+		hash = cache_hash_string(hash, buf);
+		drmFreeVersion(version);
+	}
+
+	drmDevice *device = NULL;
+	if (drmGetDevice2(drm_fd, 0, &device) == 0) {
+		if (device->bustype == DRM_BUS_PCI) {
+			snprintf(buf, sizeof(buf), "pci %04x:%04x %04x:%04x %02x",
+				device->deviceinfo.pci->vendor_id,
+				device->deviceinfo.pci->device_id,
+				device->deviceinfo.pci->subvendor_id,
+				device->deviceinfo.pci->subdevice_id,
+				device->deviceinfo.pci->revision_id);
+		} else if (device->bustype == DRM_BUS_PLATFORM) {
+			snprintf(buf, sizeof(buf), "platform %s",
+				device->businfo.platform->fullname);
+		} else {
+			snprintf(buf, sizeof(buf), "bus %d", device->bustype);
+		}
+		hash = cache_hash_string(hash, buf);
+		drmFreeDevice(&device);
+	}
+
+	for (size_t i = 0; i < formats_len; i++) {
+		snprintf(buf, sizeof(buf), "%08x", (uint32_t)formats[i].format);
+		hash = cache_hash_string(hash, buf);
+	}
+
+	int n = snprintf(path, path_size, "%s/%016"PRIx64, dir, hash);
+	free(dir);
+	return n >= 0 && (size_t)n < path_size;
+}
+
+static void finish_format_modifiers(struct egl_format_modifiers *formats,
+		size_t formats_len) {
+	for (size_t i = 0; i < formats_len; i++) {
+		free(formats[i].modifiers);
+		free(formats[i].external_only);
+		formats[i].modifiers = NULL;
+		formats[i].external_only = NULL;
+		formats[i].len = -1;
+	}
+}
+
+static bool load_format_cache(const char *path,
+		struct egl_format_modifiers *formats, size_t formats_len) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return false;
+	}
+
+	char header[64];
+	bool ok = fgets(header, sizeof(header), f) != NULL &&
+		strcmp(header, FORMAT_CACHE_HEADER "\n") == 0;
+	for (size_t i = 0; ok && i < formats_len; i++) {
+		struct egl_format_modifiers *fmt = &formats[i];
+		uint32_t format;
+		int len;
+		if (fscanf(f, "%"SCNx32" %d", &format, &len) != 2 ||
+				format != (uint32_t)fmt->format || len < 0) {
+			ok = false;
+			break;
+		}
+		fmt->len = len;
+		if (len == 0) {
+			continue;
+		}
+
+		fmt->modifiers = calloc(len, sizeof(uint64_t));
+		fmt->external_only = calloc(len, sizeof(EGLBoolean));
+		if (fmt->modifiers == NULL || fmt->external_only == NULL) {
+			ok = false;
+			break;
+		}
+		for (int j = 0; j < len; j++) {
+			int external_only;
+			if (fscanf(f, "%"SCNx64" %d", &fmt->modifiers[j],
+					&external_only) != 2) {
+				ok = false;
+				break;
+			}
+			fmt->external_only[j] = external_only ? EGL_TRUE : EGL_FALSE;
+		}
+	}
+	fclose(f);
+
+	if (!ok) {
+		finish_format_modifiers(formats, formats_len);
+	}
+	return ok;
+}
+
+static void store_format_cache(const char *path,
+		const struct egl_format_modifiers *formats, size_t formats_len) {
+	for (size_t i = 0; i < formats_len; i++) {
+		if (formats[i].len < 0) {
+			// Don't persist errors, they may be transient
+			return;
+		}
+	}
+
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *f = open_memstream(&buf, &size);
+	if (f == NULL) {
+		return;
+	}
+	fprintf(f, FORMAT_CACHE_HEADER "\n");
+	for (size_t i = 0; i < formats_len; i++) {
+		const struct egl_format_modifiers *fmt = &formats[i];
+		fprintf(f, "%08"PRIx32" %d\n", (uint32_t)fmt->format, fmt->len);
+		for (int j = 0; j < fmt->len; j++) {
+			fprintf(f, "%016"PRIx64" %d\n", fmt->modifiers[j],
+				fmt->external_only[j] ? 1 : 0);
+		}
+	}
+	if (fclose(f) != 0) {
+		free(buf);
+		return;
+	}
+
+	if (!cache_write_file(path, buf, size)) {
+		wlr_log_errno(WLR_DEBUG, "Failed to write EGL format cache %s", path);
+	}
+	free(buf);
+}
+
+static void init_dmabuf_formats(struct wlr_egl *egl, int drm_fd,
+		const char *driver_name) {
+	if (!egl->exts.image_dmabuf_import_ext) {
+		wlr_log(WLR_DEBUG, "DMA-BUF extension not present");
+		return;
+	}
+
 	int *formats;
 	int formats_len = get_egl_dmabuf_formats(egl, &formats);
 	if (formats_len < 0) {
 		return;
 	}
 
-	bool has_modifiers = false;
+	struct egl_format_modifiers *results =
+		calloc(formats_len, sizeof(*results));
+	if (results == NULL && formats_len > 0) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		goto out;
+	}
 	for (int i = 0; i < formats_len; i++) {
-		uint32_t fmt = formats[i];
+		results[i].format = formats[i];
+		results[i].len = -1;
+	}
 
-		uint64_t *modifiers;
-		EGLBoolean *external_only;
-		int modifiers_len =
-			get_egl_dmabuf_modifiers(egl, fmt, &modifiers, &external_only);
-		if (modifiers_len < 0) {
+	char cache_path[4096];
+	bool use_cache = egl->exts.image_dmabuf_import_modifiers_ext &&
+		get_format_cache_path(egl, drm_fd, driver_name, results,
+			formats_len, cache_path, sizeof(cache_path));
+	if (use_cache && load_format_cache(cache_path, results, formats_len)) {
+		wlr_log(WLR_DEBUG, "Loaded EGL DMA-BUF formats from %s", cache_path);
+	} else {
+		probe_dmabuf_modifiers(egl, results, formats_len);
+		if (use_cache) {
+			store_format_cache(cache_path, results, formats_len);
+		}
+	}
+
+	bool has_modifiers = false;
+	for (int i = 0; i < formats_len; i++) {
+		const struct egl_format_modifiers *fmt = &results[i];
+		if (fmt->len < 0) {
+			wlr_log(WLR_ERROR, "Failed to query modifiers for DMA-BUF "
+				"format 0x%"PRIX32, (uint32_t)fmt->format);
 			continue;
 		}
 
-		has_modifiers = has_modifiers || modifiers_len > 0;
+		has_modifiers = has_modifiers || fmt->len > 0;
 
-		if (modifiers_len == 0) {
-			wlr_drm_format_set_add(&egl->dmabuf_texture_formats, fmt,
+		if (fmt->len == 0) {
+			wlr_drm_format_set_add(&egl->dmabuf_texture_formats, fmt->format,
 				DRM_FORMAT_MOD_INVALID);
-			wlr_drm_format_set_add(&egl->dmabuf_render_formats, fmt,
+			wlr_drm_format_set_add(&egl->dmabuf_render_formats, fmt->format,
 				DRM_FORMAT_MOD_INVALID);
 		}
 
-		for (int j = 0; j < modifiers_len; j++) {
-			wlr_drm_format_set_add(&egl->dmabuf_texture_formats, fmt,
-				modifiers[j]);
-			if (!external_only[j]) {
-				wlr_drm_format_set_add(&egl->dmabuf_render_formats, fmt,
-					modifiers[j]);
+		for (int j = 0; j < fmt->len; j++) {
+			wlr_drm_format_set_add(&egl->dmabuf_texture_formats, fmt->format,
+				fmt->modifiers[j]);
+			if (!fmt->external_only[j]) {
+				wlr_drm_format_set_add(&egl->dmabuf_render_formats,
+					fmt->format, fmt->modifiers[j]);
 			}
 		}
-
-		free(modifiers);
-		free(external_only);
 	}
+	finish_format_modifiers(results, formats_len);
+	free(results);
 
 	char *str_formats = malloc(formats_len * 5 + 1);
 	if (str_formats == NULL) {
@@ -156,7 +432,7 @@ out:
 	free(formats);
 }
 
-struct wlr_egl *wlr_egl_create_with_drm_fd(int drm_fd) {
+static struct wlr_egl *egl_create(int drm_fd) {
 	struct wlr_egl *egl = calloc(1, sizeof(struct wlr_egl));
 	if (egl == NULL) {
 		wlr_log_errno(WLR_ERROR, "Allocation failed");
@@ -246,6 +522,14 @@ struct wlr_egl *wlr_egl_create_with_drm_fd(int drm_fd) {
 			"eglQueryDmaBufModifiersEXT");
 	}
 
+	if (check_egl_ext(display_exts_str, "EGL_KHR_fence_sync")) {
+		egl->exts.fence_sync_khr = true;
+		load_egl_proc(&egl->procs.eglCreateSyncKHR, "eglCreateSyncKHR");
+		load_egl_proc(&egl->procs.eglDestroySyncKHR, "eglDestroySyncKHR");
+		load_egl_proc(&egl->procs.eglClientWaitSyncKHR,
+			"eglClientWaitSyncKHR");
+	}
+
 	if (check_egl_ext(display_exts_str, "EGL_WL_bind_wayland_display")) {
 		egl->exts.bind_wayland_display_wl = true;
 		load_egl_proc(&egl->procs.eglBindWaylandDisplayWL,
@@ -325,7 +609,9 @@ struct wlr_egl *wlr_egl_create_with_drm_fd(int drm_fd) {
 		wlr_log(WLR_INFO, "EGL driver name: %s", driver_name);
 	}
 
-	init_dmabuf_formats(egl);
+	int64_t formats_start = startup_phase_begin("egl formats");
+	init_dmabuf_formats(egl, drm_fd, driver_name);
+	startup_phase_end("egl formats", formats_start);
 
 	bool ext_context_priority =
 		check_egl_ext(display_exts_str, "EGL_IMG_context_priority");
@@ -378,6 +664,13 @@ error:
 	return NULL;
 }
 
+struct wlr_egl *wlr_egl_create_with_drm_fd(int drm_fd) {
+	int64_t start = startup_phase_begin("egl");
+	struct wlr_egl *egl = egl_create(drm_fd);
+	startup_phase_end("egl", start);
+	return egl;
+}
+
 void wlr_egl_destroy(struct wlr_egl *egl) {
 	if (egl == NULL) {
 		return;
@@ -426,7 +719,61 @@ bool wlr_egl_destroy_image(struct wlr_egl *egl, EGLImage image) {
 	return egl->procs.eglDestroyImageKHR(egl->display, image);
 }
 
+EGLSyncKHR wlr_egl_create_fence(struct wlr_egl *egl) {
+	if (!egl->exts.fence_sync_khr) {
+		return EGL_NO_SYNC_KHR;
+	}
+
+	EGLSyncKHR sync = egl->procs.eglCreateSyncKHR(egl->display,
+		EGL_SYNC_FENCE_KHR, NULL);
+	if (sync == EGL_NO_SYNC_KHR) {
+		wlr_log(WLR_ERROR, "eglCreateSyncKHR failed");
+	}
+	return sync;
+}
+
+bool wlr_egl_wait_sync(struct wlr_egl *egl, EGLSyncKHR sync,
+		EGLTimeKHR timeout) {
+	EGLint ret = egl->procs.eglClientWaitSyncKHR(egl->display, sync,
+		EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, timeout);
+	if (ret == EGL_FALSE) {
+		wlr_log(WLR_ERROR, "eglClientWaitSyncKHR failed");
+		// Don't wait forever on a broken fence
+		return true;
+	}
+	return ret == EGL_CONDITION_SATISFIED_KHR;
+}
+
+void wlr_egl_destroy_sync(struct wlr_egl *egl, EGLSyncKHR sync) {
+	if (sync == EGL_NO_SYNC_KHR) {
+		return;
+	}
+	if (egl->procs.eglDestroySyncKHR(egl->display, sync) != EGL_TRUE) {
+		wlr_log(WLR_ERROR, "eglDestroySyncKHR failed");
+	}
+}
+
+EGLContext wlr_egl_create_shared_context(struct wlr_egl *egl) {
+	const EGLint attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE,
+	};
+	EGLContext context = eglCreateContext(egl->display, EGL_NO_CONFIG_KHR,
+		egl->context, attribs);
+	if (context == EGL_NO_CONTEXT) {
+		wlr_log(WLR_ERROR, "Failed to create shared EGL context");
+	}
+	return context;
+}
+
 bool wlr_egl_make_current(struct wlr_egl *egl) {
+	// eglMakeCurrent is expensive even when nothing changes, querying the
+	// current state is cheap
+	if (eglGetCurrentContext() == egl->context &&
+			eglGetCurrentSurface(EGL_DRAW) == EGL_NO_SURFACE &&
+			eglGetCurrentSurface(EGL_READ) == EGL_NO_SURFACE) {
+		return true;
+	}
 	if (!eglMakeCurrent(egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
 			egl->context)) {
 		wlr_log(WLR_ERROR, "eglMakeCurrent failed");
@@ -469,6 +816,14 @@ bool wlr_egl_restore_context(struct wlr_egl_context *context) {
 		return true;
 	}
 
+	// Nothing to do if the saved context is still current, which is the
+	// common case of nested save/restore pairs
+	if (context->context == eglGetCurrentContext() &&
+			context->draw_surface == eglGetCurrentSurface(EGL_DRAW) &&
+			context->read_surface == eglGetCurrentSurface(EGL_READ)) {
+		return true;
+	}
+
 	return eglMakeCurrent(display, context->draw_surface,
 			context->read_surface, context->context);
 }
@@ -652,18 +1007,15 @@ static int get_egl_dmabuf_modifiers(struct wlr_egl *egl, int format,
 	*modifiers = NULL;
 	*external_only = NULL;
 
-	if (!egl->exts.image_dmabuf_import_ext) {
-		wlr_log(WLR_DEBUG, "DMA-BUF extension not present");
-		return -1;
-	}
 	if (!egl->exts.image_dmabuf_import_modifiers_ext) {
 		return 0;
 	}
 
+	// May run on a format probe thread, errors are logged by the caller
+
 	EGLint num;
 	if (!egl->procs.eglQueryDmaBufModifiersEXT(egl->display, format, 0,
 			NULL, NULL, &num)) {
-		wlr_log(WLR_ERROR, "Failed to query dmabuf number of modifiers");
 		return -1;
 	}
 	if (num == 0) {
@@ -671,26 +1023,23 @@ static int get_egl_dmabuf_modifiers(struct wlr_egl *egl, int format,
 	}
 
 	*modifiers = calloc(num, sizeof(uint64_t));
-	if (*modifiers == NULL) {
-		wlr_log_errno(WLR_ERROR, "Allocation failed");
-		return -1;
-	}
 	*external_only = calloc(num, sizeof(EGLBoolean));
-	if (*external_only == NULL) {
-		wlr_log_errno(WLR_ERROR, "Allocation failed");
-		free(*modifiers);
-		*modifiers = NULL;
-		return -1;
+	if (*modifiers == NULL || *external_only == NULL) {
+		goto error;
 	}
 
 	if (!egl->procs.eglQueryDmaBufModifiersEXT(egl->display, format, num,
 			*modifiers, *external_only, &num)) {
-		wlr_log(WLR_ERROR, "Failed to query dmabuf modifiers");
-		free(*modifiers);
-		free(*external_only);
-		return -1;
+		goto error;
 	}
 	return num;
+
+error:
+	free(*modifiers);
+	free(*external_only);
+	*modifiers = NULL;
+	*external_only = NULL;
+	return -1;
 }
 
 const struct wlr_drm_format_set *wlr_egl_get_dmabuf_texture_formats(
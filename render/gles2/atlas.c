@@ -0,0 +1,266 @@
+#include <assert.h>
+#include <GLES2/gl2.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "render/gles2.h"
+
+static struct wlr_gles2_atlas_slot *slot_create(
+		struct wlr_gles2_atlas_shelf *shelf, struct wlr_gles2_atlas_page *page,
+		int x, int width) {
+	struct wlr_gles2_atlas_slot *slot = calloc(1, sizeof(*slot));
+	if (slot == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	slot->page = page;
+	slot->shelf = shelf;
+	slot->x = x;
+	slot->width = width;
+	return slot;
+}
+
+static void slot_destroy(struct wlr_gles2_atlas_slot *slot) {
+	wl_list_remove(&slot->link);
+	free(slot);
+}
+
+static void shelf_destroy(struct wlr_gles2_atlas_shelf *shelf) {
+	struct wlr_gles2_atlas_slot *slot, *tmp;
+	wl_list_for_each_safe(slot, tmp, &shelf->slots, link) {
+		slot_destroy(slot);
+	}
+	wl_list_remove(&shelf->link);
+	free(shelf);
+}
+
+static struct wlr_gles2_atlas_shelf *shelf_create(
+		struct wlr_gles2_atlas_page *page, int height) {
+	if (page->shelves_height + height > WLR_GLES2_ATLAS_PAGE_SIZE) {
+		return NULL;
+	}
+
+	struct wlr_gles2_atlas_shelf *shelf = calloc(1, sizeof(*shelf));
+	if (shelf == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	shelf->y = page->shelves_height;
+	shelf->height = height;
+	wl_list_init(&shelf->slots);
+
+	// A new shelf is a single free slot spanning the whole page
+	struct wlr_gles2_atlas_slot *slot =
+		slot_create(shelf, page, 0, WLR_GLES2_ATLAS_PAGE_SIZE);
+	if (slot == NULL) {
+		free(shelf);
+		return NULL;
+	}
+	wl_list_insert(&shelf->slots, &slot->link);
+
+	wl_list_insert(page->shelves.prev, &shelf->link);
+	page->shelves_height += height;
+	return shelf;
+}
+
+static struct wlr_gles2_atlas_slot *shelf_alloc(
+		struct wlr_gles2_atlas_shelf *shelf, int width) {
+	struct wlr_gles2_atlas_slot *slot;
+	wl_list_for_each(slot, &shelf->slots, link) {
+		if (slot->used || slot->width < width) {
+			continue;
+		}
+
+		if (slot->width > width) {
+			// Split the slot, keeping the remainder free
+			struct wlr_gles2_atlas_slot *rest = slot_create(shelf,
+				slot->page, slot->x + width, slot->width - width);
+			if (rest == NULL) {
+				return NULL;
+			}
+			wl_list_insert(&slot->link, &rest->link);
+			slot->width = width;
+		}
+
+		slot->used = true;
+		slot->page->slots_used++;
+		return slot;
+	}
+	return NULL;
+}
+
+static void page_destroy(struct wlr_gles2_atlas_page *page) {
+	struct wlr_gles2_atlas_shelf *shelf, *tmp;
+	wl_list_for_each_safe(shelf, tmp, &page->shelves, link) {
+		shelf_destroy(shelf);
+	}
+
+	push_gles2_debug(page->renderer);
+	glDeleteTextures(1, &page->tex);
+	pop_gles2_debug(page->renderer);
+
+	wl_list_remove(&page->link);
+	free(page);
+}
+
+static struct wlr_gles2_atlas_page *page_create(
+		struct wlr_gles2_renderer *renderer, uint32_t drm_format) {
+	const struct wlr_gles2_pixel_format *fmt =
+		get_gles2_format_from_drm(drm_format);
+	assert(fmt != NULL);
+
+	struct wlr_gles2_atlas_page *page = calloc(1, sizeof(*page));
+	if (page == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	page->renderer = renderer;
+	page->drm_format = drm_format;
+	wl_list_init(&page->shelves);
+
+	push_gles2_debug(renderer);
+
+	glGenTextures(1, &page->tex);
+	glBindTexture(GL_TEXTURE_2D, page->tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, fmt->gl_format, WLR_GLES2_ATLAS_PAGE_SIZE,
+		WLR_GLES2_ATLAS_PAGE_SIZE, 0, fmt->gl_format, fmt->gl_type, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	pop_gles2_debug(renderer);
+
+	wl_list_insert(&renderer->atlas_pages, &page->link);
+
+	wlr_log(WLR_DEBUG, "Created %dx%d atlas page for format 0x%"PRIX32,
+		WLR_GLES2_ATLAS_PAGE_SIZE, WLR_GLES2_ATLAS_PAGE_SIZE, drm_format);
+
+	return page;
+}
+
+static struct wlr_gles2_atlas_slot *page_alloc(
+		struct wlr_gles2_atlas_page *page, int width, int height) {
+	struct wlr_gles2_atlas_shelf *shelf;
+	wl_list_for_each(shelf, &page->shelves, link) {
+		// Don't waste too much of taller shelves
+		if (shelf->height < height || shelf->height > height + height / 2) {
+			continue;
+		}
+		struct wlr_gles2_atlas_slot *slot = shelf_alloc(shelf, width);
+		if (slot != NULL) {
+			return slot;
+		}
+	}
+
+	shelf = shelf_create(page, height);
+	if (shelf == NULL) {
+		return NULL;
+	}
+	return shelf_alloc(shelf, width);
+}
+
+struct wlr_gles2_atlas_slot *gles2_atlas_alloc(
+		struct wlr_gles2_renderer *renderer, uint32_t drm_format,
+		int width, int height) {
+	if (width > WLR_GLES2_ATLAS_MAX_SIZE || height > WLR_GLES2_ATLAS_MAX_SIZE) {
+		return NULL;
+	}
+
+	// Leave room for the border
+	width += 2;
+	height += 2;
+
+	struct wlr_gles2_atlas_page *page;
+	wl_list_for_each(page, &renderer->atlas_pages, link) {
+		if (page->drm_format != drm_format) {
+			continue;
+		}
+		struct wlr_gles2_atlas_slot *slot = page_alloc(page, width, height);
+		if (slot != NULL) {
+			return slot;
+		}
+	}
+
+	page = page_create(renderer, drm_format);
+	if (page == NULL) {
+		return NULL;
+	}
+	return page_alloc(page, width, height);
+}
+
+static bool page_is_last_of_format(struct wlr_gles2_atlas_page *page) {
+	struct wlr_gles2_atlas_page *other;
+	wl_list_for_each(other, &page->renderer->atlas_pages, link) {
+		if (other != page && other->drm_format == page->drm_format) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void gles2_atlas_free(struct wlr_gles2_atlas_slot *slot) {
+	struct wlr_gles2_atlas_page *page = slot->page;
+	struct wlr_gles2_atlas_shelf *shelf = slot->shelf;
+
+	assert(slot->used);
+	slot->used = false;
+	page->slots_used--;
+
+	// Merge with free neighbours
+	if (slot->link.next != &shelf->slots) {
+		struct wlr_gles2_atlas_slot *next =
+			wl_container_of(slot->link.next, next, link);
+		if (!next->used) {
+			slot->width += next->width;
+			slot_destroy(next);
+		}
+	}
+	if (slot->link.prev != &shelf->slots) {
+		struct wlr_gles2_atlas_slot *prev =
+			wl_container_of(slot->link.prev, prev, link);
+		if (!prev->used) {
+			prev->width += slot->width;
+			slot_destroy(slot);
+		}
+	}
+
+	if (page->slots_used == 0) {
+		// Keep one page around per format, to avoid re-creating it whenever
+		// e.g. the cursor image changes
+		if (!page_is_last_of_format(page)) {
+			page_destroy(page);
+			return;
+		}
+		struct wlr_gles2_atlas_shelf *tmp;
+		wl_list_for_each_safe(shelf, tmp, &page->shelves, link) {
+			shelf_destroy(shelf);
+		}
+		page->shelves_height = 0;
+		return;
+	}
+
+	// Give back empty shelves at the top of the page
+	while (!wl_list_empty(&page->shelves)) {
+		shelf = wl_container_of(page->shelves.prev, shelf, link);
+		struct wlr_gles2_atlas_slot *first =
+			wl_container_of(shelf->slots.next, first, link);
+		if (first->used || first->width != WLR_GLES2_ATLAS_PAGE_SIZE) {
+			break;
+		}
+		page->shelves_height -= shelf->height;
+		shelf_destroy(shelf);
+	}
+}
+
+void gles2_atlas_slot_get_origin(struct wlr_gles2_atlas_slot *slot,
+		int *x, int *y) {
+	*x = slot->x + 1;
+	*y = slot->shelf->y + 1;
+}
+
+void gles2_atlas_finish(struct wlr_gles2_renderer *renderer) {
+	struct wlr_gles2_atlas_page *page, *tmp;
+	wl_list_for_each_safe(page, tmp, &renderer->atlas_pages, link) {
+		page_destroy(page);
+	}
+}
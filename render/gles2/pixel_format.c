@@ -32,9 +32,44 @@ static const struct wlr_gles2_pixel_format formats[] = {
 		.gl_type = GL_UNSIGNED_BYTE,
 		.has_alpha = true,
 	},
+	{
+		.drm_format = DRM_FORMAT_XBGR2101010,
+		.gl_format = GL_RGBA,
+		.gl_type = GL_UNSIGNED_INT_2_10_10_10_REV_EXT,
+		.has_alpha = false,
+	},
+	{
+		.drm_format = DRM_FORMAT_ABGR2101010,
+		.gl_format = GL_RGBA,
+		.gl_type = GL_UNSIGNED_INT_2_10_10_10_REV_EXT,
+		.has_alpha = true,
+	},
+	{
+		.drm_format = DRM_FORMAT_XBGR16161616F,
+		.gl_format = GL_RGBA,
+		.gl_type = GL_HALF_FLOAT_OES,
+		.has_alpha = false,
+	},
+	{
+		.drm_format = DRM_FORMAT_ABGR16161616F,
+		.gl_format = GL_RGBA,
+		.gl_type = GL_HALF_FLOAT_OES,
+		.has_alpha = true,
+	},
 };
 
-// TODO: more pixel formats
+bool is_gles2_pixel_format_supported(const struct wlr_gles2_renderer *renderer,
+		const struct wlr_gles2_pixel_format *format) {
+	if (format->gl_type == GL_UNSIGNED_INT_2_10_10_10_REV_EXT &&
+			!renderer->exts.texture_type_2_10_10_10_rev_ext) {
+		return false;
+	}
+	if (format->gl_type == GL_HALF_FLOAT_OES &&
+			!renderer->exts.texture_half_float_linear_oes) {
+		return false;
+	}
+	return true;
+}
 
 const struct wlr_gles2_pixel_format *get_gles2_format_from_drm(uint32_t fmt) {
 	for (size_t i = 0; i < sizeof(formats) / sizeof(*formats); ++i) {
@@ -57,11 +92,15 @@ const struct wlr_gles2_pixel_format *get_gles2_format_from_gl(
 	return NULL;
 }
 
-const uint32_t *get_gles2_shm_formats(size_t *len) {
+const uint32_t *get_gles2_shm_formats(const struct wlr_gles2_renderer *renderer,
+		size_t *len) {
 	static uint32_t shm_formats[sizeof(formats) / sizeof(formats[0])];
-	*len = sizeof(formats) / sizeof(formats[0]);
+	size_t j = 0;
 	for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
-		shm_formats[i] = formats[i].drm_format;
+		if (is_gles2_pixel_format_supported(renderer, &formats[i])) {
+			shm_formats[j++] = formats[i].drm_format;
+		}
 	}
+	*len = j;
 	return shm_formats;
 }
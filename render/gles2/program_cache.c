@@ -0,0 +1,159 @@
+#define _POSIX_C_SOURCE 200809L
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/util/log.h>
+#include "render/gles2.h"
+#include "util/cache.h"
+
+/*
+ * On-disk cache of linked programs, using GL_OES_get_program_binary. Each
+ * program is stored in its own file, named after a hash of the driver
+ * identification strings and the shader sources. Binaries rejected by the
+ * driver (e.g. after an update it didn't advertise in its version string) are
+ * simply rebuilt and overwritten.
+ */
+
+#define CACHE_MAGIC 0x50524c57 // "WLRP"
+#define CACHE_MAX_BINARY_SIZE (16 * 1024 * 1024)
+
+struct cache_header {
+	uint32_t magic;
+	uint32_t format;
+	uint32_t length;
+};
+
+static char *get_cache_dir(void) {
+	const char *env = getenv("WLR_GLES2_PROGRAM_CACHE");
+	if (env != NULL) {
+		return env[0] != '\0' ? strdup(env) : NULL;
+	}
+	return cache_get_dir("gles2");
+}
+
+void gles2_program_cache_init(struct wlr_gles2_renderer *renderer) {
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+	if (formats <= 0) {
+		return;
+	}
+
+	char *dir = get_cache_dir();
+	if (dir == NULL) {
+		return;
+	}
+
+	const char *strs[] = {
+		(const char *)glGetString(GL_VENDOR),
+		(const char *)glGetString(GL_RENDERER),
+		(const char *)glGetString(GL_VERSION),
+		(const char *)glGetString(GL_SHADING_LANGUAGE_VERSION),
+	};
+	uint64_t hash = CACHE_HASH_INIT;
+	for (size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+		hash = cache_hash_string(hash, strs[i] != NULL ? strs[i] : "");
+	}
+
+	renderer->program_cache.dir = dir;
+	renderer->program_cache.driver_hash = hash;
+	wlr_log(WLR_DEBUG, "Using GL program cache in %s", dir);
+}
+
+void gles2_program_cache_finish(struct wlr_gles2_renderer *renderer) {
+	free(renderer->program_cache.dir);
+	renderer->program_cache.dir = NULL;
+}
+
+static bool get_program_path(struct wlr_gles2_renderer *renderer,
+		const GLchar *const *srcs, size_t srcs_len, char *path,
+		size_t path_size) {
+	uint64_t hash = renderer->program_cache.driver_hash;
+	for (size_t i = 0; i < srcs_len; i++) {
+		hash = cache_hash_string(hash, srcs[i]);
+	}
+	int n = snprintf(path, path_size, "%s/%016"PRIx64".bin",
+		renderer->program_cache.dir, hash);
+	return n >= 0 && (size_t)n < path_size;
+}
+
+GLuint gles2_program_cache_load(struct wlr_gles2_renderer *renderer,
+		const GLchar *const *srcs, size_t srcs_len) {
+	char path[4096];
+	if (renderer->program_cache.dir == NULL ||
+			!get_program_path(renderer, srcs, srcs_len, path, sizeof(path))) {
+		return 0;
+	}
+
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		return 0;
+	}
+
+	GLuint prog = 0;
+	void *binary = NULL;
+	struct cache_header header;
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+			header.magic != CACHE_MAGIC || header.length == 0 ||
+			header.length > CACHE_MAX_BINARY_SIZE) {
+		goto out;
+	}
+	binary = malloc(header.length);
+	if (binary == NULL || fread(binary, header.length, 1, f) != 1) {
+		goto out;
+	}
+
+	prog = glCreateProgram();
+	renderer->procs.glProgramBinaryOES(prog, header.format, binary,
+		header.length);
+	GLint ok;
+	glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+	if (ok == GL_FALSE) {
+		wlr_log(WLR_DEBUG, "Driver rejected cached program %s", path);
+		glDeleteProgram(prog);
+		prog = 0;
+	}
+
+out:
+	free(binary);
+	fclose(f);
+	return prog;
+}
+
+void gles2_program_cache_store(struct wlr_gles2_renderer *renderer,
+		const GLchar *const *srcs, size_t srcs_len, GLuint prog) {
+	char path[4096];
+	if (renderer->program_cache.dir == NULL ||
+			!get_program_path(renderer, srcs, srcs_len, path, sizeof(path))) {
+		return;
+	}
+
+	GLint length = 0;
+	glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0 || length > CACHE_MAX_BINARY_SIZE) {
+		return;
+	}
+	// The binary is stored right after the header
+	struct cache_header *header = malloc(sizeof(*header) + length);
+	if (header == NULL) {
+		return;
+	}
+	GLsizei written = 0;
+	GLenum format = 0;
+	renderer->procs.glGetProgramBinaryOES(prog, length, &written, &format,
+		header + 1);
+	if (written <= 0) {
+		free(header);
+		return;
+	}
+	header->magic = CACHE_MAGIC;
+	header->format = format;
+	header->length = written;
+
+	if (!cache_write_file(path, header, sizeof(*header) + written)) {
+		wlr_log_errno(WLR_DEBUG, "Failed to write GL program cache %s", path);
+	}
+	free(header);
+}
@@ -1,11 +1,16 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <drm_fourcc.h>
 #include <gbm.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
+#include <inttypes.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <wayland-server-protocol.h>
 #include <wayland-util.h>
@@ -18,6 +23,21 @@
 #include "render/egl.h"
 #include "render/gles2.h"
 #include "render/pixel_format.h"
+#include "util/startup.h"
+
+// From OpenGL ES 3.0
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT 0x0001
+#endif
+#ifndef GL_PACK_ROW_LENGTH
+#define GL_PACK_ROW_LENGTH 0x0D02
+#endif
 
 static const GLfloat verts[] = {
 	1, 0, // top right
@@ -48,7 +68,8 @@ static struct wlr_gles2_renderer *gles2_get_renderer_in_context(
 
 static void destroy_buffer(struct wlr_gles2_buffer *buffer) {
 	wl_list_remove(&buffer->link);
-	wl_list_remove(&buffer->buffer_destroy.link);
+	buffer->renderer->buffers_len--;
+	wlr_addon_finish(&buffer->addon);
 
 	struct wlr_egl_context prev_ctx;
 	wlr_egl_save_context(&prev_ctx);
@@ -68,21 +89,25 @@ static void destroy_buffer(struct wlr_gles2_buffer *buffer) {
 	free(buffer);
 }
 
+static void handle_buffer_destroy(struct wlr_addon *addon) {
+	struct wlr_gles2_buffer *buffer = wl_container_of(addon, buffer, addon);
+	destroy_buffer(buffer);
+}
+
+static const struct wlr_addon_interface buffer_addon_impl = {
+	.name = "wlr_gles2_buffer",
+	.destroy = handle_buffer_destroy,
+};
+
 static struct wlr_gles2_buffer *get_buffer(struct wlr_gles2_renderer *renderer,
 		struct wlr_buffer *wlr_buffer) {
-	struct wlr_gles2_buffer *buffer;
-	wl_list_for_each(buffer, &renderer->buffers, link) {
-		if (buffer->buffer == wlr_buffer) {
-			return buffer;
-		}
+	struct wlr_addon *addon =
+		wlr_addon_find(&wlr_buffer->addons, renderer, &buffer_addon_impl);
+	if (addon == NULL) {
+		return NULL;
 	}
-	return NULL;
-}
-
-static void handle_buffer_destroy(struct wl_listener *listener, void *data) {
-	struct wlr_gles2_buffer *buffer =
-		wl_container_of(listener, buffer, buffer_destroy);
-	destroy_buffer(buffer);
+	struct wlr_gles2_buffer *buffer = wl_container_of(addon, buffer, addon);
+	return buffer;
 }
 
 static struct wlr_gles2_buffer *create_buffer(struct wlr_gles2_renderer *renderer,
@@ -129,10 +154,11 @@ static struct wlr_gles2_buffer *create_buffer(struct wlr_gles2_renderer *rendere
 		goto error_image;
 	}
 
-	buffer->buffer_destroy.notify = handle_buffer_destroy;
-	wl_signal_add(&wlr_buffer->events.destroy, &buffer->buffer_destroy);
+	wlr_addon_init(&buffer->addon, &wlr_buffer->addons, renderer,
+		&buffer_addon_impl);
 
 	wl_list_insert(&renderer->buffers, &buffer->link);
+	renderer->buffers_len++;
 
 	wlr_log(WLR_DEBUG, "Created GL FBO for buffer %dx%d",
 		wlr_buffer->width, wlr_buffer->height);
@@ -146,6 +172,25 @@ error_buffer:
 	return NULL;
 }
 
+/**
+ * Drop the least recently bound buffers when there are too many of them, e.g.
+ * because short-lived offscreen buffers have been rendered to. They are
+ * imported again if they are bound later on.
+ */
+static void buffer_cache_evict(struct wlr_gles2_renderer *renderer) {
+	struct wlr_gles2_buffer *buffer, *tmp;
+	wl_list_for_each_reverse_safe(buffer, tmp, &renderer->buffers, link) {
+		if (renderer->buffers_len <= WLR_GLES2_BUFFER_CACHE_SIZE) {
+			break;
+		}
+		if (buffer == renderer->current_buffer) {
+			continue;
+		}
+		destroy_buffer(buffer);
+		renderer->buffer_cache_stats.evictions++;
+	}
+}
+
 static bool gles2_bind_buffer(struct wlr_renderer *wlr_renderer,
 		struct wlr_buffer *wlr_buffer) {
 	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
@@ -153,6 +198,8 @@ static bool gles2_bind_buffer(struct wlr_renderer *wlr_renderer,
 	if (renderer->current_buffer != NULL) {
 		assert(wlr_egl_is_current(renderer->egl));
 
+		gles2_flush_quads(renderer);
+
 		push_gles2_debug(renderer);
 		glFlush();
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -170,16 +217,25 @@ static bool gles2_bind_buffer(struct wlr_renderer *wlr_renderer,
 	wlr_egl_make_current(renderer->egl);
 
 	struct wlr_gles2_buffer *buffer = get_buffer(renderer, wlr_buffer);
-	if (buffer == NULL) {
+	if (buffer != NULL) {
+		renderer->buffer_cache_stats.hits++;
+		wl_list_remove(&buffer->link);
+		wl_list_insert(&renderer->buffers, &buffer->link);
+	} else {
+		renderer->buffer_cache_stats.misses++;
 		buffer = create_buffer(renderer, wlr_buffer);
-	}
-	if (buffer == NULL) {
-		return false;
+		if (buffer == NULL) {
+			return false;
+		}
 	}
 
 	wlr_buffer_lock(wlr_buffer);
 	renderer->current_buffer = buffer;
 
+	if (renderer->buffers_len > WLR_GLES2_BUFFER_CACHE_SIZE) {
+		buffer_cache_evict(renderer);
+	}
+
 	push_gles2_debug(renderer);
 	glBindFramebuffer(GL_FRAMEBUFFER, renderer->current_buffer->fbo);
 	pop_gles2_debug(renderer);
@@ -187,6 +243,154 @@ static bool gles2_bind_buffer(struct wlr_renderer *wlr_renderer,
 	return true;
 }
 
+static int64_t get_time_nsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Read and reset the disjoint state of the GPU timer. The disjoint operation
+ * may have affected any of the queries still in flight, they are all
+ * discarded.
+ */
+static void timer_check_disjoint(struct wlr_gles2_renderer *renderer) {
+	GLint disjoint = 0;
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	if (!disjoint) {
+		return;
+	}
+	for (size_t i = 0; i < WLR_GLES2_TIMER_FRAMES; i++) {
+		struct wlr_gles2_timer_frame *frame = &renderer->timer.frames[i];
+		if (frame->pending || frame == renderer->timer.current) {
+			frame->disjoint = true;
+		}
+	}
+}
+
+static void timer_frame_begin(struct wlr_gles2_renderer *renderer) {
+	// The render pass gets this sequence number in wlr_renderer_end
+	uint32_t render_seq = renderer->wlr_renderer.render_seq + 1;
+	struct wlr_gles2_timer_frame *frame =
+		&renderer->timer.frames[render_seq % WLR_GLES2_TIMER_FRAMES];
+
+	// Results of the frame we're about to re-use are lost anyways
+	frame->pending = false;
+	if (renderer->exts.disjoint_timer_query_ext) {
+		timer_check_disjoint(renderer);
+	}
+
+	frame->render_seq = render_seq;
+	frame->disjoint = false;
+	frame->draws = 0;
+	frame->cpu_time = get_time_nsec();
+	renderer->timer.current = frame;
+
+	if (!renderer->exts.disjoint_timer_query_ext) {
+		return;
+	}
+
+	if (!frame->has_queries) {
+		renderer->procs.glGenQueriesEXT(
+			sizeof(frame->queries) / sizeof(frame->queries[0]),
+			frame->queries);
+		frame->has_queries = true;
+	}
+
+	renderer->procs.glQueryCounterEXT(frame->queries[0], GL_TIMESTAMP_EXT);
+}
+
+static void timer_frame_end(struct wlr_gles2_renderer *renderer) {
+	struct wlr_gles2_timer_frame *frame = renderer->timer.current;
+	if (frame == NULL) {
+		return;
+	}
+
+	frame->cpu_time = get_time_nsec() - frame->cpu_time;
+	frame->pending = true;
+
+	if (renderer->exts.disjoint_timer_query_ext) {
+		renderer->procs.glQueryCounterEXT(frame->queries[1], GL_TIMESTAMP_EXT);
+		timer_check_disjoint(renderer);
+	}
+
+	renderer->timer.current = NULL;
+}
+
+static uint64_t get_query_result(struct wlr_gles2_renderer *renderer,
+		GLuint query) {
+	GLuint64EXT result = 0;
+	renderer->procs.glGetQueryObjectui64vEXT(query, GL_QUERY_RESULT_EXT,
+		&result);
+	return result;
+}
+
+static bool gles2_get_render_stats(struct wlr_renderer *wlr_renderer,
+		uint32_t render_seq, struct wlr_render_stats *stats) {
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+	struct wlr_gles2_timer_frame *frame =
+		&renderer->timer.frames[render_seq % WLR_GLES2_TIMER_FRAMES];
+	if (!frame->pending || frame->render_seq != render_seq) {
+		return false;
+	}
+
+	*stats = (struct wlr_render_stats){
+		.cpu_time = frame->cpu_time,
+		.gpu_time = -1,
+		.texture_gpu_time = -1,
+		.texture_gpu_time_max = -1,
+	};
+
+	if (!renderer->exts.disjoint_timer_query_ext) {
+		frame->pending = false;
+		return true;
+	}
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(renderer->egl);
+
+	push_gles2_debug(renderer);
+
+	// The end timestamp is written last
+	GLint available = 0;
+	renderer->procs.glGetQueryObjectivEXT(frame->queries[1],
+		GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+	if (!available) {
+		pop_gles2_debug(renderer);
+		wlr_egl_restore_context(&prev_ctx);
+		return false;
+	}
+
+	// A disjoint operation may have happened while the GPU was executing the
+	// queries, after the frame ended
+	timer_check_disjoint(renderer);
+	frame->pending = false;
+
+	if (!frame->disjoint) {
+		stats->gpu_time = get_query_result(renderer, frame->queries[1]) -
+			get_query_result(renderer, frame->queries[0]);
+
+		stats->texture_draws = frame->draws;
+		stats->texture_gpu_time = 0;
+		stats->texture_gpu_time_max = 0;
+		for (size_t i = 0; i < frame->draws; i++) {
+			int64_t draw_time =
+				get_query_result(renderer, frame->queries[3 + 2 * i]) -
+				get_query_result(renderer, frame->queries[2 + 2 * i]);
+			stats->texture_gpu_time += draw_time;
+			if (draw_time > stats->texture_gpu_time_max) {
+				stats->texture_gpu_time_max = draw_time;
+			}
+		}
+	}
+
+	pop_gles2_debug(renderer);
+	wlr_egl_restore_context(&prev_ctx);
+
+	return true;
+}
+
 static void gles2_begin(struct wlr_renderer *wlr_renderer, uint32_t width,
 		uint32_t height) {
 	struct wlr_gles2_renderer *renderer =
@@ -194,6 +398,8 @@ static void gles2_begin(struct wlr_renderer *wlr_renderer, uint32_t width,
 
 	push_gles2_debug(renderer);
 
+	timer_frame_begin(renderer);
+
 	glViewport(0, 0, width, height);
 	renderer->viewport_width = width;
 	renderer->viewport_height = height;
@@ -213,8 +419,50 @@ static void gles2_begin(struct wlr_renderer *wlr_renderer, uint32_t width,
 }
 
 static void gles2_end(struct wlr_renderer *wlr_renderer) {
-	gles2_get_renderer_in_context(wlr_renderer);
-	// no-op
+	struct wlr_gles2_renderer *renderer =
+		gles2_get_renderer_in_context(wlr_renderer);
+
+	gles2_flush_quads(renderer);
+
+	push_gles2_debug(renderer);
+	timer_frame_end(renderer);
+	pop_gles2_debug(renderer);
+}
+
+static float color_lut_lookup(const uint8_t *lut, int channel,
+		float value) {
+	float pos = value * (WLR_GLES2_COLOR_LUT_SIZE - 1);
+	int i = (int)pos;
+	if (i >= WLR_GLES2_COLOR_LUT_SIZE - 1) {
+		return lut[4 * (WLR_GLES2_COLOR_LUT_SIZE - 1) + channel] / 255.0f;
+	}
+	float a = lut[4 * i + channel], b = lut[4 * (i + 1) + channel];
+	return (a + (b - a) * (pos - i)) / 255.0f;
+}
+
+/**
+ * Apply the color transform on the CPU, for operations not going through
+ * the shaders.
+ */
+static void color_transform_apply(struct wlr_gles2_renderer *renderer,
+		float out[static 4], const float color[static 4]) {
+	out[3] = color[3];
+	if (color[3] <= 0) {
+		memcpy(out, color, 4 * sizeof(float));
+		return;
+	}
+
+	const float *m = renderer->color_transform.matrix;
+	float rgb[3];
+	for (int i = 0; i < 3; i++) {
+		float v = (m[3 * i] * color[0] + m[3 * i + 1] * color[1] +
+			m[3 * i + 2] * color[2]) / color[3];
+		v = v < 0 ? 0 : (v > 1 ? 1 : v);
+		rgb[i] = color_lut_lookup(renderer->color_transform.lut, i, v);
+	}
+	for (int i = 0; i < 3; i++) {
+		out[i] = rgb[i] * color[3];
+	}
 }
 
 static void gles2_clear(struct wlr_renderer *wlr_renderer,
@@ -222,6 +470,14 @@ static void gles2_clear(struct wlr_renderer *wlr_renderer,
 	struct wlr_gles2_renderer *renderer =
 		gles2_get_renderer_in_context(wlr_renderer);
 
+	gles2_flush_quads(renderer);
+
+	float transformed[4];
+	if (renderer->color_transform.enabled) {
+		color_transform_apply(renderer, transformed, color);
+		color = transformed;
+	}
+
 	push_gles2_debug(renderer);
 	glClearColor(color[0], color[1], color[2], color[3]);
 	glClear(GL_COLOR_BUFFER_BIT);
@@ -233,6 +489,8 @@ static void gles2_scissor(struct wlr_renderer *wlr_renderer,
 	struct wlr_gles2_renderer *renderer =
 		gles2_get_renderer_in_context(wlr_renderer);
 
+	gles2_flush_quads(renderer);
+
 	push_gles2_debug(renderer);
 	if (box != NULL) {
 		glScissor(box->x, box->y, box->width, box->height);
@@ -249,6 +507,434 @@ static const float flip_180[9] = {
 	0.0f, 0.0f, 1.0f,
 };
 
+static struct wlr_gles2_shaders *get_shaders(
+		struct wlr_gles2_renderer *renderer) {
+	if (renderer->color_transform.enabled) {
+		return &renderer->color_transform_shaders;
+	}
+	return &renderer->shaders;
+}
+
+static struct wlr_gles2_tex_shader *get_tex_shader(
+		struct wlr_gles2_shaders *shaders, struct wlr_gles2_texture *texture) {
+	switch (texture->target) {
+	case GL_TEXTURE_2D:
+		if (texture->yuv.tex_uv != 0) {
+			return &shaders->tex_yuv;
+		} else if (texture->has_alpha) {
+			return &shaders->tex_rgba;
+		} else {
+			return &shaders->tex_rgbx;
+		}
+	case GL_TEXTURE_EXTERNAL_OES:
+		return &shaders->tex_ext;
+	default:
+		abort();
+	}
+}
+
+static void bind_color_transform(struct wlr_gles2_renderer *renderer,
+		GLint color_matrix, GLint color_lut) {
+	if (!renderer->color_transform.enabled) {
+		return;
+	}
+
+	// OpenGL ES 2 requires the glUniformMatrix3fv transpose parameter to be set
+	// to GL_FALSE
+	float matrix[9];
+	wlr_matrix_transpose(matrix, renderer->color_transform.matrix);
+	glUniformMatrix3fv(color_matrix, 1, GL_FALSE, matrix);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, renderer->color_transform.lut_tex);
+	glUniform1i(color_lut, 1);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+static void unbind_color_transform(struct wlr_gles2_renderer *renderer) {
+	if (!renderer->color_transform.enabled) {
+		return;
+	}
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+static void bind_tex_uv(struct wlr_gles2_tex_shader *shader,
+		struct wlr_gles2_texture *texture) {
+	// Texture unit 1 is taken by the color transform LUT
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, texture->yuv.tex_uv);
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(shader->tex_uv, 2);
+	glUniformMatrix3fv(shader->yuv_matrix, 1, GL_FALSE, texture->yuv.matrix);
+	glUniform3fv(shader->yuv_offset, 1, texture->yuv.offset);
+}
+
+static void unbind_tex_uv(void) {
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+/**
+ * Get the box of the next mipmap level covering a box of a level.
+ */
+static void mipmaps_get_next_box(const pixman_box32_t *box, int width,
+		int height, int next_width, int next_height, pixman_box32_t *next) {
+	if (width != 2 * next_width || height != 2 * next_height) {
+		// Texels of odd-sized levels don't map to whole texels of the next
+		// level, redraw all of it
+		*next = (pixman_box32_t){ 0, 0, next_width, next_height };
+		return;
+	}
+	*next = (pixman_box32_t){
+		.x1 = box->x1 / 2,
+		.y1 = box->y1 / 2,
+		.x2 = (box->x2 + 1) / 2,
+		.y2 = (box->y2 + 1) / 2,
+	};
+}
+
+/**
+ * Bring the mipmapped copy of the texture up to date. The first level is
+ * drawn from the texture at half its size, so that YUV and external textures
+ * can be copied too, and the following levels are blitted from the previous
+ * one. Only the damaged area of each level is redrawn.
+ *
+ * The copy uses immutable storage, allocated the first time the texture is
+ * drawn minified.
+ */
+static void texture_update_mipmaps(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_texture *texture) {
+	int width = texture->wlr_texture.width;
+	int height = texture->wlr_texture.height;
+	if (texture->mipmaps.tex == 0) {
+		int copy_width = width > 1 ? width / 2 : 1;
+		int copy_height = height > 1 ? height / 2 : 1;
+		int size = copy_width > copy_height ? copy_width : copy_height;
+		int levels = 1;
+		while (size >> levels) {
+			levels++;
+		}
+
+		glGenTextures(1, &texture->mipmaps.tex);
+		glBindTexture(GL_TEXTURE_2D, texture->mipmaps.tex);
+		renderer->procs.glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8_OES,
+			copy_width, copy_height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+			GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		texture->mipmaps.width = copy_width;
+		texture->mipmaps.height = copy_height;
+		texture->mipmaps.levels = levels;
+		pixman_region32_union_rect(&texture->mipmaps.damage,
+			&texture->mipmaps.damage, 0, 0, width, height);
+	}
+
+	if (!pixman_region32_not_empty(&texture->mipmaps.damage)) {
+		return;
+	}
+
+	GLint prev_fbo;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+	GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+	GLboolean blend = glIsEnabled(GL_BLEND);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_BLEND);
+
+	int level_width = texture->mipmaps.width;
+	int level_height = texture->mipmaps.height;
+	glBindFramebuffer(GL_FRAMEBUFFER, renderer->mipmaps.draw_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_TEXTURE_2D, texture->mipmaps.tex, 0);
+	glViewport(0, 0, level_width, level_height);
+
+	// The copy holds the texture contents, without color transform
+	static const float identity[9] = {
+		1.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 1.0f,
+	};
+	struct wlr_gles2_tex_shader *shader =
+		get_tex_shader(&renderer->shaders, texture);
+	glUseProgram(shader->program);
+	glUniformMatrix3fv(shader->proj, 1, GL_FALSE, identity);
+	glUniform1i(shader->invert_y, false);
+	glUniform1i(shader->tex, 0);
+	glUniform1f(shader->alpha, 1.0f);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(texture->target, texture->tex);
+	// Sampling at the corner of 2x2 texels averages them
+	glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	if (texture->yuv.tex_uv != 0) {
+		bind_tex_uv(shader, texture);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glEnableVertexAttribArray(shader->pos_attrib);
+	glEnableVertexAttribArray(shader->tex_attrib);
+
+	int rects_len;
+	const pixman_box32_t *rects =
+		pixman_region32_rectangles(&texture->mipmaps.damage, &rects_len);
+	pixman_box32_t extents = { 0 };
+	for (int i = 0; i < rects_len; i++) {
+		pixman_box32_t box;
+		mipmaps_get_next_box(&rects[i], width, height,
+			level_width, level_height, &box);
+		if (i == 0) {
+			extents = box;
+		} else {
+			extents.x1 = box.x1 < extents.x1 ? box.x1 : extents.x1;
+			extents.y1 = box.y1 < extents.y1 ? box.y1 : extents.y1;
+			extents.x2 = box.x2 > extents.x2 ? box.x2 : extents.x2;
+			extents.y2 = box.y2 > extents.y2 ? box.y2 : extents.y2;
+		}
+
+		// Texture coordinates are the same in both textures
+		GLfloat u1 = (GLfloat)box.x1 / level_width;
+		GLfloat v1 = (GLfloat)box.y1 / level_height;
+		GLfloat u2 = (GLfloat)box.x2 / level_width;
+		GLfloat v2 = (GLfloat)box.y2 / level_height;
+		const GLfloat verts[] = {
+			2 * u1 - 1, 2 * v1 - 1, u1, v1,
+			2 * u2 - 1, 2 * v1 - 1, u2, v1,
+			2 * u1 - 1, 2 * v2 - 1, u1, v2,
+			2 * u2 - 1, 2 * v2 - 1, u2, v2,
+		};
+		const GLsizei stride = 4 * sizeof(GLfloat);
+		glVertexAttribPointer(shader->pos_attrib, 2, GL_FLOAT, GL_FALSE,
+			stride, &verts[0]);
+		glVertexAttribPointer(shader->tex_attrib, 2, GL_FLOAT, GL_FALSE,
+			stride, &verts[2]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+		if (box.x2 - box.x1 == level_width &&
+				box.y2 - box.y1 == level_height) {
+			break;
+		}
+	}
+
+	glDisableVertexAttribArray(shader->pos_attrib);
+	glDisableVertexAttribArray(shader->tex_attrib);
+	if (texture->yuv.tex_uv != 0) {
+		unbind_tex_uv();
+	}
+	glBindTexture(texture->target, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_TEXTURE_2D, 0, 0);
+
+	// Smaller levels are cheap to redraw, the damage extents are enough
+	glBindFramebuffer(GL_READ_FRAMEBUFFER_NV, renderer->mipmaps.read_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER_NV, renderer->mipmaps.draw_fbo);
+	for (int level = 1; level < texture->mipmaps.levels; level++) {
+		int next_width = level_width > 1 ? level_width / 2 : 1;
+		int next_height = level_height > 1 ? level_height / 2 : 1;
+		pixman_box32_t next;
+		mipmaps_get_next_box(&extents, level_width, level_height,
+			next_width, next_height, &next);
+
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER_NV, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, texture->mipmaps.tex, level - 1);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER_NV, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, texture->mipmaps.tex, level);
+		renderer->procs.glBlitFramebuffer(
+			next.x1 * level_width / next_width,
+			next.y1 * level_height / next_height,
+			next.x2 * level_width / next_width,
+			next.y2 * level_height / next_height,
+			next.x1, next.y1, next.x2, next.y2,
+			GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+		extents = next;
+		level_width = next_width;
+		level_height = next_height;
+	}
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER_NV, GL_COLOR_ATTACHMENT0,
+		GL_TEXTURE_2D, 0, 0);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER_NV, GL_COLOR_ATTACHMENT0,
+		GL_TEXTURE_2D, 0, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+	glViewport(0, 0, renderer->viewport_width, renderer->viewport_height);
+	if (scissor) {
+		glEnable(GL_SCISSOR_TEST);
+	}
+	if (blend) {
+		glEnable(GL_BLEND);
+	}
+
+	pixman_region32_clear(&texture->mipmaps.damage);
+}
+
+void gles2_flush_quads(struct wlr_gles2_renderer *renderer) {
+	struct wlr_gles2_texture *texture = renderer->batch.texture;
+	if (texture == NULL) {
+		return;
+	}
+
+	struct wlr_gles2_shaders *shaders = get_shaders(renderer);
+	struct wlr_gles2_tex_shader *shader = get_tex_shader(shaders, texture);
+	GLenum target = texture->target;
+	GLuint tex = texture->tex;
+	bool yuv = texture->yuv.tex_uv != 0;
+	bool mipmaps_copy = renderer->batch.minify && renderer->mipmaps.enabled;
+
+	// Vertices are already in normalized device coordinates
+	static const float identity[9] = {
+		1.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 1.0f,
+	};
+
+	push_gles2_debug(renderer);
+
+	if (mipmaps_copy) {
+		texture_update_mipmaps(renderer, texture);
+		// The copy is already converted to RGB
+		shader = texture->has_alpha ? &shaders->tex_rgba : &shaders->tex_rgbx;
+		target = GL_TEXTURE_2D;
+		tex = texture->mipmaps.tex;
+		yuv = false;
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(target, tex);
+
+	if (mipmaps_copy) {
+		// Filtering is set up when the copy is created
+	} else if (renderer->batch.minify) {
+		if (!texture->has_mipmaps) {
+			glGenerateMipmap(texture->target);
+			texture->has_mipmaps = true;
+		}
+		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER,
+			GL_LINEAR_MIPMAP_LINEAR);
+	} else {
+		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	}
+
+	glUseProgram(shader->program);
+
+	glUniformMatrix3fv(shader->proj, 1, GL_FALSE, identity);
+	glUniform1i(shader->invert_y, texture->inverted_y);
+	glUniform1i(shader->tex, 0);
+	glUniform1f(shader->alpha, renderer->batch.alpha);
+	bind_color_transform(renderer, shader->color_matrix, shader->color_lut);
+	if (yuv) {
+		bind_tex_uv(shader, texture);
+	}
+
+	const GLsizei stride = WLR_GLES2_BATCH_VERTEX_LEN * sizeof(GLfloat);
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->batch.vbo);
+	glBufferData(GL_ARRAY_BUFFER, renderer->batch.len * stride,
+		renderer->batch.verts, GL_STREAM_DRAW);
+
+	glVertexAttribPointer(shader->pos_attrib, 2, GL_FLOAT, GL_FALSE, stride,
+		(const void *)0);
+	glVertexAttribPointer(shader->tex_attrib, 2, GL_FLOAT, GL_FALSE, stride,
+		(const void *)(2 * sizeof(GLfloat)));
+
+	glEnableVertexAttribArray(shader->pos_attrib);
+	glEnableVertexAttribArray(shader->tex_attrib);
+
+	struct wlr_gles2_timer_frame *timer_frame = renderer->timer.current;
+	bool timed = renderer->exts.disjoint_timer_query_ext &&
+		timer_frame != NULL && timer_frame->draws < WLR_GLES2_TIMER_MAX_DRAWS;
+	if (timed) {
+		renderer->procs.glQueryCounterEXT(
+			timer_frame->queries[2 + 2 * timer_frame->draws], GL_TIMESTAMP_EXT);
+	}
+
+	glDrawArrays(GL_TRIANGLES, 0, renderer->batch.len);
+
+	if (timed) {
+		renderer->procs.glQueryCounterEXT(
+			timer_frame->queries[3 + 2 * timer_frame->draws], GL_TIMESTAMP_EXT);
+		timer_frame->draws++;
+	}
+
+	glDisableVertexAttribArray(shader->pos_attrib);
+	glDisableVertexAttribArray(shader->tex_attrib);
+
+	unbind_color_transform(renderer);
+	if (yuv) {
+		unbind_tex_uv();
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindTexture(target, 0);
+
+	pop_gles2_debug(renderer);
+
+	renderer->batch.texture = NULL;
+	renderer->batch.len = 0;
+}
+
+static void batch_push_vertex(struct wlr_gles2_renderer *renderer,
+		const float m[static 9], GLfloat x, GLfloat y, GLfloat u, GLfloat v) {
+	GLfloat *vert = &renderer->batch.verts[
+		WLR_GLES2_BATCH_VERTEX_LEN * renderer->batch.len];
+	vert[0] = m[0] * x + m[1] * y + m[2];
+	vert[1] = m[3] * x + m[4] * y + m[5];
+	vert[2] = u;
+	vert[3] = v;
+	renderer->batch.len++;
+}
+
+/**
+ * Make room in the batch for vertices sampling the texture, flushing it first
+ * if it draws with a different state.
+ */
+static void batch_prepare(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_texture *texture, float alpha, bool minify,
+		size_t len) {
+	// Textures packed in the same atlas page can be drawn together
+	struct wlr_gles2_texture *batch_texture = renderer->batch.texture;
+	if (batch_texture == NULL || batch_texture->tex != texture->tex ||
+			batch_texture->target != texture->target ||
+			batch_texture->has_alpha != texture->has_alpha ||
+			batch_texture->inverted_y != texture->inverted_y ||
+			renderer->batch.alpha != alpha ||
+			renderer->batch.minify != minify ||
+			renderer->batch.len + len > WLR_GLES2_BATCH_MAX_VERTS) {
+		gles2_flush_quads(renderer);
+	}
+	renderer->batch.texture = texture;
+	renderer->batch.alpha = alpha;
+	renderer->batch.minify = minify;
+}
+
+/**
+ * Whether a quad should be sampled from mipmaps. Linear filtering alone is
+ * fine down to half the size, past that texels start being skipped entirely
+ * and the result shimmers.
+ */
+static bool quad_needs_mipmaps(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_texture *texture, const struct wlr_fbox *box,
+		const float matrix[static 9]) {
+	// Mipmaps of atlas pages would bleed between slots
+	if (texture->atlas_slot != NULL) {
+		return false;
+	}
+	// Imported buffers can't have their own mipmap levels, only a copy
+	if (!renderer->mipmaps.enabled && (!renderer->exts.npot_mipmap ||
+			texture->target != GL_TEXTURE_2D ||
+			texture->image != EGL_NO_IMAGE_KHR)) {
+		return false;
+	}
+
+	// The matrix maps the unit square to the quad in buffer coordinates
+	double dst_width = hypot(matrix[0], matrix[3]);
+	double dst_height = hypot(matrix[1], matrix[4]);
+	return dst_width * 2 < box->width || dst_height * 2 < box->height;
+}
+
 static bool gles2_render_subtexture_with_matrix(
 		struct wlr_renderer *wlr_renderer, struct wlr_texture *wlr_texture,
 		const struct wlr_fbox *box, const float matrix[static 9],
@@ -259,28 +945,49 @@ static bool gles2_render_subtexture_with_matrix(
 		gles2_get_texture(wlr_texture);
 	assert(texture->renderer == renderer);
 
-	struct wlr_gles2_tex_shader *shader = NULL;
+	if (texture->target == GL_TEXTURE_EXTERNAL_OES &&
+			!renderer->exts.egl_image_external_oes) {
+		wlr_log(WLR_ERROR, "Failed to render texture: "
+			"GL_TEXTURE_EXTERNAL_OES not supported");
+		return false;
+	}
 
-	switch (texture->target) {
-	case GL_TEXTURE_2D:
-		if (texture->has_alpha) {
-			shader = &renderer->shaders.tex_rgba;
-		} else {
-			shader = &renderer->shaders.tex_rgbx;
-		}
-		break;
-	case GL_TEXTURE_EXTERNAL_OES:
-		shader = &renderer->shaders.tex_ext;
+	bool minify = quad_needs_mipmaps(renderer, texture, box, matrix);
+	batch_prepare(renderer, texture, alpha, minify, 6);
 
-		if (!renderer->exts.egl_image_external_oes) {
-			wlr_log(WLR_ERROR, "Failed to render texture: "
-				"GL_TEXTURE_EXTERNAL_OES not supported");
-			return false;
-		}
-		break;
-	default:
-		abort();
-	}
+	// The quad is transformed on the CPU so that consecutive quads using the
+	// same texture can be drawn with a single draw call
+	float gl_matrix[9];
+	wlr_matrix_multiply(gl_matrix, renderer->projection, matrix);
+	wlr_matrix_multiply(gl_matrix, flip_180, gl_matrix);
+
+	struct wlr_box region;
+	int tex_width, tex_height;
+	gles2_texture_get_region(texture, &region, &tex_width, &tex_height);
+
+	const GLfloat x1 = (region.x + box->x) / tex_width;
+	const GLfloat y1 = (region.y + box->y) / tex_height;
+	const GLfloat x2 = (region.x + box->x + box->width) / tex_width;
+	const GLfloat y2 = (region.y + box->y + box->height) / tex_height;
+
+	// Two triangles: top right, top left, bottom right, then bottom right,
+	// top left, bottom left
+	batch_push_vertex(renderer, gl_matrix, 1, 0, x2, y1);
+	batch_push_vertex(renderer, gl_matrix, 0, 0, x1, y1);
+	batch_push_vertex(renderer, gl_matrix, 1, 1, x2, y2);
+	batch_push_vertex(renderer, gl_matrix, 1, 1, x2, y2);
+	batch_push_vertex(renderer, gl_matrix, 0, 0, x1, y1);
+	batch_push_vertex(renderer, gl_matrix, 0, 1, x1, y2);
+
+	return true;
+}
+
+static void gles2_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
+		const float color[static 4], const float matrix[static 9]) {
+	struct wlr_gles2_renderer *renderer =
+		gles2_get_renderer_in_context(wlr_renderer);
+
+	gles2_flush_quads(renderer);
 
 	float gl_matrix[9];
 	wlr_matrix_multiply(gl_matrix, renderer->projection, matrix);
@@ -290,82 +997,247 @@ static bool gles2_render_subtexture_with_matrix(
 	// to GL_FALSE
 	wlr_matrix_transpose(gl_matrix, gl_matrix);
 
+	struct wlr_gles2_quad_shader *shader = &get_shaders(renderer)->quad;
+
 	push_gles2_debug(renderer);
+	glUseProgram(shader->program);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(texture->target, texture->tex);
+	glUniformMatrix3fv(shader->proj, 1, GL_FALSE, gl_matrix);
+	glUniform4f(shader->color, color[0], color[1], color[2], color[3]);
+	bind_color_transform(renderer, shader->color_matrix, shader->color_lut);
+
+	glVertexAttribPointer(shader->pos_attrib, 2, GL_FLOAT, GL_FALSE,
+			0, verts);
+
+	glEnableVertexAttribArray(shader->pos_attrib);
+
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	glDisableVertexAttribArray(shader->pos_attrib);
+	unbind_color_transform(renderer);
+
+	pop_gles2_debug(renderer);
+}
+
+/**
+ * Whether the matrix maps the unit square to a rectangle aligned with the
+ * buffer axes. Only those can be clipped on the CPU.
+ */
+static bool matrix_is_axis_aligned(const float m[static 9]) {
+	if (m[6] != 0 || m[7] != 0 || m[8] != 1) {
+		return false;
+	}
+	return (m[1] == 0 && m[3] == 0) || (m[0] == 0 && m[4] == 0);
+}
+
+/**
+ * Get the area covered by the unit square transformed by an axis-aligned
+ * matrix, in buffer coordinates.
+ */
+static void matrix_get_bounds(const float m[static 9], float *x1, float *y1,
+		float *x2, float *y2) {
+	float ax = m[2], bx = m[0] + m[1] + m[2];
+	float ay = m[5], by = m[3] + m[4] + m[5];
+	*x1 = fminf(ax, bx);
+	*x2 = fmaxf(ax, bx);
+	*y1 = fminf(ay, by);
+	*y2 = fmaxf(ay, by);
+}
+
+/**
+ * Intersect a rectangle of the clip region with the bounds. Returns false if
+ * the intersection is empty.
+ */
+static bool clip_rect_to_bounds(const pixman_box32_t *rect, float bx1,
+		float by1, float bx2, float by2, float out[static 4]) {
+	out[0] = fmaxf(rect->x1, bx1);
+	out[1] = fmaxf(rect->y1, by1);
+	out[2] = fminf(rect->x2, bx2);
+	out[3] = fminf(rect->y2, by2);
+	return out[0] < out[2] && out[1] < out[3];
+}
+
+static void batch_push_clipped_vertex(struct wlr_gles2_renderer *renderer,
+		const float gl_matrix[static 9], const float tex_matrix[static 9],
+		GLfloat x, GLfloat y) {
+	GLfloat u = tex_matrix[0] * x + tex_matrix[1] * y + tex_matrix[2];
+	GLfloat v = tex_matrix[3] * x + tex_matrix[4] * y + tex_matrix[5];
+	batch_push_vertex(renderer, gl_matrix, x, y, u, v);
+}
+
+static bool gles2_render_subtexture_with_matrix_clipped(
+		struct wlr_renderer *wlr_renderer, struct wlr_texture *wlr_texture,
+		const struct wlr_fbox *box, const float matrix[static 9],
+		float alpha, const pixman_region32_t *clip) {
+	struct wlr_gles2_renderer *renderer =
+		gles2_get_renderer_in_context(wlr_renderer);
+	struct wlr_gles2_texture *texture =
+		gles2_get_texture(wlr_texture);
+	assert(texture->renderer == renderer);
+
+	int nrects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(
+		(pixman_region32_t *)clip, &nrects);
+
+	const float *m = matrix;
+	float det = m[0] * m[4] - m[1] * m[3];
+	if (!matrix_is_axis_aligned(matrix) || det == 0) {
+		// Rotated quads aren't clipped on the CPU, use the scissor instead
+		bool ok = true;
+		for (int i = 0; i < nrects; i++) {
+			struct wlr_box scissor = {
+				.x = rects[i].x1,
+				.y = rects[i].y1,
+				.width = rects[i].x2 - rects[i].x1,
+				.height = rects[i].y2 - rects[i].y1,
+			};
+			gles2_scissor(wlr_renderer, &scissor);
+			ok = gles2_render_subtexture_with_matrix(wlr_renderer,
+				wlr_texture, box, matrix, alpha) && ok;
+		}
+		gles2_scissor(wlr_renderer, NULL);
+		return ok;
+	}
 
-	glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	if (texture->target == GL_TEXTURE_EXTERNAL_OES &&
+			!renderer->exts.egl_image_external_oes) {
+		wlr_log(WLR_ERROR, "Failed to render texture: "
+			"GL_TEXTURE_EXTERNAL_OES not supported");
+		return false;
+	}
 
-	glUseProgram(shader->program);
+	bool minify = quad_needs_mipmaps(renderer, texture, box, matrix);
 
-	glUniformMatrix3fv(shader->proj, 1, GL_FALSE, gl_matrix);
-	glUniform1i(shader->invert_y, texture->inverted_y);
-	glUniform1i(shader->tex, 0);
-	glUniform1f(shader->alpha, alpha);
-
-	const GLfloat x1 = box->x / wlr_texture->width;
-	const GLfloat y1 = box->y / wlr_texture->height;
-	const GLfloat x2 = (box->x + box->width) / wlr_texture->width;
-	const GLfloat y2 = (box->y + box->height) / wlr_texture->height;
-	const GLfloat texcoord[] = {
-		x2, y1, // top right
-		x1, y1, // top left
-		x2, y2, // bottom right
-		x1, y2, // bottom left
+	// Inverse of the matrix: from buffer coordinates to the unit square
+	const float inverse[9] = {
+		m[4] / det, -m[1] / det, (m[1] * m[5] - m[4] * m[2]) / det,
+		-m[3] / det, m[0] / det, (m[3] * m[2] - m[0] * m[5]) / det,
+		0.0f, 0.0f, 1.0f,
 	};
 
-	glVertexAttribPointer(shader->pos_attrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
-	glVertexAttribPointer(shader->tex_attrib, 2, GL_FLOAT, GL_FALSE, 0, texcoord);
+	struct wlr_box region;
+	int tex_width, tex_height;
+	gles2_texture_get_region(texture, &region, &tex_width, &tex_height);
 
-	glEnableVertexAttribArray(shader->pos_attrib);
-	glEnableVertexAttribArray(shader->tex_attrib);
+	// From the unit square to texture coordinates
+	const float tex_box[9] = {
+		box->width / tex_width, 0.0f, (region.x + box->x) / tex_width,
+		0.0f, box->height / tex_height, (region.y + box->y) / tex_height,
+		0.0f, 0.0f, 1.0f,
+	};
+	float tex_matrix[9];
+	wlr_matrix_multiply(tex_matrix, tex_box, inverse);
 
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	// Vertices are pieces of the quad, in buffer coordinates
+	float gl_matrix[9];
+	wlr_matrix_multiply(gl_matrix, flip_180, renderer->projection);
 
-	glDisableVertexAttribArray(shader->pos_attrib);
-	glDisableVertexAttribArray(shader->tex_attrib);
+	float bx1, by1, bx2, by2;
+	matrix_get_bounds(matrix, &bx1, &by1, &bx2, &by2);
 
-	glBindTexture(texture->target, 0);
+	for (int i = 0; i < nrects; i++) {
+		float r[4];
+		if (!clip_rect_to_bounds(&rects[i], bx1, by1, bx2, by2, r)) {
+			continue;
+		}
+
+		batch_prepare(renderer, texture, alpha, minify, 6);
+		batch_push_clipped_vertex(renderer, gl_matrix, tex_matrix, r[2], r[1]);
+		batch_push_clipped_vertex(renderer, gl_matrix, tex_matrix, r[0], r[1]);
+		batch_push_clipped_vertex(renderer, gl_matrix, tex_matrix, r[2], r[3]);
+		batch_push_clipped_vertex(renderer, gl_matrix, tex_matrix, r[2], r[3]);
+		batch_push_clipped_vertex(renderer, gl_matrix, tex_matrix, r[0], r[1]);
+		batch_push_clipped_vertex(renderer, gl_matrix, tex_matrix, r[0], r[3]);
+	}
 
-	pop_gles2_debug(renderer);
 	return true;
 }
 
-static void gles2_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
-		const float color[static 4], const float matrix[static 9]) {
+// Rectangles drawn per draw call by gles2_render_quad_with_matrix_clipped
+#define CLIPPED_QUAD_RECTS 64
+
+static void gles2_render_quad_with_matrix_clipped(
+		struct wlr_renderer *wlr_renderer, const float color[static 4],
+		const float matrix[static 9], const pixman_region32_t *clip) {
 	struct wlr_gles2_renderer *renderer =
 		gles2_get_renderer_in_context(wlr_renderer);
 
-	float gl_matrix[9];
-	wlr_matrix_multiply(gl_matrix, renderer->projection, matrix);
-	wlr_matrix_multiply(gl_matrix, flip_180, gl_matrix);
+	int nrects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(
+		(pixman_region32_t *)clip, &nrects);
+
+	if (!matrix_is_axis_aligned(matrix)) {
+		for (int i = 0; i < nrects; i++) {
+			struct wlr_box scissor = {
+				.x = rects[i].x1,
+				.y = rects[i].y1,
+				.width = rects[i].x2 - rects[i].x1,
+				.height = rects[i].y2 - rects[i].y1,
+			};
+			gles2_scissor(wlr_renderer, &scissor);
+			gles2_render_quad_with_matrix(wlr_renderer, color, matrix);
+		}
+		gles2_scissor(wlr_renderer, NULL);
+		return;
+	}
 
-	// OpenGL ES 2 requires the glUniformMatrix3fv transpose parameter to be set
-	// to GL_FALSE
+	gles2_flush_quads(renderer);
+
+	// Vertices are in buffer coordinates
+	float gl_matrix[9];
+	wlr_matrix_multiply(gl_matrix, flip_180, renderer->projection);
 	wlr_matrix_transpose(gl_matrix, gl_matrix);
 
+	float bx1, by1, bx2, by2;
+	matrix_get_bounds(matrix, &bx1, &by1, &bx2, &by2);
+
+	struct wlr_gles2_quad_shader *shader = &get_shaders(renderer)->quad;
+
 	push_gles2_debug(renderer);
-	glUseProgram(renderer->shaders.quad.program);
+	glUseProgram(shader->program);
 
-	glUniformMatrix3fv(renderer->shaders.quad.proj, 1, GL_FALSE, gl_matrix);
-	glUniform4f(renderer->shaders.quad.color, color[0], color[1], color[2], color[3]);
+	glUniformMatrix3fv(shader->proj, 1, GL_FALSE, gl_matrix);
+	glUniform4f(shader->color, color[0], color[1], color[2], color[3]);
+	bind_color_transform(renderer, shader->color_matrix, shader->color_lut);
 
-	glVertexAttribPointer(renderer->shaders.quad.pos_attrib, 2, GL_FLOAT, GL_FALSE,
-			0, verts);
+	GLfloat rect_verts[2 * 6 * CLIPPED_QUAD_RECTS];
+	glVertexAttribPointer(shader->pos_attrib, 2, GL_FLOAT, GL_FALSE,
+			0, rect_verts);
+	glEnableVertexAttribArray(shader->pos_attrib);
 
-	glEnableVertexAttribArray(renderer->shaders.quad.pos_attrib);
+	int len = 0;
+	for (int i = 0; i < nrects; i++) {
+		float r[4];
+		if (!clip_rect_to_bounds(&rects[i], bx1, by1, bx2, by2, r)) {
+			continue;
+		}
 
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		const GLfloat rect[] = {
+			r[2], r[1], r[0], r[1], r[2], r[3],
+			r[2], r[3], r[0], r[1], r[0], r[3],
+		};
+		memcpy(&rect_verts[2 * len], rect, sizeof(rect));
+		len += 6;
+
+		if (len == 6 * CLIPPED_QUAD_RECTS) {
+			glDrawArrays(GL_TRIANGLES, 0, len);
+			len = 0;
+		}
+	}
+	if (len > 0) {
+		glDrawArrays(GL_TRIANGLES, 0, len);
+	}
 
-	glDisableVertexAttribArray(renderer->shaders.quad.pos_attrib);
+	glDisableVertexAttribArray(shader->pos_attrib);
+	unbind_color_transform(renderer);
 
 	pop_gles2_debug(renderer);
 }
 
 static const uint32_t *gles2_get_shm_texture_formats(
 		struct wlr_renderer *wlr_renderer, size_t *len) {
-	return get_gles2_shm_formats(len);
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+	return get_gles2_shm_formats(renderer, len);
 }
 
 static bool gles2_resource_is_wl_drm_buffer(struct wlr_renderer *wlr_renderer,
@@ -429,7 +1301,7 @@ static uint32_t gles2_preferred_read_format(
 
 	const struct wlr_gles2_pixel_format *fmt =
 		get_gles2_format_from_gl(gl_format, gl_type, alpha_size > 0);
-	if (fmt != NULL) {
+	if (fmt != NULL && is_gles2_pixel_format_supported(renderer, fmt)) {
 		return fmt->drm_format;
 	}
 
@@ -439,16 +1311,43 @@ static uint32_t gles2_preferred_read_format(
 	return DRM_FORMAT_XBGR8888;
 }
 
-static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
-		uint32_t drm_format, uint32_t *flags, uint32_t stride,
+/**
+ * Pick the format to read pixels in. Formats other than the GL
+ * implementation's preferred one are read in the preferred format and
+ * converted on the CPU, if possible.
+ */
+static uint32_t get_read_format(struct wlr_gles2_renderer *renderer,
+		uint32_t drm_format) {
+	uint32_t preferred_format =
+		gles2_preferred_read_format(&renderer->wlr_renderer);
+	if (preferred_format != DRM_FORMAT_INVALID &&
+			pixel_format_can_convert(drm_format, preferred_format)) {
+		return preferred_format;
+	}
+	return drm_format;
+}
+
+static void *get_read_buffer(struct wlr_gles2_renderer *renderer,
+		size_t size) {
+	if (renderer->read_buffer.size < size) {
+		void *data = realloc(renderer->read_buffer.data, size);
+		if (data == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			return NULL;
+		}
+		renderer->read_buffer.data = data;
+		renderer->read_buffer.size = size;
+	}
+	return renderer->read_buffer.data;
+}
+
+static bool read_pixels_direct(struct wlr_gles2_renderer *renderer,
+		uint32_t drm_format, uint32_t stride,
 		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
 		uint32_t dst_x, uint32_t dst_y, void *data) {
-	struct wlr_gles2_renderer *renderer =
-		gles2_get_renderer_in_context(wlr_renderer);
-
 	const struct wlr_gles2_pixel_format *fmt =
 		get_gles2_format_from_drm(drm_format);
-	if (fmt == NULL) {
+	if (fmt == NULL || !is_gles2_pixel_format_supported(renderer, fmt)) {
 		wlr_log(WLR_ERROR, "Cannot read pixels: unsupported pixel format");
 		return false;
 	}
@@ -463,6 +1362,8 @@ static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
 		drm_get_pixel_format_info(fmt->drm_format);
 	assert(drm_fmt);
 
+	gles2_flush_quads(renderer);
+
 	push_gles2_debug(renderer);
 
 	// Make sure any pending drawing is finished before we try to read it
@@ -477,6 +1378,14 @@ static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
 		// one glReadPixels call
 
 		glReadPixels(src_x, src_y, width, height, fmt->gl_format, fmt->gl_type, p);
+	} else if (renderer->exts.pixel_buffer_object &&
+			stride % (drm_fmt->bpp / 8) == 0 && stride % 4 == 0) {
+		// OpenGL ES 3.0 supports GL_PACK_ROW_LENGTH (rows are aligned to
+		// 4 bytes by default)
+		glPixelStorei(GL_PACK_ROW_LENGTH, stride / (drm_fmt->bpp / 8));
+		glReadPixels(src_x, src_y, width, height, fmt->gl_format, fmt->gl_type,
+			p + dst_x * drm_fmt->bpp / 8);
+		glPixelStorei(GL_PACK_ROW_LENGTH, 0);
 	} else {
 		// Unfortunately GLES2 doesn't support GL_PACK_*, so we have to read
 		// the lines out row by row
@@ -489,11 +1398,209 @@ static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
 
 	pop_gles2_debug(renderer);
 
+	return glGetError() == GL_NO_ERROR;
+}
+
+static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
+		uint32_t drm_format, uint32_t *flags, uint32_t stride,
+		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
+		uint32_t dst_x, uint32_t dst_y, void *data) {
+	struct wlr_gles2_renderer *renderer =
+		gles2_get_renderer_in_context(wlr_renderer);
+
+	bool ok;
+	uint32_t read_format = get_read_format(renderer, drm_format);
+	if (read_format == drm_format) {
+		ok = read_pixels_direct(renderer, drm_format, stride, width, height,
+			src_x, src_y, dst_x, dst_y, data);
+	} else {
+		// All formats supported by the converter have 32 bits per pixel
+		uint32_t read_stride = width * 4;
+		void *read_data = get_read_buffer(renderer,
+			(size_t)read_stride * height);
+		unsigned char *p = (unsigned char *)data + dst_y * stride + dst_x * 4;
+		ok = read_data != NULL &&
+			read_pixels_direct(renderer, read_format, read_stride,
+				width, height, src_x, src_y, 0, 0, read_data) &&
+			pixel_format_convert(drm_format, p, stride,
+				read_format, read_data, read_stride, width, height, false);
+	}
+
+	if (flags != NULL) {
+		*flags = 0;
+	}
+
+	return ok;
+}
+
+static const struct wlr_read_pixels_request_impl read_request_impl;
+
+static struct wlr_gles2_read_request *gles2_get_read_request(
+		struct wlr_read_pixels_request *wlr_request) {
+	assert(wlr_request->impl == &read_request_impl);
+	return (struct wlr_gles2_read_request *)wlr_request;
+}
+
+static bool gles2_read_request_is_ready(
+		struct wlr_read_pixels_request *wlr_request) {
+	struct wlr_gles2_read_request *request =
+		gles2_get_read_request(wlr_request);
+	if (request->fence == EGL_NO_SYNC_KHR) {
+		return true;
+	}
+	return wlr_egl_wait_sync(request->renderer->egl, request->fence, 0);
+}
+
+static bool gles2_read_request_finish(struct wlr_read_pixels_request *wlr_request,
+		uint32_t *flags, uint32_t stride, uint32_t dst_x, uint32_t dst_y,
+		void *data) {
+	struct wlr_gles2_read_request *request =
+		gles2_get_read_request(wlr_request);
+	struct wlr_gles2_renderer *renderer = request->renderer;
+	uint32_t width = request->base.width, height = request->base.height;
+	uint32_t pack_stride = width * request->bpp / 8;
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(renderer->egl);
+
+	push_gles2_debug(renderer);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, request->pbo);
+	// Blocks if the transfer isn't complete yet
+	const unsigned char *src = renderer->procs.glMapBufferRange(
+		GL_PIXEL_PACK_BUFFER, 0, pack_stride * height, GL_MAP_READ_BIT);
+	bool ok = src != NULL;
+	if (ok) {
+		unsigned char *p = (unsigned char *)data + dst_y * stride +
+			dst_x * request->bpp / 8;
+		if (request->fmt->drm_format != request->base.format) {
+			ok = pixel_format_convert(request->base.format, p, stride,
+				request->fmt->drm_format, src, pack_stride, width, height,
+				false);
+		} else if (pack_stride == stride) {
+			memcpy(p, src, pack_stride * height);
+		} else {
+			for (size_t i = 0; i < height; ++i) {
+				memcpy(p + i * stride, src + i * pack_stride, pack_stride);
+			}
+		}
+		renderer->procs.glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	} else {
+		wlr_log(WLR_ERROR, "Failed to map pixel buffer object");
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	pop_gles2_debug(renderer);
+
+	wlr_egl_restore_context(&prev_ctx);
+
 	if (flags != NULL) {
 		*flags = 0;
 	}
 
-	return glGetError() == GL_NO_ERROR;
+	return ok;
+}
+
+static void gles2_read_request_destroy(
+		struct wlr_read_pixels_request *wlr_request) {
+	struct wlr_gles2_read_request *request =
+		gles2_get_read_request(wlr_request);
+	struct wlr_gles2_renderer *renderer = request->renderer;
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(renderer->egl);
+
+	push_gles2_debug(renderer);
+	glDeleteBuffers(1, &request->pbo);
+	pop_gles2_debug(renderer);
+
+	wlr_egl_destroy_sync(renderer->egl, request->fence);
+
+	wlr_egl_restore_context(&prev_ctx);
+
+	free(request);
+}
+
+static const struct wlr_read_pixels_request_impl read_request_impl = {
+	.is_ready = gles2_read_request_is_ready,
+	.finish = gles2_read_request_finish,
+	.destroy = gles2_read_request_destroy,
+};
+
+static struct wlr_read_pixels_request *gles2_read_pixels_async(
+		struct wlr_renderer *wlr_renderer, uint32_t drm_format,
+		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y) {
+	struct wlr_gles2_renderer *renderer =
+		gles2_get_renderer_in_context(wlr_renderer);
+
+	if (!renderer->exts.pixel_buffer_object ||
+			!renderer->egl->exts.fence_sync_khr) {
+		return NULL;
+	}
+
+	const struct wlr_gles2_pixel_format *fmt =
+		get_gles2_format_from_drm(get_read_format(renderer, drm_format));
+	if (fmt == NULL || !is_gles2_pixel_format_supported(renderer, fmt)) {
+		wlr_log(WLR_ERROR, "Cannot read pixels: unsupported pixel format");
+		return NULL;
+	}
+
+	if (fmt->gl_format == GL_BGRA_EXT && !renderer->exts.read_format_bgra_ext) {
+		wlr_log(WLR_ERROR,
+			"Cannot read pixels: missing GL_EXT_read_format_bgra extension");
+		return NULL;
+	}
+
+	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(fmt->drm_format);
+	assert(drm_fmt);
+
+	struct wlr_gles2_read_request *request = calloc(1, sizeof(*request));
+	if (request == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	wlr_read_pixels_request_init(&request->base, &read_request_impl,
+		drm_format, width, height);
+	request->renderer = renderer;
+	request->fmt = fmt;
+	request->bpp = drm_fmt->bpp;
+
+	gles2_flush_quads(renderer);
+
+	push_gles2_debug(renderer);
+
+	glGetError(); // Clear the error flag
+
+	glGenBuffers(1, &request->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, request->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, width * height * drm_fmt->bpp / 8,
+		NULL, GL_STREAM_READ);
+
+	// Rows are tightly packed in the buffer object
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(src_x, src_y, width, height, fmt->gl_format, fmt->gl_type,
+		(void *)0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	bool ok = glGetError() == GL_NO_ERROR;
+
+	pop_gles2_debug(renderer);
+
+	if (ok) {
+		request->fence = wlr_egl_create_fence(renderer->egl);
+		ok = request->fence != EGL_NO_SYNC_KHR;
+	}
+	if (!ok) {
+		gles2_read_request_destroy(&request->base);
+		return NULL;
+	}
+
+	return &request->base;
 }
 
 static bool gles2_init_wl_display(struct wlr_renderer *wlr_renderer,
@@ -538,9 +1645,21 @@ struct wlr_egl *wlr_gles2_renderer_get_egl(struct wlr_renderer *wlr_renderer) {
 	return renderer->egl;
 }
 
+static bool link_shaders(struct wlr_gles2_renderer *renderer,
+	struct wlr_gles2_shaders *shaders, bool color_transform);
+
+static void destroy_shaders(struct wlr_gles2_shaders *shaders);
+
 static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
 
+	gles2_upload_worker_finish(renderer);
+
+	wlr_log(WLR_DEBUG, "GLES2 buffer cache: %"PRIu64" hits, "
+		"%"PRIu64" misses, %"PRIu64" evictions",
+		renderer->buffer_cache_stats.hits, renderer->buffer_cache_stats.misses,
+		renderer->buffer_cache_stats.evictions);
+
 	wlr_egl_make_current(renderer->egl);
 
 	struct wlr_gles2_buffer *buffer, *buffer_tmp;
@@ -553,11 +1672,25 @@ static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 		gles2_texture_destroy(tex);
 	}
 
+	gles2_atlas_finish(renderer);
+
 	push_gles2_debug(renderer);
-	glDeleteProgram(renderer->shaders.quad.program);
-	glDeleteProgram(renderer->shaders.tex_rgba.program);
-	glDeleteProgram(renderer->shaders.tex_rgbx.program);
-	glDeleteProgram(renderer->shaders.tex_ext.program);
+	destroy_shaders(&renderer->shaders);
+	if (renderer->has_color_transform_shaders) {
+		destroy_shaders(&renderer->color_transform_shaders);
+	}
+	glDeleteTextures(1, &renderer->color_transform.lut_tex);
+	glDeleteBuffers(1, &renderer->batch.vbo);
+	glDeleteFramebuffers(1, &renderer->mipmaps.read_fbo);
+	glDeleteFramebuffers(1, &renderer->mipmaps.draw_fbo);
+	for (size_t i = 0; i < WLR_GLES2_TIMER_FRAMES; i++) {
+		struct wlr_gles2_timer_frame *frame = &renderer->timer.frames[i];
+		if (frame->has_queries) {
+			renderer->procs.glDeleteQueriesEXT(
+				sizeof(frame->queries) / sizeof(frame->queries[0]),
+				frame->queries);
+		}
+	}
 	pop_gles2_debug(renderer);
 
 	if (renderer->exts.debug_khr) {
@@ -572,9 +1705,78 @@ static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 		close(renderer->drm_fd);
 	}
 
+	gles2_program_cache_finish(renderer);
+	free(renderer->read_buffer.data);
 	free(renderer);
 }
 
+static bool gles2_set_color_transform(struct wlr_renderer *wlr_renderer,
+		const float *matrix, size_t ramp_size, const uint16_t *ramps) {
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+
+	if (matrix == NULL && ramp_size == 0) {
+		renderer->color_transform.enabled = false;
+		return true;
+	}
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(renderer->egl);
+	push_gles2_debug(renderer);
+
+	bool ok = false;
+	if (!renderer->has_color_transform_shaders) {
+		if (!link_shaders(renderer, &renderer->color_transform_shaders, true)) {
+			wlr_log(WLR_ERROR, "Failed to link color transform shaders");
+			goto out;
+		}
+		renderer->has_color_transform_shaders = true;
+	}
+
+	if (matrix != NULL) {
+		memcpy(renderer->color_transform.matrix, matrix,
+			sizeof(renderer->color_transform.matrix));
+	} else {
+		wlr_matrix_identity(renderer->color_transform.matrix);
+	}
+
+	// Resample the ramps to the LUT size
+	uint8_t *lut = renderer->color_transform.lut;
+	for (size_t i = 0; i < WLR_GLES2_COLOR_LUT_SIZE; i++) {
+		for (size_t c = 0; c < 3; c++) {
+			uint8_t value = i;
+			if (ramp_size > 0) {
+				const uint16_t *ramp = &ramps[c * ramp_size];
+				size_t j = i * (ramp_size - 1) / (WLR_GLES2_COLOR_LUT_SIZE - 1);
+				value = ramp[j] >> 8;
+			}
+			lut[4 * i + c] = value;
+		}
+		lut[4 * i + 3] = 0xFF;
+	}
+
+	if (renderer->color_transform.lut_tex == 0) {
+		glGenTextures(1, &renderer->color_transform.lut_tex);
+	}
+	glBindTexture(GL_TEXTURE_2D, renderer->color_transform.lut_tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, WLR_GLES2_COLOR_LUT_SIZE, 1, 0,
+		GL_RGBA, GL_UNSIGNED_BYTE, lut);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	renderer->color_transform.enabled = true;
+	ok = true;
+
+out:
+	pop_gles2_debug(renderer);
+	wlr_egl_restore_context(&prev_ctx);
+	return ok;
+}
+
 static const struct wlr_renderer_impl renderer_impl = {
 	.destroy = gles2_destroy,
 	.bind_buffer = gles2_bind_buffer,
@@ -584,6 +1786,9 @@ static const struct wlr_renderer_impl renderer_impl = {
 	.scissor = gles2_scissor,
 	.render_subtexture_with_matrix = gles2_render_subtexture_with_matrix,
 	.render_quad_with_matrix = gles2_render_quad_with_matrix,
+	.render_subtexture_with_matrix_clipped =
+		gles2_render_subtexture_with_matrix_clipped,
+	.render_quad_with_matrix_clipped = gles2_render_quad_with_matrix_clipped,
 	.get_shm_texture_formats = gles2_get_shm_texture_formats,
 	.resource_is_wl_drm_buffer = gles2_resource_is_wl_drm_buffer,
 	.wl_drm_buffer_get_size = gles2_wl_drm_buffer_get_size,
@@ -591,11 +1796,15 @@ static const struct wlr_renderer_impl renderer_impl = {
 	.get_render_formats = gles2_get_render_formats,
 	.preferred_read_format = gles2_preferred_read_format,
 	.read_pixels = gles2_read_pixels,
+	.read_pixels_async = gles2_read_pixels_async,
+	.upload_buffer_async = gles2_upload_buffer_async,
 	.texture_from_wl_drm = gles2_texture_from_wl_drm,
 	.init_wl_display = gles2_init_wl_display,
 	.get_drm_fd = gles2_get_drm_fd,
 	.get_render_buffer_caps = gles2_get_render_buffer_caps,
 	.texture_from_buffer = gles2_texture_from_buffer,
+	.get_render_stats = gles2_get_render_stats,
+	.set_color_transform = gles2_set_color_transform,
 };
 
 void push_gles2_debug_(struct wlr_gles2_renderer *renderer,
@@ -637,11 +1846,15 @@ static void gles2_log(GLenum src, GLenum type, GLuint id, GLenum severity,
 }
 
 static GLuint compile_shader(struct wlr_gles2_renderer *renderer,
-		GLuint type, const GLchar *src) {
+		GLuint type, const GLchar *src, bool color_transform) {
 	push_gles2_debug(renderer);
 
+	const GLchar *srcs[] = {
+		color_transform ? "#define COLOR_TRANSFORM\n" : "",
+		src,
+	};
 	GLuint shader = glCreateShader(type);
-	glShaderSource(shader, 1, &src, NULL);
+	glShaderSource(shader, 2, srcs, NULL);
 	glCompileShader(shader);
 
 	GLint ok;
@@ -656,21 +1869,34 @@ static GLuint compile_shader(struct wlr_gles2_renderer *renderer,
 }
 
 static GLuint link_program(struct wlr_gles2_renderer *renderer,
-		const GLchar *vert_src, const GLchar *frag_src) {
+		const GLchar *vert_src, const GLchar *frag_src, bool color_transform) {
 	push_gles2_debug(renderer);
 
-	GLuint vert = compile_shader(renderer, GL_VERTEX_SHADER, vert_src);
+	const GLchar *cache_key[] = {
+		vert_src,
+		color_transform ? "#define COLOR_TRANSFORM\n" : "",
+		frag_src,
+	};
+	size_t cache_key_len = sizeof(cache_key) / sizeof(cache_key[0]);
+	GLuint prog = gles2_program_cache_load(renderer, cache_key, cache_key_len);
+	if (prog != 0) {
+		pop_gles2_debug(renderer);
+		return prog;
+	}
+
+	GLuint vert = compile_shader(renderer, GL_VERTEX_SHADER, vert_src, false);
 	if (!vert) {
 		goto error;
 	}
 
-	GLuint frag = compile_shader(renderer, GL_FRAGMENT_SHADER, frag_src);
+	GLuint frag = compile_shader(renderer, GL_FRAGMENT_SHADER, frag_src,
+		color_transform);
 	if (!frag) {
 		glDeleteShader(vert);
 		goto error;
 	}
 
-	GLuint prog = glCreateProgram();
+	prog = glCreateProgram();
 	glAttachShader(prog, vert);
 	glAttachShader(prog, frag);
 	glLinkProgram(prog);
@@ -687,6 +1913,8 @@ static GLuint link_program(struct wlr_gles2_renderer *renderer,
 		goto error;
 	}
 
+	gles2_program_cache_store(renderer, cache_key, cache_key_len, prog);
+
 	pop_gles2_debug(renderer);
 	return prog;
 
@@ -695,6 +1923,87 @@ error:
 	return 0;
 }
 
+extern const GLchar quad_vertex_src[];
+extern const GLchar quad_fragment_src[];
+extern const GLchar tex_vertex_src[];
+extern const GLchar tex_fragment_src_rgba[];
+extern const GLchar tex_fragment_src_rgbx[];
+extern const GLchar tex_fragment_src_external[];
+extern const GLchar tex_fragment_src_yuv[];
+
+static void destroy_shaders(struct wlr_gles2_shaders *shaders) {
+	glDeleteProgram(shaders->quad.program);
+	glDeleteProgram(shaders->tex_rgba.program);
+	glDeleteProgram(shaders->tex_rgbx.program);
+	glDeleteProgram(shaders->tex_ext.program);
+	glDeleteProgram(shaders->tex_yuv.program);
+}
+
+static bool link_tex_shader(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_tex_shader *shader, const GLchar *frag_src,
+		bool color_transform) {
+	GLuint prog;
+	shader->program = prog =
+		link_program(renderer, tex_vertex_src, frag_src, color_transform);
+	if (!shader->program) {
+		return false;
+	}
+	shader->proj = glGetUniformLocation(prog, "proj");
+	shader->invert_y = glGetUniformLocation(prog, "invert_y");
+	shader->tex = glGetUniformLocation(prog, "tex");
+	shader->alpha = glGetUniformLocation(prog, "alpha");
+	shader->pos_attrib = glGetAttribLocation(prog, "pos");
+	shader->tex_attrib = glGetAttribLocation(prog, "texcoord");
+	shader->color_matrix = glGetUniformLocation(prog, "color_matrix");
+	shader->color_lut = glGetUniformLocation(prog, "color_lut");
+	shader->tex_uv = glGetUniformLocation(prog, "tex_uv");
+	shader->yuv_matrix = glGetUniformLocation(prog, "yuv_matrix");
+	shader->yuv_offset = glGetUniformLocation(prog, "yuv_offset");
+	return true;
+}
+
+static bool link_shaders(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_shaders *shaders, bool color_transform) {
+	memset(shaders, 0, sizeof(*shaders));
+
+	GLuint prog;
+	shaders->quad.program = prog = link_program(renderer,
+		quad_vertex_src, quad_fragment_src, color_transform);
+	if (!shaders->quad.program) {
+		goto error;
+	}
+	shaders->quad.proj = glGetUniformLocation(prog, "proj");
+	shaders->quad.color = glGetUniformLocation(prog, "color");
+	shaders->quad.pos_attrib = glGetAttribLocation(prog, "pos");
+	shaders->quad.color_matrix = glGetUniformLocation(prog, "color_matrix");
+	shaders->quad.color_lut = glGetUniformLocation(prog, "color_lut");
+
+	if (!link_tex_shader(renderer, &shaders->tex_rgba,
+			tex_fragment_src_rgba, color_transform)) {
+		goto error;
+	}
+	if (!link_tex_shader(renderer, &shaders->tex_rgbx,
+			tex_fragment_src_rgbx, color_transform)) {
+		goto error;
+	}
+	if (renderer->exts.egl_image_external_oes &&
+			!link_tex_shader(renderer, &shaders->tex_ext,
+			tex_fragment_src_external, color_transform)) {
+		goto error;
+	}
+	if (renderer->exts.texture_rg &&
+			!link_tex_shader(renderer, &shaders->tex_yuv,
+			tex_fragment_src_yuv, color_transform)) {
+		goto error;
+	}
+
+	return true;
+
+error:
+	destroy_shaders(shaders);
+	return false;
+}
+
 static bool check_gl_ext(const char *exts, const char *ext) {
 	size_t extlen = strlen(ext);
 	const char *end = exts + strlen(exts);
@@ -722,13 +2031,6 @@ static void load_gl_proc(void *proc_ptr, const char *name) {
 	*(void **)proc_ptr = proc;
 }
 
-extern const GLchar quad_vertex_src[];
-extern const GLchar quad_fragment_src[];
-extern const GLchar tex_vertex_src[];
-extern const GLchar tex_fragment_src_rgba[];
-extern const GLchar tex_fragment_src_rgbx[];
-extern const GLchar tex_fragment_src_external[];
-
 struct wlr_renderer *wlr_gles2_renderer_create_with_drm_fd(int drm_fd) {
 	struct wlr_egl *egl = wlr_egl_create_with_drm_fd(drm_fd);
 	if (egl == NULL) {
@@ -766,6 +2068,8 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 
 	wl_list_init(&renderer->buffers);
 	wl_list_init(&renderer->textures);
+	wl_list_init(&renderer->atlas_pages);
+	gles2_upload_worker_init(renderer);
 
 	renderer->egl = egl;
 	renderer->exts_str = exts_str;
@@ -816,6 +2120,60 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 			"glEGLImageTargetRenderbufferStorageOES");
 	}
 
+	int gl_major = 0;
+	const char *gl_version = (const char *)glGetString(GL_VERSION);
+	if (gl_version != NULL &&
+			sscanf(gl_version, "OpenGL ES %d.", &gl_major) == 1 &&
+			gl_major >= 3) {
+		renderer->exts.pixel_buffer_object = true;
+		load_gl_proc(&renderer->procs.glMapBufferRange, "glMapBufferRange");
+		load_gl_proc(&renderer->procs.glUnmapBuffer, "glUnmapBuffer");
+		load_gl_proc(&renderer->procs.glTexStorage2D, "glTexStorage2D");
+		load_gl_proc(&renderer->procs.glBlitFramebuffer, "glBlitFramebuffer");
+	}
+
+	const char *mipmaps_env = getenv("WLR_GLES2_MIPMAPS");
+	if (mipmaps_env != NULL && strcmp(mipmaps_env, "1") == 0) {
+		if (gl_major >= 3) {
+			renderer->mipmaps.enabled = true;
+		} else {
+			wlr_log(WLR_INFO, "Mipmapped texture copies need "
+				"OpenGL ES 3.0, disabling");
+		}
+	}
+
+	renderer->exts.npot_mipmap = gl_major >= 3 ||
+		check_gl_ext(exts_str, "GL_OES_texture_npot");
+	renderer->exts.texture_rg = gl_major >= 3 ||
+		check_gl_ext(exts_str, "GL_EXT_texture_rg");
+	renderer->exts.texture_norm16_ext =
+		check_gl_ext(exts_str, "GL_EXT_texture_norm16");
+	renderer->exts.texture_type_2_10_10_10_rev_ext =
+		check_gl_ext(exts_str, "GL_EXT_texture_type_2_10_10_10_REV");
+	renderer->exts.texture_half_float_linear_oes =
+		check_gl_ext(exts_str, "GL_OES_texture_half_float") &&
+		check_gl_ext(exts_str, "GL_OES_texture_half_float_linear");
+
+	if (check_gl_ext(exts_str, "GL_EXT_disjoint_timer_query")) {
+		renderer->exts.disjoint_timer_query_ext = true;
+		load_gl_proc(&renderer->procs.glGenQueriesEXT, "glGenQueriesEXT");
+		load_gl_proc(&renderer->procs.glDeleteQueriesEXT,
+			"glDeleteQueriesEXT");
+		load_gl_proc(&renderer->procs.glQueryCounterEXT, "glQueryCounterEXT");
+		load_gl_proc(&renderer->procs.glGetQueryObjectivEXT,
+			"glGetQueryObjectivEXT");
+		load_gl_proc(&renderer->procs.glGetQueryObjectui64vEXT,
+			"glGetQueryObjectui64vEXT");
+	}
+
+	if (check_gl_ext(exts_str, "GL_OES_get_program_binary")) {
+		renderer->exts.get_program_binary_oes = true;
+		load_gl_proc(&renderer->procs.glGetProgramBinaryOES,
+			"glGetProgramBinaryOES");
+		load_gl_proc(&renderer->procs.glProgramBinaryOES,
+			"glProgramBinaryOES");
+	}
+
 	if (renderer->exts.debug_khr) {
 		glEnable(GL_DEBUG_OUTPUT_KHR);
 		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
@@ -830,52 +2188,21 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 
 	push_gles2_debug(renderer);
 
-	GLuint prog;
-	renderer->shaders.quad.program = prog =
-		link_program(renderer, quad_vertex_src, quad_fragment_src);
-	if (!renderer->shaders.quad.program) {
-		goto error;
+	if (renderer->exts.get_program_binary_oes) {
+		gles2_program_cache_init(renderer);
 	}
-	renderer->shaders.quad.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.quad.color = glGetUniformLocation(prog, "color");
-	renderer->shaders.quad.pos_attrib = glGetAttribLocation(prog, "pos");
 
-	renderer->shaders.tex_rgba.program = prog =
-		link_program(renderer, tex_vertex_src, tex_fragment_src_rgba);
-	if (!renderer->shaders.tex_rgba.program) {
+	int64_t shaders_start = startup_phase_begin("shaders");
+	bool shaders_ok = link_shaders(renderer, &renderer->shaders, false);
+	startup_phase_end("shaders", shaders_start);
+	if (!shaders_ok) {
 		goto error;
 	}
-	renderer->shaders.tex_rgba.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.tex_rgba.invert_y = glGetUniformLocation(prog, "invert_y");
-	renderer->shaders.tex_rgba.tex = glGetUniformLocation(prog, "tex");
-	renderer->shaders.tex_rgba.alpha = glGetUniformLocation(prog, "alpha");
-	renderer->shaders.tex_rgba.pos_attrib = glGetAttribLocation(prog, "pos");
-	renderer->shaders.tex_rgba.tex_attrib = glGetAttribLocation(prog, "texcoord");
 
-	renderer->shaders.tex_rgbx.program = prog =
-		link_program(renderer, tex_vertex_src, tex_fragment_src_rgbx);
-	if (!renderer->shaders.tex_rgbx.program) {
-		goto error;
-	}
-	renderer->shaders.tex_rgbx.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.tex_rgbx.invert_y = glGetUniformLocation(prog, "invert_y");
-	renderer->shaders.tex_rgbx.tex = glGetUniformLocation(prog, "tex");
-	renderer->shaders.tex_rgbx.alpha = glGetUniformLocation(prog, "alpha");
-	renderer->shaders.tex_rgbx.pos_attrib = glGetAttribLocation(prog, "pos");
-	renderer->shaders.tex_rgbx.tex_attrib = glGetAttribLocation(prog, "texcoord");
-
-	if (renderer->exts.egl_image_external_oes) {
-		renderer->shaders.tex_ext.program = prog =
-			link_program(renderer, tex_vertex_src, tex_fragment_src_external);
-		if (!renderer->shaders.tex_ext.program) {
-			goto error;
-		}
-		renderer->shaders.tex_ext.proj = glGetUniformLocation(prog, "proj");
-		renderer->shaders.tex_ext.invert_y = glGetUniformLocation(prog, "invert_y");
-		renderer->shaders.tex_ext.tex = glGetUniformLocation(prog, "tex");
-		renderer->shaders.tex_ext.alpha = glGetUniformLocation(prog, "alpha");
-		renderer->shaders.tex_ext.pos_attrib = glGetAttribLocation(prog, "pos");
-		renderer->shaders.tex_ext.tex_attrib = glGetAttribLocation(prog, "texcoord");
+	glGenBuffers(1, &renderer->batch.vbo);
+	if (renderer->mipmaps.enabled) {
+		glGenFramebuffers(1, &renderer->mipmaps.read_fbo);
+		glGenFramebuffers(1, &renderer->mipmaps.draw_fbo);
 	}
 
 	pop_gles2_debug(renderer);
@@ -885,11 +2212,6 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 	return &renderer->wlr_renderer;
 
 error:
-	glDeleteProgram(renderer->shaders.quad.program);
-	glDeleteProgram(renderer->shaders.tex_rgba.program);
-	glDeleteProgram(renderer->shaders.tex_rgbx.program);
-	glDeleteProgram(renderer->shaders.tex_ext.program);
-
 	pop_gles2_debug(renderer);
 
 	if (renderer->exts.debug_khr) {
@@ -899,6 +2221,8 @@ error:
 
 	wlr_egl_unset_current(renderer->egl);
 
+	gles2_upload_worker_finish(renderer);
+	gles2_program_cache_finish(renderer);
 	free(renderer);
 	return NULL;
 }
@@ -912,5 +2236,7 @@ bool wlr_gles2_renderer_check_ext(struct wlr_renderer *wlr_renderer,
 GLuint wlr_gles2_renderer_get_current_fbo(struct wlr_renderer *wlr_renderer) {
 	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
 	assert(renderer->current_buffer);
+	// The caller is about to issue its own GL commands
+	gles2_flush_quads(renderer);
 	return renderer->current_buffer->fbo;
 }
@@ -1,6 +1,30 @@
 #include <GLES2/gl2.h>
 #include "render/gles2.h"
 
+// Color transform applied to the final color when COLOR_TRANSFORM is defined:
+// the unpremultiplied color is multiplied by the matrix, then each channel is
+// mapped through a 256-entry LUT.
+#define COLOR_TRANSFORM_SRC \
+	"#ifdef COLOR_TRANSFORM\n" \
+	"uniform mat3 color_matrix;\n" \
+	"uniform sampler2D color_lut;\n" \
+	"\n" \
+	"vec4 color_transform(vec4 color) {\n" \
+	"	if (color.a <= 0.0) {\n" \
+	"		return color;\n" \
+	"	}\n" \
+	"	vec3 rgb = clamp(color_matrix * (color.rgb / color.a), 0.0, 1.0);\n" \
+	"	rgb = rgb * (255.0 / 256.0) + 0.5 / 256.0;\n" \
+	"	rgb = vec3(texture2D(color_lut, vec2(rgb.r, 0.5)).r,\n" \
+	"		texture2D(color_lut, vec2(rgb.g, 0.5)).g,\n" \
+	"		texture2D(color_lut, vec2(rgb.b, 0.5)).b);\n" \
+	"	return vec4(rgb * color.a, color.a);\n" \
+	"}\n" \
+	"#else\n" \
+	"#define color_transform(color) (color)\n" \
+	"#endif\n" \
+	"\n"
+
 // Colored quads
 const GLchar quad_vertex_src[] =
 "uniform mat3 proj;\n"
@@ -21,8 +45,9 @@ const GLchar quad_fragment_src[] =
 "varying vec4 v_color;\n"
 "varying vec2 v_texcoord;\n"
 "\n"
+COLOR_TRANSFORM_SRC
 "void main() {\n"
-"	gl_FragColor = v_color;\n"
+"	gl_FragColor = color_transform(v_color);\n"
 "}\n";
 
 // Textured quads
@@ -48,8 +73,9 @@ const GLchar tex_fragment_src_rgba[] =
 "uniform sampler2D tex;\n"
 "uniform float alpha;\n"
 "\n"
+COLOR_TRANSFORM_SRC
 "void main() {\n"
-"	gl_FragColor = texture2D(tex, v_texcoord) * alpha;\n"
+"	gl_FragColor = color_transform(texture2D(tex, v_texcoord) * alpha);\n"
 "}\n";
 
 const GLchar tex_fragment_src_rgbx[] =
@@ -58,8 +84,10 @@ const GLchar tex_fragment_src_rgbx[] =
 "uniform sampler2D tex;\n"
 "uniform float alpha;\n"
 "\n"
+COLOR_TRANSFORM_SRC
 "void main() {\n"
-"	gl_FragColor = vec4(texture2D(tex, v_texcoord).rgb, 1.0) * alpha;\n"
+"	gl_FragColor =\n"
+"		color_transform(vec4(texture2D(tex, v_texcoord).rgb, 1.0) * alpha);\n"
 "}\n";
 
 const GLchar tex_fragment_src_external[] =
@@ -69,6 +97,29 @@ const GLchar tex_fragment_src_external[] =
 "uniform samplerExternalOES texture0;\n"
 "uniform float alpha;\n"
 "\n"
+COLOR_TRANSFORM_SRC
+"void main() {\n"
+"	gl_FragColor = color_transform(texture2D(texture0, v_texcoord) * alpha);\n"
+"}\n";
+
+// Two-plane YUV, the chroma plane holds interleaved Cb and Cr samples
+const GLchar tex_fragment_src_yuv[] =
+"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+"precision highp float;\n"
+"#else\n"
+"precision mediump float;\n"
+"#endif\n"
+"varying vec2 v_texcoord;\n"
+"uniform sampler2D tex;\n"
+"uniform sampler2D tex_uv;\n"
+"uniform mat3 yuv_matrix;\n"
+"uniform vec3 yuv_offset;\n"
+"uniform float alpha;\n"
+"\n"
+COLOR_TRANSFORM_SRC
 "void main() {\n"
-"	gl_FragColor = texture2D(texture0, v_texcoord) * alpha;\n"
+"	vec3 yuv = vec3(texture2D(tex, v_texcoord).r,\n"
+"		texture2D(tex_uv, v_texcoord).rg) - yuv_offset;\n"
+"	vec3 rgb = clamp(yuv_matrix * yuv, 0.0, 1.0);\n"
+"	gl_FragColor = color_transform(vec4(rgb, 1.0) * alpha);\n"
 "}\n";
@@ -49,15 +49,80 @@ static bool check_stride(const struct wlr_pixel_format_info *fmt,
 	return true;
 }
 
-static bool gles2_texture_write_pixels(struct wlr_texture *wlr_texture,
-		uint32_t stride, uint32_t width, uint32_t height,
-		uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
-		const void *data) {
-	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+/**
+ * Quads using the same GL texture must be drawn before its contents change,
+ * including quads of other textures packed in the same atlas page.
+ */
+static void flush_texture_quads(struct wlr_gles2_texture *texture) {
+	struct wlr_gles2_texture *batch_texture = texture->renderer->batch.texture;
+	if (batch_texture != NULL && batch_texture->tex == texture->tex) {
+		gles2_flush_quads(texture->renderer);
+	}
+}
+
+static void upload_rect(const struct wlr_gles2_pixel_format *fmt,
+		const void *data, uint32_t src_x, uint32_t src_y,
+		uint32_t width, uint32_t height, uint32_t dst_x, uint32_t dst_y) {
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, src_x);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, src_y);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, dst_x, dst_y, width, height,
+		fmt->gl_format, fmt->gl_type, data);
+}
+
+/**
+ * Upload pixels to a GL_TEXTURE_2D texture, which needs to be bound. Takes
+ * care of the border of atlas textures.
+ */
+static void texture_upload(struct wlr_gles2_texture *texture,
+		const struct wlr_gles2_pixel_format *fmt, uint32_t stride,
+		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
+		uint32_t dst_x, uint32_t dst_y, const void *data) {
+	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(texture->drm_format);
+	assert(drm_fmt);
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / (drm_fmt->bpp / 8));
+
+	if (texture->atlas_slot == NULL) {
+		upload_rect(fmt, data, src_x, src_y, width, height, dst_x, dst_y);
+	} else {
+		int x, y;
+		gles2_atlas_slot_get_origin(texture->atlas_slot, &x, &y);
+		uint32_t tex_width = texture->wlr_texture.width;
+		uint32_t tex_height = texture->wlr_texture.height;
+
+		upload_rect(fmt, data, src_x, src_y, width, height,
+			x + dst_x, y + dst_y);
+
+		// Replicate edges into the border
+		if (dst_x == 0) {
+			upload_rect(fmt, data, src_x, src_y, 1, height,
+				x - 1, y + dst_y);
+		}
+		if (dst_x + width == tex_width) {
+			upload_rect(fmt, data, src_x + width - 1, src_y, 1, height,
+				x + tex_width, y + dst_y);
+		}
+		if (dst_y == 0) {
+			upload_rect(fmt, data, src_x, src_y, width, 1,
+				x + dst_x, y - 1);
+		}
+		if (dst_y + height == tex_height) {
+			upload_rect(fmt, data, src_x, src_y + height - 1, width, 1,
+				x + dst_x, y + tex_height);
+		}
+	}
 
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+}
+
+static const struct wlr_gles2_pixel_format *check_write_pixels(
+		struct wlr_gles2_texture *texture, uint32_t stride, uint32_t width) {
 	if (texture->target != GL_TEXTURE_2D || texture->image != EGL_NO_IMAGE_KHR) {
 		wlr_log(WLR_ERROR, "Cannot write pixels to immutable texture");
-		return false;
+		return NULL;
 	}
 
 	const struct wlr_gles2_pixel_format *fmt =
@@ -69,6 +134,20 @@ static bool gles2_texture_write_pixels(struct wlr_texture *wlr_texture,
 	assert(drm_fmt);
 
 	if (!check_stride(drm_fmt, stride, width)) {
+		return NULL;
+	}
+	return fmt;
+}
+
+static bool gles2_texture_write_pixels(struct wlr_texture *wlr_texture,
+		uint32_t stride, uint32_t width, uint32_t height,
+		uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
+		const void *data) {
+	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+
+	const struct wlr_gles2_pixel_format *fmt =
+		check_write_pixels(texture, stride, width);
+	if (fmt == NULL) {
 		return false;
 	}
 
@@ -76,22 +155,60 @@ static bool gles2_texture_write_pixels(struct wlr_texture *wlr_texture,
 	wlr_egl_save_context(&prev_ctx);
 	wlr_egl_make_current(texture->renderer->egl);
 
+	// Quads drawn before the update must sample the old contents
+	flush_texture_quads(texture);
+
 	push_gles2_debug(texture->renderer);
 
 	glBindTexture(GL_TEXTURE_2D, texture->tex);
+	texture_upload(texture, fmt, stride, width, height, src_x, src_y,
+		dst_x, dst_y, data);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	texture->has_mipmaps = false;
+	pixman_region32_union_rect(&texture->mipmaps.damage,
+		&texture->mipmaps.damage, dst_x, dst_y, width, height);
 
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / (drm_fmt->bpp / 8));
-	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, src_x);
-	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, src_y);
+	pop_gles2_debug(texture->renderer);
 
-	glTexSubImage2D(GL_TEXTURE_2D, 0, dst_x, dst_y, width, height,
-		fmt->gl_format, fmt->gl_type, data);
+	wlr_egl_restore_context(&prev_ctx);
 
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
-	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
-	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	return true;
+}
+
+static bool gles2_texture_write_pixels_region(struct wlr_texture *wlr_texture,
+		uint32_t stride, pixman_region32_t *region, const void *data) {
+	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+
+	int n;
+	pixman_box32_t *rects = pixman_region32_rectangles(region, &n);
+	if (n == 0) {
+		return true;
+	}
+
+	const struct wlr_gles2_pixel_format *fmt =
+		check_write_pixels(texture, stride, wlr_texture->width);
+	if (fmt == NULL) {
+		return false;
+	}
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(texture->renderer->egl);
+
+	flush_texture_quads(texture);
 
+	push_gles2_debug(texture->renderer);
+
+	glBindTexture(GL_TEXTURE_2D, texture->tex);
+	for (int i = 0; i < n; ++i) {
+		pixman_box32_t *r = &rects[i];
+		texture_upload(texture, fmt, stride, r->x2 - r->x1, r->y2 - r->y1,
+			r->x1, r->y1, r->x1, r->y1, data);
+	}
 	glBindTexture(GL_TEXTURE_2D, 0);
+	texture->has_mipmaps = false;
+	pixman_region32_union(&texture->mipmaps.damage, &texture->mipmaps.damage,
+		region);
 
 	pop_gles2_debug(texture->renderer);
 
@@ -104,6 +221,12 @@ static bool gles2_texture_invalidate(struct wlr_gles2_texture *texture) {
 	if (texture->image == EGL_NO_IMAGE_KHR) {
 		return false;
 	}
+
+	// The buffer doesn't carry its damage, the whole copy is outdated
+	pixman_region32_union_rect(&texture->mipmaps.damage,
+		&texture->mipmaps.damage, 0, 0,
+		texture->wlr_texture.width, texture->wlr_texture.height);
+
 	if (texture->target == GL_TEXTURE_EXTERNAL_OES) {
 		// External changes are immediately made visible by the GL implementation
 		return true;
@@ -113,11 +236,18 @@ static bool gles2_texture_invalidate(struct wlr_gles2_texture *texture) {
 	wlr_egl_save_context(&prev_ctx);
 	wlr_egl_make_current(texture->renderer->egl);
 
+	flush_texture_quads(texture);
+
 	push_gles2_debug(texture->renderer);
 
 	glBindTexture(texture->target, texture->tex);
 	texture->renderer->procs.glEGLImageTargetTexture2DOES(texture->target,
 		texture->image);
+	if (texture->yuv.tex_uv != 0) {
+		glBindTexture(GL_TEXTURE_2D, texture->yuv.tex_uv);
+		texture->renderer->procs.glEGLImageTargetTexture2DOES(GL_TEXTURE_2D,
+			texture->yuv.image_uv);
+	}
 	glBindTexture(texture->target, 0);
 
 	pop_gles2_debug(texture->renderer);
@@ -129,21 +259,37 @@ static bool gles2_texture_invalidate(struct wlr_gles2_texture *texture) {
 
 void gles2_texture_destroy(struct wlr_gles2_texture *texture) {
 	wl_list_remove(&texture->link);
-	wl_list_remove(&texture->buffer_destroy.link);
+	if (texture->buffer != NULL) {
+		wlr_addon_finish(&texture->buffer_addon);
+	}
 
 	struct wlr_egl_context prev_ctx;
 	wlr_egl_save_context(&prev_ctx);
 	wlr_egl_make_current(texture->renderer->egl);
 
+	flush_texture_quads(texture);
+
 	push_gles2_debug(texture->renderer);
 
-	glDeleteTextures(1, &texture->tex);
+	if (texture->atlas_slot != NULL) {
+		gles2_atlas_free(texture->atlas_slot);
+	} else {
+		glDeleteTextures(1, &texture->tex);
+	}
 	wlr_egl_destroy_image(texture->renderer->egl, texture->image);
+	if (texture->yuv.tex_uv != 0) {
+		glDeleteTextures(1, &texture->yuv.tex_uv);
+		wlr_egl_destroy_image(texture->renderer->egl, texture->yuv.image_uv);
+	}
+	if (texture->mipmaps.tex != 0) {
+		glDeleteTextures(1, &texture->mipmaps.tex);
+	}
 
 	pop_gles2_debug(texture->renderer);
 
 	wlr_egl_restore_context(&prev_ctx);
 
+	pixman_region32_fini(&texture->mipmaps.damage);
 	free(texture);
 }
 
@@ -161,6 +307,7 @@ static void gles2_texture_unref(struct wlr_texture *wlr_texture) {
 static const struct wlr_texture_impl texture_impl = {
 	.is_opaque = gles2_texture_is_opaque,
 	.write_pixels = gles2_texture_write_pixels,
+	.write_pixels_region = gles2_texture_write_pixels_region,
 	.destroy = gles2_texture_unref,
 };
 
@@ -174,11 +321,29 @@ static struct wlr_gles2_texture *gles2_texture_create(
 	}
 	wlr_texture_init(&texture->wlr_texture, &texture_impl, width, height);
 	texture->renderer = renderer;
+	pixman_region32_init(&texture->mipmaps.damage);
 	wl_list_insert(&renderer->textures, &texture->link);
-	wl_list_init(&texture->buffer_destroy.link);
 	return texture;
 }
 
+struct wlr_texture *gles2_texture_from_tex(struct wlr_gles2_renderer *renderer,
+		uint32_t drm_format, uint32_t width, uint32_t height, GLuint tex) {
+	const struct wlr_gles2_pixel_format *fmt =
+		get_gles2_format_from_drm(drm_format);
+	assert(fmt);
+
+	struct wlr_gles2_texture *texture =
+		gles2_texture_create(renderer, width, height);
+	if (texture == NULL) {
+		return NULL;
+	}
+	texture->target = GL_TEXTURE_2D;
+	texture->has_alpha = fmt->has_alpha;
+	texture->drm_format = fmt->drm_format;
+	texture->tex = tex;
+	return &texture->wlr_texture;
+}
+
 static struct wlr_texture *gles2_texture_from_pixels(
 		struct wlr_renderer *wlr_renderer,
 		uint32_t drm_format, uint32_t stride, uint32_t width,
@@ -187,7 +352,7 @@ static struct wlr_texture *gles2_texture_from_pixels(
 
 	const struct wlr_gles2_pixel_format *fmt =
 		get_gles2_format_from_drm(drm_format);
-	if (fmt == NULL) {
+	if (fmt == NULL || !is_gles2_pixel_format_supported(renderer, fmt)) {
 		wlr_log(WLR_ERROR, "Unsupported pixel format 0x%"PRIX32, drm_format);
 		return NULL;
 	}
@@ -213,17 +378,30 @@ static struct wlr_texture *gles2_texture_from_pixels(
 	wlr_egl_save_context(&prev_ctx);
 	wlr_egl_make_current(renderer->egl);
 
-	push_gles2_debug(renderer);
+	// Small textures are packed together, so that they can be drawn in a
+	// single batch
+	texture->atlas_slot =
+		gles2_atlas_alloc(renderer, fmt->drm_format, width, height);
+	if (texture->atlas_slot != NULL) {
+		texture->tex = texture->atlas_slot->page->tex;
+	}
 
-	glGenTextures(1, &texture->tex);
-	glBindTexture(GL_TEXTURE_2D, texture->tex);
+	push_gles2_debug(renderer);
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / (drm_fmt->bpp / 8));
-	glTexImage2D(GL_TEXTURE_2D, 0, fmt->gl_format, width, height, 0,
-		fmt->gl_format, fmt->gl_type, data);
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	if (texture->atlas_slot != NULL) {
+		glBindTexture(GL_TEXTURE_2D, texture->tex);
+		texture_upload(texture, fmt, stride, width, height, 0, 0, 0, 0, data);
+	} else {
+		glGenTextures(1, &texture->tex);
+		glBindTexture(GL_TEXTURE_2D, texture->tex);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / (drm_fmt->bpp / 8));
+		glTexImage2D(GL_TEXTURE_2D, 0, fmt->gl_format, width, height, 0,
+			fmt->gl_format, fmt->gl_type, data);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	}
 
 	glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -301,6 +479,7 @@ struct wlr_texture *gles2_texture_from_wl_drm(struct wlr_renderer *wlr_renderer,
 
 error_texture:
 	wl_list_remove(&texture->link);
+	pixman_region32_fini(&texture->mipmaps.damage);
 	free(texture);
 error_image:
 	wlr_egl_destroy_image(renderer->egl, image);
@@ -309,6 +488,152 @@ error_ctx:
 	return NULL;
 }
 
+struct gles2_yuv_format {
+	uint32_t format;
+	uint32_t luma_format, chroma_format;
+	// Samples are stored in the most significant bits of their container, so
+	// only its size matters for normalization
+	int container_bits;
+};
+
+static const struct gles2_yuv_format yuv_formats[] = {
+	{ DRM_FORMAT_NV12, DRM_FORMAT_R8, DRM_FORMAT_GR88, 8 },
+	{ DRM_FORMAT_P010, DRM_FORMAT_R16, DRM_FORMAT_GR1616, 16 },
+};
+
+/**
+ * Set up the conversion of limited range YUV to RGB. Buffers don't carry their
+ * color encoding, so it's guessed the usual way: BT.2020 for high bit-depth,
+ * BT.709 for HD and BT.601 for SD content.
+ */
+static void texture_init_yuv_conversion(struct wlr_gles2_texture *texture,
+		const struct gles2_yuv_format *fmt) {
+	double kr, kb;
+	if (fmt->container_bits > 8) {
+		kr = 0.2627, kb = 0.0593; // BT.2020
+	} else if (texture->wlr_texture.height >= 720) {
+		kr = 0.2126, kb = 0.0722; // BT.709
+	} else {
+		kr = 0.299, kb = 0.114; // BT.601
+	}
+	double kg = 1 - kr - kb;
+
+	double max = (1 << fmt->container_bits) - 1;
+	double unit = 1 << (fmt->container_bits - 8);
+	double y_scale = max / (219 * unit);
+	double c_scale = max / (224 * unit);
+
+	// Column-major, multiplies (Y, Cb, Cr)
+	float *m = texture->yuv.matrix;
+	m[0] = m[1] = m[2] = y_scale;
+	m[3] = 0;
+	m[4] = -c_scale * 2 * kb * (1 - kb) / kg;
+	m[5] = c_scale * 2 * (1 - kb);
+	m[6] = c_scale * 2 * (1 - kr);
+	m[7] = -c_scale * 2 * kr * (1 - kr) / kg;
+	m[8] = 0;
+
+	texture->yuv.offset[0] = 16 * unit / max;
+	texture->yuv.offset[1] = texture->yuv.offset[2] = 128 * unit / max;
+}
+
+static GLuint create_plane_texture(struct wlr_gles2_renderer *renderer,
+		EGLImageKHR image) {
+	GLuint tex;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// The default minification filter needs mipmaps, which the chroma plane
+	// never gets
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	renderer->procs.glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return tex;
+}
+
+/**
+ * Import a two-plane YUV buffer as separate luma and chroma images. Drivers
+ * usually only expose these formats through GL_TEXTURE_EXTERNAL_OES, which
+ * can involve a hidden conversion copy.
+ *
+ * Must be called with the EGL context current.
+ */
+static bool texture_import_yuv(struct wlr_gles2_texture *texture,
+		struct wlr_dmabuf_attributes *attribs) {
+	struct wlr_gles2_renderer *renderer = texture->renderer;
+	if (renderer->shaders.tex_yuv.program == 0 || attribs->n_planes != 2) {
+		return false;
+	}
+
+	const struct gles2_yuv_format *fmt = NULL;
+	for (size_t i = 0; i < sizeof(yuv_formats) / sizeof(yuv_formats[0]); i++) {
+		if (yuv_formats[i].format == attribs->format) {
+			fmt = &yuv_formats[i];
+			break;
+		}
+	}
+	if (fmt == NULL ||
+			(fmt->container_bits > 8 && !renderer->exts.texture_norm16_ext)) {
+		return false;
+	}
+
+	// Both planes need to be importable as regular textures
+	struct wlr_egl *egl = renderer->egl;
+	if (!wlr_drm_format_set_has(&egl->dmabuf_render_formats,
+			fmt->luma_format, attribs->modifier) ||
+			!wlr_drm_format_set_has(&egl->dmabuf_render_formats,
+			fmt->chroma_format, attribs->modifier)) {
+		return false;
+	}
+
+	struct wlr_dmabuf_attributes luma = {
+		.width = attribs->width,
+		.height = attribs->height,
+		.format = fmt->luma_format,
+		.modifier = attribs->modifier,
+		.n_planes = 1,
+		.offset = { attribs->offset[0] },
+		.stride = { attribs->stride[0] },
+		.fd = { attribs->fd[0] },
+	};
+	struct wlr_dmabuf_attributes chroma = {
+		.width = (attribs->width + 1) / 2,
+		.height = (attribs->height + 1) / 2,
+		.format = fmt->chroma_format,
+		.modifier = attribs->modifier,
+		.n_planes = 1,
+		.offset = { attribs->offset[1] },
+		.stride = { attribs->stride[1] },
+		.fd = { attribs->fd[1] },
+	};
+
+	bool external_only;
+	EGLImageKHR luma_image =
+		wlr_egl_create_image_from_dmabuf(egl, &luma, &external_only);
+	if (luma_image == EGL_NO_IMAGE_KHR) {
+		return false;
+	}
+	EGLImageKHR chroma_image =
+		wlr_egl_create_image_from_dmabuf(egl, &chroma, &external_only);
+	if (chroma_image == EGL_NO_IMAGE_KHR) {
+		wlr_egl_destroy_image(egl, luma_image);
+		return false;
+	}
+
+	push_gles2_debug(renderer);
+	texture->target = GL_TEXTURE_2D;
+	texture->image = luma_image;
+	texture->tex = create_plane_texture(renderer, luma_image);
+	texture->yuv.image_uv = chroma_image;
+	texture->yuv.tex_uv = create_plane_texture(renderer, chroma_image);
+	pop_gles2_debug(renderer);
+
+	texture->has_alpha = false;
+	texture_init_yuv_conversion(texture, fmt);
+	return true;
+}
+
 static struct wlr_texture *gles2_texture_from_dmabuf(
 		struct wlr_renderer *wlr_renderer,
 		struct wlr_dmabuf_attributes *attribs) {
@@ -332,6 +657,11 @@ static struct wlr_texture *gles2_texture_from_dmabuf(
 	wlr_egl_save_context(&prev_ctx);
 	wlr_egl_make_current(renderer->egl);
 
+	if (texture_import_yuv(texture, attribs)) {
+		wlr_egl_restore_context(&prev_ctx);
+		return &texture->wlr_texture;
+	}
+
 	bool external_only;
 	texture->image =
 		wlr_egl_create_image_from_dmabuf(renderer->egl, attribs, &external_only);
@@ -339,6 +669,7 @@ static struct wlr_texture *gles2_texture_from_dmabuf(
 		wlr_log(WLR_ERROR, "Failed to create EGL image from DMA-BUF");
 		wlr_egl_restore_context(&prev_ctx);
 		wl_list_remove(&texture->link);
+		pixman_region32_fini(&texture->mipmaps.damage);
 		free(texture);
 		return NULL;
 	}
@@ -361,26 +692,33 @@ static struct wlr_texture *gles2_texture_from_dmabuf(
 	return &texture->wlr_texture;
 }
 
-static void texture_handle_buffer_destroy(struct wl_listener *listener,
-		void *data) {
+static void texture_handle_buffer_destroy(struct wlr_addon *addon) {
 	struct wlr_gles2_texture *texture =
-		wl_container_of(listener, texture, buffer_destroy);
+		wl_container_of(addon, texture, buffer_addon);
 	gles2_texture_destroy(texture);
 }
 
+static const struct wlr_addon_interface texture_addon_impl = {
+	.name = "wlr_gles2_texture",
+	.destroy = texture_handle_buffer_destroy,
+};
+
 static struct wlr_texture *gles2_texture_from_dmabuf_buffer(
 		struct wlr_gles2_renderer *renderer, struct wlr_buffer *buffer,
 		struct wlr_dmabuf_attributes *dmabuf) {
-	struct wlr_gles2_texture *texture;
-	wl_list_for_each(texture, &renderer->textures, link) {
-		if (texture->buffer == buffer) {
-			if (!gles2_texture_invalidate(texture)) {
-				wlr_log(WLR_ERROR, "Failed to invalidate texture");
-				return false;
-			}
-			wlr_buffer_lock(texture->buffer);
-			return &texture->wlr_texture;
+	// The texture and its EGLImage are kept around for as long as the buffer
+	// lives, since clients keep committing the same few buffers
+	struct wlr_addon *addon =
+		wlr_addon_find(&buffer->addons, renderer, &texture_addon_impl);
+	if (addon != NULL) {
+		struct wlr_gles2_texture *texture =
+			wl_container_of(addon, texture, buffer_addon);
+		if (!gles2_texture_invalidate(texture)) {
+			wlr_log(WLR_ERROR, "Failed to invalidate texture");
+			return NULL;
 		}
+		wlr_buffer_lock(texture->buffer);
+		return &texture->wlr_texture;
 	}
 
 	struct wlr_texture *wlr_texture =
@@ -389,11 +727,10 @@ static struct wlr_texture *gles2_texture_from_dmabuf_buffer(
 		return false;
 	}
 
-	texture = gles2_get_texture(wlr_texture);
+	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
 	texture->buffer = wlr_buffer_lock(buffer);
-
-	texture->buffer_destroy.notify = texture_handle_buffer_destroy;
-	wl_signal_add(&buffer->events.destroy, &texture->buffer_destroy);
+	wlr_addon_init(&texture->buffer_addon, &buffer->addons, renderer,
+		&texture_addon_impl);
 
 	return &texture->wlr_texture;
 }
@@ -418,6 +755,21 @@ struct wlr_texture *gles2_texture_from_buffer(struct wlr_renderer *wlr_renderer,
 	}
 }
 
+void gles2_texture_get_region(struct wlr_gles2_texture *texture,
+		struct wlr_box *region, int *tex_width, int *tex_height) {
+	region->width = texture->wlr_texture.width;
+	region->height = texture->wlr_texture.height;
+	if (texture->atlas_slot != NULL) {
+		gles2_atlas_slot_get_origin(texture->atlas_slot,
+			&region->x, &region->y);
+		*tex_width = *tex_height = WLR_GLES2_ATLAS_PAGE_SIZE;
+	} else {
+		region->x = region->y = 0;
+		*tex_width = region->width;
+		*tex_height = region->height;
+	}
+}
+
 void wlr_gles2_texture_get_attribs(struct wlr_texture *wlr_texture,
 		struct wlr_gles2_texture_attribs *attribs) {
 	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
@@ -426,4 +778,6 @@ void wlr_gles2_texture_get_attribs(struct wlr_texture *wlr_texture,
 	attribs->tex = texture->tex;
 	attribs->inverted_y = texture->inverted_y;
 	attribs->has_alpha = texture->has_alpha;
+	gles2_texture_get_region(texture, &attribs->region,
+		&attribs->tex_width, &attribs->tex_height);
 }
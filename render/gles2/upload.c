@@ -0,0 +1,291 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <fcntl.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wlr/render/interface.h>
+#include <wlr/util/log.h>
+#include "render/egl.h"
+#include "render/gles2.h"
+#include "render/pixel_format.h"
+#include "types/wlr_buffer.h"
+#include "util/realtime.h"
+
+/*
+ * Textures are uploaded on a worker thread with its own EGL context, sharing
+ * objects with the renderer's context. The worker waits for the GPU to be done
+ * with each texture before reporting it, so that the compositor thread never
+ * samples from a texture which is still being filled.
+ */
+
+static const struct wlr_texture_upload_impl upload_impl;
+
+static struct wlr_gles2_texture_upload *gles2_get_upload(
+		struct wlr_texture_upload *wlr_upload) {
+	assert(wlr_upload->impl == &upload_impl);
+	return (struct wlr_gles2_texture_upload *)wlr_upload;
+}
+
+static void upload_run(struct wlr_gles2_texture_upload *upload) {
+	const struct wlr_gles2_pixel_format *fmt = upload->fmt;
+	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(fmt->drm_format);
+	assert(drm_fmt);
+
+	glGenTextures(1, &upload->tex);
+	glBindTexture(GL_TEXTURE_2D, upload->tex);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, upload->stride / (drm_fmt->bpp / 8));
+	glTexImage2D(GL_TEXTURE_2D, 0, fmt->gl_format, upload->buffer->width,
+		upload->buffer->height, 0, fmt->gl_format, fmt->gl_type, upload->data);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Blocking is fine here: the contents must be complete before the
+	// renderer's context samples from the texture
+	glFinish();
+	upload->ok = glGetError() == GL_NO_ERROR;
+}
+
+static void *upload_worker_run(void *data) {
+	struct wlr_gles2_renderer *renderer = data;
+	struct wlr_egl *egl = renderer->egl;
+
+	bool current = eglMakeCurrent(egl->display, EGL_NO_SURFACE,
+		EGL_NO_SURFACE, renderer->upload.context);
+	if (!current) {
+		wlr_log(WLR_ERROR, "eglMakeCurrent failed on texture upload thread");
+	}
+
+	pthread_mutex_lock(&renderer->upload.lock);
+	while (true) {
+		while (!renderer->upload.stop && wl_list_empty(&renderer->upload.jobs)) {
+			pthread_cond_wait(&renderer->upload.cond, &renderer->upload.lock);
+		}
+		if (renderer->upload.stop) {
+			break;
+		}
+
+		struct wlr_gles2_texture_upload *upload =
+			wl_container_of(renderer->upload.jobs.next, upload, link);
+		wl_list_remove(&upload->link);
+		wl_list_init(&upload->link);
+		pthread_mutex_unlock(&renderer->upload.lock);
+
+		if (current) {
+			upload_run(upload);
+		}
+
+		pthread_mutex_lock(&renderer->upload.lock);
+		upload->done = true;
+		pthread_cond_broadcast(&renderer->upload.cond);
+
+		char byte = 0;
+		if (write(upload->done_fd, &byte, sizeof(byte)) != sizeof(byte)) {
+			wlr_log_errno(WLR_ERROR, "Failed to signal texture upload");
+		}
+	}
+	pthread_mutex_unlock(&renderer->upload.lock);
+
+	eglMakeCurrent(egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+		EGL_NO_CONTEXT);
+	eglReleaseThread();
+	return NULL;
+}
+
+static bool upload_worker_start(struct wlr_gles2_renderer *renderer) {
+	if (renderer->upload.running) {
+		return true;
+	} else if (renderer->upload.disabled) {
+		return false;
+	}
+
+	renderer->upload.context = wlr_egl_create_shared_context(renderer->egl);
+	if (renderer->upload.context == EGL_NO_CONTEXT) {
+		renderer->upload.disabled = true;
+		return false;
+	}
+
+	renderer->upload.stop = false;
+	int ret = worker_thread_create(&renderer->upload.thread,
+		upload_worker_run, renderer);
+	if (ret != 0) {
+		wlr_log(WLR_ERROR, "Failed to start texture upload thread: %s",
+			strerror(ret));
+		eglDestroyContext(renderer->egl->display, renderer->upload.context);
+		renderer->upload.context = EGL_NO_CONTEXT;
+		renderer->upload.disabled = true;
+		return false;
+	}
+
+	renderer->upload.running = true;
+	return true;
+}
+
+void gles2_upload_worker_init(struct wlr_gles2_renderer *renderer) {
+	pthread_mutex_init(&renderer->upload.lock, NULL);
+	pthread_cond_init(&renderer->upload.cond, NULL);
+	wl_list_init(&renderer->upload.jobs);
+	renderer->upload.context = EGL_NO_CONTEXT;
+}
+
+void gles2_upload_worker_finish(struct wlr_gles2_renderer *renderer) {
+	assert(wl_list_empty(&renderer->upload.jobs));
+
+	if (renderer->upload.running) {
+		pthread_mutex_lock(&renderer->upload.lock);
+		renderer->upload.stop = true;
+		pthread_cond_broadcast(&renderer->upload.cond);
+		pthread_mutex_unlock(&renderer->upload.lock);
+
+		pthread_join(renderer->upload.thread, NULL);
+		eglDestroyContext(renderer->egl->display, renderer->upload.context);
+		renderer->upload.running = false;
+	}
+
+	pthread_cond_destroy(&renderer->upload.cond);
+	pthread_mutex_destroy(&renderer->upload.lock);
+}
+
+static void delete_tex(struct wlr_gles2_renderer *renderer, GLuint tex) {
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(renderer->egl);
+
+	glDeleteTextures(1, &tex);
+
+	wlr_egl_restore_context(&prev_ctx);
+}
+
+static void upload_release(struct wlr_gles2_texture_upload *upload) {
+	buffer_end_data_ptr_access(upload->buffer);
+	wlr_buffer_unlock(upload->buffer);
+	close(upload->base.fd);
+	close(upload->done_fd);
+	free(upload);
+}
+
+static struct wlr_texture *gles2_upload_finish(
+		struct wlr_texture_upload *wlr_upload) {
+	struct wlr_gles2_texture_upload *upload = gles2_get_upload(wlr_upload);
+	struct wlr_gles2_renderer *renderer = upload->renderer;
+
+	pthread_mutex_lock(&renderer->upload.lock);
+	while (!upload->done) {
+		pthread_cond_wait(&renderer->upload.cond, &renderer->upload.lock);
+	}
+	pthread_mutex_unlock(&renderer->upload.lock);
+
+	struct wlr_texture *texture = NULL;
+	if (upload->ok) {
+		texture = gles2_texture_from_tex(renderer, upload->fmt->drm_format,
+			upload->buffer->width, upload->buffer->height, upload->tex);
+	} else {
+		wlr_log(WLR_ERROR, "Texture upload failed");
+	}
+	if (texture == NULL && upload->tex != 0) {
+		delete_tex(renderer, upload->tex);
+	}
+
+	upload_release(upload);
+	return texture;
+}
+
+static void gles2_upload_destroy(struct wlr_texture_upload *wlr_upload) {
+	struct wlr_gles2_texture_upload *upload = gles2_get_upload(wlr_upload);
+	struct wlr_gles2_renderer *renderer = upload->renderer;
+
+	pthread_mutex_lock(&renderer->upload.lock);
+	if (!wl_list_empty(&upload->link)) {
+		// Not started yet
+		wl_list_remove(&upload->link);
+		wl_list_init(&upload->link);
+	} else {
+		while (!upload->done) {
+			pthread_cond_wait(&renderer->upload.cond, &renderer->upload.lock);
+		}
+	}
+	pthread_mutex_unlock(&renderer->upload.lock);
+
+	if (upload->tex != 0) {
+		delete_tex(renderer, upload->tex);
+	}
+	upload_release(upload);
+}
+
+static const struct wlr_texture_upload_impl upload_impl = {
+	.finish = gles2_upload_finish,
+	.destroy = gles2_upload_destroy,
+};
+
+struct wlr_texture_upload *gles2_upload_buffer_async(
+		struct wlr_renderer *wlr_renderer, struct wlr_buffer *buffer) {
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (!buffer_begin_data_ptr_access(buffer, &data, &format, &stride)) {
+		// DMA-BUFs are imported without copying anyway
+		return NULL;
+	}
+
+	const struct wlr_gles2_pixel_format *fmt =
+		get_gles2_format_from_drm(format);
+	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(format);
+	if (fmt == NULL || drm_fmt == NULL ||
+			!is_gles2_pixel_format_supported(renderer, fmt) ||
+			stride % (drm_fmt->bpp / 8) != 0 ||
+			stride < buffer->width * (drm_fmt->bpp / 8)) {
+		// Let the synchronous path report the error
+		goto error_access;
+	}
+
+	if (!upload_worker_start(renderer)) {
+		goto error_access;
+	}
+
+	struct wlr_gles2_texture_upload *upload = calloc(1, sizeof(*upload));
+	if (upload == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		goto error_access;
+	}
+
+	int fds[2];
+	if (pipe(fds) != 0) {
+		wlr_log_errno(WLR_ERROR, "pipe failed");
+		goto error_upload;
+	}
+	for (size_t i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	wlr_texture_upload_init(&upload->base, &upload_impl, fds[0]);
+	upload->renderer = renderer;
+	upload->buffer = wlr_buffer_lock(buffer);
+	upload->fmt = fmt;
+	upload->data = data;
+	upload->stride = stride;
+	upload->done_fd = fds[1];
+
+	pthread_mutex_lock(&renderer->upload.lock);
+	wl_list_insert(renderer->upload.jobs.prev, &upload->link);
+	pthread_cond_broadcast(&renderer->upload.cond);
+	pthread_mutex_unlock(&renderer->upload.lock);
+
+	return &upload->base;
+
+error_upload:
+	free(upload);
+error_access:
+	buffer_end_data_ptr_access(buffer);
+	return NULL;
+}
@@ -1,4 +1,7 @@
 #include <drm_fourcc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include "render/pixel_format.h"
 
 static const struct wlr_pixel_format_info pixel_format_info[] = {
@@ -26,6 +29,42 @@ static const struct wlr_pixel_format_info pixel_format_info[] = {
 		.bpp = 32,
 		.has_alpha = true,
 	},
+	{
+		.drm_format = DRM_FORMAT_XRGB2101010,
+		.opaque_substitute = DRM_FORMAT_INVALID,
+		.bpp = 32,
+		.has_alpha = false,
+	},
+	{
+		.drm_format = DRM_FORMAT_ARGB2101010,
+		.opaque_substitute = DRM_FORMAT_XRGB2101010,
+		.bpp = 32,
+		.has_alpha = true,
+	},
+	{
+		.drm_format = DRM_FORMAT_XBGR2101010,
+		.opaque_substitute = DRM_FORMAT_INVALID,
+		.bpp = 32,
+		.has_alpha = false,
+	},
+	{
+		.drm_format = DRM_FORMAT_ABGR2101010,
+		.opaque_substitute = DRM_FORMAT_XBGR2101010,
+		.bpp = 32,
+		.has_alpha = true,
+	},
+	{
+		.drm_format = DRM_FORMAT_XBGR16161616F,
+		.opaque_substitute = DRM_FORMAT_INVALID,
+		.bpp = 64,
+		.has_alpha = false,
+	},
+	{
+		.drm_format = DRM_FORMAT_ABGR16161616F,
+		.opaque_substitute = DRM_FORMAT_XBGR16161616F,
+		.bpp = 64,
+		.has_alpha = true,
+	},
 };
 
 static const size_t pixel_format_info_size =
@@ -62,3 +101,161 @@ enum wl_shm_format convert_drm_format_to_wl_shm(uint32_t fmt) {
 		return (enum wl_shm_format)fmt;
 	}
 }
+
+/**
+ * Layout of a 32-bit RGB format, as found in a native-endian uint32_t.
+ */
+struct pixel_layout {
+	uint32_t drm_format;
+	uint32_t depth, alpha_depth;
+	uint32_t r_shift, g_shift, b_shift, a_shift;
+	bool has_alpha;
+};
+
+static const struct pixel_layout pixel_layouts[] = {
+	{ DRM_FORMAT_XRGB8888, 8, 8, 16, 8, 0, 24, false },
+	{ DRM_FORMAT_ARGB8888, 8, 8, 16, 8, 0, 24, true },
+	{ DRM_FORMAT_XBGR8888, 8, 8, 0, 8, 16, 24, false },
+	{ DRM_FORMAT_ABGR8888, 8, 8, 0, 8, 16, 24, true },
+	{ DRM_FORMAT_XRGB2101010, 10, 2, 20, 10, 0, 30, false },
+	{ DRM_FORMAT_ARGB2101010, 10, 2, 20, 10, 0, 30, true },
+	{ DRM_FORMAT_XBGR2101010, 10, 2, 0, 10, 20, 30, false },
+	{ DRM_FORMAT_ABGR2101010, 10, 2, 0, 10, 20, 30, true },
+};
+
+static const struct pixel_layout *get_pixel_layout(uint32_t fmt) {
+	for (size_t i = 0; i < sizeof(pixel_layouts) / sizeof(pixel_layouts[0]);
+			i++) {
+		if (pixel_layouts[i].drm_format == fmt) {
+			return &pixel_layouts[i];
+		}
+	}
+	return NULL;
+}
+
+bool pixel_format_can_convert(uint32_t dst_fmt, uint32_t src_fmt) {
+	return get_pixel_layout(dst_fmt) != NULL &&
+		get_pixel_layout(src_fmt) != NULL;
+}
+
+/**
+ * Pixels are converted four at a time with GCC vector extensions, which are
+ * lowered to SSE2 on x86-64 and to NEON on AArch64 without any
+ * architecture-specific code. Rows which aren't a multiple of four pixels
+ * long are padded.
+ */
+#define PIXEL_VEC_LEN 4
+typedef uint32_t pixel_vec __attribute__((vector_size(PIXEL_VEC_LEN * 4)));
+
+struct pixel_conversion {
+	// Source channel masks, after shifting
+	uint32_t mask, alpha_mask;
+	uint32_t src_r_shift, src_g_shift, src_b_shift, src_a_shift;
+	uint32_t dst_r_shift, dst_g_shift, dst_b_shift, dst_a_shift;
+	// Channels are scaled to the destination depth with (c * mul) >> shift
+	uint32_t mul, shift, alpha_mul, alpha_shift;
+	// Bits always set in the destination (alpha/padding of opaque sources)
+	uint32_t fill;
+	bool same_depth;
+};
+
+static void get_depth_conversion(uint32_t src_depth, uint32_t dst_depth,
+		uint32_t *mul, uint32_t *shift) {
+	if (src_depth == dst_depth) {
+		*mul = 1;
+		*shift = 0;
+	} else if (src_depth > dst_depth) {
+		*mul = 1;
+		*shift = src_depth - dst_depth;
+	} else if (src_depth == 8 && dst_depth == 10) {
+		*mul = 1028; // 1023 / 255 in 8.8 fixed point, rounded up
+		*shift = 8;
+	} else {
+		// 2-bit alpha to 8-bit alpha: replicate the bits
+		*mul = 0x55;
+		*shift = 0;
+	}
+}
+
+static inline pixel_vec convert_pixels(const struct pixel_conversion *conv,
+		pixel_vec p) {
+	pixel_vec r = (p >> conv->src_r_shift) & conv->mask;
+	pixel_vec g = (p >> conv->src_g_shift) & conv->mask;
+	pixel_vec b = (p >> conv->src_b_shift) & conv->mask;
+	pixel_vec a = (p >> conv->src_a_shift) & conv->alpha_mask;
+	if (!conv->same_depth) {
+		r = (r * conv->mul) >> conv->shift;
+		g = (g * conv->mul) >> conv->shift;
+		b = (b * conv->mul) >> conv->shift;
+		a = (a * conv->alpha_mul) >> conv->alpha_shift;
+	}
+	return (r << conv->dst_r_shift) | (g << conv->dst_g_shift) |
+		(b << conv->dst_b_shift) | (a << conv->dst_a_shift) | conv->fill;
+}
+
+static void convert_row(const struct pixel_conversion *conv, uint32_t *dst,
+		const uint32_t *src, uint32_t width) {
+	uint32_t i = 0;
+	for (; i + PIXEL_VEC_LEN <= width; i += PIXEL_VEC_LEN) {
+		pixel_vec p;
+		memcpy(&p, &src[i], sizeof(p));
+		p = convert_pixels(conv, p);
+		memcpy(&dst[i], &p, sizeof(p));
+	}
+	if (i < width) {
+		size_t tail = (width - i) * sizeof(uint32_t);
+		pixel_vec p = {0};
+		memcpy(&p, &src[i], tail);
+		p = convert_pixels(conv, p);
+		memcpy(&dst[i], &p, tail);
+	}
+}
+
+bool pixel_format_convert(uint32_t dst_fmt, void *dst, uint32_t dst_stride,
+		uint32_t src_fmt, const void *src, uint32_t src_stride,
+		uint32_t width, uint32_t height, bool y_invert) {
+	const struct pixel_layout *src_layout = get_pixel_layout(src_fmt);
+	const struct pixel_layout *dst_layout = get_pixel_layout(dst_fmt);
+	if (src_layout == NULL || dst_layout == NULL) {
+		return false;
+	}
+
+	struct pixel_conversion conv = {
+		.mask = (1u << src_layout->depth) - 1,
+		.alpha_mask = (1u << src_layout->alpha_depth) - 1,
+		.src_r_shift = src_layout->r_shift,
+		.src_g_shift = src_layout->g_shift,
+		.src_b_shift = src_layout->b_shift,
+		.src_a_shift = src_layout->a_shift,
+		.dst_r_shift = dst_layout->r_shift,
+		.dst_g_shift = dst_layout->g_shift,
+		.dst_b_shift = dst_layout->b_shift,
+		.dst_a_shift = dst_layout->a_shift,
+		.same_depth = src_layout->depth == dst_layout->depth,
+	};
+	get_depth_conversion(src_layout->depth, dst_layout->depth,
+		&conv.mul, &conv.shift);
+	get_depth_conversion(src_layout->alpha_depth, dst_layout->alpha_depth,
+		&conv.alpha_mul, &conv.alpha_shift);
+	if (!src_layout->has_alpha) {
+		// The padding bits are undefined, treat the source as opaque
+		conv.alpha_mask = 0;
+		conv.fill = ((1u << dst_layout->alpha_depth) - 1) <<
+			dst_layout->a_shift;
+	}
+
+	for (uint32_t y = 0; y < height; y++) {
+		uint32_t dst_y = y_invert ? height - y - 1 : y;
+		const uint32_t *src_row = (const uint32_t *)
+			((const unsigned char *)src + (size_t)y * src_stride);
+		uint32_t *dst_row = (uint32_t *)
+			((unsigned char *)dst + (size_t)dst_y * dst_stride);
+		if (src_fmt == dst_fmt) {
+			memcpy(dst_row, src_row, (size_t)width * sizeof(uint32_t));
+		} else {
+			convert_row(&conv, dst_row, src_row, width);
+		}
+	}
+
+	return true;
+}
@@ -1,12 +1,15 @@
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <math.h>
 #include <pixman.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wayland-server.h>
 #include <wlr/render/interface.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/util/log.h>
 
+#include "render/drm_dumb_allocator.h"
 #include "render/pixman.h"
 #include "types/wlr_buffer.h"
 
@@ -22,15 +25,17 @@ static struct wlr_pixman_renderer *get_renderer(
 	return (struct wlr_pixman_renderer *)wlr_renderer;
 }
 
+static const struct wlr_addon_interface buffer_addon_impl;
+
 static struct wlr_pixman_buffer *get_buffer(
 		struct wlr_pixman_renderer *renderer, struct wlr_buffer *wlr_buffer) {
-	struct wlr_pixman_buffer *buffer;
-	wl_list_for_each(buffer, &renderer->buffers, link) {
-		if (buffer->buffer == wlr_buffer) {
-			return buffer;
-		}
+	struct wlr_addon *addon =
+		wlr_addon_find(&wlr_buffer->addons, renderer, &buffer_addon_impl);
+	if (addon == NULL) {
+		return NULL;
 	}
-	return NULL;
+	struct wlr_pixman_buffer *buffer = wl_container_of(addon, buffer, addon);
+	return buffer;
 }
 
 static const struct wlr_texture_impl texture_impl;
@@ -50,18 +55,54 @@ static bool texture_is_opaque(struct wlr_texture *wlr_texture) {
 	return texture->format_info->has_alpha;
 }
 
-static void texture_destroy(struct wlr_texture *wlr_texture) {
-	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+static void pixman_texture_destroy(struct wlr_pixman_texture *texture) {
 	wl_list_remove(&texture->link);
+	if (texture->buffer != NULL) {
+		wlr_addon_finish(&texture->buffer_addon);
+	}
 	pixman_image_unref(texture->image);
-	wlr_buffer_unlock(texture->buffer);
 	free(texture->data);
 	free(texture);
 }
 
+static void texture_unref(struct wlr_texture *wlr_texture) {
+	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+	if (texture->buffer != NULL) {
+		// Keep the image around, in case the buffer is re-used later. We're
+		// still listening to the buffer's destroy event.
+		wlr_buffer_unlock(texture->buffer);
+	} else {
+		pixman_texture_destroy(texture);
+	}
+}
+
+static bool texture_write_pixels(struct wlr_texture *wlr_texture,
+		uint32_t stride, uint32_t width, uint32_t height,
+		uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
+		const void *data) {
+	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+	if (texture->data == NULL) {
+		// We don't own the memory backing the image
+		return false;
+	}
+
+	size_t bytes_per_pixel = texture->format_info->bpp / 8;
+	size_t dst_stride = pixman_image_get_stride(texture->image);
+	size_t row_size = width * bytes_per_pixel;
+	for (uint32_t y = 0; y < height; y++) {
+		const char *src = (const char *)data + (src_y + y) * stride +
+			src_x * bytes_per_pixel;
+		char *dst = (char *)texture->data + (dst_y + y) * dst_stride +
+			dst_x * bytes_per_pixel;
+		memcpy(dst, src, row_size);
+	}
+	return true;
+}
+
 static const struct wlr_texture_impl texture_impl = {
 	.is_opaque = texture_is_opaque,
-	.destroy = texture_destroy,
+	.write_pixels = texture_write_pixels,
+	.destroy = texture_unref,
 };
 
 struct wlr_pixman_texture *pixman_create_texture(
@@ -69,19 +110,23 @@ struct wlr_pixman_texture *pixman_create_texture(
 
 static void destroy_buffer(struct wlr_pixman_buffer *buffer) {
 	wl_list_remove(&buffer->link);
-	wl_list_remove(&buffer->buffer_destroy.link);
+	wlr_addon_finish(&buffer->addon);
 
 	pixman_image_unref(buffer->image);
 
 	free(buffer);
 }
 
-static void handle_destroy_buffer(struct wl_listener *listener, void *data) {
-	struct wlr_pixman_buffer *buffer =
-		wl_container_of(listener, buffer, buffer_destroy);
+static void handle_buffer_destroy(struct wlr_addon *addon) {
+	struct wlr_pixman_buffer *buffer = wl_container_of(addon, buffer, addon);
 	destroy_buffer(buffer);
 }
 
+static const struct wlr_addon_interface buffer_addon_impl = {
+	.name = "wlr_pixman_buffer",
+	.destroy = handle_buffer_destroy,
+};
+
 static struct wlr_pixman_buffer *create_buffer(
 		struct wlr_pixman_renderer *renderer, struct wlr_buffer *wlr_buffer) {
 	struct wlr_pixman_buffer *buffer = calloc(1, sizeof(*buffer));
@@ -115,8 +160,8 @@ static struct wlr_pixman_buffer *create_buffer(
 		goto error_buffer;
 	}
 
-	buffer->buffer_destroy.notify = handle_destroy_buffer;
-	wl_signal_add(&wlr_buffer->events.destroy, &buffer->buffer_destroy);
+	wlr_addon_init(&buffer->addon, &wlr_buffer->addons, renderer,
+		&buffer_addon_impl);
 
 	wl_list_insert(&renderer->buffers, &buffer->link);
 
@@ -130,11 +175,89 @@ error_buffer:
 	return NULL;
 }
 
+/**
+ * Get the area of the current buffer we're allowed to draw to.
+ */
+static void get_render_box(struct wlr_pixman_renderer *renderer,
+		pixman_box32_t *box) {
+	*box = (pixman_box32_t){
+		.x2 = renderer->width,
+		.y2 = renderer->height,
+	};
+	if (renderer->has_scissor) {
+		const struct wlr_box *scissor = &renderer->scissor;
+		box->x1 = fmax(box->x1, scissor->x);
+		box->y1 = fmax(box->y1, scissor->y);
+		box->x2 = fmin(box->x2, scissor->x + scissor->width);
+		box->y2 = fmin(box->y2, scissor->y + scissor->height);
+	}
+	if (renderer->has_clip) {
+		const pixman_box32_t *clip = &renderer->clip_extents;
+		box->x1 = fmax(box->x1, clip->x1);
+		box->y1 = fmax(box->y1, clip->y1);
+		box->x2 = fmin(box->x2, clip->x2);
+		box->y2 = fmin(box->y2, clip->y2);
+	}
+}
+
+/**
+ * Get the area covered by the unit square transformed by the matrix, clipped
+ * to the render box.
+ */
+static void get_matrix_box(struct wlr_pixman_renderer *renderer,
+		const float mat[static 9], pixman_box32_t *box) {
+	float x1 = INFINITY, y1 = INFINITY, x2 = -INFINITY, y2 = -INFINITY;
+	for (int i = 0; i < 4; i++) {
+		float u = i & 1, v = i >> 1;
+		float x = mat[0] * u + mat[1] * v + mat[2];
+		float y = mat[3] * u + mat[4] * v + mat[5];
+		x1 = fmin(x1, x);
+		y1 = fmin(y1, y);
+		x2 = fmax(x2, x);
+		y2 = fmax(y2, y);
+	}
+
+	get_render_box(renderer, box);
+	box->x1 = fmax(box->x1, floor(x1));
+	box->y1 = fmax(box->y1, floor(y1));
+	box->x2 = fmin(box->x2, ceil(x2));
+	box->y2 = fmin(box->y2, ceil(y2));
+}
+
+static bool is_integer(float f) {
+	return f == (int32_t)f;
+}
+
+/**
+ * Check whether the matrix is a translation by a whole number of pixels.
+ */
+static bool matrix_is_int_translation(const float mat[static 9]) {
+	return mat[0] == 1 && mat[1] == 0 && is_integer(mat[2]) &&
+		mat[3] == 0 && mat[4] == 1 && is_integer(mat[5]) &&
+		mat[6] == 0 && mat[7] == 0 && mat[8] == 1;
+}
+
+static void composite(struct wlr_pixman_renderer *renderer,
+		struct wlr_pixman_composite *job) {
+	if (job->box.x1 >= job->box.x2 || job->box.y1 >= job->box.y2) {
+		return;
+	}
+	if (renderer->dirty_y1 >= renderer->dirty_y2) {
+		renderer->dirty_y1 = job->box.y1;
+		renderer->dirty_y2 = job->box.y2;
+	} else {
+		renderer->dirty_y1 = fmin(renderer->dirty_y1, job->box.y1);
+		renderer->dirty_y2 = fmax(renderer->dirty_y2, job->box.y2);
+	}
+	pixman_tile_pool_composite(&renderer->tile_pool, job);
+}
+
 static void pixman_begin(struct wlr_renderer *wlr_renderer, uint32_t width,
 		uint32_t height) {
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
 	renderer->width = width;
 	renderer->height = height;
+	renderer->dirty_y1 = renderer->dirty_y2 = 0;
 
 	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
 	assert(buffer != NULL);
@@ -161,6 +284,9 @@ static void pixman_end(struct wlr_renderer *wlr_renderer) {
 
 	assert(renderer->current_buffer != NULL);
 
+	// Only the rows we've drawn to need to reach DRM dumb buffers
+	drm_dumb_buffer_set_dirty_rows(renderer->current_buffer->buffer,
+		renderer->dirty_y1, renderer->dirty_y2);
 	buffer_end_data_ptr_access(renderer->current_buffer->buffer);
 }
 
@@ -178,8 +304,13 @@ static void pixman_clear(struct wlr_renderer *wlr_renderer,
 
 	pixman_image_t *fill = pixman_image_create_solid_fill(&colour);
 
-	pixman_image_composite32(PIXMAN_OP_SRC, fill, NULL, buffer->image, 0, 0, 0,
-			0, 0, 0, renderer->width, renderer->height);
+	struct wlr_pixman_composite job = {
+		.op = PIXMAN_OP_SRC,
+		.src = fill,
+		.dst = buffer->image,
+	};
+	get_render_box(renderer, &job.box);
+	composite(renderer, &job);
 
 	pixman_image_unref(fill);
 }
@@ -189,7 +320,10 @@ static void pixman_scissor(struct wlr_renderer *wlr_renderer,
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
 	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
 
+	renderer->has_scissor = box != NULL;
 	if (box != NULL) {
+		renderer->scissor = *box;
+
 		struct pixman_region32 region = {0};
 		pixman_region32_init_rect(&region, box->x, box->y, box->width,
 				box->height);
@@ -200,6 +334,43 @@ static void pixman_scissor(struct wlr_renderer *wlr_renderer,
 	}
 }
 
+/**
+ * Restrict the next draws to the clip region, on top of the scissor box.
+ * Returns false if nothing can be drawn.
+ */
+static bool begin_clip(struct wlr_pixman_renderer *renderer,
+		const pixman_region32_t *clip) {
+	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
+
+	pixman_region32_t region;
+	pixman_region32_init(&region);
+	if (renderer->has_scissor) {
+		const struct wlr_box *scissor = &renderer->scissor;
+		pixman_region32_intersect_rect(&region, clip, scissor->x, scissor->y,
+			scissor->width, scissor->height);
+	} else {
+		pixman_region32_copy(&region, (pixman_region32_t *)clip);
+	}
+
+	bool not_empty = pixman_region32_not_empty(&region);
+	if (not_empty) {
+		pixman_image_set_clip_region32(buffer->image, &region);
+		renderer->clip_extents = *pixman_region32_extents(&region);
+		renderer->has_clip = true;
+	}
+	pixman_region32_fini(&region);
+	return not_empty;
+}
+
+static void end_clip(struct wlr_pixman_renderer *renderer) {
+	renderer->has_clip = false;
+
+	// Restore the scissor box
+	struct wlr_box scissor = renderer->scissor;
+	pixman_scissor(&renderer->wlr_renderer,
+		renderer->has_scissor ? &scissor : NULL);
+}
+
 static void matrix_to_pixman_transform(struct pixman_transform *transform,
 		const float mat[static 9]) {
 	struct pixman_f_transform ftr;
@@ -246,31 +417,51 @@ static bool pixman_render_subtexture_with_matrix(
 		}
 	}
 
-	// TODO: don't create a mask if alpha == 1.0
-	struct pixman_color mask_colour = {0};
-	mask_colour.alpha = 0xFFFF * alpha;
-	pixman_image_t *mask = pixman_image_create_solid_fill(&mask_colour);
+	pixman_image_t *mask = NULL;
+	if (alpha < 1.0) {
+		struct pixman_color mask_colour = {0};
+		mask_colour.alpha = 0xFFFF * alpha;
+		mask = pixman_image_create_solid_fill(&mask_colour);
+	}
 
 	float m[9];
 	memcpy(m, matrix, sizeof(m));
 	wlr_matrix_scale(m, 1.0 / fbox->width, 1.0 / fbox->height);
 
-	struct pixman_transform transform = {0};
-	matrix_to_pixman_transform(&transform, m);
-	pixman_transform_invert(&transform, &transform);
+	struct wlr_pixman_composite job = {
+		.op = PIXMAN_OP_OVER,
+		.src = texture->image,
+		.mask = mask,
+		.dst = buffer->image,
+	};
+	get_matrix_box(renderer, matrix, &job.box);
+
+	if (matrix_is_int_translation(m) && is_integer(fbox->x) &&
+			is_integer(fbox->y) && is_integer(fbox->width) &&
+			is_integer(fbox->height)) {
+		// Plain blit: skip the transform so that pixman can pick its fast
+		// paths, and only sample the source box
+		pixman_image_set_transform(texture->image, NULL);
+		job.src_dx = fbox->x - m[2];
+		job.src_dy = fbox->y - m[5];
+	} else {
+		struct pixman_transform transform = {0};
+		matrix_to_pixman_transform(&transform, m);
+		pixman_transform_invert(&transform, &transform);
 
-	pixman_image_set_transform(texture->image, &transform);
+		// TODO clip properly with src_x and src_y
+		pixman_image_set_transform(texture->image, &transform);
+	}
 
-	// TODO clip properly with src_x and src_y
-	pixman_image_composite32(PIXMAN_OP_OVER, texture->image, mask,
-			buffer->image, 0, 0, 0, 0, 0, 0, renderer->width,
-			renderer->height);
+	composite(renderer, &job);
 
 	if (texture->buffer != NULL) {
 		buffer_end_data_ptr_access(texture->buffer);
 	}
 
-	pixman_image_unref(mask);
+	if (mask != NULL) {
+		pixman_image_unref(mask);
+	}
 
 	return true;
 }
@@ -289,6 +480,22 @@ static void pixman_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
 
 	pixman_image_t *fill = pixman_image_create_solid_fill(&colour);
 
+	struct wlr_pixman_composite job = {
+		.op = PIXMAN_OP_OVER,
+		.dst = buffer->image,
+	};
+	get_matrix_box(renderer, matrix, &job.box);
+
+	if (matrix[1] == 0.0 && matrix[3] == 0.0 && is_integer(matrix[0]) &&
+			is_integer(matrix[2]) && is_integer(matrix[4]) &&
+			is_integer(matrix[5])) {
+		// Pixel-aligned rectangle: no need for an intermediate image
+		job.src = fill;
+		composite(renderer, &job);
+		pixman_image_unref(fill);
+		return;
+	}
+
 	float m[9];
 	memcpy(m, matrix, sizeof(m));
 
@@ -318,12 +525,37 @@ static void pixman_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
 
 	pixman_image_set_transform(image, &transform);
 
-	pixman_image_composite32(PIXMAN_OP_OVER, image, NULL, buffer->image,
-			0, 0, 0, 0, 0, 0, renderer->width, renderer->height);
+	job.src = image;
+	composite(renderer, &job);
 
 	pixman_image_unref(image);
 }
 
+static bool pixman_render_subtexture_with_matrix_clipped(
+		struct wlr_renderer *wlr_renderer, struct wlr_texture *wlr_texture,
+		const struct wlr_fbox *fbox, const float matrix[static 9],
+		float alpha, const pixman_region32_t *clip) {
+	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
+	if (!begin_clip(renderer, clip)) {
+		return true;
+	}
+	bool ok = pixman_render_subtexture_with_matrix(wlr_renderer, wlr_texture,
+		fbox, matrix, alpha);
+	end_clip(renderer);
+	return ok;
+}
+
+static void pixman_render_quad_with_matrix_clipped(
+		struct wlr_renderer *wlr_renderer, const float color[static 4],
+		const float matrix[static 9], const pixman_region32_t *clip) {
+	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
+	if (!begin_clip(renderer, clip)) {
+		return;
+	}
+	pixman_render_quad_with_matrix(wlr_renderer, color, matrix);
+	end_clip(renderer);
+}
+
 static const uint32_t *pixman_get_shm_texture_formats(
 		struct wlr_renderer *wlr_renderer, size_t *len) {
 	return get_pixman_drm_formats(len);
@@ -368,34 +600,76 @@ static struct wlr_pixman_texture *pixman_texture_create(
 	return texture;
 }
 
+static void texture_handle_buffer_destroy(struct wlr_addon *addon) {
+	struct wlr_pixman_texture *texture =
+		wl_container_of(addon, texture, buffer_addon);
+	pixman_texture_destroy(texture);
+}
+
+static const struct wlr_addon_interface texture_addon_impl = {
+	.name = "wlr_pixman_texture",
+	.destroy = texture_handle_buffer_destroy,
+};
+
 static struct wlr_texture *pixman_texture_from_buffer(
 		struct wlr_renderer *wlr_renderer, struct wlr_buffer *buffer) {
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
 
+	// Images wrapping the buffer's memory are kept for as long as the buffer
+	// lives: clients keep committing the same few buffers, and compositing
+	// reads straight from their memory, so there is nothing to update
+	struct wlr_addon *addon =
+		wlr_addon_find(&buffer->addons, renderer, &texture_addon_impl);
+	if (addon != NULL) {
+		struct wlr_pixman_texture *texture =
+			wl_container_of(addon, texture, buffer_addon);
+		wlr_buffer_lock(texture->buffer);
+		return &texture->wlr_texture;
+	}
+
 	void *data = NULL;
 	uint32_t drm_format;
 	size_t stride;
 	if (!buffer_begin_data_ptr_access(buffer, &data, &drm_format, &stride)) {
 		return NULL;
 	}
-	buffer_end_data_ptr_access(buffer);
 
 	struct wlr_pixman_texture *texture = pixman_texture_create(renderer,
 		drm_format, buffer->width, buffer->height);
 	if (texture == NULL) {
+		buffer_end_data_ptr_access(buffer);
 		return NULL;
 	}
 
+	if (renderer->copy_buffers) {
+		texture->data = malloc(stride * buffer->height);
+		if (texture->data == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			buffer_end_data_ptr_access(buffer);
+			wl_list_remove(&texture->link);
+			free(texture);
+			return NULL;
+		}
+		memcpy(texture->data, data, stride * buffer->height);
+		data = texture->data;
+	}
+	buffer_end_data_ptr_access(buffer);
+
 	texture->image = pixman_image_create_bits_no_clear(texture->format,
 		buffer->width, buffer->height, data, stride);
 	if (!texture->image) {
 		wlr_log(WLR_ERROR, "Failed to create pixman image");
 		wl_list_remove(&texture->link);
+		free(texture->data);
 		free(texture);
 		return NULL;
 	}
 
-	texture->buffer = wlr_buffer_lock(buffer);
+	if (texture->data == NULL) {
+		texture->buffer = wlr_buffer_lock(buffer);
+		wlr_addon_init(&texture->buffer_addon, &buffer->addons, renderer,
+			&texture_addon_impl);
+	}
 
 	return &texture->wlr_texture;
 }
@@ -437,11 +711,13 @@ static void pixman_destroy(struct wlr_renderer *wlr_renderer) {
 
 	struct wlr_pixman_texture *tex, *tex_tmp;
 	wl_list_for_each_safe(tex, tex_tmp, &renderer->textures, link) {
-		wlr_texture_destroy(&tex->wlr_texture);
+		pixman_texture_destroy(tex);
 	}
 
 	wlr_drm_format_set_finish(&renderer->drm_formats);
 
+	pixman_tile_pool_finish(&renderer->tile_pool);
+
 	free(renderer);
 }
 
@@ -495,6 +771,9 @@ static const struct wlr_renderer_impl renderer_impl = {
 	.scissor = pixman_scissor,
 	.render_subtexture_with_matrix = pixman_render_subtexture_with_matrix,
 	.render_quad_with_matrix = pixman_render_quad_with_matrix,
+	.render_subtexture_with_matrix_clipped =
+		pixman_render_subtexture_with_matrix_clipped,
+	.render_quad_with_matrix_clipped = pixman_render_quad_with_matrix_clipped,
 	.get_shm_texture_formats = pixman_get_shm_texture_formats,
 	.get_render_formats = pixman_get_render_formats,
 	.texture_from_buffer = pixman_texture_from_buffer,
@@ -525,9 +804,17 @@ struct wlr_renderer *wlr_pixman_renderer_create(void) {
 				DRM_FORMAT_MOD_LINEAR);
 	}
 
+	pixman_tile_pool_init(&renderer->tile_pool);
+
 	return &renderer->wlr_renderer;
 }
 
+void wlr_pixman_renderer_set_copy_buffers(struct wlr_renderer *wlr_renderer,
+		bool copy) {
+	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
+	renderer->copy_buffers = copy;
+}
+
 pixman_image_t *wlr_pixman_texture_get_image(struct wlr_texture *wlr_texture) {
 	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
 	return texture->image;
@@ -0,0 +1,168 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+#include "render/pixman.h"
+#include "util/realtime.h"
+
+// Areas smaller than this are composited on the calling thread
+#define TILE_MIN_AREA (256 * 256)
+// Minimum height of a horizontal band
+#define TILE_MIN_HEIGHT 32
+#define TILE_MAX_THREADS 7
+
+static void composite_tile(const struct wlr_pixman_composite *job,
+		int tile) {
+	int32_t height = job->box.y2 - job->box.y1;
+	int32_t y1 = job->box.y1 + height * tile / job->tiles_len;
+	int32_t y2 = job->box.y1 + height * (tile + 1) / job->tiles_len;
+	if (y1 == y2) {
+		return;
+	}
+
+	pixman_image_composite32(job->op, job->src, job->mask, job->dst,
+		job->box.x1 + job->src_dx, y1 + job->src_dy, 0, 0,
+		job->box.x1, y1, job->box.x2 - job->box.x1, y2 - y1);
+}
+
+// Returns true with the mutex locked if a tile has been assigned, false if
+// the pool is stopping
+static bool pool_take_tile(struct wlr_pixman_tile_pool *pool, int *tile) {
+	while (!pool->stop && (pool->job == NULL ||
+			pool->next_tile >= pool->job->tiles_len)) {
+		pthread_cond_wait(&pool->job_cond, &pool->mutex);
+	}
+	if (pool->stop) {
+		return false;
+	}
+	*tile = pool->next_tile++;
+	return true;
+}
+
+static void pool_complete_tile(struct wlr_pixman_tile_pool *pool) {
+	pool->tiles_done++;
+	if (pool->tiles_done == pool->job->tiles_len) {
+		pthread_cond_signal(&pool->done_cond);
+	}
+}
+
+static void *pool_worker(void *data) {
+	struct wlr_pixman_tile_pool *pool = data;
+
+	pthread_mutex_lock(&pool->mutex);
+	int tile;
+	while (pool_take_tile(pool, &tile)) {
+		const struct wlr_pixman_composite *job = pool->job;
+		pthread_mutex_unlock(&pool->mutex);
+
+		composite_tile(job, tile);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool_complete_tile(pool);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+void pixman_tile_pool_init(struct wlr_pixman_tile_pool *pool) {
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->job_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus <= 1) {
+		return;
+	}
+	size_t threads_len = cpus - 1;
+	if (threads_len > TILE_MAX_THREADS) {
+		threads_len = TILE_MAX_THREADS;
+	}
+
+	pool->threads = calloc(threads_len, sizeof(pool->threads[0]));
+	if (pool->threads == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+
+	for (size_t i = 0; i < threads_len; i++) {
+		if (worker_thread_create(&pool->threads[i], pool_worker, pool) != 0) {
+			wlr_log(WLR_ERROR, "Failed to create pixman worker thread");
+			break;
+		}
+		pool->threads_len++;
+	}
+
+	wlr_log(WLR_DEBUG, "Compositing with %zu pixman worker threads",
+		pool->threads_len);
+}
+
+void pixman_tile_pool_finish(struct wlr_pixman_tile_pool *pool) {
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (size_t i = 0; i < pool->threads_len; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	free(pool->threads);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->job_cond);
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+void pixman_tile_pool_composite(struct wlr_pixman_tile_pool *pool,
+		struct wlr_pixman_composite *job) {
+	int32_t width = job->box.x2 - job->box.x1;
+	int32_t height = job->box.y2 - job->box.y1;
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+
+	job->tiles_len = 1;
+	if (pool->threads_len > 0 && width * height >= TILE_MIN_AREA) {
+		job->tiles_len = height / TILE_MIN_HEIGHT;
+		if (job->tiles_len > (int)pool->threads_len + 1) {
+			job->tiles_len = pool->threads_len + 1;
+		}
+		if (job->tiles_len < 1) {
+			job->tiles_len = 1;
+		}
+	}
+
+	// pixman lazily validates image properties on first use, which isn't
+	// thread-safe: always composite the first tile on the calling thread,
+	// before handing out the others
+	composite_tile(job, 0);
+	if (job->tiles_len == 1) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	assert(pool->job == NULL);
+	pool->job = job;
+	pool->next_tile = 1;
+	pool->tiles_done = 1;
+	pthread_cond_broadcast(&pool->job_cond);
+
+	// Help out instead of sleeping
+	while (pool->next_tile < job->tiles_len) {
+		int tile = pool->next_tile++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		composite_tile(job, tile);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool_complete_tile(pool);
+	}
+
+	while (pool->tiles_done < job->tiles_len) {
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	}
+	pool->job = NULL;
+	pthread_mutex_unlock(&pool->mutex);
+}
@@ -8,6 +8,8 @@
 #include "render/shm_allocator.h"
 #include "util/shm.h"
 
+#define HUGEPAGE_MIN_SIZE (2 * 1024 * 1024)
+
 static const struct wlr_buffer_impl buffer_impl;
 
 static struct wlr_shm_buffer *shm_buffer_from_buffer(
@@ -91,6 +93,14 @@ static struct wlr_buffer *allocator_create_buffer(
 		return NULL;
 	}
 
+#ifdef MADV_HUGEPAGE
+	// Large buffers (e.g. full-screen 4K) benefit from fewer TLB misses when
+	// the kernel is allowed to back them with transparent huge pages
+	if (buffer->size >= HUGEPAGE_MIN_SIZE) {
+		madvise(buffer->data, buffer->size, MADV_HUGEPAGE);
+	}
+#endif
+
 	return &buffer->base;
 }
 
@@ -23,6 +23,7 @@ struct wlr_swapchain *wlr_swapchain_create(
 	swapchain->allocator = alloc;
 	swapchain->width = width;
 	swapchain->height = height;
+	swapchain->num_slots = WLR_SWAPCHAIN_CAP;
 
 	swapchain->format = wlr_drm_format_dup(format);
 	if (swapchain->format == NULL) {
@@ -56,6 +57,28 @@ void wlr_swapchain_destroy(struct wlr_swapchain *swapchain) {
 	free(swapchain);
 }
 
+static void swapchain_trim(struct wlr_swapchain *swapchain) {
+	for (size_t i = swapchain->num_slots; i < WLR_SWAPCHAIN_CAP; i++) {
+		struct wlr_swapchain_slot *slot = &swapchain->slots[i];
+		if (!slot->acquired && slot->buffer != NULL) {
+			slot_reset(slot);
+		}
+	}
+}
+
+bool wlr_swapchain_set_num_slots(struct wlr_swapchain *swapchain,
+		size_t num_slots) {
+	if (num_slots == 0 || num_slots > WLR_SWAPCHAIN_CAP) {
+		wlr_log(WLR_ERROR, "Invalid number of swapchain slots: %zu",
+			num_slots);
+		return false;
+	}
+
+	swapchain->num_slots = num_slots;
+	swapchain_trim(swapchain);
+	return true;
+}
+
 static void slot_handle_release(struct wl_listener *listener, void *data) {
 	struct wlr_swapchain_slot *slot =
 		wl_container_of(listener, slot, release);
@@ -82,18 +105,35 @@ static struct wlr_buffer *slot_acquire(struct wlr_swapchain *swapchain,
 
 struct wlr_buffer *wlr_swapchain_acquire(struct wlr_swapchain *swapchain,
 		int *age) {
-	struct wlr_swapchain_slot *free_slot = NULL;
+	swapchain_trim(swapchain);
+
+	// Prefer the most recently submitted buffer: it needs the least repainting.
+	// Buffers with an age of zero have undefined contents.
+	struct wlr_swapchain_slot *best_slot = NULL, *free_slot = NULL;
+	size_t num_buffers = 0;
 	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
 		struct wlr_swapchain_slot *slot = &swapchain->slots[i];
+		if (slot->buffer != NULL) {
+			num_buffers++;
+		}
 		if (slot->acquired) {
 			continue;
 		}
-		if (slot->buffer != NULL) {
-			return slot_acquire(swapchain, slot, age);
+		if (slot->buffer == NULL) {
+			if (free_slot == NULL && i < swapchain->num_slots) {
+				free_slot = slot;
+			}
+			continue;
+		}
+		if (best_slot == NULL || (slot->age > 0 &&
+				(best_slot->age == 0 || slot->age < best_slot->age))) {
+			best_slot = slot;
 		}
-		free_slot = slot;
 	}
-	if (free_slot == NULL) {
+	if (best_slot != NULL) {
+		return slot_acquire(swapchain, best_slot, age);
+	}
+	if (free_slot == NULL || num_buffers >= swapchain->num_slots) {
 		wlr_log(WLR_ERROR, "No free output buffer slot");
 		return NULL;
 	}
@@ -112,24 +152,13 @@ struct wlr_buffer *wlr_swapchain_acquire(struct wlr_swapchain *swapchain,
 	return slot_acquire(swapchain, free_slot, age);
 }
 
-static bool swapchain_has_buffer(struct wlr_swapchain *swapchain,
-		struct wlr_buffer *buffer) {
-	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
-		struct wlr_swapchain_slot *slot = &swapchain->slots[i];
-		if (slot->buffer == buffer) {
-			return true;
-		}
-	}
-	return false;
-}
-
 void wlr_swapchain_set_buffer_submitted(struct wlr_swapchain *swapchain,
 		struct wlr_buffer *buffer) {
 	assert(buffer != NULL);
 
-	if (!swapchain_has_buffer(swapchain, buffer)) {
-		return;
-	}
+	// A buffer which doesn't belong to the swap chain (e.g. a client buffer
+	// used for direct scan-out) still counts as a frame: all of our buffers
+	// get older.
 
 	// See the algorithm described in:
 	// https://www.khronos.org/registry/EGL/extensions/EXT/EGL_EXT_buffer_age.txt
@@ -15,8 +15,11 @@
 #endif
 
 #include "util/signal.h"
+#include "util/startup.h"
+#include "util/trace.h"
 #include "render/pixel_format.h"
 #include "render/wlr_renderer.h"
+#include "render/wlr_texture.h"
 
 void wlr_renderer_init(struct wlr_renderer *renderer,
 		const struct wlr_renderer_impl *impl) {
@@ -59,6 +62,8 @@ bool renderer_bind_buffer(struct wlr_renderer *r, struct wlr_buffer *buffer) {
 void wlr_renderer_begin(struct wlr_renderer *r, uint32_t width, uint32_t height) {
 	assert(!r->rendering);
 
+	trace_begin("render %ux%u", width, height);
+
 	r->impl->begin(r, width, height);
 
 	r->rendering = true;
@@ -82,11 +87,32 @@ void wlr_renderer_end(struct wlr_renderer *r) {
 	}
 
 	r->rendering = false;
+	r->render_seq++;
+
+	if (r->color_transform) {
+		r->impl->set_color_transform(r, NULL, 0, NULL);
+		r->color_transform = false;
+	}
 
 	if (r->rendering_with_buffer) {
 		renderer_bind_buffer(r, NULL);
 		r->rendering_with_buffer = false;
 	}
+
+	trace_end();
+}
+
+bool wlr_renderer_set_color_transform(struct wlr_renderer *r,
+		const float *matrix, size_t ramp_size, const uint16_t *ramps) {
+	assert(!r->rendering);
+	if (!r->impl->set_color_transform) {
+		return false;
+	}
+	if (!r->impl->set_color_transform(r, matrix, ramp_size, ramps)) {
+		return false;
+	}
+	r->color_transform = matrix != NULL || ramp_size > 0;
+	return true;
 }
 
 void wlr_renderer_clear(struct wlr_renderer *r, const float color[static 4]) {
@@ -131,6 +157,19 @@ bool wlr_render_subtexture_with_matrix(struct wlr_renderer *r,
 		struct wlr_texture *texture, const struct wlr_fbox *box,
 		const float matrix[static 9], float alpha) {
 	assert(r->rendering);
+	if (wlr_texture_is_solid(texture)) {
+		struct wlr_solid_texture *solid = solid_texture_from_texture(texture);
+		const float color[4] = {
+			solid->color[0] * alpha,
+			solid->color[1] * alpha,
+			solid->color[2] * alpha,
+			solid->color[3] * alpha,
+		};
+		if (color[3] > 0) {
+			r->impl->render_quad_with_matrix(r, color, matrix);
+		}
+		return true;
+	}
 	return r->impl->render_subtexture_with_matrix(r, texture,
 		box, matrix, alpha);
 }
@@ -154,6 +193,104 @@ void wlr_render_quad_with_matrix(struct wlr_renderer *r,
 	r->impl->render_quad_with_matrix(r, color, matrix);
 }
 
+static void scissor_rect(struct wlr_renderer *r, const pixman_box32_t *rect) {
+	struct wlr_box box = {
+		.x = rect->x1,
+		.y = rect->y1,
+		.width = rect->x2 - rect->x1,
+		.height = rect->y2 - rect->y1,
+	};
+	r->impl->scissor(r, &box);
+}
+
+bool wlr_render_texture_with_matrix_clipped(struct wlr_renderer *r,
+		struct wlr_texture *texture, const float matrix[static 9], float alpha,
+		const pixman_region32_t *clip) {
+	struct wlr_fbox box = {
+		.x = 0,
+		.y = 0,
+		.width = texture->width,
+		.height = texture->height,
+	};
+	return wlr_render_subtexture_with_matrix_clipped(r, texture, &box, matrix,
+		alpha, clip);
+}
+
+bool wlr_render_subtexture_with_matrix_clipped(struct wlr_renderer *r,
+		struct wlr_texture *texture, const struct wlr_fbox *box,
+		const float matrix[static 9], float alpha,
+		const pixman_region32_t *clip) {
+	assert(r->rendering);
+	if (!pixman_region32_not_empty((pixman_region32_t *)clip)) {
+		return true;
+	}
+	if (wlr_texture_is_solid(texture)) {
+		struct wlr_solid_texture *solid = solid_texture_from_texture(texture);
+		const float color[4] = {
+			solid->color[0] * alpha,
+			solid->color[1] * alpha,
+			solid->color[2] * alpha,
+			solid->color[3] * alpha,
+		};
+		if (color[3] > 0) {
+			wlr_render_quad_with_matrix_clipped(r, color, matrix, clip);
+		}
+		return true;
+	}
+	if (r->impl->render_subtexture_with_matrix_clipped) {
+		return r->impl->render_subtexture_with_matrix_clipped(r, texture,
+			box, matrix, alpha, clip);
+	}
+
+	bool ok = true;
+	int nrects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(
+		(pixman_region32_t *)clip, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		scissor_rect(r, &rects[i]);
+		ok = r->impl->render_subtexture_with_matrix(r, texture, box, matrix,
+			alpha) && ok;
+	}
+	r->impl->scissor(r, NULL);
+	return ok;
+}
+
+void wlr_render_rect_clipped(struct wlr_renderer *r, const struct wlr_box *box,
+		const float color[static 4], const float projection[static 9],
+		const pixman_region32_t *clip) {
+	if (box->width == 0 || box->height == 0) {
+		return;
+	}
+	assert(box->width > 0 && box->height > 0);
+	float matrix[9];
+	wlr_matrix_project_box(matrix, box, WL_OUTPUT_TRANSFORM_NORMAL, 0,
+		projection);
+
+	wlr_render_quad_with_matrix_clipped(r, color, matrix, clip);
+}
+
+void wlr_render_quad_with_matrix_clipped(struct wlr_renderer *r,
+		const float color[static 4], const float matrix[static 9],
+		const pixman_region32_t *clip) {
+	assert(r->rendering);
+	if (!pixman_region32_not_empty((pixman_region32_t *)clip)) {
+		return;
+	}
+	if (r->impl->render_quad_with_matrix_clipped) {
+		r->impl->render_quad_with_matrix_clipped(r, color, matrix, clip);
+		return;
+	}
+
+	int nrects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(
+		(pixman_region32_t *)clip, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		scissor_rect(r, &rects[i]);
+		r->impl->render_quad_with_matrix(r, color, matrix);
+	}
+	r->impl->scissor(r, NULL);
+}
+
 const uint32_t *wlr_renderer_get_shm_texture_formats(struct wlr_renderer *r,
 		size_t *len) {
 	return r->impl->get_shm_texture_formats(r, len);
@@ -206,6 +343,73 @@ bool wlr_renderer_read_pixels(struct wlr_renderer *r, uint32_t fmt,
 		src_x, src_y, dst_x, dst_y, data);
 }
 
+struct wlr_read_pixels_request *wlr_renderer_read_pixels_async(
+		struct wlr_renderer *r, uint32_t fmt, uint32_t width, uint32_t height,
+		uint32_t src_x, uint32_t src_y) {
+	if (!r->impl->read_pixels_async) {
+		return NULL;
+	}
+	return r->impl->read_pixels_async(r, fmt, width, height, src_x, src_y);
+}
+
+void wlr_read_pixels_request_init(struct wlr_read_pixels_request *request,
+		const struct wlr_read_pixels_request_impl *impl, uint32_t format,
+		uint32_t width, uint32_t height) {
+	assert(impl->is_ready && impl->finish && impl->destroy);
+	request->impl = impl;
+	request->format = format;
+	request->width = width;
+	request->height = height;
+}
+
+bool wlr_read_pixels_request_is_ready(struct wlr_read_pixels_request *request) {
+	return request->impl->is_ready(request);
+}
+
+bool wlr_read_pixels_request_finish(struct wlr_read_pixels_request *request,
+		uint32_t *flags, uint32_t stride, uint32_t dst_x, uint32_t dst_y,
+		void *data) {
+	return request->impl->finish(request, flags, stride, dst_x, dst_y, data);
+}
+
+void wlr_read_pixels_request_destroy(struct wlr_read_pixels_request *request) {
+	if (request == NULL) {
+		return;
+	}
+	request->impl->destroy(request);
+}
+
+struct wlr_texture_upload *wlr_renderer_upload_buffer_async(
+		struct wlr_renderer *r, struct wlr_buffer *buffer) {
+	if (!r->impl->upload_buffer_async) {
+		return NULL;
+	}
+	return r->impl->upload_buffer_async(r, buffer);
+}
+
+void wlr_texture_upload_init(struct wlr_texture_upload *upload,
+		const struct wlr_texture_upload_impl *impl, int fd) {
+	assert(impl->finish && impl->destroy);
+	upload->impl = impl;
+	upload->fd = fd;
+}
+
+int wlr_texture_upload_get_fd(struct wlr_texture_upload *upload) {
+	return upload->fd;
+}
+
+struct wlr_texture *wlr_texture_upload_finish(
+		struct wlr_texture_upload *upload) {
+	return upload->impl->finish(upload);
+}
+
+void wlr_texture_upload_destroy(struct wlr_texture_upload *upload) {
+	if (upload == NULL) {
+		return;
+	}
+	upload->impl->destroy(upload);
+}
+
 bool wlr_renderer_init_wl_display(struct wlr_renderer *r,
 		struct wl_display *wl_display) {
 	if (wl_display_init_shm(wl_display)) {
@@ -247,7 +451,7 @@ bool wlr_renderer_init_wl_display(struct wlr_renderer *r,
 	return true;
 }
 
-struct wlr_renderer *renderer_autocreate_with_drm_fd(int drm_fd) {
+static struct wlr_renderer *renderer_autocreate(int drm_fd) {
 	const char *name = getenv("WLR_RENDERER");
 	if (name) {
 		wlr_log(WLR_INFO, "Loading user-specified renderer due to WLR_RENDERER: %s",
@@ -292,12 +496,27 @@ struct wlr_renderer *renderer_autocreate_with_drm_fd(int drm_fd) {
 	return NULL;
 }
 
+struct wlr_renderer *renderer_autocreate_with_drm_fd(int drm_fd) {
+	int64_t start = startup_phase_begin("renderer");
+	struct wlr_renderer *renderer = renderer_autocreate(drm_fd);
+	startup_phase_end("renderer", start);
+	return renderer;
+}
+
 struct wlr_renderer *wlr_renderer_autocreate(struct wlr_backend *backend) {
 	// Note, drm_fd may be negative if unavailable
 	int drm_fd = wlr_backend_get_drm_fd(backend);
 	return renderer_autocreate_with_drm_fd(drm_fd);
 }
 
+bool wlr_renderer_get_render_stats(struct wlr_renderer *r,
+		uint32_t render_seq, struct wlr_render_stats *stats) {
+	if (!r->impl->get_render_stats) {
+		return false;
+	}
+	return r->impl->get_render_stats(r, render_seq, stats);
+}
+
 int wlr_renderer_get_drm_fd(struct wlr_renderer *r) {
 	if (!r->impl->get_drm_fd) {
 		return -1;
@@ -1,8 +1,10 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/render/interface.h>
 #include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_buffer.h>
 #include "types/wlr_buffer.h"
 #include "render/wlr_texture.h"
 
@@ -70,9 +72,55 @@ struct wlr_texture *wlr_texture_from_dmabuf(struct wlr_renderer *renderer,
 	return texture;
 }
 
+static const struct wlr_texture_impl solid_texture_impl;
+
+bool wlr_texture_is_solid(struct wlr_texture *texture) {
+	return texture->impl == &solid_texture_impl;
+}
+
+struct wlr_solid_texture *solid_texture_from_texture(
+		struct wlr_texture *texture) {
+	assert(wlr_texture_is_solid(texture));
+	return (struct wlr_solid_texture *)texture;
+}
+
+static bool solid_texture_is_opaque(struct wlr_texture *wlr_texture) {
+	struct wlr_solid_texture *texture = solid_texture_from_texture(wlr_texture);
+	return texture->color[3] >= 1.0f;
+}
+
+static void solid_texture_destroy(struct wlr_texture *wlr_texture) {
+	free(solid_texture_from_texture(wlr_texture));
+}
+
+// Not writable: surface updates re-import the buffer, which is as cheap
+static const struct wlr_texture_impl solid_texture_impl = {
+	.is_opaque = solid_texture_is_opaque,
+	.destroy = solid_texture_destroy,
+};
+
+static struct wlr_texture *solid_texture_create(struct wlr_buffer *buffer,
+		const float color[static 4]) {
+	struct wlr_solid_texture *texture = calloc(1, sizeof(*texture));
+	if (texture == NULL) {
+		return NULL;
+	}
+	wlr_texture_init(&texture->base, &solid_texture_impl,
+		buffer->width, buffer->height);
+	memcpy(texture->color, color, sizeof(texture->color));
+	return &texture->base;
+}
+
 struct wlr_texture *wlr_texture_from_buffer(struct wlr_renderer *renderer,
 		struct wlr_buffer *buffer) {
 	assert(!renderer->rendering);
+
+	// Nothing to upload for a single color
+	float color[4];
+	if (wlr_buffer_get_solid_color(buffer, color)) {
+		return solid_texture_create(buffer, color);
+	}
+
 	if (!renderer->impl->texture_from_buffer) {
 		return NULL;
 	}
@@ -96,3 +144,23 @@ bool wlr_texture_write_pixels(struct wlr_texture *texture,
 	return texture->impl->write_pixels(texture, stride, width, height,
 		src_x, src_y, dst_x, dst_y, data);
 }
+
+bool wlr_texture_write_pixels_region(struct wlr_texture *texture,
+		uint32_t stride, pixman_region32_t *region, const void *data) {
+	if (texture->impl->write_pixels_region) {
+		return texture->impl->write_pixels_region(texture, stride, region,
+			data);
+	}
+
+	int n;
+	pixman_box32_t *rects = pixman_region32_rectangles(region, &n);
+	for (int i = 0; i < n; ++i) {
+		pixman_box32_t *r = &rects[i];
+		if (!wlr_texture_write_pixels(texture, stride,
+				r->x2 - r->x1, r->y2 - r->y1, r->x1, r->y1,
+				r->x1, r->y1, data)) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -15,12 +15,14 @@
 #include <wlr/types/wlr_keyboard.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_damage.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_pointer.h>
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/util/log.h>
+#include <wlr/util/region.h>
 #include <xkbcommon/xkbcommon.h>
 
 /* For brevity's sake, struct members are annotated where they are used. */
@@ -61,6 +63,9 @@ struct tinywl_server {
 	struct wlr_output_layout *output_layout;
 	struct wl_list outputs;
 	struct wl_listener new_output;
+
+	bool damage_tracking;
+	struct wl_listener new_surface;
 };
 
 struct tinywl_output {
@@ -68,6 +73,18 @@ struct tinywl_output {
 	struct tinywl_server *server;
 	struct wlr_output *wlr_output;
 	struct wl_listener frame;
+	struct wlr_output_damage *damage;
+};
+
+/* Only used with damage tracking, to find out which parts of the screen a
+ * surface commit changes. */
+struct tinywl_surface {
+	struct tinywl_server *server;
+	struct wlr_surface *wlr_surface;
+	struct wl_listener commit;
+	struct wl_listener destroy;
+	/* Where the surface was drawn last, in layout coordinates */
+	struct wlr_box box;
 };
 
 struct tinywl_view {
@@ -92,6 +109,53 @@ struct tinywl_keyboard {
 	struct wl_listener key;
 };
 
+static void damage_layout_box(struct tinywl_server *server,
+		struct wlr_box *box) {
+	/* Damage is tracked per output, in output-local coordinates. We translate
+	 * the box for each output, outputs it doesn't intersect ignore it. */
+	struct tinywl_output *output;
+	wl_list_for_each(output, &server->outputs, link) {
+		double ox = 0, oy = 0;
+		wlr_output_layout_output_coords(
+				server->output_layout, output->wlr_output, &ox, &oy);
+		float scale = output->wlr_output->scale;
+		struct wlr_box output_box = {
+			.x = (box->x + ox) * scale,
+			.y = (box->y + oy) * scale,
+			.width = box->width * scale,
+			.height = box->height * scale,
+		};
+		wlr_output_damage_add_box(output->damage, &output_box);
+	}
+}
+
+static void view_damage_surface(struct wlr_surface *surface,
+		int sx, int sy, void *data) {
+	struct tinywl_view *view = data;
+	struct tinywl_surface *tsurface = surface->data;
+	struct wlr_box box = {
+		.x = view->x + sx,
+		.y = view->y + sy,
+		.width = surface->current.width,
+		.height = surface->current.height,
+	};
+	damage_layout_box(view->server, &box);
+	if (tsurface != NULL) {
+		tsurface->box = box;
+	}
+}
+
+static void view_damage_whole(struct tinywl_view *view) {
+	/* With damage tracking, every change to the scene which isn't a surface
+	 * commit has to be reported: here the view moved, got raised, mapped or
+	 * unmapped. We damage all the surfaces of the view. */
+	if (!view->server->damage_tracking || !view->mapped) {
+		return;
+	}
+	wlr_xdg_surface_for_each_surface(view->xdg_surface,
+			view_damage_surface, view);
+}
+
 static void focus_view(struct tinywl_view *view, struct wlr_surface *surface) {
 	/* Note: this function only deals with keyboard focus. */
 	if (view == NULL) {
@@ -118,6 +182,7 @@ static void focus_view(struct tinywl_view *view, struct wlr_surface *surface) {
 	/* Move the view to the front */
 	wl_list_remove(&view->link);
 	wl_list_insert(&server->views, &view->link);
+	view_damage_whole(view);
 	/* Activate the new surface */
 	wlr_xdg_toplevel_set_activated(view->xdg_surface, true);
 	/*
@@ -350,10 +415,51 @@ static struct tinywl_view *desktop_view_at(
 	return NULL;
 }
 
+/* Used to look for a surface among the surfaces of a view. */
+struct find_surface_data {
+	struct wlr_surface *surface;
+	int sx, sy;
+	bool found;
+};
+
+static void find_surface(struct wlr_surface *surface,
+		int sx, int sy, void *data) {
+	struct find_surface_data *fdata = data;
+	if (surface == fdata->surface) {
+		fdata->sx = sx;
+		fdata->sy = sy;
+		fdata->found = true;
+	}
+}
+
+static struct tinywl_view *view_from_surface(struct tinywl_server *server,
+		struct wlr_surface *surface, int *sx, int *sy) {
+	/* Finds the mapped view a surface belongs to, along with the position of
+	 * the surface relative to the view. */
+	struct tinywl_view *view;
+	wl_list_for_each(view, &server->views, link) {
+		if (!view->mapped) {
+			continue;
+		}
+		struct find_surface_data fdata = { .surface = surface };
+		wlr_xdg_surface_for_each_surface(view->xdg_surface,
+				find_surface, &fdata);
+		if (fdata.found) {
+			*sx = fdata.sx;
+			*sy = fdata.sy;
+			return view;
+		}
+	}
+	return NULL;
+}
+
 static void process_cursor_move(struct tinywl_server *server, uint32_t time) {
-	/* Move the grabbed view to the new position. */
+	/* Move the grabbed view to the new position. Both the old and new
+	 * positions need to be redrawn. */
+	view_damage_whole(server->grabbed_view);
 	server->grabbed_view->x = server->cursor->x - server->grab_x;
 	server->grabbed_view->y = server->cursor->y - server->grab_y;
+	view_damage_whole(server->grabbed_view);
 }
 
 static void process_cursor_resize(struct tinywl_server *server, uint32_t time) {
@@ -400,8 +506,10 @@ static void process_cursor_resize(struct tinywl_server *server, uint32_t time) {
 
 	struct wlr_box geo_box;
 	wlr_xdg_surface_get_geometry(view->xdg_surface, &geo_box);
+	view_damage_whole(view);
 	view->x = new_left - geo_box.x;
 	view->y = new_top - geo_box.y;
+	view_damage_whole(view);
 
 	int new_width = new_right - new_left;
 	int new_height = new_bottom - new_top;
@@ -537,8 +645,21 @@ struct render_data {
 	struct wlr_renderer *renderer;
 	struct tinywl_view *view;
 	struct timespec *when;
+	/* With damage tracking, the part of the output to redraw */
+	pixman_region32_t *damage;
 };
 
+static void output_clip_region(struct wlr_output *output,
+		pixman_region32_t *clip, pixman_region32_t *region) {
+	/* Damage is in output-local coordinates, but the render clip region is in
+	 * buffer coordinates: we have to undo the output transform. */
+	int ow, oh;
+	wlr_output_transformed_resolution(output, &ow, &oh);
+	enum wl_output_transform transform =
+		wlr_output_transform_invert(output->transform);
+	wlr_region_transform(clip, region, transform, ow, oh);
+}
+
 static void render_surface(struct wlr_surface *surface,
 		int sx, int sy, void *data) {
 	/* This function is called for every surface that needs to be rendered. */
@@ -591,13 +712,106 @@ static void render_surface(struct wlr_surface *surface,
 	wlr_matrix_project_box(matrix, &box, transform, 0,
 		output->transform_matrix);
 
-	/* This takes our matrix, the texture, and an alpha, and performs the actual
-	 * rendering on the GPU. */
-	wlr_render_texture_with_matrix(rdata->renderer, texture, matrix, 1);
+	if (rdata->damage == NULL) {
+		/* This takes our matrix, the texture, and an alpha, and performs the
+		 * actual rendering on the GPU. */
+		wlr_render_texture_with_matrix(rdata->renderer, texture, matrix, 1);
+
+		/* This lets the client know that we've displayed that frame and it
+		 * can prepare another one now if it likes. */
+		wlr_surface_send_frame_done(surface, rdata->when);
+		return;
+	}
+
+	/* With damage tracking, we only draw the damaged parts of the surface:
+	 * the renderer leaves everything outside of the clip region untouched.
+	 * Frame done events are sent in send_frame_done. */
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	pixman_region32_intersect_rect(&damage, rdata->damage,
+		box.x, box.y, box.width, box.height);
+	output_clip_region(output, &damage, &damage);
+	wlr_render_texture_with_matrix_clipped(rdata->renderer, texture, matrix, 1,
+		&damage);
+	pixman_region32_fini(&damage);
+}
+
+/* Used to track which surfaces are hidden when sending frame done events. */
+struct frame_done_data {
+	struct wlr_output *output;
+	struct tinywl_view *view;
+	struct timespec *when;
+	pixman_region32_t *opaque; /* covered by the views above, layout coords */
+};
+
+static void surface_frame_done(struct wlr_surface *surface,
+		int sx, int sy, void *data) {
+	struct frame_done_data *fdata = data;
+	struct tinywl_server *server = fdata->view->server;
+	struct wlr_box box = {
+		.x = fdata->view->x + sx,
+		.y = fdata->view->y + sy,
+		.width = surface->current.width,
+		.height = surface->current.height,
+	};
+
+	/* Clients drawing frames nobody can see waste CPU and GPU time. Surfaces
+	 * which are off this output or hidden behind opaque windows don't get a
+	 * frame done event, so their clients stop drawing until they are visible
+	 * again. */
+	if (!wlr_output_layout_intersects(server->output_layout,
+			fdata->output, &box)) {
+		return;
+	}
+	pixman_box32_t box32 = {
+		.x1 = box.x,
+		.y1 = box.y,
+		.x2 = box.x + box.width,
+		.y2 = box.y + box.height,
+	};
+	if (pixman_region32_contains_rectangle(fdata->opaque, &box32) ==
+			PIXMAN_REGION_IN) {
+		return;
+	}
 
-	/* This lets the client know that we've displayed that frame and it can
-	 * prepare another one now if it likes. */
-	wlr_surface_send_frame_done(surface, rdata->when);
+	wlr_surface_send_frame_done(surface, fdata->when);
+}
+
+static void surface_add_opaque(struct wlr_surface *surface,
+		int sx, int sy, void *data) {
+	struct frame_done_data *fdata = data;
+	pixman_region32_t opaque;
+	pixman_region32_init(&opaque);
+	pixman_region32_copy(&opaque, &surface->opaque_region);
+	pixman_region32_translate(&opaque,
+		fdata->view->x + sx, fdata->view->y + sy);
+	pixman_region32_union(fdata->opaque, fdata->opaque, &opaque);
+	pixman_region32_fini(&opaque);
+}
+
+static void send_frame_done(struct tinywl_output *output,
+		struct timespec *when) {
+	pixman_region32_t opaque;
+	pixman_region32_init(&opaque);
+	/* This time we iterate front-to-back, accumulating the opaque regions of
+	 * the views we've been through. */
+	struct tinywl_view *view;
+	wl_list_for_each(view, &output->server->views, link) {
+		if (!view->mapped) {
+			continue;
+		}
+		struct frame_done_data fdata = {
+			.output = output->wlr_output,
+			.view = view,
+			.when = when,
+			.opaque = &opaque,
+		};
+		wlr_xdg_surface_for_each_surface(view->xdg_surface,
+				surface_frame_done, &fdata);
+		wlr_xdg_surface_for_each_surface(view->xdg_surface,
+				surface_add_opaque, &fdata);
+	}
+	pixman_region32_fini(&opaque);
 }
 
 static void output_frame(struct wl_listener *listener, void *data) {
@@ -657,6 +871,177 @@ static void output_frame(struct wl_listener *listener, void *data) {
 	wlr_output_commit(output->wlr_output);
 }
 
+static void output_damage_frame(struct wl_listener *listener, void *data) {
+	/* This is the damage tracking variant of output_frame. wlr_output_damage
+	 * remembers the damage of the previous frames: we only redraw what changed
+	 * since the buffer we're given was last displayed, which depends on the
+	 * buffer age. */
+	struct tinywl_output *output =
+		wl_container_of(listener, output, frame);
+	struct wlr_output *wlr_output = output->wlr_output;
+	struct wlr_renderer *renderer = output->server->renderer;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	bool needs_frame;
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	if (!wlr_output_damage_attach_render(output->damage, &needs_frame,
+			&damage)) {
+		pixman_region32_fini(&damage);
+		return;
+	}
+
+	if (!needs_frame) {
+		/* Nothing changed on screen, we don't need to submit a frame. Clients
+		 * waiting for a frame done event still get one. */
+		wlr_output_rollback(wlr_output);
+		goto frame_done;
+	}
+
+	wlr_renderer_begin(renderer, wlr_output->width, wlr_output->height);
+
+	/* Paint the damaged parts of the background. The color is opaque, so
+	 * this is the same as clearing them. */
+	float color[4] = {0.3, 0.3, 0.3, 1.0};
+	struct wlr_box output_box = {0};
+	wlr_output_transformed_resolution(wlr_output,
+		&output_box.width, &output_box.height);
+	pixman_region32_t clip;
+	pixman_region32_init(&clip);
+	output_clip_region(wlr_output, &clip, &damage);
+	wlr_render_rect_clipped(renderer, &output_box, color,
+		wlr_output->transform_matrix, &clip);
+	pixman_region32_fini(&clip);
+
+	struct tinywl_view *view;
+	wl_list_for_each_reverse(view, &output->server->views, link) {
+		if (!view->mapped) {
+			continue;
+		}
+		struct render_data rdata = {
+			.output = wlr_output,
+			.view = view,
+			.renderer = renderer,
+			.when = &now,
+			.damage = &damage,
+		};
+		wlr_xdg_surface_for_each_surface(view->xdg_surface,
+				render_surface, &rdata);
+	}
+
+	wlr_output_render_software_cursors(wlr_output, &damage);
+	wlr_renderer_end(renderer);
+
+	/* The backend wants to know which parts of the buffer changed since the
+	 * previous frame, in buffer coordinates. */
+	int width, height;
+	wlr_output_transformed_resolution(wlr_output, &width, &height);
+	pixman_region32_t frame_damage;
+	pixman_region32_init(&frame_damage);
+	enum wl_output_transform transform =
+		wlr_output_transform_invert(wlr_output->transform);
+	wlr_region_transform(&frame_damage, &output->damage->current,
+		transform, width, height);
+	wlr_output_set_damage(wlr_output, &frame_damage);
+	pixman_region32_fini(&frame_damage);
+
+	wlr_output_commit(wlr_output);
+
+frame_done:
+	send_frame_done(output, &now);
+	pixman_region32_fini(&damage);
+}
+
+static void surface_handle_commit(struct wl_listener *listener, void *data) {
+	/* With damage tracking, this is called every time a client commits a
+	 * surface. We add the parts of the surface which changed to the damage of
+	 * the outputs. */
+	struct tinywl_surface *tsurface =
+		wl_container_of(listener, tsurface, commit);
+	struct tinywl_server *server = tsurface->server;
+	struct wlr_surface *surface = tsurface->wlr_surface;
+
+	int sx, sy;
+	struct tinywl_view *view = view_from_surface(server, surface, &sx, &sy);
+	if (view == NULL) {
+		/* Not part of a mapped view, e.g. a cursor surface */
+		return;
+	}
+
+	struct wlr_box box = {
+		.x = view->x + sx,
+		.y = view->y + sy,
+		.width = surface->current.width,
+		.height = surface->current.height,
+	};
+	if (box.x != tsurface->box.x || box.y != tsurface->box.y ||
+			box.width != tsurface->box.width ||
+			box.height != tsurface->box.height) {
+		/* The surface moved or was resized, redraw both boxes */
+		damage_layout_box(server, &tsurface->box);
+		damage_layout_box(server, &box);
+		tsurface->box = box;
+	} else {
+		/* The surface damage is in surface-local coordinates */
+		pixman_region32_t damage;
+		pixman_region32_init(&damage);
+		wlr_surface_get_effective_damage(surface, &damage);
+		struct tinywl_output *output;
+		wl_list_for_each(output, &server->outputs, link) {
+			double ox = 0, oy = 0;
+			wlr_output_layout_output_coords(
+					server->output_layout, output->wlr_output, &ox, &oy);
+			pixman_region32_t output_damage;
+			pixman_region32_init(&output_damage);
+			pixman_region32_copy(&output_damage, &damage);
+			pixman_region32_translate(&output_damage, box.x + ox, box.y + oy);
+			wlr_region_scale(&output_damage, &output_damage,
+				output->wlr_output->scale);
+			wlr_output_damage_add(output->damage, &output_damage);
+			pixman_region32_fini(&output_damage);
+		}
+		pixman_region32_fini(&damage);
+	}
+
+	/* The client may only be waiting for a frame done event, without any
+	 * damage. Make sure the outputs showing the surface emit a frame. */
+	struct tinywl_output *output;
+	wl_list_for_each(output, &server->outputs, link) {
+		if (wlr_output_layout_intersects(server->output_layout,
+				output->wlr_output, &box)) {
+			wlr_output_schedule_frame(output->wlr_output);
+		}
+	}
+}
+
+static void surface_handle_destroy(struct wl_listener *listener, void *data) {
+	struct tinywl_surface *tsurface =
+		wl_container_of(listener, tsurface, destroy);
+	tsurface->wlr_surface->data = NULL;
+	wl_list_remove(&tsurface->commit.link);
+	wl_list_remove(&tsurface->destroy.link);
+	free(tsurface);
+}
+
+static void server_new_surface(struct wl_listener *listener, void *data) {
+	/* This event is raised by the compositor for each new wl_surface. We only
+	 * listen to it with damage tracking, to track the surface commits. */
+	struct tinywl_server *server =
+		wl_container_of(listener, server, new_surface);
+	struct wlr_surface *surface = data;
+
+	struct tinywl_surface *tsurface = calloc(1, sizeof(struct tinywl_surface));
+	tsurface->server = server;
+	tsurface->wlr_surface = surface;
+	surface->data = tsurface;
+	tsurface->commit.notify = surface_handle_commit;
+	wl_signal_add(&surface->events.commit, &tsurface->commit);
+	tsurface->destroy.notify = surface_handle_destroy;
+	wl_signal_add(&surface->events.destroy, &tsurface->destroy);
+}
+
 static void server_new_output(struct wl_listener *listener, void *data) {
 	/* This event is rasied by the backend when a new output (aka a display or
 	 * monitor) becomes available. */
@@ -683,9 +1068,17 @@ static void server_new_output(struct wl_listener *listener, void *data) {
 		calloc(1, sizeof(struct tinywl_output));
 	output->wlr_output = wlr_output;
 	output->server = server;
-	/* Sets up a listener for the frame notify event. */
-	output->frame.notify = output_frame;
-	wl_signal_add(&wlr_output->events.frame, &output->frame);
+	if (server->damage_tracking) {
+		/* wlr_output_damage relays the frame event of the output, and keeps
+		 * track of the damage of previous frames for us. */
+		output->damage = wlr_output_damage_create(wlr_output);
+		output->frame.notify = output_damage_frame;
+		wl_signal_add(&output->damage->events.frame, &output->frame);
+	} else {
+		/* Sets up a listener for the frame notify event. */
+		output->frame.notify = output_frame;
+		wl_signal_add(&wlr_output->events.frame, &output->frame);
+	}
 	wl_list_insert(&server->outputs, &output->link);
 
 	/* Adds this to the output layout. The add_auto function arranges outputs
@@ -704,12 +1097,14 @@ static void xdg_surface_map(struct wl_listener *listener, void *data) {
 	/* Called when the surface is mapped, or ready to display on-screen. */
 	struct tinywl_view *view = wl_container_of(listener, view, map);
 	view->mapped = true;
+	view_damage_whole(view);
 	focus_view(view, view->xdg_surface->surface);
 }
 
 static void xdg_surface_unmap(struct wl_listener *listener, void *data) {
 	/* Called when the surface is unmapped, and should no longer be shown. */
 	struct tinywl_view *view = wl_container_of(listener, view, unmap);
+	view_damage_whole(view);
 	view->mapped = false;
 }
 
@@ -816,24 +1211,29 @@ static void server_new_xdg_surface(struct wl_listener *listener, void *data) {
 int main(int argc, char *argv[]) {
 	wlr_log_init(WLR_DEBUG, NULL);
 	char *startup_cmd = NULL;
+	bool damage_tracking = false;
 
 	int c;
-	while ((c = getopt(argc, argv, "s:h")) != -1) {
+	while ((c = getopt(argc, argv, "s:dh")) != -1) {
 		switch (c) {
 		case 's':
 			startup_cmd = optarg;
 			break;
+		case 'd':
+			damage_tracking = true;
+			break;
 		default:
-			printf("Usage: %s [-s startup command]\n", argv[0]);
+			printf("Usage: %s [-s startup command] [-d]\n", argv[0]);
 			return 0;
 		}
 	}
 	if (optind < argc) {
-		printf("Usage: %s [-s startup command]\n", argv[0]);
+		printf("Usage: %s [-s startup command] [-d]\n", argv[0]);
 		return 0;
 	}
 
 	struct tinywl_server server;
+	server.damage_tracking = damage_tracking;
 	/* The Wayland display is managed by libwayland. It handles accepting
 	 * clients from the Unix socket, manging Wayland globals, and so on. */
 	server.wl_display = wl_display_create();
@@ -855,9 +1255,16 @@ int main(int argc, char *argv[]) {
 	 * to dig your fingers in and play with their behavior if you want. Note that
 	 * the clients cannot set the selection directly without compositor approval,
 	 * see the handling of the request_set_selection event below.*/
-	wlr_compositor_create(server.wl_display, server.renderer);
+	struct wlr_compositor *compositor =
+		wlr_compositor_create(server.wl_display, server.renderer);
 	wlr_data_device_manager_create(server.wl_display);
 
+	/* With damage tracking, we need to know when surfaces change. */
+	if (server.damage_tracking) {
+		server.new_surface.notify = server_new_surface;
+		wl_signal_add(&compositor->events.new_surface, &server.new_surface);
+	}
+
 	/* Creates an output layout, which a wlroots utility for working with an
 	 * arrangement of screens in a physical layout. */
 	server.output_layout = wlr_output_layout_create();
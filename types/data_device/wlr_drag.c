@@ -19,12 +19,61 @@ static void drag_handle_seat_client_destroy(struct wl_listener *listener,
 	wl_list_remove(&drag->seat_client_destroy.link);
 }
 
+static void drag_send_motion(struct wlr_drag *drag) {
+	if (drag->motion_idle == NULL) {
+		return;
+	}
+	wl_event_source_remove(drag->motion_idle);
+	drag->motion_idle = NULL;
+
+	if (drag->focus == NULL || drag->focus_client == NULL) {
+		return;
+	}
+	struct wl_resource *resource;
+	wl_resource_for_each(resource, &drag->focus_client->data_devices) {
+		wl_data_device_send_motion(resource, drag->motion_time,
+			wl_fixed_from_double(drag->motion_sx),
+			wl_fixed_from_double(drag->motion_sy));
+	}
+}
+
+static void drag_handle_motion_idle(void *data) {
+	struct wlr_drag *drag = data;
+	drag_send_motion(drag);
+}
+
+static void drag_queue_motion(struct wlr_drag *drag, uint32_t time,
+		double sx, double sy) {
+	drag->motion_time = time;
+	drag->motion_sx = sx;
+	drag->motion_sy = sy;
+	if (drag->motion_idle != NULL) {
+		return;
+	}
+
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(drag->seat->display);
+	drag->motion_idle =
+		wl_event_loop_add_idle(loop, drag_handle_motion_idle, drag);
+	if (drag->motion_idle == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add idle event source");
+		struct wl_resource *resource;
+		wl_resource_for_each(resource, &drag->focus_client->data_devices) {
+			wl_data_device_send_motion(resource, time,
+				wl_fixed_from_double(sx), wl_fixed_from_double(sy));
+		}
+	}
+}
+
 static void drag_set_focus(struct wlr_drag *drag,
 		struct wlr_surface *surface, double sx, double sy) {
 	if (drag->focus == surface) {
 		return;
 	}
 
+	// Pending motion is relative to the previous focus
+	drag_send_motion(drag);
+
 	if (drag->focus_client) {
 		wl_list_remove(&drag->seat_client_destroy.link);
 
@@ -152,6 +201,9 @@ static void drag_destroy(struct wlr_drag *drag) {
 		wl_list_remove(&drag->source_destroy.link);
 	}
 
+	if (drag->motion_idle != NULL) {
+		wl_event_source_remove(drag->motion_idle);
+	}
 	drag_icon_destroy(drag->icon);
 	free(drag);
 }
@@ -171,11 +223,7 @@ static void drag_handle_pointer_motion(struct wlr_seat_pointer_grab *grab,
 		uint32_t time, double sx, double sy) {
 	struct wlr_drag *drag = grab->data;
 	if (drag->focus != NULL && drag->focus_client != NULL) {
-		struct wl_resource *resource;
-		wl_resource_for_each(resource, &drag->focus_client->data_devices) {
-			wl_data_device_send_motion(resource, time, wl_fixed_from_double(sx),
-				wl_fixed_from_double(sy));
-		}
+		drag_queue_motion(drag, time, sx, sy);
 
 		struct wlr_drag_motion_event event = {
 			.drag = drag,
@@ -190,6 +238,7 @@ static void drag_handle_pointer_motion(struct wlr_seat_pointer_grab *grab,
 static void drag_drop(struct wlr_drag *drag, uint32_t time) {
 	assert(drag->focus_client);
 
+	drag_send_motion(drag);
 	drag->dropped = true;
 
 	struct wl_resource *resource;
@@ -277,12 +326,7 @@ static void drag_handle_touch_motion(struct wlr_seat_touch_grab *grab,
 		uint32_t time, struct wlr_touch_point *point) {
 	struct wlr_drag *drag = grab->data;
 	if (drag->focus && drag->focus_client) {
-		struct wl_resource *resource;
-		wl_resource_for_each(resource, &drag->focus_client->data_devices) {
-			wl_data_device_send_motion(resource, time,
-				wl_fixed_from_double(point->sx),
-				wl_fixed_from_double(point->sy));
-		}
+		drag_queue_motion(drag, time, point->sx, point->sy);
 	}
 }
 
@@ -0,0 +1,1210 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/backend.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_output_damage.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/log.h>
+#include <wlr/util/region.h>
+#include "render/wlr_texture.h"
+#include "util/signal.h"
+#include "util/time.h"
+
+// How long damage stays highlighted, in milliseconds
+#define HIGHLIGHT_DAMAGE_FADEOUT_TIME 250
+
+// Number of times a pixel needs to be drawn to get the last overdraw color
+#define OVERDRAW_LEVELS 4
+
+struct highlight_region {
+	pixman_region32_t region;
+	int64_t when; // in milliseconds
+	struct wl_list link; // wlr_scene_output.damage_highlight_regions
+};
+
+static struct wlr_scene *scene_root_from_node(struct wlr_scene_node *node) {
+	assert(node->type == WLR_SCENE_NODE_ROOT);
+	return (struct wlr_scene *)node;
+}
+
+struct wlr_scene_surface *wlr_scene_surface_from_node(
+		struct wlr_scene_node *node) {
+	assert(node->type == WLR_SCENE_NODE_SURFACE);
+	return (struct wlr_scene_surface *)node;
+}
+
+static struct wlr_scene_rect *scene_rect_from_node(
+		struct wlr_scene_node *node) {
+	assert(node->type == WLR_SCENE_NODE_RECT);
+	return (struct wlr_scene_rect *)node;
+}
+
+static struct wlr_scene_buffer *scene_buffer_from_node(
+		struct wlr_scene_node *node) {
+	assert(node->type == WLR_SCENE_NODE_BUFFER);
+	return (struct wlr_scene_buffer *)node;
+}
+
+static struct wlr_scene *scene_node_get_root(struct wlr_scene_node *node) {
+	while (node->parent != NULL) {
+		node = node->parent;
+	}
+	return scene_root_from_node(node);
+}
+
+static void scene_node_state_init(struct wlr_scene_node_state *state) {
+	wl_list_init(&state->children);
+	wl_list_init(&state->link);
+	state->enabled = true;
+}
+
+static void scene_node_state_finish(struct wlr_scene_node_state *state) {
+	wl_list_remove(&state->link);
+}
+
+static void scene_node_init(struct wlr_scene_node *node,
+		enum wlr_scene_node_type type, struct wlr_scene_node *parent) {
+	assert(type == WLR_SCENE_NODE_ROOT || parent != NULL);
+
+	memset(node, 0, sizeof(*node));
+	node->type = type;
+	node->parent = parent;
+	scene_node_state_init(&node->state);
+	wl_signal_init(&node->events.destroy);
+
+	if (parent != NULL) {
+		wl_list_insert(parent->state.children.prev, &node->state.link);
+	}
+}
+
+static void scene_node_damage_whole(struct wlr_scene_node *node);
+
+static void scene_node_finish(struct wlr_scene_node *node) {
+	wlr_signal_emit_safe(&node->events.destroy, NULL);
+
+	struct wlr_scene_node *child, *child_tmp;
+	wl_list_for_each_safe(child, child_tmp,
+			&node->state.children, state.link) {
+		scene_node_finish(child);
+	}
+
+	scene_node_state_finish(&node->state);
+
+	switch (node->type) {
+	case WLR_SCENE_NODE_ROOT:;
+		struct wlr_scene *scene = scene_root_from_node(node);
+		struct wlr_scene_output *scene_output, *scene_output_tmp;
+		wl_list_for_each_safe(scene_output, scene_output_tmp,
+				&scene->outputs, link) {
+			wlr_scene_output_destroy(scene_output);
+		}
+		free(scene);
+		break;
+	case WLR_SCENE_NODE_TREE:
+		free(node);
+		break;
+	case WLR_SCENE_NODE_SURFACE:;
+		struct wlr_scene_surface *scene_surface =
+			wlr_scene_surface_from_node(node);
+		wl_list_remove(&scene_surface->surface_commit.link);
+		wl_list_remove(&scene_surface->surface_destroy.link);
+		free(scene_surface);
+		break;
+	case WLR_SCENE_NODE_RECT:
+		free(scene_rect_from_node(node));
+		break;
+	case WLR_SCENE_NODE_BUFFER:;
+		struct wlr_scene_buffer *scene_buffer = scene_buffer_from_node(node);
+		wlr_texture_destroy(scene_buffer->texture);
+		wlr_buffer_unlock(scene_buffer->buffer);
+		free(scene_buffer);
+		break;
+	}
+}
+
+void wlr_scene_node_destroy(struct wlr_scene_node *node) {
+	if (node == NULL) {
+		return;
+	}
+
+	if (node->type != WLR_SCENE_NODE_ROOT) {
+		scene_node_damage_whole(node);
+	}
+	scene_node_finish(node);
+}
+
+struct wlr_scene *wlr_scene_create(void) {
+	struct wlr_scene *scene = calloc(1, sizeof(struct wlr_scene));
+	if (scene == NULL) {
+		return NULL;
+	}
+	scene_node_init(&scene->node, WLR_SCENE_NODE_ROOT, NULL);
+	wl_list_init(&scene->outputs);
+
+	const char *debug_damage = getenv("WLR_SCENE_DEBUG_DAMAGE");
+	if (debug_damage == NULL || strcmp(debug_damage, "none") == 0) {
+		scene->debug_damage_option = WLR_SCENE_DEBUG_DAMAGE_NONE;
+	} else if (strcmp(debug_damage, "rerender") == 0) {
+		scene->debug_damage_option = WLR_SCENE_DEBUG_DAMAGE_RERENDER;
+	} else if (strcmp(debug_damage, "highlight") == 0) {
+		scene->debug_damage_option = WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT;
+	} else if (strcmp(debug_damage, "overdraw") == 0) {
+		scene->debug_damage_option = WLR_SCENE_DEBUG_DAMAGE_OVERDRAW;
+	} else {
+		wlr_log(WLR_ERROR, "Unknown WLR_SCENE_DEBUG_DAMAGE option: %s",
+			debug_damage);
+	}
+	if (scene->debug_damage_option != WLR_SCENE_DEBUG_DAMAGE_NONE) {
+		wlr_log(WLR_INFO, "Scene damage debugging enabled (%s)", debug_damage);
+	}
+
+	return scene;
+}
+
+struct wlr_scene_tree *wlr_scene_tree_create(struct wlr_scene_node *parent) {
+	struct wlr_scene_tree *tree = calloc(1, sizeof(struct wlr_scene_tree));
+	if (tree == NULL) {
+		return NULL;
+	}
+	scene_node_init(&tree->node, WLR_SCENE_NODE_TREE, parent);
+	return tree;
+}
+
+static void scale_box(struct wlr_box *box, float scale) {
+	box->width = round((box->x + box->width) * scale) - round(box->x * scale);
+	box->x = round(box->x * scale);
+	box->height = round((box->y + box->height) * scale) - round(box->y * scale);
+	box->y = round(box->y * scale);
+}
+
+static void scene_output_get_box(struct wlr_scene_output *scene_output,
+		struct wlr_box *box) {
+	box->x = scene_output->x;
+	box->y = scene_output->y;
+	wlr_output_effective_resolution(scene_output->output,
+		&box->width, &box->height);
+}
+
+static void scene_surface_handle_surface_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_scene_surface *scene_surface =
+		wl_container_of(listener, scene_surface, surface_destroy);
+	wlr_scene_node_destroy(&scene_surface->node);
+}
+
+static void scene_surface_handle_surface_commit(struct wl_listener *listener,
+		void *data) {
+	struct wlr_scene_surface *scene_surface =
+		wl_container_of(listener, scene_surface, surface_commit);
+	struct wlr_surface *surface = scene_surface->surface;
+	struct wlr_scene *scene = scene_node_get_root(&scene_surface->node);
+
+	int lx, ly;
+	if (!wlr_scene_node_coords(&scene_surface->node, &lx, &ly)) {
+		return;
+	}
+
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	wlr_surface_get_effective_damage(surface, &damage);
+
+	// The effective damage includes the previous surface bounds on resize
+	struct wlr_box surface_box = {
+		.x = lx,
+		.y = ly,
+		.width = surface->current.width,
+		.height = surface->current.height,
+	};
+	if (surface->previous.width > surface_box.width) {
+		surface_box.width = surface->previous.width;
+	}
+	if (surface->previous.height > surface_box.height) {
+		surface_box.height = surface->previous.height;
+	}
+
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		struct wlr_box output_box, intersection;
+		scene_output_get_box(scene_output, &output_box);
+		if (!wlr_box_intersection(&intersection, &surface_box, &output_box)) {
+			continue;
+		}
+
+		if (!pixman_region32_not_empty(&damage)) {
+			// The surface may still be waiting for a frame callback
+			if (!wl_list_empty(&surface->current.frame_callback_list)) {
+				wlr_output_schedule_frame(scene_output->output);
+			}
+			continue;
+		}
+
+		pixman_region32_t output_damage;
+		pixman_region32_init(&output_damage);
+		pixman_region32_copy(&output_damage, &damage);
+		pixman_region32_translate(&output_damage,
+			lx - scene_output->x, ly - scene_output->y);
+		wlr_region_scale(&output_damage, &output_damage,
+			scene_output->output->scale);
+		wlr_output_damage_add(scene_output->damage, &output_damage);
+		pixman_region32_fini(&output_damage);
+	}
+
+	pixman_region32_fini(&damage);
+}
+
+struct wlr_scene_surface *wlr_scene_surface_create(struct wlr_scene_node *parent,
+		struct wlr_surface *surface) {
+	struct wlr_scene_surface *scene_surface =
+		calloc(1, sizeof(struct wlr_scene_surface));
+	if (scene_surface == NULL) {
+		return NULL;
+	}
+	scene_node_init(&scene_surface->node, WLR_SCENE_NODE_SURFACE, parent);
+
+	scene_surface->surface = surface;
+
+	scene_surface->surface_destroy.notify = scene_surface_handle_surface_destroy;
+	wl_signal_add(&surface->events.destroy, &scene_surface->surface_destroy);
+
+	scene_surface->surface_commit.notify = scene_surface_handle_surface_commit;
+	wl_signal_add(&surface->events.commit, &scene_surface->surface_commit);
+
+	scene_node_damage_whole(&scene_surface->node);
+
+	return scene_surface;
+}
+
+struct wlr_scene_rect *wlr_scene_rect_create(struct wlr_scene_node *parent,
+		int width, int height, const float color[static 4]) {
+	struct wlr_scene_rect *scene_rect =
+		calloc(1, sizeof(struct wlr_scene_rect));
+	if (scene_rect == NULL) {
+		return NULL;
+	}
+	scene_node_init(&scene_rect->node, WLR_SCENE_NODE_RECT, parent);
+
+	scene_rect->width = width;
+	scene_rect->height = height;
+	memcpy(scene_rect->color, color, sizeof(scene_rect->color));
+
+	scene_node_damage_whole(&scene_rect->node);
+
+	return scene_rect;
+}
+
+void wlr_scene_rect_set_size(struct wlr_scene_rect *rect, int width, int height) {
+	if (rect->width == width && rect->height == height) {
+		return;
+	}
+
+	scene_node_damage_whole(&rect->node);
+	rect->width = width;
+	rect->height = height;
+	scene_node_damage_whole(&rect->node);
+}
+
+void wlr_scene_rect_set_color(struct wlr_scene_rect *rect, const float color[static 4]) {
+	if (memcmp(rect->color, color, sizeof(rect->color)) == 0) {
+		return;
+	}
+
+	memcpy(rect->color, color, sizeof(rect->color));
+	scene_node_damage_whole(&rect->node);
+}
+
+struct wlr_scene_buffer *wlr_scene_buffer_create(struct wlr_scene_node *parent,
+		struct wlr_buffer *buffer) {
+	struct wlr_scene_buffer *scene_buffer =
+		calloc(1, sizeof(struct wlr_scene_buffer));
+	if (scene_buffer == NULL) {
+		return NULL;
+	}
+	scene_node_init(&scene_buffer->node, WLR_SCENE_NODE_BUFFER, parent);
+
+	scene_buffer->buffer = wlr_buffer_lock(buffer);
+
+	scene_node_damage_whole(&scene_buffer->node);
+
+	return scene_buffer;
+}
+
+static struct wlr_texture *scene_buffer_get_texture(
+		struct wlr_scene_buffer *scene_buffer, struct wlr_renderer *renderer) {
+	if (scene_buffer->texture != NULL &&
+			scene_buffer->texture_renderer == renderer) {
+		return scene_buffer->texture;
+	}
+
+	wlr_texture_destroy(scene_buffer->texture);
+	scene_buffer->texture =
+		wlr_texture_from_buffer(renderer, scene_buffer->buffer);
+	scene_buffer->texture_renderer = renderer;
+	return scene_buffer->texture;
+}
+
+static void scene_node_get_size(struct wlr_scene_node *node,
+		int *width, int *height) {
+	*width = 0;
+	*height = 0;
+
+	switch (node->type) {
+	case WLR_SCENE_NODE_ROOT:
+	case WLR_SCENE_NODE_TREE:
+		return;
+	case WLR_SCENE_NODE_SURFACE:;
+		struct wlr_scene_surface *scene_surface =
+			wlr_scene_surface_from_node(node);
+		*width = scene_surface->surface->current.width;
+		*height = scene_surface->surface->current.height;
+		break;
+	case WLR_SCENE_NODE_RECT:;
+		struct wlr_scene_rect *scene_rect = scene_rect_from_node(node);
+		*width = scene_rect->width;
+		*height = scene_rect->height;
+		break;
+	case WLR_SCENE_NODE_BUFFER:;
+		struct wlr_scene_buffer *scene_buffer = scene_buffer_from_node(node);
+		*width = scene_buffer->buffer->width;
+		*height = scene_buffer->buffer->height;
+		break;
+	}
+}
+
+static void _scene_node_damage_whole(struct wlr_scene_node *node,
+		struct wlr_scene *scene, int lx, int ly) {
+	if (!node->state.enabled) {
+		return;
+	}
+
+	struct wlr_scene_node *child;
+	wl_list_for_each(child, &node->state.children, state.link) {
+		_scene_node_damage_whole(child, scene,
+			lx + child->state.x, ly + child->state.y);
+	}
+
+	int width, height;
+	scene_node_get_size(node, &width, &height);
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		struct wlr_box box = {
+			.x = lx - scene_output->x,
+			.y = ly - scene_output->y,
+			.width = width,
+			.height = height,
+		};
+		scale_box(&box, scene_output->output->scale);
+		wlr_output_damage_add_box(scene_output->damage, &box);
+	}
+}
+
+static void scene_node_damage_whole(struct wlr_scene_node *node) {
+	struct wlr_scene *scene = scene_node_get_root(node);
+	if (wl_list_empty(&scene->outputs)) {
+		return;
+	}
+
+	int lx, ly;
+	if (!wlr_scene_node_coords(node, &lx, &ly)) {
+		return;
+	}
+
+	_scene_node_damage_whole(node, scene, lx, ly);
+}
+
+void wlr_scene_node_set_enabled(struct wlr_scene_node *node, bool enabled) {
+	if (node->state.enabled == enabled) {
+		return;
+	}
+
+	// One of these damage_whole() calls will short-circuit and be a no-op
+	scene_node_damage_whole(node);
+	node->state.enabled = enabled;
+	scene_node_damage_whole(node);
+}
+
+void wlr_scene_node_set_position(struct wlr_scene_node *node, int x, int y) {
+	if (node->state.x == x && node->state.y == y) {
+		return;
+	}
+
+	scene_node_damage_whole(node);
+	node->state.x = x;
+	node->state.y = y;
+	scene_node_damage_whole(node);
+}
+
+void wlr_scene_node_place_above(struct wlr_scene_node *node,
+		struct wlr_scene_node *sibling) {
+	assert(node != sibling);
+	assert(node->parent == sibling->parent);
+
+	if (node->state.link.prev == &sibling->state.link) {
+		return;
+	}
+
+	wl_list_remove(&node->state.link);
+	wl_list_insert(&sibling->state.link, &node->state.link);
+
+	scene_node_damage_whole(node);
+	scene_node_damage_whole(sibling);
+}
+
+void wlr_scene_node_place_below(struct wlr_scene_node *node,
+		struct wlr_scene_node *sibling) {
+	assert(node != sibling);
+	assert(node->parent == sibling->parent);
+
+	if (node->state.link.next == &sibling->state.link) {
+		return;
+	}
+
+	wl_list_remove(&node->state.link);
+	wl_list_insert(sibling->state.link.prev, &node->state.link);
+
+	scene_node_damage_whole(node);
+	scene_node_damage_whole(sibling);
+}
+
+void wlr_scene_node_raise_to_top(struct wlr_scene_node *node) {
+	struct wlr_scene_node *current_top = wl_container_of(
+		node->parent->state.children.prev, current_top, state.link);
+	if (node == current_top) {
+		return;
+	}
+	wlr_scene_node_place_above(node, current_top);
+}
+
+void wlr_scene_node_lower_to_bottom(struct wlr_scene_node *node) {
+	struct wlr_scene_node *current_bottom = wl_container_of(
+		node->parent->state.children.next, current_bottom, state.link);
+	if (node == current_bottom) {
+		return;
+	}
+	wlr_scene_node_place_below(node, current_bottom);
+}
+
+void wlr_scene_node_reparent(struct wlr_scene_node *node,
+		struct wlr_scene_node *new_parent) {
+	assert(node->type != WLR_SCENE_NODE_ROOT && new_parent != NULL);
+
+	if (node->parent == new_parent) {
+		return;
+	}
+
+	// Ensure that a node cannot become its own ancestor
+	for (struct wlr_scene_node *ancestor = new_parent; ancestor != NULL;
+			ancestor = ancestor->parent) {
+		assert(ancestor != node);
+	}
+
+	scene_node_damage_whole(node);
+
+	wl_list_remove(&node->state.link);
+	node->parent = new_parent;
+	wl_list_insert(new_parent->state.children.prev, &node->state.link);
+
+	scene_node_damage_whole(node);
+}
+
+bool wlr_scene_node_coords(struct wlr_scene_node *node,
+		int *lx_ptr, int *ly_ptr) {
+	int lx = 0, ly = 0;
+	bool enabled = true;
+	while (node != NULL) {
+		lx += node->state.x;
+		ly += node->state.y;
+		enabled = enabled && node->state.enabled;
+		node = node->parent;
+	}
+
+	*lx_ptr = lx;
+	*ly_ptr = ly;
+	return enabled;
+}
+
+static void scene_node_for_each_surface(struct wlr_scene_node *node,
+		int lx, int ly, wlr_surface_iterator_func_t user_iterator,
+		void *user_data) {
+	if (!node->state.enabled) {
+		return;
+	}
+
+	lx += node->state.x;
+	ly += node->state.y;
+
+	if (node->type == WLR_SCENE_NODE_SURFACE) {
+		struct wlr_scene_surface *scene_surface =
+			wlr_scene_surface_from_node(node);
+		user_iterator(scene_surface->surface, lx, ly, user_data);
+	}
+
+	struct wlr_scene_node *child;
+	wl_list_for_each(child, &node->state.children, state.link) {
+		scene_node_for_each_surface(child, lx, ly, user_iterator, user_data);
+	}
+}
+
+void wlr_scene_node_for_each_surface(struct wlr_scene_node *node,
+		wlr_surface_iterator_func_t user_iterator, void *user_data) {
+	int lx = 0, ly = 0;
+	if (node->parent != NULL) {
+		wlr_scene_node_coords(node->parent, &lx, &ly);
+	}
+	scene_node_for_each_surface(node, lx, ly, user_iterator, user_data);
+}
+
+struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
+		double lx, double ly, double *nx, double *ny) {
+	if (!node->state.enabled) {
+		return NULL;
+	}
+
+	lx -= node->state.x;
+	ly -= node->state.y;
+
+	struct wlr_scene_node *child;
+	wl_list_for_each_reverse(child, &node->state.children, state.link) {
+		struct wlr_scene_node *found =
+			wlr_scene_node_at(child, lx, ly, nx, ny);
+		if (found != NULL) {
+			return found;
+		}
+	}
+
+	bool hit = false;
+	switch (node->type) {
+	case WLR_SCENE_NODE_ROOT:
+	case WLR_SCENE_NODE_TREE:
+		break;
+	case WLR_SCENE_NODE_SURFACE:;
+		struct wlr_scene_surface *scene_surface =
+			wlr_scene_surface_from_node(node);
+		hit = wlr_surface_point_accepts_input(scene_surface->surface, lx, ly);
+		break;
+	case WLR_SCENE_NODE_RECT:
+	case WLR_SCENE_NODE_BUFFER:;
+		int width, height;
+		scene_node_get_size(node, &width, &height);
+		hit = lx >= 0 && lx < width && ly >= 0 && ly < height;
+		break;
+	}
+
+	if (!hit) {
+		return NULL;
+	}
+	if (nx != NULL) {
+		*nx = lx;
+	}
+	if (ny != NULL) {
+		*ny = ly;
+	}
+	return node;
+}
+
+struct render_entry {
+	struct wlr_scene_node *node;
+	// Position and size in output-buffer-local coordinates, before the
+	// output transform is applied
+	struct wlr_box box;
+	// Part of the node which needs to be painted
+	pixman_region32_t visible;
+};
+
+static void scene_node_collect(struct wlr_scene_node *node, int x, int y,
+		struct wlr_output *output, struct wl_array *entries) {
+	if (!node->state.enabled) {
+		return;
+	}
+
+	x += node->state.x;
+	y += node->state.y;
+
+	int width, height;
+	scene_node_get_size(node, &width, &height);
+	if (width > 0 && height > 0) {
+		struct wlr_box box = {
+			.x = x,
+			.y = y,
+			.width = width,
+			.height = height,
+		};
+		scale_box(&box, output->scale);
+
+		int output_width, output_height;
+		wlr_output_transformed_resolution(output,
+			&output_width, &output_height);
+		struct wlr_box output_box = {
+			.width = output_width,
+			.height = output_height,
+		};
+		struct wlr_box intersection;
+		if (wlr_box_intersection(&intersection, &box, &output_box)) {
+			struct render_entry *entry =
+				wl_array_add(entries, sizeof(*entry));
+			if (entry != NULL) {
+				entry->node = node;
+				entry->box = box;
+			}
+		}
+	}
+
+	struct wlr_scene_node *child;
+	wl_list_for_each(child, &node->state.children, state.link) {
+		scene_node_collect(child, x, y, output, entries);
+	}
+}
+
+/**
+ * Get the part of the node which is opaque, in output-buffer-local
+ * coordinates before the output transform is applied.
+ */
+static void scene_node_opaque_region(struct render_entry *entry,
+		struct wlr_output *output, pixman_region32_t *opaque) {
+	struct wlr_scene_node *node = entry->node;
+	struct wlr_box *box = &entry->box;
+
+	switch (node->type) {
+	case WLR_SCENE_NODE_ROOT:
+	case WLR_SCENE_NODE_TREE:
+		break;
+	case WLR_SCENE_NODE_SURFACE:;
+		struct wlr_surface *surface = wlr_scene_surface_from_node(node)->surface;
+		if (wlr_surface_get_texture(surface) == NULL) {
+			break;
+		}
+		wlr_surface_get_output_opaque_region(surface, box->x, box->y,
+			output->scale, opaque);
+		break;
+	case WLR_SCENE_NODE_RECT:;
+		struct wlr_scene_rect *scene_rect = scene_rect_from_node(node);
+		if (scene_rect->color[3] >= 1.0) {
+			pixman_region32_union_rect(opaque, opaque,
+				box->x, box->y, box->width, box->height);
+		}
+		break;
+	case WLR_SCENE_NODE_BUFFER:;
+		struct wlr_scene_buffer *scene_buffer = scene_buffer_from_node(node);
+		if (scene_buffer->texture != NULL &&
+				wlr_texture_is_opaque(scene_buffer->texture)) {
+			pixman_region32_union_rect(opaque, opaque,
+				box->x, box->y, box->width, box->height);
+		}
+		break;
+	}
+}
+
+static void scissor_output(struct wlr_output *output, pixman_box32_t *rect) {
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	assert(renderer);
+
+	struct wlr_box box = {
+		.x = rect->x1,
+		.y = rect->y1,
+		.width = rect->x2 - rect->x1,
+		.height = rect->y2 - rect->y1,
+	};
+
+	int ow, oh;
+	wlr_output_transformed_resolution(output, &ow, &oh);
+
+	enum wl_output_transform transform =
+		wlr_output_transform_invert(output->transform);
+	wlr_box_transform(&box, &box, transform, ow, oh);
+
+	wlr_renderer_scissor(renderer, &box);
+}
+
+/**
+ * Convert a region from output-local coordinates to buffer coordinates, to be
+ * used as a render clip region.
+ */
+static void output_clip_region(struct wlr_output *output,
+		pixman_region32_t *clip, pixman_region32_t *region) {
+	int ow, oh;
+	wlr_output_transformed_resolution(output, &ow, &oh);
+
+	enum wl_output_transform transform =
+		wlr_output_transform_invert(output->transform);
+	wlr_region_transform(clip, region, transform, ow, oh);
+}
+
+static void render_texture(struct wlr_output *output,
+		pixman_region32_t *visible, struct wlr_texture *texture,
+		const struct wlr_fbox *src_box, const float matrix[static 9]) {
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+
+	pixman_region32_t clip;
+	pixman_region32_init(&clip);
+	output_clip_region(output, &clip, visible);
+	wlr_render_subtexture_with_matrix_clipped(renderer, texture, src_box,
+		matrix, 1.0, &clip);
+	pixman_region32_fini(&clip);
+}
+
+/**
+ * Blend a color over the region. The color is premultiplied.
+ */
+static void render_tint(struct wlr_output *output, pixman_region32_t *region,
+		const float color[static 4]) {
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+
+	pixman_box32_t *extents = pixman_region32_extents(region);
+	struct wlr_box box = {
+		.x = extents->x1,
+		.y = extents->y1,
+		.width = extents->x2 - extents->x1,
+		.height = extents->y2 - extents->y1,
+	};
+
+	pixman_region32_t clip;
+	pixman_region32_init(&clip);
+	output_clip_region(output, &clip, region);
+	wlr_render_rect_clipped(renderer, &box, color, output->transform_matrix,
+		&clip);
+	pixman_region32_fini(&clip);
+}
+
+/**
+ * Account for a region being drawn once more. levels[i] is the region drawn
+ * more than i times.
+ */
+static void overdraw_add(pixman_region32_t levels[static OVERDRAW_LEVELS],
+		pixman_region32_t *drawn) {
+	pixman_region32_t more;
+	pixman_region32_init(&more);
+	for (size_t i = OVERDRAW_LEVELS - 1; i > 0; i--) {
+		pixman_region32_intersect(&more, &levels[i - 1], drawn);
+		pixman_region32_union(&levels[i], &levels[i], &more);
+	}
+	pixman_region32_fini(&more);
+	pixman_region32_union(&levels[0], &levels[0], drawn);
+}
+
+static void overdraw_render(struct wlr_output *output,
+		pixman_region32_t levels[static OVERDRAW_LEVELS]) {
+	// Blue, green, pink then red, like Android's overdraw debugging
+	static const float colors[OVERDRAW_LEVELS][4] = {
+		{ 0.0, 0.0, 0.4, 0.4 },
+		{ 0.0, 0.4, 0.0, 0.4 },
+		{ 0.4, 0.2, 0.3, 0.4 },
+		{ 0.4, 0.0, 0.0, 0.4 },
+	};
+
+	pixman_region32_t exact;
+	pixman_region32_init(&exact);
+	for (size_t i = 0; i < OVERDRAW_LEVELS; i++) {
+		if (i + 1 < OVERDRAW_LEVELS) {
+			pixman_region32_subtract(&exact, &levels[i], &levels[i + 1]);
+		} else {
+			pixman_region32_copy(&exact, &levels[i]);
+		}
+		render_tint(output, &exact, colors[i]);
+	}
+	pixman_region32_fini(&exact);
+}
+
+static void render_entry(struct render_entry *entry,
+		struct wlr_output *output) {
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	struct wlr_scene_node *node = entry->node;
+	struct wlr_box *box = &entry->box;
+
+	float matrix[9];
+	enum wl_output_transform transform;
+	struct wlr_texture *texture;
+	switch (node->type) {
+	case WLR_SCENE_NODE_ROOT:
+	case WLR_SCENE_NODE_TREE:
+		break;
+	case WLR_SCENE_NODE_SURFACE:;
+		struct wlr_surface *surface = wlr_scene_surface_from_node(node)->surface;
+		texture = wlr_surface_get_texture(surface);
+		if (texture == NULL) {
+			break;
+		}
+
+		struct wlr_fbox src_box;
+		wlr_surface_get_buffer_source_box(surface, &src_box);
+
+		transform = wlr_output_transform_invert(surface->current.transform);
+		wlr_matrix_project_box(matrix, box, transform, 0.0,
+			output->transform_matrix);
+
+		render_texture(output, &entry->visible, texture, &src_box, matrix);
+		break;
+	case WLR_SCENE_NODE_RECT:;
+		struct wlr_scene_rect *scene_rect = scene_rect_from_node(node);
+
+		pixman_region32_t clip;
+		pixman_region32_init(&clip);
+		output_clip_region(output, &clip, &entry->visible);
+		wlr_render_rect_clipped(renderer, box, scene_rect->color,
+			output->transform_matrix, &clip);
+		pixman_region32_fini(&clip);
+		break;
+	case WLR_SCENE_NODE_BUFFER:;
+		struct wlr_scene_buffer *scene_buffer = scene_buffer_from_node(node);
+		texture = scene_buffer->texture;
+		if (texture == NULL) {
+			break;
+		}
+
+		struct wlr_fbox full_box = {
+			.width = texture->width,
+			.height = texture->height,
+		};
+		wlr_matrix_project_box(matrix, box, WL_OUTPUT_TRANSFORM_NORMAL, 0.0,
+			output->transform_matrix);
+
+		render_texture(output, &entry->visible, texture, &full_box, matrix);
+		break;
+	}
+}
+
+void wlr_scene_render_output(struct wlr_scene *scene, struct wlr_output *output,
+		int lx, int ly, pixman_region32_t *damage) {
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	assert(renderer);
+
+	int width, height;
+	wlr_output_transformed_resolution(output, &width, &height);
+
+	pixman_region32_t full_region;
+	pixman_region32_init_rect(&full_region, 0, 0, width, height);
+	if (damage == NULL) {
+		damage = &full_region;
+	}
+
+	struct wl_array entries;
+	wl_array_init(&entries);
+	scene_node_collect(&scene->node, -lx, -ly, output, &entries);
+
+	// Walk the nodes from top to bottom, and compute the part of each node
+	// which isn't covered by the opaque nodes above it
+	pixman_region32_t covered, opaque;
+	pixman_region32_init(&covered);
+	pixman_region32_init(&opaque);
+	size_t entries_len = entries.size / sizeof(struct render_entry);
+	struct render_entry *entries_data = entries.data;
+	for (size_t i = entries_len; i-- > 0;) {
+		struct render_entry *entry = &entries_data[i];
+		if (entry->node->type == WLR_SCENE_NODE_BUFFER) {
+			scene_buffer_get_texture(scene_buffer_from_node(entry->node),
+				renderer);
+		}
+
+		pixman_region32_init_rect(&entry->visible, entry->box.x, entry->box.y,
+			entry->box.width, entry->box.height);
+		pixman_region32_intersect(&entry->visible, &entry->visible, damage);
+		pixman_region32_subtract(&entry->visible, &entry->visible, &covered);
+
+		pixman_region32_clear(&opaque);
+		scene_node_opaque_region(entry, output, &opaque);
+		pixman_region32_union(&covered, &covered, &opaque);
+	}
+	pixman_region32_fini(&opaque);
+
+	// Clear what isn't covered by opaque nodes, then paint from bottom to top
+	pixman_region32_t background;
+	pixman_region32_init(&background);
+	pixman_region32_subtract(&background, damage, &covered);
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&background, &nrects);
+	for (int i = 0; i < nrects; ++i) {
+		scissor_output(output, &rects[i]);
+		wlr_renderer_clear(renderer, (float[4]){ 0.0, 0.0, 0.0, 1.0 });
+	}
+	wlr_renderer_scissor(renderer, NULL);
+
+	bool overdraw =
+		scene->debug_damage_option == WLR_SCENE_DEBUG_DAMAGE_OVERDRAW;
+	pixman_region32_t overdraw_levels[OVERDRAW_LEVELS];
+	if (overdraw) {
+		for (size_t i = 0; i < OVERDRAW_LEVELS; i++) {
+			pixman_region32_init(&overdraw_levels[i]);
+		}
+		overdraw_add(overdraw_levels, &background);
+	}
+	pixman_region32_fini(&background);
+	pixman_region32_fini(&covered);
+
+	for (size_t i = 0; i < entries_len; i++) {
+		struct render_entry *entry = &entries_data[i];
+		if (pixman_region32_not_empty(&entry->visible)) {
+			render_entry(entry, output);
+			if (overdraw) {
+				overdraw_add(overdraw_levels, &entry->visible);
+			}
+		}
+		pixman_region32_fini(&entry->visible);
+	}
+
+	if (overdraw) {
+		overdraw_render(output, overdraw_levels);
+		for (size_t i = 0; i < OVERDRAW_LEVELS; i++) {
+			pixman_region32_fini(&overdraw_levels[i]);
+		}
+	}
+
+	wlr_renderer_scissor(renderer, NULL);
+
+	wl_array_release(&entries);
+	pixman_region32_fini(&full_region);
+}
+
+static void highlight_region_destroy(struct highlight_region *highlight) {
+	wl_list_remove(&highlight->link);
+	pixman_region32_fini(&highlight->region);
+	free(highlight);
+}
+
+static void scene_output_handle_damage_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_scene_output *scene_output =
+		wl_container_of(listener, scene_output, damage_destroy);
+	scene_output->damage = NULL;
+	wlr_scene_output_destroy(scene_output);
+}
+
+struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
+		struct wlr_output *output) {
+	assert(wlr_scene_get_scene_output(scene, output) == NULL);
+
+	struct wlr_scene_output *scene_output = calloc(1, sizeof(*scene_output));
+	if (scene_output == NULL) {
+		return NULL;
+	}
+
+	scene_output->damage = wlr_output_damage_create(output);
+	if (scene_output->damage == NULL) {
+		free(scene_output);
+		return NULL;
+	}
+
+	scene_output->output = output;
+	scene_output->scene = scene;
+	wl_list_init(&scene_output->damage_highlight_regions);
+	pixman_region32_init(&scene_output->highlight_damage);
+	wl_list_insert(&scene->outputs, &scene_output->link);
+
+	scene_output->damage_destroy.notify = scene_output_handle_damage_destroy;
+	wl_signal_add(&scene_output->damage->events.destroy,
+		&scene_output->damage_destroy);
+
+	wlr_output_damage_add_whole(scene_output->damage);
+
+	return scene_output;
+}
+
+void wlr_scene_output_destroy(struct wlr_scene_output *scene_output) {
+	if (scene_output == NULL) {
+		return;
+	}
+
+	struct highlight_region *highlight, *highlight_tmp;
+	wl_list_for_each_safe(highlight, highlight_tmp,
+			&scene_output->damage_highlight_regions, link) {
+		highlight_region_destroy(highlight);
+	}
+	pixman_region32_fini(&scene_output->highlight_damage);
+
+	wl_list_remove(&scene_output->link);
+	wl_list_remove(&scene_output->damage_destroy.link);
+	wlr_output_damage_destroy(scene_output->damage);
+	free(scene_output);
+}
+
+struct wlr_scene_output *wlr_scene_get_scene_output(struct wlr_scene *scene,
+		struct wlr_output *output) {
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		if (scene_output->output == output) {
+			return scene_output;
+		}
+	}
+	return NULL;
+}
+
+void wlr_scene_output_set_position(struct wlr_scene_output *scene_output,
+		int lx, int ly) {
+	if (scene_output->x == lx && scene_output->y == ly) {
+		return;
+	}
+
+	scene_output->x = lx;
+	scene_output->y = ly;
+	wlr_output_damage_add_whole(scene_output->damage);
+}
+
+/**
+ * Record the damage of the frame about to be rendered as a new highlight, and
+ * drop the highlights which have faded out.
+ */
+static void scene_output_update_highlights(
+		struct wlr_scene_output *scene_output, pixman_region32_t *damage,
+		int64_t now) {
+	// Don't highlight the damage added to repaint the previous highlights
+	pixman_region32_t new_damage;
+	pixman_region32_init(&new_damage);
+	pixman_region32_subtract(&new_damage, damage,
+		&scene_output->highlight_damage);
+	if (pixman_region32_not_empty(&new_damage)) {
+		struct highlight_region *highlight = calloc(1, sizeof(*highlight));
+		if (highlight != NULL) {
+			pixman_region32_init(&highlight->region);
+			pixman_region32_copy(&highlight->region, &new_damage);
+			highlight->when = now;
+			wl_list_insert(&scene_output->damage_highlight_regions,
+				&highlight->link);
+		}
+	}
+	pixman_region32_fini(&new_damage);
+
+	struct highlight_region *highlight, *tmp;
+	wl_list_for_each_safe(highlight, tmp,
+			&scene_output->damage_highlight_regions, link) {
+		if (now - highlight->when >= HIGHLIGHT_DAMAGE_FADEOUT_TIME) {
+			highlight_region_destroy(highlight);
+		}
+	}
+}
+
+static void scene_output_render_highlights(
+		struct wlr_scene_output *scene_output, int64_t now) {
+	struct wlr_output *output = scene_output->output;
+
+	// Oldest first, so that recent damage is drawn on top
+	struct highlight_region *highlight;
+	wl_list_for_each_reverse(highlight,
+			&scene_output->damage_highlight_regions, link) {
+		float alpha = 0.5 * (1.0 - (float)(now - highlight->when) /
+			HIGHLIGHT_DAMAGE_FADEOUT_TIME);
+		render_tint(output, &highlight->region,
+			(float[4]){ alpha, 0.0, 0.0, alpha });
+	}
+	wlr_renderer_scissor(wlr_backend_get_renderer(output->backend), NULL);
+}
+
+/**
+ * Damage the highlights, so that they are repainted while fading out.
+ */
+static void scene_output_damage_highlights(
+		struct wlr_scene_output *scene_output) {
+	pixman_region32_clear(&scene_output->highlight_damage);
+	struct highlight_region *highlight;
+	wl_list_for_each(highlight, &scene_output->damage_highlight_regions,
+			link) {
+		pixman_region32_union(&scene_output->highlight_damage,
+			&scene_output->highlight_damage, &highlight->region);
+	}
+	if (pixman_region32_not_empty(&scene_output->highlight_damage)) {
+		wlr_output_damage_add(scene_output->damage,
+			&scene_output->highlight_damage);
+	}
+}
+
+bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
+	struct wlr_output *output = scene_output->output;
+	enum wlr_scene_debug_damage_option debug_damage =
+		scene_output->scene->debug_damage_option;
+
+	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_RERENDER) {
+		wlr_output_damage_add_whole(scene_output->damage);
+	}
+
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+
+	bool needs_frame;
+	if (!wlr_output_damage_attach_render(scene_output->damage,
+			&needs_frame, &damage)) {
+		pixman_region32_fini(&damage);
+		return false;
+	}
+
+	if (!needs_frame) {
+		pixman_region32_fini(&damage);
+		wlr_output_rollback(output);
+		return true;
+	}
+
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	assert(renderer != NULL);
+
+	int64_t now = 0;
+	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
+		now = get_current_time_msec();
+		scene_output_update_highlights(scene_output, &damage, now);
+	}
+
+	wlr_renderer_begin(renderer, output->width, output->height);
+	wlr_scene_render_output(scene_output->scene, output,
+		scene_output->x, scene_output->y, &damage);
+	wlr_output_render_software_cursors(output, &damage);
+	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
+		scene_output_render_highlights(scene_output, now);
+	}
+	wlr_renderer_end(renderer);
+
+	pixman_region32_fini(&damage);
+
+	int tr_width, tr_height;
+	wlr_output_transformed_resolution(output, &tr_width, &tr_height);
+
+	enum wl_output_transform transform =
+		wlr_output_transform_invert(output->transform);
+
+	pixman_region32_t frame_damage;
+	pixman_region32_init(&frame_damage);
+	wlr_region_transform(&frame_damage, &scene_output->damage->current,
+		transform, tr_width, tr_height);
+	wlr_output_set_damage(output, &frame_damage);
+	pixman_region32_fini(&frame_damage);
+
+	if (!wlr_output_commit(output)) {
+		return false;
+	}
+
+	// Added after the commit, which resets the damage
+	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
+		scene_output_damage_highlights(scene_output);
+	}
+	return true;
+}
+
+struct frame_done_data {
+	struct wlr_box output_box;
+	struct timespec *now;
+};
+
+static void scene_surface_send_frame_done(struct wlr_surface *surface,
+		int lx, int ly, void *_data) {
+	struct frame_done_data *data = _data;
+
+	struct wlr_box surface_box = {
+		.x = lx,
+		.y = ly,
+		.width = surface->current.width,
+		.height = surface->current.height,
+	};
+	struct wlr_box intersection;
+	if (wlr_box_intersection(&intersection, &surface_box, &data->output_box)) {
+		wlr_surface_send_frame_done(surface, data->now);
+	}
+}
+
+void wlr_scene_output_send_frame_done(struct wlr_scene_output *scene_output,
+		struct timespec *now) {
+	struct frame_done_data data = { .now = now };
+	scene_output_get_box(scene_output, &data.output_box);
+	wlr_scene_node_for_each_surface(&scene_output->scene->node,
+		scene_surface_send_frame_done, &data);
+}
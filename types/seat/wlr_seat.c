@@ -11,6 +11,7 @@
 #include <wlr/util/log.h>
 #include "types/wlr_seat.h"
 #include "util/global.h"
+#include "util/hash_map.h"
 #include "util/signal.h"
 
 #define SEAT_VERSION 7
@@ -95,6 +96,8 @@ static void seat_client_handle_resource_destroy(
 		wl_list_init(link);
 	}
 
+	hash_map_remove(client->seat->client_map, hash_pointer(client->client),
+		client->client);
 	wl_list_remove(&client->link);
 	free(client);
 }
@@ -133,6 +136,14 @@ static void seat_handle_bind(struct wl_client *client, void *_wlr_seat,
 			return;
 		}
 
+		if (!hash_map_set(wlr_seat->client_map, hash_pointer(client), client,
+				seat_client)) {
+			free(seat_client);
+			wl_resource_destroy(wl_resource);
+			wl_client_post_no_memory(client);
+			return;
+		}
+
 		seat_client->client = client;
 		seat_client->seat = wlr_seat;
 		wl_list_init(&seat_client->resources);
@@ -192,6 +203,7 @@ void wlr_seat_destroy(struct wlr_seat *seat) {
 	}
 
 	wlr_global_destroy_safe(seat->global, seat->display);
+	hash_map_destroy(seat->client_map);
 	free(seat->pointer_state.default_grab);
 	free(seat->keyboard_state.default_grab);
 	free(seat->touch_state.default_grab);
@@ -263,9 +275,19 @@ struct wlr_seat *wlr_seat_create(struct wl_display *display, const char *name) {
 	seat->touch_state.seat = seat;
 	wl_list_init(&seat->touch_state.touch_points);
 
+	seat->client_map = hash_map_create(NULL);
+	if (seat->client_map == NULL) {
+		free(touch_grab);
+		free(pointer_grab);
+		free(keyboard_grab);
+		free(seat);
+		return NULL;
+	}
+
 	seat->global = wl_global_create(display, &wl_seat_interface,
 		SEAT_VERSION, seat, seat_handle_bind);
 	if (seat->global == NULL) {
+		hash_map_destroy(seat->client_map);
 		free(touch_grab);
 		free(pointer_grab);
 		free(keyboard_grab);
@@ -307,13 +329,8 @@ struct wlr_seat *wlr_seat_create(struct wl_display *display, const char *name) {
 
 struct wlr_seat_client *wlr_seat_client_for_wl_client(struct wlr_seat *wlr_seat,
 		struct wl_client *wl_client) {
-	struct wlr_seat_client *seat_client;
-	wl_list_for_each(seat_client, &wlr_seat->clients, link) {
-		if (seat_client->client == wl_client) {
-			return seat_client;
-		}
-	}
-	return NULL;
+	return hash_map_get(wlr_seat->client_map, hash_pointer(wl_client),
+		wl_client);
 }
 
 void wlr_seat_set_capabilities(struct wlr_seat *wlr_seat,
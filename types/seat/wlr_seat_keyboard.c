@@ -2,16 +2,13 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <time.h>
-#include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_input_device.h>
 #include <wlr/util/log.h>
 #include "types/wlr_data_device.h"
 #include "types/wlr_seat.h"
-#include "util/shm.h"
 #include "util/signal.h"
 
 static void default_keyboard_enter(struct wlr_seat_keyboard_grab *grab,
@@ -205,20 +202,27 @@ void wlr_seat_keyboard_send_modifiers(struct wlr_seat *seat,
 		return;
 	}
 
+	struct wlr_keyboard_modifiers mods = {0};
+	if (modifiers != NULL) {
+		mods = *modifiers;
+	}
+	struct wlr_keyboard_modifiers *sent = &client->sent_modifiers;
+	if (client->sent_modifiers_valid && sent->depressed == mods.depressed &&
+			sent->latched == mods.latched && sent->locked == mods.locked &&
+			sent->group == mods.group) {
+		return;
+	}
+	client->sent_modifiers = mods;
+	client->sent_modifiers_valid = true;
+
 	uint32_t serial = wlr_seat_client_next_serial(client);
 	struct wl_resource *resource;
 	wl_resource_for_each(resource, &client->keyboards) {
 		if (seat_client_from_keyboard_resource(resource) == NULL) {
 			continue;
 		}
-
-		if (modifiers == NULL) {
-			wl_keyboard_send_modifiers(resource, serial, 0, 0, 0, 0);
-		} else {
-			wl_keyboard_send_modifiers(resource, serial,
-				modifiers->depressed, modifiers->latched,
-				modifiers->locked, modifiers->group);
-		}
+		wl_keyboard_send_modifiers(resource, serial, mods.depressed,
+			mods.latched, mods.locked, mods.group);
 	}
 }
 
@@ -298,7 +302,9 @@ void wlr_seat_keyboard_enter(struct wlr_seat *seat,
 
 	if (client != NULL) {
 		// tell new client about any modifier change last,
-		// as it targets seat->keyboard_state.focused_client
+		// as it targets seat->keyboard_state.focused_client. The protocol
+		// requires a modifiers event after each enter.
+		client->sent_modifiers_valid = false;
 		wlr_seat_keyboard_send_modifiers(seat, modifiers);
 
 		seat_client_send_selection(client);
@@ -350,12 +356,35 @@ void wlr_seat_keyboard_notify_key(struct wlr_seat *seat, uint32_t time,
 }
 
 
+static void keyboard_resource_send_keymap(struct wl_resource *resource,
+		struct wlr_keyboard *keyboard) {
+	// The keymap file is read-only, it can be shared by all clients
+	wl_keyboard_send_keymap(resource, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
+		keyboard->keymap_fd, keyboard->keymap_size);
+}
+
+static void keyboard_resource_send_repeat_info(struct wl_resource *resource,
+		struct wlr_keyboard *keyboard) {
+	if (wl_resource_get_version(resource) >=
+			WL_KEYBOARD_REPEAT_INFO_SINCE_VERSION) {
+		wl_keyboard_send_repeat_info(resource,
+			keyboard->repeat_info.rate, keyboard->repeat_info.delay);
+	}
+}
+
 static void seat_client_send_keymap(struct wlr_seat_client *client,
 		struct wlr_keyboard *keyboard) {
-	if (!keyboard) {
+	if (!keyboard || keyboard->keymap_fd < 0) {
 		return;
 	}
 
+	// Keyboards with identical keymaps share the same serial, so switching
+	// between them doesn't need to resend anything
+	if (client->sent_keymap_serial == keyboard->keymap_serial) {
+		return;
+	}
+	client->sent_keymap_serial = keyboard->keymap_serial;
+
 	// TODO: We should probably lift all of the keys set by the other
 	// keyboard
 	struct wl_resource *resource;
@@ -363,29 +392,7 @@ static void seat_client_send_keymap(struct wlr_seat_client *client,
 		if (seat_client_from_keyboard_resource(resource) == NULL) {
 			continue;
 		}
-
-		int keymap_fd = allocate_shm_file(keyboard->keymap_size);
-		if (keymap_fd < 0) {
-			wlr_log(WLR_ERROR, "creating a keymap file for %zu bytes failed", keyboard->keymap_size);
-			continue;
-		}
-
-		void *ptr = mmap(NULL, keyboard->keymap_size, PROT_READ | PROT_WRITE,
-				MAP_SHARED, keymap_fd, 0);
-		if (ptr == MAP_FAILED) {
-			wlr_log(WLR_ERROR, "failed to mmap() %zu bytes", keyboard->keymap_size);
-			close(keymap_fd);
-			continue;
-		}
-
-		strcpy(ptr, keyboard->keymap_string);
-		munmap(ptr, keyboard->keymap_size);
-
-		wl_keyboard_send_keymap(resource,
-			WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, keymap_fd,
-			keyboard->keymap_size);
-
-		close(keymap_fd);
+		keyboard_resource_send_keymap(resource, keyboard);
 	}
 }
 
@@ -395,17 +402,21 @@ static void seat_client_send_repeat_info(struct wlr_seat_client *client,
 		return;
 	}
 
+	if (client->sent_repeat_info_valid &&
+			client->sent_repeat_rate == keyboard->repeat_info.rate &&
+			client->sent_repeat_delay == keyboard->repeat_info.delay) {
+		return;
+	}
+	client->sent_repeat_info_valid = true;
+	client->sent_repeat_rate = keyboard->repeat_info.rate;
+	client->sent_repeat_delay = keyboard->repeat_info.delay;
+
 	struct wl_resource *resource;
 	wl_resource_for_each(resource, &client->keyboards) {
 		if (seat_client_from_keyboard_resource(resource) == NULL) {
 			continue;
 		}
-
-		if (wl_resource_get_version(resource) >=
-				WL_KEYBOARD_REPEAT_INFO_SINCE_VERSION) {
-			wl_keyboard_send_repeat_info(resource,
-				keyboard->repeat_info.rate, keyboard->repeat_info.delay);
-		}
+		keyboard_resource_send_repeat_info(resource, keyboard);
 	}
 }
 
@@ -430,8 +441,23 @@ void seat_client_create_keyboard(struct wlr_seat_client *seat_client,
 	if (keyboard == NULL) {
 		return;
 	}
-	seat_client_send_keymap(seat_client, keyboard);
-	seat_client_send_repeat_info(seat_client, keyboard);
+
+	// Only the new resource needs the current state: the client's other
+	// keyboards already have it
+	if (keyboard->keymap_fd >= 0) {
+		if (seat_client->sent_keymap_serial == keyboard->keymap_serial) {
+			keyboard_resource_send_keymap(resource, keyboard);
+		} else {
+			seat_client_send_keymap(seat_client, keyboard);
+		}
+	}
+	if (seat_client->sent_repeat_info_valid &&
+			seat_client->sent_repeat_rate == keyboard->repeat_info.rate &&
+			seat_client->sent_repeat_delay == keyboard->repeat_info.delay) {
+		keyboard_resource_send_repeat_info(resource, keyboard);
+	} else {
+		seat_client_send_repeat_info(seat_client, keyboard);
+	}
 
 	struct wlr_seat_client *focused_client =
 		seat_client->seat->keyboard_state.focused_client;
@@ -469,6 +495,7 @@ void seat_client_create_keyboard(struct wlr_seat_client *seat_client,
 
 		wl_array_release(&keys);
 
+		focused_client->sent_modifiers_valid = false;
 		wlr_seat_keyboard_send_modifiers(seat_client->seat,
 			&keyboard->modifiers);
 	}
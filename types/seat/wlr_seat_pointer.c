@@ -146,6 +146,7 @@ void seat_client_send_pointer_leave_raw(struct wlr_seat_client *seat_client,
 		wl_pointer_send_leave(resource, serial, surface->resource);
 		pointer_send_frame(resource);
 	}
+	seat_client->needs_pointer_frame = false;
 }
 
 void wlr_seat_pointer_enter(struct wlr_seat *wlr_seat,
@@ -184,6 +185,7 @@ void wlr_seat_pointer_enter(struct wlr_seat *wlr_seat,
 				wl_fixed_from_double(sx), wl_fixed_from_double(sy));
 			pointer_send_frame(resource);
 		}
+		client->needs_pointer_frame = false;
 	}
 
 	// reinitialize the focus destroy events
@@ -242,6 +244,7 @@ void wlr_seat_pointer_send_motion(struct wlr_seat *wlr_seat, uint32_t time,
 
 		wl_pointer_send_motion(resource, time, wl_fixed_from_double(sx),
 			wl_fixed_from_double(sy));
+		client->needs_pointer_frame = true;
 	}
 
 	wlr_seat_pointer_warp(wlr_seat, sx, sy);
@@ -262,6 +265,7 @@ uint32_t wlr_seat_pointer_send_button(struct wlr_seat *wlr_seat, uint32_t time,
 		}
 
 		wl_pointer_send_button(resource, serial, time, button, state);
+		client->needs_pointer_frame = true;
 	}
 	return serial;
 }
@@ -297,14 +301,18 @@ void wlr_seat_pointer_send_axis(struct wlr_seat *wlr_seat, uint32_t time,
 		} else if (version >= WL_POINTER_AXIS_STOP_SINCE_VERSION) {
 			wl_pointer_send_axis_stop(resource, time, orientation);
 		}
+		client->needs_pointer_frame = true;
 	}
 }
 
 void wlr_seat_pointer_send_frame(struct wlr_seat *wlr_seat) {
 	struct wlr_seat_client *client = wlr_seat->pointer_state.focused_client;
-	if (client == NULL) {
+	// Don't wake up the client with a frame grouping no events, e.g. after
+	// motion that didn't change the surface-local position
+	if (client == NULL || !client->needs_pointer_frame) {
 		return;
 	}
+	client->needs_pointer_frame = false;
 
 	struct wl_resource *resource;
 	wl_resource_for_each(resource, &client->pointers) {
@@ -33,6 +33,10 @@ static void default_touch_enter(struct wlr_seat_touch_grab *grab,
 	// not handled by default
 }
 
+static void default_touch_frame(struct wlr_seat_touch_grab *grab) {
+	wlr_seat_touch_send_frame(grab->seat);
+}
+
 static void default_touch_cancel(struct wlr_seat_touch_grab *grab) {
 	// cannot be cancelled
 }
@@ -42,6 +46,7 @@ const struct wlr_touch_grab_interface default_touch_grab_impl = {
 	.up = default_touch_up,
 	.motion = default_touch_motion,
 	.enter = default_touch_enter,
+	.frame = default_touch_frame,
 	.cancel = default_touch_cancel,
 };
 
@@ -103,6 +108,21 @@ static void touch_point_destroy(struct wlr_touch_point *point) {
 	wl_list_remove(&point->surface_destroy.link);
 	wl_list_remove(&point->client_destroy.link);
 	wl_list_remove(&point->link);
+
+	struct wlr_seat_touch_state *state = &point->client->seat->touch_state;
+	int32_t id = point->touch_id;
+	if (id >= 0 && id < WLR_SEAT_TOUCH_SLOTS && state->slots[id] == point) {
+		// Fall back to an older point with the same ID, if any
+		state->slots[id] = NULL;
+		struct wlr_touch_point *other;
+		wl_list_for_each(other, &state->touch_points, link) {
+			if (other->touch_id == id) {
+				state->slots[id] = other;
+				break;
+			}
+		}
+	}
+
 	free(point);
 }
 
@@ -154,12 +174,19 @@ static struct wlr_touch_point *touch_point_create(
 	wl_signal_add(&client->events.destroy, &point->client_destroy);
 	point->client_destroy.notify = touch_point_handle_client_destroy;
 	wl_list_insert(&seat->touch_state.touch_points, &point->link);
+	if (touch_id >= 0 && touch_id < WLR_SEAT_TOUCH_SLOTS) {
+		seat->touch_state.slots[touch_id] = point;
+	}
 
 	return point;
 }
 
 struct wlr_touch_point *wlr_seat_touch_get_point(
 		struct wlr_seat *seat, int32_t touch_id) {
+	if (touch_id >= 0 && touch_id < WLR_SEAT_TOUCH_SLOTS) {
+		return seat->touch_state.slots[touch_id];
+	}
+
 	struct wlr_touch_point *point = NULL;
 	wl_list_for_each(point, &seat->touch_state.touch_points, link) {
 		if (point->touch_id == touch_id) {
@@ -226,6 +253,17 @@ void wlr_seat_touch_notify_motion(struct wlr_seat *seat, uint32_t time,
 	grab->interface->motion(grab, time, point);
 }
 
+void wlr_seat_touch_notify_frame(struct wlr_seat *seat) {
+	seat->touch_state.batch_frames = true;
+
+	struct wlr_seat_touch_grab *grab = seat->touch_state.grab;
+	if (grab->interface->frame) {
+		grab->interface->frame(grab);
+	} else {
+		wlr_seat_touch_send_frame(seat);
+	}
+}
+
 static void handle_point_focus_destroy(struct wl_listener *listener,
 		void *data) {
 	struct wlr_touch_point *point =
@@ -286,6 +324,30 @@ void wlr_seat_touch_point_clear_focus(struct wlr_seat *seat, uint32_t time,
 	touch_point_clear_focus(point);
 }
 
+static void touch_client_send_frame(struct wlr_seat_client *client) {
+	struct wl_resource *resource;
+	wl_resource_for_each(resource, &client->touches) {
+		if (seat_client_from_touch_resource(resource) == NULL) {
+			continue;
+		}
+		wl_touch_send_frame(resource);
+	}
+	client->needs_touch_frame = false;
+}
+
+/**
+ * Ends a touch event sent to the client: the frame is either sent right away
+ * or deferred to the next touch frame notification.
+ */
+static void touch_client_end_event(struct wlr_seat *seat,
+		struct wlr_seat_client *client) {
+	if (seat->touch_state.batch_frames) {
+		client->needs_touch_frame = true;
+	} else {
+		touch_client_send_frame(client);
+	}
+}
+
 uint32_t wlr_seat_touch_send_down(struct wlr_seat *seat,
 		struct wlr_surface *surface, uint32_t time, int32_t touch_id, double sx,
 		double sy) {
@@ -303,8 +365,8 @@ uint32_t wlr_seat_touch_send_down(struct wlr_seat *seat,
 		}
 		wl_touch_send_down(resource, serial, time, surface->resource,
 			touch_id, wl_fixed_from_double(sx), wl_fixed_from_double(sy));
-		wl_touch_send_frame(resource);
 	}
+	touch_client_end_event(seat, point->client);
 
 	return serial;
 }
@@ -323,8 +385,8 @@ void wlr_seat_touch_send_up(struct wlr_seat *seat, uint32_t time, int32_t touch_
 			continue;
 		}
 		wl_touch_send_up(resource, serial, time, touch_id);
-		wl_touch_send_frame(resource);
 	}
+	touch_client_end_event(seat, point->client);
 }
 
 void wlr_seat_touch_send_motion(struct wlr_seat *seat, uint32_t time, int32_t touch_id,
@@ -342,7 +404,16 @@ void wlr_seat_touch_send_motion(struct wlr_seat *seat, uint32_t time, int32_t to
 		}
 		wl_touch_send_motion(resource, time, touch_id, wl_fixed_from_double(sx),
 			wl_fixed_from_double(sy));
-		wl_touch_send_frame(resource);
+	}
+	touch_client_end_event(seat, point->client);
+}
+
+void wlr_seat_touch_send_frame(struct wlr_seat *seat) {
+	struct wlr_seat_client *client;
+	wl_list_for_each(client, &seat->clients, link) {
+		if (client->needs_touch_frame) {
+			touch_client_send_frame(client);
+		}
 	}
 }
 
@@ -6,6 +6,7 @@
 #include "util/array.h"
 #include "util/time.h"
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
 #include <types/wlr_tablet_v2.h>
 #include <wayland-util.h>
@@ -319,6 +320,20 @@ static void queue_tool_frame(struct wlr_tablet_tool_client_v2 *tool) {
 	}
 }
 
+/**
+ * Returns true if the axis value needs to be sent, and records it as sent.
+ */
+static bool update_axis(struct wlr_tablet_tool_client_v2 *client,
+		enum tablet_tool_axis_v2 axis, double *last, double value,
+		double epsilon) {
+	if ((client->axes.sent & axis) && fabs(value - *last) <= epsilon) {
+		return false;
+	}
+	client->axes.sent |= axis;
+	*last = value;
+	return true;
+}
+
 static void handle_tablet_tool_surface_destroy(struct wl_listener *listener,
 		void *data) {
 	struct wlr_tablet_v2_tablet_tool *tool =
@@ -376,6 +391,7 @@ void wlr_send_tablet_v2_tablet_tool_proximity_in(
 	tool->surface_destroy.notify = handle_tablet_tool_surface_destroy;
 
 	tool->current_client = tool_client;
+	tool_client->axes.sent = 0;
 
 	uint32_t serial = wlr_seat_client_next_serial(tool_client->seat->seat_client);
 	tool->focused_surface = surface;
@@ -398,9 +414,18 @@ void wlr_send_tablet_v2_tablet_tool_proximity_in(
 
 void wlr_send_tablet_v2_tablet_tool_motion(
 		struct wlr_tablet_v2_tablet_tool *tool, double x, double y) {
-	if (!tool->current_client) {
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	if (!client) {
+		return;
+	}
+
+	if ((client->axes.sent & TABLET_TOOL_AXIS_V2_POSITION) &&
+			client->axes.x == x && client->axes.y == y) {
 		return;
 	}
+	client->axes.sent |= TABLET_TOOL_AXIS_V2_POSITION;
+	client->axes.x = x;
+	client->axes.y = y;
 
 	zwp_tablet_tool_v2_send_motion(tool->current_client->resource,
 		wl_fixed_from_double(x), wl_fixed_from_double(y));
@@ -436,7 +461,9 @@ void wlr_send_tablet_v2_tablet_tool_proximity_out(
 
 void wlr_send_tablet_v2_tablet_tool_pressure(
 		struct wlr_tablet_v2_tablet_tool *tool, double pressure) {
-	if (tool->current_client) {
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	if (client && update_axis(client, TABLET_TOOL_AXIS_V2_PRESSURE,
+			&client->axes.pressure, pressure, tool->axis_epsilon)) {
 		zwp_tablet_tool_v2_send_pressure(tool->current_client->resource,
 			pressure * 65535);
 
@@ -446,7 +473,9 @@ void wlr_send_tablet_v2_tablet_tool_pressure(
 
 void wlr_send_tablet_v2_tablet_tool_distance(
 		struct wlr_tablet_v2_tablet_tool *tool, double distance) {
-	if (tool->current_client) {
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	if (client && update_axis(client, TABLET_TOOL_AXIS_V2_DISTANCE,
+			&client->axes.distance, distance, tool->axis_epsilon)) {
 		zwp_tablet_tool_v2_send_distance(tool->current_client->resource,
 			distance * 65535);
 
@@ -456,9 +485,20 @@ void wlr_send_tablet_v2_tablet_tool_distance(
 
 void wlr_send_tablet_v2_tablet_tool_tilt(
 		struct wlr_tablet_v2_tablet_tool *tool, double x, double y) {
-	if (!tool->current_client) {
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	if (!client) {
+		return;
+	}
+
+	// Both axes are sent together, drop the update only if neither changed
+	if ((client->axes.sent & TABLET_TOOL_AXIS_V2_TILT) &&
+			fabs(x - client->axes.tilt_x) <= tool->axis_epsilon &&
+			fabs(y - client->axes.tilt_y) <= tool->axis_epsilon) {
 		return;
 	}
+	client->axes.sent |= TABLET_TOOL_AXIS_V2_TILT;
+	client->axes.tilt_x = x;
+	client->axes.tilt_y = y;
 
 	zwp_tablet_tool_v2_send_tilt(tool->current_client->resource,
 		wl_fixed_from_double(x), wl_fixed_from_double(y));
@@ -468,7 +508,9 @@ void wlr_send_tablet_v2_tablet_tool_tilt(
 
 void wlr_send_tablet_v2_tablet_tool_rotation(
 		struct wlr_tablet_v2_tablet_tool *tool, double degrees) {
-	if (!tool->current_client) {
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	if (!client || !update_axis(client, TABLET_TOOL_AXIS_V2_ROTATION,
+			&client->axes.rotation, degrees, tool->axis_epsilon)) {
 		return;
 	}
 
@@ -480,7 +522,9 @@ void wlr_send_tablet_v2_tablet_tool_rotation(
 
 void wlr_send_tablet_v2_tablet_tool_slider(
 		struct wlr_tablet_v2_tablet_tool *tool, double position) {
-	if (!tool->current_client) {
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	if (!client || !update_axis(client, TABLET_TOOL_AXIS_V2_SLIDER,
+			&client->axes.slider, position, tool->axis_epsilon)) {
 		return;
 	}
 
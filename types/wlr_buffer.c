@@ -1,5 +1,7 @@
 #include <assert.h>
+#include <drm_fourcc.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
@@ -20,6 +22,7 @@ void wlr_buffer_init(struct wlr_buffer *buffer,
 	buffer->height = height;
 	wl_signal_init(&buffer->events.destroy);
 	wl_signal_init(&buffer->events.release);
+	wlr_addon_set_init(&buffer->addons);
 }
 
 static void buffer_consider_destroy(struct wlr_buffer *buffer) {
@@ -30,6 +33,7 @@ static void buffer_consider_destroy(struct wlr_buffer *buffer) {
 	assert(!buffer->accessing_data_ptr);
 
 	wlr_signal_emit_safe(&buffer->events.destroy, NULL);
+	wlr_addon_set_finish(&buffer->addons);
 
 	buffer->impl->destroy(buffer);
 }
@@ -152,7 +156,27 @@ static void client_buffer_destroy(struct wlr_buffer *_buffer) {
 	}
 
 	wl_list_remove(&buffer->resource_destroy.link);
-	wlr_texture_destroy(buffer->texture);
+
+	if (buffer->prev != NULL) {
+		buffer->prev->next = NULL;
+	}
+
+	// Hand our texture over to the next buffer, so that it can catch up with
+	// the damage accumulated since our contents
+	struct wlr_client_buffer *next = buffer->next;
+	if (next != NULL) {
+		next->prev = NULL;
+	}
+	if (next != NULL && next->next == NULL && next->spare_texture == NULL &&
+			next->texture->width == buffer->texture->width &&
+			next->texture->height == buffer->texture->height) {
+		next->spare_texture = buffer->texture;
+	} else {
+		wlr_texture_destroy(buffer->texture);
+	}
+
+	wlr_texture_destroy(buffer->spare_texture);
+	pixman_region32_fini(&buffer->spare_damage);
 	free(buffer);
 }
 
@@ -207,6 +231,58 @@ static void client_buffer_handle_release(struct wl_listener *listener,
 	}
 }
 
+static struct wlr_texture *texture_from_shm_resource(
+		struct wlr_renderer *renderer, struct wl_resource *resource) {
+	struct wlr_shm_client_buffer *shm_client_buffer =
+		shm_client_buffer_get_or_create(resource);
+	if (shm_client_buffer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create shm client buffer");
+		return NULL;
+	}
+
+	// Ensure the buffer will be released once the renderer is done with it
+	wlr_buffer_lock(&shm_client_buffer->base);
+
+	struct wlr_texture *texture =
+		wlr_texture_from_buffer(renderer, &shm_client_buffer->base);
+
+	// The renderer should've locked the buffer by now if necessary
+	wlr_buffer_unlock(&shm_client_buffer->base);
+
+	return texture;
+}
+
+static struct wlr_client_buffer *client_buffer_create(
+		struct wlr_renderer *renderer, struct wl_resource *resource,
+		struct wlr_texture *texture, bool resource_released) {
+	struct wlr_client_buffer *buffer =
+		calloc(1, sizeof(struct wlr_client_buffer));
+	if (buffer == NULL) {
+		wlr_texture_destroy(texture);
+		wl_resource_post_no_memory(resource);
+		return NULL;
+	}
+	wlr_buffer_init(&buffer->base, &client_buffer_impl,
+		texture->width, texture->height);
+	buffer->resource = resource;
+	buffer->texture = texture;
+	buffer->resource_released = resource_released;
+	buffer->renderer = renderer;
+	pixman_region32_init(&buffer->spare_damage);
+
+	wl_resource_add_destroy_listener(resource, &buffer->resource_destroy);
+	buffer->resource_destroy.notify = client_buffer_resource_handle_destroy;
+
+	buffer->release.notify = client_buffer_handle_release;
+	wl_signal_add(&buffer->base.events.release, &buffer->release);
+
+	// Ensure the buffer will be released before being destroyed
+	wlr_buffer_lock(&buffer->base);
+	wlr_buffer_drop(&buffer->base);
+
+	return buffer;
+}
+
 struct wlr_client_buffer *wlr_client_buffer_import(
 		struct wlr_renderer *renderer, struct wl_resource *resource) {
 	assert(wlr_resource_is_buffer(resource));
@@ -215,21 +291,7 @@ struct wlr_client_buffer *wlr_client_buffer_import(
 	bool resource_released = false;
 
 	if (wl_shm_buffer_get(resource) != NULL) {
-		struct wlr_shm_client_buffer *shm_client_buffer =
-			shm_client_buffer_create(resource);
-		if (shm_client_buffer == NULL) {
-			wlr_log(WLR_ERROR, "Failed to create shm client buffer");
-			return NULL;
-		}
-
-		// Ensure the buffer will be released before being destroyed
-		wlr_buffer_lock(&shm_client_buffer->base);
-		wlr_buffer_drop(&shm_client_buffer->base);
-
-		texture = wlr_texture_from_buffer(renderer, &shm_client_buffer->base);
-
-		// The renderer should've locked the buffer by now if necessary
-		wlr_buffer_unlock(&shm_client_buffer->base);
+		texture = texture_from_shm_resource(renderer, resource);
 
 		// The renderer is responsible for releasing the buffer when
 		// appropriate
@@ -259,42 +321,101 @@ struct wlr_client_buffer *wlr_client_buffer_import(
 		return NULL;
 	}
 
+	return client_buffer_create(renderer, resource, texture,
+		resource_released);
+}
+
+struct wlr_client_buffer *client_buffer_create_from_shm_texture(
+		struct wlr_renderer *renderer, struct wl_resource *resource,
+		struct wlr_texture *texture) {
+	assert(wl_shm_buffer_get(resource) != NULL);
+
 	struct wlr_client_buffer *buffer =
-		calloc(1, sizeof(struct wlr_client_buffer));
+		client_buffer_create(renderer, resource, texture, true);
 	if (buffer == NULL) {
-		wlr_texture_destroy(texture);
-		wl_resource_post_no_memory(resource);
 		return NULL;
 	}
-	wlr_buffer_init(&buffer->base, &client_buffer_impl,
-		texture->width, texture->height);
-	buffer->resource = resource;
-	buffer->texture = texture;
-	buffer->resource_released = resource_released;
 
-	wl_resource_add_destroy_listener(resource, &buffer->resource_destroy);
-	buffer->resource_destroy.notify = client_buffer_resource_handle_destroy;
+	// The contents have already been uploaded, we don't need to access the
+	// wl_buffer anymore
+	wl_buffer_send_release(resource);
+	return buffer;
+}
 
-	buffer->release.notify = client_buffer_handle_release;
-	wl_signal_add(&buffer->base.events.release, &buffer->release);
+static bool texture_write_damage(struct wlr_texture *texture,
+		struct wl_shm_buffer *shm_buf, pixman_region32_t *damage) {
+	int32_t stride = wl_shm_buffer_get_stride(shm_buf);
 
-	// Ensure the buffer will be released before being destroyed
-	wlr_buffer_lock(&buffer->base);
-	wlr_buffer_drop(&buffer->base);
+	wl_shm_buffer_begin_access(shm_buf);
+	void *data = wl_shm_buffer_get_data(shm_buf);
 
-	return buffer;
+	bool ok = wlr_texture_write_pixels_region(texture, stride, damage, data);
+
+	wl_shm_buffer_end_access(shm_buf);
+	return ok;
 }
 
-struct wlr_client_buffer *wlr_client_buffer_apply_damage(
+/**
+ * Create a new buffer for the updated contents, leaving the locked buffer
+ * untouched. Textures are recycled between the two buffers: the spare texture
+ * left behind by the previous buffer is brought up-to-date, or if there's
+ * none yet, the whole wl_buffer is uploaded.
+ */
+static struct wlr_client_buffer *client_buffer_apply_damage_to_spare(
 		struct wlr_client_buffer *buffer, struct wl_resource *resource,
-		pixman_region32_t *damage) {
-	assert(wlr_resource_is_buffer(resource));
+		struct wl_shm_buffer *shm_buf, pixman_region32_t *damage) {
+	if (buffer->next != NULL) {
+		// Already replaced once
+		return NULL;
+	}
 
-	if (buffer->base.n_locks > 1) {
-		// Someone else still has a reference to the buffer
+	struct wlr_texture *texture = buffer->spare_texture;
+	buffer->spare_texture = NULL;
+	if (texture != NULL && (texture->width != buffer->texture->width ||
+			texture->height != buffer->texture->height)) {
+		wlr_texture_destroy(texture);
+		texture = NULL;
+	}
+
+	if (texture != NULL) {
+		pixman_region32_union(&buffer->spare_damage, &buffer->spare_damage,
+			damage);
+		if (!texture_write_damage(texture, shm_buf, &buffer->spare_damage)) {
+			wlr_texture_destroy(texture);
+			return NULL;
+		}
+	} else {
+		texture = texture_from_shm_resource(buffer->renderer, resource);
+		if (texture == NULL) {
+			return NULL;
+		}
+	}
+	pixman_region32_clear(&buffer->spare_damage);
+
+	struct wlr_client_buffer *new_buffer =
+		client_buffer_create(buffer->renderer, resource, texture, true);
+	if (new_buffer == NULL) {
 		return NULL;
 	}
 
+	// Our texture lags behind the new buffer's contents by this damage
+	pixman_region32_copy(&new_buffer->spare_damage, damage);
+	new_buffer->prev = buffer;
+	buffer->next = new_buffer;
+
+	// We have uploaded the data, we don't need to access the wl_buffer
+	// anymore
+	wl_buffer_send_release(resource);
+
+	wlr_buffer_unlock(&buffer->base);
+	return new_buffer;
+}
+
+struct wlr_client_buffer *wlr_client_buffer_apply_damage(
+		struct wlr_client_buffer *buffer, struct wl_resource *resource,
+		pixman_region32_t *damage) {
+	assert(wlr_resource_is_buffer(resource));
+
 	struct wl_shm_buffer *shm_buf = wl_shm_buffer_get(resource);
 	struct wl_shm_buffer *old_shm_buf = wl_shm_buffer_get(buffer->resource);
 	if (shm_buf == NULL || old_shm_buf == NULL) {
@@ -310,7 +431,6 @@ struct wlr_client_buffer *wlr_client_buffer_apply_damage(
 		return NULL;
 	}
 
-	int32_t stride = wl_shm_buffer_get_stride(shm_buf);
 	int32_t width = wl_shm_buffer_get_width(shm_buf);
 	int32_t height = wl_shm_buffer_get_height(shm_buf);
 
@@ -319,22 +439,17 @@ struct wlr_client_buffer *wlr_client_buffer_apply_damage(
 		return NULL;
 	}
 
-	wl_shm_buffer_begin_access(shm_buf);
-	void *data = wl_shm_buffer_get_data(shm_buf);
-
-	int n;
-	pixman_box32_t *rects = pixman_region32_rectangles(damage, &n);
-	for (int i = 0; i < n; ++i) {
-		pixman_box32_t *r = &rects[i];
-		if (!wlr_texture_write_pixels(buffer->texture, stride,
-				r->x2 - r->x1, r->y2 - r->y1, r->x1, r->y1,
-				r->x1, r->y1, data)) {
-			wl_shm_buffer_end_access(shm_buf);
-			return NULL;
-		}
+	if (buffer->base.n_locks > 1) {
+		// Someone else still has a reference to the buffer
+		return client_buffer_apply_damage_to_spare(buffer, resource, shm_buf,
+			damage);
 	}
 
-	wl_shm_buffer_end_access(shm_buf);
+	if (!texture_write_damage(buffer->texture, shm_buf, damage)) {
+		return NULL;
+	}
+	pixman_region32_union(&buffer->spare_damage, &buffer->spare_damage,
+		damage);
 
 	// We have uploaded the data, we don't need to access the wl_buffer
 	// anymore
@@ -412,6 +527,8 @@ static void shm_client_buffer_resource_handle_destroy(
 	buffer->shm_buffer = NULL;
 	wl_list_remove(&buffer->resource_destroy.link);
 	wl_list_init(&buffer->resource_destroy.link);
+
+	wlr_buffer_drop(&buffer->base);
 }
 
 static void shm_client_buffer_handle_release(struct wl_listener *listener,
@@ -423,8 +540,16 @@ static void shm_client_buffer_handle_release(struct wl_listener *listener,
 	}
 }
 
-struct wlr_shm_client_buffer *shm_client_buffer_create(
+struct wlr_shm_client_buffer *shm_client_buffer_get_or_create(
 		struct wl_resource *resource) {
+	struct wl_listener *listener = wl_resource_get_destroy_listener(resource,
+		shm_client_buffer_resource_handle_destroy);
+	if (listener != NULL) {
+		struct wlr_shm_client_buffer *buffer =
+			wl_container_of(listener, buffer, resource_destroy);
+		return buffer;
+	}
+
 	struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(resource);
 	assert(shm_buffer != NULL);
 
@@ -592,3 +717,112 @@ bool dmabuf_buffer_drop(struct wlr_dmabuf_buffer *buffer) {
 	wlr_buffer_drop(&buffer->base);
 	return ok;
 }
+
+struct wlr_solid_buffer {
+	struct wlr_buffer base;
+	float color[4];
+
+	uint32_t *data; // lazily filled in for consumers needing pixels
+};
+
+static const struct wlr_buffer_impl solid_buffer_impl;
+
+static struct wlr_solid_buffer *solid_buffer_from_buffer(
+		struct wlr_buffer *buffer) {
+	assert(buffer->impl == &solid_buffer_impl);
+	return (struct wlr_solid_buffer *)buffer;
+}
+
+static void solid_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct wlr_solid_buffer *buffer = solid_buffer_from_buffer(wlr_buffer);
+	free(buffer->data);
+	free(buffer);
+}
+
+static bool solid_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		void **data, uint32_t *format, size_t *stride) {
+	struct wlr_solid_buffer *buffer = solid_buffer_from_buffer(wlr_buffer);
+
+	if (buffer->data == NULL) {
+		size_t len = (size_t)buffer->base.width * buffer->base.height;
+		buffer->data = malloc(len * sizeof(uint32_t));
+		if (buffer->data == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			return false;
+		}
+
+		uint32_t pixel = 0;
+		for (size_t i = 0; i < 4; i++) {
+			// Stored as A, R, G, B from the most significant byte
+			float c = buffer->color[(i + 3) % 4];
+			c = c < 0 ? 0 : (c > 1 ? 1 : c);
+			pixel = (pixel << 8) | (uint32_t)(c * 255 + 0.5f);
+		}
+		for (size_t i = 0; i < len; i++) {
+			buffer->data[i] = pixel;
+		}
+	}
+
+	*data = buffer->data;
+	*format = DRM_FORMAT_ARGB8888;
+	*stride = buffer->base.width * sizeof(uint32_t);
+	return true;
+}
+
+static void solid_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	// This space is intentionally left blank
+}
+
+static const struct wlr_buffer_impl solid_buffer_impl = {
+	.destroy = solid_buffer_destroy,
+	.begin_data_ptr_access = solid_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = solid_buffer_end_data_ptr_access,
+};
+
+struct wlr_buffer *wlr_solid_buffer_create(int width, int height,
+		const float color[static 4]) {
+	assert(width > 0 && height > 0);
+
+	struct wlr_solid_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	wlr_buffer_init(&buffer->base, &solid_buffer_impl, width, height);
+	memcpy(buffer->color, color, sizeof(buffer->color));
+
+	return &buffer->base;
+}
+
+bool wlr_buffer_get_solid_color(struct wlr_buffer *buffer,
+		float color[static 4]) {
+	if (buffer->impl == &solid_buffer_impl) {
+		struct wlr_solid_buffer *solid = solid_buffer_from_buffer(buffer);
+		memcpy(color, solid->color, sizeof(solid->color));
+		return true;
+	}
+
+	if (buffer->width != 1 || buffer->height != 1 ||
+			buffer->accessing_data_ptr) {
+		return false;
+	}
+
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (!buffer_begin_data_ptr_access(buffer, &data, &format, &stride)) {
+		return false;
+	}
+	bool ok = format == DRM_FORMAT_ARGB8888 || format == DRM_FORMAT_XRGB8888;
+	uint32_t pixel = *(const uint32_t *)data;
+	buffer_end_data_ptr_access(buffer);
+	if (!ok) {
+		return false;
+	}
+
+	color[0] = ((pixel >> 16) & 0xFF) / 255.0f;
+	color[1] = ((pixel >> 8) & 0xFF) / 255.0f;
+	color[2] = (pixel & 0xFF) / 255.0f;
+	color[3] = format == DRM_FORMAT_ARGB8888 ? (pixel >> 24) / 255.0f : 1.0f;
+	return true;
+}
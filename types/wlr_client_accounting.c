@@ -0,0 +1,433 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_client_accounting.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/addon.h>
+#include <wlr/util/log.h>
+#include "util/signal.h"
+#include "util/time.h"
+
+// Commits up to this early are let through, so that clients can commit their
+// whole surface tree at once
+#define COMMIT_BURST_NSEC (100 * 1000 * 1000)
+#define COMMIT_RATE_WINDOW_NSEC (1000 * 1000 * 1000)
+
+struct accounting_surface {
+	struct wlr_client_accounting_client *client;
+	struct wlr_surface *surface;
+	struct wl_list link; // wlr_client_accounting_client.surfaces_list
+
+	size_t shm_bytes, gpu_bytes;
+
+	struct wlr_addon addon;
+
+	struct wl_listener commit;
+	struct wl_listener client_commit;
+};
+
+struct held_commit {
+	struct wl_list link; // wlr_client_accounting_client.held
+	struct accounting_surface *surface;
+	uint32_t seq;
+	int64_t release; // in nanoseconds
+};
+
+static int64_t get_now_nsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_nsec(&now);
+}
+
+static struct wl_event_loop *client_get_event_loop(
+		struct wlr_client_accounting_client *client) {
+	return wl_display_get_event_loop(wl_client_get_display(client->client));
+}
+
+static void client_destroy(struct wlr_client_accounting_client *client) {
+	assert(wl_list_empty(&client->surfaces_list));
+	assert(wl_list_empty(&client->held));
+	if (client->held_timer != NULL) {
+		wl_event_source_remove(client->held_timer);
+	}
+	if (client->limit_idle != NULL) {
+		wl_event_source_remove(client->limit_idle);
+	}
+	wl_list_remove(&client->link);
+	free(client);
+}
+
+static void client_update_held_timer(
+		struct wlr_client_accounting_client *client) {
+	if (wl_list_empty(&client->held)) {
+		if (client->held_timer != NULL) {
+			wl_event_source_timer_update(client->held_timer, 0);
+		}
+		return;
+	}
+
+	struct held_commit *held = wl_container_of(client->held.next, held, link);
+	int64_t delay = held->release - get_now_nsec();
+	int delay_msec = delay > 0 ? (delay + 999999) / 1000000 : 1;
+	wl_event_source_timer_update(client->held_timer, delay_msec);
+}
+
+static void held_commit_release(struct held_commit *held) {
+	struct wlr_surface *surface = held->surface->surface;
+	uint32_t seq = held->seq;
+	wl_list_remove(&held->link);
+	free(held);
+	wlr_surface_unlock_cached(surface, seq);
+}
+
+static int client_handle_held_timer(void *data) {
+	struct wlr_client_accounting_client *client = data;
+	int64_t now = get_now_nsec();
+
+	// Releasing a commit doesn't destroy the client record, the surface
+	// stays around
+	while (!wl_list_empty(&client->held)) {
+		struct held_commit *held =
+			wl_container_of(client->held.next, held, link);
+		if (held->release > now) {
+			break;
+		}
+		held_commit_release(held);
+	}
+
+	client_update_held_timer(client);
+	return 0;
+}
+
+static void client_handle_limit_idle(void *data) {
+	struct wlr_client_accounting_client *client = data;
+	client->limit_idle = NULL;
+	// The compositor may destroy the client from there
+	wlr_signal_emit_safe(&client->accounting->events.limit_exceeded, client);
+}
+
+static void client_check_limits(struct wlr_client_accounting_client *client) {
+	const struct wlr_client_accounting_limits *limits =
+		&client->accounting->limits;
+	bool over = (limits->max_shm_bytes > 0 &&
+			client->shm_bytes > limits->max_shm_bytes) ||
+		(limits->max_gpu_bytes > 0 &&
+			client->gpu_bytes > limits->max_gpu_bytes);
+	if (!over || client->over_limit) {
+		client->over_limit = over;
+		return;
+	}
+	client->over_limit = true;
+
+	// Not emitted right away: the client is in the middle of a request
+	if (client->limit_idle == NULL) {
+		client->limit_idle = wl_event_loop_add_idle(
+			client_get_event_loop(client), client_handle_limit_idle, client);
+	}
+}
+
+static void accounting_surface_destroy(struct accounting_surface *surface) {
+	struct wlr_client_accounting_client *client = surface->client;
+
+	struct held_commit *held, *tmp;
+	wl_list_for_each_safe(held, tmp, &client->held, link) {
+		if (held->surface == surface) {
+			// The cached states are destroyed with the surface
+			wl_list_remove(&held->link);
+			free(held);
+		}
+	}
+	client_update_held_timer(client);
+
+	client->shm_bytes -= surface->shm_bytes;
+	client->gpu_bytes -= surface->gpu_bytes;
+	client->surfaces--;
+
+	wlr_addon_finish(&surface->addon);
+	wl_list_remove(&surface->commit.link);
+	wl_list_remove(&surface->client_commit.link);
+	wl_list_remove(&surface->link);
+	free(surface);
+
+	if (client->surfaces == 0) {
+		client_destroy(client);
+	}
+}
+
+static void surface_addon_destroy(struct wlr_addon *addon) {
+	struct accounting_surface *surface =
+		wl_container_of(addon, surface, addon);
+	accounting_surface_destroy(surface);
+}
+
+static const struct wlr_addon_interface surface_addon_impl = {
+	.name = "wlr_client_accounting_surface",
+	.destroy = surface_addon_destroy,
+};
+
+static void surface_handle_client_commit(struct wl_listener *listener,
+		void *data) {
+	struct accounting_surface *surface =
+		wl_container_of(listener, surface, client_commit);
+	struct wlr_client_accounting_client *client = surface->client;
+	int64_t now = get_now_nsec();
+
+	client->commits++;
+	int64_t elapsed = now - client->window_start;
+	if (elapsed >= COMMIT_RATE_WINDOW_NSEC) {
+		client->commit_rate = elapsed < 2 * COMMIT_RATE_WINDOW_NSEC ?
+			client->window_commits : 0;
+		client->window_start = now;
+		client->window_commits = 0;
+	}
+	client->window_commits++;
+
+	int max_rate = client->accounting->limits.max_commit_rate;
+	if (max_rate <= 0) {
+		return;
+	}
+
+	// Each commit pushes the theoretical time of the next one by one
+	// interval. Commits ahead of it by more than the burst are held back.
+	int64_t interval = COMMIT_RATE_WINDOW_NSEC / max_rate;
+	int64_t next = client->next_commit > now ? client->next_commit : now;
+	client->next_commit = next + interval;
+	if (next - now <= COMMIT_BURST_NSEC && wl_list_empty(&client->held)) {
+		return;
+	}
+
+	if (client->held_timer == NULL) {
+		client->held_timer = wl_event_loop_add_timer(
+			client_get_event_loop(client), client_handle_held_timer, client);
+		if (client->held_timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create commit rate limit timer");
+			return;
+		}
+	}
+
+	struct held_commit *held = calloc(1, sizeof(*held));
+	if (held == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	held->surface = surface;
+	held->release = next - COMMIT_BURST_NSEC;
+	held->seq = wlr_surface_lock_pending(surface->surface);
+	wl_list_insert(client->held.prev, &held->link);
+	client->delayed_commits++;
+
+	client_update_held_timer(client);
+}
+
+static void surface_get_buffer_bytes(struct wlr_surface *surface,
+		size_t *shm_bytes, size_t *gpu_bytes) {
+	*shm_bytes = 0;
+	*gpu_bytes = 0;
+
+	struct wl_resource *resource = surface->current.buffer_resource;
+	if (resource == NULL || surface->buffer == NULL) {
+		return;
+	}
+
+	struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(resource);
+	if (shm_buffer != NULL) {
+		size_t height = wl_shm_buffer_get_height(shm_buffer);
+		*shm_bytes = (size_t)wl_shm_buffer_get_stride(shm_buffer) * height;
+		// Textures are assumed to use 4 bytes per pixel
+		*gpu_bytes = (size_t)wl_shm_buffer_get_width(shm_buffer) * height * 4;
+	} else if (wlr_dmabuf_v1_resource_is_buffer(resource)) {
+		struct wlr_dmabuf_v1_buffer *dmabuf =
+			wlr_dmabuf_v1_buffer_from_buffer_resource(resource);
+		const struct wlr_dmabuf_attributes *attribs = &dmabuf->attributes;
+		for (int i = 0; i < attribs->n_planes; i++) {
+			*gpu_bytes += (size_t)attribs->stride[i] * attribs->height;
+		}
+	} else {
+		*gpu_bytes = (size_t)surface->buffer->base.width *
+			surface->buffer->base.height * 4;
+	}
+}
+
+static uint64_t surface_get_uploaded_bytes(struct wlr_surface *surface) {
+	struct wl_resource *resource = surface->current.buffer_resource;
+	struct wl_shm_buffer *shm_buffer =
+		resource != NULL ? wl_shm_buffer_get(resource) : NULL;
+	if (shm_buffer == NULL || surface->buffer == NULL) {
+		return 0;
+	}
+
+	int32_t width = wl_shm_buffer_get_width(shm_buffer);
+	uint64_t bytes_per_pixel = width > 0 ?
+		wl_shm_buffer_get_stride(shm_buffer) / width : 0;
+
+	uint64_t area = 0;
+	int n_rects;
+	pixman_box32_t *rects =
+		pixman_region32_rectangles(&surface->buffer_damage, &n_rects);
+	for (int i = 0; i < n_rects; i++) {
+		area += (uint64_t)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+	}
+	return area * bytes_per_pixel;
+}
+
+static void surface_handle_commit(struct wl_listener *listener, void *data) {
+	struct accounting_surface *surface =
+		wl_container_of(listener, surface, commit);
+	struct wlr_client_accounting_client *client = surface->client;
+
+	if (!(surface->surface->current.committed & WLR_SURFACE_STATE_BUFFER)) {
+		return;
+	}
+
+	client->bytes_uploaded += surface_get_uploaded_bytes(surface->surface);
+
+	size_t shm_bytes, gpu_bytes;
+	surface_get_buffer_bytes(surface->surface, &shm_bytes, &gpu_bytes);
+	client->shm_bytes += shm_bytes - surface->shm_bytes;
+	client->gpu_bytes += gpu_bytes - surface->gpu_bytes;
+	surface->shm_bytes = shm_bytes;
+	surface->gpu_bytes = gpu_bytes;
+
+	client_check_limits(client);
+}
+
+static struct wlr_client_accounting_client *client_get_or_create(
+		struct wlr_client_accounting *accounting, struct wl_client *wl_client) {
+	struct wlr_client_accounting_client *client =
+		wlr_client_accounting_get_client(accounting, wl_client);
+	if (client != NULL) {
+		return client;
+	}
+
+	client = calloc(1, sizeof(*client));
+	if (client == NULL) {
+		return NULL;
+	}
+	client->accounting = accounting;
+	client->client = wl_client;
+	client->window_start = get_now_nsec();
+	wl_list_init(&client->surfaces_list);
+	wl_list_init(&client->held);
+	wl_list_insert(&accounting->clients, &client->link);
+	return client;
+}
+
+static void handle_compositor_new_surface(struct wl_listener *listener,
+		void *data) {
+	struct wlr_client_accounting *accounting =
+		wl_container_of(listener, accounting, compositor_new_surface);
+	struct wlr_surface *wlr_surface = data;
+
+	struct wlr_client_accounting_client *client = client_get_or_create(
+		accounting, wl_resource_get_client(wlr_surface->resource));
+	if (client == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+
+	struct accounting_surface *surface = calloc(1, sizeof(*surface));
+	if (surface == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		if (client->surfaces == 0) {
+			client_destroy(client);
+		}
+		return;
+	}
+	surface->client = client;
+	surface->surface = wlr_surface;
+	wl_list_insert(&client->surfaces_list, &surface->link);
+	client->surfaces++;
+
+	wlr_addon_init(&surface->addon, &wlr_surface->addons, accounting,
+		&surface_addon_impl);
+
+	surface->commit.notify = surface_handle_commit;
+	wl_signal_add(&wlr_surface->events.commit, &surface->commit);
+	surface->client_commit.notify = surface_handle_client_commit;
+	wl_signal_add(&wlr_surface->events.client_commit, &surface->client_commit);
+}
+
+static void handle_compositor_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_client_accounting *accounting =
+		wl_container_of(listener, accounting, compositor_destroy);
+	wlr_client_accounting_destroy(accounting);
+}
+
+struct wlr_client_accounting *wlr_client_accounting_create(
+		struct wlr_compositor *compositor) {
+	struct wlr_client_accounting *accounting = calloc(1, sizeof(*accounting));
+	if (accounting == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	wl_list_init(&accounting->clients);
+	wl_signal_init(&accounting->events.limit_exceeded);
+	wl_signal_init(&accounting->events.destroy);
+
+	accounting->compositor_new_surface.notify = handle_compositor_new_surface;
+	wl_signal_add(&compositor->events.new_surface,
+		&accounting->compositor_new_surface);
+	accounting->compositor_destroy.notify = handle_compositor_destroy;
+	wl_signal_add(&compositor->events.destroy,
+		&accounting->compositor_destroy);
+
+	return accounting;
+}
+
+void wlr_client_accounting_destroy(struct wlr_client_accounting *accounting) {
+	if (accounting == NULL) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&accounting->events.destroy, accounting);
+
+	wl_list_remove(&accounting->compositor_new_surface.link);
+	wl_list_remove(&accounting->compositor_destroy.link);
+
+	// Held commits are applied right away, surfaces would be stuck otherwise
+	while (!wl_list_empty(&accounting->clients)) {
+		struct wlr_client_accounting_client *client =
+			wl_container_of(accounting->clients.next, client, link);
+		while (!wl_list_empty(&client->held)) {
+			struct held_commit *held =
+				wl_container_of(client->held.next, held, link);
+			held_commit_release(held);
+		}
+		// Destroying the last surface destroys the client
+		for (size_t n = client->surfaces; n > 0; n--) {
+			struct accounting_surface *surface = wl_container_of(
+				client->surfaces_list.next, surface, link);
+			accounting_surface_destroy(surface);
+		}
+	}
+
+	free(accounting);
+}
+
+void wlr_client_accounting_set_limits(struct wlr_client_accounting *accounting,
+		const struct wlr_client_accounting_limits *limits) {
+	accounting->limits = *limits;
+
+	struct wlr_client_accounting_client *client;
+	wl_list_for_each(client, &accounting->clients, link) {
+		client->next_commit = 0;
+		client_check_limits(client);
+	}
+}
+
+struct wlr_client_accounting_client *wlr_client_accounting_get_client(
+		struct wlr_client_accounting *accounting, struct wl_client *wl_client) {
+	struct wlr_client_accounting_client *client;
+	wl_list_for_each(client, &accounting->clients, link) {
+		if (client->client == wl_client) {
+			return client;
+		}
+	}
+	return NULL;
+}
@@ -20,6 +20,10 @@ struct wlr_cursor_device {
 	struct wlr_output *mapped_output;
 	struct wlr_box *mapped_box;
 
+	// Relative motion accumulated while coalescing
+	bool motion_pending;
+	struct wlr_event_pointer_motion pending_motion;
+
 	struct wl_listener motion;
 	struct wl_listener motion_absolute;
 	struct wl_listener button;
@@ -36,6 +40,7 @@ struct wlr_cursor_device {
 	struct wl_listener touch_up;
 	struct wl_listener touch_motion;
 	struct wl_listener touch_cancel;
+	struct wl_listener touch_frame;
 
 	struct wl_listener tablet_tool_axis;
 	struct wl_listener tablet_tool_proximity;
@@ -60,6 +65,7 @@ struct wlr_cursor_state {
 	struct wlr_output_layout *layout;
 	struct wlr_output *mapped_output;
 	struct wlr_box *mapped_box;
+	bool coalesce_motion;
 
 	struct wl_listener layout_add;
 	struct wl_listener layout_change;
@@ -104,6 +110,7 @@ struct wlr_cursor *wlr_cursor_create(void) {
 	wl_signal_init(&cur->events.touch_down);
 	wl_signal_init(&cur->events.touch_motion);
 	wl_signal_init(&cur->events.touch_cancel);
+	wl_signal_init(&cur->events.touch_frame);
 
 	// tablet tool signals
 	wl_signal_init(&cur->events.tablet_tool_tip);
@@ -162,6 +169,7 @@ static void cursor_device_destroy(struct wlr_cursor_device *c_device) {
 		wl_list_remove(&c_device->touch_up.link);
 		wl_list_remove(&c_device->touch_motion.link);
 		wl_list_remove(&c_device->touch_cancel.link);
+		wl_list_remove(&c_device->touch_frame.link);
 	} else if (dev->type == WLR_INPUT_DEVICE_TABLET_TOOL) {
 		wl_list_remove(&c_device->tablet_tool_axis.link);
 		wl_list_remove(&c_device->tablet_tool_proximity.link);
@@ -351,11 +359,61 @@ void wlr_cursor_set_surface(struct wlr_cursor *cur, struct wlr_surface *surface,
 	}
 }
 
+/**
+ * Emit the motion accumulated so far on a device, followed by the frame the
+ * coalesced motion events were swallowed with.
+ */
+static void device_flush_motion(struct wlr_cursor_device *device) {
+	if (!device->motion_pending) {
+		return;
+	}
+	device->motion_pending = false;
+	// The device may be detached by a motion listener
+	struct wlr_cursor *cursor = device->cursor;
+	struct wlr_event_pointer_motion event = device->pending_motion;
+	wlr_signal_emit_safe(&cursor->events.motion, &event);
+	wlr_signal_emit_safe(&cursor->events.frame, cursor);
+}
+
 static void handle_pointer_motion(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_motion *event = data;
 	struct wlr_cursor_device *device =
 		wl_container_of(listener, device, motion);
-	wlr_signal_emit_safe(&device->cursor->events.motion, event);
+
+	if (!device->cursor->state->coalesce_motion) {
+		wlr_signal_emit_safe(&device->cursor->events.motion, event);
+		return;
+	}
+
+	struct wlr_event_pointer_motion *pending = &device->pending_motion;
+	if (!device->motion_pending) {
+		*pending = *event;
+		device->motion_pending = true;
+		return;
+	}
+	// Unaccelerated deltas are summed too, for relative pointer clients
+	pending->time_msec = event->time_msec;
+	pending->delta_x += event->delta_x;
+	pending->delta_y += event->delta_y;
+	pending->unaccel_dx += event->unaccel_dx;
+	pending->unaccel_dy += event->unaccel_dy;
+}
+
+void wlr_cursor_set_motion_coalescing(struct wlr_cursor *cur, bool enabled) {
+	if (cur->state->coalesce_motion == enabled) {
+		return;
+	}
+	cur->state->coalesce_motion = enabled;
+	if (!enabled) {
+		wlr_cursor_flush_motion(cur);
+	}
+}
+
+void wlr_cursor_flush_motion(struct wlr_cursor *cur) {
+	struct wlr_cursor_device *device, *tmp;
+	wl_list_for_each_safe(device, tmp, &cur->state->devices, link) {
+		device_flush_motion(device);
+	}
 }
 
 static void apply_output_transform(double *x, double *y,
@@ -421,6 +479,7 @@ static void handle_pointer_motion_absolute(struct wl_listener *listener,
 	struct wlr_event_pointer_motion_absolute *event = data;
 	struct wlr_cursor_device *device =
 		wl_container_of(listener, device, motion_absolute);
+	device_flush_motion(device);
 
 	struct wlr_output *output =
 		get_mapped_output(device);
@@ -434,53 +493,65 @@ static void handle_pointer_button(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_button *event = data;
 	struct wlr_cursor_device *device =
 		wl_container_of(listener, device, button);
+	device_flush_motion(device);
 	wlr_signal_emit_safe(&device->cursor->events.button, event);
 }
 
 static void handle_pointer_axis(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_axis *event = data;
 	struct wlr_cursor_device *device = wl_container_of(listener, device, axis);
+	device_flush_motion(device);
 	wlr_signal_emit_safe(&device->cursor->events.axis, event);
 }
 
 static void handle_pointer_frame(struct wl_listener *listener, void *data) {
 	struct wlr_cursor_device *device = wl_container_of(listener, device, frame);
+	if (device->motion_pending) {
+		// Sent along with the coalesced motion
+		return;
+	}
 	wlr_signal_emit_safe(&device->cursor->events.frame, device->cursor);
 }
 
 static void handle_pointer_swipe_begin(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_swipe_begin *event = data;
 	struct wlr_cursor_device *device = wl_container_of(listener, device, swipe_begin);
+	device_flush_motion(device);
 	wlr_signal_emit_safe(&device->cursor->events.swipe_begin, event);
 }
 
 static void handle_pointer_swipe_update(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_swipe_update *event = data;
 	struct wlr_cursor_device *device = wl_container_of(listener, device, swipe_update);
+	device_flush_motion(device);
 	wlr_signal_emit_safe(&device->cursor->events.swipe_update, event);
 }
 
 static void handle_pointer_swipe_end(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_swipe_end *event = data;
 	struct wlr_cursor_device *device = wl_container_of(listener, device, swipe_end);
+	device_flush_motion(device);
 	wlr_signal_emit_safe(&device->cursor->events.swipe_end, event);
 }
 
 static void handle_pointer_pinch_begin(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_pinch_begin *event = data;
 	struct wlr_cursor_device *device = wl_container_of(listener, device, pinch_begin);
+	device_flush_motion(device);
 	wlr_signal_emit_safe(&device->cursor->events.pinch_begin, event);
 }
 
 static void handle_pointer_pinch_update(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_pinch_update *event = data;
 	struct wlr_cursor_device *device = wl_container_of(listener, device, pinch_update);
+	device_flush_motion(device);
 	wlr_signal_emit_safe(&device->cursor->events.pinch_update, event);
 }
 
 static void handle_pointer_pinch_end(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_pinch_end *event = data;
 	struct wlr_cursor_device *device = wl_container_of(listener, device, pinch_end);
+	device_flush_motion(device);
 	wlr_signal_emit_safe(&device->cursor->events.pinch_end, event);
 }
 
@@ -524,6 +595,12 @@ static void handle_touch_cancel(struct wl_listener *listener, void *data) {
 	wlr_signal_emit_safe(&device->cursor->events.touch_cancel, event);
 }
 
+static void handle_touch_frame(struct wl_listener *listener, void *data) {
+	struct wlr_cursor_device *device;
+	device = wl_container_of(listener, device, touch_frame);
+	wlr_signal_emit_safe(&device->cursor->events.touch_frame, NULL);
+}
+
 static void handle_tablet_tool_tip(struct wl_listener *listener, void *data) {
 	struct wlr_event_tablet_tool_tip *event = data;
 	struct wlr_cursor_device *device;
@@ -662,6 +739,9 @@ static struct wlr_cursor_device *cursor_device_create(
 
 		wl_signal_add(&device->touch->events.cancel, &c_device->touch_cancel);
 		c_device->touch_cancel.notify = handle_touch_cancel;
+
+		wl_signal_add(&device->touch->events.frame, &c_device->touch_frame);
+		c_device->touch_frame.notify = handle_touch_frame;
 	} else if (device->type == WLR_INPUT_DEVICE_TABLET_TOOL) {
 		wl_signal_add(&device->tablet->events.tip,
 			&c_device->tablet_tool_tip);
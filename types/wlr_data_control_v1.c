@@ -7,6 +7,7 @@
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_primary_selection.h>
 #include <wlr/util/log.h>
+#include "types/wlr_selection_cache.h"
 #include "util/signal.h"
 #include "wlr-data-control-unstable-v1-protocol.h"
 
@@ -237,6 +238,16 @@ static struct data_offer *data_offer_from_offer_resource(
 	return wl_resource_get_user_data(resource);
 }
 
+static void cache_send_selection(void *source, const char *mime_type,
+		int fd) {
+	wlr_data_source_send(source, mime_type, fd);
+}
+
+static void cache_send_primary_selection(void *source, const char *mime_type,
+		int fd) {
+	wlr_primary_selection_source_send(source, mime_type, fd);
+}
+
 static void offer_handle_receive(struct wl_client *client,
 		struct wl_resource *resource, const char *mime_type, int fd) {
 	struct data_offer *offer = data_offer_from_offer_resource(resource);
@@ -256,15 +267,17 @@ static void offer_handle_receive(struct wl_client *client,
 			close(fd);
 			return;
 		}
-		wlr_primary_selection_source_send(
+		selection_cache_receive(device->primary_selection_cache,
 			device->seat->primary_selection_source,
-			mime_type, fd);
+			cache_send_primary_selection, mime_type, fd);
 	} else {
 		if (device->seat->selection_source == NULL) {
 			close(fd);
 			return;
 		}
-		wlr_data_source_send(device->seat->selection_source, mime_type, fd);
+		selection_cache_receive(device->selection_cache,
+			device->seat->selection_source, cache_send_selection,
+			mime_type, fd);
 	}
 }
 
@@ -517,6 +530,7 @@ static void control_handle_seat_set_selection(struct wl_listener *listener,
 		void *data) {
 	struct wlr_data_control_device_v1 *device =
 		wl_container_of(listener, device, seat_set_selection);
+	selection_cache_reset(device->selection_cache);
 	control_send_selection(device);
 }
 
@@ -525,6 +539,7 @@ static void control_handle_seat_set_primary_selection(
 		void *data) {
 	struct wlr_data_control_device_v1 *device =
 		wl_container_of(listener, device, seat_set_primary_selection);
+	selection_cache_reset(device->primary_selection_cache);
 	control_send_primary_selection(device);
 }
 
@@ -549,6 +564,10 @@ void wlr_data_control_device_v1_destroy(struct wlr_data_control_device_v1 *devic
 	wl_list_remove(&device->seat_set_selection.link);
 	wl_list_remove(&device->seat_set_primary_selection.link);
 	wl_list_remove(&device->link);
+	selection_cache_finish(device->selection_cache);
+	selection_cache_finish(device->primary_selection_cache);
+	free(device->selection_cache);
+	free(device->primary_selection_cache);
 	free(device);
 }
 
@@ -603,13 +622,25 @@ static void manager_handle_get_data_device(struct wl_client *client,
 	device->manager = manager;
 	device->seat = seat_client->seat;
 
+	device->selection_cache = calloc(1, sizeof(*device->selection_cache));
+	device->primary_selection_cache =
+		calloc(1, sizeof(*device->primary_selection_cache));
+	if (device->selection_cache == NULL ||
+			device->primary_selection_cache == NULL) {
+		wl_resource_post_no_memory(manager_resource);
+		goto error_device;
+	}
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(wl_client_get_display(client));
+	selection_cache_init(device->selection_cache, loop);
+	selection_cache_init(device->primary_selection_cache, loop);
+
 	uint32_t version = wl_resource_get_version(manager_resource);
 	device->resource = wl_resource_create(client,
 		&zwlr_data_control_device_v1_interface, version, id);
 	if (device->resource == NULL) {
 		wl_resource_post_no_memory(manager_resource);
-		free(device);
-		return;
+		goto error_device;
 	}
 	wl_resource_set_implementation(device->resource, &control_impl, device,
 		control_handle_resource_destroy);
@@ -637,6 +668,12 @@ static void manager_handle_get_data_device(struct wl_client *client,
 		control_send_selection(device);
 		control_send_primary_selection(device);
 	}
+	return;
+
+error_device:
+	free(device->selection_cache);
+	free(device->primary_selection_cache);
+	free(device);
 }
 
 static void manager_handle_destroy(struct wl_client *client,
@@ -0,0 +1,752 @@
+#define _POSIX_C_SOURCE 200809L
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_event_recorder.h>
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_stats.h>
+#include <wlr/types/wlr_pointer.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/log.h>
+#include "util/signal.h"
+#include "util/time.h"
+
+/*
+ * Recordings are text files with one event per line. The first word is the
+ * event type, followed by the time in microseconds since the start of the
+ * recording and the event fields:
+ *
+ *   device <id> <keyboard|pointer>
+ *   motion <time> <device> <dx> <dy> <unaccel_dx> <unaccel_dy>
+ *   motion_absolute <time> <device> <x> <y>
+ *   button <time> <device> <button> <state>
+ *   axis <time> <device> <source> <orientation> <delta> <delta_discrete>
+ *   frame <time> <device>
+ *   key <time> <device> <keycode> <state>
+ *   commit <time> <pid> <surface> <buffer> <width> <height>
+ *
+ * Device lines have no time, they come before the device's first event.
+ */
+
+#define RECORDING_HEADER "# wlroots event recording v1"
+
+static int64_t get_now_nsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_nsec(&now);
+}
+
+struct recorder_device {
+	struct wlr_event_recorder *recorder;
+	struct wlr_input_device *device;
+	int id;
+	struct wl_list link; // wlr_event_recorder.devices
+
+	struct wl_listener destroy;
+	struct wl_listener motion;
+	struct wl_listener motion_absolute;
+	struct wl_listener button;
+	struct wl_listener axis;
+	struct wl_listener frame;
+	struct wl_listener key;
+};
+
+struct recorder_surface {
+	struct wlr_event_recorder *recorder;
+	struct wlr_surface *surface;
+	struct wl_list link; // wlr_event_recorder.surfaces
+
+	struct wl_listener client_commit;
+	struct wl_listener destroy;
+};
+
+static int64_t recorder_get_time(struct wlr_event_recorder *recorder) {
+	return (get_now_nsec() - recorder->start_nsec) / 1000;
+}
+
+static void recorder_device_destroy(struct recorder_device *device) {
+	wl_list_remove(&device->destroy.link);
+	wl_list_remove(&device->motion.link);
+	wl_list_remove(&device->motion_absolute.link);
+	wl_list_remove(&device->button.link);
+	wl_list_remove(&device->axis.link);
+	wl_list_remove(&device->frame.link);
+	wl_list_remove(&device->key.link);
+	wl_list_remove(&device->link);
+	free(device);
+}
+
+static void device_handle_destroy(struct wl_listener *listener, void *data) {
+	struct recorder_device *device =
+		wl_container_of(listener, device, destroy);
+	recorder_device_destroy(device);
+}
+
+static void device_handle_motion(struct wl_listener *listener, void *data) {
+	struct recorder_device *device = wl_container_of(listener, device, motion);
+	struct wlr_event_pointer_motion *event = data;
+	struct wlr_event_recorder *recorder = device->recorder;
+	fprintf(recorder->file, "motion %"PRId64" %d %.17g %.17g %.17g %.17g\n",
+		recorder_get_time(recorder), device->id, event->delta_x,
+		event->delta_y, event->unaccel_dx, event->unaccel_dy);
+	recorder->events++;
+}
+
+static void device_handle_motion_absolute(struct wl_listener *listener,
+		void *data) {
+	struct recorder_device *device =
+		wl_container_of(listener, device, motion_absolute);
+	struct wlr_event_pointer_motion_absolute *event = data;
+	struct wlr_event_recorder *recorder = device->recorder;
+	fprintf(recorder->file, "motion_absolute %"PRId64" %d %.17g %.17g\n",
+		recorder_get_time(recorder), device->id, event->x, event->y);
+	recorder->events++;
+}
+
+static void device_handle_button(struct wl_listener *listener, void *data) {
+	struct recorder_device *device = wl_container_of(listener, device, button);
+	struct wlr_event_pointer_button *event = data;
+	struct wlr_event_recorder *recorder = device->recorder;
+	fprintf(recorder->file, "button %"PRId64" %d %"PRIu32" %d\n",
+		recorder_get_time(recorder), device->id, event->button,
+		(int)event->state);
+	recorder->events++;
+}
+
+static void device_handle_axis(struct wl_listener *listener, void *data) {
+	struct recorder_device *device = wl_container_of(listener, device, axis);
+	struct wlr_event_pointer_axis *event = data;
+	struct wlr_event_recorder *recorder = device->recorder;
+	fprintf(recorder->file, "axis %"PRId64" %d %d %d %.17g %"PRId32"\n",
+		recorder_get_time(recorder), device->id, (int)event->source,
+		(int)event->orientation, event->delta, event->delta_discrete);
+	recorder->events++;
+}
+
+static void device_handle_frame(struct wl_listener *listener, void *data) {
+	struct recorder_device *device = wl_container_of(listener, device, frame);
+	struct wlr_event_recorder *recorder = device->recorder;
+	fprintf(recorder->file, "frame %"PRId64" %d\n",
+		recorder_get_time(recorder), device->id);
+	recorder->events++;
+}
+
+static void device_handle_key(struct wl_listener *listener, void *data) {
+	struct recorder_device *device = wl_container_of(listener, device, key);
+	struct wlr_event_keyboard_key *event = data;
+	struct wlr_event_recorder *recorder = device->recorder;
+	fprintf(recorder->file, "key %"PRId64" %d %"PRIu32" %d\n",
+		recorder_get_time(recorder), device->id, event->keycode,
+		(int)event->state);
+	recorder->events++;
+}
+
+static void recorder_handle_new_input(struct wl_listener *listener,
+		void *data) {
+	struct wlr_event_recorder *recorder =
+		wl_container_of(listener, recorder, backend_new_input);
+	struct wlr_input_device *wlr_device = data;
+
+	const char *type;
+	switch (wlr_device->type) {
+	case WLR_INPUT_DEVICE_KEYBOARD:
+		type = "keyboard";
+		break;
+	case WLR_INPUT_DEVICE_POINTER:
+		type = "pointer";
+		break;
+	default:
+		return;
+	}
+
+	struct recorder_device *device = calloc(1, sizeof(*device));
+	if (device == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	device->recorder = recorder;
+	device->device = wlr_device;
+	device->id = recorder->next_device_id++;
+	wl_list_insert(&recorder->devices, &device->link);
+
+	device->destroy.notify = device_handle_destroy;
+	wl_signal_add(&wlr_device->events.destroy, &device->destroy);
+
+	wl_list_init(&device->motion.link);
+	wl_list_init(&device->motion_absolute.link);
+	wl_list_init(&device->button.link);
+	wl_list_init(&device->axis.link);
+	wl_list_init(&device->frame.link);
+	wl_list_init(&device->key.link);
+	if (wlr_device->type == WLR_INPUT_DEVICE_POINTER) {
+		struct wlr_pointer *pointer = wlr_device->pointer;
+		device->motion.notify = device_handle_motion;
+		wl_signal_add(&pointer->events.motion, &device->motion);
+		device->motion_absolute.notify = device_handle_motion_absolute;
+		wl_signal_add(&pointer->events.motion_absolute,
+			&device->motion_absolute);
+		device->button.notify = device_handle_button;
+		wl_signal_add(&pointer->events.button, &device->button);
+		device->axis.notify = device_handle_axis;
+		wl_signal_add(&pointer->events.axis, &device->axis);
+		device->frame.notify = device_handle_frame;
+		wl_signal_add(&pointer->events.frame, &device->frame);
+	} else {
+		device->key.notify = device_handle_key;
+		wl_signal_add(&wlr_device->keyboard->events.key, &device->key);
+	}
+
+	fprintf(recorder->file, "device %d %s\n", device->id, type);
+}
+
+static void recorder_surface_destroy(struct recorder_surface *surface) {
+	wl_list_remove(&surface->client_commit.link);
+	wl_list_remove(&surface->destroy.link);
+	wl_list_remove(&surface->link);
+	free(surface);
+}
+
+static void surface_handle_client_commit(struct wl_listener *listener,
+		void *data) {
+	struct recorder_surface *surface =
+		wl_container_of(listener, surface, client_commit);
+	struct wlr_event_recorder *recorder = surface->recorder;
+	struct wlr_surface *wlr_surface = surface->surface;
+
+	pid_t pid = 0;
+	wl_client_get_credentials(wl_resource_get_client(wlr_surface->resource),
+		&pid, NULL, NULL);
+	bool buffer = (wlr_surface->pending.committed & WLR_SURFACE_STATE_BUFFER) &&
+		wlr_surface->pending.buffer_resource != NULL;
+	fprintf(recorder->file, "commit %"PRId64" %d %"PRIu32" %d %d %d\n",
+		recorder_get_time(recorder), (int)pid,
+		wl_resource_get_id(wlr_surface->resource), buffer,
+		buffer ? wlr_surface->pending.buffer_width : 0,
+		buffer ? wlr_surface->pending.buffer_height : 0);
+	recorder->events++;
+}
+
+static void surface_handle_destroy(struct wl_listener *listener, void *data) {
+	struct recorder_surface *surface =
+		wl_container_of(listener, surface, destroy);
+	recorder_surface_destroy(surface);
+}
+
+static void recorder_handle_new_surface(struct wl_listener *listener,
+		void *data) {
+	struct wlr_event_recorder *recorder =
+		wl_container_of(listener, recorder, compositor_new_surface);
+	struct wlr_surface *wlr_surface = data;
+
+	struct recorder_surface *surface = calloc(1, sizeof(*surface));
+	if (surface == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	surface->recorder = recorder;
+	surface->surface = wlr_surface;
+	wl_list_insert(&recorder->surfaces, &surface->link);
+
+	surface->client_commit.notify = surface_handle_client_commit;
+	wl_signal_add(&wlr_surface->events.client_commit, &surface->client_commit);
+	surface->destroy.notify = surface_handle_destroy;
+	wl_signal_add(&wlr_surface->events.destroy, &surface->destroy);
+}
+
+static void recorder_handle_compositor_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_event_recorder *recorder =
+		wl_container_of(listener, recorder, compositor_destroy);
+	struct recorder_surface *surface, *tmp;
+	wl_list_for_each_safe(surface, tmp, &recorder->surfaces, link) {
+		recorder_surface_destroy(surface);
+	}
+	wl_list_remove(&recorder->compositor_new_surface.link);
+	wl_list_remove(&recorder->compositor_destroy.link);
+	wl_list_init(&recorder->compositor_new_surface.link);
+	wl_list_init(&recorder->compositor_destroy.link);
+}
+
+static void recorder_handle_backend_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_event_recorder *recorder =
+		wl_container_of(listener, recorder, backend_destroy);
+	wlr_event_recorder_destroy(recorder);
+}
+
+struct wlr_event_recorder *wlr_event_recorder_create(
+		struct wlr_backend *backend, struct wlr_compositor *compositor,
+		FILE *file) {
+	struct wlr_event_recorder *recorder = calloc(1, sizeof(*recorder));
+	if (recorder == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	recorder->file = file;
+	recorder->start_nsec = get_now_nsec();
+	wl_list_init(&recorder->devices);
+	wl_list_init(&recorder->surfaces);
+
+	fprintf(file, "%s\n", RECORDING_HEADER);
+
+	recorder->backend_new_input.notify = recorder_handle_new_input;
+	wl_signal_add(&backend->events.new_input, &recorder->backend_new_input);
+	recorder->backend_destroy.notify = recorder_handle_backend_destroy;
+	wl_signal_add(&backend->events.destroy, &recorder->backend_destroy);
+
+	wl_list_init(&recorder->compositor_new_surface.link);
+	wl_list_init(&recorder->compositor_destroy.link);
+	if (compositor != NULL) {
+		recorder->compositor_new_surface.notify = recorder_handle_new_surface;
+		wl_signal_add(&compositor->events.new_surface,
+			&recorder->compositor_new_surface);
+		recorder->compositor_destroy.notify =
+			recorder_handle_compositor_destroy;
+		wl_signal_add(&compositor->events.destroy,
+			&recorder->compositor_destroy);
+	}
+
+	return recorder;
+}
+
+void wlr_event_recorder_destroy(struct wlr_event_recorder *recorder) {
+	if (recorder == NULL) {
+		return;
+	}
+
+	struct recorder_device *device, *device_tmp;
+	wl_list_for_each_safe(device, device_tmp, &recorder->devices, link) {
+		recorder_device_destroy(device);
+	}
+	struct recorder_surface *surface, *surface_tmp;
+	wl_list_for_each_safe(surface, surface_tmp, &recorder->surfaces, link) {
+		recorder_surface_destroy(surface);
+	}
+
+	fflush(recorder->file);
+
+	wl_list_remove(&recorder->backend_new_input.link);
+	wl_list_remove(&recorder->backend_destroy.link);
+	wl_list_remove(&recorder->compositor_new_surface.link);
+	wl_list_remove(&recorder->compositor_destroy.link);
+	free(recorder);
+}
+
+enum replay_record_type {
+	RECORD_MOTION,
+	RECORD_MOTION_ABSOLUTE,
+	RECORD_BUTTON,
+	RECORD_AXIS,
+	RECORD_FRAME,
+	RECORD_KEY,
+	RECORD_COMMIT,
+};
+
+struct replay_record {
+	enum replay_record_type type;
+	int64_t time_usec;
+	int device;
+	union {
+		struct {
+			double dx, dy, unaccel_dx, unaccel_dy;
+		} motion;
+		struct {
+			double x, y;
+		} motion_absolute;
+		struct {
+			uint32_t button;
+			int state;
+		} button;
+		struct {
+			int source, orientation;
+			double delta;
+			int32_t delta_discrete;
+		} axis;
+		struct {
+			uint32_t keycode;
+			int state;
+		} key;
+		struct wlr_event_replay_commit commit;
+	};
+};
+
+struct replay_output {
+	struct wlr_output_stats *stats;
+	struct wl_list link; // wlr_event_replay.outputs
+
+	struct wl_listener stats_destroy;
+};
+
+static bool replay_add_device(struct wlr_event_replay *replay, int id,
+		const char *type) {
+	size_t len = replay->devices.size / sizeof(struct wlr_input_device *);
+	if (id < 0 || (size_t)id != len) {
+		return false;
+	}
+
+	enum wlr_input_device_type device_type;
+	if (strcmp(type, "keyboard") == 0) {
+		device_type = WLR_INPUT_DEVICE_KEYBOARD;
+	} else if (strcmp(type, "pointer") == 0) {
+		device_type = WLR_INPUT_DEVICE_POINTER;
+	} else {
+		return false;
+	}
+
+	struct wlr_input_device **device_ptr =
+		wl_array_add(&replay->devices, sizeof(*device_ptr));
+	if (device_ptr == NULL) {
+		return false;
+	}
+	*device_ptr = wlr_headless_add_input_device(replay->backend, device_type);
+	return *device_ptr != NULL;
+}
+
+static bool replay_parse_line(struct wlr_event_replay *replay,
+		const char *line) {
+	char type[32];
+	int n = 0;
+	if (sscanf(line, "%31s %n", type, &n) != 1) {
+		return true; // empty line
+	}
+	const char *args = line + n;
+
+	if (type[0] == '#') {
+		return true;
+	} else if (strcmp(type, "device") == 0) {
+		int id;
+		char device_type[32];
+		return sscanf(args, "%d %31s", &id, device_type) == 2 &&
+			replay_add_device(replay, id, device_type);
+	}
+
+	struct replay_record record = {0};
+	bool ok;
+	if (strcmp(type, "motion") == 0) {
+		record.type = RECORD_MOTION;
+		ok = sscanf(args, "%"SCNd64" %d %lf %lf %lf %lf", &record.time_usec,
+			&record.device, &record.motion.dx, &record.motion.dy,
+			&record.motion.unaccel_dx, &record.motion.unaccel_dy) == 6;
+	} else if (strcmp(type, "motion_absolute") == 0) {
+		record.type = RECORD_MOTION_ABSOLUTE;
+		ok = sscanf(args, "%"SCNd64" %d %lf %lf", &record.time_usec,
+			&record.device, &record.motion_absolute.x,
+			&record.motion_absolute.y) == 4;
+	} else if (strcmp(type, "button") == 0) {
+		record.type = RECORD_BUTTON;
+		ok = sscanf(args, "%"SCNd64" %d %"SCNu32" %d", &record.time_usec,
+			&record.device, &record.button.button,
+			&record.button.state) == 4;
+	} else if (strcmp(type, "axis") == 0) {
+		record.type = RECORD_AXIS;
+		ok = sscanf(args, "%"SCNd64" %d %d %d %lf %"SCNd32,
+			&record.time_usec, &record.device, &record.axis.source,
+			&record.axis.orientation, &record.axis.delta,
+			&record.axis.delta_discrete) == 6;
+	} else if (strcmp(type, "frame") == 0) {
+		record.type = RECORD_FRAME;
+		ok = sscanf(args, "%"SCNd64" %d", &record.time_usec,
+			&record.device) == 2;
+	} else if (strcmp(type, "key") == 0) {
+		record.type = RECORD_KEY;
+		ok = sscanf(args, "%"SCNd64" %d %"SCNu32" %d", &record.time_usec,
+			&record.device, &record.key.keycode, &record.key.state) == 4;
+	} else if (strcmp(type, "commit") == 0) {
+		record.type = RECORD_COMMIT;
+		int buffer;
+		struct wlr_event_replay_commit *commit = &record.commit;
+		ok = sscanf(args, "%"SCNd64" %"SCNd32" %"SCNu32" %d %"SCNd32" %"SCNd32,
+			&record.time_usec, &commit->pid, &commit->surface_id, &buffer,
+			&commit->width, &commit->height) == 6;
+		commit->time_usec = record.time_usec;
+		commit->buffer = buffer != 0;
+	} else {
+		wlr_log(WLR_DEBUG, "Skipping unknown recorded event '%s'", type);
+		return true;
+	}
+	if (!ok) {
+		return false;
+	}
+
+	// Devices are declared before their first event
+	size_t devices_len =
+		replay->devices.size / sizeof(struct wlr_input_device *);
+	if (record.type != RECORD_COMMIT &&
+			(record.device < 0 || (size_t)record.device >= devices_len)) {
+		return false;
+	}
+
+	struct replay_record *ptr =
+		wl_array_add(&replay->records, sizeof(record));
+	if (ptr == NULL) {
+		return false;
+	}
+	*ptr = record;
+	return true;
+}
+
+static void replay_emit(struct wlr_event_replay *replay,
+		const struct replay_record *record) {
+	if (record->type == RECORD_COMMIT) {
+		wlr_signal_emit_safe(&replay->events.commit,
+			(void *)&record->commit);
+		return;
+	}
+
+	struct wlr_input_device **devices = replay->devices.data;
+	struct wlr_input_device *device = devices[record->device];
+	uint32_t time_msec = get_current_time_msec();
+
+	if (record->type == RECORD_KEY) {
+		if (device->type != WLR_INPUT_DEVICE_KEYBOARD) {
+			return;
+		}
+		struct wlr_event_keyboard_key event = {
+			.time_msec = time_msec,
+			.keycode = record->key.keycode,
+			.update_state = true,
+			.state = record->key.state,
+		};
+		wlr_keyboard_notify_key(device->keyboard, &event);
+		return;
+	}
+
+	if (device->type != WLR_INPUT_DEVICE_POINTER) {
+		return;
+	}
+	struct wlr_pointer *pointer = device->pointer;
+	switch (record->type) {
+	case RECORD_MOTION:;
+		struct wlr_event_pointer_motion motion = {
+			.device = device,
+			.time_msec = time_msec,
+			.delta_x = record->motion.dx,
+			.delta_y = record->motion.dy,
+			.unaccel_dx = record->motion.unaccel_dx,
+			.unaccel_dy = record->motion.unaccel_dy,
+		};
+		wlr_signal_emit_safe(&pointer->events.motion, &motion);
+		break;
+	case RECORD_MOTION_ABSOLUTE:;
+		struct wlr_event_pointer_motion_absolute motion_absolute = {
+			.device = device,
+			.time_msec = time_msec,
+			.x = record->motion_absolute.x,
+			.y = record->motion_absolute.y,
+		};
+		wlr_signal_emit_safe(&pointer->events.motion_absolute,
+			&motion_absolute);
+		break;
+	case RECORD_BUTTON:;
+		struct wlr_event_pointer_button button = {
+			.device = device,
+			.time_msec = time_msec,
+			.button = record->button.button,
+			.state = record->button.state,
+		};
+		wlr_signal_emit_safe(&pointer->events.button, &button);
+		break;
+	case RECORD_AXIS:;
+		struct wlr_event_pointer_axis axis = {
+			.device = device,
+			.time_msec = time_msec,
+			.source = record->axis.source,
+			.orientation = record->axis.orientation,
+			.delta = record->axis.delta,
+			.delta_discrete = record->axis.delta_discrete,
+		};
+		wlr_signal_emit_safe(&pointer->events.axis, &axis);
+		break;
+	case RECORD_FRAME:
+		wlr_signal_emit_safe(&pointer->events.frame, pointer);
+		break;
+	case RECORD_KEY:
+	case RECORD_COMMIT:
+		abort(); // handled above
+	}
+}
+
+static void replay_report(struct wlr_event_replay *replay) {
+	struct replay_output *replay_output;
+	wl_list_for_each(replay_output, &replay->outputs, link) {
+		struct wlr_output_stats *stats = replay_output->stats;
+		wlr_log(WLR_INFO, "Replay on output %s: %"PRIu64" frames presented, "
+			"%"PRIu64" dropped, %"PRIu64" late (%"PRIu64" missed vblanks); "
+			"commit to present p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, "
+			"max %.2f ms", stats->output->name, stats->presented,
+			stats->dropped, stats->late, stats->missed_vblanks,
+			wlr_output_stats_get_latency_percentile(stats, 50) / 1000.0,
+			wlr_output_stats_get_latency_percentile(stats, 90) / 1000.0,
+			wlr_output_stats_get_latency_percentile(stats, 99) / 1000.0,
+			stats->latency_max_usec / 1000.0);
+	}
+}
+
+static int replay_handle_timer(void *data) {
+	struct wlr_event_replay *replay = data;
+	struct replay_record *records = replay->records.data;
+	size_t records_len = replay->records.size / sizeof(*records);
+
+	int64_t now_usec = (get_now_nsec() - replay->start_nsec) / 1000;
+	while (replay->next_record < records_len &&
+			records[replay->next_record].time_usec <= now_usec) {
+		replay_emit(replay, &records[replay->next_record]);
+		replay->next_record++;
+	}
+
+	if (replay->next_record < records_len) {
+		int64_t delay = records[replay->next_record].time_usec - now_usec;
+		int delay_msec = (delay + 999) / 1000;
+		wl_event_source_timer_update(replay->timer,
+			delay_msec > 0 ? delay_msec : 1);
+		return 0;
+	}
+
+	replay_report(replay);
+	wlr_signal_emit_safe(&replay->events.done, replay);
+	return 0;
+}
+
+static void replay_handle_backend_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_event_replay *replay =
+		wl_container_of(listener, replay, backend_destroy);
+	wlr_event_replay_destroy(replay);
+}
+
+struct wlr_event_replay *wlr_event_replay_create(struct wlr_backend *backend,
+		struct wl_display *display, FILE *file) {
+	if (!wlr_backend_is_headless(backend)) {
+		wlr_log(WLR_ERROR, "Recordings can only be replayed on the "
+			"headless backend");
+		return NULL;
+	}
+
+	struct wlr_event_replay *replay = calloc(1, sizeof(*replay));
+	if (replay == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	replay->backend = backend;
+	replay->event_loop = wl_display_get_event_loop(display);
+	wl_array_init(&replay->devices);
+	wl_array_init(&replay->records);
+	wl_list_init(&replay->outputs);
+	wl_signal_init(&replay->events.commit);
+	wl_signal_init(&replay->events.done);
+	wl_signal_init(&replay->events.destroy);
+
+	char *line = NULL;
+	size_t line_size = 0;
+	size_t line_number = 0;
+	bool ok = true;
+	while (ok && getline(&line, &line_size, file) >= 0) {
+		line_number++;
+		if (line_number == 1 && strncmp(line, RECORDING_HEADER,
+				strlen(RECORDING_HEADER)) != 0) {
+			wlr_log(WLR_ERROR, "Not an event recording");
+			ok = false;
+			break;
+		}
+		ok = replay_parse_line(replay, line);
+		if (!ok) {
+			wlr_log(WLR_ERROR, "Invalid event recording at line %zu",
+				line_number);
+		}
+	}
+	free(line);
+	if (!ok || line_number == 0) {
+		wl_array_release(&replay->devices);
+		wl_array_release(&replay->records);
+		free(replay);
+		return NULL;
+	}
+
+	replay->backend_destroy.notify = replay_handle_backend_destroy;
+	wl_signal_add(&backend->events.destroy, &replay->backend_destroy);
+
+	return replay;
+}
+
+static void replay_output_destroy(struct replay_output *replay_output) {
+	wl_list_remove(&replay_output->stats_destroy.link);
+	wl_list_remove(&replay_output->link);
+	free(replay_output);
+}
+
+static void replay_output_handle_stats_destroy(struct wl_listener *listener,
+		void *data) {
+	struct replay_output *replay_output =
+		wl_container_of(listener, replay_output, stats_destroy);
+	replay_output_destroy(replay_output);
+}
+
+void wlr_event_replay_destroy(struct wlr_event_replay *replay) {
+	if (replay == NULL) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&replay->events.destroy, replay);
+
+	struct replay_output *replay_output, *tmp;
+	wl_list_for_each_safe(replay_output, tmp, &replay->outputs, link) {
+		struct wlr_output_stats *stats = replay_output->stats;
+		replay_output_destroy(replay_output);
+		wlr_output_stats_destroy(stats);
+	}
+
+	if (replay->timer != NULL) {
+		wl_event_source_remove(replay->timer);
+	}
+	// The input devices belong to the backend
+	wl_array_release(&replay->devices);
+	wl_array_release(&replay->records);
+	wl_list_remove(&replay->backend_destroy.link);
+	free(replay);
+}
+
+bool wlr_event_replay_add_output(struct wlr_event_replay *replay,
+		struct wlr_output *output) {
+	struct replay_output *replay_output = calloc(1, sizeof(*replay_output));
+	if (replay_output == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+	replay_output->stats = wlr_output_stats_create(output);
+	if (replay_output->stats == NULL) {
+		free(replay_output);
+		return false;
+	}
+	replay_output->stats_destroy.notify = replay_output_handle_stats_destroy;
+	wl_signal_add(&replay_output->stats->events.destroy,
+		&replay_output->stats_destroy);
+	wl_list_insert(&replay->outputs, &replay_output->link);
+	return true;
+}
+
+void wlr_event_replay_start(struct wlr_event_replay *replay) {
+	if (replay->timer == NULL) {
+		replay->timer = wl_event_loop_add_timer(replay->event_loop,
+			replay_handle_timer, replay);
+		if (replay->timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create replay timer");
+			return;
+		}
+	}
+
+	struct replay_output *replay_output;
+	wl_list_for_each(replay_output, &replay->outputs, link) {
+		wlr_output_stats_reset(replay_output->stats);
+	}
+
+	replay->next_record = 0;
+	replay->start_nsec = get_now_nsec();
+	wl_event_source_timer_update(replay->timer, 1);
+}
@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/render/dmabuf.h>
+#include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_export_dmabuf_v1.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/util/log.h>
@@ -30,18 +31,25 @@ static const struct zwlr_export_dmabuf_frame_v1_interface frame_impl = {
 	.destroy = frame_handle_destroy,
 };
 
-static void frame_destroy(struct wlr_export_dmabuf_frame_v1 *frame) {
-	if (frame == NULL) {
-		return;
-	}
+static void frame_release_output(struct wlr_export_dmabuf_frame_v1 *frame) {
 	if (frame->output != NULL) {
 		wlr_output_lock_attach_render(frame->output, false);
 		if (frame->cursor_locked) {
 			wlr_output_lock_software_cursors(frame->output, false);
 		}
+		frame->output = NULL;
 	}
-	wl_list_remove(&frame->link);
 	wl_list_remove(&frame->output_commit.link);
+	wl_list_init(&frame->output_commit.link);
+}
+
+static void frame_destroy(struct wlr_export_dmabuf_frame_v1 *frame) {
+	if (frame == NULL) {
+		return;
+	}
+	frame_release_output(frame);
+	wlr_buffer_unlock(frame->buffer);
+	wl_list_remove(&frame->link);
 	// Make the frame resource inert
 	wl_resource_set_user_data(frame->resource, NULL);
 	free(frame);
@@ -52,6 +60,22 @@ static void frame_handle_resource_destroy(struct wl_resource *resource) {
 	frame_destroy(frame);
 }
 
+/**
+ * Check whether a client still holds a buffer committed on the output. Only
+ * one is lent at a time, to leave enough buffers for the compositor to keep
+ * rendering.
+ */
+static bool output_has_lent_buffer(struct wlr_export_dmabuf_manager_v1 *manager,
+		struct wlr_output *output) {
+	struct wlr_export_dmabuf_frame_v1 *frame;
+	wl_list_for_each(frame, &manager->frames, link) {
+		if (frame->buffer != NULL && frame->buffer_output == output) {
+			return true;
+		}
+	}
+	return false;
+}
+
 static void frame_output_handle_commit(struct wl_listener *listener,
 		void *data) {
 	struct wlr_export_dmabuf_frame_v1 *frame =
@@ -65,15 +89,27 @@ static void frame_output_handle_commit(struct wl_listener *listener,
 	wl_list_remove(&frame->output_commit.link);
 	wl_list_init(&frame->output_commit.link);
 
+	// Lend the committed buffer itself when possible, so that the client can
+	// keep reading it after the compositor moved on to the next frame.
+	// Otherwise the exported buffer may be re-used for rendering any time.
 	struct wlr_dmabuf_attributes attribs = {0};
-	if (!wlr_output_export_dmabuf(frame->output, &attribs)) {
+	uint32_t frame_flags = ZWLR_EXPORT_DMABUF_FRAME_V1_FLAGS_TRANSIENT;
+	bool owned = false;
+	if (event->buffer != NULL && !output_has_lent_buffer(frame->manager,
+			frame->output) &&
+			wlr_buffer_get_dmabuf(event->buffer, &attribs)) {
+		frame->buffer = wlr_buffer_lock(event->buffer);
+		frame->buffer_output = frame->output;
+		frame_flags = 0;
+	} else if (wlr_output_export_dmabuf(frame->output, &attribs)) {
+		owned = true;
+	} else {
 		zwlr_export_dmabuf_frame_v1_send_cancel(frame->resource,
 			ZWLR_EXPORT_DMABUF_FRAME_V1_CANCEL_REASON_TEMPORARY);
 		frame_destroy(frame);
 		return;
 	}
 
-	uint32_t frame_flags = ZWLR_EXPORT_DMABUF_FRAME_V1_FLAGS_TRANSIENT;
 	uint32_t mod_high = attribs.modifier >> 32;
 	uint32_t mod_low = attribs.modifier & 0xFFFFFFFF;
 	zwlr_export_dmabuf_frame_v1_send_frame(frame->resource,
@@ -86,14 +122,22 @@ static void frame_output_handle_commit(struct wl_listener *listener,
 			attribs.fd[i], size, attribs.offset[i], attribs.stride[i], i);
 	}
 
-	wlr_dmabuf_attributes_finish(&attribs);
+	if (owned) {
+		wlr_dmabuf_attributes_finish(&attribs);
+	}
 
 	time_t tv_sec = event->when->tv_sec;
 	uint32_t tv_sec_hi = (sizeof(tv_sec) > 4) ? tv_sec >> 32 : 0;
 	uint32_t tv_sec_lo = tv_sec & 0xFFFFFFFF;
 	zwlr_export_dmabuf_frame_v1_send_ready(frame->resource,
 		tv_sec_hi, tv_sec_lo, event->when->tv_nsec);
-	frame_destroy(frame);
+
+	if (frame->buffer != NULL) {
+		// Keep the buffer locked until the client is done with it
+		frame_release_output(frame);
+	} else {
+		frame_destroy(frame);
+	}
 }
 
 
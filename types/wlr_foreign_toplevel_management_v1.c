@@ -7,10 +7,21 @@
 #include <wlr/types/wlr_seat.h>
 #include <wlr/util/log.h>
 #include "util/signal.h"
+#include "util/time.h"
 #include "wlr-foreign-toplevel-management-unstable-v1-protocol.h"
 
 #define FOREIGN_TOPLEVEL_MANAGEMENT_V1_VERSION 3
 
+// Properties are broadcast once per event loop iteration, with a single done
+// event, no matter how many times the compositor updates them
+enum toplevel_pending_field {
+	TOPLEVEL_PENDING_TITLE = 1 << 0,
+	TOPLEVEL_PENDING_APP_ID = 1 << 1,
+	TOPLEVEL_PENDING_STATE = 1 << 2,
+	// Other events have been sent right away and need to be followed by done
+	TOPLEVEL_PENDING_DONE = 1 << 3,
+};
+
 static const struct zwlr_foreign_toplevel_handle_v1_interface toplevel_handle_impl;
 
 static struct wlr_foreign_toplevel_handle_v1 *toplevel_handle_from_resource(
@@ -174,18 +185,105 @@ static const struct zwlr_foreign_toplevel_handle_v1_interface toplevel_handle_im
 	.unset_fullscreen = foreign_toplevel_handle_unset_fullscreen,
 };
 
-static void toplevel_idle_send_done(void *data) {
-	struct wlr_foreign_toplevel_handle_v1 *toplevel = data;
+static bool fill_array_from_toplevel_state(struct wl_array *array,
+	uint32_t state);
+
+static void toplevel_send_state(struct wlr_foreign_toplevel_handle_v1 *toplevel) {
+	struct wl_array states;
+	wl_array_init(&states);
+	bool r = fill_array_from_toplevel_state(&states, toplevel->state);
+	if (!r) {
+		struct wl_resource *resource;
+		wl_resource_for_each(resource, &toplevel->resources) {
+			wl_resource_post_no_memory(resource);
+		}
+
+		wl_array_release(&states);
+		return;
+	}
+
 	struct wl_resource *resource;
 	wl_resource_for_each(resource, &toplevel->resources) {
-		zwlr_foreign_toplevel_handle_v1_send_done(resource);
+		zwlr_foreign_toplevel_handle_v1_send_state(resource, &states);
+	}
+
+	wl_array_release(&states);
+}
+
+/**
+ * Check whether the title has been sent too recently. If so, arm the title
+ * timer to send it later.
+ */
+static bool toplevel_title_throttled(
+		struct wlr_foreign_toplevel_handle_v1 *toplevel) {
+	int interval = toplevel->manager->title_interval;
+	if (interval <= 0 || toplevel->title_timer == NULL) {
+		return false;
+	}
+
+	uint32_t elapsed = get_current_time_msec() - toplevel->title_sent_msec;
+	if (elapsed >= (uint32_t)interval) {
+		return false;
+	}
+	wl_event_source_timer_update(toplevel->title_timer, interval - elapsed);
+	return true;
+}
+
+static void toplevel_send_pending(
+		struct wlr_foreign_toplevel_handle_v1 *toplevel) {
+	uint32_t pending = toplevel->pending;
+	bool send_done = pending & TOPLEVEL_PENDING_DONE;
+	toplevel->pending = 0;
+
+	struct wl_resource *resource;
+	if ((pending & TOPLEVEL_PENDING_TITLE) && toplevel->title != NULL) {
+		if (toplevel_title_throttled(toplevel)) {
+			toplevel->pending |= TOPLEVEL_PENDING_TITLE;
+		} else {
+			wl_resource_for_each(resource, &toplevel->resources) {
+				zwlr_foreign_toplevel_handle_v1_send_title(resource,
+					toplevel->title);
+			}
+			toplevel->title_sent_msec = get_current_time_msec();
+			send_done = true;
+		}
+	}
+	if ((pending & TOPLEVEL_PENDING_APP_ID) && toplevel->app_id != NULL) {
+		wl_resource_for_each(resource, &toplevel->resources) {
+			zwlr_foreign_toplevel_handle_v1_send_app_id(resource,
+				toplevel->app_id);
+		}
+		send_done = true;
+	}
+	if (pending & TOPLEVEL_PENDING_STATE) {
+		toplevel_send_state(toplevel);
+		send_done = true;
 	}
 
+	if (send_done) {
+		wl_resource_for_each(resource, &toplevel->resources) {
+			zwlr_foreign_toplevel_handle_v1_send_done(resource);
+		}
+	}
+}
+
+static void toplevel_idle_send_done(void *data) {
+	struct wlr_foreign_toplevel_handle_v1 *toplevel = data;
 	toplevel->idle_source = NULL;
+	toplevel_send_pending(toplevel);
 }
 
-static void toplevel_update_idle_source(
-	struct wlr_foreign_toplevel_handle_v1 *toplevel) {
+static int toplevel_handle_title_timer(void *data) {
+	struct wlr_foreign_toplevel_handle_v1 *toplevel = data;
+	if (toplevel->pending & TOPLEVEL_PENDING_TITLE) {
+		toplevel_send_pending(toplevel);
+	}
+	return 0;
+}
+
+static void toplevel_schedule_pending(
+		struct wlr_foreign_toplevel_handle_v1 *toplevel, uint32_t fields) {
+	toplevel->pending |= fields;
 	if (toplevel->idle_source) {
 		return;
 	}
@@ -194,8 +292,17 @@ static void toplevel_update_idle_source(
 		toplevel_idle_send_done, toplevel);
 }
 
+static void toplevel_update_idle_source(
+		struct wlr_foreign_toplevel_handle_v1 *toplevel) {
+	toplevel_schedule_pending(toplevel, TOPLEVEL_PENDING_DONE);
+}
+
 void wlr_foreign_toplevel_handle_v1_set_title(
 		struct wlr_foreign_toplevel_handle_v1 *toplevel, const char *title) {
+	if (toplevel->title != NULL && strcmp(toplevel->title, title) == 0) {
+		return;
+	}
+
 	free(toplevel->title);
 	toplevel->title = strdup(title);
 	if (toplevel->title == NULL) {
@@ -203,16 +310,15 @@ void wlr_foreign_toplevel_handle_v1_set_title(
 		return;
 	}
 
-	struct wl_resource *resource;
-	wl_resource_for_each(resource, &toplevel->resources) {
-		zwlr_foreign_toplevel_handle_v1_send_title(resource, title);
-	}
-
-	toplevel_update_idle_source(toplevel);
+	toplevel_schedule_pending(toplevel, TOPLEVEL_PENDING_TITLE);
 }
 
 void wlr_foreign_toplevel_handle_v1_set_app_id(
 		struct wlr_foreign_toplevel_handle_v1 *toplevel, const char *app_id) {
+	if (toplevel->app_id != NULL && strcmp(toplevel->app_id, app_id) == 0) {
+		return;
+	}
+
 	free(toplevel->app_id);
 	toplevel->app_id = strdup(app_id);
 	if (toplevel->app_id == NULL) {
@@ -220,12 +326,7 @@ void wlr_foreign_toplevel_handle_v1_set_app_id(
 		return;
 	}
 
-	struct wl_resource *resource;
-	wl_resource_for_each(resource, &toplevel->resources) {
-		zwlr_foreign_toplevel_handle_v1_send_app_id(resource, app_id);
-	}
-
-	toplevel_update_idle_source(toplevel);
+	toplevel_schedule_pending(toplevel, TOPLEVEL_PENDING_APP_ID);
 }
 
 static void send_output_to_resource(struct wl_resource *resource,
@@ -353,29 +454,6 @@ static bool fill_array_from_toplevel_state(struct wl_array *array,
 	return true;
 }
 
-static void toplevel_send_state(struct wlr_foreign_toplevel_handle_v1 *toplevel) {
-	struct wl_array states;
-	wl_array_init(&states);
-	bool r = fill_array_from_toplevel_state(&states, toplevel->state);
-	if (!r) {
-		struct wl_resource *resource;
-		wl_resource_for_each(resource, &toplevel->resources) {
-			wl_resource_post_no_memory(resource);
-		}
-
-		wl_array_release(&states);
-		return;
-	}
-
-	struct wl_resource *resource;
-	wl_resource_for_each(resource, &toplevel->resources) {
-		zwlr_foreign_toplevel_handle_v1_send_state(resource, &states);
-	}
-
-	wl_array_release(&states);
-	toplevel_update_idle_source(toplevel);
-}
-
 void wlr_foreign_toplevel_handle_v1_set_maximized(
 		struct wlr_foreign_toplevel_handle_v1 *toplevel, bool maximized) {
 	if (maximized == !!(toplevel->state &
@@ -387,7 +465,7 @@ void wlr_foreign_toplevel_handle_v1_set_maximized(
 	} else {
 		toplevel->state &= ~WLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MAXIMIZED;
 	}
-	toplevel_send_state(toplevel);
+	toplevel_schedule_pending(toplevel, TOPLEVEL_PENDING_STATE);
 }
 
 void wlr_foreign_toplevel_handle_v1_set_minimized(
@@ -401,7 +479,7 @@ void wlr_foreign_toplevel_handle_v1_set_minimized(
 	} else {
 		toplevel->state &= ~WLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MINIMIZED;
 	}
-	toplevel_send_state(toplevel);
+	toplevel_schedule_pending(toplevel, TOPLEVEL_PENDING_STATE);
 }
 
 void wlr_foreign_toplevel_handle_v1_set_activated(
@@ -415,7 +493,7 @@ void wlr_foreign_toplevel_handle_v1_set_activated(
 	} else {
 		toplevel->state &= ~WLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_ACTIVATED;
 	}
-	toplevel_send_state(toplevel);
+	toplevel_schedule_pending(toplevel, TOPLEVEL_PENDING_STATE);
 }
 
 void wlr_foreign_toplevel_handle_v1_set_fullscreen(
@@ -429,7 +507,7 @@ void wlr_foreign_toplevel_handle_v1_set_fullscreen(
 	} else {
 		toplevel->state &= ~WLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_FULLSCREEN;
 	}
-	toplevel_send_state(toplevel);
+	toplevel_schedule_pending(toplevel, TOPLEVEL_PENDING_STATE);
 }
 
 static void toplevel_resource_send_parent(
@@ -491,6 +569,9 @@ void wlr_foreign_toplevel_handle_v1_destroy(
 	if (toplevel->idle_source) {
 		wl_event_source_remove(toplevel->idle_source);
 	}
+	if (toplevel->title_timer) {
+		wl_event_source_remove(toplevel->title_timer);
+	}
 
 	wl_list_remove(&toplevel->link);
 
@@ -545,6 +626,13 @@ wlr_foreign_toplevel_handle_v1_create(
 		return NULL;
 	}
 
+	toplevel->title_timer = wl_event_loop_add_timer(manager->event_loop,
+		toplevel_handle_title_timer, toplevel);
+	if (!toplevel->title_timer) {
+		free(toplevel);
+		return NULL;
+	}
+
 	wl_list_insert(&manager->toplevels, &toplevel->link);
 	toplevel->manager = manager;
 
@@ -662,6 +750,11 @@ static void handle_display_destroy(struct wl_listener *listener, void *data) {
 	free(manager);
 }
 
+void wlr_foreign_toplevel_manager_v1_set_title_interval(
+		struct wlr_foreign_toplevel_manager_v1 *manager, int interval_ms) {
+	manager->title_interval = interval_ms;
+}
+
 struct wlr_foreign_toplevel_manager_v1 *wlr_foreign_toplevel_manager_v1_create(
 		struct wl_display *display) {
 	struct wlr_foreign_toplevel_manager_v1 *manager = calloc(1,
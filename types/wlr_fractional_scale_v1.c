@@ -0,0 +1,210 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_fractional_scale_v1.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_surface.h>
+#include "fractional-scale-v1-protocol.h"
+#include "util/signal.h"
+
+#define FRACTIONAL_SCALE_VERSION 1
+
+static const struct wp_fractional_scale_v1_interface fractional_scale_impl;
+static const struct wp_fractional_scale_manager_v1_interface manager_impl;
+
+// Returns NULL if the fractional scale object is inert
+static struct wlr_fractional_scale_v1 *fractional_scale_from_resource(
+		struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource, &wp_fractional_scale_v1_interface,
+		&fractional_scale_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+static struct wlr_fractional_scale_manager_v1 *manager_from_resource(
+		struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource,
+		&wp_fractional_scale_manager_v1_interface, &manager_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+static struct wlr_fractional_scale_v1 *manager_find_scale(
+		struct wlr_fractional_scale_manager_v1 *manager,
+		struct wlr_surface *surface) {
+	struct wlr_fractional_scale_v1 *fractional_scale;
+	wl_list_for_each(fractional_scale, &manager->scales, link) {
+		if (fractional_scale->surface == surface) {
+			return fractional_scale;
+		}
+	}
+	return NULL;
+}
+
+static void fractional_scale_send(struct wlr_fractional_scale_v1 *fractional_scale,
+		double scale) {
+	uint32_t scale_120 = round(scale * 120);
+	if (scale_120 == 0 || scale_120 == fractional_scale->scale_120) {
+		return;
+	}
+	fractional_scale->scale_120 = scale_120;
+	wp_fractional_scale_v1_send_preferred_scale(fractional_scale->resource,
+		scale_120);
+}
+
+static void fractional_scale_destroy(
+		struct wlr_fractional_scale_v1 *fractional_scale) {
+	if (fractional_scale == NULL) {
+		return;
+	}
+	wl_resource_set_user_data(fractional_scale->resource, NULL);
+	wl_list_remove(&fractional_scale->link);
+	wl_list_remove(&fractional_scale->surface_destroy.link);
+	free(fractional_scale);
+}
+
+static void fractional_scale_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct wp_fractional_scale_v1_interface fractional_scale_impl = {
+	.destroy = fractional_scale_handle_destroy,
+};
+
+static void fractional_scale_handle_resource_destroy(
+		struct wl_resource *resource) {
+	struct wlr_fractional_scale_v1 *fractional_scale =
+		fractional_scale_from_resource(resource);
+	fractional_scale_destroy(fractional_scale);
+}
+
+static void fractional_scale_handle_surface_destroy(
+		struct wl_listener *listener, void *data) {
+	struct wlr_fractional_scale_v1 *fractional_scale =
+		wl_container_of(listener, fractional_scale, surface_destroy);
+	fractional_scale_destroy(fractional_scale);
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void manager_handle_get_fractional_scale(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource) {
+	struct wlr_fractional_scale_manager_v1 *manager =
+		manager_from_resource(resource);
+	struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+
+	if (manager_find_scale(manager, surface) != NULL) {
+		wl_resource_post_error(resource,
+			WP_FRACTIONAL_SCALE_MANAGER_V1_ERROR_FRACTIONAL_SCALE_EXISTS,
+			"wp_fractional_scale_v1 already exists for this surface");
+		return;
+	}
+
+	struct wlr_fractional_scale_v1 *fractional_scale =
+		calloc(1, sizeof(*fractional_scale));
+	if (fractional_scale == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	uint32_t version = wl_resource_get_version(resource);
+	fractional_scale->resource = wl_resource_create(client,
+		&wp_fractional_scale_v1_interface, version, id);
+	if (fractional_scale->resource == NULL) {
+		wl_client_post_no_memory(client);
+		free(fractional_scale);
+		return;
+	}
+	wl_resource_set_implementation(fractional_scale->resource,
+		&fractional_scale_impl, fractional_scale,
+		fractional_scale_handle_resource_destroy);
+
+	fractional_scale->surface = surface;
+	wl_list_insert(&manager->scales, &fractional_scale->link);
+
+	fractional_scale->surface_destroy.notify =
+		fractional_scale_handle_surface_destroy;
+	wl_signal_add(&surface->events.destroy, &fractional_scale->surface_destroy);
+
+	// Don't make the client wait for the next output change
+	double scale = 0;
+	struct wlr_surface_output *surface_output;
+	wl_list_for_each(surface_output, &surface->current_outputs, link) {
+		if (surface_output->output->scale > scale) {
+			scale = surface_output->output->scale;
+		}
+	}
+	fractional_scale_send(fractional_scale, scale);
+}
+
+static const struct wp_fractional_scale_manager_v1_interface manager_impl = {
+	.destroy = manager_handle_destroy,
+	.get_fractional_scale = manager_handle_get_fractional_scale,
+};
+
+static void manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wlr_fractional_scale_manager_v1 *manager = data;
+
+	struct wl_resource *resource = wl_resource_create(client,
+		&wp_fractional_scale_manager_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &manager_impl, manager, NULL);
+}
+
+static void handle_display_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_fractional_scale_manager_v1 *manager =
+		wl_container_of(listener, manager, display_destroy);
+	wlr_signal_emit_safe(&manager->events.destroy, NULL);
+
+	// Resources outlive the global, make them inert
+	struct wlr_fractional_scale_v1 *fractional_scale, *tmp;
+	wl_list_for_each_safe(fractional_scale, tmp, &manager->scales, link) {
+		fractional_scale_destroy(fractional_scale);
+	}
+
+	wl_list_remove(&manager->display_destroy.link);
+	wl_global_destroy(manager->global);
+	free(manager);
+}
+
+struct wlr_fractional_scale_manager_v1 *wlr_fractional_scale_manager_v1_create(
+		struct wl_display *display) {
+	struct wlr_fractional_scale_manager_v1 *manager =
+		calloc(1, sizeof(*manager));
+	if (manager == NULL) {
+		return NULL;
+	}
+
+	manager->global = wl_global_create(display,
+		&wp_fractional_scale_manager_v1_interface, FRACTIONAL_SCALE_VERSION,
+		manager, manager_bind);
+	if (manager->global == NULL) {
+		free(manager);
+		return NULL;
+	}
+
+	wl_list_init(&manager->scales);
+	wl_signal_init(&manager->events.destroy);
+
+	manager->display_destroy.notify = handle_display_destroy;
+	wl_display_add_destroy_listener(display, &manager->display_destroy);
+
+	return manager;
+}
+
+void wlr_fractional_scale_manager_v1_notify_scale(
+		struct wlr_fractional_scale_manager_v1 *manager,
+		struct wlr_surface *surface, double scale) {
+	struct wlr_fractional_scale_v1 *fractional_scale =
+		manager_find_scale(manager, surface);
+	if (fractional_scale != NULL) {
+		fractional_scale_send(fractional_scale, scale);
+	}
+}
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,6 +7,7 @@
 #include <wlr/util/log.h>
 #include "idle-protocol.h"
 #include "util/signal.h"
+#include "util/time.h"
 
 static const struct org_kde_kwin_idle_timeout_interface idle_timeout_impl;
 
@@ -21,6 +23,15 @@ static int idle_notify(void *data) {
 	if (timer->idle_state) {
 		return 0;
 	}
+
+	// Activity doesn't re-arm the timer, so it may fire early
+	uint32_t elapsed = get_current_time_msec() - timer->last_activity_msec;
+	if (elapsed < timer->timeout) {
+		wl_event_source_timer_update(timer->idle_source,
+			timer->timeout - elapsed);
+		return 0;
+	}
+
 	timer->idle_state = true;
 	wlr_signal_emit_safe(&timer->events.idle, timer);
 
@@ -35,6 +46,13 @@ static void handle_activity(struct wlr_idle_timeout *timer) {
 		return;
 	}
 
+	timer->last_activity_msec = get_current_time_msec();
+	if (!timer->idle_state && timer->timeout != 0) {
+		// The timer is still armed, idle_notify will push it back. This avoids
+		// a timerfd_settime call per input event.
+		return;
+	}
+
 	// in case the previous state was sleeping send a resume event and switch state
 	if (timer->idle_state) {
 		timer->idle_state = false;
@@ -112,6 +130,7 @@ static struct wlr_idle_timeout *create_timer(struct wlr_idle *idle,
 	timer->timeout = timeout;
 	timer->idle_state = false;
 	timer->enabled = idle->enabled;
+	timer->last_activity_msec = get_current_time_msec();
 
 	wl_list_insert(&idle->idle_timers, &timer->link);
 	wl_signal_init(&timer->events.idle);
@@ -193,6 +212,7 @@ void wlr_idle_set_enabled(struct wlr_idle *idle, struct wlr_seat *seat,
 		int timeout = enabled ? timer->timeout : 0;
 		wl_event_source_timer_update(timer->idle_source, timeout);
 		timer->enabled = enabled;
+		timer->last_activity_msec = get_current_time_msec();
 	}
 }
 
@@ -3,15 +3,12 @@
 #endif
 #include <assert.h>
 #include <string.h>
-#include <sys/mman.h>
-#include <unistd.h>
 #include <wayland-util.h>
 #include <wlr/types/wlr_input_method_v2.h>
 #include <wlr/types/wlr_surface.h>
 #include <wlr/util/log.h>
 #include <xkbcommon/xkbcommon.h>
 #include "input-method-unstable-v2-protocol.h"
-#include "util/shm.h"
 #include "util/signal.h"
 
 static const struct zwp_input_method_v2_interface input_method_impl;
@@ -152,6 +149,9 @@ void wlr_input_method_keyboard_grab_v2_send_key(
 		keyboard_grab->resource,
 		wlr_seat_client_next_serial(keyboard_grab->input_method->seat_client),
 		time, key, state);
+	// Hand the key to the input method right away instead of waiting for
+	// the compositor to go idle, the IME's reply is on the typing path
+	wl_client_flush(wl_resource_get_client(keyboard_grab->resource));
 }
 
 void wlr_input_method_keyboard_grab_v2_send_modifiers(
@@ -164,33 +164,28 @@ void wlr_input_method_keyboard_grab_v2_send_modifiers(
 		modifiers->locked, modifiers->group);
 }
 
-static bool keyboard_grab_send_keymap(
-		struct wlr_input_method_keyboard_grab_v2 *keyboard_grab,
-		struct wlr_keyboard *keyboard) {
-	int keymap_fd = allocate_shm_file(keyboard->keymap_size);
-	if (keymap_fd < 0) {
-		wlr_log(WLR_ERROR, "creating a keymap file for %zu bytes failed",
-			keyboard->keymap_size);
+static bool keymap_changed(struct wlr_keyboard *old, struct wlr_keyboard *new) {
+	if (old == NULL) {
+		return true;
+	}
+	if (old->keymap == new->keymap) {
 		return false;
 	}
+	if (old->keymap_size != new->keymap_size) {
+		return true;
+	}
+	return strcmp(old->keymap_string, new->keymap_string) != 0;
+}
 
-	void *ptr = mmap(NULL, keyboard->keymap_size, PROT_READ | PROT_WRITE,
-		MAP_SHARED, keymap_fd, 0);
-	if (ptr == MAP_FAILED) {
-		wlr_log(WLR_ERROR, "failed to mmap() %zu bytes",
-			keyboard->keymap_size);
-		close(keymap_fd);
+static bool keyboard_grab_send_keymap(
+		struct wlr_input_method_keyboard_grab_v2 *keyboard_grab,
+		struct wlr_keyboard *keyboard) {
+	if (keyboard->keymap_fd < 0) {
 		return false;
 	}
-
-	memcpy(ptr, keyboard->keymap_string, keyboard->keymap_size);
-	munmap(ptr, keyboard->keymap_size);
-
 	zwp_input_method_keyboard_grab_v2_send_keymap(keyboard_grab->resource,
-		WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, keymap_fd,
+		WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, keyboard->keymap_fd,
 		keyboard->keymap_size);
-
-	close(keymap_fd);
 	return true;
 }
 
@@ -236,9 +231,7 @@ void wlr_input_method_keyboard_grab_v2_set_keyboard(
 	}
 
 	if (keyboard) {
-		if (keyboard_grab->keyboard == NULL ||
-				strcmp(keyboard_grab->keyboard->keymap_string,
-				keyboard->keymap_string) != 0) {
+		if (keymap_changed(keyboard_grab->keyboard, keyboard)) {
 			// send keymap only if it is changed, or if input method is not
 			// aware that it did not change and blindly send it back with
 			// virtual keyboard, it may cause an infinite recursion.
@@ -351,6 +344,8 @@ void wlr_input_method_v2_send_done(struct wlr_input_method_v2 *input_method) {
 	zwp_input_method_v2_send_done(input_method->resource);
 	input_method->client_active = input_method->active;
 	input_method->current_serial++;
+	// done closes a batch of state events, flush it as a whole
+	wl_client_flush(wl_resource_get_client(input_method->resource));
 }
 
 void wlr_input_method_v2_send_unavailable(
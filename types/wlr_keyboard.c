@@ -1,12 +1,16 @@
+#define _POSIX_C_SOURCE 200809L
 #include "util/array.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/interfaces/wlr_keyboard.h>
 #include <wlr/types/wlr_keyboard.h>
 #include <wlr/util/log.h>
 #include "types/wlr_keyboard.h"
+#include "util/shm.h"
 #include "util/signal.h"
 
 void keyboard_led_update(struct wlr_keyboard *keyboard) {
@@ -110,6 +114,177 @@ void wlr_keyboard_notify_key(struct wlr_keyboard *keyboard,
 	keyboard_led_update(keyboard);
 }
 
+/**
+ * Keymaps are shared by keyboards with identical layouts, so that they are
+ * serialized and written to a file for clients only once. A few unused
+ * keymaps are kept around for devices being re-plugged.
+ */
+#define KEYMAP_CACHE_MAX_UNUSED 4
+
+struct keyboard_keymap {
+	struct xkb_keymap *keymap;
+	char *string;
+	size_t size; // including the NUL terminator
+	int fd; // read-only, shared with clients
+	uint32_t hash; // of the string
+	uint64_t serial; // unique, never reused
+	size_t refs; // number of keyboards using the keymap
+	struct wl_list link; // keymap_cache, most recently used first
+};
+
+static struct wl_list keymap_cache = { &keymap_cache, &keymap_cache };
+static uint64_t keymap_serial = 0;
+
+static uint32_t hash_keymap_string(const char *string, size_t len) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ (uint8_t)string[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Write the keymap string to a shared memory file once, so that the same
+ * read-only file descriptor can be sent to every client.
+ */
+static int keymap_create_fd(const char *keymap_string, size_t keymap_size) {
+	int rw_fd, ro_fd;
+	if (!allocate_shm_file_pair(keymap_size, &rw_fd, &ro_fd)) {
+		wlr_log(WLR_ERROR, "Failed to allocate %zu bytes for the keymap",
+			keymap_size);
+		return -1;
+	}
+
+	void *ptr = mmap(NULL, keymap_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		rw_fd, 0);
+	close(rw_fd);
+	if (ptr == MAP_FAILED) {
+		wlr_log_errno(WLR_ERROR, "Failed to mmap() %zu bytes", keymap_size);
+		close(ro_fd);
+		return -1;
+	}
+	memcpy(ptr, keymap_string, keymap_size);
+	munmap(ptr, keymap_size);
+
+	return ro_fd;
+}
+
+static void keymap_destroy(struct keyboard_keymap *keymap) {
+	wl_list_remove(&keymap->link);
+	xkb_keymap_unref(keymap->keymap);
+	free(keymap->string);
+	close(keymap->fd);
+	free(keymap);
+}
+
+static struct keyboard_keymap *keymap_cache_find(struct xkb_keymap *xkb_keymap) {
+	struct keyboard_keymap *keymap;
+	wl_list_for_each(keymap, &keymap_cache, link) {
+		if (keymap->keymap == xkb_keymap) {
+			return keymap;
+		}
+	}
+	return NULL;
+}
+
+static struct keyboard_keymap *keymap_cache_find_string(const char *string,
+		size_t len) {
+	uint32_t hash = hash_keymap_string(string, len);
+	struct keyboard_keymap *keymap;
+	wl_list_for_each(keymap, &keymap_cache, link) {
+		if (keymap->hash == hash && keymap->size == len + 1 &&
+				memcmp(keymap->string, string, len) == 0) {
+			return keymap;
+		}
+	}
+	return NULL;
+}
+
+struct xkb_keymap *keyboard_keymap_cache_find_string(const char *string,
+		size_t size) {
+	struct keyboard_keymap *keymap =
+		keymap_cache_find_string(string, strnlen(string, size));
+	return keymap != NULL ? keymap->keymap : NULL;
+}
+
+/**
+ * Get the shared keymap identical to the given one, taking a reference.
+ */
+static struct keyboard_keymap *keymap_cache_get(struct xkb_keymap *xkb_keymap) {
+	struct keyboard_keymap *keymap = keymap_cache_find(xkb_keymap);
+	if (keymap == NULL) {
+		char *string = xkb_keymap_get_as_string(xkb_keymap,
+			XKB_KEYMAP_FORMAT_TEXT_V1);
+		if (string == NULL) {
+			wlr_log(WLR_ERROR, "Failed to get string version of keymap");
+			return NULL;
+		}
+		size_t len = strlen(string);
+
+		keymap = keymap_cache_find_string(string, len);
+		if (keymap != NULL) {
+			free(string);
+		} else {
+			keymap = calloc(1, sizeof(*keymap));
+			if (keymap == NULL) {
+				wlr_log_errno(WLR_ERROR, "Allocation failed");
+				free(string);
+				return NULL;
+			}
+			keymap->string = string;
+			keymap->size = len + 1;
+			keymap->hash = hash_keymap_string(string, len);
+			keymap->serial = ++keymap_serial;
+			keymap->fd = keymap_create_fd(string, keymap->size);
+			if (keymap->fd < 0) {
+				free(string);
+				free(keymap);
+				return NULL;
+			}
+			keymap->keymap = xkb_keymap_ref(xkb_keymap);
+			wl_list_insert(&keymap_cache, &keymap->link);
+		}
+	}
+
+	wl_list_remove(&keymap->link);
+	wl_list_insert(&keymap_cache, &keymap->link);
+	keymap->refs++;
+	return keymap;
+}
+
+static void keymap_cache_put(struct keyboard_keymap *keymap) {
+	assert(keymap->refs > 0);
+	keymap->refs--;
+	if (keymap->refs > 0) {
+		return;
+	}
+
+	size_t unused = 0;
+	struct keyboard_keymap *tmp;
+	wl_list_for_each_safe(keymap, tmp, &keymap_cache, link) {
+		if (keymap->refs == 0 && ++unused > KEYMAP_CACHE_MAX_UNUSED) {
+			keymap_destroy(keymap);
+		}
+	}
+}
+
+static void keyboard_release_keymap(struct wlr_keyboard *kb) {
+	if (kb->keymap == NULL) {
+		return;
+	}
+	struct keyboard_keymap *keymap = keymap_cache_find(kb->keymap);
+	if (keymap != NULL) {
+		keymap_cache_put(keymap);
+	}
+	xkb_keymap_unref(kb->keymap);
+	kb->keymap = NULL;
+	kb->keymap_string = NULL;
+	kb->keymap_size = 0;
+	kb->keymap_fd = -1;
+	kb->keymap_serial = 0;
+}
+
 void wlr_keyboard_init(struct wlr_keyboard *kb,
 		const struct wlr_keyboard_impl *impl) {
 	kb->impl = impl;
@@ -119,6 +294,8 @@ void wlr_keyboard_init(struct wlr_keyboard *kb,
 	wl_signal_init(&kb->events.repeat_info);
 	wl_signal_init(&kb->events.destroy);
 
+	kb->keymap_fd = -1;
+
 	// Sane defaults
 	kb->repeat_info.rate = 25;
 	kb->repeat_info.delay = 600;
@@ -130,8 +307,7 @@ void wlr_keyboard_destroy(struct wlr_keyboard *kb) {
 	}
 	wlr_signal_emit_safe(&kb->events.destroy, kb);
 	xkb_state_unref(kb->xkb_state);
-	xkb_keymap_unref(kb->keymap);
-	free(kb->keymap_string);
+	keyboard_release_keymap(kb);
 	if (kb->impl && kb->impl->destroy) {
 		kb->impl->destroy(kb);
 	} else {
@@ -148,8 +324,17 @@ void wlr_keyboard_led_update(struct wlr_keyboard *kb, uint32_t leds) {
 
 bool wlr_keyboard_set_keymap(struct wlr_keyboard *kb,
 		struct xkb_keymap *keymap) {
-	xkb_keymap_unref(kb->keymap);
-	kb->keymap = xkb_keymap_ref(keymap);
+	struct keyboard_keymap *shared = keymap_cache_get(keymap);
+	keyboard_release_keymap(kb);
+	if (shared == NULL) {
+		goto err;
+	}
+	// An identical keymap may be used instead of the one passed in
+	kb->keymap = xkb_keymap_ref(shared->keymap);
+	kb->keymap_string = shared->string;
+	kb->keymap_size = shared->size;
+	kb->keymap_fd = shared->fd;
+	kb->keymap_serial = shared->serial;
 
 	xkb_state_unref(kb->xkb_state);
 	kb->xkb_state = xkb_state_new(kb->keymap);
@@ -182,16 +367,6 @@ bool wlr_keyboard_set_keymap(struct wlr_keyboard *kb,
 		kb->mod_indexes[i] = xkb_map_mod_get_index(kb->keymap, mod_names[i]);
 	}
 
-	char *tmp_keymap_string = xkb_keymap_get_as_string(kb->keymap,
-		XKB_KEYMAP_FORMAT_TEXT_V1);
-	if (tmp_keymap_string == NULL) {
-		wlr_log(WLR_ERROR, "Failed to get string version of keymap");
-		goto err;
-	}
-	free(kb->keymap_string);
-	kb->keymap_string = tmp_keymap_string;
-	kb->keymap_size = strlen(kb->keymap_string) + 1;
-
 	for (size_t i = 0; i < kb->num_keycodes; ++i) {
 		xkb_keycode_t keycode = kb->keycodes[i] + 8;
 		xkb_state_update_key(kb->xkb_state, keycode, XKB_KEY_DOWN);
@@ -205,10 +380,7 @@ bool wlr_keyboard_set_keymap(struct wlr_keyboard *kb,
 err:
 	xkb_state_unref(kb->xkb_state);
 	kb->xkb_state = NULL;
-	xkb_keymap_unref(keymap);
-	kb->keymap = NULL;
-	free(kb->keymap_string);
-	kb->keymap_string = NULL;
+	keyboard_release_keymap(kb);
 	return false;
 }
 
@@ -242,9 +414,26 @@ bool wlr_keyboard_keymaps_match(struct xkb_keymap *km1,
 	if (!km1 || !km2) {
 		return false;
 	}
-	char *km1_str = xkb_keymap_get_as_string(km1, XKB_KEYMAP_FORMAT_TEXT_V1);
-	char *km2_str = xkb_keymap_get_as_string(km2, XKB_KEYMAP_FORMAT_TEXT_V1);
-	bool result = strcmp(km1_str, km2_str) == 0;
+	if (km1 == km2) {
+		return true;
+	}
+
+	// Shared keymaps are deduplicated: two of them never match
+	struct keyboard_keymap *shared1 = keymap_cache_find(km1);
+	struct keyboard_keymap *shared2 = keymap_cache_find(km2);
+	if (shared1 != NULL && shared2 != NULL) {
+		return false;
+	}
+
+	char *km1_str = NULL, *km2_str = NULL;
+	if (shared1 == NULL) {
+		km1_str = xkb_keymap_get_as_string(km1, XKB_KEYMAP_FORMAT_TEXT_V1);
+	}
+	if (shared2 == NULL) {
+		km2_str = xkb_keymap_get_as_string(km2, XKB_KEYMAP_FORMAT_TEXT_V1);
+	}
+	bool result = strcmp(shared1 != NULL ? shared1->string : km1_str,
+		shared2 != NULL ? shared2->string : km2_str) == 0;
 	free(km1_str);
 	free(km2_str);
 	return result;
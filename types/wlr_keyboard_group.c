@@ -23,12 +23,6 @@ struct keyboard_group_device {
 	struct wl_list link; // wlr_keyboard_group::devices
 };
 
-struct keyboard_group_key {
-	uint32_t keycode;
-	size_t count;
-	struct wl_list link; // wlr_keyboard_group::keys
-};
-
 static void keyboard_set_leds(struct wlr_keyboard *kb, uint32_t leds) {
 	struct wlr_keyboard_group *group = wlr_keyboard_group_from_wlr_keyboard(kb);
 	struct keyboard_group_device *device;
@@ -71,7 +65,6 @@ struct wlr_keyboard_group *wlr_keyboard_group_create(void) {
 
 	wlr_keyboard_init(&group->keyboard, &impl);
 	wl_list_init(&group->devices);
-	wl_list_init(&group->keys);
 
 	wl_signal_init(&group->events.enter);
 	wl_signal_init(&group->events.leave);
@@ -90,39 +83,22 @@ struct wlr_keyboard_group *wlr_keyboard_group_from_wlr_keyboard(
 static bool process_key(struct keyboard_group_device *group_device,
 		struct wlr_event_keyboard_key *event) {
 	struct wlr_keyboard_group *group = group_device->keyboard->group;
-
-	struct keyboard_group_key *key, *tmp;
-	wl_list_for_each_safe(key, tmp, &group->keys, link) {
-		if (key->keycode != event->keycode) {
-			continue;
-		}
-		if (event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-			key->count++;
-			return false;
-		}
-		if (event->state == WL_KEYBOARD_KEY_STATE_RELEASED) {
-			key->count--;
-			if (key->count > 0) {
-				return false;
-			}
-			wl_list_remove(&key->link);
-			free(key);
-		}
-		break;
+	if (event->keycode >= WLR_KEYBOARD_GROUP_KEYCODES_MAX) {
+		return true;
 	}
 
-	if (event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-		struct keyboard_group_key *key =
-			calloc(1, sizeof(struct keyboard_group_key));
-		if (!key) {
-			wlr_log(WLR_ERROR, "Failed to allocate keyboard_group_key");
-			return false;
+	uint16_t *count = &group->key_counts[event->keycode];
+	switch (event->state) {
+	case WL_KEYBOARD_KEY_STATE_PRESSED:
+		// Only the first keyboard pressing the key is forwarded
+		return (*count)++ == 0;
+	case WL_KEYBOARD_KEY_STATE_RELEASED:
+		if (*count == 0) {
+			return true;
 		}
-		key->keycode = event->keycode;
-		key->count = 1;
-		wl_list_insert(&group->keys, &key->link);
+		// Only the last keyboard releasing the key is forwarded
+		return --(*count) == 0;
 	}
-
 	return true;
 }
 
@@ -140,21 +116,29 @@ static void handle_keyboard_modifiers(struct wl_listener *listener,
 	// the modifiers will be derived from the wlr_keyboard_group's key state
 	struct keyboard_group_device *group_device =
 		wl_container_of(listener, group_device, modifiers);
+	struct wlr_keyboard_group *group = group_device->keyboard->group;
+	if (group->syncing_modifiers) {
+		// Triggered by the loop below
+		return;
+	}
 	struct wlr_keyboard_modifiers mods = group_device->keyboard->modifiers;
 
+	// Update all members in a single pass, instead of recursing through each
+	// member's modifiers event
+	group->syncing_modifiers = true;
 	struct keyboard_group_device *device;
-	wl_list_for_each(device, &group_device->keyboard->group->devices, link) {
+	wl_list_for_each(device, &group->devices, link) {
 		if (mods.depressed != device->keyboard->modifiers.depressed ||
 				mods.latched != device->keyboard->modifiers.latched ||
 				mods.locked != device->keyboard->modifiers.locked ||
 				mods.group != device->keyboard->modifiers.group) {
 			wlr_keyboard_notify_modifiers(device->keyboard,
 					mods.depressed, mods.latched, mods.locked, mods.group);
-			return;
 		}
 	}
+	group->syncing_modifiers = false;
 
-	wlr_keyboard_notify_modifiers(&group_device->keyboard->group->keyboard,
+	wlr_keyboard_notify_modifiers(&group->keyboard,
 			mods.depressed, mods.latched, mods.locked, mods.group);
 }
 
@@ -204,9 +188,9 @@ static void refresh_state(struct keyboard_group_device *device,
 	struct wl_array keys;
 	wl_array_init(&keys);
 
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
 	for (size_t i = 0; i < device->keyboard->num_keycodes; i++) {
-		struct timespec now;
-		clock_gettime(CLOCK_MONOTONIC, &now);
 		struct wlr_event_keyboard_key event = {
 			.time_msec = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000,
 			.keycode = device->keyboard->keycodes[i],
@@ -219,8 +203,6 @@ static void refresh_state(struct keyboard_group_device *device,
 		if (process_key(device, &event)) {
 			// Update state for wlr_keyboard_group's keyboard
 			keyboard_key_update(&device->keyboard->group->keyboard, &event);
-			keyboard_modifier_update(&device->keyboard->group->keyboard);
-			keyboard_led_update(&device->keyboard->group->keyboard);
 
 			// Add the key to the array
 			uint32_t *key = wl_array_add(&keys, sizeof(uint32_t));
@@ -230,6 +212,10 @@ static void refresh_state(struct keyboard_group_device *device,
 
 	// If there are any unique keys, emit the enter/leave event
 	if (keys.size > 0) {
+		// Modifiers and LEDs only need updating once for all keys
+		keyboard_modifier_update(&device->keyboard->group->keyboard);
+		keyboard_led_update(&device->keyboard->group->keyboard);
+
 		if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
 			wlr_signal_emit_safe(&device->keyboard->group->events.enter, &keys);
 		} else {
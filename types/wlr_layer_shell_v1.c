@@ -13,6 +13,9 @@
 
 #define LAYER_SHELL_VERSION 4
 
+static void layer_surface_schedule_arrange(
+	struct wlr_layer_surface_v1 *surface);
+
 static void resource_handle_destroy(struct wl_client *client,
 		struct wl_resource *resource) {
 	wl_resource_destroy(resource);
@@ -235,6 +238,8 @@ static void layer_surface_unmap(struct wlr_layer_surface_v1 *surface) {
 	surface->configured = surface->mapped = false;
 	surface->configure_serial = 0;
 	surface->configure_next_serial = 0;
+
+	layer_surface_schedule_arrange(surface);
 }
 
 static void layer_surface_destroy(struct wlr_layer_surface_v1 *surface) {
@@ -242,9 +247,11 @@ static void layer_surface_destroy(struct wlr_layer_surface_v1 *surface) {
 		layer_surface_unmap(surface);
 	}
 	wlr_signal_emit_safe(&surface->events.destroy, surface);
+	layer_surface_schedule_arrange(surface);
 	wl_resource_set_user_data(surface->resource, NULL);
 	surface->surface->role_data = NULL;
 	wl_list_remove(&surface->surface_destroy.link);
+	wl_list_remove(&surface->link);
 	free(surface->namespace);
 	free(surface);
 }
@@ -363,6 +370,15 @@ static void layer_surface_role_commit(struct wlr_surface *wlr_surface) {
 		return;
 	}
 
+	struct wlr_layer_surface_v1_state *pending = &surface->client_pending;
+	struct wlr_layer_surface_v1_state *current = &surface->current;
+	bool changed = current->anchor != pending->anchor ||
+		current->exclusive_zone != pending->exclusive_zone ||
+		memcmp(&current->margin, &pending->margin, sizeof(current->margin)) ||
+		current->desired_width != pending->desired_width ||
+		current->desired_height != pending->desired_height ||
+		current->layer != pending->layer;
+
 	surface->current.anchor = surface->client_pending.anchor;
 	surface->current.exclusive_zone = surface->client_pending.exclusive_zone;
 	surface->current.margin = surface->client_pending.margin;
@@ -379,11 +395,16 @@ static void layer_surface_role_commit(struct wlr_surface *wlr_surface) {
 		// either the compositor found a suitable output or it must
 		// have closed the surface
 		assert(surface->output || surface->closed);
+		changed = true;
 	}
 	if (surface->configured && wlr_surface_has_buffer(surface->surface) &&
 			!surface->mapped) {
 		surface->mapped = true;
 		wlr_signal_emit_safe(&surface->events.map, surface);
+		changed = true;
+	}
+	if (changed) {
+		layer_surface_schedule_arrange(surface);
 	}
 	if (surface->configured && !wlr_surface_has_buffer(surface->surface) &&
 			surface->mapped) {
@@ -458,6 +479,7 @@ static void layer_shell_handle_get_layer_surface(struct wl_client *wl_client,
 
 	wl_list_init(&surface->configure_list);
 	wl_list_init(&surface->popups);
+	wl_list_insert(&shell->surfaces, &surface->link);
 
 	wl_signal_init(&surface->events.destroy);
 	wl_signal_init(&surface->events.map);
@@ -498,6 +520,10 @@ static void handle_display_destroy(struct wl_listener *listener, void *data) {
 	struct wlr_layer_shell_v1 *layer_shell =
 		wl_container_of(listener, layer_shell, display_destroy);
 	wlr_signal_emit_safe(&layer_shell->events.destroy, layer_shell);
+	struct wlr_layer_output_v1 *layer_output, *tmp;
+	wl_list_for_each_safe(layer_output, tmp, &layer_shell->outputs, link) {
+		wlr_layer_output_v1_destroy(layer_output);
+	}
 	wl_list_remove(&layer_shell->display_destroy.link);
 	wl_global_destroy(layer_shell->global);
 	free(layer_shell);
@@ -521,6 +547,8 @@ struct wlr_layer_shell_v1 *wlr_layer_shell_v1_create(struct wl_display *display)
 
 	wl_signal_init(&layer_shell->events.new_surface);
 	wl_signal_init(&layer_shell->events.destroy);
+	wl_list_init(&layer_shell->surfaces);
+	wl_list_init(&layer_shell->outputs);
 
 	layer_shell->display_destroy.notify = handle_display_destroy;
 	wl_display_add_destroy_listener(display, &layer_shell->display_destroy);
@@ -602,3 +630,277 @@ struct wlr_surface *wlr_layer_surface_v1_popup_surface_at(
 
 	return NULL;
 }
+
+static bool box_equal(const struct wlr_box *a, const struct wlr_box *b) {
+	return a->x == b->x && a->y == b->y &&
+		a->width == b->width && a->height == b->height;
+}
+
+static void apply_exclusive(struct wlr_box *usable_area,
+		const struct wlr_layer_surface_v1_state *state) {
+	if (state->exclusive_zone <= 0) {
+		return;
+	}
+	struct {
+		uint32_t singular_anchor;
+		uint32_t anchor_triplet;
+		int *positive_axis;
+		int *negative_axis;
+		int margin;
+	} edges[] = {
+		{
+			.singular_anchor = ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP,
+			.anchor_triplet = ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
+				ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT |
+				ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP,
+			.positive_axis = &usable_area->y,
+			.negative_axis = &usable_area->height,
+			.margin = state->margin.top,
+		},
+		{
+			.singular_anchor = ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM,
+			.anchor_triplet = ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
+				ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT |
+				ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM,
+			.positive_axis = NULL,
+			.negative_axis = &usable_area->height,
+			.margin = state->margin.bottom,
+		},
+		{
+			.singular_anchor = ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT,
+			.anchor_triplet = ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
+				ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM |
+				ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT,
+			.positive_axis = &usable_area->x,
+			.negative_axis = &usable_area->width,
+			.margin = state->margin.left,
+		},
+		{
+			.singular_anchor = ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT,
+			.anchor_triplet = ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
+				ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM |
+				ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT,
+			.positive_axis = NULL,
+			.negative_axis = &usable_area->width,
+			.margin = state->margin.right,
+		},
+	};
+	for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); ++i) {
+		if ((state->anchor == edges[i].singular_anchor ||
+				state->anchor == edges[i].anchor_triplet) &&
+				state->exclusive_zone + edges[i].margin > 0) {
+			if (edges[i].positive_axis) {
+				*edges[i].positive_axis +=
+					state->exclusive_zone + edges[i].margin;
+			}
+			if (edges[i].negative_axis) {
+				*edges[i].negative_axis -=
+					state->exclusive_zone + edges[i].margin;
+			}
+			break;
+		}
+	}
+}
+
+/**
+ * Compute the geometry of the surface within the bounds. Returns false if the
+ * margins don't leave any room for the surface.
+ */
+static bool layer_surface_compute_geometry(
+		const struct wlr_layer_surface_v1_state *state,
+		const struct wlr_box *bounds, struct wlr_box *box) {
+	box->width = state->desired_width;
+	box->height = state->desired_height;
+
+	// Horizontal axis
+	const uint32_t both_horiz = ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
+		ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT;
+	if (box->width == 0) {
+		box->x = bounds->x + state->margin.left;
+		box->width = bounds->width -
+			(state->margin.left + state->margin.right);
+	} else if ((state->anchor & both_horiz) == both_horiz) {
+		box->x = bounds->x + bounds->width / 2 - box->width / 2;
+	} else if (state->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT) {
+		box->x = bounds->x + state->margin.left;
+	} else if (state->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT) {
+		box->x = bounds->x + bounds->width - box->width - state->margin.right;
+	} else {
+		box->x = bounds->x + bounds->width / 2 - box->width / 2;
+	}
+
+	// Vertical axis
+	const uint32_t both_vert = ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
+		ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM;
+	if (box->height == 0) {
+		box->y = bounds->y + state->margin.top;
+		box->height = bounds->height -
+			(state->margin.top + state->margin.bottom);
+	} else if ((state->anchor & both_vert) == both_vert) {
+		box->y = bounds->y + bounds->height / 2 - box->height / 2;
+	} else if (state->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP) {
+		box->y = bounds->y + state->margin.top;
+	} else if (state->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM) {
+		box->y = bounds->y + bounds->height - box->height -
+			state->margin.bottom;
+	} else {
+		box->y = bounds->y + bounds->height / 2 - box->height / 2;
+	}
+
+	return box->width > 0 && box->height > 0;
+}
+
+static bool arrange_layer(struct wlr_layer_output_v1 *layer_output,
+		enum zwlr_layer_shell_v1_layer layer, const struct wlr_box *full_area,
+		struct wlr_box *usable_area, bool exclusive) {
+	bool changed = false;
+	struct wlr_layer_surface_v1 *surface, *tmp;
+	wl_list_for_each_safe(surface, tmp, &layer_output->shell->surfaces, link) {
+		struct wlr_layer_surface_v1_state *state = &surface->current;
+		if (surface->output != layer_output->output || !surface->added ||
+				surface->closed || state->layer != layer ||
+				exclusive != (state->exclusive_zone > 0)) {
+			continue;
+		}
+
+		const struct wlr_box *bounds =
+			state->exclusive_zone == -1 ? full_area : usable_area;
+		struct wlr_box box;
+		if (!layer_surface_compute_geometry(state, bounds, &box)) {
+			wlr_log(WLR_DEBUG, "No room left for layer surface %p", surface);
+			wlr_layer_surface_v1_close(surface);
+			continue;
+		}
+
+		if (!box_equal(&box, &surface->geometry)) {
+			surface->geometry = box;
+			changed = true;
+		}
+		// Only mapped surfaces take space from the others
+		if (surface->mapped) {
+			apply_exclusive(usable_area, state);
+		}
+		wlr_layer_surface_v1_configure(surface, box.width, box.height);
+	}
+	return changed;
+}
+
+static void layer_output_arrange(struct wlr_layer_output_v1 *layer_output) {
+	struct wlr_box full_area = {0};
+	wlr_output_effective_resolution(layer_output->output,
+		&full_area.width, &full_area.height);
+	struct wlr_box usable_area = full_area;
+
+	// Surfaces with an exclusive zone are placed first, from the top layer
+	static const enum zwlr_layer_shell_v1_layer layers[] = {
+		ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY,
+		ZWLR_LAYER_SHELL_V1_LAYER_TOP,
+		ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM,
+		ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND,
+	};
+	size_t layers_len = sizeof(layers) / sizeof(layers[0]);
+	bool changed = false;
+	for (size_t i = 0; i < layers_len; ++i) {
+		changed |= arrange_layer(layer_output, layers[i], &full_area,
+			&usable_area, true);
+	}
+	for (size_t i = 0; i < layers_len; ++i) {
+		changed |= arrange_layer(layer_output, layers[i], &full_area,
+			&usable_area, false);
+	}
+
+	if (!box_equal(&usable_area, &layer_output->usable_area)) {
+		layer_output->usable_area = usable_area;
+		wlr_signal_emit_safe(&layer_output->events.usable_area,
+			layer_output);
+	}
+	if (changed) {
+		wlr_signal_emit_safe(&layer_output->events.arrange, layer_output);
+	}
+}
+
+static void layer_output_handle_idle_arrange(void *data) {
+	struct wlr_layer_output_v1 *layer_output = data;
+	layer_output->idle_arrange = NULL;
+	layer_output_arrange(layer_output);
+}
+
+void wlr_layer_output_v1_schedule_arrange(
+		struct wlr_layer_output_v1 *layer_output) {
+	if (layer_output->idle_arrange != NULL) {
+		return;
+	}
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(layer_output->output->display);
+	layer_output->idle_arrange = wl_event_loop_add_idle(loop,
+		layer_output_handle_idle_arrange, layer_output);
+}
+
+static void layer_surface_schedule_arrange(
+		struct wlr_layer_surface_v1 *surface) {
+	struct wlr_layer_output_v1 *layer_output;
+	wl_list_for_each(layer_output, &surface->shell->outputs, link) {
+		if (layer_output->output == surface->output) {
+			wlr_layer_output_v1_schedule_arrange(layer_output);
+			return;
+		}
+	}
+}
+
+static void layer_output_handle_output_commit(struct wl_listener *listener,
+		void *data) {
+	struct wlr_layer_output_v1 *layer_output =
+		wl_container_of(listener, layer_output, output_commit);
+	struct wlr_output_event_commit *event = data;
+	if (event->committed & (WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_SCALE |
+			WLR_OUTPUT_STATE_TRANSFORM)) {
+		wlr_layer_output_v1_schedule_arrange(layer_output);
+	}
+}
+
+static void layer_output_handle_output_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_layer_output_v1 *layer_output =
+		wl_container_of(listener, layer_output, output_destroy);
+	wlr_layer_output_v1_destroy(layer_output);
+}
+
+struct wlr_layer_output_v1 *wlr_layer_output_v1_create(
+		struct wlr_layer_shell_v1 *shell, struct wlr_output *output) {
+	struct wlr_layer_output_v1 *layer_output =
+		calloc(1, sizeof(struct wlr_layer_output_v1));
+	if (layer_output == NULL) {
+		return NULL;
+	}
+	layer_output->shell = shell;
+	layer_output->output = output;
+	wl_signal_init(&layer_output->events.arrange);
+	wl_signal_init(&layer_output->events.usable_area);
+	wl_signal_init(&layer_output->events.destroy);
+
+	wlr_output_effective_resolution(output, &layer_output->usable_area.width,
+		&layer_output->usable_area.height);
+
+	layer_output->output_commit.notify = layer_output_handle_output_commit;
+	wl_signal_add(&output->events.commit, &layer_output->output_commit);
+	layer_output->output_destroy.notify = layer_output_handle_output_destroy;
+	wl_signal_add(&output->events.destroy, &layer_output->output_destroy);
+	wl_list_insert(&shell->outputs, &layer_output->link);
+
+	wlr_layer_output_v1_schedule_arrange(layer_output);
+	return layer_output;
+}
+
+void wlr_layer_output_v1_destroy(struct wlr_layer_output_v1 *layer_output) {
+	if (layer_output == NULL) {
+		return;
+	}
+	wlr_signal_emit_safe(&layer_output->events.destroy, layer_output);
+	if (layer_output->idle_arrange != NULL) {
+		wl_event_source_remove(layer_output->idle_arrange);
+	}
+	wl_list_remove(&layer_output->output_commit.link);
+	wl_list_remove(&layer_output->output_destroy.link);
+	wl_list_remove(&layer_output->link);
+	free(layer_output);
+}
@@ -2,16 +2,57 @@
 #include <assert.h>
 #include <drm_fourcc.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/render/drm_format_set.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_surface.h>
 #include <wlr/util/log.h>
 #include "linux-dmabuf-unstable-v1-protocol.h"
+#include "render/wlr_texture.h"
+#include "util/shm.h"
 #include "util/signal.h"
 
-#define LINUX_DMABUF_VERSION 3
+#define LINUX_DMABUF_VERSION 4
+
+struct wlr_linux_dmabuf_feedback_v1_compiled_tranche {
+	dev_t target_device;
+	uint32_t flags; // bitfield of enum zwp_linux_dmabuf_feedback_v1_tranche_flags
+	struct wl_array indices; // uint16_t
+};
+
+struct wlr_linux_dmabuf_feedback_v1_compiled {
+	dev_t main_device;
+	int table_fd;
+	size_t table_size;
+
+	size_t tranches_len;
+	struct wlr_linux_dmabuf_feedback_v1_compiled_tranche tranches[];
+};
+
+// Entry of the format table shared with clients, as defined by the protocol
+struct wlr_linux_dmabuf_feedback_v1_table_entry {
+	uint32_t format;
+	uint32_t pad; // unused
+	uint64_t modifier;
+};
+
+static_assert(sizeof(struct wlr_linux_dmabuf_feedback_v1_table_entry) == 16,
+	"Expected format table entry to be 16 bytes");
+
+struct wlr_linux_dmabuf_v1_surface {
+	struct wlr_surface *surface;
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf;
+	struct wl_list link; // wlr_linux_dmabuf_v1.surfaces
+
+	struct wlr_linux_dmabuf_feedback_v1_compiled *feedback; // NULL for default
+	struct wl_list feedback_resources; // wl_resource_get_link
+
+	struct wl_listener surface_destroy;
+};
 
 static void buffer_handle_destroy(struct wl_client *client,
 		struct wl_resource *resource) {
@@ -150,15 +191,16 @@ static void buffer_handle_resource_destroy(struct wl_resource *buffer_resource)
 }
 
 static bool check_import_dmabuf(struct wlr_linux_dmabuf_v1 *linux_dmabuf,
-		struct wlr_dmabuf_attributes *attribs) {
+		struct wlr_dmabuf_v1_buffer *buffer) {
 	struct wlr_texture *texture =
-		wlr_texture_from_dmabuf(linux_dmabuf->renderer, attribs);
+		wlr_texture_from_buffer(linux_dmabuf->renderer, &buffer->base);
 	if (texture == NULL) {
 		return false;
 	}
 
-	// We can import the image, good. No need to keep it since wlr_surface will
-	// import it again on commit.
+	// We can import the image, good. The renderer may keep the texture
+	// attached to the buffer, in which case wlr_surface will re-use it on
+	// commit instead of importing the buffer again.
 	wlr_texture_destroy(texture);
 	return true;
 }
@@ -273,31 +315,35 @@ static void params_create_common(struct wl_resource *params_resource,
 		goto err_out;
 	}
 
-	/* Check if dmabuf is usable */
-	if (!check_import_dmabuf(linux_dmabuf, &attribs)) {
-		goto err_failed;
-	}
-
 	struct wlr_dmabuf_v1_buffer *buffer = calloc(1, sizeof(*buffer));
 	if (!buffer) {
 		wl_resource_post_no_memory(params_resource);
 		goto err_failed;
 	}
 	wlr_buffer_init(&buffer->base, &buffer_impl, attribs.width, attribs.height);
+	buffer->attributes = attribs;
+
+	/* Check if dmabuf is usable. This happens before the release listener
+	 * is set up, so that the client doesn't get a spurious release. */
+	if (!check_import_dmabuf(linux_dmabuf, buffer)) {
+		wlr_addon_set_finish(&buffer->base.addons);
+		free(buffer);
+		goto err_failed;
+	}
 
 	struct wl_client *client = wl_resource_get_client(params_resource);
 	buffer->resource = wl_resource_create(client, &wl_buffer_interface,
 		1, buffer_id);
 	if (!buffer->resource) {
 		wl_resource_post_no_memory(params_resource);
+		// Destroys the texture cached by the renderer, if any
+		wlr_addon_set_finish(&buffer->base.addons);
 		free(buffer);
 		goto err_failed;
 	}
 	wl_resource_set_implementation(buffer->resource,
 		&wl_buffer_impl, buffer, buffer_handle_resource_destroy);
 
-	buffer->attributes = attribs;
-
 	buffer->release.notify = buffer_handle_release;
 	wl_signal_add(&buffer->base.events.release, &buffer->release);
 
@@ -405,11 +451,348 @@ static void linux_dmabuf_destroy(struct wl_client *client,
 	wl_resource_destroy(resource);
 }
 
+static void feedback_compiled_destroy(
+		struct wlr_linux_dmabuf_feedback_v1_compiled *feedback) {
+	if (feedback == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < feedback->tranches_len; i++) {
+		wl_array_release(&feedback->tranches[i].indices);
+	}
+	if (feedback->table_fd >= 0) {
+		close(feedback->table_fd);
+	}
+	free(feedback);
+}
+
+static ssize_t table_find_or_add(
+		struct wlr_linux_dmabuf_feedback_v1_table_entry *table,
+		size_t *table_len, uint32_t format, uint64_t modifier) {
+	for (size_t i = 0; i < *table_len; i++) {
+		if (table[i].format == format && table[i].modifier == modifier) {
+			return i;
+		}
+	}
+	// Indices are sent as 16-bit integers
+	if (*table_len > UINT16_MAX) {
+		return -1;
+	}
+	table[*table_len] = (struct wlr_linux_dmabuf_feedback_v1_table_entry){
+		.format = format,
+		.modifier = modifier,
+	};
+	return (*table_len)++;
+}
+
+static bool tranche_add_index(
+		struct wlr_linux_dmabuf_feedback_v1_compiled_tranche *tranche,
+		ssize_t index) {
+	if (index < 0) {
+		wlr_log(WLR_ERROR, "Too many entries in DMA-BUF format table");
+		return false;
+	}
+	uint16_t *ptr = wl_array_add(&tranche->indices, sizeof(*ptr));
+	if (ptr == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+	*ptr = index;
+	return true;
+}
+
+/**
+ * Build the format table and the per-tranche indices sent to clients.
+ *
+ * The last tranche is the fallback one: like with the legacy modifier events,
+ * the implicit modifier is always accepted for its formats. In other tranches
+ * the implicit modifier is only advertised for formats which don't support
+ * any explicit modifier.
+ */
+static struct wlr_linux_dmabuf_feedback_v1_compiled *feedback_compile(
+		const struct wlr_linux_dmabuf_feedback_v1 *feedback) {
+	assert(feedback->tranches_len > 0);
+
+	size_t table_cap = 0;
+	for (size_t i = 0; i < feedback->tranches_len; i++) {
+		const struct wlr_drm_format_set *formats =
+			feedback->tranches[i].formats;
+		for (size_t j = 0; j < formats->len; j++) {
+			table_cap += formats->formats[j]->len + 1;
+		}
+	}
+
+	struct wlr_linux_dmabuf_feedback_v1_table_entry *table =
+		calloc(table_cap > 0 ? table_cap : 1, sizeof(table[0]));
+	struct wlr_linux_dmabuf_feedback_v1_compiled *compiled = calloc(1,
+		sizeof(*compiled) + feedback->tranches_len * sizeof(compiled->tranches[0]));
+	if (table == NULL || compiled == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		free(table);
+		free(compiled);
+		return NULL;
+	}
+	compiled->main_device = feedback->main_device;
+	compiled->table_fd = -1;
+	compiled->tranches_len = feedback->tranches_len;
+
+	size_t table_len = 0;
+	for (size_t i = 0; i < feedback->tranches_len; i++) {
+		const struct wlr_linux_dmabuf_feedback_v1_tranche *tranche =
+			&feedback->tranches[i];
+		struct wlr_linux_dmabuf_feedback_v1_compiled_tranche *compiled_tranche =
+			&compiled->tranches[i];
+		compiled_tranche->target_device = tranche->target_device;
+		compiled_tranche->flags = tranche->flags;
+		wl_array_init(&compiled_tranche->indices);
+
+		bool fallback = i == feedback->tranches_len - 1;
+		for (size_t j = 0; j < tranche->formats->len; j++) {
+			const struct wlr_drm_format *fmt = tranche->formats->formats[j];
+			for (size_t k = 0; k < fmt->len; k++) {
+				ssize_t index = table_find_or_add(table, &table_len,
+					fmt->format, fmt->modifiers[k]);
+				if (!tranche_add_index(compiled_tranche, index)) {
+					goto error;
+				}
+			}
+			if (fallback || fmt->len == 0) {
+				ssize_t index = table_find_or_add(table, &table_len,
+					fmt->format, DRM_FORMAT_MOD_INVALID);
+				if (!tranche_add_index(compiled_tranche, index)) {
+					goto error;
+				}
+			}
+		}
+	}
+
+	// Clients get a read-only mapping of the table, so that a single copy
+	// can be shared with all of them
+	size_t table_size = table_len * sizeof(table[0]);
+	int rw_fd, ro_fd;
+	if (!allocate_shm_file_pair(table_size, &rw_fd, &ro_fd)) {
+		wlr_log(WLR_ERROR, "Failed to allocate shm file for format table");
+		goto error;
+	}
+
+	void *dst = mmap(NULL, table_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		rw_fd, 0);
+	if (dst == MAP_FAILED) {
+		wlr_log_errno(WLR_ERROR, "mmap failed");
+		close(rw_fd);
+		close(ro_fd);
+		goto error;
+	}
+	memcpy(dst, table, table_size);
+	munmap(dst, table_size);
+	close(rw_fd);
+
+	compiled->table_fd = ro_fd;
+	compiled->table_size = table_size;
+
+	free(table);
+	return compiled;
+
+error:
+	free(table);
+	feedback_compiled_destroy(compiled);
+	return NULL;
+}
+
+static void send_dev(struct wl_resource *resource, dev_t dev,
+		void (*send)(struct wl_resource *resource, struct wl_array *dev)) {
+	struct wl_array dev_array = {
+		.size = sizeof(dev),
+		.alloc = sizeof(dev),
+		.data = &dev,
+	};
+	send(resource, &dev_array);
+}
+
+static void feedback_send(struct wl_resource *resource,
+		const struct wlr_linux_dmabuf_feedback_v1_compiled *feedback) {
+	send_dev(resource, feedback->main_device,
+		zwp_linux_dmabuf_feedback_v1_send_main_device);
+	zwp_linux_dmabuf_feedback_v1_send_format_table(resource,
+		feedback->table_fd, feedback->table_size);
+
+	for (size_t i = 0; i < feedback->tranches_len; i++) {
+		const struct wlr_linux_dmabuf_feedback_v1_compiled_tranche *tranche =
+			&feedback->tranches[i];
+		send_dev(resource, tranche->target_device,
+			zwp_linux_dmabuf_feedback_v1_send_tranche_target_device);
+		zwp_linux_dmabuf_feedback_v1_send_tranche_flags(resource,
+			tranche->flags);
+		// wl_array isn't const-correct
+		zwp_linux_dmabuf_feedback_v1_send_tranche_formats(resource,
+			(struct wl_array *)&tranche->indices);
+		zwp_linux_dmabuf_feedback_v1_send_tranche_done(resource);
+	}
+
+	zwp_linux_dmabuf_feedback_v1_send_done(resource);
+}
+
+static void feedback_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct zwp_linux_dmabuf_feedback_v1_interface feedback_impl = {
+	.destroy = feedback_handle_destroy,
+};
+
+static void feedback_handle_resource_destroy(struct wl_resource *resource) {
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+static struct wl_resource *feedback_resource_create(
+		struct wl_resource *linux_dmabuf_resource, uint32_t id) {
+	struct wl_client *client = wl_resource_get_client(linux_dmabuf_resource);
+	uint32_t version = wl_resource_get_version(linux_dmabuf_resource);
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwp_linux_dmabuf_feedback_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_resource_post_no_memory(linux_dmabuf_resource);
+		return NULL;
+	}
+	wl_resource_set_implementation(resource, &feedback_impl, NULL,
+		feedback_handle_resource_destroy);
+	wl_list_init(wl_resource_get_link(resource));
+	return resource;
+}
+
+static void linux_dmabuf_get_default_feedback(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf =
+		linux_dmabuf_from_resource(resource);
+
+	struct wl_resource *feedback_resource =
+		feedback_resource_create(resource, id);
+	if (feedback_resource == NULL) {
+		return;
+	}
+	feedback_send(feedback_resource, linux_dmabuf->default_feedback);
+}
+
+static void surface_destroy(struct wlr_linux_dmabuf_v1_surface *surface) {
+	struct wl_resource *resource, *tmp;
+	wl_resource_for_each_safe(resource, tmp, &surface->feedback_resources) {
+		struct wl_list *link = wl_resource_get_link(resource);
+		wl_list_remove(link);
+		wl_list_init(link);
+	}
+
+	wl_list_remove(&surface->surface_destroy.link);
+	wl_list_remove(&surface->link);
+	feedback_compiled_destroy(surface->feedback);
+	free(surface);
+}
+
+static void surface_handle_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_linux_dmabuf_v1_surface *surface =
+		wl_container_of(listener, surface, surface_destroy);
+	surface_destroy(surface);
+}
+
+static struct wlr_linux_dmabuf_v1_surface *surface_get_or_create(
+		struct wlr_linux_dmabuf_v1 *linux_dmabuf,
+		struct wlr_surface *wlr_surface) {
+	struct wlr_linux_dmabuf_v1_surface *surface;
+	wl_list_for_each(surface, &linux_dmabuf->surfaces, link) {
+		if (surface->surface == wlr_surface) {
+			return surface;
+		}
+	}
+
+	surface = calloc(1, sizeof(*surface));
+	if (surface == NULL) {
+		return NULL;
+	}
+	surface->surface = wlr_surface;
+	surface->linux_dmabuf = linux_dmabuf;
+	wl_list_init(&surface->feedback_resources);
+
+	surface->surface_destroy.notify = surface_handle_destroy;
+	wl_signal_add(&wlr_surface->events.destroy, &surface->surface_destroy);
+
+	wl_list_insert(&linux_dmabuf->surfaces, &surface->link);
+	return surface;
+}
+
+static const struct wlr_linux_dmabuf_feedback_v1_compiled *surface_get_feedback(
+		struct wlr_linux_dmabuf_v1_surface *surface) {
+	if (surface->feedback != NULL) {
+		return surface->feedback;
+	}
+	return surface->linux_dmabuf->default_feedback;
+}
+
+static void linux_dmabuf_get_surface_feedback(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource) {
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf =
+		linux_dmabuf_from_resource(resource);
+	struct wlr_surface *wlr_surface =
+		wlr_surface_from_resource(surface_resource);
+
+	struct wlr_linux_dmabuf_v1_surface *surface =
+		surface_get_or_create(linux_dmabuf, wlr_surface);
+	if (surface == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	struct wl_resource *feedback_resource =
+		feedback_resource_create(resource, id);
+	if (feedback_resource == NULL) {
+		return;
+	}
+	wl_list_insert(&surface->feedback_resources,
+		wl_resource_get_link(feedback_resource));
+	feedback_send(feedback_resource, surface_get_feedback(surface));
+}
+
 static const struct zwp_linux_dmabuf_v1_interface linux_dmabuf_impl = {
 	.destroy = linux_dmabuf_destroy,
 	.create_params = linux_dmabuf_create_params,
+	.get_default_feedback = linux_dmabuf_get_default_feedback,
+	.get_surface_feedback = linux_dmabuf_get_surface_feedback,
 };
 
+bool wlr_linux_dmabuf_v1_set_surface_feedback(
+		struct wlr_linux_dmabuf_v1 *linux_dmabuf,
+		struct wlr_surface *wlr_surface,
+		const struct wlr_linux_dmabuf_feedback_v1 *feedback) {
+	if (linux_dmabuf->default_feedback == NULL) {
+		// Feedback isn't advertised to clients
+		return false;
+	}
+
+	struct wlr_linux_dmabuf_v1_surface *surface =
+		surface_get_or_create(linux_dmabuf, wlr_surface);
+	if (surface == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+
+	struct wlr_linux_dmabuf_feedback_v1_compiled *compiled = NULL;
+	if (feedback != NULL) {
+		compiled = feedback_compile(feedback);
+		if (compiled == NULL) {
+			return false;
+		}
+	}
+
+	feedback_compiled_destroy(surface->feedback);
+	surface->feedback = compiled;
+
+	struct wl_resource *resource;
+	wl_resource_for_each(resource, &surface->feedback_resources) {
+		feedback_send(resource, surface_get_feedback(surface));
+	}
+
+	return true;
+}
+
 static void linux_dmabuf_send_modifiers(struct wl_resource *resource,
 		const struct wlr_drm_format *fmt) {
 	if (wl_resource_get_version(resource) < ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION) {
@@ -454,16 +837,26 @@ static void linux_dmabuf_bind(struct wl_client *client, void *data,
 	}
 	wl_resource_set_implementation(resource, &linux_dmabuf_impl,
 		linux_dmabuf, NULL);
-	linux_dmabuf_send_formats(linux_dmabuf, resource);
+
+	// The format and modifier events are deprecated in favor of feedback
+	if (version < ZWP_LINUX_DMABUF_V1_GET_DEFAULT_FEEDBACK_SINCE_VERSION) {
+		linux_dmabuf_send_formats(linux_dmabuf, resource);
+	}
 }
 
 static void linux_dmabuf_v1_destroy(struct wlr_linux_dmabuf_v1 *linux_dmabuf) {
 	wlr_signal_emit_safe(&linux_dmabuf->events.destroy, linux_dmabuf);
 
+	struct wlr_linux_dmabuf_v1_surface *surface, *surface_tmp;
+	wl_list_for_each_safe(surface, surface_tmp, &linux_dmabuf->surfaces, link) {
+		surface_destroy(surface);
+	}
+
 	wl_list_remove(&linux_dmabuf->display_destroy.link);
 	wl_list_remove(&linux_dmabuf->renderer_destroy.link);
 
 	wl_global_destroy(linux_dmabuf->global);
+	feedback_compiled_destroy(linux_dmabuf->default_feedback);
 	free(linux_dmabuf);
 }
 
@@ -479,6 +872,39 @@ static void handle_renderer_destroy(struct wl_listener *listener, void *data) {
 	linux_dmabuf_v1_destroy(linux_dmabuf);
 }
 
+static struct wlr_linux_dmabuf_feedback_v1_compiled *create_default_feedback(
+		struct wlr_renderer *renderer) {
+	int drm_fd = wlr_renderer_get_drm_fd(renderer);
+	if (drm_fd < 0) {
+		wlr_log(WLR_INFO, "Renderer has no DRM FD, "
+			"disabling DMA-BUF feedback");
+		return NULL;
+	}
+
+	struct stat stat;
+	if (fstat(drm_fd, &stat) != 0) {
+		wlr_log_errno(WLR_ERROR, "fstat failed");
+		return NULL;
+	}
+
+	const struct wlr_drm_format_set *formats =
+		wlr_renderer_get_dmabuf_texture_formats(renderer);
+	if (formats == NULL || formats->len == 0) {
+		return NULL;
+	}
+
+	struct wlr_linux_dmabuf_feedback_v1_tranche tranche = {
+		.target_device = stat.st_rdev,
+		.formats = formats,
+	};
+	struct wlr_linux_dmabuf_feedback_v1 feedback = {
+		.main_device = stat.st_rdev,
+		.tranches_len = 1,
+		.tranches = &tranche,
+	};
+	return feedback_compile(&feedback);
+}
+
 struct wlr_linux_dmabuf_v1 *wlr_linux_dmabuf_v1_create(struct wl_display *display,
 		struct wlr_renderer *renderer) {
 	struct wlr_linux_dmabuf_v1 *linux_dmabuf =
@@ -488,14 +914,23 @@ struct wlr_linux_dmabuf_v1 *wlr_linux_dmabuf_v1_create(struct wl_display *displa
 		return NULL;
 	}
 	linux_dmabuf->renderer = renderer;
+	wl_list_init(&linux_dmabuf->surfaces);
 
 	wl_signal_init(&linux_dmabuf->events.destroy);
 
+	// Without a main device, feedback can't be sent: stick to version 3
+	uint32_t version = LINUX_DMABUF_VERSION;
+	linux_dmabuf->default_feedback = create_default_feedback(renderer);
+	if (linux_dmabuf->default_feedback == NULL) {
+		version = 3;
+	}
+
 	linux_dmabuf->global =
 		wl_global_create(display, &zwp_linux_dmabuf_v1_interface,
-			LINUX_DMABUF_VERSION, linux_dmabuf, linux_dmabuf_bind);
+			version, linux_dmabuf, linux_dmabuf_bind);
 	if (!linux_dmabuf->global) {
 		wlr_log(WLR_ERROR, "could not create linux dmabuf v1 wl global");
+		feedback_compiled_destroy(linux_dmabuf->default_feedback);
 		free(linux_dmabuf);
 		return NULL;
 	}
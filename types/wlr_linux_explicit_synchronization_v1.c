@@ -0,0 +1,549 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_linux_explicit_synchronization_v1.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/log.h>
+#include "linux-explicit-synchronization-unstable-v1-protocol.h"
+#include "render/dmabuf.h"
+#include "util/signal.h"
+
+#define LINUX_EXPLICIT_SYNCHRONIZATION_VERSION 2
+
+static const struct zwp_linux_explicit_synchronization_v1_interface
+	explicit_sync_impl;
+static const struct zwp_linux_surface_synchronization_v1_interface
+	surface_sync_impl;
+
+static struct wlr_linux_explicit_synchronization_v1 *explicit_sync_from_resource(
+		struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource,
+		&zwp_linux_explicit_synchronization_v1_interface,
+		&explicit_sync_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+// Returns NULL if the surface synchronization object is inert
+static struct wlr_linux_surface_synchronization_v1 *surface_sync_from_resource(
+		struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource,
+		&zwp_linux_surface_synchronization_v1_interface,
+		&surface_sync_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+/**
+ * A commit which used explicit synchronization, from the client commit until
+ * its state is applied.
+ */
+struct surface_sync_commit {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync;
+	uint32_t seq; // surface state
+	bool locked; // whether the surface state is held back
+
+	int acquire_fence_fd; // -1 once signalled
+	struct wl_event_source *event_source;
+
+	struct wlr_linux_buffer_release_v1 *buffer_release; // may be NULL
+
+	struct wl_list link; // wlr_linux_surface_synchronization_v1.commits
+};
+
+static void buffer_release_handle_resource_destroy(
+		struct wl_resource *resource) {
+	struct wlr_linux_buffer_release_v1 *buffer_release =
+		wl_resource_get_user_data(resource);
+	if (buffer_release->ref != NULL) {
+		*buffer_release->ref = NULL;
+	}
+	if (buffer_release->buffer != NULL) {
+		wl_list_remove(&buffer_release->buffer_release.link);
+	}
+	wlr_dmabuf_attributes_finish(&buffer_release->dmabuf);
+	free(buffer_release);
+}
+
+static void buffer_release_send_immediate(
+		struct wlr_linux_buffer_release_v1 *buffer_release) {
+	zwp_linux_buffer_release_v1_send_immediate_release(
+		buffer_release->resource);
+	wl_resource_destroy(buffer_release->resource);
+}
+
+/**
+ * Export the fences of the reads still pending on the buffer, e.g. GPU
+ * sampling of the last frames which used it. Returns -1 if there are none.
+ */
+static int buffer_release_export_fence(
+		struct wlr_linux_buffer_release_v1 *buffer_release) {
+	const struct wlr_dmabuf_attributes *attribs = &buffer_release->dmabuf;
+
+	int fence_fd = -1;
+	for (int i = 0; i < attribs->n_planes; i++) {
+		bool dup = false;
+		for (int j = 0; j < i; j++) {
+			dup = dup || attribs->fd[j] == attribs->fd[i];
+		}
+		if (dup) {
+			continue;
+		}
+
+		int plane_fence_fd = dmabuf_export_write_sync_file(attribs->fd[i]);
+		if (plane_fence_fd < 0) {
+			continue;
+		}
+		if (fence_fd < 0) {
+			fence_fd = plane_fence_fd;
+			continue;
+		}
+
+		int merged_fd = sync_file_merge(fence_fd, plane_fence_fd);
+		close(plane_fence_fd);
+		if (merged_fd < 0) {
+			// Waiting on part of the reads is worse than implicit sync
+			close(fence_fd);
+			return -1;
+		}
+		close(fence_fd);
+		fence_fd = merged_fd;
+	}
+	return fence_fd;
+}
+
+static void buffer_release_handle_buffer_release(struct wl_listener *listener,
+		void *data) {
+	struct wlr_linux_buffer_release_v1 *buffer_release =
+		wl_container_of(listener, buffer_release, buffer_release);
+
+	int fence_fd = buffer_release_export_fence(buffer_release);
+	if (fence_fd < 0) {
+		buffer_release_send_immediate(buffer_release);
+		return;
+	}
+
+	zwp_linux_buffer_release_v1_send_fenced_release(buffer_release->resource,
+		fence_fd);
+	close(fence_fd);
+	wl_resource_destroy(buffer_release->resource);
+}
+
+static void buffer_release_set_ref(
+		struct wlr_linux_buffer_release_v1 *buffer_release,
+		struct wlr_linux_buffer_release_v1 **ref) {
+	*ref = buffer_release;
+	buffer_release->ref = ref;
+}
+
+/**
+ * Attach the release object to the buffer which became current.
+ */
+static void buffer_release_commit(
+		struct wlr_linux_buffer_release_v1 *buffer_release,
+		struct wlr_surface *surface) {
+	struct wl_resource *buffer_resource = surface->current.buffer_resource;
+	*buffer_release->ref = NULL;
+	buffer_release->ref = NULL;
+
+	if (surface->buffer == NULL || buffer_resource == NULL ||
+			surface->buffer->resource != buffer_resource) {
+		// The buffer couldn't be imported or was destroyed, we'll never
+		// use it
+		buffer_release_send_immediate(buffer_release);
+		return;
+	}
+
+	// Without a copy we fall back to an immediate release
+	struct wlr_dmabuf_v1_buffer *dmabuf =
+		wlr_dmabuf_v1_buffer_from_buffer_resource(buffer_resource);
+	wlr_dmabuf_attributes_copy(&buffer_release->dmabuf, &dmabuf->attributes);
+
+	buffer_release->buffer = &surface->buffer->base;
+	buffer_release->buffer_release.notify =
+		buffer_release_handle_buffer_release;
+	wl_signal_add(&buffer_release->buffer->events.release,
+		&buffer_release->buffer_release);
+}
+
+static void surface_sync_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void surface_sync_handle_set_acquire_fence(struct wl_client *client,
+		struct wl_resource *resource, int32_t fd) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		surface_sync_from_resource(resource);
+	if (surface_sync == NULL) {
+		wl_resource_post_error(resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_SURFACE,
+			"set_acquire_fence sent after wl_surface has been destroyed");
+		close(fd);
+		return;
+	}
+
+	if (surface_sync->pending.acquire_fence_fd >= 0) {
+		wl_resource_post_error(resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_DUPLICATE_FENCE,
+			"an acquire fence has already been set for this commit");
+		close(fd);
+		return;
+	}
+
+	surface_sync->pending.acquire_fence_fd = fd;
+}
+
+static void surface_sync_handle_get_release(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		surface_sync_from_resource(resource);
+	if (surface_sync == NULL) {
+		wl_resource_post_error(resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_SURFACE,
+			"get_release sent after wl_surface has been destroyed");
+		return;
+	}
+
+	if (surface_sync->pending.buffer_release != NULL) {
+		wl_resource_post_error(resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_DUPLICATE_RELEASE,
+			"a release has already been requested for this commit");
+		return;
+	}
+
+	struct wlr_linux_buffer_release_v1 *buffer_release =
+		calloc(1, sizeof(*buffer_release));
+	if (buffer_release == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	buffer_release->resource = wl_resource_create(client,
+		&zwp_linux_buffer_release_v1_interface, 1, id);
+	if (buffer_release->resource == NULL) {
+		wl_client_post_no_memory(client);
+		free(buffer_release);
+		return;
+	}
+	wl_resource_set_implementation(buffer_release->resource, NULL,
+		buffer_release, buffer_release_handle_resource_destroy);
+
+	buffer_release_set_ref(buffer_release,
+		&surface_sync->pending.buffer_release);
+}
+
+static const struct zwp_linux_surface_synchronization_v1_interface
+		surface_sync_impl = {
+	.destroy = surface_sync_handle_destroy,
+	.set_acquire_fence = surface_sync_handle_set_acquire_fence,
+	.get_release = surface_sync_handle_get_release,
+};
+
+static void surface_sync_commit_destroy(struct surface_sync_commit *commit) {
+	if (commit->event_source != NULL) {
+		wl_event_source_remove(commit->event_source);
+	}
+	if (commit->acquire_fence_fd >= 0) {
+		close(commit->acquire_fence_fd);
+	}
+	if (commit->buffer_release != NULL) {
+		commit->buffer_release->ref = NULL;
+		buffer_release_send_immediate(commit->buffer_release);
+	}
+	wl_list_remove(&commit->link);
+	free(commit);
+}
+
+static void surface_sync_pending_finish(
+		struct wlr_linux_surface_synchronization_v1 *surface_sync) {
+	if (surface_sync->pending.buffer_release != NULL) {
+		surface_sync->pending.buffer_release->ref = NULL;
+		buffer_release_send_immediate(surface_sync->pending.buffer_release);
+		surface_sync->pending.buffer_release = NULL;
+	}
+	if (surface_sync->pending.acquire_fence_fd >= 0) {
+		close(surface_sync->pending.acquire_fence_fd);
+		surface_sync->pending.acquire_fence_fd = -1;
+	}
+}
+
+static void surface_sync_destroy(
+		struct wlr_linux_surface_synchronization_v1 *surface_sync) {
+	surface_sync_pending_finish(surface_sync);
+
+	struct surface_sync_commit *commit, *tmp;
+	wl_list_for_each_safe(commit, tmp, &surface_sync->commits, link) {
+		surface_sync_commit_destroy(commit);
+	}
+
+	if (surface_sync->resource != NULL) {
+		wl_resource_set_user_data(surface_sync->resource, NULL);
+	}
+	wl_list_remove(&surface_sync->link);
+	wl_list_remove(&surface_sync->surface_destroy.link);
+	wl_list_remove(&surface_sync->surface_client_commit.link);
+	wl_list_remove(&surface_sync->surface_commit.link);
+	free(surface_sync);
+}
+
+static void surface_sync_handle_resource_destroy(struct wl_resource *resource) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		surface_sync_from_resource(resource);
+	if (surface_sync == NULL) {
+		return;
+	}
+
+	// Fences of past commits still apply, keep tracking them until the
+	// commits are applied
+	surface_sync_pending_finish(surface_sync);
+	surface_sync->resource = NULL;
+	if (wl_list_empty(&surface_sync->commits)) {
+		surface_sync_destroy(surface_sync);
+	}
+}
+
+static void surface_sync_handle_surface_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		wl_container_of(listener, surface_sync, surface_destroy);
+	surface_sync_destroy(surface_sync);
+}
+
+static int surface_sync_commit_handle_fence(int fd, uint32_t mask,
+		void *data) {
+	struct surface_sync_commit *commit = data;
+	struct wlr_surface *surface = commit->surface_sync->surface;
+
+	wl_event_source_remove(commit->event_source);
+	commit->event_source = NULL;
+	close(commit->acquire_fence_fd);
+	commit->acquire_fence_fd = -1;
+	commit->locked = false;
+
+	// May apply the state, which destroys the commit
+	wlr_surface_unlock_cached(surface, commit->seq);
+	return 0;
+}
+
+static void surface_sync_handle_surface_client_commit(
+		struct wl_listener *listener, void *data) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		wl_container_of(listener, surface_sync, surface_client_commit);
+	struct wlr_surface *surface = surface_sync->surface;
+	struct wlr_linux_surface_synchronization_v1_state *pending =
+		&surface_sync->pending;
+
+	if (surface_sync->resource == NULL ||
+			(pending->acquire_fence_fd < 0 && pending->buffer_release == NULL)) {
+		return;
+	}
+
+	struct wl_resource *buffer_resource = surface->pending.buffer_resource;
+	if (!(surface->pending.committed & WLR_SURFACE_STATE_BUFFER) ||
+			buffer_resource == NULL) {
+		wl_resource_post_error(surface_sync->resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_BUFFER,
+			"no buffer attached");
+		return;
+	}
+	if (!wlr_dmabuf_v1_resource_is_buffer(buffer_resource)) {
+		wl_resource_post_error(surface_sync->resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_UNSUPPORTED_BUFFER,
+			"only linux-dmabuf buffers support explicit synchronization");
+		return;
+	}
+
+	struct surface_sync_commit *commit = calloc(1, sizeof(*commit));
+	if (commit == NULL) {
+		wl_client_post_no_memory(wl_resource_get_client(surface->resource));
+		return;
+	}
+	commit->surface_sync = surface_sync;
+	commit->seq = surface->pending.seq;
+	commit->acquire_fence_fd = -1;
+	wl_list_insert(surface_sync->commits.prev, &commit->link);
+
+	if (pending->buffer_release != NULL) {
+		buffer_release_set_ref(pending->buffer_release,
+			&commit->buffer_release);
+		pending->buffer_release = NULL;
+	}
+
+	int fence_fd = pending->acquire_fence_fd;
+	pending->acquire_fence_fd = -1;
+	if (fence_fd < 0) {
+		return;
+	}
+	if (sync_file_is_signaled(fence_fd)) {
+		close(fence_fd);
+		return;
+	}
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(
+		wl_client_get_display(wl_resource_get_client(surface->resource)));
+	commit->event_source = wl_event_loop_add_fd(loop, fence_fd,
+		WL_EVENT_READABLE, surface_sync_commit_handle_fence, commit);
+	if (commit->event_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add acquire fence to event loop");
+		close(fence_fd);
+		return;
+	}
+	commit->acquire_fence_fd = fence_fd;
+	commit->locked = true;
+	wlr_surface_lock_pending(surface);
+}
+
+static void surface_sync_handle_surface_commit(struct wl_listener *listener,
+		void *data) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		wl_container_of(listener, surface_sync, surface_commit);
+	struct wlr_surface *surface = surface_sync->surface;
+
+	// Commits are applied in order
+	struct surface_sync_commit *commit, *tmp;
+	wl_list_for_each_safe(commit, tmp, &surface_sync->commits, link) {
+		int32_t delta = (int32_t)(surface->current.seq - commit->seq);
+		if (delta < 0) {
+			break;
+		}
+		assert(!commit->locked);
+
+		if (delta == 0 && commit->buffer_release != NULL) {
+			buffer_release_commit(commit->buffer_release, surface);
+		}
+		surface_sync_commit_destroy(commit);
+	}
+
+	if (surface_sync->resource == NULL &&
+			wl_list_empty(&surface_sync->commits)) {
+		surface_sync_destroy(surface_sync);
+	}
+}
+
+static struct wlr_linux_surface_synchronization_v1 *explicit_sync_get_surface(
+		struct wlr_linux_explicit_synchronization_v1 *explicit_sync,
+		struct wlr_surface *surface) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync;
+	wl_list_for_each(surface_sync, &explicit_sync->surfaces, link) {
+		if (surface_sync->surface == surface &&
+				surface_sync->resource != NULL) {
+			return surface_sync;
+		}
+	}
+	return NULL;
+}
+
+static void explicit_sync_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void explicit_sync_handle_get_synchronization(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource) {
+	struct wlr_linux_explicit_synchronization_v1 *explicit_sync =
+		explicit_sync_from_resource(resource);
+	struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+
+	if (explicit_sync_get_surface(explicit_sync, surface) != NULL) {
+		wl_resource_post_error(resource,
+			ZWP_LINUX_EXPLICIT_SYNCHRONIZATION_V1_ERROR_SYNCHRONIZATION_EXISTS,
+			"zwp_linux_surface_synchronization_v1 already created for this surface");
+		return;
+	}
+
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		calloc(1, sizeof(*surface_sync));
+	if (surface_sync == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	uint32_t version = wl_resource_get_version(resource);
+	surface_sync->resource = wl_resource_create(client,
+		&zwp_linux_surface_synchronization_v1_interface, version, id);
+	if (surface_sync->resource == NULL) {
+		wl_client_post_no_memory(client);
+		free(surface_sync);
+		return;
+	}
+	wl_resource_set_implementation(surface_sync->resource, &surface_sync_impl,
+		surface_sync, surface_sync_handle_resource_destroy);
+
+	surface_sync->surface = surface;
+	surface_sync->explicit_sync = explicit_sync;
+	surface_sync->pending.acquire_fence_fd = -1;
+	wl_list_init(&surface_sync->commits);
+
+	surface_sync->surface_destroy.notify = surface_sync_handle_surface_destroy;
+	wl_signal_add(&surface->events.destroy, &surface_sync->surface_destroy);
+
+	surface_sync->surface_client_commit.notify =
+		surface_sync_handle_surface_client_commit;
+	wl_signal_add(&surface->events.client_commit,
+		&surface_sync->surface_client_commit);
+
+	surface_sync->surface_commit.notify = surface_sync_handle_surface_commit;
+	wl_signal_add(&surface->events.commit, &surface_sync->surface_commit);
+
+	wl_list_insert(&explicit_sync->surfaces, &surface_sync->link);
+}
+
+static const struct zwp_linux_explicit_synchronization_v1_interface
+		explicit_sync_impl = {
+	.destroy = explicit_sync_handle_destroy,
+	.get_synchronization = explicit_sync_handle_get_synchronization,
+};
+
+static void explicit_sync_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wlr_linux_explicit_synchronization_v1 *explicit_sync = data;
+
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwp_linux_explicit_synchronization_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &explicit_sync_impl,
+		explicit_sync, NULL);
+}
+
+static void handle_display_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_linux_explicit_synchronization_v1 *explicit_sync =
+		wl_container_of(listener, explicit_sync, display_destroy);
+	wlr_signal_emit_safe(&explicit_sync->events.destroy, NULL);
+	wl_list_remove(&explicit_sync->display_destroy.link);
+	wl_global_destroy(explicit_sync->global);
+	free(explicit_sync);
+}
+
+struct wlr_linux_explicit_synchronization_v1 *
+		wlr_linux_explicit_synchronization_v1_create(struct wl_display *display) {
+	struct wlr_linux_explicit_synchronization_v1 *explicit_sync =
+		calloc(1, sizeof(*explicit_sync));
+	if (explicit_sync == NULL) {
+		return NULL;
+	}
+
+	wl_list_init(&explicit_sync->surfaces);
+	wl_signal_init(&explicit_sync->events.destroy);
+
+	explicit_sync->global = wl_global_create(display,
+		&zwp_linux_explicit_synchronization_v1_interface,
+		LINUX_EXPLICIT_SYNCHRONIZATION_VERSION, explicit_sync,
+		explicit_sync_bind);
+	if (explicit_sync->global == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create "
+			"zwp_linux_explicit_synchronization_v1 global");
+		free(explicit_sync);
+		return NULL;
+	}
+
+	explicit_sync->display_destroy.notify = handle_display_destroy;
+	wl_display_add_destroy_listener(display, &explicit_sync->display_destroy);
+
+	return explicit_sync;
+}
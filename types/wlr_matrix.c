@@ -140,6 +140,73 @@ void wlr_matrix_projection(float mat[static 9], int width, int height,
 	mat[8] = 1.0f;
 }
 
+/**
+ * The output transforms applied around the center of the unit square, i.e.
+ * translate(0.5, 0.5) × transform × translate(-0.5, -0.5). Only the first
+ * two rows are stored, the last one is always (0, 0, 1).
+ */
+static const float centered_transforms[][6] = {
+	[WL_OUTPUT_TRANSFORM_NORMAL] = {
+		1.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f,
+	},
+	[WL_OUTPUT_TRANSFORM_90] = {
+		0.0f, 1.0f, 0.0f,
+		-1.0f, 0.0f, 1.0f,
+	},
+	[WL_OUTPUT_TRANSFORM_180] = {
+		-1.0f, 0.0f, 1.0f,
+		0.0f, -1.0f, 1.0f,
+	},
+	[WL_OUTPUT_TRANSFORM_270] = {
+		0.0f, -1.0f, 1.0f,
+		1.0f, 0.0f, 0.0f,
+	},
+	[WL_OUTPUT_TRANSFORM_FLIPPED] = {
+		-1.0f, 0.0f, 1.0f,
+		0.0f, 1.0f, 0.0f,
+	},
+	[WL_OUTPUT_TRANSFORM_FLIPPED_90] = {
+		0.0f, 1.0f, 0.0f,
+		1.0f, 0.0f, 0.0f,
+	},
+	[WL_OUTPUT_TRANSFORM_FLIPPED_180] = {
+		1.0f, 0.0f, 0.0f,
+		0.0f, -1.0f, 1.0f,
+	},
+	[WL_OUTPUT_TRANSFORM_FLIPPED_270] = {
+		0.0f, -1.0f, 1.0f,
+		-1.0f, 0.0f, 1.0f,
+	},
+};
+
+/**
+ * mat ← projection × box × t, where box is the affine matrix with the linear
+ * part (a, b; c, d) and the translation (tx, ty), and t is a centered
+ * transform.
+ */
+static inline void project_affine(float mat[static 9],
+		float a, float b, float tx, float c, float d, float ty,
+		const float t[static 6], const float p[static 9]) {
+	// box × t, the last row stays (0, 0, 1)
+	float m0 = a * t[0] + b * t[3];
+	float m1 = a * t[1] + b * t[4];
+	float m2 = a * t[2] + b * t[5] + tx;
+	float m3 = c * t[0] + d * t[3];
+	float m4 = c * t[1] + d * t[4];
+	float m5 = c * t[2] + d * t[5] + ty;
+
+	mat[0] = p[0] * m0 + p[1] * m3;
+	mat[1] = p[0] * m1 + p[1] * m4;
+	mat[2] = p[0] * m2 + p[1] * m5 + p[2];
+	mat[3] = p[3] * m0 + p[4] * m3;
+	mat[4] = p[3] * m1 + p[4] * m4;
+	mat[5] = p[3] * m2 + p[4] * m5 + p[5];
+	mat[6] = p[6] * m0 + p[7] * m3;
+	mat[7] = p[6] * m1 + p[7] * m4;
+	mat[8] = p[6] * m2 + p[7] * m5 + p[8];
+}
+
 void wlr_matrix_project_box(float mat[static 9], const struct wlr_box *box,
 		enum wl_output_transform transform, float rotation,
 		const float projection[static 9]) {
@@ -147,23 +214,32 @@ void wlr_matrix_project_box(float mat[static 9], const struct wlr_box *box,
 	int y = box->y;
 	int width = box->width;
 	int height = box->height;
+	const float *t = centered_transforms[transform];
 
-	wlr_matrix_identity(mat);
-	wlr_matrix_translate(mat, x, y);
-
-	if (rotation != 0) {
-		wlr_matrix_translate(mat, width/2, height/2);
-		wlr_matrix_rotate(mat, rotation);
-		wlr_matrix_translate(mat, -width/2, -height/2);
+	if (rotation == 0) {
+		// translate(x, y) × scale(width, height)
+		project_affine(mat, width, 0.0f, x, 0.0f, height, y, t, projection);
+		return;
 	}
 
-	wlr_matrix_scale(mat, width, height);
+	// translate(x, y) × rotate around (width/2, height/2) × scale
+	float cos_r = cos(rotation), sin_r = sin(rotation);
+	int half_w = width / 2, half_h = height / 2;
+	float tx = x + half_w - cos_r * half_w + sin_r * half_h;
+	float ty = y + half_h - sin_r * half_w - cos_r * half_h;
+	project_affine(mat, cos_r * width, -sin_r * height, tx,
+		sin_r * width, cos_r * height, ty, t, projection);
+}
 
-	if (transform != WL_OUTPUT_TRANSFORM_NORMAL) {
-		wlr_matrix_translate(mat, 0.5, 0.5);
-		wlr_matrix_transform(mat, transform);
-		wlr_matrix_translate(mat, -0.5, -0.5);
+void wlr_matrix_project_boxes(float (*mats)[9], const struct wlr_box *boxes,
+		size_t len, enum wl_output_transform transform,
+		const float projection[static 9]) {
+	const float *t = centered_transforms[transform];
+	float p[9];
+	memcpy(p, projection, sizeof(p));
+	for (size_t i = 0; i < len; i++) {
+		const struct wlr_box *box = &boxes[i];
+		project_affine(mats[i], box->width, 0.0f, box->x,
+			0.0f, box->height, box->y, t, p);
 	}
-
-	wlr_matrix_multiply(mat, projection, mat);
 }
@@ -1,10 +1,12 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <tgmath.h>
 #include <time.h>
+#include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/render/interface.h>
@@ -21,11 +23,33 @@
 #include "render/drm_format_set.h"
 #include "render/swapchain.h"
 #include "render/wlr_renderer.h"
+#include "render/wlr_texture.h"
 #include "util/global.h"
 #include "util/signal.h"
+#include "util/startup.h"
+#include "util/time.h"
+#include "util/trace.h"
 
 #define OUTPUT_VERSION 3
 
+// Minimum frame scheduling safety margin, in nanoseconds
+#define FRAME_SCHED_MIN_MARGIN 1000000
+// Frame events of grouped outputs due within this window are sent together,
+// in nanoseconds
+#define FRAME_GROUP_WINDOW 2000000
+
+static struct wl_list frame_group_outputs =
+	{ &frame_group_outputs, &frame_group_outputs };
+// Whether an output with frame interleaving enabled has sent a frame event
+// during the current event loop iteration
+static bool frame_interleave_busy = false;
+
+// Maximum number of rendered cursor images kept around per output
+#define WLR_OUTPUT_CURSOR_BUFFER_CACHE_SIZE 16
+#define WLR_OUTPUT_CURSOR_TEXTURE_CACHE_SIZE 32
+// Gamma ramp size advertised when gamma is applied by the renderer
+#define WLR_OUTPUT_SOFTWARE_GAMMA_SIZE 256
+
 static void send_geometry(struct wl_resource *resource) {
 	struct wlr_output *output = wlr_output_from_resource(resource);
 	wl_output_send_geometry(resource, 0, 0,
@@ -54,6 +78,19 @@ static void send_scale(struct wl_resource *resource) {
 	}
 }
 
+static int32_t output_advertised_scale(struct wlr_output *output) {
+	return (int32_t)ceil(output->scale);
+}
+
+static void output_update_advertised(struct wlr_output *output) {
+	output->advertised.width = output->width;
+	output->advertised.height = output->height;
+	output->advertised.refresh = output->refresh;
+	output->advertised.scale = output_advertised_scale(output);
+	output->advertised.subpixel = output->subpixel;
+	output->advertised.transform = output->transform;
+}
+
 static void send_done(struct wl_resource *resource) {
 	uint32_t version = wl_resource_get_version(resource);
 	if (version >= WL_OUTPUT_DONE_SINCE_VERSION) {
@@ -61,6 +98,8 @@ static void send_done(struct wl_resource *resource) {
 	}
 }
 
+static void output_schedule_update(struct wlr_output *output);
+
 static void output_handle_resource_destroy(struct wl_resource *resource) {
 	wl_list_remove(wl_resource_get_link(resource));
 }
@@ -112,6 +151,7 @@ void wlr_output_create_global(struct wlr_output *output) {
 	if (output->global != NULL) {
 		return;
 	}
+	output_update_advertised(output);
 	output->global = wl_global_create(output->display,
 		&wl_output_interface, OUTPUT_VERSION, output, output_bind);
 	if (output->global == NULL) {
@@ -136,12 +176,15 @@ void wlr_output_destroy_global(struct wlr_output *output) {
 	output->global = NULL;
 }
 
+static void output_update_release_buffers_timer(struct wlr_output *output);
+
 void wlr_output_update_enabled(struct wlr_output *output, bool enabled) {
 	if (output->enabled == enabled) {
 		return;
 	}
 
 	output->enabled = enabled;
+	output_update_release_buffers_timer(output);
 	wlr_signal_emit_safe(&output->events.enable, output);
 }
 
@@ -239,11 +282,7 @@ void wlr_output_update_custom_mode(struct wlr_output *output, int32_t width,
 		output->swapchain = NULL;
 	}
 
-	struct wl_resource *resource;
-	wl_resource_for_each(resource, &output->resources) {
-		send_current_mode(resource);
-	}
-	wlr_output_schedule_done(output);
+	output_schedule_update(output);
 
 	wlr_signal_emit_safe(&output->events.mode, output);
 }
@@ -288,12 +327,7 @@ void wlr_output_set_subpixel(struct wlr_output *output,
 	}
 
 	output->subpixel = subpixel;
-
-	struct wl_resource *resource;
-	wl_resource_for_each(resource, &output->resources) {
-		send_geometry(resource);
-	}
-	wlr_output_schedule_done(output);
+	output_schedule_update(output);
 }
 
 void wlr_output_set_description(struct wlr_output *output, const char *desc) {
@@ -316,16 +350,45 @@ static void schedule_done_handle_idle_timer(void *data) {
 	struct wlr_output *output = data;
 	output->idle_done = NULL;
 
+	bool geometry_changed =
+		output->advertised.subpixel != output->subpixel ||
+		output->advertised.transform != output->transform;
+	bool mode_changed = output->advertised.width != output->width ||
+		output->advertised.height != output->height ||
+		output->advertised.refresh != output->refresh;
+	bool scale_changed =
+		output->advertised.scale != output_advertised_scale(output);
+	bool done = output->advertised.done || geometry_changed ||
+		mode_changed || scale_changed;
+	output_update_advertised(output);
+	output->advertised.done = false;
+
+	if (!done) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&output->events.done, output);
+
 	struct wl_resource *resource;
 	wl_resource_for_each(resource, &output->resources) {
-		uint32_t version = wl_resource_get_version(resource);
-		if (version >= WL_OUTPUT_DONE_SINCE_VERSION) {
-			wl_output_send_done(resource);
+		if (geometry_changed) {
+			send_geometry(resource);
 		}
+		if (mode_changed) {
+			send_current_mode(resource);
+		}
+		if (scale_changed) {
+			send_scale(resource);
+		}
+		send_done(resource);
 	}
 }
 
-void wlr_output_schedule_done(struct wlr_output *output) {
+/**
+ * Schedule sending the wl_output properties which have changed. Multiple
+ * updates in the same event loop iteration are coalesced.
+ */
+static void output_schedule_update(struct wlr_output *output) {
 	if (output->idle_done != NULL) {
 		return; // Already scheduled
 	}
@@ -335,6 +398,11 @@ void wlr_output_schedule_done(struct wlr_output *output) {
 		wl_event_loop_add_idle(ev, schedule_done_handle_idle_timer, output);
 }
 
+void wlr_output_schedule_done(struct wlr_output *output) {
+	output->advertised.done = true;
+	output_schedule_update(output);
+}
+
 static void handle_display_destroy(struct wl_listener *listener, void *data) {
 	struct wlr_output *output =
 		wl_container_of(listener, output, display_destroy);
@@ -357,7 +425,15 @@ void wlr_output_init(struct wlr_output *output, struct wlr_backend *backend,
 	output->transform = WL_OUTPUT_TRANSFORM_NORMAL;
 	output->scale = 1;
 	output->commit_seq = 0;
+	output->out_fence_fd = -1;
+	output->pending.in_fence_fd = -1;
+	output->frame_sched.margin = FRAME_SCHED_MIN_MARGIN;
+	wl_list_init(&output->frame_group.link);
+	output->render_format = DRM_FORMAT_ARGB8888;
 	wl_list_init(&output->cursors);
+	wl_list_init(&output->cursor_buffers);
+	wl_list_init(&output->cursor_textures);
+	wl_list_init(&output->layers);
 	wl_list_init(&output->resources);
 	wl_signal_init(&output->events.frame);
 	wl_signal_init(&output->events.damage);
@@ -365,10 +441,13 @@ void wlr_output_init(struct wlr_output *output, struct wlr_backend *backend,
 	wl_signal_init(&output->events.precommit);
 	wl_signal_init(&output->events.commit);
 	wl_signal_init(&output->events.present);
+	wl_signal_init(&output->events.render_stats);
+	wl_signal_init(&output->events.capture);
 	wl_signal_init(&output->events.bind);
 	wl_signal_init(&output->events.enable);
 	wl_signal_init(&output->events.mode);
 	wl_signal_init(&output->events.description);
+	wl_signal_init(&output->events.done);
 	wl_signal_init(&output->events.destroy);
 	pixman_region32_init(&output->pending.damage);
 
@@ -385,6 +464,18 @@ void wlr_output_init(struct wlr_output *output, struct wlr_backend *backend,
 
 static void output_clear_back_buffer(struct wlr_output *output);
 
+static void output_cursor_buffers_clear(struct wlr_output *output);
+static void output_cursor_textures_clear(struct wlr_output *output);
+static void output_cursor_save_under_commit(struct wlr_output *output);
+static void output_cursor_save_under_repaint(struct wlr_output *output);
+static bool output_cursor_is_hardware(struct wlr_output_cursor *cursor);
+
+static void format_cache_finish(struct wlr_output_format_cache *cache) {
+	free(cache->format);
+	cache->format = NULL;
+	cache->display_formats = NULL;
+}
+
 void wlr_output_destroy(struct wlr_output *output) {
 	if (!output) {
 		return;
@@ -402,11 +493,21 @@ void wlr_output_destroy(struct wlr_output *output) {
 	wl_list_for_each_safe(cursor, tmp_cursor, &output->cursors, link) {
 		wlr_output_cursor_destroy(cursor);
 	}
+	output_cursor_textures_clear(output);
+
+	struct wlr_output_layer *layer, *tmp_layer;
+	wl_list_for_each_safe(layer, tmp_layer, &output->layers, link) {
+		wlr_output_layer_destroy(layer);
+	}
 
 	wlr_swapchain_destroy(output->cursor_swapchain);
 	wlr_buffer_unlock(output->cursor_front_buffer);
+	wlr_buffer_unlock(output->cursor_save_under.frame);
+	output_cursor_buffers_clear(output);
+	format_cache_finish(&output->cursor_format);
 
 	wlr_swapchain_destroy(output->swapchain);
+	format_cache_finish(&output->primary_format);
 
 	if (output->idle_frame != NULL) {
 		wl_event_source_remove(output->idle_frame);
@@ -416,8 +517,37 @@ void wlr_output_destroy(struct wlr_output *output) {
 		wl_event_source_remove(output->idle_done);
 	}
 
+	if (output->frame_sched.timer != NULL) {
+		wl_event_source_remove(output->frame_sched.timer);
+	}
+	wl_list_remove(&output->frame_group.link);
+	if (output->frame_group.timer != NULL) {
+		wl_event_source_remove(output->frame_group.timer);
+	}
+	if (output->frame_interleave.event_source != NULL) {
+		wl_event_source_remove(output->frame_interleave.event_source);
+		close(output->frame_interleave.fds[0]);
+		close(output->frame_interleave.fds[1]);
+	}
+	if (output->frame_interleave.idle != NULL) {
+		wl_event_source_remove(output->frame_interleave.idle);
+		frame_interleave_busy = false;
+	}
+
+	if (output->release_buffers_timer != NULL) {
+		wl_event_source_remove(output->release_buffers_timer);
+	}
+
+	free(output->software_gamma.lut);
 	free(output->description);
 
+	if (output->out_fence_fd >= 0) {
+		close(output->out_fence_fd);
+	}
+	if (output->pending.committed & WLR_OUTPUT_STATE_IN_FENCE) {
+		close(output->pending.in_fence_fd);
+	}
+
 	pixman_region32_fini(&output->pending.damage);
 
 	if (output->impl && output->impl->destroy) {
@@ -461,7 +591,21 @@ struct wlr_output_mode *wlr_output_preferred_mode(struct wlr_output *output) {
 	return wl_container_of(output->modes.prev, mode, link);
 }
 
+static void output_state_clear_in_fence(struct wlr_output_state *state) {
+	if (!(state->committed & WLR_OUTPUT_STATE_IN_FENCE)) {
+		return;
+	}
+
+	close(state->in_fence_fd);
+	state->in_fence_fd = -1;
+
+	state->committed &= ~WLR_OUTPUT_STATE_IN_FENCE;
+}
+
 static void output_state_clear_buffer(struct wlr_output_state *state) {
+	output_state_clear_in_fence(state);
+	state->committed &= ~WLR_OUTPUT_STATE_BUFFER_TRANSFORM;
+
 	if (!(state->committed & WLR_OUTPUT_STATE_BUFFER)) {
 		return;
 	}
@@ -475,6 +619,56 @@ static void output_state_clear_buffer(struct wlr_output_state *state) {
 static struct wlr_drm_format *output_pick_format(struct wlr_output *output,
 		const struct wlr_drm_format_set *display_formats);
 
+/**
+ * Negotiate a buffer format with the renderer. The result is cached and
+ * re-used as long as the output has the same format constraints, so that
+ * mode changes and re-enabling an output don't need to go through the
+ * format sets again.
+ */
+static const struct wlr_drm_format *output_negotiate_format(
+		struct wlr_output *output, struct wlr_output_format_cache *cache,
+		const struct wlr_drm_format_set *display_formats) {
+	if (cache->format != NULL && cache->display_formats == display_formats) {
+		return cache->format;
+	}
+
+	format_cache_finish(cache);
+
+	struct wlr_drm_format *format = output_pick_format(output, display_formats);
+	if (format == NULL) {
+		return NULL;
+	}
+	cache->display_formats = display_formats;
+	cache->format = format;
+	return format;
+}
+
+/**
+ * Stop using explicit modifiers for the negotiated format, because buffers
+ * couldn't be allocated with them. The failure is remembered until the format
+ * constraints of the output change. Returns false if there were no explicit
+ * modifiers to drop.
+ */
+static bool format_cache_drop_modifiers(struct wlr_output *output,
+		struct wlr_output_format_cache *cache) {
+	if (cache->format == NULL || cache->format->len == 0) {
+		return false;
+	}
+	wlr_log(WLR_DEBUG, "Failed to allocate buffer with explicit modifiers "
+		"for output '%s', falling back to implicit modifier", output->name);
+	cache->format->len = 0;
+	return true;
+}
+
+static bool swapchain_is_empty(struct wlr_swapchain *swapchain) {
+	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
+		if (swapchain->slots[i].buffer != NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
 static bool output_create_swapchain(struct wlr_output *output) {
 	if (output->swapchain != NULL) {
 		return true;
@@ -496,7 +690,8 @@ static bool output_create_swapchain(struct wlr_output *output) {
 		}
 	}
 
-	struct wlr_drm_format *format = output_pick_format(output, display_formats);
+	const struct wlr_drm_format *format = output_negotiate_format(output,
+		&output->primary_format, display_formats);
 	if (format == NULL) {
 		wlr_log(WLR_ERROR, "Failed to pick primary buffer format for output '%s'",
 			output->name);
@@ -507,11 +702,13 @@ static bool output_create_swapchain(struct wlr_output *output) {
 
 	output->swapchain = wlr_swapchain_create(allocator, output->width,
 		output->height, format);
-	free(format);
 	if (output->swapchain == NULL) {
 		wlr_log(WLR_ERROR, "Failed to create output swapchain");
 		return false;
 	}
+	if (output->swapchain_depth != 0) {
+		wlr_swapchain_set_num_slots(output->swapchain, output->swapchain_depth);
+	}
 
 	return true;
 }
@@ -529,6 +726,15 @@ static bool output_attach_back_buffer(struct wlr_output *output,
 
 	struct wlr_buffer *buffer =
 		wlr_swapchain_acquire(output->swapchain, buffer_age);
+	if (buffer == NULL && swapchain_is_empty(output->swapchain) &&
+			format_cache_drop_modifiers(output, &output->primary_format)) {
+		wlr_swapchain_destroy(output->swapchain);
+		output->swapchain = NULL;
+		if (!output_create_swapchain(output)) {
+			return false;
+		}
+		buffer = wlr_swapchain_acquire(output->swapchain, buffer_age);
+	}
 	if (buffer == NULL) {
 		return false;
 	}
@@ -539,6 +745,7 @@ static bool output_attach_back_buffer(struct wlr_output *output,
 	}
 
 	output->back_buffer = buffer;
+	output->cursor_save_under.saved = false;
 	return true;
 }
 
@@ -556,23 +763,152 @@ static void output_clear_back_buffer(struct wlr_output *output) {
 	output->back_buffer = NULL;
 }
 
+bool wlr_output_set_swapchain_depth(struct wlr_output *output, size_t depth) {
+	if (depth < 2 || depth > WLR_SWAPCHAIN_CAP) {
+		wlr_log(WLR_DEBUG, "Unsupported swapchain depth: %zu", depth);
+		return false;
+	}
+
+	output->swapchain_depth = depth;
+	if (output->swapchain != NULL) {
+		wlr_swapchain_set_num_slots(output->swapchain, depth);
+	}
+	return true;
+}
+
+void wlr_output_set_render_format(struct wlr_output *output,
+		uint32_t format) {
+	if (output->render_format == format) {
+		return;
+	}
+	output->render_format = format;
+
+	// The next frame is rendered into a new swapchain
+	format_cache_finish(&output->primary_format);
+	wlr_swapchain_destroy(output->swapchain);
+	output->swapchain = NULL;
+}
+
+static int output_handle_release_buffers_timer(void *data) {
+	struct wlr_output *output = data;
+	if (output->enabled || output->back_buffer != NULL) {
+		return 0;
+	}
+
+	wlr_log(WLR_DEBUG, "Releasing buffers of disabled output '%s'",
+		output->name);
+
+	// Buffers still in use, e.g. the current cursor image, are destroyed
+	// once unlocked
+	wlr_swapchain_destroy(output->swapchain);
+	output->swapchain = NULL;
+
+	wlr_swapchain_destroy(output->cursor_swapchain);
+	output->cursor_swapchain = NULL;
+	output_cursor_buffers_clear(output);
+	return 0;
+}
+
+static void output_update_release_buffers_timer(struct wlr_output *output) {
+	if (output->enabled || output->release_buffers_timeout <= 0) {
+		if (output->release_buffers_timer != NULL) {
+			wl_event_source_timer_update(output->release_buffers_timer, 0);
+		}
+		return;
+	}
+
+	if (output->release_buffers_timer == NULL) {
+		struct wl_event_loop *ev = wl_display_get_event_loop(output->display);
+		output->release_buffers_timer = wl_event_loop_add_timer(ev,
+			output_handle_release_buffers_timer, output);
+		if (output->release_buffers_timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create release buffers timer");
+			return;
+		}
+	}
+	wl_event_source_timer_update(output->release_buffers_timer,
+		output->release_buffers_timeout);
+}
+
+void wlr_output_set_release_buffers_timeout(struct wlr_output *output,
+		int timeout_ms) {
+	output->release_buffers_timeout = timeout_ms;
+	output_update_release_buffers_timer(output);
+}
+
+static size_t output_get_hardware_gamma_size(struct wlr_output *output) {
+	if (!output->impl->get_gamma_size) {
+		return 0;
+	}
+	return output->impl->get_gamma_size(output);
+}
+
+static bool output_supports_software_gamma(struct wlr_output *output) {
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	return renderer != NULL && renderer->impl->set_color_transform != NULL;
+}
+
+/**
+ * Check whether the pending gamma LUT needs to be applied by the renderer.
+ */
+static bool output_pending_software_gamma(struct wlr_output *output) {
+	return (output->pending.committed & WLR_OUTPUT_STATE_GAMMA_LUT) &&
+		output_get_hardware_gamma_size(output) == 0;
+}
+
+/**
+ * Hide the pending gamma LUT from the backend if it needs to be applied by
+ * the renderer. Returns true if it has been hidden.
+ */
+static bool output_hide_software_gamma(struct wlr_output *output) {
+	if (!output_pending_software_gamma(output)) {
+		return false;
+	}
+	output->pending.committed &= ~WLR_OUTPUT_STATE_GAMMA_LUT;
+	return true;
+}
+
+static void output_apply_software_gamma(struct wlr_output *output) {
+	output->pending.committed |= WLR_OUTPUT_STATE_GAMMA_LUT;
+
+	free(output->software_gamma.lut);
+	output->software_gamma.lut = NULL;
+	output->software_gamma.size = 0;
+	if (output->pending.gamma_lut_size > 0) {
+		output->software_gamma.lut = output->pending.gamma_lut;
+		output->software_gamma.size = output->pending.gamma_lut_size;
+		output->pending.gamma_lut = NULL;
+	}
+}
+
 bool wlr_output_attach_render(struct wlr_output *output, int *buffer_age) {
+	trace_begin("%s attach_render", output->name);
+	bool ok;
 	if (output->impl->attach_render) {
-		if (!output->impl->attach_render(output, buffer_age)) {
-			return false;
+		ok = output->impl->attach_render(output, buffer_age);
+		if (ok) {
+			output_state_clear_buffer(&output->pending);
+			output->pending.committed |= WLR_OUTPUT_STATE_BUFFER;
+			output->pending.buffer_type = WLR_OUTPUT_STATE_BUFFER_RENDER;
 		}
-
-		output_state_clear_buffer(&output->pending);
-		output->pending.committed |= WLR_OUTPUT_STATE_BUFFER;
-		output->pending.buffer_type = WLR_OUTPUT_STATE_BUFFER_RENDER;
 	} else {
-		if (!output_attach_back_buffer(output, buffer_age)) {
-			return false;
+		ok = output_attach_back_buffer(output, buffer_age);
+		if (ok) {
+			wlr_output_attach_buffer(output, output->back_buffer);
+		}
+	}
+	if (ok && output->software_gamma.lut != NULL) {
+		struct wlr_renderer *renderer =
+			wlr_backend_get_renderer(output->backend);
+		if (!wlr_renderer_set_color_transform(renderer, NULL,
+				output->software_gamma.size, output->software_gamma.lut)) {
+			wlr_log(WLR_ERROR, "Failed to apply gamma LUT on output %s",
+				output->name);
 		}
-		wlr_output_attach_buffer(output, output->back_buffer);
 	}
+	trace_end();
 
-	return true;
+	return ok;
 }
 
 uint32_t wlr_output_preferred_read_format(struct wlr_output *output) {
@@ -618,6 +954,8 @@ static void output_state_clear_gamma_lut(struct wlr_output_state *state) {
 static void output_state_clear(struct wlr_output_state *state) {
 	output_state_clear_buffer(state);
 	output_state_clear_gamma_lut(state);
+	state->layers = NULL;
+	state->layers_len = 0;
 	pixman_region32_clear(&state->damage);
 	state->committed = 0;
 }
@@ -656,12 +994,21 @@ static bool output_basic_test(struct wlr_output *output) {
 				return false;
 			}
 
+			bool software_gamma = output->software_gamma.lut != NULL;
+			if (output_pending_software_gamma(output)) {
+				software_gamma = output->pending.gamma_lut_size > 0;
+			}
+			if (software_gamma) {
+				wlr_log(WLR_DEBUG, "Direct scan-out disabled by gamma LUT");
+				return false;
+			}
+
 			// If the output has at least one software cursor, refuse to attach the
 			// buffer
 			struct wlr_output_cursor *cursor;
 			wl_list_for_each(cursor, &output->cursors, link) {
 				if (cursor->enabled && cursor->visible &&
-						cursor != output->hardware_cursor) {
+						!output_cursor_is_hardware(cursor)) {
 					wlr_log(WLR_DEBUG,
 						"Direct scan-out disabled by software cursor");
 					return false;
@@ -672,6 +1019,13 @@ static bool output_basic_test(struct wlr_output *output) {
 			// supported)
 			int pending_width, pending_height;
 			output_pending_resolution(output, &pending_width, &pending_height);
+			if ((output->pending.committed &
+					WLR_OUTPUT_STATE_BUFFER_TRANSFORM) &&
+					output->pending.buffer_transform % 2 != 0) {
+				int tmp = pending_width;
+				pending_width = pending_height;
+				pending_height = tmp;
+			}
 			if (output->pending.buffer->width != pending_width ||
 					output->pending.buffer->height != pending_height) {
 				wlr_log(WLR_DEBUG, "Direct scan-out buffer size mismatch");
@@ -680,6 +1034,43 @@ static bool output_basic_test(struct wlr_output *output) {
 		}
 	}
 
+	if ((output->pending.committed & WLR_OUTPUT_STATE_BUFFER_TRANSFORM) &&
+			(!(output->pending.committed & WLR_OUTPUT_STATE_BUFFER) ||
+			output->pending.buffer_type != WLR_OUTPUT_STATE_BUFFER_SCANOUT)) {
+		wlr_log(WLR_DEBUG, "Tried to commit a buffer transform without "
+			"a scan-out buffer");
+		return false;
+	}
+
+	if ((output->pending.committed & WLR_OUTPUT_STATE_TEARING_PAGE_FLIP) &&
+			!(output->pending.committed & WLR_OUTPUT_STATE_BUFFER)) {
+		wlr_log(WLR_DEBUG, "Tried to commit a tearing page-flip without "
+			"a buffer");
+		return false;
+	}
+
+	if ((output->pending.committed & WLR_OUTPUT_STATE_IN_FENCE) &&
+			!(output->pending.committed & WLR_OUTPUT_STATE_BUFFER)) {
+		wlr_log(WLR_DEBUG, "Tried to commit an in-fence without a buffer");
+		return false;
+	}
+
+	if (output->pending.committed & WLR_OUTPUT_STATE_LAYERS) {
+		if (!(output->pending.committed & WLR_OUTPUT_STATE_BUFFER)) {
+			wlr_log(WLR_DEBUG, "Tried to commit layers without a buffer");
+			return false;
+		}
+
+		for (size_t i = 0; i < output->pending.layers_len; i++) {
+			struct wlr_output_layer_state *layer_state =
+				&output->pending.layers[i];
+			if (layer_state->layer->output != output) {
+				wlr_log(WLR_DEBUG, "Tried to commit a layer of another output");
+				return false;
+			}
+		}
+	}
+
 	bool enabled = output->enabled;
 	if (output->pending.committed & WLR_OUTPUT_STATE_ENABLED) {
 		enabled = output->pending.enabled;
@@ -712,48 +1103,111 @@ bool wlr_output_test(struct wlr_output *output) {
 	if (!output->impl->test) {
 		return true;
 	}
-	return output->impl->test(output);
+	bool software_gamma = output_hide_software_gamma(output);
+	bool ok = output->impl->test(output);
+	if (software_gamma) {
+		output->pending.committed |= WLR_OUTPUT_STATE_GAMMA_LUT;
+	}
+	return ok;
 }
 
-bool wlr_output_commit(struct wlr_output *output) {
-	if (!output_basic_test(output)) {
-		wlr_log(WLR_ERROR, "Basic output test failed for %s", output->name);
-		return false;
+static void output_poll_render_stats(struct wlr_output *output) {
+	if (output->pending_render_stats_len == 0) {
+		return;
+	}
+
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	size_t len = 0;
+	for (size_t i = 0; i < output->pending_render_stats_len; i++) {
+		struct wlr_render_stats stats;
+		if (renderer != NULL && wlr_renderer_get_render_stats(renderer,
+				output->pending_render_stats[i].render_seq, &stats)) {
+			struct wlr_output_event_render_stats event = {
+				.output = output,
+				.commit_seq = output->pending_render_stats[i].commit_seq,
+				.stats = &stats,
+			};
+			wlr_signal_emit_safe(&output->events.render_stats, &event);
+		} else {
+			output->pending_render_stats[len++] =
+				output->pending_render_stats[i];
+		}
+	}
+	output->pending_render_stats_len = len;
+}
+
+static void output_queue_render_stats(struct wlr_output *output) {
+	if (wl_list_empty(&output->events.render_stats.listener_list)) {
+		return;
+	}
+
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	if (renderer == NULL) {
+		return;
+	}
+
+	// Give up on the oldest frame if the GPU is too far behind
+	size_t cap = sizeof(output->pending_render_stats) /
+		sizeof(output->pending_render_stats[0]);
+	if (output->pending_render_stats_len == cap) {
+		memmove(&output->pending_render_stats[0],
+			&output->pending_render_stats[1],
+			(cap - 1) * sizeof(output->pending_render_stats[0]));
+		output->pending_render_stats_len--;
 	}
 
+	size_t i = output->pending_render_stats_len++;
+	output->pending_render_stats[i].render_seq = renderer->render_seq;
+	output->pending_render_stats[i].commit_seq = output->commit_seq;
+}
+
+static void frame_sched_record_commit(struct wlr_output *output);
+
+static void output_prepare_commit(struct wlr_output *output,
+		struct timespec *now) {
 	if ((output->pending.committed & WLR_OUTPUT_STATE_BUFFER) &&
 			output->idle_frame != NULL) {
 		wl_event_source_remove(output->idle_frame);
 		output->idle_frame = NULL;
 	}
 
-	struct timespec now;
-	clock_gettime(CLOCK_MONOTONIC, &now);
-
 	struct wlr_output_event_precommit pre_event = {
 		.output = output,
-		.when = &now,
+		.when = now,
 	};
 	wlr_signal_emit_safe(&output->events.precommit, &pre_event);
 
-	if (!output->impl->commit(output)) {
-		output_clear_back_buffer(output);
-		output_state_clear(&output->pending);
-		return false;
+	if (output->out_fence_fd >= 0) {
+		close(output->out_fence_fd);
+		output->out_fence_fd = -1;
 	}
+}
+
+static void output_rollback_commit(struct wlr_output *output) {
+	output_clear_back_buffer(output);
+	output_state_clear(&output->pending);
+}
 
+static void output_apply_commit(struct wlr_output *output,
+		struct timespec *now) {
 	if (output->pending.committed & WLR_OUTPUT_STATE_BUFFER) {
 		struct wlr_output_cursor *cursor;
 		wl_list_for_each(cursor, &output->cursors, link) {
 			if (!cursor->enabled || !cursor->visible || cursor->surface == NULL) {
 				continue;
 			}
-			wlr_surface_send_frame_done(cursor->surface, &now);
+			wlr_surface_send_frame_done(cursor->surface, now);
 		}
 	}
 
 	output->commit_seq++;
 
+	if (output->pending.committed & WLR_OUTPUT_STATE_BUFFER) {
+		// Ended when the backend reports the frame as presented
+		trace_async_begin(output->commit_seq, "%s present", output->name);
+		startup_first_commit(output->name);
+	}
+
 	bool scale_updated = output->pending.committed & WLR_OUTPUT_STATE_SCALE;
 	if (scale_updated) {
 		output->scale = output->pending.scale;
@@ -767,26 +1221,43 @@ bool wlr_output_commit(struct wlr_output *output) {
 	bool geometry_updated = output->pending.committed &
 		(WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_TRANSFORM);
 	if (geometry_updated || scale_updated) {
-		struct wl_resource *resource;
-		wl_resource_for_each(resource, &output->resources) {
-			if (geometry_updated) {
-				send_geometry(resource);
-			}
-			if (scale_updated) {
-				send_scale(resource);
-			}
-		}
-		wlr_output_schedule_done(output);
+		output_schedule_update(output);
 	}
 
 	if (output->pending.committed & WLR_OUTPUT_STATE_BUFFER) {
 		output->frame_pending = true;
 		output->needs_frame = false;
+		frame_sched_record_commit(output);
+
+		if (output->pending.buffer_type == WLR_OUTPUT_STATE_BUFFER_RENDER ||
+				output->back_buffer != NULL) {
+			output_poll_render_stats(output);
+			output_queue_render_stats(output);
+		}
+
+		output_cursor_save_under_commit(output);
 
 		if (output->back_buffer != NULL) {
 			wlr_swapchain_set_buffer_submitted(output->swapchain,
 				output->back_buffer);
 			output_clear_back_buffer(output);
+		} else if (output->swapchain != NULL &&
+				output->pending.buffer_type == WLR_OUTPUT_STATE_BUFFER_SCANOUT) {
+			// Direct scan-out: our render buffers are getting older
+			wlr_swapchain_set_buffer_submitted(output->swapchain,
+				output->pending.buffer);
+		}
+	}
+
+	struct wlr_buffer *buffer = NULL;
+	if (output->pending.committed & WLR_OUTPUT_STATE_BUFFER) {
+		if (output->pending.buffer != NULL) {
+			buffer = wlr_buffer_lock(output->pending.buffer);
+		} else if (output->impl->get_committed_buffer) {
+			buffer = output->impl->get_committed_buffer(output);
+			if (buffer != NULL) {
+				wlr_buffer_lock(buffer);
+			}
 		}
 	}
 
@@ -796,42 +1267,696 @@ bool wlr_output_commit(struct wlr_output *output) {
 	struct wlr_output_event_commit event = {
 		.output = output,
 		.committed = committed,
-		.when = &now,
+		.when = now,
+		.buffer = buffer,
 	};
 	wlr_signal_emit_safe(&output->events.commit, &event);
 
-	return true;
+	if (buffer != NULL) {
+		wlr_buffer_unlock(buffer);
+	}
 }
 
-void wlr_output_rollback(struct wlr_output *output) {
-	if (output->impl->rollback_render &&
-			(output->pending.committed & WLR_OUTPUT_STATE_BUFFER) &&
-			output->pending.buffer_type == WLR_OUTPUT_STATE_BUFFER_RENDER) {
-		output->impl->rollback_render(output);
+bool wlr_output_commit(struct wlr_output *output) {
+	if (!output_basic_test(output)) {
+		wlr_log(WLR_ERROR, "Basic output test failed for %s", output->name);
+		return false;
 	}
-	output_clear_back_buffer(output);
 
-	output_state_clear(&output->pending);
-}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-void wlr_output_attach_buffer(struct wlr_output *output,
-		struct wlr_buffer *buffer) {
-	output_state_clear_buffer(&output->pending);
-	output->pending.committed |= WLR_OUTPUT_STATE_BUFFER;
-	output->pending.buffer_type = WLR_OUTPUT_STATE_BUFFER_SCANOUT;
-	output->pending.buffer = wlr_buffer_lock(buffer);
-}
+	trace_begin("%s commit", output->name);
 
-void wlr_output_send_frame(struct wlr_output *output) {
-	output->frame_pending = false;
-	wlr_signal_emit_safe(&output->events.frame, output);
-}
+	output_prepare_commit(output, &now);
 
-static void schedule_frame_handle_idle_timer(void *data) {
+	bool software_gamma = output_hide_software_gamma(output);
+	if (!output->impl->commit(output)) {
+		output_rollback_commit(output);
+		trace_end();
+		return false;
+	}
+
+	if (software_gamma) {
+		output_apply_software_gamma(output);
+	}
+	output_apply_commit(output, &now);
+	trace_end();
+	return true;
+}
+
+static bool output_group_is_atomic(struct wlr_output *const *outputs,
+		size_t outputs_len) {
+	struct wlr_backend *backend = outputs[0]->backend;
+	if (!backend_supports_commit_outputs(backend)) {
+		return false;
+	}
+	for (size_t i = 1; i < outputs_len; i++) {
+		if (outputs[i]->backend != backend) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool wlr_output_test_group(struct wlr_output *const *outputs,
+		size_t outputs_len) {
+	if (outputs_len == 0) {
+		return true;
+	}
+
+	if (!output_group_is_atomic(outputs, outputs_len)) {
+		for (size_t i = 0; i < outputs_len; i++) {
+			if (!wlr_output_test(outputs[i])) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	for (size_t i = 0; i < outputs_len; i++) {
+		if (!output_basic_test(outputs[i])) {
+			return false;
+		}
+	}
+
+	bool software_gamma[outputs_len];
+	for (size_t i = 0; i < outputs_len; i++) {
+		software_gamma[i] = output_hide_software_gamma(outputs[i]);
+	}
+
+	struct wlr_backend *backend = outputs[0]->backend;
+	bool ok = backend_commit_outputs(backend, outputs, outputs_len, true);
+
+	for (size_t i = 0; i < outputs_len; i++) {
+		if (software_gamma[i]) {
+			outputs[i]->pending.committed |= WLR_OUTPUT_STATE_GAMMA_LUT;
+		}
+	}
+
+	return ok;
+}
+
+bool wlr_output_commit_group(struct wlr_output *const *outputs,
+		size_t outputs_len) {
+	if (outputs_len == 0) {
+		return true;
+	}
+
+	if (!output_group_is_atomic(outputs, outputs_len)) {
+		bool ok = true;
+		for (size_t i = 0; i < outputs_len; i++) {
+			ok = wlr_output_commit(outputs[i]) && ok;
+		}
+		return ok;
+	}
+
+	for (size_t i = 0; i < outputs_len; i++) {
+		if (!output_basic_test(outputs[i])) {
+			wlr_log(WLR_ERROR, "Basic output test failed for %s",
+				outputs[i]->name);
+			return false;
+		}
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	bool software_gamma[outputs_len];
+	for (size_t i = 0; i < outputs_len; i++) {
+		output_prepare_commit(outputs[i], &now);
+		software_gamma[i] = output_hide_software_gamma(outputs[i]);
+	}
+
+	struct wlr_backend *backend = outputs[0]->backend;
+	bool ok = backend_commit_outputs(backend, outputs, outputs_len, false);
+
+	for (size_t i = 0; i < outputs_len; i++) {
+		if (ok) {
+			if (software_gamma[i]) {
+				output_apply_software_gamma(outputs[i]);
+			}
+			output_apply_commit(outputs[i], &now);
+		} else {
+			output_rollback_commit(outputs[i]);
+		}
+	}
+
+	return ok;
+}
+
+void wlr_output_rollback(struct wlr_output *output) {
+	if (output->impl->rollback_render &&
+			(output->pending.committed & WLR_OUTPUT_STATE_BUFFER) &&
+			output->pending.buffer_type == WLR_OUTPUT_STATE_BUFFER_RENDER) {
+		output->impl->rollback_render(output);
+	}
+	output_clear_back_buffer(output);
+
+	// Don't leak the gamma LUT into an unrelated render pass
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	if (output->software_gamma.lut != NULL && renderer != NULL &&
+			!renderer->rendering) {
+		wlr_renderer_set_color_transform(renderer, NULL, 0, NULL);
+	}
+
+	output_state_clear(&output->pending);
+}
+
+void wlr_output_attach_buffer(struct wlr_output *output,
+		struct wlr_buffer *buffer) {
+	output_state_clear_buffer(&output->pending);
+	output->pending.committed |= WLR_OUTPUT_STATE_BUFFER;
+	output->pending.buffer_type = WLR_OUTPUT_STATE_BUFFER_SCANOUT;
+	output->pending.buffer = wlr_buffer_lock(buffer);
+}
+
+void wlr_output_set_in_fence(struct wlr_output *output, int fence_fd) {
+	output_state_clear_in_fence(&output->pending);
+
+	int fd = fcntl(fence_fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to duplicate in-fence");
+		return;
+	}
+
+	output->pending.committed |= WLR_OUTPUT_STATE_IN_FENCE;
+	output->pending.in_fence_fd = fd;
+}
+
+void wlr_output_set_tearing_page_flip(struct wlr_output *output,
+		bool enabled) {
+	if (enabled) {
+		output->pending.committed |= WLR_OUTPUT_STATE_TEARING_PAGE_FLIP;
+	} else {
+		output->pending.committed &= ~WLR_OUTPUT_STATE_TEARING_PAGE_FLIP;
+	}
+}
+
+void wlr_output_set_buffer_transform(struct wlr_output *output,
+		enum wl_output_transform transform) {
+	if (transform == WL_OUTPUT_TRANSFORM_NORMAL) {
+		output->pending.committed &= ~WLR_OUTPUT_STATE_BUFFER_TRANSFORM;
+		return;
+	}
+	output->pending.committed |= WLR_OUTPUT_STATE_BUFFER_TRANSFORM;
+	output->pending.buffer_transform = transform;
+}
+
+struct wlr_output_layer *wlr_output_layer_create(struct wlr_output *output) {
+	struct wlr_output_layer *layer = calloc(1, sizeof(*layer));
+	if (layer == NULL) {
+		return NULL;
+	}
+
+	layer->output = output;
+	wlr_addon_set_init(&layer->addons);
+	wl_list_insert(&output->layers, &layer->link);
+	return layer;
+}
+
+void wlr_output_layer_destroy(struct wlr_output_layer *layer) {
+	if (layer == NULL) {
+		return;
+	}
+	wlr_addon_set_finish(&layer->addons);
+	wl_list_remove(&layer->link);
+	free(layer);
+}
+
+void wlr_output_set_layers(struct wlr_output *output,
+		struct wlr_output_layer_state *layers, size_t layers_len) {
+	// Backends only ever accept layers, reset any leftover value
+	for (size_t i = 0; i < layers_len; i++) {
+		layers[i].accepted = false;
+	}
+
+	output->pending.committed |= WLR_OUTPUT_STATE_LAYERS;
+	output->pending.layers = layers;
+	output->pending.layers_len = layers_len;
+}
+
+/**
+ * Returns the transform the display engine needs to apply to the surface's
+ * buffer so that it matches the output transform.
+ */
+static enum wl_output_transform surface_scanout_transform(
+		struct wlr_surface *surface, struct wlr_output *output) {
+	return wlr_output_transform_compose(
+		wlr_output_transform_invert(surface->current.transform),
+		output->transform);
+}
+
+static bool surface_is_scanout_candidate(struct wlr_surface *surface,
+		struct wlr_output *output) {
+	if (surface->buffer == NULL) {
+		return false;
+	}
+
+	if (surface->current.viewport.has_src ||
+			surface->current.viewport.has_dst) {
+		return false;
+	}
+
+	struct wlr_subsurface *subsurface;
+	wl_list_for_each(subsurface, &surface->subsurfaces_below, parent_link) {
+		if (subsurface->mapped) {
+			return false;
+		}
+	}
+	wl_list_for_each(subsurface, &surface->subsurfaces_above, parent_link) {
+		if (subsurface->mapped) {
+			return false;
+		}
+	}
+
+	// Direct scan-out requires a DMA-BUF
+	struct wlr_dmabuf_attributes attribs;
+	if (!wlr_buffer_get_dmabuf(&surface->buffer->base, &attribs)) {
+		return false;
+	}
+
+	int pending_width, pending_height;
+	output_pending_resolution(output, &pending_width, &pending_height);
+	if (surface_scanout_transform(surface, output) % 2 != 0) {
+		int tmp = pending_width;
+		pending_width = pending_height;
+		pending_height = tmp;
+	}
+	return surface->buffer->base.width == pending_width &&
+		surface->buffer->base.height == pending_height;
+}
+
+bool wlr_output_attach_surface(struct wlr_output *output,
+		struct wlr_surface *surface) {
+	if (output->pending.committed & WLR_OUTPUT_STATE_BUFFER) {
+		return false;
+	}
+
+	if (!surface_is_scanout_candidate(surface, output)) {
+		return false;
+	}
+
+	wlr_output_attach_buffer(output, &surface->buffer->base);
+	wlr_output_set_buffer_transform(output,
+		surface_scanout_transform(surface, output));
+	if (!wlr_output_test(output)) {
+		// Only drop the buffer, keep any other pending state so that the
+		// compositor can render and commit as usual
+		output_state_clear_buffer(&output->pending);
+		return false;
+	}
+
+	return true;
+}
+
+static int64_t output_sched_now(struct wlr_output *output) {
+	clockid_t clock = wlr_backend_get_presentation_clock(output->backend);
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return timespec_to_nsec(&now);
+}
+
+static void output_emit_frame(struct wlr_output *output);
+
+static bool frame_group_is_peer(struct wlr_output *output,
+		struct wlr_output *peer) {
+	return peer != output && peer->display == output->display &&
+		wlr_backend_get_presentation_clock(peer->backend) ==
+		wlr_backend_get_presentation_clock(output->backend);
+}
+
+/**
+ * Send the frame events held back for the output's frame.
+ */
+static void frame_group_flush(struct wlr_output *output) {
+	if (!output->frame_group.enabled) {
+		return;
+	}
+
+	// Frame listeners may change the list, so restart after each event
+	bool found = true;
+	while (found) {
+		found = false;
+		struct wlr_output *peer;
+		wl_list_for_each(peer, &frame_group_outputs, frame_group.link) {
+			if (!peer->frame_group.waiting ||
+					!frame_group_is_peer(output, peer)) {
+				continue;
+			}
+			peer->frame_group.waiting = false;
+			wl_event_source_timer_update(peer->frame_group.timer, 0);
+			if (!peer->frame_pending) {
+				output_emit_frame(peer);
+			}
+			found = true;
+			break;
+		}
+	}
+}
+
+static int frame_group_handle_timer(void *data) {
+	struct wlr_output *output = data;
+	output->frame_group.waiting = false;
+	if (!output->frame_pending) {
+		output_emit_frame(output);
+	}
+	return 0;
+}
+
+/**
+ * Hold back the output's frame event if another output of the group is about
+ * to send one. Returns false if the frame event should be sent right away.
+ */
+static bool frame_group_defer(struct wlr_output *output) {
+	if (!output->frame_group.enabled) {
+		return false;
+	}
+
+	int64_t now = output_sched_now(output);
+	bool found = false;
+	struct wlr_output *peer;
+	wl_list_for_each(peer, &frame_group_outputs, frame_group.link) {
+		// Only outputs waiting for a page-flip will send a frame event on
+		// their own
+		if (!frame_group_is_peer(output, peer) || !peer->enabled ||
+				!peer->frame_pending || peer->frame_group.waiting ||
+				peer->frame_sched.last_present == 0 ||
+				peer->frame_sched.refresh <= 0) {
+			continue;
+		}
+		int64_t next = peer->frame_sched.last_present +
+			peer->frame_sched.refresh;
+		if (next - now <= FRAME_GROUP_WINDOW) {
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		return false;
+	}
+
+	if (output->frame_group.timer == NULL) {
+		struct wl_event_loop *ev = wl_display_get_event_loop(output->display);
+		output->frame_group.timer =
+			wl_event_loop_add_timer(ev, frame_group_handle_timer, output);
+		if (output->frame_group.timer == NULL) {
+			return false;
+		}
+	}
+	// In case the other output doesn't send its frame event in time
+	wl_event_source_timer_update(output->frame_group.timer,
+		FRAME_GROUP_WINDOW / 1000000);
+	output->frame_group.waiting = true;
+	return true;
+}
+
+static int frame_interleave_handle_wakeup(int fd, uint32_t mask, void *data) {
+	struct wlr_output *output = data;
+	char byte;
+	if (read(fd, &byte, sizeof(byte)) != sizeof(byte)) {
+		wlr_log_errno(WLR_ERROR, "Failed to read from frame interleaving pipe");
+	}
+
+	if (!output->frame_interleave.queued) {
+		return 0;
+	}
+	output->frame_interleave.queued = false;
+	if (!output->frame_pending) {
+		output_emit_frame(output);
+	}
+	return 0;
+}
+
+/**
+ * Hold back the output's frame event until the next event loop iteration if
+ * another output has already sent one during this iteration. Returns false if
+ * the frame event should be sent right away.
+ */
+static bool frame_interleave_defer(struct wlr_output *output) {
+	if (!output->frame_interleave.enabled || !frame_interleave_busy) {
+		return false;
+	}
+	if (output->frame_interleave.queued) {
+		return true;
+	}
+
+	if (output->frame_interleave.event_source == NULL) {
+		int *fds = output->frame_interleave.fds;
+		if (pipe(fds) != 0) {
+			wlr_log_errno(WLR_ERROR, "pipe failed");
+			return false;
+		}
+		for (size_t i = 0; i < 2; i++) {
+			fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+		}
+
+		struct wl_event_loop *ev = wl_display_get_event_loop(output->display);
+		output->frame_interleave.event_source = wl_event_loop_add_fd(ev,
+			fds[0], WL_EVENT_READABLE, frame_interleave_handle_wakeup, output);
+		if (output->frame_interleave.event_source == NULL) {
+			close(fds[0]);
+			close(fds[1]);
+			return false;
+		}
+	}
+
+	// Readable on the next epoll_wait, along with all other pending events
+	char byte = 0;
+	if (write(output->frame_interleave.fds[1], &byte, sizeof(byte)) !=
+			sizeof(byte)) {
+		wlr_log_errno(WLR_ERROR, "Failed to write to frame interleaving pipe");
+		return false;
+	}
+	output->frame_interleave.queued = true;
+	return true;
+}
+
+static void frame_interleave_handle_idle(void *data) {
+	struct wlr_output *output = data;
+	output->frame_interleave.idle = NULL;
+	frame_interleave_busy = false;
+}
+
+static void frame_interleave_mark_busy(struct wlr_output *output) {
+	if (!output->frame_interleave.enabled) {
+		return;
+	}
+
+	frame_interleave_busy = true;
+	// Idle sources run once all events of the iteration have been dispatched
+	if (output->frame_interleave.idle == NULL) {
+		struct wl_event_loop *ev = wl_display_get_event_loop(output->display);
+		output->frame_interleave.idle =
+			wl_event_loop_add_idle(ev, frame_interleave_handle_idle, output);
+		if (output->frame_interleave.idle == NULL) {
+			frame_interleave_busy = false;
+		}
+	}
+}
+
+static void output_emit_frame(struct wlr_output *output) {
+	if (frame_interleave_defer(output)) {
+		return;
+	}
+
+	if (output->frame_sched.enabled) {
+		output->frame_sched.frame_sent = output_sched_now(output);
+	}
+	trace_begin("%s frame", output->name);
+	wlr_signal_emit_safe(&output->events.frame, output);
+	trace_end();
+
+	frame_interleave_mark_busy(output);
+	frame_group_flush(output);
+
+	// Nothing but software cursors changed: repaint them on our own
+	if (output->cursor_save_under.moved && !output->frame_pending) {
+		output_cursor_save_under_repaint(output);
+	}
+}
+
+static void frame_sched_record_commit(struct wlr_output *output) {
+	if (output->frame_sched.frame_sent == 0) {
+		return;
+	}
+
+	int64_t elapsed = output_sched_now(output) - output->frame_sched.frame_sent;
+	output->frame_sched.frame_sent = 0;
+
+	// A commit long after the frame event wasn't triggered by the frame event
+	if (output->frame_sched.refresh > 0 &&
+			elapsed > output->frame_sched.refresh) {
+		return;
+	}
+
+	// Follow increases immediately, decreases slowly
+	if (elapsed > output->frame_sched.render_time) {
+		output->frame_sched.render_time = elapsed;
+	} else {
+		output->frame_sched.render_time =
+			(7 * (int64_t)output->frame_sched.render_time + elapsed) / 8;
+	}
+}
+
+static void frame_sched_record_present(struct wlr_output *output,
+		const struct wlr_output_event_present *event) {
+	if (!(event->flags & WLR_OUTPUT_PRESENT_VSYNC) || event->refresh <= 0) {
+		output->frame_sched.last_present = 0;
+		output->frame_sched.refresh = 0;
+		return;
+	}
+
+	int64_t when = timespec_to_nsec(event->when);
+	int64_t target = output->frame_sched.target_present;
+	if (target != 0 && event->commit_seq == output->commit_seq) {
+		int margin = output->frame_sched.margin;
+		if (when > target + event->refresh / 2) {
+			// Missed the deadline, back off
+			margin *= 2;
+			if (margin > event->refresh / 2) {
+				margin = event->refresh / 2;
+			}
+		} else {
+			margin -= margin / 16;
+		}
+		if (margin < FRAME_SCHED_MIN_MARGIN) {
+			margin = FRAME_SCHED_MIN_MARGIN;
+		}
+		output->frame_sched.margin = margin;
+		output->frame_sched.target_present = 0;
+	}
+
+	output->frame_sched.last_present = when;
+	output->frame_sched.refresh = event->refresh;
+}
+
+/**
+ * Compute how long the frame event can be delayed, in nanoseconds.
+ */
+static int64_t frame_sched_get_delay(struct wlr_output *output) {
+	output->frame_sched.target_present = 0;
+
+	int refresh = output->frame_sched.refresh;
+	if (!output->frame_sched.enabled || output->frame_sched.last_present == 0 ||
+			refresh <= 0 || output->frame_sched.render_time == 0) {
+		return 0;
+	}
+
+	// With adaptive sync, the next refresh cycle starts when the next frame
+	// is committed: delaying the frame event would only lower the refresh
+	// rate. The display bounds it to its maximum rate on its own.
+	if (output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED) {
+		return 0;
+	}
+
+	int64_t now = output_sched_now(output);
+	int64_t next = output->frame_sched.last_present + refresh;
+	if (next <= now) {
+		next += ((now - next) / refresh + 1) * refresh;
+	}
+	output->frame_sched.target_present = next;
+
+	return next - now - output->frame_sched.render_time -
+		output->frame_sched.margin;
+}
+
+static int frame_sched_handle_timer(void *data) {
+	struct wlr_output *output = data;
+	output->frame_sched.delayed = false;
+	if (!output->frame_pending) {
+		output_emit_frame(output);
+	}
+	return 0;
+}
+
+void wlr_output_send_frame(struct wlr_output *output) {
+	output->frame_pending = false;
+
+	// The timer has a millisecond granularity
+	int64_t delay_ms = frame_sched_get_delay(output) / 1000000;
+	if (delay_ms > 0) {
+		if (output->frame_sched.timer == NULL) {
+			struct wl_event_loop *ev =
+				wl_display_get_event_loop(output->display);
+			output->frame_sched.timer =
+				wl_event_loop_add_timer(ev, frame_sched_handle_timer, output);
+		}
+		if (output->frame_sched.timer != NULL) {
+			wl_event_source_timer_update(output->frame_sched.timer, delay_ms);
+			output->frame_sched.delayed = true;
+			return;
+		}
+	}
+
+	if (frame_group_defer(output)) {
+		return;
+	}
+
+	output_emit_frame(output);
+}
+
+void wlr_output_enable_frame_scheduling(struct wlr_output *output,
+		bool enabled) {
+	if (output->frame_sched.enabled == enabled) {
+		return;
+	}
+
+	output->frame_sched.enabled = enabled;
+	output->frame_sched.frame_sent = 0;
+	output->frame_sched.target_present = 0;
+	output->frame_sched.render_time = 0;
+	output->frame_sched.margin = FRAME_SCHED_MIN_MARGIN;
+
+	if (!enabled && output->frame_sched.delayed) {
+		wl_event_source_timer_update(output->frame_sched.timer, 0);
+		frame_sched_handle_timer(output);
+	}
+}
+
+void wlr_output_enable_frame_grouping(struct wlr_output *output,
+		bool enabled) {
+	if (output->frame_group.enabled == enabled) {
+		return;
+	}
+
+	output->frame_group.enabled = enabled;
+	wl_list_remove(&output->frame_group.link);
+	wl_list_init(&output->frame_group.link);
+	if (enabled) {
+		wl_list_insert(&frame_group_outputs, &output->frame_group.link);
+		// Presentation events are needed to predict frames
+		output->frame_sched.last_present = 0;
+		output->frame_sched.refresh = 0;
+	} else if (output->frame_group.waiting) {
+		wl_event_source_timer_update(output->frame_group.timer, 0);
+		frame_group_handle_timer(output);
+	}
+}
+
+void wlr_output_enable_frame_interleaving(struct wlr_output *output,
+		bool enabled) {
+	if (output->frame_interleave.enabled == enabled) {
+		return;
+	}
+
+	output->frame_interleave.enabled = enabled;
+	if (!enabled && output->frame_interleave.queued) {
+		// The wake-up is ignored once it arrives
+		output->frame_interleave.queued = false;
+		if (!output->frame_pending) {
+			output_emit_frame(output);
+		}
+	}
+}
+
+static void schedule_frame_handle_idle_timer(void *data) {
 	struct wlr_output *output = data;
 	output->idle_frame = NULL;
 	if (!output->frame_pending) {
-		wlr_output_send_frame(output);
+		// Not aligned on a vertical blank, don't try to predict anything
+		output->frame_sched.target_present = 0;
+		output_emit_frame(output);
 	}
 }
 
@@ -841,7 +1966,14 @@ void wlr_output_schedule_frame(struct wlr_output *output) {
 	// work.
 	wlr_output_update_needs_frame(output);
 
-	if (output->frame_pending || output->idle_frame != NULL) {
+	if (output->frame_pending || output->idle_frame != NULL ||
+			output->frame_sched.delayed || output->frame_group.waiting ||
+			output->frame_interleave.queued) {
+		return;
+	}
+
+	if (output->impl->schedule_frame) {
+		output->impl->schedule_frame(output);
 		return;
 	}
 
@@ -874,6 +2006,14 @@ void wlr_output_send_present(struct wlr_output *output,
 		event->when = &now;
 	}
 
+	if (output->frame_sched.enabled || output->frame_group.enabled) {
+		frame_sched_record_present(output, event);
+	}
+
+	output_poll_render_stats(output);
+
+	trace_async_end(event->commit_seq, "%s present", output->name);
+
 	wlr_signal_emit_safe(&output->events.present, event);
 }
 
@@ -895,10 +2035,11 @@ void wlr_output_set_gamma(struct wlr_output *output, size_t size,
 }
 
 size_t wlr_output_get_gamma_size(struct wlr_output *output) {
-	if (!output->impl->get_gamma_size) {
-		return 0;
+	size_t size = output_get_hardware_gamma_size(output);
+	if (size == 0 && output_supports_software_gamma(output)) {
+		return WLR_OUTPUT_SOFTWARE_GAMMA_SIZE;
 	}
-	return output->impl->get_gamma_size(output);
+	return size;
 }
 
 bool wlr_output_export_dmabuf(struct wlr_output *output,
@@ -906,7 +2047,28 @@ bool wlr_output_export_dmabuf(struct wlr_output *output,
 	if (!output->impl->export_dmabuf) {
 		return false;
 	}
-	return output->impl->export_dmabuf(output, attribs);
+	return output->impl->export_dmabuf(output, attribs);
+}
+
+bool wlr_output_capture_next_commit(struct wlr_output *output,
+		struct wlr_buffer *buffer) {
+	if (!output->impl->capture_next_commit) {
+		return false;
+	}
+	return output->impl->capture_next_commit(output, buffer);
+}
+
+void wlr_output_send_capture(struct wlr_output *output,
+		struct wlr_output_event_capture *event) {
+	event->output = output;
+
+	struct timespec now;
+	if (event->when == NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		event->when = &now;
+	}
+
+	wlr_signal_emit_safe(&output->events.capture, event);
 }
 
 void wlr_output_update_needs_frame(struct wlr_output *output) {
@@ -967,7 +2129,13 @@ void wlr_output_lock_software_cursors(struct wlr_output *output, bool lock) {
 	if (output->software_cursor_locks > 0 && output->hardware_cursor != NULL) {
 		assert(output->impl->set_cursor);
 		output->impl->set_cursor(output, NULL, 0, 0);
-		output_cursor_damage_whole(output->hardware_cursor);
+		struct wlr_output_cursor *cursor;
+		wl_list_for_each(cursor, &output->cursors, link) {
+			if (output_cursor_is_hardware(cursor)) {
+				cursor->composited = false;
+				output_cursor_damage_whole(cursor);
+			}
+		}
 		output->hardware_cursor = NULL;
 	}
 
@@ -976,25 +2144,28 @@ void wlr_output_lock_software_cursors(struct wlr_output *output, bool lock) {
 	// again.
 }
 
-static void output_scissor(struct wlr_output *output, pixman_box32_t *rect) {
-	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
-	assert(renderer);
-
-	struct wlr_box box = {
-		.x = rect->x1,
-		.y = rect->y1,
-		.width = rect->x2 - rect->x1,
-		.height = rect->y2 - rect->y1,
-	};
+void wlr_output_lock_hardware_cursor_damage(struct wlr_output *output,
+		bool lock) {
+	if (lock) {
+		++output->hardware_cursor_damage_locks;
+	} else {
+		assert(output->hardware_cursor_damage_locks > 0);
+		--output->hardware_cursor_damage_locks;
+	}
+}
 
+/**
+ * Convert an output-local region to buffer coordinates, to be used as a render
+ * clip region.
+ */
+static void output_clip_region(struct wlr_output *output,
+		pixman_region32_t *clip, pixman_region32_t *region) {
 	int ow, oh;
 	wlr_output_transformed_resolution(output, &ow, &oh);
 
 	enum wl_output_transform transform =
 		wlr_output_transform_invert(output->transform);
-	wlr_box_transform(&box, &box, transform, ow, oh);
-
-	wlr_renderer_scissor(renderer, &box);
+	wlr_region_transform(clip, region, transform, ow, oh);
 }
 
 static void output_cursor_get_box(struct wlr_output_cursor *cursor,
@@ -1030,18 +2201,78 @@ static void output_cursor_render(struct wlr_output_cursor *cursor,
 	wlr_matrix_project_box(matrix, &box, WL_OUTPUT_TRANSFORM_NORMAL, 0,
 		cursor->output->transform_matrix);
 
-	int nrects;
-	pixman_box32_t *rects = pixman_region32_rectangles(&surface_damage, &nrects);
-	for (int i = 0; i < nrects; ++i) {
-		output_scissor(cursor->output, &rects[i]);
-		wlr_render_texture_with_matrix(renderer, texture, matrix, 1.0f);
-	}
+	// The clip region replaces any scissor box left by the compositor
 	wlr_renderer_scissor(renderer, NULL);
+	output_clip_region(cursor->output, &surface_damage, &surface_damage);
+	wlr_render_texture_with_matrix_clipped(renderer, texture, matrix, 1.0f,
+		&surface_damage);
 
 surface_damage_finish:
 	pixman_region32_fini(&surface_damage);
 }
 
+static bool output_cursor_save_under_supported(struct wlr_output *output) {
+	return output->cursor_save_under.enabled &&
+		output->transform == WL_OUTPUT_TRANSFORM_NORMAL;
+}
+
+/**
+ * Saves the pixels below the cursor in the current render pass. If damage is
+ * NULL, the cursor isn't drawn and there is nothing to save. Fails if the
+ * pixels below the cursor aren't entirely repainted in this pass.
+ */
+static bool output_cursor_save_under(struct wlr_output_cursor *cursor,
+		pixman_region32_t *damage) {
+	struct wlr_output *output = cursor->output;
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+
+	wlr_texture_destroy(cursor->save_under);
+	cursor->save_under = NULL;
+	cursor->save_under_box = (struct wlr_box){0};
+	if (damage == NULL) {
+		return true;
+	}
+
+	struct wlr_box output_box = { .width = output->width,
+		.height = output->height };
+	struct wlr_box box;
+	output_cursor_get_box(cursor, &box);
+	if (!wlr_box_intersection(&box, &box, &output_box)) {
+		return true;
+	}
+
+	pixman_box32_t rect = {
+		.x1 = box.x,
+		.y1 = box.y,
+		.x2 = box.x + box.width,
+		.y2 = box.y + box.height,
+	};
+	if (pixman_region32_contains_rectangle(damage, &rect) != PIXMAN_REGION_IN) {
+		return false;
+	}
+
+	uint32_t stride = box.width * 4;
+	uint8_t *data = malloc(stride * box.height);
+	if (data == NULL) {
+		return false;
+	}
+
+	uint32_t flags = 0;
+	bool ok = wlr_renderer_read_pixels(renderer, DRM_FORMAT_XRGB8888, &flags,
+		stride, box.width, box.height, box.x, box.y, 0, 0, data);
+	if (ok && !(flags & WLR_RENDERER_READ_PIXELS_Y_INVERT)) {
+		cursor->save_under = wlr_texture_from_pixels(renderer,
+			DRM_FORMAT_XRGB8888, stride, box.width, box.height, data);
+	}
+	free(data);
+
+	if (cursor->save_under == NULL) {
+		return false;
+	}
+	cursor->save_under_box = box;
+	return true;
+}
+
 void wlr_output_render_software_cursors(struct wlr_output *output,
 		pixman_region32_t *damage) {
 	int width, height;
@@ -1056,13 +2287,21 @@ void wlr_output_render_software_cursors(struct wlr_output *output,
 		pixman_region32_intersect(&render_damage, &render_damage, damage);
 	}
 
-	if (pixman_region32_not_empty(&render_damage)) {
-		struct wlr_output_cursor *cursor;
-		wl_list_for_each(cursor, &output->cursors, link) {
-			if (!cursor->enabled || !cursor->visible ||
-					output->hardware_cursor == cursor) {
-				continue;
-			}
+	bool save_under = output_cursor_save_under_supported(output) &&
+		output->back_buffer != NULL;
+	if (save_under) {
+		output->cursor_save_under.saved = true;
+	}
+
+	struct wlr_output_cursor *cursor;
+	wl_list_for_each(cursor, &output->cursors, link) {
+		bool software = cursor->enabled && cursor->visible &&
+			!output_cursor_is_hardware(cursor);
+		if (save_under && !output_cursor_save_under(cursor,
+				software ? &render_damage : NULL)) {
+			output->cursor_save_under.saved = false;
+		}
+		if (software && pixman_region32_not_empty(&render_damage)) {
 			output_cursor_render(cursor, &render_damage);
 		}
 	}
@@ -1070,6 +2309,153 @@ void wlr_output_render_software_cursors(struct wlr_output *output,
 	pixman_region32_fini(&render_damage);
 }
 
+static void output_cursor_emit_damage(struct wlr_output_cursor *cursor,
+		bool software_cursor);
+
+static void output_cursor_save_under_damage(struct wlr_output *output) {
+	struct wlr_output_cursor *cursor;
+	wl_list_for_each(cursor, &output->cursors, link) {
+		struct wlr_box *box = &cursor->save_under_box;
+		if (!wlr_box_empty(box)) {
+			pixman_region32_t damage;
+			pixman_region32_init_rect(&damage, box->x, box->y,
+				box->width, box->height);
+			struct wlr_output_event_damage event = {
+				.output = output,
+				.damage = &damage,
+			};
+			wlr_signal_emit_safe(&output->events.damage, &event);
+			pixman_region32_fini(&damage);
+		}
+		if (!output_cursor_is_hardware(cursor)) {
+			output_cursor_emit_damage(cursor, false);
+		}
+	}
+}
+
+static void output_cursor_save_under_commit(struct wlr_output *output) {
+	wlr_buffer_unlock(output->cursor_save_under.frame);
+	output->cursor_save_under.frame = NULL;
+	if (output->cursor_save_under.saved && output->back_buffer != NULL) {
+		output->cursor_save_under.frame = wlr_buffer_lock(output->back_buffer);
+	}
+	output->cursor_save_under.saved = false;
+	output->cursor_save_under.moved = false;
+}
+
+/**
+ * Checks whether software cursor motion can be repainted on top of the last
+ * frame.
+ */
+static bool output_cursor_save_under_valid(struct wlr_output *output) {
+	struct wlr_buffer *frame = output->cursor_save_under.frame;
+	return output_cursor_save_under_supported(output) && frame != NULL &&
+		frame->width == output->width && frame->height == output->height;
+}
+
+static void output_cursor_save_under_repaint(struct wlr_output *output) {
+	output->cursor_save_under.moved = false;
+
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	if (!output->enabled || output->back_buffer != NULL ||
+			!output_cursor_save_under_valid(output) || renderer == NULL) {
+		goto fallback;
+	}
+
+	struct wlr_texture *frame =
+		wlr_texture_from_buffer(renderer, output->cursor_save_under.frame);
+	if (frame == NULL) {
+		goto fallback;
+	}
+	if (!wlr_output_attach_render(output, NULL)) {
+		wlr_texture_destroy(frame);
+		goto fallback;
+	}
+
+	pixman_region32_t whole, damage;
+	pixman_region32_init_rect(&whole, 0, 0, output->width, output->height);
+	pixman_region32_init(&damage);
+
+	wlr_renderer_begin(renderer, output->width, output->height);
+	wlr_renderer_clear(renderer, (float[]){ 0.0, 0.0, 0.0, 0.0 });
+	wlr_render_texture(renderer, frame, output->transform_matrix, 0, 0, 1.0);
+
+	// Restore in reverse order: the pixels saved for a cursor may include the
+	// cursors drawn before it
+	struct wlr_output_cursor *cursor;
+	wl_list_for_each_reverse(cursor, &output->cursors, link) {
+		struct wlr_box *box = &cursor->save_under_box;
+		if (cursor->save_under == NULL) {
+			continue;
+		}
+		wlr_render_texture(renderer, cursor->save_under,
+			output->transform_matrix, box->x, box->y, 1.0);
+		pixman_region32_union_rect(&damage, &damage, box->x, box->y,
+			box->width, box->height);
+	}
+
+	bool saved = true;
+	wl_list_for_each(cursor, &output->cursors, link) {
+		bool software = cursor->enabled && cursor->visible &&
+			!output_cursor_is_hardware(cursor);
+		if (!output_cursor_save_under(cursor, software ? &whole : NULL)) {
+			saved = false;
+		}
+		if (software) {
+			output_cursor_render(cursor, &whole);
+			struct wlr_box box;
+			output_cursor_get_box(cursor, &box);
+			pixman_region32_union_rect(&damage, &damage, box.x, box.y,
+				box.width, box.height);
+		}
+	}
+
+	wlr_renderer_end(renderer);
+	wlr_texture_destroy(frame);
+
+	output->cursor_save_under.saved = saved;
+	wlr_output_set_damage(output, &damage);
+	pixman_region32_fini(&damage);
+	pixman_region32_fini(&whole);
+
+	if (!wlr_output_commit(output)) {
+		wlr_log(WLR_DEBUG, "Failed to repaint software cursors on output '%s'",
+			output->name);
+		wlr_buffer_unlock(output->cursor_save_under.frame);
+		output->cursor_save_under.frame = NULL;
+		goto fallback;
+	}
+	return;
+
+fallback:
+	// Let the compositor render the cursor boxes instead
+	output_cursor_save_under_damage(output);
+}
+
+void wlr_output_enable_cursor_save_under(struct wlr_output *output,
+		bool enabled) {
+	if (output->cursor_save_under.enabled == enabled) {
+		return;
+	}
+
+	if (output->cursor_save_under.moved) {
+		output->cursor_save_under.moved = false;
+		output_cursor_save_under_damage(output);
+	}
+
+	output->cursor_save_under.enabled = enabled;
+	output->cursor_save_under.saved = false;
+	wlr_buffer_unlock(output->cursor_save_under.frame);
+	output->cursor_save_under.frame = NULL;
+
+	struct wlr_output_cursor *cursor;
+	wl_list_for_each(cursor, &output->cursors, link) {
+		wlr_texture_destroy(cursor->save_under);
+		cursor->save_under = NULL;
+		cursor->save_under_box = (struct wlr_box){0};
+	}
+}
+
 
 /**
  * Returns the cursor box, scaled for its output.
@@ -1082,7 +2468,8 @@ static void output_cursor_get_box(struct wlr_output_cursor *cursor,
 	box->height = cursor->height;
 }
 
-static void output_cursor_damage_whole(struct wlr_output_cursor *cursor) {
+static void output_cursor_emit_damage(struct wlr_output_cursor *cursor,
+		bool software_cursor) {
 	struct wlr_box box;
 	output_cursor_get_box(cursor, &box);
 
@@ -1092,111 +2479,407 @@ static void output_cursor_damage_whole(struct wlr_output_cursor *cursor) {
 	struct wlr_output_event_damage event = {
 		.output = cursor->output,
 		.damage = &damage,
+		.software_cursor = software_cursor,
 	};
 	wlr_signal_emit_safe(&cursor->output->events.damage, &event);
 
 	pixman_region32_fini(&damage);
 }
 
+static void output_cursor_damage_whole(struct wlr_output_cursor *cursor) {
+	output_cursor_emit_damage(cursor, false);
+}
+
+static bool output_cursor_is_hardware(struct wlr_output_cursor *cursor) {
+	return cursor->output->hardware_cursor == cursor || cursor->composited;
+}
+
+static bool output_cursor_needs_damage(struct wlr_output_cursor *cursor) {
+	return !output_cursor_is_hardware(cursor) ||
+		cursor->output->hardware_cursor_damage_locks > 0;
+}
+
 static void output_cursor_reset(struct wlr_output_cursor *cursor) {
-	if (cursor->output->hardware_cursor != cursor) {
+	if (!output_cursor_is_hardware(cursor)) {
 		output_cursor_damage_whole(cursor);
 	}
-	if (cursor->surface != NULL) {
-		wl_list_remove(&cursor->surface_commit.link);
-		wl_list_remove(&cursor->surface_destroy.link);
-		if (cursor->visible) {
-			wlr_surface_send_leave(cursor->surface, cursor->output);
-		}
-		cursor->surface = NULL;
+	if (cursor->surface != NULL) {
+		wl_list_remove(&cursor->surface_commit.link);
+		wl_list_remove(&cursor->surface_destroy.link);
+		if (cursor->visible) {
+			wlr_surface_send_leave(cursor->surface, cursor->output);
+		}
+		cursor->surface = NULL;
+	}
+}
+
+static void output_cursor_update_visible(struct wlr_output_cursor *cursor) {
+	struct wlr_box output_box;
+	output_box.x = output_box.y = 0;
+	wlr_output_transformed_resolution(cursor->output, &output_box.width,
+		&output_box.height);
+
+	struct wlr_box cursor_box;
+	output_cursor_get_box(cursor, &cursor_box);
+
+	struct wlr_box intersection;
+	bool visible =
+		wlr_box_intersection(&intersection, &output_box, &cursor_box);
+
+	if (cursor->surface != NULL) {
+		if (cursor->visible && !visible) {
+			wlr_surface_send_leave(cursor->surface, cursor->output);
+		}
+		if (!cursor->visible && visible) {
+			wlr_surface_send_enter(cursor->surface, cursor->output);
+		}
+	}
+
+	cursor->visible = visible;
+}
+
+static struct wlr_drm_format *pick_format(
+		const struct wlr_drm_format_set *render_formats,
+		const struct wlr_drm_format_set *display_formats, uint32_t fmt) {
+	const struct wlr_drm_format *render_format =
+		wlr_drm_format_set_get(render_formats, fmt);
+	if (render_format == NULL) {
+		wlr_log(WLR_DEBUG, "Renderer doesn't support format 0x%"PRIX32, fmt);
+		return NULL;
+	}
+
+	const struct wlr_drm_format *display_format;
+	if (display_formats != NULL) {
+		display_format = wlr_drm_format_set_get(display_formats, fmt);
+		if (display_format == NULL) {
+			wlr_log(WLR_DEBUG, "Output doesn't support format 0x%"PRIX32, fmt);
+			return NULL;
+		}
+	} else {
+		// The output can display any format
+		display_format = render_format;
+	}
+
+	struct wlr_drm_format *format =
+		wlr_drm_format_intersect(display_format, render_format);
+	if (format == NULL) {
+		wlr_log(WLR_DEBUG, "Failed to intersect display and render "
+			"modifiers for format 0x%"PRIX32, fmt);
+		return NULL;
+	}
+
+	return format;
+}
+
+static struct wlr_drm_format *output_pick_format(struct wlr_output *output,
+		const struct wlr_drm_format_set *display_formats) {
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	struct wlr_allocator *allocator = backend_get_allocator(output->backend);
+	assert(renderer != NULL && allocator != NULL);
+
+	const struct wlr_drm_format_set *render_formats =
+		wlr_renderer_get_render_formats(renderer);
+	if (render_formats == NULL) {
+		wlr_log(WLR_ERROR, "Failed to get render formats");
+		return NULL;
+	}
+
+	struct wlr_drm_format *format =
+		pick_format(render_formats, display_formats, output->render_format);
+	if (format == NULL && output->render_format != DRM_FORMAT_ARGB8888) {
+		wlr_log(WLR_DEBUG, "Falling back to ARGB8888 for output '%s'",
+			output->name);
+		format = pick_format(render_formats, display_formats,
+			DRM_FORMAT_ARGB8888);
+	}
+	return format;
+}
+
+static const struct wlr_drm_format *output_pick_cursor_format(
+		struct wlr_output *output) {
+	struct wlr_allocator *allocator = backend_get_allocator(output->backend);
+	assert(allocator != NULL);
+
+	const struct wlr_drm_format_set *display_formats = NULL;
+	if (output->impl->get_cursor_formats) {
+		display_formats =
+			output->impl->get_cursor_formats(output, allocator->buffer_caps);
+		if (display_formats == NULL) {
+			wlr_log(WLR_ERROR, "Failed to get cursor display formats");
+			return NULL;
+		}
+	}
+
+	return output_negotiate_format(output, &output->cursor_format,
+		display_formats);
+}
+
+static bool output_create_cursor_swapchain(struct wlr_output *output,
+		int width, int height) {
+	struct wlr_allocator *allocator = backend_get_allocator(output->backend);
+	assert(allocator != NULL);
+
+	const struct wlr_drm_format *format = output_pick_cursor_format(output);
+	if (format == NULL) {
+		wlr_log(WLR_ERROR, "Failed to pick cursor format");
+		return false;
+	}
+
+	// Cached cursor buffers may use a format which has been given up on
+	output_cursor_buffers_clear(output);
+
+	wlr_swapchain_destroy(output->cursor_swapchain);
+	output->cursor_swapchain = wlr_swapchain_create(allocator,
+		width, height, format);
+	if (output->cursor_swapchain == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create cursor swapchain");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Cursor image rendered into a buffer suitable for the cursor plane. Animated
+ * cursors cycle through a few images, keeping them around avoids rendering
+ * each frame of the animation again.
+ */
+struct output_cursor_buffer {
+	struct wl_list link; // wlr_output.cursor_buffers, most recent first
+	uint64_t image_hash;
+	uint32_t image_width, image_height;
+	enum wl_output_transform transform;
+	struct wlr_buffer *buffer;
+};
+
+static void output_cursor_buffer_destroy(struct wlr_output *output,
+		struct output_cursor_buffer *cursor_buffer) {
+	wl_list_remove(&cursor_buffer->link);
+	output->cursor_buffers_len--;
+	wlr_buffer_drop(cursor_buffer->buffer);
+	free(cursor_buffer);
+}
+
+static void output_cursor_buffers_clear(struct wlr_output *output) {
+	struct output_cursor_buffer *cursor_buffer, *tmp;
+	wl_list_for_each_safe(cursor_buffer, tmp, &output->cursor_buffers, link) {
+		output_cursor_buffer_destroy(output, cursor_buffer);
+	}
+}
+
+static struct output_cursor_buffer *output_cursor_buffer_get(
+		struct wlr_output_cursor *cursor, int width, int height) {
+	struct wlr_output *output = cursor->output;
+	struct wlr_texture *texture = cursor->texture;
+
+	struct output_cursor_buffer *cursor_buffer;
+	wl_list_for_each(cursor_buffer, &output->cursor_buffers, link) {
+		if (cursor_buffer->image_hash == cursor->image_hash &&
+				cursor_buffer->image_width == texture->width &&
+				cursor_buffer->image_height == texture->height &&
+				cursor_buffer->transform == output->transform &&
+				cursor_buffer->buffer->width == width &&
+				cursor_buffer->buffer->height == height) {
+			wl_list_remove(&cursor_buffer->link);
+			wl_list_insert(&output->cursor_buffers, &cursor_buffer->link);
+			return cursor_buffer;
+		}
+	}
+	return NULL;
+}
+
+static struct output_cursor_buffer *output_cursor_buffer_create(
+		struct wlr_output_cursor *cursor, int width, int height) {
+	struct wlr_output *output = cursor->output;
+	struct wlr_allocator *allocator = backend_get_allocator(output->backend);
+	assert(allocator != NULL);
+
+	const struct wlr_drm_format *format = output_pick_cursor_format(output);
+	if (format == NULL) {
+		wlr_log(WLR_ERROR, "Failed to pick cursor format");
+		return NULL;
+	}
+
+	struct wlr_buffer *buffer =
+		wlr_allocator_create_buffer(allocator, width, height, format);
+	if (buffer == NULL && wl_list_empty(&output->cursor_buffers) &&
+			format_cache_drop_modifiers(output, &output->cursor_format)) {
+		format = output_pick_cursor_format(output);
+		if (format != NULL) {
+			buffer = wlr_allocator_create_buffer(allocator,
+				width, height, format);
+		}
+	}
+	if (buffer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to allocate cursor buffer");
+		return NULL;
+	}
+
+	struct output_cursor_buffer *cursor_buffer =
+		calloc(1, sizeof(*cursor_buffer));
+	if (cursor_buffer == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		wlr_buffer_drop(buffer);
+		return NULL;
+	}
+	cursor_buffer->image_hash = cursor->image_hash;
+	cursor_buffer->image_width = cursor->texture->width;
+	cursor_buffer->image_height = cursor->texture->height;
+	cursor_buffer->transform = output->transform;
+	cursor_buffer->buffer = buffer;
+
+	wl_list_insert(&output->cursor_buffers, &cursor_buffer->link);
+	output->cursor_buffers_len++;
+	if (output->cursor_buffers_len > WLR_OUTPUT_CURSOR_BUFFER_CACHE_SIZE) {
+		struct output_cursor_buffer *last =
+			wl_container_of(output->cursor_buffers.prev, last, link);
+		output_cursor_buffer_destroy(output, last);
 	}
+
+	return cursor_buffer;
 }
 
-static void output_cursor_update_visible(struct wlr_output_cursor *cursor) {
-	struct wlr_box output_box;
-	output_box.x = output_box.y = 0;
-	wlr_output_transformed_resolution(cursor->output, &output_box.width,
-		&output_box.height);
+/**
+ * Cursor image uploaded to the GPU. Compositors switch between a handful of
+ * cursor images, keeping them around avoids uploading them on each change.
+ */
+struct output_cursor_texture {
+	struct wl_list link; // wlr_output.cursor_textures, most recent first
+	uint64_t image_hash;
+	struct wlr_texture *texture;
+};
 
-	struct wlr_box cursor_box;
-	output_cursor_get_box(cursor, &cursor_box);
+static void output_cursor_texture_destroy(struct wlr_output *output,
+		struct output_cursor_texture *cursor_texture) {
+	wl_list_remove(&cursor_texture->link);
+	output->cursor_textures_len--;
+	wlr_texture_destroy(cursor_texture->texture);
+	free(cursor_texture);
+}
 
-	struct wlr_box intersection;
-	bool visible =
-		wlr_box_intersection(&intersection, &output_box, &cursor_box);
+static void output_cursor_textures_clear(struct wlr_output *output) {
+	struct output_cursor_texture *cursor_texture, *tmp;
+	wl_list_for_each_safe(cursor_texture, tmp, &output->cursor_textures,
+			link) {
+		output_cursor_texture_destroy(output, cursor_texture);
+	}
+}
 
-	if (cursor->surface != NULL) {
-		if (cursor->visible && !visible) {
-			wlr_surface_send_leave(cursor->surface, cursor->output);
-		}
-		if (!cursor->visible && visible) {
-			wlr_surface_send_enter(cursor->surface, cursor->output);
+static bool output_cursor_texture_in_use(struct wlr_output *output,
+		struct wlr_texture *texture) {
+	struct wlr_output_cursor *cursor;
+	wl_list_for_each(cursor, &output->cursors, link) {
+		if (cursor->texture == texture) {
+			return true;
 		}
 	}
-
-	cursor->visible = visible;
+	return false;
 }
 
-static struct wlr_drm_format *output_pick_format(struct wlr_output *output,
-		const struct wlr_drm_format_set *display_formats) {
-	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
-	struct wlr_allocator *allocator = backend_get_allocator(output->backend);
-	assert(renderer != NULL && allocator != NULL);
+static struct wlr_texture *output_cursor_texture_get(struct wlr_output *output,
+		struct wlr_renderer *renderer, const uint8_t *pixels, int32_t stride,
+		uint32_t width, uint32_t height, uint64_t hash) {
+	struct output_cursor_texture *cursor_texture;
+	wl_list_for_each(cursor_texture, &output->cursor_textures, link) {
+		if (cursor_texture->image_hash == hash &&
+				cursor_texture->texture->width == width &&
+				cursor_texture->texture->height == height) {
+			wl_list_remove(&cursor_texture->link);
+			wl_list_insert(&output->cursor_textures, &cursor_texture->link);
+			return cursor_texture->texture;
+		}
+	}
 
-	const struct wlr_drm_format_set *render_formats =
-		wlr_renderer_get_render_formats(renderer);
-	if (render_formats == NULL) {
-		wlr_log(WLR_ERROR, "Failed to get render formats");
+	struct wlr_texture *texture = wlr_texture_from_pixels(renderer,
+		DRM_FORMAT_ARGB8888, stride, width, height, pixels);
+	if (texture == NULL) {
 		return NULL;
 	}
 
-	uint32_t fmt = DRM_FORMAT_ARGB8888;
-
-	const struct wlr_drm_format *render_format =
-		wlr_drm_format_set_get(render_formats, fmt);
-	if (render_format == NULL) {
-		wlr_log(WLR_DEBUG, "Renderer doesn't support format 0x%"PRIX32, fmt);
+	cursor_texture = calloc(1, sizeof(*cursor_texture));
+	if (cursor_texture == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		wlr_texture_destroy(texture);
 		return NULL;
 	}
-
-	const struct wlr_drm_format *display_format;
-	if (display_formats != NULL) {
-		display_format = wlr_drm_format_set_get(display_formats, fmt);
-		if (display_format == NULL) {
-			wlr_log(WLR_DEBUG, "Output doesn't support format 0x%"PRIX32, fmt);
-			return NULL;
+	cursor_texture->image_hash = hash;
+	cursor_texture->texture = texture;
+	wl_list_insert(&output->cursor_textures, &cursor_texture->link);
+	output->cursor_textures_len++;
+
+	// Evict the least recently used textures, except the ones still displayed
+	struct output_cursor_texture *tmp;
+	wl_list_for_each_reverse_safe(cursor_texture, tmp,
+			&output->cursor_textures, link) {
+		if (output->cursor_textures_len <=
+				WLR_OUTPUT_CURSOR_TEXTURE_CACHE_SIZE) {
+			break;
+		}
+		if (cursor_texture->texture != texture &&
+				!output_cursor_texture_in_use(output,
+				cursor_texture->texture)) {
+			output_cursor_texture_destroy(output, cursor_texture);
 		}
-	} else {
-		// The output can display any format
-		display_format = render_format;
 	}
 
-	struct wlr_drm_format *format =
-		wlr_drm_format_intersect(display_format, render_format);
-	if (format == NULL) {
-		wlr_log(WLR_DEBUG, "Failed to intersect display and render "
-			"modifiers for format 0x%"PRIX32, fmt);
-		return NULL;
-	}
+	return texture;
+}
 
-	return format;
+static uint64_t hash_cursor_pixels(const uint8_t *pixels, int32_t stride,
+		uint32_t width, uint32_t height) {
+	// 64-bit FNV-1a
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	for (uint32_t y = 0; y < height; y++) {
+		const uint8_t *row = pixels + (size_t)y * stride;
+		for (size_t i = 0; i < (size_t)width * 4; i++) {
+			hash ^= row[i];
+			hash *= UINT64_C(0x100000001b3);
+		}
+	}
+	return hash;
 }
 
-static struct wlr_drm_format *output_pick_cursor_format(struct wlr_output *output) {
-	struct wlr_allocator *allocator = backend_get_allocator(output->backend);
-	assert(allocator != NULL);
+static struct wlr_buffer *output_cursor_swapchain_acquire(
+		struct wlr_output *output, int width, int height) {
+	if (output->cursor_swapchain == NULL ||
+			output->cursor_swapchain->width != width ||
+			output->cursor_swapchain->height != height) {
+		if (!output_create_cursor_swapchain(output, width, height)) {
+			return NULL;
+		}
+	}
 
-	const struct wlr_drm_format_set *display_formats = NULL;
-	if (output->impl->get_cursor_formats) {
-		display_formats =
-			output->impl->get_cursor_formats(output, allocator->buffer_caps);
-		if (display_formats == NULL) {
-			wlr_log(WLR_ERROR, "Failed to get cursor display formats");
+	struct wlr_buffer *buffer =
+		wlr_swapchain_acquire(output->cursor_swapchain, NULL);
+	if (buffer == NULL && swapchain_is_empty(output->cursor_swapchain) &&
+			format_cache_drop_modifiers(output, &output->cursor_format)) {
+		if (!output_create_cursor_swapchain(output, width, height)) {
 			return NULL;
 		}
+		buffer = wlr_swapchain_acquire(output->cursor_swapchain, NULL);
 	}
+	return buffer;
+}
+
+/**
+ * Get the matrix mapping output coordinates to cursor buffer coordinates,
+ * relative to the top-left corner of the buffer.
+ */
+static void cursor_buffer_get_matrix(struct wlr_output *output,
+		struct wlr_buffer *buffer, float output_matrix[static 9]) {
+	wlr_matrix_identity(output_matrix);
+	if (output->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		struct wlr_box tr_size = {
+			.width = buffer->width,
+			.height = buffer->height,
+		};
+		wlr_box_transform(&tr_size, &tr_size, output->transform, 0, 0);
 
-	return output_pick_format(output, display_formats);
+		wlr_matrix_translate(output_matrix, buffer->width / 2.0,
+			buffer->height / 2.0);
+		wlr_matrix_transform(output_matrix, output->transform);
+		wlr_matrix_translate(output_matrix, - tr_size.width / 2.0,
+			- tr_size.height / 2.0);
+	}
 }
 
 static struct wlr_buffer *render_cursor_buffer(struct wlr_output_cursor *cursor) {
@@ -1239,29 +2922,26 @@ static struct wlr_buffer *render_cursor_buffer(struct wlr_output_cursor *cursor)
 		}
 	}
 
-	if (output->cursor_swapchain == NULL ||
-			output->cursor_swapchain->width != width ||
-			output->cursor_swapchain->height != height) {
-		struct wlr_drm_format *format =
-			output_pick_cursor_format(output);
-		if (format == NULL) {
-			wlr_log(WLR_ERROR, "Failed to pick cursor format");
-			return NULL;
+	// Images set with wlr_output_cursor_set_image don't change once
+	// rendered, surfaces do
+	struct output_cursor_buffer *cursor_buffer = NULL;
+	struct wlr_buffer *buffer;
+	if (cursor->surface == NULL && cursor->image_hash != 0) {
+		cursor_buffer = output_cursor_buffer_get(cursor, width, height);
+		if (cursor_buffer != NULL) {
+			return wlr_buffer_lock(cursor_buffer->buffer);
 		}
 
-		wlr_swapchain_destroy(output->cursor_swapchain);
-		output->cursor_swapchain = wlr_swapchain_create(allocator,
-			width, height, format);
-		if (output->cursor_swapchain == NULL) {
-			wlr_log(WLR_ERROR, "Failed to create cursor swapchain");
+		cursor_buffer = output_cursor_buffer_create(cursor, width, height);
+		if (cursor_buffer == NULL) {
+			return NULL;
+		}
+		buffer = wlr_buffer_lock(cursor_buffer->buffer);
+	} else {
+		buffer = output_cursor_swapchain_acquire(output, width, height);
+		if (buffer == NULL) {
 			return NULL;
 		}
-	}
-
-	struct wlr_buffer *buffer =
-		wlr_swapchain_acquire(output->cursor_swapchain, NULL);
-	if (buffer == NULL) {
-		return NULL;
 	}
 
 	struct wlr_box cursor_box = {
@@ -1270,26 +2950,16 @@ static struct wlr_buffer *render_cursor_buffer(struct wlr_output_cursor *cursor)
 	};
 
 	float output_matrix[9];
-	wlr_matrix_identity(output_matrix);
-	if (output->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
-		struct wlr_box tr_size = {
-			.width = buffer->width,
-			.height = buffer->height,
-		};
-		wlr_box_transform(&tr_size, &tr_size, output->transform, 0, 0);
-
-		wlr_matrix_translate(output_matrix, buffer->width / 2.0,
-			buffer->height / 2.0);
-		wlr_matrix_transform(output_matrix, output->transform);
-		wlr_matrix_translate(output_matrix, - tr_size.width / 2.0,
-			- tr_size.height / 2.0);
-	}
+	cursor_buffer_get_matrix(output, buffer, output_matrix);
 
 	float matrix[9];
 	wlr_matrix_project_box(matrix, &cursor_box, transform, 0, output_matrix);
 
 	if (!wlr_renderer_begin_with_buffer(renderer, buffer)) {
 		wlr_buffer_unlock(buffer);
+		if (cursor_buffer != NULL) {
+			output_cursor_buffer_destroy(output, cursor_buffer);
+		}
 		return NULL;
 	}
 
@@ -1301,6 +2971,191 @@ static struct wlr_buffer *render_cursor_buffer(struct wlr_output_cursor *cursor)
 	return buffer;
 }
 
+static struct wlr_texture *output_cursor_get_texture(
+		struct wlr_output_cursor *cursor) {
+	if (cursor->surface != NULL) {
+		return wlr_surface_get_texture(cursor->surface);
+	}
+	return cursor->texture;
+}
+
+static bool output_has_composited_cursors(struct wlr_output *output) {
+	struct wlr_output_cursor *cursor;
+	wl_list_for_each(cursor, &output->cursors, link) {
+		if (cursor->composited) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Render the hardware cursor and the composited cursors in a single cursor
+ * plane buffer, along with extra if not NULL. The buffer covers the union of
+ * the cursor boxes, its hotspot is the position of the hardware cursor.
+ */
+static bool output_cursor_composite(struct wlr_output *output,
+		struct wlr_output_cursor *extra) {
+	struct wlr_output_cursor *hwcur = output->hardware_cursor;
+	assert(hwcur != NULL);
+
+	if (!output->impl->move_cursor || output->software_cursor_locks > 0) {
+		return false;
+	}
+
+	int x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+	bool empty = true;
+	struct wlr_output_cursor *cursor;
+	wl_list_for_each(cursor, &output->cursors, link) {
+		if ((cursor != hwcur && !cursor->composited && cursor != extra) ||
+				!cursor->enabled || !cursor->visible ||
+				output_cursor_get_texture(cursor) == NULL) {
+			continue;
+		}
+
+		struct wlr_box box;
+		output_cursor_get_box(cursor, &box);
+		if (empty || box.x < x1) {
+			x1 = box.x;
+		}
+		if (empty || box.y < y1) {
+			y1 = box.y;
+		}
+		if (empty || box.x + box.width > x2) {
+			x2 = box.x + box.width;
+		}
+		if (empty || box.y + box.height > y2) {
+			y2 = box.y + box.height;
+		}
+		empty = false;
+	}
+
+	if (empty) {
+		if (!output->impl->set_cursor(output, NULL, 0, 0)) {
+			return false;
+		}
+		wlr_buffer_unlock(output->cursor_front_buffer);
+		output->cursor_front_buffer = NULL;
+		if (extra != NULL && extra != hwcur) {
+			extra->composited = true;
+		}
+		return true;
+	}
+
+	int width = x2 - x1;
+	int height = y2 - y1;
+	if (output->transform & WL_OUTPUT_TRANSFORM_90) {
+		int tmp = width;
+		width = height;
+		height = tmp;
+	}
+	if (output->impl->get_cursor_size) {
+		int max_width = width, max_height = height;
+		output->impl->get_cursor_size(output, &max_width, &max_height);
+		if (width > max_width || height > max_height) {
+			wlr_log(WLR_DEBUG, "Composited cursors too large (%dx%d), "
+				"exceed hardware limitations (%dx%d)", width, height,
+				max_width, max_height);
+			return false;
+		}
+		width = max_width;
+		height = max_height;
+	}
+
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	if (renderer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to get backend renderer");
+		return false;
+	}
+
+	struct wlr_buffer *buffer =
+		output_cursor_swapchain_acquire(output, width, height);
+	if (buffer == NULL) {
+		return false;
+	}
+
+	if (!wlr_renderer_begin_with_buffer(renderer, buffer)) {
+		wlr_buffer_unlock(buffer);
+		return false;
+	}
+
+	wlr_renderer_clear(renderer, (float[]){ 0.0, 0.0, 0.0, 0.0 });
+
+	float output_matrix[9];
+	cursor_buffer_get_matrix(output, buffer, output_matrix);
+
+	wl_list_for_each(cursor, &output->cursors, link) {
+		struct wlr_texture *texture = output_cursor_get_texture(cursor);
+		if ((cursor != hwcur && !cursor->composited && cursor != extra) ||
+				!cursor->enabled || !cursor->visible || texture == NULL) {
+			continue;
+		}
+
+		float scale = output->scale;
+		enum wl_output_transform transform = WL_OUTPUT_TRANSFORM_NORMAL;
+		if (cursor->surface != NULL) {
+			scale = cursor->surface->current.scale;
+			transform = cursor->surface->current.transform;
+		}
+
+		struct wlr_box box;
+		output_cursor_get_box(cursor, &box);
+		box.x -= x1;
+		box.y -= y1;
+		box.width = texture->width * output->scale / scale;
+		box.height = texture->height * output->scale / scale;
+
+		float matrix[9];
+		wlr_matrix_project_box(matrix, &box, transform, 0, output_matrix);
+		wlr_render_texture_with_matrix(renderer, texture, matrix, 1.0);
+	}
+
+	wlr_renderer_end(renderer);
+
+	struct wlr_box hotspot = {
+		.x = (int)hwcur->x - x1,
+		.y = (int)hwcur->y - y1,
+	};
+	wlr_box_transform(&hotspot, &hotspot,
+		wlr_output_transform_invert(output->transform),
+		buffer->width, buffer->height);
+
+	output->impl->move_cursor(output, (int)hwcur->x, (int)hwcur->y);
+	if (!output->impl->set_cursor(output, buffer, hotspot.x, hotspot.y)) {
+		wlr_buffer_unlock(buffer);
+		return false;
+	}
+
+	wlr_buffer_unlock(output->cursor_front_buffer);
+	output->cursor_front_buffer = buffer;
+	if (extra != NULL && extra != hwcur) {
+		extra->composited = true;
+	}
+	return true;
+}
+
+static bool output_cursor_attempt_hardware(struct wlr_output_cursor *cursor);
+
+/**
+ * Re-render the cursor plane after a composited cursor has changed. If the
+ * cursors can't be composited anymore, the composited cursors fall back to
+ * software cursors.
+ */
+static bool output_cursor_update_composite(struct wlr_output *output) {
+	if (output_cursor_composite(output, NULL)) {
+		return true;
+	}
+
+	struct wlr_output_cursor *cursor;
+	wl_list_for_each(cursor, &output->cursors, link) {
+		if (cursor->composited) {
+			cursor->composited = false;
+			output_cursor_damage_whole(cursor);
+		}
+	}
+	return output_cursor_attempt_hardware(output->hardware_cursor);
+}
+
 static bool output_cursor_attempt_hardware(struct wlr_output_cursor *cursor) {
 	struct wlr_output *output = cursor->output;
 
@@ -1311,8 +3166,19 @@ static bool output_cursor_attempt_hardware(struct wlr_output_cursor *cursor) {
 
 	struct wlr_output_cursor *hwcur = output->hardware_cursor;
 	if (hwcur != NULL && hwcur != cursor) {
+		// Another cursor owns the cursor plane, try to share it
+		if (output_cursor_composite(output, cursor)) {
+			return true;
+		}
+		if (cursor->composited) {
+			cursor->composited = false;
+			output_cursor_update_composite(output);
+		}
 		return false;
 	}
+	if (hwcur == cursor && output_has_composited_cursors(output)) {
+		return output_cursor_update_composite(output);
+	}
 
 	struct wlr_texture *texture = cursor->texture;
 	if (cursor->surface != NULL) {
@@ -1365,6 +3231,21 @@ bool wlr_output_cursor_set_image(struct wlr_output_cursor *cursor,
 		return true;
 	}
 
+	uint64_t hash = 0;
+	if (pixels != NULL) {
+		hash = hash_cursor_pixels(pixels, stride, width, height);
+
+		// Nothing to do if the image is already displayed
+		if (cursor->enabled && cursor->texture != NULL &&
+				cursor->image_hash == hash &&
+				cursor->texture->width == width &&
+				cursor->texture->height == height &&
+				cursor->hotspot_x == hotspot_x &&
+				cursor->hotspot_y == hotspot_y) {
+			return true;
+		}
+	}
+
 	output_cursor_reset(cursor);
 
 	cursor->width = width;
@@ -1373,20 +3254,24 @@ bool wlr_output_cursor_set_image(struct wlr_output_cursor *cursor,
 	cursor->hotspot_y = hotspot_y;
 	output_cursor_update_visible(cursor);
 
-	wlr_texture_destroy(cursor->texture);
 	cursor->texture = NULL;
+	cursor->image_hash = 0;
 
 	cursor->enabled = false;
 	if (pixels != NULL) {
-		cursor->texture = wlr_texture_from_pixels(renderer,
-			DRM_FORMAT_ARGB8888, stride, width, height, pixels);
+		cursor->texture = output_cursor_texture_get(cursor->output, renderer,
+			pixels, stride, width, height, hash);
 		if (cursor->texture == NULL) {
 			return false;
 		}
+		cursor->image_hash = hash;
 		cursor->enabled = true;
 	}
 
 	if (output_cursor_attempt_hardware(cursor)) {
+		if (cursor->output->hardware_cursor_damage_locks > 0) {
+			output_cursor_damage_whole(cursor);
+		}
 		return true;
 	}
 
@@ -1398,7 +3283,7 @@ bool wlr_output_cursor_set_image(struct wlr_output_cursor *cursor,
 
 static void output_cursor_commit(struct wlr_output_cursor *cursor,
 		bool update_hotspot) {
-	if (cursor->output->hardware_cursor != cursor) {
+	if (output_cursor_needs_damage(cursor)) {
 		output_cursor_damage_whole(cursor);
 	}
 
@@ -1416,6 +3301,9 @@ static void output_cursor_commit(struct wlr_output_cursor *cursor,
 	}
 
 	if (output_cursor_attempt_hardware(cursor)) {
+		if (cursor->output->hardware_cursor_damage_locks > 0) {
+			output_cursor_damage_whole(cursor);
+		}
 		return;
 	}
 
@@ -1445,13 +3333,15 @@ void wlr_output_cursor_set_surface(struct wlr_output_cursor *cursor,
 	if (surface && surface == cursor->surface) {
 		// Only update the hotspot: surface hasn't changed
 
-		if (cursor->output->hardware_cursor != cursor) {
+		if (!output_cursor_is_hardware(cursor)) {
 			output_cursor_damage_whole(cursor);
 		}
 		cursor->hotspot_x = hotspot_x;
 		cursor->hotspot_y = hotspot_y;
-		if (cursor->output->hardware_cursor != cursor) {
+		if (!output_cursor_is_hardware(cursor)) {
 			output_cursor_damage_whole(cursor);
+		} else if (output_has_composited_cursors(cursor->output)) {
+			output_cursor_update_composite(cursor->output);
 		} else {
 			struct wlr_buffer *buffer = cursor->output->cursor_front_buffer;
 
@@ -1472,6 +3362,10 @@ void wlr_output_cursor_set_surface(struct wlr_output_cursor *cursor,
 
 	output_cursor_reset(cursor);
 
+	// The image set with wlr_output_cursor_set_image is replaced
+	cursor->texture = NULL;
+	cursor->image_hash = 0;
+
 	cursor->surface = surface;
 	cursor->hotspot_x = hotspot_x;
 	cursor->hotspot_y = hotspot_y;
@@ -1487,7 +3381,10 @@ void wlr_output_cursor_set_surface(struct wlr_output_cursor *cursor,
 		cursor->width = 0;
 		cursor->height = 0;
 
-		if (cursor->output->hardware_cursor == cursor) {
+		if (output_cursor_is_hardware(cursor) &&
+				output_has_composited_cursors(cursor->output)) {
+			output_cursor_update_composite(cursor->output);
+		} else if (cursor->output->hardware_cursor == cursor) {
 			assert(cursor->output->impl->set_cursor);
 			cursor->output->impl->set_cursor(cursor->output, NULL, 0, 0);
 		}
@@ -1500,8 +3397,13 @@ bool wlr_output_cursor_move(struct wlr_output_cursor *cursor,
 		return true;
 	}
 
-	if (cursor->output->hardware_cursor != cursor) {
-		output_cursor_damage_whole(cursor);
+	// With a save-under the output can repaint the cursor without the
+	// compositor re-rendering the scene
+	bool save_under = output_cursor_save_under_valid(cursor->output);
+	if (!output_cursor_is_hardware(cursor)) {
+		output_cursor_emit_damage(cursor, save_under);
+	} else if (output_cursor_needs_damage(cursor)) {
+		output_cursor_emit_damage(cursor, false);
 	}
 
 	bool was_visible = cursor->visible;
@@ -1516,8 +3418,28 @@ bool wlr_output_cursor_move(struct wlr_output_cursor *cursor,
 		return true;
 	}
 
-	if (cursor->output->hardware_cursor != cursor) {
-		output_cursor_damage_whole(cursor);
+	if (!output_cursor_is_hardware(cursor)) {
+		if (save_under) {
+			cursor->output->cursor_save_under.moved = true;
+		}
+		output_cursor_emit_damage(cursor, save_under);
+		return true;
+	}
+
+	if (output_cursor_needs_damage(cursor)) {
+		output_cursor_emit_damage(cursor, false);
+	}
+
+	if (output_has_composited_cursors(cursor->output)) {
+		// The cursors sharing the cursor plane are re-rendered at their new
+		// relative position
+		if (!output_cursor_composite(cursor->output, NULL)) {
+			if (cursor->composited) {
+				cursor->composited = false;
+				output_cursor_damage_whole(cursor);
+			}
+			output_cursor_update_composite(cursor->output);
+		}
 		return true;
 	}
 
@@ -1548,15 +3470,30 @@ void wlr_output_cursor_destroy(struct wlr_output_cursor *cursor) {
 	}
 	output_cursor_reset(cursor);
 	wlr_signal_emit_safe(&cursor->events.destroy, cursor);
-	if (cursor->output->hardware_cursor == cursor) {
-		// If this cursor was the hardware cursor, disable it
-		if (cursor->output->impl->set_cursor) {
-			cursor->output->impl->set_cursor(cursor->output, NULL, 0, 0);
+	wl_list_remove(&cursor->link);
+	struct wlr_output *output = cursor->output;
+	if (cursor->composited) {
+		cursor->composited = false;
+		output_cursor_update_composite(output);
+	} else if (output->hardware_cursor == cursor) {
+		// Hand the cursor plane over to a composited cursor, if any
+		struct wlr_output_cursor *next = NULL, *iter;
+		wl_list_for_each(iter, &output->cursors, link) {
+			if (iter->composited) {
+				next = iter;
+				break;
+			}
+		}
+		output->hardware_cursor = next;
+		if (next != NULL) {
+			next->composited = false;
+			output_cursor_update_composite(output);
+		} else if (output->impl->set_cursor) {
+			// If this cursor was the hardware cursor, disable it
+			output->impl->set_cursor(output, NULL, 0, 0);
 		}
-		cursor->output->hardware_cursor = NULL;
 	}
-	wlr_texture_destroy(cursor->texture);
-	wl_list_remove(&cursor->link);
+	wlr_texture_destroy(cursor->save_under);
 	free(cursor);
 }
 
@@ -1,10 +1,13 @@
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_box.h>
 #include <wlr/types/wlr_output_damage.h>
 #include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+#include <wlr/util/region.h>
 #include "util/signal.h"
 
 static void output_handle_destroy(struct wl_listener *listener, void *data) {
@@ -30,7 +33,18 @@ static void output_handle_damage(struct wl_listener *listener, void *data) {
 	struct wlr_output_damage *output_damage =
 		wl_container_of(listener, output_damage, output_damage);
 	struct wlr_output_event_damage *event = data;
-	wlr_output_damage_add(output_damage, event->damage);
+	if (!event->software_cursor) {
+		wlr_output_damage_add(output_damage, event->damage);
+		return;
+	}
+
+	int width, height;
+	wlr_output_transformed_resolution(output_damage->output, &width, &height);
+	pixman_region32_union(&output_damage->cursor, &output_damage->cursor,
+		event->damage);
+	pixman_region32_intersect_rect(&output_damage->cursor,
+		&output_damage->cursor, 0, 0, width, height);
+	wlr_output_schedule_frame(output_damage->output);
 }
 
 static void output_handle_frame(struct wl_listener *listener, void *data) {
@@ -44,18 +58,6 @@ static void output_handle_frame(struct wl_listener *listener, void *data) {
 	wlr_signal_emit_safe(&output_damage->events.frame, output_damage);
 }
 
-static void output_handle_precommit(struct wl_listener *listener, void *data) {
-	struct wlr_output_damage *output_damage =
-		wl_container_of(listener, output_damage, output_precommit);
-	struct wlr_output *output = output_damage->output;
-
-	if (output->pending.committed & WLR_OUTPUT_STATE_BUFFER) {
-		// TODO: find a better way to access this info without a precommit
-		// handler
-		output_damage->pending_buffer_type = output->pending.buffer_type;
-	}
-}
-
 static void output_handle_commit(struct wl_listener *listener, void *data) {
 	struct wlr_output_damage *output_damage =
 		wl_container_of(listener, output_damage, output_commit);
@@ -69,26 +71,55 @@ static void output_handle_commit(struct wl_listener *listener, void *data) {
 		return;
 	}
 
-	pixman_region32_t *prev;
-	switch (output_damage->pending_buffer_type) {
-	case WLR_OUTPUT_STATE_BUFFER_RENDER:
-		// render-buffers have been swapped, rotate the damage
+	// A new frame has been submitted, rotate the damage. This also applies
+	// to direct scan-out: the swap chain buffers get older in this case too,
+	// so the damage accumulated while scanning out a client buffer is picked
+	// up when switching back to rendering.
+
+	// Re-use the oldest region for the most recent frame
+	pixman_region32_t *previous = output_damage->previous;
+	size_t cap = output_damage->previous_cap;
+	pixman_region32_t oldest = previous[cap - 1];
+	memmove(&previous[1], &previous[0], (cap - 1) * sizeof(previous[0]));
+	previous[0] = oldest;
+	pixman_region32_union(&previous[0], &output_damage->current,
+		&output_damage->cursor);
+	if (output_damage->previous_len < cap) {
+		output_damage->previous_len++;
+	}
+
+	pixman_region32_clear(&output_damage->current);
+	pixman_region32_clear(&output_damage->cursor);
+}
 
-		// same as decrementing, but works on unsigned integers
-		output_damage->previous_idx += WLR_OUTPUT_DAMAGE_PREVIOUS_LEN - 1;
-		output_damage->previous_idx %= WLR_OUTPUT_DAMAGE_PREVIOUS_LEN;
+/**
+ * Grow the damage history to make room for cap frames. The added frames have
+ * unknown damage until enough frames have been submitted.
+ */
+static void output_damage_grow_history(struct wlr_output_damage *output_damage,
+		size_t cap) {
+	if (cap > WLR_OUTPUT_DAMAGE_PREVIOUS_MAX) {
+		cap = WLR_OUTPUT_DAMAGE_PREVIOUS_MAX;
+	}
+	if (cap <= output_damage->previous_cap) {
+		return;
+	}
 
-		prev = &output_damage->previous[output_damage->previous_idx];
-		pixman_region32_copy(prev, &output_damage->current);
-		break;
-	case WLR_OUTPUT_STATE_BUFFER_SCANOUT:
-		// accumulate render-buffer damage
-		prev = &output_damage->previous[output_damage->previous_idx];
-		pixman_region32_union(prev, prev, &output_damage->current);
-		break;
+	pixman_region32_t *previous = realloc(output_damage->previous,
+		cap * sizeof(previous[0]));
+	if (previous == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	for (size_t i = output_damage->previous_cap; i < cap; ++i) {
+		pixman_region32_init(&previous[i]);
 	}
 
-	pixman_region32_clear(&output_damage->current);
+	wlr_log(WLR_DEBUG, "Growing damage history of output '%s' to %zu frames",
+		output_damage->output->name, cap);
+
+	output_damage->previous = previous;
+	output_damage->previous_cap = cap;
 }
 
 struct wlr_output_damage *wlr_output_damage_create(struct wlr_output *output) {
@@ -104,8 +135,18 @@ struct wlr_output_damage *wlr_output_damage_create(struct wlr_output *output) {
 	wl_signal_init(&output_damage->events.destroy);
 
 	pixman_region32_init(&output_damage->current);
-	for (size_t i = 0; i < WLR_OUTPUT_DAMAGE_PREVIOUS_LEN; ++i) {
-		pixman_region32_init(&output_damage->previous[i]);
+	pixman_region32_init(&output_damage->cursor);
+	// A buffer gets back to us after going through the rest of the swap chain
+	size_t history_len = WLR_OUTPUT_DAMAGE_PREVIOUS_LEN;
+	if (output->swapchain_depth > history_len + 1) {
+		history_len = output->swapchain_depth - 1;
+	}
+	output_damage_grow_history(output_damage, history_len);
+	if (output_damage->previous_cap == 0) {
+		pixman_region32_fini(&output_damage->current);
+		pixman_region32_fini(&output_damage->cursor);
+		free(output_damage);
+		return NULL;
 	}
 
 	wl_signal_add(&output->events.destroy, &output_damage->output_destroy);
@@ -118,8 +159,6 @@ struct wlr_output_damage *wlr_output_damage_create(struct wlr_output *output) {
 	output_damage->output_damage.notify = output_handle_damage;
 	wl_signal_add(&output->events.frame, &output_damage->output_frame);
 	output_damage->output_frame.notify = output_handle_frame;
-	wl_signal_add(&output->events.precommit, &output_damage->output_precommit);
-	output_damage->output_precommit.notify = output_handle_precommit;
 	wl_signal_add(&output->events.commit, &output_damage->output_commit);
 	output_damage->output_commit.notify = output_handle_commit;
 
@@ -136,12 +175,13 @@ void wlr_output_damage_destroy(struct wlr_output_damage *output_damage) {
 	wl_list_remove(&output_damage->output_needs_frame.link);
 	wl_list_remove(&output_damage->output_damage.link);
 	wl_list_remove(&output_damage->output_frame.link);
-	wl_list_remove(&output_damage->output_precommit.link);
 	wl_list_remove(&output_damage->output_commit.link);
 	pixman_region32_fini(&output_damage->current);
-	for (size_t i = 0; i < WLR_OUTPUT_DAMAGE_PREVIOUS_LEN; ++i) {
+	pixman_region32_fini(&output_damage->cursor);
+	for (size_t i = 0; i < output_damage->previous_cap; ++i) {
 		pixman_region32_fini(&output_damage->previous[i]);
 	}
+	free(output_damage->previous);
 	free(output_damage);
 }
 
@@ -156,8 +196,15 @@ bool wlr_output_damage_attach_render(struct wlr_output_damage *output_damage,
 
 	*needs_frame =
 		output->needs_frame || pixman_region32_not_empty(&output_damage->current);
+	// Remember older frames from now on if the buffer is too old
+	if (buffer_age > 0 &&
+			(size_t)buffer_age - 1 > output_damage->previous_cap) {
+		output_damage_grow_history(output_damage, buffer_age - 1);
+	}
+
 	// Check if we can use damage tracking
-	if (buffer_age <= 0 || buffer_age - 1 > WLR_OUTPUT_DAMAGE_PREVIOUS_LEN) {
+	if (buffer_age <= 0 ||
+			(size_t)buffer_age - 1 > output_damage->previous_len) {
 		int width, height;
 		wlr_output_transformed_resolution(output, &width, &height);
 
@@ -165,22 +212,16 @@ bool wlr_output_damage_attach_render(struct wlr_output_damage *output_damage,
 		pixman_region32_union_rect(damage, damage, 0, 0, width, height);
 		*needs_frame = true;
 	} else {
-		pixman_region32_copy(damage, &output_damage->current);
+		pixman_region32_union(damage, &output_damage->current,
+			&output_damage->cursor);
 
 		// Accumulate damage from old buffers
-		size_t idx = output_damage->previous_idx;
 		for (int i = 0; i < buffer_age - 1; ++i) {
-			int j = (idx + i) % WLR_OUTPUT_DAMAGE_PREVIOUS_LEN;
-			pixman_region32_union(damage, damage, &output_damage->previous[j]);
+			pixman_region32_union(damage, damage, &output_damage->previous[i]);
 		}
 
-		// Check the number of rectangles
-		int n_rects = pixman_region32_n_rects(damage);
-		if (n_rects > output_damage->max_rects) {
-			pixman_box32_t *extents = pixman_region32_extents(damage);
-			pixman_region32_union_rect(damage, damage, extents->x1, extents->y1,
-				extents->x2 - extents->x1, extents->y2 - extents->y1);
-		}
+		// Limit the number of rectangles to draw
+		wlr_region_coalesce(damage, damage, output_damage->max_rects);
 	}
 
 	return true;
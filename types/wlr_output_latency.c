@@ -0,0 +1,148 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wlr/backend.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_latency.h>
+#include <wlr/util/log.h>
+#include "util/signal.h"
+
+// Larger latencies come from timestamps on another clock
+#define MAX_LATENCY_USEC (10 * 1000 * 1000)
+
+static void latency_add_sample(struct wlr_output_latency *latency,
+		uint32_t commit_seq, uint32_t input_msec, const struct timespec *when) {
+	if (wlr_backend_get_presentation_clock(latency->output->backend) !=
+			CLOCK_MONOTONIC) {
+		return;
+	}
+
+	// Input timestamps wrap around every 49 days
+	int64_t present_usec = (int64_t)when->tv_sec * 1000000 +
+		when->tv_nsec / 1000;
+	uint32_t present_msec = (uint32_t)(present_usec / 1000);
+	int64_t latency_usec = (int64_t)(int32_t)(present_msec - input_msec) * 1000 +
+		present_usec % 1000;
+	if (latency_usec < 0 || latency_usec > MAX_LATENCY_USEC) {
+		return;
+	}
+
+	size_t bucket = latency_usec / 1000;
+	if (bucket >= WLR_OUTPUT_LATENCY_BUCKETS) {
+		bucket = WLR_OUTPUT_LATENCY_BUCKETS - 1;
+	}
+	latency->histogram[bucket]++;
+	latency->samples++;
+	if (latency_usec > latency->max_usec) {
+		latency->max_usec = latency_usec;
+	}
+
+	struct wlr_output_latency_sample event = {
+		.latency = latency,
+		.commit_seq = commit_seq,
+		.latency_usec = latency_usec,
+	};
+	wlr_signal_emit_safe(&latency->events.sample, &event);
+}
+
+static void handle_output_commit(struct wl_listener *listener, void *data) {
+	struct wlr_output_latency *latency =
+		wl_container_of(listener, latency, output_commit);
+	struct wlr_output_event_commit *event = data;
+
+	if (!(event->committed & WLR_OUTPUT_STATE_BUFFER) ||
+			!latency->input_pending) {
+		return;
+	}
+	latency->input_pending = false;
+
+	// Reuse the oldest slot if too many frames are in flight
+	size_t slot = 0;
+	for (size_t i = 0; i < WLR_OUTPUT_LATENCY_INFLIGHT; i++) {
+		if (!latency->inflight[i].used) {
+			slot = i;
+			break;
+		}
+		if (latency->inflight[i].commit_seq -
+				latency->inflight[slot].commit_seq > UINT32_MAX / 2) {
+			slot = i;
+		}
+	}
+	latency->inflight[slot].used = true;
+	latency->inflight[slot].commit_seq = latency->output->commit_seq;
+	latency->inflight[slot].input_msec = latency->input_msec;
+}
+
+static void handle_output_present(struct wl_listener *listener, void *data) {
+	struct wlr_output_latency *latency =
+		wl_container_of(listener, latency, output_present);
+	struct wlr_output_event_present *event = data;
+
+	for (size_t i = 0; i < WLR_OUTPUT_LATENCY_INFLIGHT; i++) {
+		if (!latency->inflight[i].used ||
+				latency->inflight[i].commit_seq != event->commit_seq) {
+			continue;
+		}
+		latency->inflight[i].used = false;
+		latency_add_sample(latency, event->commit_seq,
+			latency->inflight[i].input_msec, event->when);
+	}
+}
+
+static void handle_output_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_output_latency *latency =
+		wl_container_of(listener, latency, output_destroy);
+	wlr_output_latency_destroy(latency);
+}
+
+struct wlr_output_latency *wlr_output_latency_create(
+		struct wlr_output *output) {
+	struct wlr_output_latency *latency = calloc(1, sizeof(*latency));
+	if (latency == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	latency->output = output;
+	wl_signal_init(&latency->events.sample);
+	wl_signal_init(&latency->events.destroy);
+
+	latency->output_commit.notify = handle_output_commit;
+	wl_signal_add(&output->events.commit, &latency->output_commit);
+	latency->output_present.notify = handle_output_present;
+	wl_signal_add(&output->events.present, &latency->output_present);
+	latency->output_destroy.notify = handle_output_destroy;
+	wl_signal_add(&output->events.destroy, &latency->output_destroy);
+
+	return latency;
+}
+
+void wlr_output_latency_destroy(struct wlr_output_latency *latency) {
+	if (latency == NULL) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&latency->events.destroy, latency);
+
+	wl_list_remove(&latency->output_commit.link);
+	wl_list_remove(&latency->output_present.link);
+	wl_list_remove(&latency->output_destroy.link);
+	free(latency);
+}
+
+void wlr_output_latency_notify_input(struct wlr_output_latency *latency,
+		uint32_t time_msec) {
+	// Keep the oldest event, it's the one that waited the most
+	if (latency->input_pending &&
+			(int32_t)(time_msec - latency->input_msec) >= 0) {
+		return;
+	}
+	latency->input_pending = true;
+	latency->input_msec = time_msec;
+}
+
+void wlr_output_latency_reset(struct wlr_output_latency *latency) {
+	memset(latency->histogram, 0, sizeof(latency->histogram));
+	latency->samples = 0;
+	latency->max_usec = 0;
+}
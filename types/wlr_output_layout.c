@@ -8,8 +8,23 @@
 #include <wlr/util/log.h>
 #include "util/signal.h"
 
+struct output_layout_entry {
+	struct wlr_box box;
+	struct wlr_output_layout_output *l_output;
+	size_t order; // position in wlr_output_layout.outputs
+};
+
 struct wlr_output_layout_state {
 	struct wlr_box _box; // should never be read directly, use the getter
+
+	// Output boxes sorted by x, rebuilt lazily after layout changes
+	struct output_layout_entry *entries;
+	size_t entries_len, entries_cap;
+	bool entries_dirty;
+	int max_width; // largest output width
+	bool overlapping; // whether some outputs overlap
+	struct wlr_box extents;
+	struct wlr_output_layout_output *last_hit; // last output_at result
 };
 
 struct wlr_output_layout_output_state {
@@ -17,6 +32,7 @@ struct wlr_output_layout_output_state {
 	struct wlr_output_layout_output *l_output;
 
 	struct wlr_box _box; // should never be read directly, use the getter
+	struct wlr_box box; // cached, updated on layout changes
 	bool auto_configured;
 
 	struct wl_listener mode;
@@ -36,6 +52,7 @@ struct wlr_output_layout *wlr_output_layout_create(void) {
 		return NULL;
 	}
 	wl_list_init(&layout->outputs);
+	layout->state->entries_dirty = true;
 
 	wl_signal_init(&layout->events.add);
 	wl_signal_init(&layout->events.change);
@@ -46,12 +63,17 @@ struct wlr_output_layout *wlr_output_layout_create(void) {
 
 static void output_layout_output_destroy(
 		struct wlr_output_layout_output *l_output) {
+	struct wlr_output_layout_state *layout_state = l_output->state->layout->state;
 	wlr_signal_emit_safe(&l_output->events.destroy, l_output);
 	wlr_output_destroy_global(l_output->output);
 	wl_list_remove(&l_output->state->mode.link);
 	wl_list_remove(&l_output->state->commit.link);
 	wl_list_remove(&l_output->state->output_destroy.link);
 	wl_list_remove(&l_output->link);
+	layout_state->entries_dirty = true;
+	if (layout_state->last_hit == l_output) {
+		layout_state->last_hit = NULL;
+	}
 	free(l_output->state);
 	free(l_output);
 }
@@ -68,21 +90,167 @@ void wlr_output_layout_destroy(struct wlr_output_layout *layout) {
 		output_layout_output_destroy(l_output);
 	}
 
+	free(layout->state->entries);
 	free(layout->state);
 	free(layout);
 }
 
-static struct wlr_box *output_layout_output_get_box(
+static void output_layout_output_update_box(
 		struct wlr_output_layout_output *l_output) {
-	l_output->state->_box.x = l_output->x;
-	l_output->state->_box.y = l_output->y;
+	l_output->state->box.x = l_output->x;
+	l_output->state->box.y = l_output->y;
 	int width, height;
 	wlr_output_effective_resolution(l_output->output, &width, &height);
-	l_output->state->_box.width = width;
-	l_output->state->_box.height = height;
+	l_output->state->box.width = width;
+	l_output->state->box.height = height;
+}
+
+static struct wlr_box *output_layout_output_get_box(
+		struct wlr_output_layout_output *l_output) {
+	l_output->state->_box = l_output->state->box;
 	return &l_output->state->_box;
 }
 
+static int entry_compare(const void *data_a, const void *data_b) {
+	const struct output_layout_entry *a = data_a, *b = data_b;
+	if (a->box.x != b->box.x) {
+		return a->box.x < b->box.x ? -1 : 1;
+	}
+	return a->order < b->order ? -1 : a->order > b->order;
+}
+
+/**
+ * Rebuild the sorted output boxes if the layout has changed. Returns false
+ * on allocation failure.
+ */
+static bool output_layout_update_entries(struct wlr_output_layout *layout) {
+	struct wlr_output_layout_state *state = layout->state;
+	if (!state->entries_dirty) {
+		return true;
+	}
+
+	size_t len = wl_list_length(&layout->outputs);
+	if (len > state->entries_cap) {
+		struct output_layout_entry *entries =
+			realloc(state->entries, len * sizeof(entries[0]));
+		if (entries == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			return false;
+		}
+		state->entries = entries;
+		state->entries_cap = len;
+	}
+
+	int min_x = INT_MAX, min_y = INT_MAX, max_x = INT_MIN, max_y = INT_MIN;
+	state->max_width = 0;
+	size_t i = 0;
+	struct wlr_output_layout_output *l_output;
+	wl_list_for_each(l_output, &layout->outputs, link) {
+		struct wlr_box *box = &l_output->state->box;
+		state->entries[i] = (struct output_layout_entry){
+			.box = *box,
+			.l_output = l_output,
+			.order = i,
+		};
+		i++;
+
+		if (box->width > state->max_width) {
+			state->max_width = box->width;
+		}
+		if (box->x < min_x) {
+			min_x = box->x;
+		}
+		if (box->y < min_y) {
+			min_y = box->y;
+		}
+		if (box->x + box->width > max_x) {
+			max_x = box->x + box->width;
+		}
+		if (box->y + box->height > max_y) {
+			max_y = box->y + box->height;
+		}
+	}
+	state->entries_len = len;
+	qsort(state->entries, len, sizeof(state->entries[0]), entry_compare);
+
+	if (len == 0) {
+		min_x = min_y = max_x = max_y = 0;
+	}
+	state->extents = (struct wlr_box){
+		.x = min_x,
+		.y = min_y,
+		.width = max_x - min_x,
+		.height = max_y - min_y,
+	};
+
+	// Without overlaps any output containing a point is the only one
+	state->overlapping = false;
+	for (i = 0; i < len && !state->overlapping; i++) {
+		struct wlr_box *a = &state->entries[i].box;
+		for (size_t j = i + 1; j < len; j++) {
+			struct wlr_box *b = &state->entries[j].box;
+			if (b->x >= a->x + a->width) {
+				break;
+			}
+			struct wlr_box intersection;
+			if (wlr_box_intersection(&intersection, a, b)) {
+				state->overlapping = true;
+				break;
+			}
+		}
+	}
+
+	state->entries_dirty = false;
+	return true;
+}
+
+/**
+ * Find the first output in layout order containing the point, using the
+ * boxes sorted by x.
+ */
+static struct wlr_output_layout_output *output_layout_output_at(
+		struct wlr_output_layout *layout, double lx, double ly) {
+	struct wlr_output_layout_state *state = layout->state;
+
+	if (!state->overlapping && state->last_hit != NULL &&
+			wlr_box_contains_point(&state->last_hit->state->box, lx, ly)) {
+		return state->last_hit;
+	}
+
+	// Find the first entry starting to the right of the point
+	size_t lo = 0, hi = state->entries_len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (state->entries[mid].box.x <= lx) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	struct output_layout_entry *found = NULL;
+	for (size_t i = lo; i-- > 0;) {
+		struct output_layout_entry *entry = &state->entries[i];
+		if (entry->box.x + state->max_width <= lx) {
+			break;
+		}
+		if (!wlr_box_contains_point(&entry->box, lx, ly) ||
+				(found != NULL && found->order < entry->order)) {
+			continue;
+		}
+		found = entry;
+		if (!state->overlapping) {
+			break;
+		}
+	}
+
+	if (found == NULL) {
+		return NULL;
+	}
+	state->last_hit = found->l_output;
+	return found->l_output;
+}
+
 /**
  * This must be called whenever the layout changes to reconfigure the auto
  * configured outputs and emit the `changed` event.
@@ -98,11 +266,12 @@ static void output_layout_reconfigure(struct wlr_output_layout *layout) {
 	// in the layout
 	struct wlr_output_layout_output *l_output;
 	wl_list_for_each(l_output, &layout->outputs, link) {
+		output_layout_output_update_box(l_output);
 		if (l_output->state->auto_configured) {
 			continue;
 		}
 
-		struct wlr_box *box = output_layout_output_get_box(l_output);
+		struct wlr_box *box = &l_output->state->box;
 		if (box->x + box->width > max_x) {
 			max_x = box->x + box->width;
 			max_x_y = box->y;
@@ -119,12 +288,14 @@ static void output_layout_reconfigure(struct wlr_output_layout *layout) {
 		if (!l_output->state->auto_configured) {
 			continue;
 		}
-		struct wlr_box *box = output_layout_output_get_box(l_output);
 		l_output->x = max_x;
 		l_output->y = max_x_y;
-		max_x += box->width;
+		output_layout_output_update_box(l_output);
+		max_x += l_output->state->box.width;
 	}
 
+	layout->state->entries_dirty = true;
+
 	wlr_signal_emit_safe(&layout->events.change, layout);
 }
 
@@ -265,6 +436,12 @@ bool wlr_output_layout_intersects(struct wlr_output_layout *layout,
 
 struct wlr_output *wlr_output_layout_output_at(struct wlr_output_layout *layout,
 		double lx, double ly) {
+	if (output_layout_update_entries(layout)) {
+		struct wlr_output_layout_output *l_output =
+			output_layout_output_at(layout, lx, ly);
+		return l_output != NULL ? l_output->output : NULL;
+	}
+
 	struct wlr_output_layout_output *l_output;
 	wl_list_for_each(l_output, &layout->outputs, link) {
 		struct wlr_box *box = output_layout_output_get_box(l_output);
@@ -322,6 +499,18 @@ void wlr_output_layout_closest_point(struct wlr_output_layout *layout,
 		return;
 	}
 
+	// A point inside the layout is its own closest point
+	if (reference == NULL && output_layout_update_entries(layout) &&
+			output_layout_output_at(layout, lx, ly) != NULL) {
+		if (dest_lx) {
+			*dest_lx = lx;
+		}
+		if (dest_ly) {
+			*dest_ly = ly;
+		}
+		return;
+	}
+
 	double min_x = 0, min_y = 0, min_distance = DBL_MAX;
 	struct wlr_output_layout_output *l_output;
 	wl_list_for_each(l_output, &layout->outputs, link) {
@@ -368,6 +557,9 @@ struct wlr_box *wlr_output_layout_get_box(
 		} else {
 			return NULL;
 		}
+	} else if (output_layout_update_entries(layout)) {
+		layout->state->_box = layout->state->extents;
+		return &layout->state->_box;
 	} else {
 		// layout extents
 		int min_x = 0, max_x = 0, min_y = 0, max_y = 0;
@@ -7,6 +7,8 @@
 #include "wlr-output-management-unstable-v1-protocol.h"
 
 #define OUTPUT_MANAGER_VERSION 2
+// Maximum number of configuration test results kept around
+#define OUTPUT_TEST_RESULTS_CACHE_SIZE 8
 
 enum {
 	HEAD_STATE_ENABLED = 1 << 0,
@@ -19,6 +21,26 @@ enum {
 static const uint32_t HEAD_STATE_ALL = HEAD_STATE_ENABLED | HEAD_STATE_MODE |
 	HEAD_STATE_POSITION | HEAD_STATE_TRANSFORM | HEAD_STATE_SCALE;
 
+struct output_test_result {
+	struct wl_list link; // wlr_output_manager_v1.test_results
+	struct wlr_output_head_v1_state *heads;
+	size_t heads_len;
+	bool ok;
+};
+
+static void test_result_destroy(struct output_test_result *result) {
+	wl_list_remove(&result->link);
+	free(result->heads);
+	free(result);
+}
+
+static void manager_clear_test_results(struct wlr_output_manager_v1 *manager) {
+	struct output_test_result *result, *tmp;
+	wl_list_for_each_safe(result, tmp, &manager->test_results, link) {
+		test_result_destroy(result);
+	}
+	manager->test_results_len = 0;
+}
 
 // Can return NULL if the head is inert
 static struct wlr_output_head_v1 *head_from_resource(
@@ -48,6 +70,8 @@ static void head_destroy(struct wlr_output_head_v1 *head) {
 		zwlr_output_head_v1_send_finished(resource);
 		wl_resource_destroy(resource);
 	}
+	// Test results may refer to the head's output
+	manager_clear_test_results(head->manager);
 	wl_list_remove(&head->link);
 	wl_list_remove(&head->output_destroy.link);
 	free(head);
@@ -74,6 +98,7 @@ static struct wlr_output_head_v1 *head_create(
 	wl_list_insert(&manager->heads, &head->link);
 	head->output_destroy.notify = head_handle_output_destroy;
 	wl_signal_add(&output->events.destroy, &head->output_destroy);
+	manager_clear_test_results(manager);
 	return head;
 }
 
@@ -595,6 +620,7 @@ static void manager_handle_display_destroy(struct wl_listener *listener,
 	wl_list_for_each_safe(head, tmp, &manager->heads, link) {
 		head_destroy(head);
 	}
+	manager_clear_test_results(manager);
 	wl_global_destroy(manager->global);
 	free(manager);
 }
@@ -609,6 +635,7 @@ struct wlr_output_manager_v1 *wlr_output_manager_v1_create(
 
 	wl_list_init(&manager->resources);
 	wl_list_init(&manager->heads);
+	wl_list_init(&manager->test_results);
 	wl_signal_init(&manager->events.destroy);
 	wl_signal_init(&manager->events.apply);
 	wl_signal_init(&manager->events.test);
@@ -907,3 +934,171 @@ void wlr_output_manager_v1_set_configuration(
 	}
 	manager->current_configuration_dirty = false;
 }
+
+static bool head_state_equal(const struct wlr_output_head_v1_state *a,
+		const struct wlr_output_head_v1_state *b) {
+	if (a->output != b->output || a->enabled != b->enabled) {
+		return false;
+	}
+	if (!a->enabled) {
+		return true;
+	}
+	// Positions don't matter to the backend
+	if (a->mode != b->mode || a->transform != b->transform ||
+			a->scale != b->scale) {
+		return false;
+	}
+	return a->mode != NULL ||
+		(a->custom_mode.width == b->custom_mode.width &&
+		a->custom_mode.height == b->custom_mode.height &&
+		a->custom_mode.refresh == b->custom_mode.refresh);
+}
+
+static bool test_result_matches(const struct output_test_result *result,
+		struct wlr_output_configuration_v1 *config, size_t heads_len) {
+	if (result->heads_len != heads_len) {
+		return false;
+	}
+	struct wlr_output_configuration_head_v1 *config_head;
+	wl_list_for_each(config_head, &config->heads, link) {
+		bool found = false;
+		for (size_t i = 0; i < result->heads_len; i++) {
+			if (result->heads[i].output == config_head->state.output) {
+				found = head_state_equal(&result->heads[i],
+					&config_head->state);
+				break;
+			}
+		}
+		if (!found) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static struct output_test_result *manager_find_test_result(
+		struct wlr_output_manager_v1 *manager,
+		struct wlr_output_configuration_v1 *config, size_t heads_len) {
+	struct output_test_result *result;
+	wl_list_for_each(result, &manager->test_results, link) {
+		if (test_result_matches(result, config, heads_len)) {
+			// Move to the front of the list
+			wl_list_remove(&result->link);
+			wl_list_insert(&manager->test_results, &result->link);
+			return result;
+		}
+	}
+	return NULL;
+}
+
+static void manager_add_test_result(struct wlr_output_manager_v1 *manager,
+		struct wlr_output_configuration_v1 *config, size_t heads_len,
+		bool ok) {
+	struct output_test_result *result = calloc(1, sizeof(*result));
+	if (result == NULL) {
+		return;
+	}
+	result->heads = calloc(heads_len, sizeof(result->heads[0]));
+	if (heads_len > 0 && result->heads == NULL) {
+		free(result);
+		return;
+	}
+	struct wlr_output_configuration_head_v1 *config_head;
+	wl_list_for_each(config_head, &config->heads, link) {
+		result->heads[result->heads_len++] = config_head->state;
+	}
+	result->ok = ok;
+
+	wl_list_insert(&manager->test_results, &result->link);
+	manager->test_results_len++;
+	if (manager->test_results_len > OUTPUT_TEST_RESULTS_CACHE_SIZE) {
+		struct output_test_result *oldest =
+			wl_container_of(manager->test_results.prev, oldest, link);
+		test_result_destroy(oldest);
+		manager->test_results_len--;
+	}
+}
+
+static void config_head_apply_state(
+		struct wlr_output_configuration_head_v1 *config_head) {
+	const struct wlr_output_head_v1_state *state = &config_head->state;
+	struct wlr_output *output = state->output;
+
+	wlr_output_enable(output, state->enabled);
+	if (!state->enabled) {
+		return;
+	}
+
+	if (state->mode != NULL) {
+		wlr_output_set_mode(output, state->mode);
+	} else {
+		wlr_output_set_custom_mode(output, state->custom_mode.width,
+			state->custom_mode.height, state->custom_mode.refresh);
+	}
+	wlr_output_set_transform(output, state->transform);
+	wlr_output_set_scale(output, state->scale);
+}
+
+bool wlr_output_configuration_v1_apply(
+		struct wlr_output_configuration_v1 *config, bool test_only) {
+	size_t outputs_len = wl_list_length(&config->heads);
+	if (outputs_len == 0) {
+		return true;
+	}
+
+	// Only configurations coming from clients are tied to a manager
+	struct wlr_output_manager_v1 *manager = config->manager;
+	struct output_test_result *result = NULL;
+	if (manager != NULL) {
+		result = manager_find_test_result(manager, config, outputs_len);
+		if (result != NULL && (!result->ok || test_only)) {
+			return result->ok;
+		}
+	}
+
+	struct wlr_output **outputs = calloc(outputs_len, sizeof(outputs[0]));
+	if (outputs == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+
+	size_t i = 0;
+	struct wlr_output_configuration_head_v1 *config_head;
+	wl_list_for_each(config_head, &config->heads, link) {
+		config_head_apply_state(config_head);
+		outputs[i++] = config_head->state.output;
+	}
+
+	bool ok;
+	if (test_only) {
+		ok = wlr_output_test_group(outputs, outputs_len);
+		for (i = 0; i < outputs_len; i++) {
+			wlr_output_rollback(outputs[i]);
+		}
+	} else {
+		ok = wlr_output_commit_group(outputs, outputs_len);
+		if (!ok) {
+			for (i = 0; i < outputs_len; i++) {
+				wlr_output_rollback(outputs[i]);
+			}
+		}
+	}
+	free(outputs);
+
+	if (manager == NULL) {
+		return ok;
+	}
+	if (result != NULL) {
+		if (!ok) {
+			// The backend state changed since the configuration was tested
+			test_result_destroy(result);
+			manager->test_results_len--;
+		}
+	} else if (test_only || ok) {
+		// Failed commits may be caused by transient issues, don't
+		// remember them
+		manager_add_test_result(manager, config, outputs_len, ok);
+	}
+
+	return ok;
+}
@@ -0,0 +1,201 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <wlr/backend.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_box.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_mirror.h>
+#include <wlr/util/log.h>
+#include "render/wlr_texture.h"
+#include "util/signal.h"
+
+static bool mirror_blit(struct wlr_output_mirror *mirror,
+		struct wlr_buffer *buffer) {
+	struct wlr_output *src = mirror->src, *dst = mirror->dst;
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(dst->backend);
+	if (renderer == NULL) {
+		return false;
+	}
+
+	struct wlr_texture *texture = wlr_texture_from_buffer(renderer, buffer);
+	if (texture == NULL) {
+		wlr_log(WLR_ERROR, "Failed to import frame of output '%s' "
+			"for mirroring onto '%s'", src->name, dst->name);
+		return false;
+	}
+
+	if (!wlr_output_attach_render(dst, NULL)) {
+		wlr_texture_destroy(texture);
+		return false;
+	}
+
+	// The source buffer has the source transform applied: fit the untransformed
+	// image into the destination, keeping the aspect ratio
+	int src_width = buffer->width, src_height = buffer->height;
+	if (src->transform & WL_OUTPUT_TRANSFORM_90) {
+		src_width = buffer->height;
+		src_height = buffer->width;
+	}
+	int dst_width, dst_height;
+	wlr_output_transformed_resolution(dst, &dst_width, &dst_height);
+
+	double scale_x = (double)dst_width / src_width;
+	double scale_y = (double)dst_height / src_height;
+	double scale = scale_x < scale_y ? scale_x : scale_y;
+	struct wlr_box box = {
+		.width = src_width * scale,
+		.height = src_height * scale,
+	};
+	box.x = (dst_width - box.width) / 2;
+	box.y = (dst_height - box.height) / 2;
+
+	float matrix[9];
+	wlr_matrix_project_box(matrix, &box,
+		wlr_output_transform_invert(src->transform), 0, dst->transform_matrix);
+
+	wlr_renderer_begin(renderer, dst->width, dst->height);
+	wlr_renderer_clear(renderer, (float[]){ 0.0, 0.0, 0.0, 1.0 });
+	wlr_render_texture_with_matrix(renderer, texture, matrix, 1.0);
+	wlr_renderer_end(renderer);
+
+	wlr_texture_destroy(texture);
+
+	return wlr_output_commit(dst);
+}
+
+static bool mirror_scanout(struct wlr_output_mirror *mirror,
+		struct wlr_buffer *buffer) {
+	struct wlr_output *src = mirror->src, *dst = mirror->dst;
+	if (mirror->scanout_failed || src->transform != dst->transform ||
+			buffer->width != dst->width || buffer->height != dst->height) {
+		return false;
+	}
+
+	wlr_output_attach_buffer(dst, buffer);
+	if (!wlr_output_test(dst)) {
+		wlr_output_rollback(dst);
+		wlr_log(WLR_DEBUG, "Output '%s' can't scan out frames of '%s', "
+			"falling back to rendering", dst->name, src->name);
+		mirror->scanout_failed = true;
+		return false;
+	}
+
+	if (!wlr_output_commit(dst)) {
+		wlr_log(WLR_ERROR, "Failed to commit mirrored frame on output '%s'",
+			dst->name);
+	}
+	return true;
+}
+
+static void mirror_present(struct wlr_output_mirror *mirror) {
+	struct wlr_buffer *buffer = mirror->pending;
+	mirror->pending = NULL;
+	if (buffer == NULL) {
+		return;
+	}
+
+	if (mirror->dst->enabled && !mirror_scanout(mirror, buffer) &&
+			!mirror_blit(mirror, buffer)) {
+		wlr_log(WLR_ERROR, "Failed to mirror output '%s' onto '%s'",
+			mirror->src->name, mirror->dst->name);
+	}
+
+	wlr_buffer_unlock(buffer);
+}
+
+static void handle_src_commit(struct wl_listener *listener, void *data) {
+	struct wlr_output_mirror *mirror =
+		wl_container_of(listener, mirror, src_commit);
+	struct wlr_output_event_commit *event = data;
+
+	if (event->committed &
+			(WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_TRANSFORM)) {
+		mirror->scanout_failed = false;
+	}
+	if (event->buffer == NULL) {
+		return;
+	}
+
+	// Only the latest frame matters if the destination is still busy
+	wlr_buffer_unlock(mirror->pending);
+	mirror->pending = wlr_buffer_lock(event->buffer);
+
+	if (!mirror->dst->frame_pending) {
+		mirror_present(mirror);
+	}
+}
+
+static void handle_dst_commit(struct wl_listener *listener, void *data) {
+	struct wlr_output_mirror *mirror =
+		wl_container_of(listener, mirror, dst_commit);
+	struct wlr_output_event_commit *event = data;
+
+	if (event->committed & (WLR_OUTPUT_STATE_MODE |
+			WLR_OUTPUT_STATE_TRANSFORM | WLR_OUTPUT_STATE_ENABLED)) {
+		mirror->scanout_failed = false;
+	}
+}
+
+static void handle_dst_frame(struct wl_listener *listener, void *data) {
+	struct wlr_output_mirror *mirror =
+		wl_container_of(listener, mirror, dst_frame);
+	mirror_present(mirror);
+}
+
+static void handle_src_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_output_mirror *mirror =
+		wl_container_of(listener, mirror, src_destroy);
+	wlr_output_mirror_destroy(mirror);
+}
+
+static void handle_dst_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_output_mirror *mirror =
+		wl_container_of(listener, mirror, dst_destroy);
+	wlr_output_mirror_destroy(mirror);
+}
+
+struct wlr_output_mirror *wlr_output_mirror_create(struct wlr_output *src,
+		struct wlr_output *dst) {
+	assert(src != dst);
+
+	struct wlr_output_mirror *mirror = calloc(1, sizeof(*mirror));
+	if (mirror == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	mirror->src = src;
+	mirror->dst = dst;
+	wl_signal_init(&mirror->events.destroy);
+
+	mirror->src_commit.notify = handle_src_commit;
+	wl_signal_add(&src->events.commit, &mirror->src_commit);
+	mirror->src_destroy.notify = handle_src_destroy;
+	wl_signal_add(&src->events.destroy, &mirror->src_destroy);
+	mirror->dst_commit.notify = handle_dst_commit;
+	wl_signal_add(&dst->events.commit, &mirror->dst_commit);
+	mirror->dst_frame.notify = handle_dst_frame;
+	wl_signal_add(&dst->events.frame, &mirror->dst_frame);
+	mirror->dst_destroy.notify = handle_dst_destroy;
+	wl_signal_add(&dst->events.destroy, &mirror->dst_destroy);
+
+	return mirror;
+}
+
+void wlr_output_mirror_destroy(struct wlr_output_mirror *mirror) {
+	if (mirror == NULL) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&mirror->events.destroy, mirror);
+
+	wl_list_remove(&mirror->src_commit.link);
+	wl_list_remove(&mirror->src_destroy.link);
+	wl_list_remove(&mirror->dst_commit.link);
+	wl_list_remove(&mirror->dst_frame.link);
+	wl_list_remove(&mirror->dst_destroy.link);
+	wlr_buffer_unlock(mirror->pending);
+	free(mirror);
+}
@@ -0,0 +1,304 @@
+#define _POSIX_C_SOURCE 200809L
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wlr/backend.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_stats.h>
+#include <wlr/util/log.h>
+#include "util/signal.h"
+#include "util/time.h"
+
+static int64_t stats_now(struct wlr_output_stats *stats) {
+	clockid_t clock =
+		wlr_backend_get_presentation_clock(stats->output->backend);
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return timespec_to_nsec(&now);
+}
+
+/**
+ * Count the vertical blanks the frame missed between its commit and its
+ * presentation.
+ */
+static unsigned stats_get_missed_vblanks(struct wlr_output_stats *stats,
+		int64_t commit_nsec, const struct wlr_output_event_present *event) {
+	int64_t present_nsec = timespec_to_nsec(event->when);
+
+	if (event->seq != 0 && stats->last_present_seq != 0 &&
+			stats->last_present_nsec != 0) {
+		// The first vertical blank after the commit
+		unsigned expected = stats->last_present_seq + 1;
+		if (commit_nsec > stats->last_present_nsec) {
+			expected += (commit_nsec - stats->last_present_nsec) /
+				event->refresh;
+		}
+		int missed = (int)(event->seq - expected);
+		return missed > 0 ? missed : 0;
+	}
+
+	// Without missed vertical blanks, the frame is presented within one
+	// refresh period
+	if (present_nsec <= commit_nsec) {
+		return 0;
+	}
+	return (present_nsec - commit_nsec) / event->refresh;
+}
+
+static void stats_add_sample(struct wlr_output_stats *stats,
+		int64_t commit_nsec, const struct wlr_output_event_present *event) {
+	int64_t present_nsec = timespec_to_nsec(event->when);
+
+	stats->presented++;
+
+	int64_t latency_usec = (present_nsec - commit_nsec) / 1000;
+	if (latency_usec >= 0) {
+		size_t bucket = latency_usec / WLR_OUTPUT_STATS_BUCKET_USEC;
+		if (bucket >= WLR_OUTPUT_STATS_BUCKETS) {
+			bucket = WLR_OUTPUT_STATS_BUCKETS - 1;
+		}
+		stats->latency_histogram[bucket]++;
+		stats->latency_samples++;
+		if (latency_usec > stats->latency_max_usec) {
+			stats->latency_max_usec =
+				latency_usec > UINT32_MAX ? UINT32_MAX : latency_usec;
+		}
+	}
+
+	if ((event->flags & WLR_OUTPUT_PRESENT_VSYNC) && event->refresh > 0) {
+		unsigned missed = stats_get_missed_vblanks(stats, commit_nsec, event);
+		if (missed > 0) {
+			stats->late++;
+			stats->missed_vblanks += missed;
+		}
+	}
+}
+
+static void handle_output_frame(struct wl_listener *listener, void *data) {
+	struct wlr_output_stats *stats =
+		wl_container_of(listener, stats, output_frame);
+	if (stats->frame_waiting) {
+		stats->idle_frames++;
+	}
+	stats->frame_waiting = true;
+}
+
+static void handle_output_commit(struct wl_listener *listener, void *data) {
+	struct wlr_output_stats *stats =
+		wl_container_of(listener, stats, output_commit);
+	struct wlr_output_event_commit *event = data;
+
+	if (!(event->committed & WLR_OUTPUT_STATE_BUFFER)) {
+		return;
+	}
+	stats->commits++;
+	stats->frame_waiting = false;
+
+	// Reuse the oldest slot if too many frames are in flight
+	size_t slot = 0;
+	for (size_t i = 0; i < WLR_OUTPUT_STATS_INFLIGHT; i++) {
+		if (!stats->inflight[i].used) {
+			slot = i;
+			break;
+		}
+		if (stats->inflight[i].commit_seq -
+				stats->inflight[slot].commit_seq > UINT32_MAX / 2) {
+			slot = i;
+		}
+	}
+	stats->inflight[slot].used = true;
+	stats->inflight[slot].commit_seq = stats->output->commit_seq;
+	stats->inflight[slot].commit_nsec = stats_now(stats);
+}
+
+static void handle_output_present(struct wl_listener *listener, void *data) {
+	struct wlr_output_stats *stats =
+		wl_container_of(listener, stats, output_present);
+	struct wlr_output_event_present *event = data;
+
+	for (size_t i = 0; i < WLR_OUTPUT_STATS_INFLIGHT; i++) {
+		if (!stats->inflight[i].used) {
+			continue;
+		}
+		uint32_t age = event->commit_seq - stats->inflight[i].commit_seq;
+		if (age == 0) {
+			stats->inflight[i].used = false;
+			stats_add_sample(stats, stats->inflight[i].commit_nsec, event);
+		} else if (age < UINT32_MAX / 2) {
+			// Older frames won't be presented anymore
+			stats->inflight[i].used = false;
+			stats->dropped++;
+		}
+	}
+
+	stats->last_present_nsec = timespec_to_nsec(event->when);
+	stats->last_present_seq = event->seq;
+}
+
+static void handle_output_render_stats(struct wl_listener *listener,
+		void *data) {
+	struct wlr_output_stats *stats =
+		wl_container_of(listener, stats, output_render_stats);
+	struct wlr_output_event_render_stats *event = data;
+
+	stats->render_samples++;
+	stats->render_cpu_time_total += event->stats->cpu_time;
+	if (event->stats->cpu_time > stats->render_cpu_time_max) {
+		stats->render_cpu_time_max = event->stats->cpu_time;
+	}
+
+	if (event->stats->gpu_time >= 0) {
+		stats->render_gpu_samples++;
+		stats->render_gpu_time_total += event->stats->gpu_time;
+		if (event->stats->gpu_time > stats->render_gpu_time_max) {
+			stats->render_gpu_time_max = event->stats->gpu_time;
+		}
+	}
+}
+
+static void handle_output_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_output_stats *stats =
+		wl_container_of(listener, stats, output_destroy);
+	wlr_output_stats_destroy(stats);
+}
+
+static void stats_log(struct wlr_output_stats *stats) {
+	double cpu_avg = stats->render_samples == 0 ? 0 :
+		(double)stats->render_cpu_time_total / stats->render_samples / 1e6;
+	double gpu_avg = stats->render_gpu_samples == 0 ? 0 :
+		(double)stats->render_gpu_time_total / stats->render_gpu_samples / 1e6;
+
+	wlr_log(WLR_INFO, "Output %s: %"PRIu64" frames presented, "
+		"%"PRIu64" dropped, %"PRIu64" late (%"PRIu64" missed vblanks), "
+		"%"PRIu64" idle; commit to present p50 %.2f ms, p99 %.2f ms, "
+		"max %.2f ms; render CPU avg %.2f ms max %.2f ms, "
+		"GPU avg %.2f ms max %.2f ms",
+		stats->output->name, stats->presented, stats->dropped, stats->late,
+		stats->missed_vblanks, stats->idle_frames,
+		wlr_output_stats_get_latency_percentile(stats, 50) / 1000.0,
+		wlr_output_stats_get_latency_percentile(stats, 99) / 1000.0,
+		stats->latency_max_usec / 1000.0,
+		cpu_avg, stats->render_cpu_time_max / 1e6,
+		gpu_avg, stats->render_gpu_time_max / 1e6);
+}
+
+static int handle_log_timer(void *data) {
+	struct wlr_output_stats *stats = data;
+	stats_log(stats);
+	wl_event_source_timer_update(stats->log_timer, stats->log_interval);
+	return 0;
+}
+
+struct wlr_output_stats *wlr_output_stats_create(struct wlr_output *output) {
+	struct wlr_output_stats *stats = calloc(1, sizeof(*stats));
+	if (stats == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	stats->output = output;
+	wl_signal_init(&stats->events.destroy);
+
+	stats->output_frame.notify = handle_output_frame;
+	wl_signal_add(&output->events.frame, &stats->output_frame);
+	stats->output_commit.notify = handle_output_commit;
+	wl_signal_add(&output->events.commit, &stats->output_commit);
+	stats->output_present.notify = handle_output_present;
+	wl_signal_add(&output->events.present, &stats->output_present);
+	// Render statistics are only collected while someone listens
+	stats->output_render_stats.notify = handle_output_render_stats;
+	wl_signal_add(&output->events.render_stats, &stats->output_render_stats);
+	stats->output_destroy.notify = handle_output_destroy;
+	wl_signal_add(&output->events.destroy, &stats->output_destroy);
+
+	return stats;
+}
+
+void wlr_output_stats_destroy(struct wlr_output_stats *stats) {
+	if (stats == NULL) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&stats->events.destroy, stats);
+
+	if (stats->log_timer != NULL) {
+		wl_event_source_remove(stats->log_timer);
+	}
+	wl_list_remove(&stats->output_frame.link);
+	wl_list_remove(&stats->output_commit.link);
+	wl_list_remove(&stats->output_present.link);
+	wl_list_remove(&stats->output_render_stats.link);
+	wl_list_remove(&stats->output_destroy.link);
+	free(stats);
+}
+
+uint32_t wlr_output_stats_get_latency_percentile(
+		struct wlr_output_stats *stats, unsigned percent) {
+	if (stats->latency_samples == 0) {
+		return 0;
+	}
+	if (percent > 100) {
+		percent = 100;
+	}
+
+	// Smallest bucket such that at least `percent` of the samples are below
+	uint64_t rank = (stats->latency_samples * percent + 99) / 100;
+	if (rank == 0) {
+		rank = 1;
+	}
+	uint64_t count = 0;
+	for (size_t i = 0; i < WLR_OUTPUT_STATS_BUCKETS - 1; i++) {
+		count += stats->latency_histogram[i];
+		if (count >= rank) {
+			uint32_t upper = (i + 1) * WLR_OUTPUT_STATS_BUCKET_USEC;
+			return upper < stats->latency_max_usec ?
+				upper : stats->latency_max_usec;
+		}
+	}
+	return stats->latency_max_usec;
+}
+
+void wlr_output_stats_set_log_interval(struct wlr_output_stats *stats,
+		int interval_msec) {
+	stats->log_interval = interval_msec > 0 ? interval_msec : 0;
+
+	if (stats->log_interval == 0) {
+		if (stats->log_timer != NULL) {
+			wl_event_source_remove(stats->log_timer);
+			stats->log_timer = NULL;
+		}
+		return;
+	}
+
+	if (stats->log_timer == NULL) {
+		struct wl_event_loop *loop =
+			wl_display_get_event_loop(stats->output->display);
+		stats->log_timer =
+			wl_event_loop_add_timer(loop, handle_log_timer, stats);
+		if (stats->log_timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create output statistics timer");
+			stats->log_interval = 0;
+			return;
+		}
+	}
+	wl_event_source_timer_update(stats->log_timer, stats->log_interval);
+}
+
+void wlr_output_stats_reset(struct wlr_output_stats *stats) {
+	stats->commits = 0;
+	stats->presented = 0;
+	stats->dropped = 0;
+	stats->late = 0;
+	stats->missed_vblanks = 0;
+	stats->idle_frames = 0;
+	memset(stats->latency_histogram, 0, sizeof(stats->latency_histogram));
+	stats->latency_samples = 0;
+	stats->latency_max_usec = 0;
+	stats->render_samples = 0;
+	stats->render_cpu_time_total = 0;
+	stats->render_cpu_time_max = 0;
+	stats->render_gpu_samples = 0;
+	stats->render_gpu_time_total = 0;
+	stats->render_gpu_time_max = 0;
+}
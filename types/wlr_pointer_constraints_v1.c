@@ -8,6 +8,7 @@
 #include <wlr/types/wlr_pointer_constraints_v1.h>
 #include <wlr/types/wlr_region.h>
 #include <wlr/util/log.h>
+#include <wlr/util/region.h>
 #include "util/signal.h"
 
 static const struct zwp_locked_pointer_v1_interface locked_pointer_impl;
@@ -56,6 +57,7 @@ static void pointer_constraint_destroy(struct wlr_pointer_constraint_v1 *constra
 	pixman_region32_fini(&constraint->current.region);
 	pixman_region32_fini(&constraint->pending.region);
 	pixman_region32_fini(&constraint->region);
+	wlr_region_lookup_finish(&constraint->region_lookup);
 	free(constraint);
 }
 
@@ -128,6 +130,12 @@ static void pointer_constraint_commit(
 			&constraint->surface->input_region);
 	}
 
+	wlr_region_lookup_finish(&constraint->region_lookup);
+	if (!wlr_region_lookup_init(&constraint->region_lookup,
+			&constraint->region)) {
+		wlr_log(WLR_ERROR, "Failed to index pointer constraint region");
+	}
+
 	if (updated_region) {
 		wlr_signal_emit_safe(&constraint->events.set_region, NULL);
 	}
@@ -362,3 +370,16 @@ void wlr_pointer_constraint_v1_send_deactivated(
 		pointer_constraint_destroy(constraint);
 	}
 }
+
+bool wlr_pointer_constraint_v1_confine(
+		struct wlr_pointer_constraint_v1 *constraint, double sx1, double sy1,
+		double sx2, double sy2, double *sx_out, double *sy_out) {
+	if (constraint->region_lookup.nrects == 0 &&
+			pixman_region32_not_empty(&constraint->region)) {
+		// The index couldn't be allocated
+		return wlr_region_confine(&constraint->region, sx1, sy1, sx2, sy2,
+			sx_out, sy_out);
+	}
+	return wlr_region_lookup_confine(&constraint->region_lookup,
+		sx1, sy1, sx2, sy2, sx_out, sy_out);
+}
@@ -6,10 +6,97 @@
 #include <wlr/types/wlr_surface.h>
 #include <wlr/backend.h>
 #include "presentation-time-protocol.h"
+#include "util/object_pool.h"
 #include "util/signal.h"
 
 #define PRESENTATION_VERSION 1
 
+/**
+ * Per-surface state, attached to the surface as an addon so that a surface's
+ * feedbacks can be found without going through all of them.
+ */
+struct presentation_surface {
+	struct wlr_addon addon; // wlr_surface.addons
+	struct wl_list link; // wlr_presentation.surfaces
+
+	// Feedback for the pending surface state, if any
+	struct wlr_presentation_feedback *pending;
+	// Feedback for the current surface state, if not sampled yet
+	struct wlr_presentation_feedback *committed;
+};
+
+static void presentation_surface_destroy(struct presentation_surface *ps) {
+	wlr_addon_finish(&ps->addon);
+	wl_list_remove(&ps->link);
+	free(ps);
+}
+
+static void surface_addon_destroy(struct wlr_addon *addon) {
+	struct presentation_surface *ps = wl_container_of(addon, ps, addon);
+	presentation_surface_destroy(ps);
+}
+
+static const struct wlr_addon_interface surface_addon_impl = {
+	.name = "wlr_presentation_surface",
+	.destroy = surface_addon_destroy,
+};
+
+static struct presentation_surface *presentation_surface_get(
+		struct wlr_presentation *presentation, struct wlr_surface *surface,
+		bool create) {
+	struct wlr_addon *addon = wlr_addon_find(&surface->addons, presentation,
+		&surface_addon_impl);
+	if (addon != NULL) {
+		struct presentation_surface *ps = wl_container_of(addon, ps, addon);
+		return ps;
+	}
+	if (!create) {
+		return NULL;
+	}
+
+	struct presentation_surface *ps = calloc(1, sizeof(*ps));
+	if (ps == NULL) {
+		return NULL;
+	}
+	wlr_addon_init(&ps->addon, &surface->addons, presentation,
+		&surface_addon_impl);
+	wl_list_insert(&presentation->surfaces, &ps->link);
+	return ps;
+}
+
+/**
+ * Forget about the feedback in the per-surface state.
+ */
+static void feedback_detach(struct wlr_presentation_feedback *feedback) {
+	if (feedback->presentation == NULL || feedback->surface == NULL) {
+		return;
+	}
+	struct presentation_surface *ps = presentation_surface_get(
+		feedback->presentation, feedback->surface, false);
+	if (ps == NULL) {
+		return;
+	}
+	if (ps->pending == feedback) {
+		ps->pending = NULL;
+	}
+	if (ps->committed == feedback) {
+		ps->committed = NULL;
+	}
+}
+
+// Clients usually request a feedback for each commit
+static struct object_pool feedback_pool = OBJECT_POOL_INIT(
+	"wlr_presentation_feedback", struct wlr_presentation_feedback, 32);
+
+static struct wlr_presentation_feedback *feedback_alloc(
+		struct wl_display *display) {
+	return object_pool_alloc(&feedback_pool, display);
+}
+
+static void feedback_free(struct wlr_presentation_feedback *feedback) {
+	object_pool_free(&feedback_pool, feedback);
+}
+
 static void feedback_handle_resource_destroy(struct wl_resource *resource) {
 	wl_list_remove(wl_resource_get_link(resource));
 }
@@ -55,6 +142,15 @@ static void feedback_handle_surface_commit(struct wl_listener *listener,
 		}
 	} else {
 		feedback->committed = true;
+
+		struct presentation_surface *ps = presentation_surface_get(
+			feedback->presentation, feedback->surface, false);
+		if (ps != NULL) {
+			if (ps->pending == feedback) {
+				ps->pending = NULL;
+			}
+			ps->committed = feedback;
+		}
 	}
 }
 
@@ -63,6 +159,7 @@ static void feedback_unset_surface(struct wlr_presentation_feedback *feedback) {
 		return;
 	}
 
+	feedback_detach(feedback);
 	feedback->surface = NULL;
 	wl_list_remove(&feedback->surface_commit.link);
 	wl_list_remove(&feedback->surface_destroy.link);
@@ -96,21 +193,22 @@ static void presentation_handle_feedback(struct wl_client *client,
 		presentation_from_resource(presentation_resource);
 	struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
 
-	bool found = false;
-	struct wlr_presentation_feedback *feedback;
-	wl_list_for_each(feedback, &presentation->feedbacks, link) {
-		if (feedback->surface == surface && !feedback->committed) {
-			found = true;
-			break;
-		}
+	struct presentation_surface *ps =
+		presentation_surface_get(presentation, surface, true);
+	if (ps == NULL) {
+		wl_client_post_no_memory(client);
+		return;
 	}
-	if (!found) {
-		feedback = calloc(1, sizeof(struct wlr_presentation_feedback));
+
+	struct wlr_presentation_feedback *feedback = ps->pending;
+	if (feedback == NULL) {
+		feedback = feedback_alloc(wl_client_get_display(client));
 		if (feedback == NULL) {
 			wl_client_post_no_memory(client);
 			return;
 		}
 
+		feedback->presentation = presentation;
 		feedback->surface = surface;
 		wl_list_init(&feedback->resources);
 
@@ -121,6 +219,7 @@ static void presentation_handle_feedback(struct wl_client *client,
 		wl_signal_add(&surface->events.destroy, &feedback->surface_destroy);
 
 		wl_list_insert(&presentation->feedbacks, &feedback->link);
+		ps->pending = feedback;
 	}
 
 	uint32_t version = wl_resource_get_version(presentation_resource);
@@ -168,6 +267,21 @@ static void handle_display_destroy(struct wl_listener *listener, void *data) {
 	wlr_signal_emit_safe(&presentation->events.destroy, presentation);
 	wl_list_remove(&presentation->display_destroy.link);
 	wl_global_destroy(presentation->global);
+
+	struct presentation_surface *ps, *ps_tmp;
+	wl_list_for_each_safe(ps, ps_tmp, &presentation->surfaces, link) {
+		presentation_surface_destroy(ps);
+	}
+
+	// Feedbacks still alive outlive us
+	struct wlr_presentation_feedback *feedback, *feedback_tmp;
+	wl_list_for_each_safe(feedback, feedback_tmp,
+			&presentation->feedbacks, link) {
+		feedback->presentation = NULL;
+		wl_list_remove(&feedback->link);
+		wl_list_init(&feedback->link);
+	}
+
 	free(presentation);
 }
 
@@ -189,6 +303,7 @@ struct wlr_presentation *wlr_presentation_create(struct wl_display *display,
 	presentation->clock = wlr_backend_get_presentation_clock(backend);
 
 	wl_list_init(&presentation->feedbacks);
+	wl_list_init(&presentation->surfaces);
 	wl_signal_init(&presentation->events.destroy);
 
 	presentation->display_destroy.notify = handle_display_destroy;
@@ -210,17 +325,16 @@ void wlr_presentation_feedback_send_presented(
 
 struct wlr_presentation_feedback *wlr_presentation_surface_sampled(
 		struct wlr_presentation *presentation, struct wlr_surface *surface) {
-	// TODO: maybe use a hashtable to optimize this function
-	struct wlr_presentation_feedback *feedback, *feedback_tmp;
-	wl_list_for_each_safe(feedback, feedback_tmp,
-			&presentation->feedbacks, link) {
-		if (feedback->surface == surface && feedback->committed &&
-				!feedback->sampled) {
-			feedback->sampled = true;
-			return feedback;
-		}
+	struct presentation_surface *ps =
+		presentation_surface_get(presentation, surface, false);
+	if (ps == NULL || ps->committed == NULL) {
+		return NULL;
 	}
-	return NULL;
+
+	struct wlr_presentation_feedback *feedback = ps->committed;
+	ps->committed = NULL;
+	feedback->sampled = true;
+	return feedback;
 }
 
 static void feedback_unset_output(struct wlr_presentation_feedback *feedback);
@@ -242,7 +356,7 @@ void wlr_presentation_feedback_destroy(
 	feedback_unset_surface(feedback);
 	feedback_unset_output(feedback);
 	wl_list_remove(&feedback->link);
-	free(feedback);
+	feedback_free(feedback);
 }
 
 void wlr_presentation_event_from_output(struct wlr_presentation_event *event,
@@ -5,6 +5,11 @@
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_region.h>
 #include "types/wlr_region.h"
+#include "util/object_pool.h"
+
+// Clients create a region for most opaque and input region updates
+static struct object_pool region_pool =
+	OBJECT_POOL_INIT("wl_region", pixman_region32_t, 64);
 
 static void region_add(struct wl_client *client, struct wl_resource *resource,
 		int32_t x, int32_t y, int32_t width, int32_t height) {
@@ -36,12 +41,13 @@ static const struct wl_region_interface region_impl = {
 static void region_handle_resource_destroy(struct wl_resource *resource) {
 	pixman_region32_t *reg = wlr_region_from_resource(resource);
 	pixman_region32_fini(reg);
-	free(reg);
+	object_pool_free(&region_pool, reg);
 }
 
 struct wl_resource *region_create(struct wl_client *client,
 		uint32_t version, uint32_t id) {
-	pixman_region32_t *region = calloc(1, sizeof(pixman_region32_t));
+	pixman_region32_t *region = object_pool_alloc(&region_pool,
+		wl_client_get_display(client));
 	if (region == NULL) {
 		wl_client_post_no_memory(client);
 		return NULL;
@@ -52,7 +58,8 @@ struct wl_resource *region_create(struct wl_client *client,
 	struct wl_resource *region_resource = wl_resource_create(client,
 		&wl_region_interface, version, id);
 	if (region_resource == NULL) {
-		free(region);
+		pixman_region32_fini(region);
+		object_pool_free(&region_pool, region);
 		wl_client_post_no_memory(client);
 		return NULL;
 	}
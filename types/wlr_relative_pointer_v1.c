@@ -118,6 +118,7 @@ static void relative_pointer_manager_v1_handle_get_relative_pointer(struct wl_cl
 
 	relative_pointer->resource = relative_pointer_resource;
 	relative_pointer->seat = seat_client->seat;
+	relative_pointer->seat_client = seat_client;
 	relative_pointer->pointer_resource = pointer;
 
 	wl_signal_init(&relative_pointer->events.destroy);
@@ -226,11 +227,12 @@ void wlr_relative_pointer_manager_v1_send_relative_motion(
 		return;
 	}
 
+	// This runs for every motion event (up to several kHz with gaming mice),
+	// so match on the cached seat client rather than going through the
+	// wl_pointer resource
 	struct wlr_relative_pointer_v1 *pointer;
 	wl_list_for_each(pointer, &manager->relative_pointers, link) {
-		struct wlr_seat_client *seat_client =
-			wlr_seat_client_from_pointer_resource(pointer->pointer_resource);
-		if (seat != pointer->seat || focused != seat_client) {
+		if (pointer->seat_client != focused) {
 			continue;
 		}
 
@@ -238,5 +240,7 @@ void wlr_relative_pointer_manager_v1_send_relative_motion(
 			(uint32_t)(time_usec >> 32), (uint32_t)time_usec,
 			wl_fixed_from_double(dx), wl_fixed_from_double(dy),
 			wl_fixed_from_double(dx_unaccel), wl_fixed_from_double(dy_unaccel));
+		// Relative motion is grouped by wl_pointer.frame too
+		focused->needs_pointer_frame = true;
 	}
 }
@@ -1,19 +1,28 @@
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <drm_fourcc.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
 #include <wlr/types/wlr_screencopy_v1.h>
+#include <wlr/types/wlr_surface.h>
 #include <wlr/backend.h>
 #include <wlr/util/log.h>
 #include "wlr-screencopy-unstable-v1-protocol.h"
 #include "render/pixel_format.h"
+#include "render/wlr_texture.h"
 #include "util/signal.h"
 
 #define SCREENCOPY_MANAGER_VERSION 3
 
+// Maximum number of client buffers whose contents are tracked per output
+#define SCREENCOPY_MAX_BUFFERS 4
+// Above this number of rectangles, the damage extents are copied instead
+#define SCREENCOPY_MAX_RECTS 16
+
 struct screencopy_damage {
 	struct wl_list link;
 	struct wlr_output *output;
@@ -21,6 +30,19 @@ struct screencopy_damage {
 	struct wl_listener output_precommit;
 	struct wl_listener output_destroy;
 	uint32_t last_commit_seq;
+	struct wl_list buffers; // screencopy_buffer.link, most recent first
+};
+
+/**
+ * A client buffer which has received a copy_with_damage frame. Only the
+ * pixels damaged since then need to be copied into it again.
+ */
+struct screencopy_buffer {
+	struct wl_list link;
+	struct wl_resource *resource;
+	struct wlr_box box; // captured region the contents correspond to
+	struct pixman_region32 damage; // since the contents were last copied
+	struct wl_listener resource_destroy;
 };
 
 static const struct zwlr_screencopy_frame_v1_interface frame_impl;
@@ -39,8 +61,138 @@ static struct screencopy_damage *screencopy_damage_find(
 	return NULL;
 }
 
+static void screencopy_buffer_destroy(struct screencopy_buffer *buffer) {
+	wl_list_remove(&buffer->link);
+	wl_list_remove(&buffer->resource_destroy.link);
+	pixman_region32_fini(&buffer->damage);
+	free(buffer);
+}
+
+static void screencopy_buffer_handle_resource_destroy(
+		struct wl_listener *listener, void *data) {
+	struct screencopy_buffer *buffer =
+		wl_container_of(listener, buffer, resource_destroy);
+	screencopy_buffer_destroy(buffer);
+}
+
+static struct screencopy_buffer *screencopy_buffer_find(
+		struct screencopy_damage *damage, struct wl_resource *resource) {
+	struct screencopy_buffer *buffer;
+	wl_list_for_each(buffer, &damage->buffers, link) {
+		if (buffer->resource == resource) {
+			return buffer;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Get the region of the frame's buffer which needs to be copied, in output
+ * buffer coordinates. Everything needs to be copied unless the buffer already
+ * received the same region before, with copy_with_damage.
+ */
+static void frame_get_copy_region(struct wlr_screencopy_frame_v1 *frame,
+		struct pixman_region32 *region) {
+	struct wlr_box *box = &frame->box;
+	pixman_region32_init_rect(region, box->x, box->y, box->width, box->height);
+
+	if (!frame->with_damage) {
+		return;
+	}
+	struct screencopy_damage *damage =
+		screencopy_damage_find(frame->client, frame->output);
+	if (damage == NULL) {
+		return;
+	}
+	struct screencopy_buffer *buffer =
+		screencopy_buffer_find(damage, frame->buffer);
+	if (buffer == NULL || buffer->box.x != box->x || buffer->box.y != box->y ||
+			buffer->box.width != box->width ||
+			buffer->box.height != box->height) {
+		return;
+	}
+
+	pixman_region32_intersect(region, region, &buffer->damage);
+	int n_rects;
+	pixman_region32_rectangles(region, &n_rects);
+	if (n_rects > SCREENCOPY_MAX_RECTS) {
+		pixman_box32_t extents = *pixman_region32_extents(region);
+		pixman_region32_fini(region);
+		pixman_region32_init_rect(region, extents.x1, extents.y1,
+			extents.x2 - extents.x1, extents.y2 - extents.y1);
+	}
+}
+
+/**
+ * Record that the frame's buffer now holds the current contents of the
+ * captured region. Must be called when the frame is copied, before the next
+ * output commit.
+ */
+static void frame_update_buffer(struct wlr_screencopy_frame_v1 *frame) {
+	if (!frame->with_damage) {
+		return;
+	}
+	struct screencopy_damage *damage =
+		screencopy_damage_find(frame->client, frame->output);
+	if (damage == NULL) {
+		return;
+	}
+
+	struct screencopy_buffer *buffer =
+		screencopy_buffer_find(damage, frame->buffer);
+	if (buffer == NULL) {
+		if (wl_list_length(&damage->buffers) >= SCREENCOPY_MAX_BUFFERS) {
+			struct screencopy_buffer *oldest =
+				wl_container_of(damage->buffers.prev, oldest, link);
+			screencopy_buffer_destroy(oldest);
+		}
+
+		buffer = calloc(1, sizeof(*buffer));
+		if (buffer == NULL) {
+			return;
+		}
+		buffer->resource = frame->buffer;
+		pixman_region32_init(&buffer->damage);
+		buffer->resource_destroy.notify =
+			screencopy_buffer_handle_resource_destroy;
+		wl_resource_add_destroy_listener(frame->buffer,
+			&buffer->resource_destroy);
+	} else {
+		wl_list_remove(&buffer->link);
+		pixman_region32_clear(&buffer->damage);
+	}
+	wl_list_insert(&damage->buffers, &buffer->link);
+	buffer->box = frame->box;
+}
+
+/**
+ * Forget about the contents of the frame's buffer, e.g. because the copy
+ * failed.
+ */
+static void frame_invalidate_buffer(struct wlr_screencopy_frame_v1 *frame) {
+	struct screencopy_damage *damage =
+		screencopy_damage_find(frame->client, frame->output);
+	if (damage == NULL) {
+		return;
+	}
+	struct screencopy_buffer *buffer =
+		screencopy_buffer_find(damage, frame->buffer);
+	if (buffer != NULL) {
+		screencopy_buffer_destroy(buffer);
+	}
+}
+
+static void screencopy_damage_add(struct screencopy_damage *damage,
+		struct pixman_region32 *region) {
+	pixman_region32_union(&damage->damage, &damage->damage, region);
+
+	struct screencopy_buffer *buffer;
+	wl_list_for_each(buffer, &damage->buffers, link) {
+		pixman_region32_union(&buffer->damage, &buffer->damage, region);
+	}
+}
+
 static void screencopy_damage_accumulate(struct screencopy_damage *damage) {
-	struct pixman_region32 *region = &damage->damage;
 	struct wlr_output *output = damage->output;
 
 	/* This check is done so damage that has been added and cleared in the
@@ -52,14 +204,20 @@ static void screencopy_damage_accumulate(struct screencopy_damage *damage) {
 
 	if (output->pending.committed & WLR_OUTPUT_STATE_DAMAGE) {
 		// If the compositor submitted damage, copy it over
-		pixman_region32_union(region, region, &output->pending.damage);
-		pixman_region32_intersect_rect(region, region, 0, 0,
+		struct pixman_region32 region;
+		pixman_region32_init(&region);
+		pixman_region32_intersect_rect(&region, &output->pending.damage, 0, 0,
 			output->width, output->height);
+		screencopy_damage_add(damage, &region);
+		pixman_region32_fini(&region);
 	} else if (output->pending.committed & WLR_OUTPUT_STATE_BUFFER) {
 		// If the compositor did not submit damage but did submit a buffer
 		// damage everything
-		pixman_region32_union_rect(region, region, 0, 0,
+		struct pixman_region32 region;
+		pixman_region32_init_rect(&region, 0, 0,
 			output->width, output->height);
+		screencopy_damage_add(damage, &region);
+		pixman_region32_fini(&region);
 	}
 
 	damage->last_commit_seq = output->commit_seq;
@@ -73,6 +231,10 @@ static void screencopy_damage_handle_output_precommit(
 }
 
 static void screencopy_damage_destroy(struct screencopy_damage *damage) {
+	struct screencopy_buffer *buffer, *tmp;
+	wl_list_for_each_safe(buffer, tmp, &damage->buffers, link) {
+		screencopy_buffer_destroy(buffer);
+	}
 	wl_list_remove(&damage->output_destroy.link);
 	wl_list_remove(&damage->output_precommit.link);
 	wl_list_remove(&damage->link);
@@ -100,6 +262,7 @@ static struct screencopy_damage *screencopy_damage_create(
 	damage->last_commit_seq = output->commit_seq - 1;
 	pixman_region32_init_rect(&damage->damage, 0, 0, output->width,
 		output->height);
+	wl_list_init(&damage->buffers);
 	wl_list_insert(&client->damages, &damage->link);
 
 	wl_signal_add(&output->events.precommit, &damage->output_precommit);
@@ -134,6 +297,46 @@ static void client_unref(struct wlr_screencopy_v1_client *client) {
 	free(client);
 }
 
+/**
+ * A read-back of the output for a commit, shared by all shm frames of the
+ * same format which are copied on that commit. The union of their regions is
+ * read once into a staging buffer, then each frame copies its own region out
+ * of it.
+ */
+struct screencopy_readback {
+	int ref;
+	struct wl_list link; // wlr_screencopy_manager_v1.readbacks
+
+	struct wlr_output *output;
+	uint32_t commit_seq;
+	uint32_t drm_format;
+
+	struct pixman_region32 region; // in output buffer coordinates
+	struct wlr_box box; // extents of the region
+	void *data;
+	int32_t stride;
+
+	// Pending asynchronous read-back, NULL once the data is available
+	struct wlr_read_pixels_request *request;
+	bool ok;
+	uint32_t flags; // enum wlr_renderer_read_pixels_flags
+};
+
+static void readback_unref(struct screencopy_readback *readback) {
+	if (readback == NULL) {
+		return;
+	}
+	assert(readback->ref > 0);
+	if (--readback->ref > 0) {
+		return;
+	}
+	wl_list_remove(&readback->link);
+	wlr_read_pixels_request_destroy(readback->request);
+	pixman_region32_fini(&readback->region);
+	free(readback->data);
+	free(readback);
+}
+
 static struct wlr_screencopy_frame_v1 *frame_from_resource(
 		struct wl_resource *resource) {
 	assert(wl_resource_instance_of(resource,
@@ -151,13 +354,22 @@ static void frame_destroy(struct wlr_screencopy_frame_v1 *frame) {
 		if (frame->cursor_locked) {
 			wlr_output_lock_software_cursors(frame->output, false);
 		}
+		if (frame->cursor_damage_locked) {
+			wlr_output_lock_hardware_cursor_damage(frame->output, false);
+		}
 	}
 	wl_list_remove(&frame->link);
 	wl_list_remove(&frame->output_precommit.link);
 	wl_list_remove(&frame->output_commit.link);
 	wl_list_remove(&frame->output_destroy.link);
 	wl_list_remove(&frame->output_enable.link);
+	wl_list_remove(&frame->output_capture.link);
 	wl_list_remove(&frame->buffer_destroy.link);
+	if (frame->read_timer != NULL) {
+		wl_event_source_remove(frame->read_timer);
+	}
+	readback_unref(frame->readback);
+	pixman_region32_fini(&frame->read_region);
 	// Make the frame resource inert
 	wl_resource_set_user_data(frame->resource, NULL);
 	client_unref(frame->client);
@@ -199,79 +411,466 @@ static void frame_send_ready(struct wlr_screencopy_frame_v1 *frame,
 		tv_sec_hi, tv_sec_lo, when->tv_nsec);
 }
 
-static void frame_handle_output_precommit(struct wl_listener *listener,
-		void *_data) {
-	struct wlr_screencopy_frame_v1 *frame =
-		wl_container_of(listener, frame, output_precommit);
-	struct wlr_output_event_precommit *event = _data;
-	struct wlr_output *output = frame->output;
-	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
-	assert(renderer);
+// Interval at which pending read-backs are polled, in milliseconds
+#define READ_POLL_INTERVAL 1
 
-	if (!(output->pending.committed & WLR_OUTPUT_STATE_BUFFER)) {
+static bool readback_is_ready(struct screencopy_readback *readback) {
+	return readback->request == NULL ||
+		wlr_read_pixels_request_is_ready(readback->request);
+}
+
+/**
+ * Make the pixels available in the staging buffer, blocking if the GPU isn't
+ * done with the transfer yet.
+ */
+static void readback_finish(struct screencopy_readback *readback) {
+	if (readback->request == NULL) {
 		return;
 	}
+	readback->ok = wlr_read_pixels_request_finish(readback->request,
+		&readback->flags, readback->stride, 0, 0, readback->data);
+	wlr_read_pixels_request_destroy(readback->request);
+	readback->request = NULL;
+}
 
-	struct wl_shm_buffer *shm_buffer = frame->shm_buffer;
-	if (shm_buffer == NULL) {
-		return;
+static struct screencopy_readback *readback_create(
+		struct wlr_screencopy_manager_v1 *manager, struct wlr_output *output,
+		struct wlr_renderer *renderer, uint32_t drm_format,
+		struct pixman_region32 *region) {
+	const struct wlr_pixel_format_info *info =
+		drm_get_pixel_format_info(drm_format);
+	if (info == NULL) {
+		return NULL;
+	}
+
+	struct screencopy_readback *readback = calloc(1, sizeof(*readback));
+	if (readback == NULL) {
+		return NULL;
+	}
+	readback->ref = 1;
+	readback->output = output;
+	readback->commit_seq = output->commit_seq;
+	readback->drm_format = drm_format;
+	pixman_region32_init(&readback->region);
+	pixman_region32_copy(&readback->region, region);
+
+	pixman_box32_t *extents = pixman_region32_extents(region);
+	readback->box = (struct wlr_box){
+		.x = extents->x1,
+		.y = extents->y1,
+		.width = extents->x2 - extents->x1,
+		.height = extents->y2 - extents->y1,
+	};
+	readback->stride = readback->box.width * (info->bpp / 8);
+	readback->data = malloc((size_t)readback->stride * readback->box.height);
+	if (readback->data == NULL) {
+		pixman_region32_fini(&readback->region);
+		free(readback);
+		return NULL;
+	}
+	wl_list_insert(&manager->readbacks, &readback->link);
+
+	struct wlr_box *box = &readback->box;
+	readback->request = wlr_renderer_read_pixels_async(renderer, drm_format,
+		box->width, box->height, box->x, box->y);
+	if (readback->request != NULL) {
+		return readback;
 	}
 
+	// Only read the damaged parts if the GPU has to be waited for anyway
+	readback->ok = true;
+	int n_rects;
+	pixman_box32_t *rects = pixman_region32_rectangles(region, &n_rects);
+	for (int i = 0; i < n_rects && readback->ok; i++) {
+		pixman_box32_t *rect = &rects[i];
+		readback->ok = wlr_renderer_read_pixels(renderer, drm_format,
+			&readback->flags, readback->stride, rect->x2 - rect->x1,
+			rect->y2 - rect->y1, rect->x1, rect->y1, rect->x1 - box->x,
+			rect->y1 - box->y, readback->data);
+	}
+	return readback;
+}
+
+/**
+ * Check whether the shm frame is copied on the output commit about to happen.
+ * The damage of the commit is accumulated beforehand.
+ */
+static bool frame_is_due(struct wlr_screencopy_frame_v1 *frame) {
+	if (frame->shm_buffer == NULL) {
+		return false;
+	}
 	if (frame->with_damage) {
 		struct screencopy_damage *damage =
-			screencopy_damage_get_or_create(frame->client, output);
+			screencopy_damage_get_or_create(frame->client, frame->output);
 		if (damage) {
 			screencopy_damage_accumulate(damage);
 			if (!pixman_region32_not_empty(&damage->damage)) {
-				return;
+				return false;
 			}
 		}
 	}
+	return true;
+}
 
-	wl_list_remove(&frame->output_precommit.link);
-	wl_list_init(&frame->output_precommit.link);
+static uint32_t frame_get_drm_format(struct wlr_screencopy_frame_v1 *frame) {
+	return convert_wl_shm_format_to_drm(
+		wl_shm_buffer_get_format(frame->shm_buffer));
+}
+
+/**
+ * Get the read-back of the current commit for the frame. The first frame
+ * copied on a commit reads the union of the regions of all frames of the same
+ * output and format waiting for that commit, the other ones re-use it.
+ */
+static struct screencopy_readback *frame_get_readback(
+		struct wlr_screencopy_frame_v1 *frame, struct wlr_renderer *renderer,
+		struct pixman_region32 *region) {
+	struct wlr_screencopy_manager_v1 *manager = frame->client->manager;
+	struct wlr_output *output = frame->output;
+	uint32_t drm_format = frame_get_drm_format(frame);
+
+	struct screencopy_readback *readback;
+	wl_list_for_each(readback, &manager->readbacks, link) {
+		if (readback->output != output ||
+				readback->commit_seq != output->commit_seq ||
+				readback->drm_format != drm_format) {
+			continue;
+		}
+
+		struct pixman_region32 missing;
+		pixman_region32_init(&missing);
+		pixman_region32_subtract(&missing, region, &readback->region);
+		bool covered = !pixman_region32_not_empty(&missing);
+		pixman_region32_fini(&missing);
+		if (covered) {
+			readback->ref++;
+			return readback;
+		}
+	}
 
-	int x = frame->box.x;
-	int y = frame->box.y;
+	struct pixman_region32 read_region;
+	pixman_region32_init(&read_region);
+	pixman_region32_copy(&read_region, region);
+
+	struct wlr_screencopy_frame_v1 *other;
+	wl_list_for_each(other, &manager->frames, link) {
+		// Frames already handled for this commit aren't listening anymore
+		if (other == frame || other->output != output ||
+				wl_list_empty(&other->output_precommit.link) ||
+				!frame_is_due(other) ||
+				frame_get_drm_format(other) != drm_format) {
+			continue;
+		}
+		struct pixman_region32 other_region;
+		frame_get_copy_region(other, &other_region);
+		pixman_region32_union(&read_region, &read_region, &other_region);
+		pixman_region32_fini(&other_region);
+	}
 
-	enum wl_shm_format wl_shm_format = wl_shm_buffer_get_format(shm_buffer);
-	uint32_t drm_format = convert_wl_shm_format_to_drm(wl_shm_format);
-	int32_t width = wl_shm_buffer_get_width(shm_buffer);
-	int32_t height = wl_shm_buffer_get_height(shm_buffer);
+	readback = readback_create(manager, output, renderer, drm_format,
+		&read_region);
+	pixman_region32_fini(&read_region);
+	return readback;
+}
+
+static bool frame_copy_readback(struct wlr_screencopy_frame_v1 *frame,
+		uint32_t *flags) {
+	struct screencopy_readback *readback = frame->readback;
+	readback_finish(readback);
+	if (!readback->ok) {
+		return false;
+	}
+
+	const struct wlr_pixel_format_info *info =
+		drm_get_pixel_format_info(readback->drm_format);
+	size_t bytes_per_pixel = info->bpp / 8;
+	struct wl_shm_buffer *shm_buffer = frame->shm_buffer;
 	int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
 
 	wl_shm_buffer_begin_access(shm_buffer);
-	void *data = wl_shm_buffer_get_data(shm_buffer);
-	uint32_t renderer_flags = 0;
-	bool ok = wlr_renderer_read_pixels(renderer, drm_format, &renderer_flags,
-		stride, width, height, x, y, 0, 0, data);
-	uint32_t flags = renderer_flags & WLR_RENDERER_READ_PIXELS_Y_INVERT ?
-		ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT : 0;
+	unsigned char *data = wl_shm_buffer_get_data(shm_buffer);
+
+	int n_rects;
+	pixman_box32_t *rects =
+		pixman_region32_rectangles(&frame->read_region, &n_rects);
+	for (int i = 0; i < n_rects; i++) {
+		pixman_box32_t *rect = &rects[i];
+		size_t len = (rect->x2 - rect->x1) * bytes_per_pixel;
+		for (int y = rect->y1; y < rect->y2; y++) {
+			unsigned char *dst = data +
+				(size_t)(y - frame->box.y) * stride +
+				(rect->x1 - frame->box.x) * bytes_per_pixel;
+			const unsigned char *src = (unsigned char *)readback->data +
+				(size_t)(y - readback->box.y) * readback->stride +
+				(rect->x1 - readback->box.x) * bytes_per_pixel;
+			memcpy(dst, src, len);
+		}
+	}
+
 	wl_shm_buffer_end_access(shm_buffer);
 
-	if (!ok) {
+	*flags = readback->flags & WLR_RENDERER_READ_PIXELS_Y_INVERT ?
+		ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT : 0;
+	return true;
+}
+
+static void frame_finish_read(struct wlr_screencopy_frame_v1 *frame) {
+	uint32_t flags = 0;
+	if (!frame_copy_readback(frame, &flags)) {
 		wlr_log(WLR_ERROR, "Failed to read pixels from renderer");
+		frame_invalidate_buffer(frame);
 		zwlr_screencopy_frame_v1_send_failed(frame->resource);
 		frame_destroy(frame);
 		return;
 	}
 
 	zwlr_screencopy_frame_v1_send_flags(frame->resource, flags);
+	frame_send_ready(frame, &frame->read_when);
+	frame_destroy(frame);
+}
+
+static int frame_handle_read_timer(void *data) {
+	struct wlr_screencopy_frame_v1 *frame = data;
+	if (!readback_is_ready(frame->readback)) {
+		wl_event_source_timer_update(frame->read_timer, READ_POLL_INTERVAL);
+		return 0;
+	}
+	frame_finish_read(frame);
+	return 0;
+}
+
+/**
+ * Wait for the read-back without stalling the compositor. The ready event is
+ * sent once the GPU is done with the transfer.
+ */
+static bool frame_defer_read(struct wlr_screencopy_frame_v1 *frame,
+		struct timespec *when) {
+	struct wl_display *display =
+		wl_client_get_display(wl_resource_get_client(frame->resource));
+	struct wl_event_loop *loop = wl_display_get_event_loop(display);
+	frame->read_timer =
+		wl_event_loop_add_timer(loop, frame_handle_read_timer, frame);
+	if (frame->read_timer == NULL) {
+		return false;
+	}
+	wl_event_source_timer_update(frame->read_timer, READ_POLL_INTERVAL);
+	frame->read_when = *when;
+
+	// Damage must be collected now, later commits belong to the next frame
+	frame_update_buffer(frame);
+	frame_send_damage(frame);
+	return true;
+}
+
+static uint32_t frame_get_dmabuf_flags(struct wlr_screencopy_frame_v1 *frame) {
+	return frame->dma_buffer->attributes.flags &
+		WLR_DMABUF_ATTRIBUTES_FLAGS_Y_INVERT ?
+		ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT : 0;
+}
+
+static void frame_handle_output_capture(struct wl_listener *listener,
+		void *data) {
+	struct wlr_screencopy_frame_v1 *frame =
+		wl_container_of(listener, frame, output_capture);
+	struct wlr_output_event_capture *event = data;
+	if (event->buffer != &frame->dma_buffer->base) {
+		return;
+	}
+
+	wl_list_remove(&frame->output_capture.link);
+	wl_list_init(&frame->output_capture.link);
+
+	if (!event->success) {
+		// Fall back to blitting the next commit
+		wl_signal_add(&frame->output->events.commit, &frame->output_commit);
+		wlr_output_schedule_frame(frame->output);
+		return;
+	}
+
+	zwlr_screencopy_frame_v1_send_flags(frame->resource,
+		frame_get_dmabuf_flags(frame));
+	frame_update_buffer(frame);
 	frame_send_damage(frame);
 	frame_send_ready(frame, event->when);
 	frame_destroy(frame);
 }
 
+/**
+ * Try to have the display engine write the commit about to happen into the
+ * DMA-BUF frame, which saves the renderer a blit. Only frames covering the
+ * whole output can be captured this way, and the hardware cursor is part of
+ * the written contents.
+ */
+static void frame_request_writeback(struct wlr_screencopy_frame_v1 *frame) {
+	struct wlr_output *output = frame->output;
+	struct wlr_box *box = &frame->box;
+	if (box->x != 0 || box->y != 0 || box->width != output->width ||
+			box->height != output->height) {
+		return;
+	}
+	if (!frame->overlay_cursor && output->hardware_cursor != NULL) {
+		return;
+	}
+
+	if (frame->with_damage) {
+		struct screencopy_damage *damage =
+			screencopy_damage_get_or_create(frame->client, output);
+		if (damage) {
+			screencopy_damage_accumulate(damage);
+			if (!pixman_region32_not_empty(&damage->damage)) {
+				return;
+			}
+		}
+	}
+
+	if (!wlr_output_capture_next_commit(output, &frame->dma_buffer->base)) {
+		return;
+	}
+
+	wl_list_remove(&frame->output_precommit.link);
+	wl_list_init(&frame->output_precommit.link);
+	wl_list_remove(&frame->output_commit.link);
+	wl_list_init(&frame->output_commit.link);
+
+	wl_signal_add(&output->events.capture, &frame->output_capture);
+	frame->output_capture.notify = frame_handle_output_capture;
+}
+
+static void frame_handle_output_precommit(struct wl_listener *listener,
+		void *_data) {
+	struct wlr_screencopy_frame_v1 *frame =
+		wl_container_of(listener, frame, output_precommit);
+	struct wlr_output_event_precommit *event = _data;
+	struct wlr_output *output = frame->output;
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	assert(renderer);
+
+	if (!(output->pending.committed & WLR_OUTPUT_STATE_BUFFER)) {
+		return;
+	}
+
+	if (frame->dma_buffer != NULL) {
+		frame_request_writeback(frame);
+		return;
+	}
+
+	if (!frame_is_due(frame)) {
+		return;
+	}
+
+	wl_list_remove(&frame->output_precommit.link);
+	wl_list_init(&frame->output_precommit.link);
+
+	struct pixman_region32 *region = &frame->read_region;
+	frame_get_copy_region(frame, region);
+
+	uint32_t flags = 0;
+	if (pixman_region32_not_empty(region)) {
+		frame->readback = frame_get_readback(frame, renderer, region);
+		if (frame->readback != NULL && !readback_is_ready(frame->readback) &&
+				frame_defer_read(frame, event->when)) {
+			return;
+		}
+
+		if (frame->readback == NULL ||
+				!frame_copy_readback(frame, &flags)) {
+			wlr_log(WLR_ERROR, "Failed to read pixels from renderer");
+			frame_invalidate_buffer(frame);
+			zwlr_screencopy_frame_v1_send_failed(frame->resource);
+			frame_destroy(frame);
+			return;
+		}
+	}
+
+	zwlr_screencopy_frame_v1_send_flags(frame->resource, flags);
+	frame_update_buffer(frame);
+	frame_send_damage(frame);
+	frame_send_ready(frame, event->when);
+	frame_destroy(frame);
+}
+
+/**
+ * Import the frame which has just been committed on the output as a texture.
+ *
+ * The committed buffer is preferred: the renderer keeps its texture around
+ * for as long as the buffer lives, and the output cycles through the same few
+ * buffers, so continuous captures don't need to re-import the output contents
+ * on each frame.
+ */
+static struct wlr_texture *output_commit_get_texture(struct wlr_output *output,
+		struct wlr_renderer *renderer, struct wlr_buffer *buffer) {
+	if (buffer != NULL) {
+		struct wlr_texture *texture = wlr_texture_from_buffer(renderer, buffer);
+		if (texture != NULL) {
+			return texture;
+		}
+	}
+
+	struct wlr_dmabuf_attributes attr = { 0 };
+	if (!wlr_output_export_dmabuf(output, &attr)) {
+		return NULL;
+	}
+	struct wlr_texture *texture = wlr_texture_from_dmabuf(renderer, &attr);
+	wlr_dmabuf_attributes_finish(&attr);
+	return texture;
+}
+
+static void render_cursor(struct wlr_renderer *renderer,
+		struct wlr_output_cursor *cursor, const float src_matrix[static 9]) {
+	struct wlr_output *output = cursor->output;
+	if (!cursor->enabled || !cursor->visible) {
+		return;
+	}
+
+	struct wlr_texture *texture = cursor->texture;
+	if (cursor->surface != NULL) {
+		texture = wlr_surface_get_texture(cursor->surface);
+	}
+	if (texture == NULL) {
+		return;
+	}
+
+	struct wlr_box box = {
+		.x = cursor->x - cursor->hotspot_x,
+		.y = cursor->y - cursor->hotspot_y,
+		.width = cursor->width,
+		.height = cursor->height,
+	};
+	float matrix[9];
+	wlr_matrix_project_box(matrix, &box, WL_OUTPUT_TRANSFORM_NORMAL, 0,
+		output->transform_matrix);
+	wlr_matrix_multiply(matrix, src_matrix, matrix);
+	wlr_render_texture_with_matrix(renderer, texture, matrix, 1.0f);
+}
+
+/**
+ * Render the cursors displayed on the cursor plane: the hardware cursor and
+ * the cursors composited with it.
+ */
+static void render_hardware_cursor(struct wlr_renderer *renderer,
+		struct wlr_output *output, const float src_matrix[static 9]) {
+	struct wlr_output_cursor *cursor;
+	wl_list_for_each(cursor, &output->cursors, link) {
+		if (cursor == output->hardware_cursor || cursor->composited) {
+			render_cursor(renderer, cursor, src_matrix);
+		}
+	}
+}
+
+/**
+ * Copy the box of the source texture into the destination, scaled to the
+ * destination size. Only the part of the box intersecting the region is
+ * copied, pixels outside of it are left untouched. The box and the region are
+ * in source buffer coordinates.
+ *
+ * If cursor_output is non-NULL, its hardware cursor is drawn on top.
+ */
 static bool blit_dmabuf(struct wlr_renderer *renderer,
 		struct wlr_dmabuf_v1_buffer *dst_dmabuf,
-		struct wlr_dmabuf_attributes *src_attrs) {
+		struct wlr_texture *src_tex, const struct wlr_box *src_box,
+		struct pixman_region32 *region, struct wlr_output *cursor_output) {
 	struct wlr_buffer *dst_buffer = wlr_buffer_lock(&dst_dmabuf->base);
 
-	struct wlr_texture *src_tex = wlr_texture_from_dmabuf(renderer, src_attrs);
-	if (src_tex == NULL) {
-		goto error_src_tex;
-	}
-
 	float mat[9];
 	wlr_matrix_identity(mat);
 	wlr_matrix_scale(mat, dst_buffer->width, dst_buffer->height);
@@ -280,18 +879,51 @@ static bool blit_dmabuf(struct wlr_renderer *renderer,
 		goto error_renderer_begin;
 	}
 
-	wlr_renderer_clear(renderer, (float[]){ 0.0, 0.0, 0.0, 0.0 });
-	wlr_render_texture_with_matrix(renderer, src_tex, mat, 1.0f);
+	struct wlr_fbox src_fbox = {
+		.x = src_box->x,
+		.y = src_box->y,
+		.width = src_box->width,
+		.height = src_box->height,
+	};
+	double scale_x = (double)dst_buffer->width / src_box->width;
+	double scale_y = (double)dst_buffer->height / src_box->height;
+
+	// Maps source buffer coordinates to destination buffer coordinates
+	float src_matrix[9];
+	wlr_matrix_identity(src_matrix);
+	wlr_matrix_scale(src_matrix, scale_x, scale_y);
+	wlr_matrix_translate(src_matrix, -src_box->x, -src_box->y);
+
+	int n_rects;
+	pixman_box32_t *rects = pixman_region32_rectangles(region, &n_rects);
+	for (int i = 0; i < n_rects; i++) {
+		// Round outwards, so that partially covered pixels are updated too
+		int x1 = floor((rects[i].x1 - src_box->x) * scale_x);
+		int y1 = floor((rects[i].y1 - src_box->y) * scale_y);
+		int x2 = ceil((rects[i].x2 - src_box->x) * scale_x);
+		int y2 = ceil((rects[i].y2 - src_box->y) * scale_y);
+		struct wlr_box box = {
+			.x = x1,
+			.y = y1,
+			.width = x2 - x1,
+			.height = y2 - y1,
+		};
+		wlr_renderer_scissor(renderer, &box);
+		wlr_renderer_clear(renderer, (float[]){ 0.0, 0.0, 0.0, 0.0 });
+		wlr_render_subtexture_with_matrix(renderer, src_tex, &src_fbox,
+			mat, 1.0f);
+		if (cursor_output != NULL) {
+			render_hardware_cursor(renderer, cursor_output, src_matrix);
+		}
+	}
+	wlr_renderer_scissor(renderer, NULL);
 
 	wlr_renderer_end(renderer);
 
-	wlr_texture_destroy(src_tex);
 	wlr_buffer_unlock(dst_buffer);
 	return true;
 
 error_renderer_begin:
-	wlr_texture_destroy(src_tex);
-error_src_tex:
 	wlr_buffer_unlock(dst_buffer);
 	return false;
 }
@@ -325,29 +957,30 @@ static void frame_handle_output_commit(struct wl_listener *listener,
 	wl_list_remove(&frame->output_commit.link);
 	wl_list_init(&frame->output_commit.link);
 
-	// TODO: add support for copying regions with DMA-BUFs
-	if (frame->box.x != 0 || frame->box.y != 0 ||
-			output->width != frame->box.width ||
-			output->height != frame->box.height) {
-		zwlr_screencopy_frame_v1_send_failed(frame->resource);
-		frame_destroy(frame);
-		return;
+	struct pixman_region32 region;
+	frame_get_copy_region(frame, &region);
+
+	bool ok = true;
+	if (pixman_region32_not_empty(&region)) {
+		struct wlr_texture *texture =
+			output_commit_get_texture(output, renderer, event->buffer);
+		ok = texture != NULL && blit_dmabuf(renderer, dma_buffer, texture,
+			&frame->box, &region,
+			frame->cursor_damage_locked ? output : NULL);
+		wlr_texture_destroy(texture);
 	}
-
-	struct wlr_dmabuf_attributes attr = { 0 };
-	bool ok = wlr_output_export_dmabuf(output, &attr);
-	ok = ok && blit_dmabuf(renderer, dma_buffer, &attr);
-	uint32_t flags = dma_buffer->attributes.flags & WLR_DMABUF_ATTRIBUTES_FLAGS_Y_INVERT ?
-		ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT : 0;
-	wlr_dmabuf_attributes_finish(&attr);
+	pixman_region32_fini(&region);
+	uint32_t flags = frame_get_dmabuf_flags(frame);
 
 	if (!ok) {
+		frame_invalidate_buffer(frame);
 		zwlr_screencopy_frame_v1_send_failed(frame->resource);
 		frame_destroy(frame);
 		return;
 	}
 
 	zwlr_screencopy_frame_v1_send_flags(frame->resource, flags);
+	frame_update_buffer(frame);
 	frame_send_damage(frame);
 	frame_send_ready(frame, event->when);
 	frame_destroy(frame);
@@ -467,6 +1100,7 @@ static void frame_handle_copy(struct wl_client *wl_client,
 
 	frame->shm_buffer = shm_buffer;
 	frame->dma_buffer = dma_buffer;
+	frame->buffer = buffer_resource;
 
 	wl_signal_add(&output->events.precommit, &frame->output_precommit);
 	frame->output_precommit.notify = frame_handle_output_precommit;
@@ -487,7 +1121,11 @@ static void frame_handle_copy(struct wl_client *wl_client,
 	wlr_output_schedule_frame(output);
 
 	wlr_output_lock_attach_render(output, true);
-	if (frame->overlay_cursor) {
+	if (frame->overlay_cursor && dma_buffer != NULL) {
+		// The cursor is drawn when blitting, the hardware cursor can stay
+		wlr_output_lock_hardware_cursor_damage(output, true);
+		frame->cursor_damage_locked = true;
+	} else if (frame->overlay_cursor) {
 		wlr_output_lock_software_cursors(output, true);
 		frame->cursor_locked = true;
 	}
@@ -578,8 +1216,10 @@ static void capture_output(struct wl_client *wl_client,
 	wl_list_init(&frame->output_precommit.link);
 	wl_list_init(&frame->output_commit.link);
 	wl_list_init(&frame->output_enable.link);
+	wl_list_init(&frame->output_capture.link);
 	wl_list_init(&frame->output_destroy.link);
 	wl_list_init(&frame->buffer_destroy.link);
+	pixman_region32_init(&frame->read_region);
 
 	if (output == NULL || !output->enabled) {
 		goto error;
@@ -595,6 +1235,16 @@ static void capture_output(struct wl_client *wl_client,
 		goto error;
 	}
 
+	// Clients are guaranteed to support the formats mandated by wl_shm, have
+	// the renderer convert to those when the read format can be converted
+	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(drm_format);
+	uint32_t shm_format = drm_fmt != NULL && drm_fmt->has_alpha ?
+		DRM_FORMAT_ARGB8888 : DRM_FORMAT_XRGB8888;
+	if (pixel_format_can_convert(shm_format, drm_format)) {
+		drm_format = shm_format;
+	}
+
 	frame->format = convert_drm_format_to_wl_shm(drm_format);
 	frame->fourcc = get_output_fourcc(output);
 
@@ -740,6 +1390,7 @@ struct wlr_screencopy_manager_v1 *wlr_screencopy_manager_v1_create(
 		return NULL;
 	}
 	wl_list_init(&manager->frames);
+	wl_list_init(&manager->readbacks);
 
 	wl_signal_init(&manager->events.destroy);
 
@@ -0,0 +1,343 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "types/wlr_selection_cache.h"
+
+// Contents larger than this are still forwarded, but not kept afterwards
+#define SELECTION_CACHE_MAX_SIZE (16 * 1024 * 1024)
+#define SELECTION_CACHE_READ_SIZE (64 * 1024)
+// Contents which aren't kept are buffered up to this size for the slowest
+// receiver, reading from the source is paused past it
+#define SELECTION_CACHE_MAX_BUFFERED (1024 * 1024)
+
+struct selection_cache_entry {
+	struct selection_cache *cache;
+	struct wl_list link; // selection_cache.entries
+	char *mime_type;
+	struct wl_array data;
+	// Offset of the first byte of data in the contents, data which every
+	// receiver has consumed is trimmed once the entry isn't cacheable
+	size_t base;
+	// Whether the entry can serve later requests. Reset when the selection
+	// changes or when the contents can't be kept.
+	bool cacheable;
+	bool done; // the whole contents have been received
+	int fd; // read end of the pipe from the source, -1 once done
+	struct wl_event_source *event_source;
+	bool paused; // whether reading is paused until receivers catch up
+	struct wl_list writers; // selection_cache_writer.link
+};
+
+struct selection_cache_writer {
+	struct selection_cache_entry *entry;
+	struct wl_list link; // selection_cache_entry.writers
+	int fd;
+	size_t offset; // in the contents
+	struct wl_event_source *event_source; // only while the pipe is full
+};
+
+static void writer_destroy(struct selection_cache_writer *writer) {
+	if (writer->event_source != NULL) {
+		wl_event_source_remove(writer->event_source);
+	}
+	close(writer->fd);
+	wl_list_remove(&writer->link);
+	free(writer);
+}
+
+static void entry_destroy(struct selection_cache_entry *entry) {
+	struct selection_cache_writer *writer, *tmp;
+	wl_list_for_each_safe(writer, tmp, &entry->writers, link) {
+		writer_destroy(writer);
+	}
+	if (entry->event_source != NULL) {
+		wl_event_source_remove(entry->event_source);
+	}
+	if (entry->fd >= 0) {
+		close(entry->fd);
+	}
+	wl_array_release(&entry->data);
+	wl_list_remove(&entry->link);
+	free(entry->mime_type);
+	free(entry);
+}
+
+/**
+ * Destroy the entry if it can't be used anymore.
+ */
+static void entry_check_unused(struct selection_cache_entry *entry) {
+	if (!entry->cacheable && wl_list_empty(&entry->writers)) {
+		entry_destroy(entry);
+	}
+}
+
+static int writer_handle_writable(int fd, uint32_t mask, void *data);
+
+/**
+ * Write as much of the available contents as the pipe accepts. The writer is
+ * destroyed once it has written everything or on error.
+ */
+static void writer_flush(struct selection_cache_writer *writer) {
+	struct selection_cache_entry *entry = writer->entry;
+	size_t end = entry->base + entry->data.size;
+	while (writer->offset < end) {
+		ssize_t n = write(writer->fd,
+			(char *)entry->data.data + (writer->offset - entry->base),
+			end - writer->offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && errno == EAGAIN) {
+			if (writer->event_source == NULL) {
+				writer->event_source = wl_event_loop_add_fd(
+					entry->cache->event_loop, writer->fd, WL_EVENT_WRITABLE,
+					writer_handle_writable, writer);
+				if (writer->event_source == NULL) {
+					writer_destroy(writer);
+				}
+			}
+			return;
+		} else if (n < 0) {
+			// The receiving client has closed the pipe
+			writer_destroy(writer);
+			return;
+		}
+		writer->offset += n;
+	}
+
+	if (entry->done) {
+		writer_destroy(writer);
+	} else if (writer->event_source != NULL) {
+		// Wait for more contents from the source
+		wl_event_source_remove(writer->event_source);
+		writer->event_source = NULL;
+	}
+}
+
+/**
+ * Drop the data every receiver has consumed, unless the entry is kept for
+ * later requests. Resumes reading from the source if it was paused.
+ */
+static void entry_trim(struct selection_cache_entry *entry) {
+	if (entry->cacheable || wl_list_empty(&entry->writers)) {
+		return;
+	}
+
+	size_t min_offset = entry->base + entry->data.size;
+	struct selection_cache_writer *writer;
+	wl_list_for_each(writer, &entry->writers, link) {
+		if (writer->offset < min_offset) {
+			min_offset = writer->offset;
+		}
+	}
+
+	size_t consumed = min_offset - entry->base;
+	if (consumed > 0) {
+		memmove(entry->data.data, (char *)entry->data.data + consumed,
+			entry->data.size - consumed);
+		entry->data.size -= consumed;
+		entry->base += consumed;
+	}
+
+	if (entry->paused && entry->data.size < SELECTION_CACHE_MAX_BUFFERED) {
+		wl_event_source_fd_update(entry->event_source, WL_EVENT_READABLE);
+		entry->paused = false;
+	}
+}
+
+static void entry_flush_writers(struct selection_cache_entry *entry) {
+	struct selection_cache_writer *writer, *tmp;
+	wl_list_for_each_safe(writer, tmp, &entry->writers, link) {
+		writer_flush(writer);
+	}
+	entry_trim(entry);
+}
+
+static int writer_handle_writable(int fd, uint32_t mask, void *data) {
+	struct selection_cache_writer *writer = data;
+	struct selection_cache_entry *entry = writer->entry;
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		writer_destroy(writer);
+	} else {
+		writer_flush(writer);
+	}
+	entry_trim(entry);
+	entry_check_unused(entry);
+	return 0;
+}
+
+static void entry_finish_read(struct selection_cache_entry *entry) {
+	wl_event_source_remove(entry->event_source);
+	entry->event_source = NULL;
+	close(entry->fd);
+	entry->fd = -1;
+	entry->done = true;
+	entry->paused = false;
+	entry_flush_writers(entry);
+}
+
+static int entry_handle_readable(int fd, uint32_t mask, void *data) {
+	struct selection_cache_entry *entry = data;
+
+	void *dst = wl_array_add(&entry->data, SELECTION_CACHE_READ_SIZE);
+	if (dst == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		entry->cacheable = false;
+		entry_finish_read(entry);
+		entry_check_unused(entry);
+		return 0;
+	}
+
+	ssize_t n = read(fd, dst, SELECTION_CACHE_READ_SIZE);
+	entry->data.size -= SELECTION_CACHE_READ_SIZE - (n > 0 ? n : 0);
+	if (n > 0) {
+		if (entry->base + entry->data.size > SELECTION_CACHE_MAX_SIZE) {
+			// Too big to be kept, stop buffering the whole contents
+			entry->cacheable = false;
+		}
+		entry_flush_writers(entry);
+		if (!entry->cacheable && !entry->paused &&
+				entry->data.size >= SELECTION_CACHE_MAX_BUFFERED) {
+			wl_event_source_fd_update(entry->event_source, 0);
+			entry->paused = true;
+		}
+	} else if (n == 0) {
+		entry_finish_read(entry);
+	} else if (errno != EAGAIN && errno != EINTR) {
+		wlr_log_errno(WLR_ERROR, "Failed to read selection contents");
+		// Only forward what we got so far, don't keep partial contents
+		entry->cacheable = false;
+		entry_finish_read(entry);
+	}
+	entry_check_unused(entry);
+	return 0;
+}
+
+static bool set_fd_flags(int fd, int fd_flags, int fl_flags) {
+	int flags = fcntl(fd, F_GETFD);
+	if (flags < 0 || fcntl(fd, F_SETFD, flags | fd_flags) < 0) {
+		return false;
+	}
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | fl_flags) < 0) {
+		return false;
+	}
+	return true;
+}
+
+static struct selection_cache_entry *entry_create(
+		struct selection_cache *cache, void *source,
+		selection_cache_send_func_t send, const char *mime_type) {
+	int fds[2];
+	if (pipe(fds) != 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to create pipe");
+		return NULL;
+	}
+	if (!set_fd_flags(fds[0], FD_CLOEXEC, O_NONBLOCK) ||
+			!set_fd_flags(fds[1], FD_CLOEXEC, 0)) {
+		wlr_log_errno(WLR_ERROR, "Failed to set pipe flags");
+		goto error_pipe;
+	}
+
+	struct selection_cache_entry *entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		goto error_pipe;
+	}
+	entry->mime_type = strdup(mime_type);
+	if (entry->mime_type == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		goto error_entry;
+	}
+	entry->event_source = wl_event_loop_add_fd(cache->event_loop, fds[0],
+		WL_EVENT_READABLE, entry_handle_readable, entry);
+	if (entry->event_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add pipe to event loop");
+		goto error_mime_type;
+	}
+
+	entry->cache = cache;
+	entry->cacheable = true;
+	entry->fd = fds[0];
+	wl_array_init(&entry->data);
+	wl_list_init(&entry->writers);
+	wl_list_insert(&cache->entries, &entry->link);
+
+	send(source, mime_type, fds[1]);
+	return entry;
+
+error_mime_type:
+	free(entry->mime_type);
+error_entry:
+	free(entry);
+error_pipe:
+	close(fds[0]);
+	close(fds[1]);
+	return NULL;
+}
+
+void selection_cache_init(struct selection_cache *cache,
+		struct wl_event_loop *loop) {
+	cache->event_loop = loop;
+	cache->source = NULL;
+	wl_list_init(&cache->entries);
+}
+
+void selection_cache_finish(struct selection_cache *cache) {
+	struct selection_cache_entry *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &cache->entries, link) {
+		entry_destroy(entry);
+	}
+}
+
+void selection_cache_reset(struct selection_cache *cache) {
+	cache->source = NULL;
+
+	// Transfers in progress are completed, the contents are dropped after
+	struct selection_cache_entry *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &cache->entries, link) {
+		entry->cacheable = false;
+		entry_trim(entry);
+		entry_check_unused(entry);
+	}
+}
+
+void selection_cache_receive(struct selection_cache *cache, void *source,
+		selection_cache_send_func_t send, const char *mime_type, int fd) {
+	if (cache->source != source) {
+		selection_cache_reset(cache);
+		cache->source = source;
+	}
+
+	struct selection_cache_entry *entry = NULL, *iter;
+	wl_list_for_each(iter, &cache->entries, link) {
+		if (iter->cacheable && strcmp(iter->mime_type, mime_type) == 0) {
+			entry = iter;
+			break;
+		}
+	}
+	if (entry == NULL) {
+		entry = entry_create(cache, source, send, mime_type);
+		if (entry == NULL) {
+			close(fd);
+			return;
+		}
+	}
+
+	struct selection_cache_writer *writer = calloc(1, sizeof(*writer));
+	if (writer == NULL || !set_fd_flags(fd, FD_CLOEXEC, O_NONBLOCK)) {
+		wlr_log(WLR_ERROR, "Failed to set up selection transfer");
+		free(writer);
+		close(fd);
+		entry_check_unused(entry);
+		return;
+	}
+	writer->entry = entry;
+	writer->fd = fd;
+	wl_list_insert(&entry->writers, &writer->link);
+
+	writer_flush(writer);
+}
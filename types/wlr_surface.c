@@ -1,20 +1,34 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <inttypes.h>
+#include <math.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/render/interface.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_region.h>
 #include <wlr/types/wlr_surface.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/util/log.h>
 #include <wlr/util/region.h>
+#include "render/dmabuf.h"
+#include "render/pixel_format.h"
+#include "types/wlr_buffer.h"
 #include "types/wlr_surface.h"
+#include "util/object_pool.h"
 #include "util/signal.h"
 #include "util/time.h"
+#include "util/trace.h"
 
 #define CALLBACK_VERSION 1
+// Maximum number of applied cached states kept around for re-use
+#define CACHED_STATE_POOL_SIZE 4
+// Maximum number of rectangles in the buffer damage of a commit
+#define SURFACE_DAMAGE_MAX_RECTS 32
 
 static int min(int fst, int snd) {
 	if (fst < snd) {
@@ -248,6 +262,11 @@ static void surface_update_damage(pixman_region32_t *buffer_damage,
 			&pending->buffer_damage, &surface_damage);
 
 		pixman_region32_fini(&surface_damage);
+
+		// Clients may send hundreds of small rectangles, each of which
+		// costs a texture upload and a draw call
+		wlr_region_coalesce(buffer_damage, buffer_damage,
+			SURFACE_DAMAGE_MAX_RECTS);
 	}
 }
 
@@ -344,10 +363,72 @@ static void surface_damage_subsurfaces(struct wlr_subsurface *subsurface) {
 	}
 }
 
+/**
+ * A commit held back until its wl_shm buffer has been uploaded to a texture
+ * on the renderer's upload worker.
+ */
+struct surface_buffer_upload {
+	struct wlr_surface *surface;
+	uint32_t seq; // locked surface state
+	struct wlr_texture_upload *upload; // NULL once finished
+	struct wlr_texture *texture; // NULL until finished or on failure
+	// Wraps a private copy of the wl_shm data: the worker can't read client
+	// memory, which may be truncated under it, outside of libwayland's
+	// SIGBUS protection
+	struct wlr_readonly_data_buffer *data_buffer;
+	void *data;
+	struct wl_event_source *event_source;
+	struct wl_list link; // wlr_surface.buffer_uploads
+};
+
+static void surface_buffer_upload_release_data(
+		struct surface_buffer_upload *upload) {
+	if (upload->data_buffer != NULL) {
+		readonly_data_buffer_drop(upload->data_buffer);
+		upload->data_buffer = NULL;
+	}
+	free(upload->data);
+	upload->data = NULL;
+}
+
+static void surface_buffer_upload_destroy(
+		struct surface_buffer_upload *upload) {
+	if (upload->event_source != NULL) {
+		wl_event_source_remove(upload->event_source);
+	}
+	wlr_texture_upload_destroy(upload->upload);
+	wlr_texture_destroy(upload->texture);
+	surface_buffer_upload_release_data(upload);
+	wl_list_remove(&upload->link);
+	free(upload);
+}
+
+/**
+ * Take the texture uploaded for the current state, if any.
+ */
+static struct wlr_texture *surface_take_uploaded_texture(
+		struct wlr_surface *surface) {
+	struct surface_buffer_upload *upload;
+	wl_list_for_each(upload, &surface->buffer_uploads, link) {
+		if (upload->seq != surface->current.seq) {
+			continue;
+		}
+		assert(upload->upload == NULL);
+		struct wlr_texture *texture = upload->texture;
+		upload->texture = NULL;
+		surface_buffer_upload_destroy(upload);
+		return texture;
+	}
+	return NULL;
+}
+
 static void surface_apply_damage(struct wlr_surface *surface) {
+	struct wlr_texture *uploaded = surface_take_uploaded_texture(surface);
+
 	struct wl_resource *resource = surface->current.buffer_resource;
 	if (resource == NULL) {
-		// NULL commit
+		// NULL commit, or the client destroyed the buffer in the meantime
+		wlr_texture_destroy(uploaded);
 		if (surface->buffer != NULL) {
 			wlr_buffer_unlock(&surface->buffer->base);
 		}
@@ -355,6 +436,18 @@ static void surface_apply_damage(struct wlr_surface *surface) {
 		return;
 	}
 
+	if (uploaded != NULL) {
+		struct wlr_client_buffer *buffer = client_buffer_create_from_shm_texture(
+			surface->renderer, resource, uploaded);
+		if (buffer != NULL) {
+			if (surface->buffer != NULL) {
+				wlr_buffer_unlock(&surface->buffer->base);
+			}
+			surface->buffer = buffer;
+			return;
+		}
+	}
+
 	if (surface->buffer != NULL && surface->buffer->resource_released) {
 		struct wlr_client_buffer *updated_buffer =
 			wlr_client_buffer_apply_damage(surface->buffer, resource,
@@ -405,18 +498,44 @@ static void surface_update_input_region(struct wlr_surface *surface) {
 static void surface_state_init(struct wlr_surface_state *state);
 
 static void surface_cache_pending(struct wlr_surface *surface) {
-	struct wlr_surface_state *cached = calloc(1, sizeof(*cached));
-	if (!cached) {
-		wl_resource_post_no_memory(surface->resource);
-		return;
+	struct wlr_surface_state *cached;
+	if (!wl_list_empty(&surface->cached_pool)) {
+		// Only fields marked as committed are read from a cached state, and
+		// its regions keep their storage for the copy
+		cached = wl_container_of(surface->cached_pool.next, cached,
+			cached_state_link);
+		wl_list_remove(&cached->cached_state_link);
+		surface->cached_pool_len--;
+	} else {
+		cached = calloc(1, sizeof(*cached));
+		if (!cached) {
+			wl_resource_post_no_memory(surface->resource);
+			return;
+		}
+		surface_state_init(cached);
 	}
 
-	surface_state_init(cached);
 	surface_state_move(cached, &surface->pending);
 
 	wl_list_insert(surface->cached.prev, &cached->cached_state_link);
 }
 
+/**
+ * Drop the cached extents of the surface and of its parents. A surface with
+ * valid extents only has children with valid extents.
+ */
+static void surface_invalidate_extents(struct wlr_surface *surface) {
+	while (surface != NULL && surface->extents_valid) {
+		surface->extents_valid = false;
+
+		if (!wlr_surface_is_subsurface(surface)) {
+			break;
+		}
+		struct wlr_subsurface *subsurface = surface->role_data;
+		surface = subsurface != NULL ? subsurface->parent : NULL;
+	}
+}
+
 static void surface_commit_state(struct wlr_surface *surface,
 		struct wlr_surface_state *next) {
 	assert(next->cached_state_locks == 0);
@@ -463,9 +582,210 @@ static void surface_commit_state(struct wlr_surface *surface,
 		surface->role->commit(surface);
 	}
 
+	// Size, subsurface order and position may have changed
+	surface_invalidate_extents(surface);
+
 	wlr_signal_emit_safe(&surface->events.commit, surface);
 }
 
+/**
+ * A commit held back until the GPU is done rendering its buffer.
+ */
+struct surface_buffer_fence {
+	struct wlr_surface *surface;
+	uint32_t seq; // locked surface state
+	int fd; // sync_file
+	struct wl_event_source *event_source;
+	struct wl_list link; // wlr_surface.buffer_fences
+};
+
+static void surface_buffer_fence_destroy(struct surface_buffer_fence *fence) {
+	wl_event_source_remove(fence->event_source);
+	close(fence->fd);
+	wl_list_remove(&fence->link);
+	free(fence);
+}
+
+static int surface_buffer_fence_handle_event(int fd, uint32_t mask,
+		void *data) {
+	struct surface_buffer_fence *fence = data;
+	struct wlr_surface *surface = fence->surface;
+	uint32_t seq = fence->seq;
+
+	surface_buffer_fence_destroy(fence);
+	wlr_surface_unlock_cached(surface, seq);
+	return 0;
+}
+
+/**
+ * Hold the pending state back until the write fences of its DMA-BUF signal,
+ * so that the compositor doesn't block on implicit synchronization when
+ * sampling from a buffer the client's GPU hasn't finished rendering. The
+ * previous buffer stays current in the meantime.
+ */
+static void surface_wait_pending_buffer(struct wlr_surface *surface) {
+	struct wl_resource *buffer_resource = surface->pending.buffer_resource;
+	if (!(surface->pending.committed & WLR_SURFACE_STATE_BUFFER) ||
+			buffer_resource == NULL ||
+			!wlr_dmabuf_v1_resource_is_buffer(buffer_resource)) {
+		return;
+	}
+
+	struct wlr_dmabuf_v1_buffer *dmabuf =
+		wlr_dmabuf_v1_buffer_from_buffer_resource(buffer_resource);
+	const struct wlr_dmabuf_attributes *attribs = &dmabuf->attributes;
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(
+		wl_client_get_display(wl_resource_get_client(surface->resource)));
+
+	for (int i = 0; i < attribs->n_planes; i++) {
+		bool dup = false;
+		for (int j = 0; j < i; j++) {
+			dup = dup || attribs->fd[j] == attribs->fd[i];
+		}
+		if (dup) {
+			continue;
+		}
+
+		int sync_file_fd = dmabuf_export_sync_file(attribs->fd[i]);
+		if (sync_file_fd < 0) {
+			continue;
+		}
+		if (sync_file_is_signaled(sync_file_fd)) {
+			close(sync_file_fd);
+			continue;
+		}
+
+		struct surface_buffer_fence *fence = calloc(1, sizeof(*fence));
+		if (fence == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			close(sync_file_fd);
+			continue;
+		}
+		fence->event_source = wl_event_loop_add_fd(loop, sync_file_fd,
+			WL_EVENT_READABLE, surface_buffer_fence_handle_event, fence);
+		if (fence->event_source == NULL) {
+			wlr_log(WLR_ERROR, "Failed to add sync_file to event loop");
+			close(sync_file_fd);
+			free(fence);
+			continue;
+		}
+		fence->surface = surface;
+		fence->fd = sync_file_fd;
+		fence->seq = wlr_surface_lock_pending(surface);
+		wl_list_insert(&surface->buffer_fences, &fence->link);
+	}
+}
+
+static int surface_buffer_upload_handle_done(int fd, uint32_t mask,
+		void *data) {
+	struct surface_buffer_upload *upload = data;
+
+	wl_event_source_remove(upload->event_source);
+	upload->event_source = NULL;
+	upload->texture = wlr_texture_upload_finish(upload->upload);
+	upload->upload = NULL;
+	surface_buffer_upload_release_data(upload);
+
+	// Applies the state, which takes the texture
+	wlr_surface_unlock_cached(upload->surface, upload->seq);
+	return 0;
+}
+
+// Uploads smaller than this many pixels are done synchronously
+#define SURFACE_ASYNC_UPLOAD_MIN_AREA (512 * 512)
+
+/**
+ * Hold the pending state back while a big wl_shm buffer is uploaded on the
+ * renderer's upload worker, so that protocol dispatch isn't blocked by the
+ * upload. The previous buffer stays current in the meantime.
+ */
+static void surface_upload_pending_buffer(struct wlr_surface *surface) {
+	struct wl_resource *buffer_resource = surface->pending.buffer_resource;
+	if (!(surface->pending.committed & WLR_SURFACE_STATE_BUFFER) ||
+			buffer_resource == NULL) {
+		return;
+	}
+	struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(buffer_resource);
+	if (shm_buffer == NULL) {
+		return;
+	}
+
+	int32_t width = wl_shm_buffer_get_width(shm_buffer);
+	int32_t height = wl_shm_buffer_get_height(shm_buffer);
+	if ((int64_t)width * height < SURFACE_ASYNC_UPLOAD_MIN_AREA) {
+		return;
+	}
+
+	// Updates of a small damaged area of a buffer with the same size are
+	// cheap, only full uploads are worth moving to the worker
+	struct wlr_texture *texture = wlr_surface_get_texture(surface);
+	if (texture != NULL && texture->width == (uint32_t)width &&
+			texture->height == (uint32_t)height) {
+		pixman_box32_t *ext =
+			pixman_region32_extents(&surface->pending.buffer_damage);
+		int64_t damage_area =
+			(int64_t)(ext->x2 - ext->x1) * (ext->y2 - ext->y1);
+		if (damage_area < SURFACE_ASYNC_UPLOAD_MIN_AREA) {
+			return;
+		}
+	}
+
+	uint32_t format =
+		convert_wl_shm_format_to_drm(wl_shm_buffer_get_format(shm_buffer));
+
+	struct surface_buffer_upload *upload = calloc(1, sizeof(*upload));
+	if (upload == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	wl_list_init(&upload->link);
+	upload->surface = surface;
+
+	// Copy the data here, under SIGBUS protection. This is much cheaper than
+	// the GL upload, which the worker still takes off this thread.
+	int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+	size_t size = (size_t)stride * height;
+	upload->data = malloc(size);
+	if (upload->data == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		goto error;
+	}
+	wl_shm_buffer_begin_access(shm_buffer);
+	memcpy(upload->data, wl_shm_buffer_get_data(shm_buffer), size);
+	wl_shm_buffer_end_access(shm_buffer);
+
+	upload->data_buffer = readonly_data_buffer_create(format, stride,
+		width, height, upload->data);
+	if (upload->data_buffer == NULL) {
+		goto error;
+	}
+
+	upload->upload = wlr_renderer_upload_buffer_async(surface->renderer,
+		&upload->data_buffer->base);
+	if (upload->upload == NULL) {
+		// Fall back to a synchronous upload
+		goto error;
+	}
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(
+		wl_client_get_display(wl_resource_get_client(surface->resource)));
+	upload->event_source = wl_event_loop_add_fd(loop,
+		wlr_texture_upload_get_fd(upload->upload), WL_EVENT_READABLE,
+		surface_buffer_upload_handle_done, upload);
+	if (upload->event_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add texture upload to event loop");
+		goto error;
+	}
+
+	upload->seq = wlr_surface_lock_pending(surface);
+	wl_list_insert(&surface->buffer_uploads, &upload->link);
+	return;
+
+error:
+	surface_buffer_upload_destroy(upload);
+}
+
 static void surface_commit_pending(struct wlr_surface *surface) {
 	surface_state_finalize(surface, &surface->pending);
 
@@ -473,6 +793,11 @@ static void surface_commit_pending(struct wlr_surface *surface) {
 		surface->role->precommit(surface);
 	}
 
+	wlr_signal_emit_safe(&surface->events.client_commit, surface);
+
+	surface_wait_pending_buffer(surface);
+	surface_upload_pending_buffer(surface);
+
 	uint32_t next_seq = surface->pending.seq + 1;
 	if (surface->pending.cached_state_locks > 0 || !wl_list_empty(&surface->cached)) {
 		surface_cache_pending(surface);
@@ -502,39 +827,120 @@ static bool subsurface_is_synchronized(struct wlr_subsurface *subsurface) {
 }
 
 /**
- * Recursive function to commit the effectively synchronized children.
+ * Add delta to the count of cached subsurfaces of the surface and of all its
+ * ancestors.
  */
-static void subsurface_parent_commit(struct wlr_subsurface *subsurface,
-		bool synchronized) {
-	struct wlr_surface *surface = subsurface->surface;
-	if (synchronized || subsurface->synchronized) {
-		if (subsurface->has_cache) {
-			wlr_surface_unlock_cached(surface, subsurface->cached_seq);
-			subsurface->has_cache = false;
-			subsurface->cached_seq = 0;
+static void surface_add_cached_subsurfaces(struct wlr_surface *surface,
+		long delta) {
+	while (surface != NULL) {
+		assert(delta >= 0 || surface->cached_subsurfaces >= (size_t)-delta);
+		surface->cached_subsurfaces += delta;
+
+		if (!wlr_surface_is_subsurface(surface)) {
+			break;
 		}
+		struct wlr_subsurface *subsurface = surface->role_data;
+		surface = subsurface != NULL ? subsurface->parent : NULL;
+	}
+}
+
+/**
+ * Get the number of cached subsurfaces in the tree rooted at the subsurface,
+ * itself included.
+ */
+static size_t subsurface_get_cached_tree(struct wlr_subsurface *subsurface) {
+	size_t n = subsurface->has_cache ? 1 : 0;
+	if (subsurface->surface != NULL) {
+		n += subsurface->surface->cached_subsurfaces;
+	}
+	return n;
+}
 
-		struct wlr_subsurface *subsurface;
-		wl_list_for_each(subsurface, &surface->subsurfaces_below, parent_link) {
-			subsurface_parent_commit(subsurface, true);
+static void subsurface_hold_cache(struct wlr_subsurface *subsurface) {
+	assert(!subsurface->has_cache);
+	subsurface->has_cache = true;
+	subsurface->cached_seq = wlr_surface_lock_pending(subsurface->surface);
+	surface_add_cached_subsurfaces(subsurface->parent, 1);
+}
+
+static void subsurface_release_cache(struct wlr_subsurface *subsurface) {
+	if (!subsurface->has_cache) {
+		return;
+	}
+	uint32_t seq = subsurface->cached_seq;
+	subsurface->has_cache = false;
+	subsurface->cached_seq = 0;
+	// Update the counts first, applying the commit may emit signals
+	surface_add_cached_subsurfaces(subsurface->parent, -1);
+	wlr_surface_unlock_cached(subsurface->surface, seq);
+}
+
+static bool subsurface_needs_parent_commit(struct wlr_subsurface *subsurface) {
+	return subsurface->has_cache ||
+		subsurface->surface->cached_subsurfaces > 0;
+}
+
+static void push_children(struct wl_array *stack, struct wlr_surface *surface,
+		bool synchronized) {
+	// In reverse order, so that children are popped in stacking order
+	struct wlr_subsurface *child;
+	wl_list_for_each_reverse(child, &surface->subsurfaces_above, parent_link) {
+		if ((synchronized || child->synchronized) &&
+				subsurface_needs_parent_commit(child)) {
+			struct wlr_subsurface **ptr = wl_array_add(stack, sizeof(*ptr));
+			if (ptr != NULL) {
+				*ptr = child;
+			}
 		}
-		wl_list_for_each(subsurface, &surface->subsurfaces_above, parent_link) {
-			subsurface_parent_commit(subsurface, true);
+	}
+	wl_list_for_each_reverse(child, &surface->subsurfaces_below, parent_link) {
+		if ((synchronized || child->synchronized) &&
+				subsurface_needs_parent_commit(child)) {
+			struct wlr_subsurface **ptr = wl_array_add(stack, sizeof(*ptr));
+			if (ptr != NULL) {
+				*ptr = child;
+			}
 		}
 	}
 }
 
-static void subsurface_commit(struct wlr_subsurface *subsurface) {
-	struct wlr_surface *surface = subsurface->surface;
+/**
+ * Apply the commits held back by the effectively synchronized descendants of
+ * a surface, parents first. Only the subtrees holding cached commits are
+ * visited.
+ */
+static void surface_commit_synchronized_children(struct wlr_surface *surface,
+		bool synchronized) {
+	if (surface->cached_subsurfaces == 0) {
+		return;
+	}
+
+	struct wl_array stack;
+	wl_array_init(&stack);
+	push_children(&stack, surface, synchronized);
+
+	while (stack.size > 0) {
+		stack.size -= sizeof(struct wlr_subsurface *);
+		struct wlr_subsurface *subsurface =
+			*(struct wlr_subsurface **)((char *)stack.data + stack.size);
+
+		subsurface_release_cache(subsurface);
+		if (subsurface->surface->cached_subsurfaces > 0) {
+			push_children(&stack, subsurface->surface, true);
+		}
+	}
 
+	wl_array_release(&stack);
+}
+
+static void subsurface_commit(struct wlr_subsurface *subsurface) {
 	if (subsurface_is_synchronized(subsurface)) {
 		if (subsurface->has_cache) {
 			// We already lock a previous commit. The prevents any future
 			// commit to be applied before we release the previous commit.
 			return;
 		}
-		subsurface->has_cache = true;
-		subsurface->cached_seq = wlr_surface_lock_pending(surface);
+		subsurface_hold_cache(subsurface);
 	}
 }
 
@@ -542,6 +948,13 @@ static void surface_commit(struct wl_client *client,
 		struct wl_resource *resource) {
 	struct wlr_surface *surface = wlr_surface_from_resource(resource);
 
+	if (trace_enabled()) {
+		pid_t pid;
+		wl_client_get_credentials(client, &pid, NULL, NULL);
+		trace_begin("wl_surface@%" PRIu32 " commit (client %d)",
+			wl_resource_get_id(resource), (int)pid);
+	}
+
 	struct wlr_subsurface *subsurface = wlr_surface_is_subsurface(surface) ?
 		wlr_subsurface_from_wlr_surface(surface) : NULL;
 	if (subsurface != NULL) {
@@ -549,13 +962,9 @@ static void surface_commit(struct wl_client *client,
 	}
 
 	surface_commit_pending(surface);
+	surface_commit_synchronized_children(surface, false);
 
-	wl_list_for_each(subsurface, &surface->subsurfaces_below, parent_link) {
-		subsurface_parent_commit(subsurface, false);
-	}
-	wl_list_for_each(subsurface, &surface->subsurfaces_above, parent_link) {
-		subsurface_parent_commit(subsurface, false);
-	}
+	trace_end();
 }
 
 static void surface_set_buffer_transform(struct wl_client *client,
@@ -649,6 +1058,28 @@ static void surface_state_destroy_cached(struct wlr_surface_state *state) {
 	free(state);
 }
 
+/**
+ * Put a cached state which has just been committed into the pool, so that
+ * the next commit made while the surface is locked doesn't need to allocate.
+ */
+static void surface_state_release_cached(struct wlr_surface *surface,
+		struct wlr_surface_state *state) {
+	if (surface->cached_pool_len >= CACHED_STATE_POOL_SIZE) {
+		surface_state_destroy_cached(state);
+		return;
+	}
+
+	// Buffer and frame callbacks have been moved to the current state
+	assert(state->buffer_resource == NULL);
+	assert(wl_list_empty(&state->frame_callback_list));
+	state->committed = 0;
+	state->cached_state_locks = 0;
+
+	wl_list_remove(&state->cached_state_link);
+	wl_list_insert(&surface->cached_pool, &state->cached_state_link);
+	surface->cached_pool_len++;
+}
+
 static void subsurface_unmap(struct wlr_subsurface *subsurface);
 
 static void subsurface_destroy(struct wlr_subsurface *subsurface) {
@@ -663,9 +1094,12 @@ static void subsurface_destroy(struct wlr_subsurface *subsurface) {
 	wl_list_remove(&subsurface->surface_destroy.link);
 
 	if (subsurface->parent) {
+		surface_add_cached_subsurfaces(subsurface->parent,
+			-(long)subsurface_get_cached_tree(subsurface));
 		wl_list_remove(&subsurface->parent_link);
 		wl_list_remove(&subsurface->parent_pending_link);
 		wl_list_remove(&subsurface->parent_destroy.link);
+		surface_invalidate_extents(subsurface->parent);
 	}
 
 	wl_resource_set_user_data(subsurface->resource, NULL);
@@ -688,10 +1122,25 @@ static void surface_handle_resource_destroy(struct wl_resource *resource) {
 
 	wlr_signal_emit_safe(&surface->events.destroy, surface);
 
+	wlr_addon_set_finish(&surface->addons);
+
 	struct wlr_surface_state *cached, *cached_tmp;
 	wl_list_for_each_safe(cached, cached_tmp, &surface->cached, cached_state_link) {
 		surface_state_destroy_cached(cached);
 	}
+	wl_list_for_each_safe(cached, cached_tmp, &surface->cached_pool,
+			cached_state_link) {
+		surface_state_destroy_cached(cached);
+	}
+
+	struct surface_buffer_fence *fence, *fence_tmp;
+	wl_list_for_each_safe(fence, fence_tmp, &surface->buffer_fences, link) {
+		surface_buffer_fence_destroy(fence);
+	}
+	struct surface_buffer_upload *upload, *upload_tmp;
+	wl_list_for_each_safe(upload, upload_tmp, &surface->buffer_uploads, link) {
+		surface_buffer_upload_destroy(upload);
+	}
 
 	wl_list_remove(&surface->renderer_destroy.link);
 	surface_state_finish(&surface->pending);
@@ -738,8 +1187,10 @@ struct wlr_surface *surface_create(struct wl_client *client,
 	surface_state_init(&surface->pending);
 	surface_state_init(&surface->previous);
 	surface->pending.seq = 1;
+	surface->hidden_frame_interval = -1;
 
 	wl_signal_init(&surface->events.commit);
+	wl_signal_init(&surface->events.client_commit);
 	wl_signal_init(&surface->events.destroy);
 	wl_signal_init(&surface->events.new_subsurface);
 	wl_list_init(&surface->subsurfaces_above);
@@ -748,6 +1199,10 @@ struct wlr_surface *surface_create(struct wl_client *client,
 	wl_list_init(&surface->subsurfaces_pending_below);
 	wl_list_init(&surface->current_outputs);
 	wl_list_init(&surface->cached);
+	wl_list_init(&surface->cached_pool);
+	wl_list_init(&surface->buffer_fences);
+	wl_list_init(&surface->buffer_uploads);
+	wlr_addon_set_init(&surface->addons);
 	pixman_region32_init(&surface->buffer_damage);
 	pixman_region32_init(&surface->opaque_region);
 	pixman_region32_init(&surface->input_region);
@@ -839,7 +1294,7 @@ void wlr_surface_unlock_cached(struct wlr_surface *surface, uint32_t seq) {
 		}
 
 		surface_commit_state(surface, next);
-		surface_state_destroy_cached(next);
+		surface_state_release_cached(surface, next);
 	}
 }
 
@@ -977,14 +1432,8 @@ static void subsurface_handle_set_desync(struct wl_client *client,
 		subsurface->synchronized = false;
 
 		if (!subsurface_is_synchronized(subsurface)) {
-			if (subsurface->has_cache) {
-				wlr_surface_unlock_cached(subsurface->surface,
-					subsurface->cached_seq);
-				subsurface->has_cache = false;
-				subsurface->cached_seq = 0;
-			}
-
-			subsurface_parent_commit(subsurface, true);
+			subsurface_release_cache(subsurface);
+			surface_commit_synchronized_children(subsurface->surface, true);
 		}
 	}
 }
@@ -1113,6 +1562,8 @@ static void subsurface_handle_parent_destroy(struct wl_listener *listener,
 	struct wlr_subsurface *subsurface =
 		wl_container_of(listener, subsurface, parent_destroy);
 	subsurface_unmap(subsurface);
+	surface_add_cached_subsurfaces(subsurface->parent,
+		-(long)subsurface_get_cached_tree(subsurface));
 	wl_list_remove(&subsurface->parent_link);
 	wl_list_remove(&subsurface->parent_pending_link);
 	wl_list_remove(&subsurface->parent_destroy.link);
@@ -1162,8 +1613,10 @@ struct wlr_subsurface *subsurface_create(struct wlr_surface *surface,
 	wl_list_insert(parent->subsurfaces_above.prev, &subsurface->parent_link);
 	wl_list_insert(parent->subsurfaces_pending_above.prev,
 		&subsurface->parent_pending_link);
+	surface_invalidate_extents(parent);
 
 	surface->role_data = subsurface;
+	surface_add_cached_subsurfaces(parent, surface->cached_subsurfaces);
 
 	wlr_signal_emit_safe(&parent->events.new_subsurface, subsurface);
 
@@ -1193,14 +1646,29 @@ bool wlr_surface_point_accepts_input(struct wlr_surface *surface,
 		pixman_region32_contains_point(&surface->current.input, floor(sx), floor(sy), NULL);
 }
 
+static const struct wlr_box *surface_get_extents(struct wlr_surface *surface);
+
+static struct wlr_surface *subsurface_surface_at(
+		struct wlr_subsurface *subsurface, double sx, double sy,
+		double *sub_x, double *sub_y) {
+	sx -= subsurface->current.x;
+	sy -= subsurface->current.y;
+
+	// Don't descend into subsurface trees which can't contain the point
+	if (!wlr_box_contains_point(surface_get_extents(subsurface->surface),
+			sx, sy)) {
+		return NULL;
+	}
+
+	return wlr_surface_surface_at(subsurface->surface, sx, sy, sub_x, sub_y);
+}
+
 struct wlr_surface *wlr_surface_surface_at(struct wlr_surface *surface,
 		double sx, double sy, double *sub_x, double *sub_y) {
 	struct wlr_subsurface *subsurface;
 	wl_list_for_each_reverse(subsurface, &surface->subsurfaces_above, parent_link) {
-		double _sub_x = subsurface->current.x;
-		double _sub_y = subsurface->current.y;
-		struct wlr_surface *sub = wlr_surface_surface_at(subsurface->surface,
-			sx - _sub_x, sy - _sub_y, sub_x, sub_y);
+		struct wlr_surface *sub =
+			subsurface_surface_at(subsurface, sx, sy, sub_x, sub_y);
 		if (sub != NULL) {
 			return sub;
 		}
@@ -1217,10 +1685,8 @@ struct wlr_surface *wlr_surface_surface_at(struct wlr_surface *surface,
 	}
 
 	wl_list_for_each_reverse(subsurface, &surface->subsurfaces_below, parent_link) {
-		double _sub_x = subsurface->current.x;
-		double _sub_y = subsurface->current.y;
-		struct wlr_surface *sub = wlr_surface_surface_at(subsurface->surface,
-			sx - _sub_x, sy - _sub_y, sub_x, sub_y);
+		struct wlr_surface *sub =
+			subsurface_surface_at(subsurface, sx, sy, sub_x, sub_y);
 		if (sub != NULL) {
 			return sub;
 		}
@@ -1229,12 +1695,16 @@ struct wlr_surface *wlr_surface_surface_at(struct wlr_surface *surface,
 	return NULL;
 }
 
+// Surfaces enter and leave outputs whenever they move across them
+static struct object_pool surface_output_pool =
+	OBJECT_POOL_INIT("wlr_surface_output", struct wlr_surface_output, 64);
+
 static void surface_output_destroy(struct wlr_surface_output *surface_output) {
 	wl_list_remove(&surface_output->bind.link);
 	wl_list_remove(&surface_output->destroy.link);
 	wl_list_remove(&surface_output->link);
 
-	free(surface_output);
+	object_pool_free(&surface_output_pool, surface_output);
 }
 
 static void surface_handle_output_bind(struct wl_listener *listener,
@@ -1268,7 +1738,8 @@ void wlr_surface_send_enter(struct wlr_surface *surface,
 		}
 	}
 
-	surface_output = calloc(1, sizeof(struct wlr_surface_output));
+	surface_output = object_pool_alloc(&surface_output_pool,
+		wl_client_get_display(client));
 	if (surface_output == NULL) {
 		return;
 	}
@@ -1309,8 +1780,37 @@ void wlr_surface_send_leave(struct wlr_surface *surface,
 	}
 }
 
+static bool surface_frame_done_throttled(struct wlr_surface *surface,
+		const struct timespec *when) {
+	struct wlr_surface *root = wlr_surface_get_root_surface(surface);
+	if (root == NULL) {
+		root = surface;
+	}
+	if (root->hidden_frame_interval < 0) {
+		return false;
+	}
+
+	int64_t now = timespec_to_msec(when);
+	if (!root->hidden && !wl_list_empty(&surface->current_outputs)) {
+		surface->last_frame_done = now;
+		return false;
+	}
+
+	if (root->hidden_frame_interval == 0 ||
+			now - surface->last_frame_done < root->hidden_frame_interval) {
+		return true;
+	}
+	surface->last_frame_done = now;
+	return false;
+}
+
 void wlr_surface_send_frame_done(struct wlr_surface *surface,
 		const struct timespec *when) {
+	if (wl_list_empty(&surface->current.frame_callback_list) ||
+			surface_frame_done_throttled(surface, when)) {
+		return;
+	}
+
 	struct wl_resource *resource, *tmp;
 	wl_resource_for_each_safe(resource, tmp,
 			&surface->current.frame_callback_list) {
@@ -1319,6 +1819,37 @@ void wlr_surface_send_frame_done(struct wlr_surface *surface,
 	}
 }
 
+struct wlr_output *wlr_surface_get_primary_output(
+		struct wlr_surface *surface) {
+	struct wlr_output *primary = NULL;
+	struct wlr_surface_output *surface_output;
+	wl_list_for_each(surface_output, &surface->current_outputs, link) {
+		struct wlr_output *output = surface_output->output;
+		if (primary == NULL || output->refresh > primary->refresh) {
+			primary = output;
+		}
+	}
+	return primary;
+}
+
+void wlr_surface_send_frame_done_for_output(struct wlr_surface *surface,
+		struct wlr_output *output, const struct timespec *when) {
+	struct wlr_output *primary = wlr_surface_get_primary_output(surface);
+	if (primary != NULL && primary != output) {
+		return;
+	}
+	wlr_surface_send_frame_done(surface, when);
+}
+
+void wlr_surface_set_hidden_frame_interval(struct wlr_surface *surface,
+		int interval_ms) {
+	surface->hidden_frame_interval = interval_ms;
+}
+
+void wlr_surface_set_visible(struct wlr_surface *surface, bool visible) {
+	surface->hidden = !visible;
+}
+
 static void surface_for_each_surface(struct wlr_surface *surface, int x, int y,
 		wlr_surface_iterator_func_t iterator, void *user_data) {
 	struct wlr_subsurface *subsurface;
@@ -1353,18 +1884,20 @@ struct bound_acc {
 	int32_t max_x, max_y;
 };
 
-static void handle_bounding_box_surface(struct wlr_surface *surface,
-		int x, int y, void *data) {
-	struct bound_acc *acc = data;
-
-	acc->min_x = min(x, acc->min_x);
-	acc->min_y = min(y, acc->min_y);
+static void bound_acc_add(struct bound_acc *acc, const struct wlr_box *box,
+		int x, int y) {
+	acc->min_x = min(x + box->x, acc->min_x);
+	acc->min_y = min(y + box->y, acc->min_y);
 
-	acc->max_x = max(x + surface->current.width, acc->max_x);
-	acc->max_y = max(y + surface->current.height, acc->max_y);
+	acc->max_x = max(x + box->x + box->width, acc->max_x);
+	acc->max_y = max(y + box->y + box->height, acc->max_y);
 }
 
-void wlr_surface_get_extends(struct wlr_surface *surface, struct wlr_box *box) {
+static const struct wlr_box *surface_get_extents(struct wlr_surface *surface) {
+	if (surface->extents_valid) {
+		return &surface->extents;
+	}
+
 	struct bound_acc acc = {
 		.min_x = 0,
 		.min_y = 0,
@@ -1372,12 +1905,28 @@ void wlr_surface_get_extends(struct wlr_surface *surface, struct wlr_box *box) {
 		.max_y = surface->current.height,
 	};
 
-	wlr_surface_for_each_surface(surface, handle_bounding_box_surface, &acc);
+	struct wlr_subsurface *subsurface;
+	wl_list_for_each(subsurface, &surface->subsurfaces_below, parent_link) {
+		bound_acc_add(&acc, surface_get_extents(subsurface->surface),
+			subsurface->current.x, subsurface->current.y);
+	}
+	wl_list_for_each(subsurface, &surface->subsurfaces_above, parent_link) {
+		bound_acc_add(&acc, surface_get_extents(subsurface->surface),
+			subsurface->current.x, subsurface->current.y);
+	}
 
-	box->x = acc.min_x;
-	box->y = acc.min_y;
-	box->width = acc.max_x - acc.min_x;
-	box->height = acc.max_y - acc.min_y;
+	surface->extents = (struct wlr_box){
+		.x = acc.min_x,
+		.y = acc.min_y,
+		.width = acc.max_x - acc.min_x,
+		.height = acc.max_y - acc.min_y,
+	};
+	surface->extents_valid = true;
+	return &surface->extents;
+}
+
+void wlr_surface_get_extends(struct wlr_surface *surface, struct wlr_box *box) {
+	*box = *surface_get_extents(surface);
 }
 
 static void crop_region(pixman_region32_t *dst, pixman_region32_t *src,
@@ -1459,3 +2008,48 @@ void wlr_surface_get_buffer_source_box(struct wlr_surface *surface,
 		}
 	}
 }
+
+void wlr_surface_get_output_opaque_region(struct wlr_surface *surface,
+		int x, int y, float scale, pixman_region32_t *opaque) {
+	pixman_region32_clear(opaque);
+
+	int nrects;
+	pixman_box32_t *rects =
+		pixman_region32_rectangles(&surface->opaque_region, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		int x1 = ceil(rects[i].x1 * scale);
+		int y1 = ceil(rects[i].y1 * scale);
+		int x2 = floor(rects[i].x2 * scale);
+		int y2 = floor(rects[i].y2 * scale);
+		if (x2 <= x1 || y2 <= y1) {
+			continue;
+		}
+		pixman_region32_union_rect(opaque, opaque,
+			x + x1, y + y1, x2 - x1, y2 - y1);
+	}
+}
+
+void wlr_surface_stack_cull(struct wlr_surface_stack_entry *entries,
+		size_t entries_len, float scale, pixman_region32_t *region) {
+	pixman_region32_t opaque;
+	pixman_region32_init(&opaque);
+
+	for (size_t i = entries_len; i-- > 0;) {
+		struct wlr_surface_stack_entry *entry = &entries[i];
+		struct wlr_surface *surface = entry->surface;
+
+		pixman_region32_intersect_rect(&entry->visible, region,
+			entry->x, entry->y,
+			ceil(surface->current.width * scale),
+			ceil(surface->current.height * scale));
+		if (!pixman_region32_not_empty(&entry->visible)) {
+			continue;
+		}
+
+		wlr_surface_get_output_opaque_region(surface,
+			entry->x, entry->y, scale, &opaque);
+		pixman_region32_subtract(region, region, &opaque);
+	}
+
+	pixman_region32_fini(&opaque);
+}
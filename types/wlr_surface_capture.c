@@ -0,0 +1,439 @@
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <math.h>
+#include <stdlib.h>
+#include <wlr/backend.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_box.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/types/wlr_surface_capture.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/log.h>
+#include "backend/backend.h"
+#include "render/allocator.h"
+#include "render/wlr_renderer.h"
+#include "render/wlr_texture.h"
+#include "util/signal.h"
+
+struct render_data {
+	struct wlr_renderer *renderer;
+	struct wlr_box extents;
+	float scale;
+};
+
+static void render_surface_iterator(struct wlr_surface *surface,
+		int sx, int sy, void *_data) {
+	struct render_data *data = _data;
+
+	struct wlr_texture *texture = wlr_surface_get_texture(surface);
+	if (texture == NULL) {
+		return;
+	}
+
+	struct wlr_box box = {
+		.x = round((sx - data->extents.x) * data->scale),
+		.y = round((sy - data->extents.y) * data->scale),
+		.width = round(surface->current.width * data->scale),
+		.height = round(surface->current.height * data->scale),
+	};
+
+	struct wlr_fbox src_box;
+	wlr_surface_get_buffer_source_box(surface, &src_box);
+
+	float identity[9];
+	wlr_matrix_identity(identity);
+	float matrix[9];
+	enum wl_output_transform transform =
+		wlr_output_transform_invert(surface->current.transform);
+	wlr_matrix_project_box(matrix, &box, transform, 0.0, identity);
+
+	wlr_render_subtexture_with_matrix(data->renderer, texture, &src_box,
+		matrix, 1.0);
+}
+
+bool wlr_surface_capture_render(struct wlr_surface *surface,
+		struct wlr_renderer *renderer, struct wlr_buffer *buffer, float scale) {
+	struct render_data data = {
+		.renderer = renderer,
+		.scale = scale,
+	};
+	wlr_surface_get_extends(surface, &data.extents);
+
+	if (!wlr_renderer_begin_with_buffer(renderer, buffer)) {
+		return false;
+	}
+	wlr_renderer_clear(renderer, (float[]){ 0.0, 0.0, 0.0, 0.0 });
+	wlr_surface_for_each_surface(surface, render_surface_iterator, &data);
+	wlr_renderer_end(renderer);
+	return true;
+}
+
+static void count_buffers_iterator(struct wlr_surface *surface,
+		int sx, int sy, void *data) {
+	size_t *count = data;
+	if (wlr_surface_has_buffer(surface)) {
+		(*count)++;
+	}
+}
+
+struct wlr_dmabuf_v1_buffer *wlr_surface_capture_get_dmabuf(
+		struct wlr_surface *surface) {
+	size_t count = 0;
+	wlr_surface_for_each_surface(surface, count_buffers_iterator, &count);
+	if (count != 1 || !wlr_surface_has_buffer(surface)) {
+		return NULL;
+	}
+
+	// The buffer must be displayed without any crop or scale
+	struct wlr_surface_state *state = &surface->current;
+	if (state->transform != WL_OUTPUT_TRANSFORM_NORMAL || state->scale != 1 ||
+			state->viewport.has_src || state->viewport.has_dst) {
+		return NULL;
+	}
+
+	// Once released, the client is free to draw the next frame into it
+	struct wlr_client_buffer *client_buffer = surface->buffer;
+	if (client_buffer->resource == NULL || client_buffer->resource_released ||
+			!wlr_dmabuf_v1_resource_is_buffer(client_buffer->resource)) {
+		return NULL;
+	}
+	return wlr_dmabuf_v1_buffer_from_buffer_resource(client_buffer->resource);
+}
+
+struct snapshot_surface {
+	struct wlr_surface_snapshot *snapshot;
+	struct wlr_surface *surface;
+	struct wlr_xdg_surface *xdg_surface; // NULL if not an xdg surface
+	struct wl_list link; // wlr_surface_snapshot.surfaces
+
+	struct wl_listener commit;
+	struct wl_listener new_subsurface;
+	struct wl_listener destroy;
+	struct wl_listener xdg_new_popup;
+	struct wl_listener xdg_destroy;
+};
+
+static void snapshot_mark_dirty(struct wlr_surface_snapshot *snapshot) {
+	for (size_t i = 0; i < WLR_SURFACE_SNAPSHOT_LEVELS; i++) {
+		snapshot->levels[i].dirty = true;
+	}
+}
+
+static void snapshot_track_surface(struct wlr_surface_snapshot *snapshot,
+	struct wlr_surface *surface);
+
+static void snapshot_surface_destroy(struct snapshot_surface *entry) {
+	wl_list_remove(&entry->link);
+	wl_list_remove(&entry->commit.link);
+	wl_list_remove(&entry->new_subsurface.link);
+	wl_list_remove(&entry->destroy.link);
+	if (entry->xdg_surface != NULL) {
+		wl_list_remove(&entry->xdg_new_popup.link);
+		wl_list_remove(&entry->xdg_destroy.link);
+	}
+	free(entry);
+}
+
+static void snapshot_surface_handle_commit(struct wl_listener *listener,
+		void *data) {
+	struct snapshot_surface *entry =
+		wl_container_of(listener, entry, commit);
+	struct wlr_surface *surface = entry->surface;
+	// Frame callback requests alone don't change the contents, but
+	// subsurfaces may have moved along with the parent commit
+	if (pixman_region32_not_empty(&surface->buffer_damage) ||
+			!wl_list_empty(&surface->subsurfaces_below) ||
+			!wl_list_empty(&surface->subsurfaces_above) ||
+			!wlr_surface_has_buffer(surface)) {
+		snapshot_mark_dirty(entry->snapshot);
+	}
+}
+
+static void snapshot_surface_handle_new_subsurface(
+		struct wl_listener *listener, void *data) {
+	struct snapshot_surface *entry =
+		wl_container_of(listener, entry, new_subsurface);
+	struct wlr_subsurface *subsurface = data;
+	snapshot_track_surface(entry->snapshot, subsurface->surface);
+}
+
+static void snapshot_surface_handle_xdg_new_popup(
+		struct wl_listener *listener, void *data) {
+	struct snapshot_surface *entry =
+		wl_container_of(listener, entry, xdg_new_popup);
+	struct wlr_xdg_popup *popup = data;
+	snapshot_track_surface(entry->snapshot, popup->base->surface);
+}
+
+static void snapshot_surface_handle_xdg_destroy(struct wl_listener *listener,
+		void *data) {
+	struct snapshot_surface *entry =
+		wl_container_of(listener, entry, xdg_destroy);
+	wl_list_remove(&entry->xdg_new_popup.link);
+	wl_list_remove(&entry->xdg_destroy.link);
+	entry->xdg_surface = NULL;
+}
+
+static void snapshot_surface_handle_destroy(struct wl_listener *listener,
+		void *data) {
+	struct snapshot_surface *entry =
+		wl_container_of(listener, entry, destroy);
+	struct wlr_surface_snapshot *snapshot = entry->snapshot;
+	if (entry->surface == snapshot->surface) {
+		// Keep the last contents around
+		snapshot->surface = NULL;
+	} else {
+		snapshot_mark_dirty(snapshot);
+	}
+	snapshot_surface_destroy(entry);
+}
+
+static void snapshot_track_surface(struct wlr_surface_snapshot *snapshot,
+		struct wlr_surface *surface) {
+	struct snapshot_surface *entry;
+	wl_list_for_each(entry, &snapshot->surfaces, link) {
+		if (entry->surface == surface) {
+			return;
+		}
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	entry->snapshot = snapshot;
+	entry->surface = surface;
+	wl_list_insert(&snapshot->surfaces, &entry->link);
+
+	entry->commit.notify = snapshot_surface_handle_commit;
+	wl_signal_add(&surface->events.commit, &entry->commit);
+	entry->new_subsurface.notify = snapshot_surface_handle_new_subsurface;
+	wl_signal_add(&surface->events.new_subsurface, &entry->new_subsurface);
+	entry->destroy.notify = snapshot_surface_handle_destroy;
+	wl_signal_add(&surface->events.destroy, &entry->destroy);
+
+	if (wlr_surface_is_xdg_surface(surface)) {
+		entry->xdg_surface = wlr_xdg_surface_from_wlr_surface(surface);
+	}
+	if (entry->xdg_surface != NULL) {
+		entry->xdg_new_popup.notify = snapshot_surface_handle_xdg_new_popup;
+		wl_signal_add(&entry->xdg_surface->events.new_popup,
+			&entry->xdg_new_popup);
+		entry->xdg_destroy.notify = snapshot_surface_handle_xdg_destroy;
+		wl_signal_add(&entry->xdg_surface->events.destroy,
+			&entry->xdg_destroy);
+
+		struct wlr_xdg_popup *popup;
+		wl_list_for_each(popup, &entry->xdg_surface->popups, link) {
+			snapshot_track_surface(snapshot, popup->base->surface);
+		}
+	}
+
+	struct wlr_subsurface *subsurface;
+	wl_list_for_each(subsurface, &surface->subsurfaces_below, parent_link) {
+		snapshot_track_surface(snapshot, subsurface->surface);
+	}
+	wl_list_for_each(subsurface, &surface->subsurfaces_above, parent_link) {
+		snapshot_track_surface(snapshot, subsurface->surface);
+	}
+	wl_list_for_each(subsurface, &surface->subsurfaces_pending_below,
+			parent_pending_link) {
+		snapshot_track_surface(snapshot, subsurface->surface);
+	}
+	wl_list_for_each(subsurface, &surface->subsurfaces_pending_above,
+			parent_pending_link) {
+		snapshot_track_surface(snapshot, subsurface->surface);
+	}
+}
+
+static void snapshot_for_each_surface(struct wlr_surface *surface,
+		wlr_surface_iterator_func_t iterator, void *data) {
+	if (wlr_surface_is_xdg_surface(surface)) {
+		struct wlr_xdg_surface *xdg_surface =
+			wlr_xdg_surface_from_wlr_surface(surface);
+		if (xdg_surface != NULL) {
+			wlr_xdg_surface_for_each_surface(xdg_surface, iterator, data);
+			return;
+		}
+	}
+	wlr_surface_for_each_surface(surface, iterator, data);
+}
+
+static void extents_iterator(struct wlr_surface *surface,
+		int sx, int sy, void *data) {
+	struct wlr_box *extents = data;
+	if (!wlr_surface_has_buffer(surface)) {
+		return;
+	}
+	struct wlr_box box = {
+		.x = sx,
+		.y = sy,
+		.width = surface->current.width,
+		.height = surface->current.height,
+	};
+	if (wlr_box_empty(extents)) {
+		*extents = box;
+		return;
+	}
+	int x2 = fmax(extents->x + extents->width, box.x + box.width);
+	int y2 = fmax(extents->y + extents->height, box.y + box.height);
+	extents->x = fmin(extents->x, box.x);
+	extents->y = fmin(extents->y, box.y);
+	extents->width = x2 - extents->x;
+	extents->height = y2 - extents->y;
+}
+
+static void snapshot_finish_level(struct wlr_surface_snapshot *snapshot,
+		size_t level) {
+	wlr_texture_destroy(snapshot->levels[level].texture);
+	wlr_buffer_drop(snapshot->levels[level].buffer);
+	snapshot->levels[level].texture = NULL;
+	snapshot->levels[level].buffer = NULL;
+}
+
+static bool snapshot_render_level(struct wlr_surface_snapshot *snapshot,
+		size_t level) {
+	struct wlr_surface *surface = snapshot->surface;
+	if (surface == NULL || !wlr_surface_has_buffer(surface)) {
+		// Unmapped, keep the last contents
+		return false;
+	}
+
+	struct render_data data = {
+		.renderer = snapshot->renderer,
+		.scale = snapshot->scale / (1 << level),
+	};
+	snapshot_for_each_surface(surface, extents_iterator, &data.extents);
+	int width = ceil(data.extents.width * data.scale);
+	int height = ceil(data.extents.height * data.scale);
+	if (width <= 0 || height <= 0) {
+		return false;
+	}
+
+	struct wlr_buffer *buffer = snapshot->levels[level].buffer;
+	if (buffer == NULL || buffer->width != width || buffer->height != height) {
+		const struct wlr_drm_format_set *formats =
+			wlr_renderer_get_render_formats(snapshot->renderer);
+		const struct wlr_drm_format *format = formats != NULL ?
+			wlr_drm_format_set_get(formats, DRM_FORMAT_ARGB8888) : NULL;
+		if (format == NULL) {
+			wlr_log(WLR_ERROR, "Renderer doesn't support ARGB8888");
+			return false;
+		}
+		buffer = wlr_allocator_create_buffer(snapshot->allocator,
+			width, height, format);
+		if (buffer == NULL) {
+			return false;
+		}
+		snapshot_finish_level(snapshot, level);
+		snapshot->levels[level].buffer = buffer;
+	}
+
+	if (!wlr_renderer_begin_with_buffer(snapshot->renderer, buffer)) {
+		return false;
+	}
+	wlr_renderer_clear(snapshot->renderer, (float[]){ 0.0, 0.0, 0.0, 0.0 });
+	snapshot_for_each_surface(surface, render_surface_iterator, &data);
+	wlr_renderer_end(snapshot->renderer);
+
+	// Re-import the buffer, to pick up its new contents
+	wlr_texture_destroy(snapshot->levels[level].texture);
+	snapshot->levels[level].texture =
+		wlr_texture_from_buffer(snapshot->renderer, buffer);
+	if (snapshot->levels[level].texture == NULL) {
+		return false;
+	}
+	snapshot->levels[level].extents = data.extents;
+	return true;
+}
+
+struct wlr_surface_snapshot *wlr_surface_snapshot_create(
+		struct wlr_surface *surface, struct wlr_backend *backend, float scale) {
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(backend);
+	struct wlr_allocator *allocator = backend_get_allocator(backend);
+	if (renderer == NULL || allocator == NULL) {
+		wlr_log(WLR_ERROR, "Surface snapshots need a renderer and "
+			"an allocator");
+		return NULL;
+	}
+
+	struct wlr_surface_snapshot *snapshot = calloc(1, sizeof(*snapshot));
+	if (snapshot == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	snapshot->surface = surface;
+	snapshot->renderer = renderer;
+	snapshot->allocator = allocator;
+	snapshot->scale = scale;
+	wl_signal_init(&snapshot->events.destroy);
+	wl_list_init(&snapshot->surfaces);
+	snapshot_mark_dirty(snapshot);
+
+	snapshot_track_surface(snapshot, surface);
+
+	return snapshot;
+}
+
+void wlr_surface_snapshot_destroy(struct wlr_surface_snapshot *snapshot) {
+	if (snapshot == NULL) {
+		return;
+	}
+	wlr_signal_emit_safe(&snapshot->events.destroy, snapshot);
+
+	struct snapshot_surface *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &snapshot->surfaces, link) {
+		snapshot_surface_destroy(entry);
+	}
+	for (size_t i = 0; i < WLR_SURFACE_SNAPSHOT_LEVELS; i++) {
+		snapshot_finish_level(snapshot, i);
+	}
+	free(snapshot);
+}
+
+void wlr_surface_snapshot_set_scale(struct wlr_surface_snapshot *snapshot,
+		float scale) {
+	if (snapshot->scale == scale) {
+		return;
+	}
+	snapshot->scale = scale;
+	snapshot_mark_dirty(snapshot);
+}
+
+struct wlr_texture *wlr_surface_snapshot_get_texture(
+		struct wlr_surface_snapshot *snapshot, float scale,
+		struct wlr_box *extents) {
+	assert(!snapshot->renderer->rendering);
+
+	// Pick the smallest level at least as large as the destination
+	size_t level = 0;
+	while (level + 1 < WLR_SURFACE_SNAPSHOT_LEVELS &&
+			snapshot->scale / (1 << (level + 1)) >= scale) {
+		level++;
+	}
+
+	if (snapshot->levels[level].dirty &&
+			snapshot_render_level(snapshot, level)) {
+		snapshot->levels[level].dirty = false;
+	}
+
+	// Fall back to the closest level with contents, e.g. when the tree was
+	// unmapped before this level was ever rendered
+	for (size_t i = 0; i < WLR_SURFACE_SNAPSHOT_LEVELS; i++) {
+		size_t candidates[] = { level - i, level + i };
+		for (size_t j = 0; j < 2; j++) {
+			size_t l = candidates[j];
+			if (l < WLR_SURFACE_SNAPSHOT_LEVELS &&
+					snapshot->levels[l].texture != NULL) {
+				*extents = snapshot->levels[l].extents;
+				return snapshot->levels[l].texture;
+			}
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/types/wlr_surface_output_tracker.h>
+#include <wlr/util/log.h>
+#include "util/signal.h"
+
+struct tracker_output {
+	struct wlr_output *output;
+	struct wlr_box box;
+};
+
+static size_t tracker_outputs_len(struct wlr_surface_output_tracker *tracker) {
+	return tracker->outputs.size / sizeof(struct tracker_output);
+}
+
+/**
+ * Compute the outputs the box overlaps, and the one with the largest
+ * intersection.
+ */
+static uint64_t tracker_get_outputs(struct wlr_surface_output_tracker *tracker,
+		const struct wlr_box *box, struct wlr_output **primary) {
+	*primary = NULL;
+	if (wlr_box_empty(box)) {
+		return 0;
+	}
+
+	uint64_t mask = 0;
+	int64_t primary_area = 0;
+	struct tracker_output *outputs = tracker->outputs.data;
+	size_t outputs_len = tracker_outputs_len(tracker);
+	for (size_t i = 0; i < outputs_len; i++) {
+		struct wlr_box intersection;
+		if (!wlr_box_intersection(&intersection, box, &outputs[i].box)) {
+			continue;
+		}
+		mask |= UINT64_C(1) << i;
+		int64_t area = (int64_t)intersection.width * intersection.height;
+		if (area > primary_area) {
+			primary_area = area;
+			*primary = outputs[i].output;
+		}
+	}
+	return mask;
+}
+
+static void tracked_surface_update(struct wlr_tracked_surface *tracked,
+		const struct tracker_output *old_outputs, size_t old_outputs_len,
+		uint64_t old_mask) {
+	struct wlr_surface_output_tracker *tracker = tracked->tracker;
+	struct tracker_output *outputs = tracker->outputs.data;
+	size_t outputs_len = tracker_outputs_len(tracker);
+
+	struct wlr_output *primary;
+	uint64_t mask = tracker_get_outputs(tracker, &tracked->box, &primary);
+	tracked->outputs = mask;
+
+	if (old_outputs == outputs) {
+		// Same outputs, only look at the bits which changed
+		uint64_t changed = mask ^ old_mask;
+		for (size_t i = 0; changed != 0; i++, changed >>= 1) {
+			if (!(changed & 1)) {
+				continue;
+			}
+			if (mask & (UINT64_C(1) << i)) {
+				wlr_surface_send_enter(tracked->surface, outputs[i].output);
+			} else {
+				wlr_surface_send_leave(tracked->surface, outputs[i].output);
+			}
+		}
+	} else {
+		for (size_t i = 0; i < old_outputs_len; i++) {
+			if (!(old_mask & (UINT64_C(1) << i))) {
+				continue;
+			}
+			bool still = false;
+			for (size_t j = 0; j < outputs_len; j++) {
+				if ((mask & (UINT64_C(1) << j)) &&
+						outputs[j].output == old_outputs[i].output) {
+					still = true;
+					break;
+				}
+			}
+			if (!still) {
+				wlr_surface_send_leave(tracked->surface,
+					old_outputs[i].output);
+			}
+		}
+		// Entering an output the surface is already on is a no-op
+		for (size_t j = 0; j < outputs_len; j++) {
+			if (mask & (UINT64_C(1) << j)) {
+				wlr_surface_send_enter(tracked->surface, outputs[j].output);
+			}
+		}
+	}
+
+	if (tracked->primary_output != primary) {
+		tracked->primary_output = primary;
+		wlr_signal_emit_safe(&tracked->events.primary_output, tracked);
+	}
+}
+
+static void tracker_update_outputs(struct wlr_surface_output_tracker *tracker) {
+	struct wl_array old_outputs = tracker->outputs;
+	size_t old_outputs_len = tracker_outputs_len(tracker);
+	wl_array_init(&tracker->outputs);
+
+	struct wlr_output_layout_output *l_output;
+	wl_list_for_each(l_output, &tracker->layout->outputs, link) {
+		if (tracker_outputs_len(tracker) ==
+				WLR_SURFACE_OUTPUT_TRACKER_MAX_OUTPUTS) {
+			wlr_log(WLR_ERROR, "Too many outputs in layout, "
+				"ignoring output '%s'", l_output->output->name);
+			continue;
+		}
+		struct tracker_output *output =
+			wl_array_add(&tracker->outputs, sizeof(*output));
+		if (output == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			break;
+		}
+		output->output = l_output->output;
+		output->box = *wlr_output_layout_get_box(tracker->layout,
+			l_output->output);
+	}
+
+	struct wlr_tracked_surface *tracked, *tmp;
+	wl_list_for_each_safe(tracked, tmp, &tracker->surfaces, link) {
+		tracked_surface_update(tracked, old_outputs.data, old_outputs_len,
+			tracked->outputs);
+	}
+
+	wl_array_release(&old_outputs);
+}
+
+static void tracker_handle_layout_change(struct wl_listener *listener,
+		void *data) {
+	struct wlr_surface_output_tracker *tracker =
+		wl_container_of(listener, tracker, layout_change);
+	tracker_update_outputs(tracker);
+}
+
+static void tracker_handle_layout_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_surface_output_tracker *tracker =
+		wl_container_of(listener, tracker, layout_destroy);
+	wlr_surface_output_tracker_destroy(tracker);
+}
+
+struct wlr_surface_output_tracker *wlr_surface_output_tracker_create(
+		struct wlr_output_layout *layout) {
+	struct wlr_surface_output_tracker *tracker = calloc(1, sizeof(*tracker));
+	if (tracker == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	tracker->layout = layout;
+	wl_list_init(&tracker->surfaces);
+	wl_signal_init(&tracker->events.destroy);
+	wl_array_init(&tracker->outputs);
+
+	tracker->layout_change.notify = tracker_handle_layout_change;
+	wl_signal_add(&layout->events.change, &tracker->layout_change);
+	tracker->layout_destroy.notify = tracker_handle_layout_destroy;
+	wl_signal_add(&layout->events.destroy, &tracker->layout_destroy);
+
+	tracker_update_outputs(tracker);
+
+	return tracker;
+}
+
+static void tracked_surface_destroy(struct wlr_tracked_surface *tracked,
+		bool send_leave) {
+	wlr_signal_emit_safe(&tracked->events.destroy, tracked);
+
+	if (send_leave) {
+		struct tracker_output *outputs = tracked->tracker->outputs.data;
+		for (size_t i = 0; tracked->outputs >> i != 0; i++) {
+			if (tracked->outputs & (UINT64_C(1) << i)) {
+				wlr_surface_send_leave(tracked->surface, outputs[i].output);
+			}
+		}
+	}
+
+	wl_list_remove(&tracked->surface_destroy.link);
+	wl_list_remove(&tracked->link);
+	free(tracked);
+}
+
+void wlr_surface_output_tracker_destroy(
+		struct wlr_surface_output_tracker *tracker) {
+	if (tracker == NULL) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&tracker->events.destroy, tracker);
+
+	struct wlr_tracked_surface *tracked, *tmp;
+	wl_list_for_each_safe(tracked, tmp, &tracker->surfaces, link) {
+		tracked_surface_destroy(tracked, false);
+	}
+
+	wl_list_remove(&tracker->layout_change.link);
+	wl_list_remove(&tracker->layout_destroy.link);
+	wl_array_release(&tracker->outputs);
+	free(tracker);
+}
+
+static void tracked_surface_handle_surface_destroy(
+		struct wl_listener *listener, void *data) {
+	struct wlr_tracked_surface *tracked =
+		wl_container_of(listener, tracked, surface_destroy);
+	tracked_surface_destroy(tracked, false);
+}
+
+struct wlr_tracked_surface *wlr_surface_output_tracker_add(
+		struct wlr_surface_output_tracker *tracker,
+		struct wlr_surface *surface) {
+	struct wlr_tracked_surface *tracked = calloc(1, sizeof(*tracked));
+	if (tracked == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	tracked->tracker = tracker;
+	tracked->surface = surface;
+	wl_signal_init(&tracked->events.primary_output);
+	wl_signal_init(&tracked->events.destroy);
+	wl_list_insert(&tracker->surfaces, &tracked->link);
+
+	tracked->surface_destroy.notify = tracked_surface_handle_surface_destroy;
+	wl_signal_add(&surface->events.destroy, &tracked->surface_destroy);
+
+	return tracked;
+}
+
+void wlr_tracked_surface_set_box(struct wlr_tracked_surface *tracked,
+		const struct wlr_box *box) {
+	if (tracked->box.x == box->x && tracked->box.y == box->y &&
+			tracked->box.width == box->width &&
+			tracked->box.height == box->height) {
+		return;
+	}
+	tracked->box = *box;
+
+	struct wlr_surface_output_tracker *tracker = tracked->tracker;
+	tracked_surface_update(tracked, tracker->outputs.data,
+		tracker_outputs_len(tracker), tracked->outputs);
+}
+
+void wlr_tracked_surface_destroy(struct wlr_tracked_surface *tracked) {
+	if (tracked == NULL) {
+		return;
+	}
+	tracked_surface_destroy(tracked, true);
+}
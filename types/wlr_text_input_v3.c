@@ -62,6 +62,8 @@ void wlr_text_input_v3_send_delete_surrounding_text(
 void wlr_text_input_v3_send_done(struct wlr_text_input_v3 *text_input) {
 	zwp_text_input_v3_send_done(text_input->resource,
 		text_input->current_serial);
+	// done closes a batch of state events, flush it as a whole
+	wl_client_flush(wl_resource_get_client(text_input->resource));
 }
 
 static void wlr_text_input_destroy(struct wlr_text_input_v3 *text_input) {
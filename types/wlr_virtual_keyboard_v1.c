@@ -7,6 +7,7 @@
 #include <wlr/types/wlr_virtual_keyboard_v1.h>
 #include <wlr/util/log.h>
 #include <xkbcommon/xkbcommon.h>
+#include "types/wlr_keyboard.h"
 #include "util/signal.h"
 #include "util/time.h"
 #include "virtual-keyboard-unstable-v1-protocol.h"
@@ -56,30 +57,33 @@ static void virtual_keyboard_keymap(struct wl_client *client,
 	struct wlr_virtual_keyboard_v1 *keyboard =
 		virtual_keyboard_from_resource(resource);
 
-	struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-	if (!context) {
-		goto context_fail;
-	}
 	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
 	if (data == MAP_FAILED) {
-		goto fd_fail;
+		goto fail;
+	}
+	// Clients usually send a keymap they got from the compositor, which has
+	// already been compiled
+	struct xkb_keymap *keymap = keyboard_keymap_cache_find_string(data, size);
+	if (keymap != NULL) {
+		xkb_keymap_ref(keymap);
+	} else {
+		struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+		if (context != NULL) {
+			keymap = xkb_keymap_new_from_string(context, data,
+				XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+			xkb_context_unref(context);
+		}
 	}
-	struct xkb_keymap *keymap = xkb_keymap_new_from_string(context, data,
-		XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
 	munmap(data, size);
 	if (!keymap) {
-		goto keymap_fail;
+		goto fail;
 	}
 	wlr_keyboard_set_keymap(keyboard->input_device.keyboard, keymap);
 	keyboard->has_keymap = true;
 	xkb_keymap_unref(keymap);
-	xkb_context_unref(context);
 	close(fd);
 	return;
-keymap_fail:
-fd_fail:
-	xkb_context_unref(context);
-context_fail:
+fail:
 	wl_client_post_no_memory(client);
 	close(fd);
 }
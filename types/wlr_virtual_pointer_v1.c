@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_virtual_pointer_v1.h>
 #include <wlr/types/wlr_pointer.h>
@@ -11,6 +12,9 @@ static void input_device_destroy(struct wlr_input_device *dev) {
 	struct wlr_virtual_pointer_v1 *pointer =
 		(struct wlr_virtual_pointer_v1 *)dev;
 	wl_resource_set_user_data(pointer->resource, NULL);
+	if (pointer->flush_idle != NULL) {
+		wl_event_source_remove(pointer->flush_idle);
+	}
 	wlr_signal_emit_safe(&pointer->events.destroy, pointer);
 	wl_list_remove(&pointer->link);
 	free(pointer);
@@ -29,6 +33,52 @@ static struct wlr_virtual_pointer_v1 *virtual_pointer_from_resource(
 	return wl_resource_get_user_data(resource);
 }
 
+static void flush_motion(struct wlr_virtual_pointer_v1 *pointer) {
+	struct wlr_pointer *wlr_pointer = pointer->input_device.pointer;
+	switch (pointer->pending_motion_type) {
+	case VIRTUAL_POINTER_MOTION_NONE:
+		return;
+	case VIRTUAL_POINTER_MOTION_RELATIVE:;
+		struct wlr_event_pointer_motion motion = pointer->pending_motion;
+		pointer->pending_motion_type = VIRTUAL_POINTER_MOTION_NONE;
+		wlr_signal_emit_safe(&wlr_pointer->events.motion, &motion);
+		return;
+	case VIRTUAL_POINTER_MOTION_ABSOLUTE:;
+		struct wlr_event_pointer_motion_absolute motion_absolute =
+			pointer->pending_motion_absolute;
+		pointer->pending_motion_type = VIRTUAL_POINTER_MOTION_NONE;
+		wlr_signal_emit_safe(&wlr_pointer->events.motion_absolute,
+			&motion_absolute);
+		return;
+	}
+}
+
+static void handle_flush_idle(void *data) {
+	struct wlr_virtual_pointer_v1 *pointer = data;
+	pointer->flush_idle = NULL;
+	flush_motion(pointer);
+}
+
+static void queue_motion(struct wlr_virtual_pointer_v1 *pointer,
+		enum wlr_virtual_pointer_v1_motion_type type) {
+	if (pointer->pending_motion_type != VIRTUAL_POINTER_MOTION_NONE &&
+			pointer->pending_motion_type != type) {
+		flush_motion(pointer);
+	}
+	pointer->pending_motion_type = type;
+
+	if (pointer->flush_idle == NULL) {
+		struct wl_display *display =
+			wl_client_get_display(wl_resource_get_client(pointer->resource));
+		pointer->flush_idle = wl_event_loop_add_idle(
+			wl_display_get_event_loop(display), handle_flush_idle, pointer);
+		if (pointer->flush_idle == NULL) {
+			// Don't hold on to events we may never deliver
+			flush_motion(pointer);
+		}
+	}
+}
+
 static void virtual_pointer_motion(struct wl_client *client,
 		struct wl_resource *resource, uint32_t time,
 		wl_fixed_t dx, wl_fixed_t dy) {
@@ -37,16 +87,18 @@ static void virtual_pointer_motion(struct wl_client *client,
 	if (pointer == NULL) {
 		return;
 	}
-	struct wlr_input_device *wlr_dev = &pointer->input_device;
-	struct wlr_event_pointer_motion event = {
-		.device = wlr_dev,
-		.time_msec = time,
-		.delta_x = wl_fixed_to_double(dx),
-		.delta_y = wl_fixed_to_double(dy),
-		.unaccel_dx = wl_fixed_to_double(dx),
-		.unaccel_dy = wl_fixed_to_double(dy),
-	};
-	wlr_signal_emit_safe(&wlr_dev->pointer->events.motion, &event);
+	struct wlr_event_pointer_motion *event = &pointer->pending_motion;
+	if (pointer->pending_motion_type != VIRTUAL_POINTER_MOTION_RELATIVE) {
+		memset(event, 0, sizeof(*event));
+		event->device = &pointer->input_device;
+	}
+	// Relative deltas add up exactly, the batch carries the latest time
+	event->time_msec = time;
+	event->delta_x += wl_fixed_to_double(dx);
+	event->delta_y += wl_fixed_to_double(dy);
+	event->unaccel_dx = event->delta_x;
+	event->unaccel_dy = event->delta_y;
+	queue_motion(pointer, VIRTUAL_POINTER_MOTION_RELATIVE);
 }
 
 static void virtual_pointer_motion_absolute(struct wl_client *client,
@@ -60,14 +112,15 @@ static void virtual_pointer_motion_absolute(struct wl_client *client,
 	if (x_extent == 0 || y_extent == 0) {
 		return;
 	}
-	struct wlr_input_device *wlr_dev = &pointer->input_device;
-	struct wlr_event_pointer_motion_absolute event = {
-		.device = wlr_dev,
+	// Only the latest absolute position matters
+	pointer->pending_motion_absolute =
+		(struct wlr_event_pointer_motion_absolute){
+		.device = &pointer->input_device,
 		.time_msec = time,
 		.x = (double)x / x_extent,
 		.y = (double)y / y_extent,
 	};
-	wlr_signal_emit_safe(&wlr_dev->pointer->events.motion_absolute, &event);
+	queue_motion(pointer, VIRTUAL_POINTER_MOTION_ABSOLUTE);
 }
 
 static void virtual_pointer_button(struct wl_client *client,
@@ -78,6 +131,7 @@ static void virtual_pointer_button(struct wl_client *client,
 	if (pointer == NULL) {
 		return;
 	}
+	flush_motion(pointer);
 	struct wlr_input_device *wlr_dev = &pointer->input_device;
 	struct wlr_event_pointer_button event = {
 		.device = wlr_dev,
@@ -120,6 +174,7 @@ static void virtual_pointer_frame(struct wl_client *client,
 	}
 	struct wlr_input_device *wlr_dev = &pointer->input_device;
 
+	flush_motion(pointer);
 	for (size_t i = 0;
 			i < sizeof(pointer->axis_valid) / sizeof(pointer->axis_valid[0]);
 			++i) {
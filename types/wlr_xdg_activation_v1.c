@@ -6,7 +6,9 @@
 #include <wlr/types/wlr_surface.h>
 #include <wlr/types/wlr_xdg_activation_v1.h>
 #include <wlr/util/log.h>
+#include "util/hash_map.h"
 #include "util/signal.h"
+#include "util/time.h"
 #include "util/token.h"
 #include "xdg-activation-v1-protocol.h"
 
@@ -28,9 +30,11 @@ static void token_destroy(struct wlr_xdg_activation_token_v1 *token) {
 	if (token->resource != NULL) {
 		wl_resource_set_user_data(token->resource, NULL); // make inert
 	}
-	if (token->timeout != NULL) {
-		wl_event_source_remove(token->timeout);
+	if (token->token != NULL) {
+		hash_map_remove(token->activation->token_map,
+			hash_string(token->token), token->token);
 	}
+	wl_list_remove(&token->expiry_link);
 	wl_list_remove(&token->link);
 	wl_list_remove(&token->seat_destroy.link);
 	wl_list_remove(&token->surface_destroy.link);
@@ -39,13 +43,65 @@ static void token_destroy(struct wlr_xdg_activation_token_v1 *token) {
 	free(token);
 }
 
-static int token_handle_timeout(void *data) {
-	struct wlr_xdg_activation_token_v1 *token = data;
-	wlr_log(WLR_DEBUG, "Activation token '%s' has expired", token->token);
-	token_destroy(token);
+static int64_t get_monotonic_msec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_msec(&now);
+}
+
+static void update_expiry_timer(struct wlr_xdg_activation_v1 *activation) {
+	if (wl_list_empty(&activation->expiry_queue)) {
+		wl_event_source_timer_update(activation->expiry_timer, 0);
+		return;
+	}
+
+	struct wlr_xdg_activation_token_v1 *token = wl_container_of(
+		activation->expiry_queue.next, token, expiry_link);
+	int64_t delay = token->expire_msec - get_monotonic_msec();
+	// A zero delay would disarm the timer
+	wl_event_source_timer_update(activation->expiry_timer,
+		delay > 0 ? delay : 1);
+}
+
+static int handle_expiry_timer(void *data) {
+	struct wlr_xdg_activation_v1 *activation = data;
+
+	int64_t now = get_monotonic_msec();
+	struct wlr_xdg_activation_token_v1 *token, *token_tmp;
+	wl_list_for_each_safe(token, token_tmp, &activation->expiry_queue,
+			expiry_link) {
+		if (token->expire_msec > now) {
+			break;
+		}
+		wlr_log(WLR_DEBUG, "Activation token '%s' has expired", token->token);
+		token_destroy(token);
+	}
+
+	update_expiry_timer(activation);
 	return 0;
 }
 
+static void token_schedule_expiry(struct wlr_xdg_activation_token_v1 *token) {
+	struct wlr_xdg_activation_v1 *activation = token->activation;
+	token->expire_msec = get_monotonic_msec() + activation->token_timeout_msec;
+
+	// The timeout rarely changes, so the new token almost always goes last
+	struct wl_list *prev = activation->expiry_queue.prev;
+	while (prev != &activation->expiry_queue) {
+		struct wlr_xdg_activation_token_v1 *other =
+			wl_container_of(prev, other, expiry_link);
+		if (other->expire_msec <= token->expire_msec) {
+			break;
+		}
+		prev = prev->prev;
+	}
+	wl_list_insert(prev, &token->expiry_link);
+
+	if (prev == &activation->expiry_queue) {
+		update_expiry_timer(activation);
+	}
+}
+
 static void token_handle_resource_destroy(struct wl_resource *resource) {
 	struct wlr_xdg_activation_token_v1 *token = token_from_resource(resource);
 	token_destroy(token);
@@ -100,18 +156,16 @@ static void token_handle_commit(struct wl_client *client,
 		wl_client_post_no_memory(client);
 		return;
 	}
+	if (!hash_map_set(token->activation->token_map, hash_string(token->token),
+			token->token, token)) {
+		free(token->token);
+		token->token = NULL;
+		wl_client_post_no_memory(client);
+		return;
+	}
 
 	if (token->activation->token_timeout_msec > 0) {
-		struct wl_display *display = wl_client_get_display(client);
-		struct wl_event_loop *loop = wl_display_get_event_loop(display);
-		token->timeout =
-			wl_event_loop_add_timer(loop, token_handle_timeout, token);
-		if (token->timeout == NULL) {
-			wl_client_post_no_memory(client);
-			return;
-		}
-		wl_event_source_timer_update(token->timeout,
-			token->activation->token_timeout_msec);
+		token_schedule_expiry(token);
 	}
 
 	assert(wl_list_empty(&token->link));
@@ -242,6 +296,7 @@ static void activation_handle_get_activation_token(struct wl_client *client,
 		return;
 	}
 	wl_list_init(&token->link);
+	wl_list_init(&token->expiry_link);
 	wl_list_init(&token->seat_destroy.link);
 	wl_list_init(&token->surface_destroy.link);
 
@@ -266,15 +321,9 @@ static void activation_handle_activate(struct wl_client *client,
 		activation_from_resource(activation_resource);
 	struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
 
-	struct wlr_xdg_activation_token_v1 *token;
-	bool found = false;
-	wl_list_for_each(token, &activation->tokens, link) {
-		if (strcmp(token_str, token->token) == 0) {
-			found = true;
-			break;
-		}
-	}
-	if (!found) {
+	struct wlr_xdg_activation_token_v1 *token = hash_map_get(
+		activation->token_map, hash_string(token_str), token_str);
+	if (token == NULL) {
 		wlr_log(WLR_DEBUG, "Rejecting activate request: unknown token");
 		return;
 	}
@@ -319,6 +368,8 @@ static void handle_display_destroy(struct wl_listener *listener, void *data) {
 	}
 
 	wl_list_remove(&activation->display_destroy.link);
+	wl_event_source_remove(activation->expiry_timer);
+	hash_map_destroy(activation->token_map);
 	wl_global_destroy(activation->global);
 	free(activation);
 }
@@ -332,13 +383,31 @@ struct wlr_xdg_activation_v1 *wlr_xdg_activation_v1_create(
 
 	activation->token_timeout_msec = 30000; // 30s
 	wl_list_init(&activation->tokens);
+	wl_list_init(&activation->expiry_queue);
 	wl_signal_init(&activation->events.destroy);
 	wl_signal_init(&activation->events.request_activate);
 
+	activation->token_map = hash_map_create(hash_map_string_equal);
+	if (activation->token_map == NULL) {
+		free(activation);
+		return NULL;
+	}
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(display);
+	activation->expiry_timer =
+		wl_event_loop_add_timer(loop, handle_expiry_timer, activation);
+	if (activation->expiry_timer == NULL) {
+		hash_map_destroy(activation->token_map);
+		free(activation);
+		return NULL;
+	}
+
 	activation->global = wl_global_create(display,
 		&xdg_activation_v1_interface, XDG_ACTIVATION_V1_VERSION, activation,
 		activation_bind);
 	if (activation->global == NULL) {
+		wl_event_source_remove(activation->expiry_timer);
+		hash_map_destroy(activation->token_map);
 		free(activation);
 		return NULL;
 	}
@@ -1,4 +1,5 @@
 #include <wlr/types/wlr_xdg_foreign_registry.h>
+#include "util/hash_map.h"
 #include "util/signal.h"
 #include "util/token.h"
 #include <assert.h>
@@ -14,6 +15,11 @@ bool wlr_xdg_foreign_exported_init(
 		}
 	} while (wlr_xdg_foreign_registry_find_by_handle(registry, exported->handle) != NULL);
 
+	if (!hash_map_set(registry->handle_map, hash_string(exported->handle),
+			exported->handle, exported)) {
+		return false;
+	}
+
 	exported->registry = registry;
 	wl_list_insert(&registry->exported_surfaces, &exported->link);
 
@@ -27,18 +33,15 @@ struct wlr_xdg_foreign_exported *wlr_xdg_foreign_registry_find_by_handle(
 		return NULL;
 	}
 
-	struct wlr_xdg_foreign_exported *exported;
-	wl_list_for_each(exported, &registry->exported_surfaces, link) {
-		if (strcmp(handle, exported->handle) == 0) {
-			return exported;
-		}
-	}
-
-	return NULL;
+	return hash_map_get(registry->handle_map, hash_string(handle), handle);
 }
 
 void wlr_xdg_foreign_exported_finish(struct wlr_xdg_foreign_exported *surface) {
 	wlr_signal_emit_safe(&surface->events.destroy, NULL);
+	if (surface->registry != NULL) {
+		hash_map_remove(surface->registry->handle_map,
+			hash_string(surface->handle), surface->handle);
+	}
 	surface->registry = NULL;
 	wl_list_remove(&surface->link);
 	wl_list_init(&surface->link);
@@ -53,6 +56,8 @@ static void foreign_registry_handle_display_destroy(struct wl_listener *listener
 
 	// Implementations are supposed to remove all surfaces
 	assert(wl_list_empty(&registry->exported_surfaces));
+	wl_list_remove(&registry->display_destroy.link);
+	hash_map_destroy(registry->handle_map);
 	free(registry);
 }
 
@@ -64,6 +69,12 @@ struct wlr_xdg_foreign_registry *wlr_xdg_foreign_registry_create(
 		return NULL;
 	}
 
+	registry->handle_map = hash_map_create(hash_map_string_equal);
+	if (registry->handle_map == NULL) {
+		free(registry);
+		return NULL;
+	}
+
 	registry->display_destroy.notify = foreign_registry_handle_display_destroy;
 	wl_display_add_destroy_listener(display, &registry->display_destroy);
 
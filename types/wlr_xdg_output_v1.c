@@ -55,12 +55,9 @@ static void output_update(struct wlr_xdg_output_v1 *xdg_output) {
 	}
 
 	if (updated) {
-		struct wl_resource *resource;
-		wl_resource_for_each(resource, &xdg_output->resources) {
-			output_send_details(xdg_output, resource);
-		}
-
-		wlr_output_schedule_done(xdg_output->layout_output->output);
+		// Sent along with the other wl_output updates
+		xdg_output->details_dirty = true;
+		wlr_output_schedule_done(layout_output->output);
 	}
 }
 
@@ -72,6 +69,7 @@ static void output_destroy(struct wlr_xdg_output_v1 *output) {
 	}
 	wl_list_remove(&output->destroy.link);
 	wl_list_remove(&output->description.link);
+	wl_list_remove(&output->output_done.link);
 	wl_list_remove(&output->link);
 	free(output);
 }
@@ -178,13 +176,30 @@ static void handle_output_description(struct wl_listener *listener,
 		return;
 	}
 
+	xdg_output->description_dirty = true;
+	wlr_output_schedule_done(output);
+}
+
+static void handle_output_done(struct wl_listener *listener, void *data) {
+	struct wlr_xdg_output_v1 *xdg_output =
+		wl_container_of(listener, xdg_output, output_done);
+	struct wlr_output *output = xdg_output->layout_output->output;
+
+	bool send_description = xdg_output->description_dirty &&
+		output->description != NULL;
 	struct wl_resource *resource;
 	wl_resource_for_each(resource, &xdg_output->resources) {
-		if (wl_resource_get_version(resource) >=
+		if (send_description && wl_resource_get_version(resource) >=
 				OUTPUT_DESCRIPTION_MUTABLE_SINCE_VERSION) {
 			zxdg_output_v1_send_description(resource, output->description);
 		}
+		if (xdg_output->details_dirty) {
+			output_send_details(xdg_output, resource);
+		}
 	}
+
+	xdg_output->details_dirty = false;
+	xdg_output->description_dirty = false;
 }
 
 static void add_output(struct wlr_xdg_output_manager_v1 *manager,
@@ -201,6 +216,8 @@ static void add_output(struct wlr_xdg_output_manager_v1 *manager,
 	output->description.notify = handle_output_description;
 	wl_signal_add(&layout_output->output->events.description,
 		&output->description);
+	output->output_done.notify = handle_output_done;
+	wl_signal_add(&layout_output->output->events.done, &output->output_done);
 	wl_list_insert(&manager->outputs, &output->link);
 	output_update(output);
 }
@@ -131,6 +131,10 @@ static void xdg_touch_grab_enter(struct wlr_seat_touch_grab *grab,
 		uint32_t time, struct wlr_touch_point *point) {
 }
 
+static void xdg_touch_grab_frame(struct wlr_seat_touch_grab *grab) {
+	wlr_seat_touch_send_frame(grab->seat);
+}
+
 static void xdg_touch_grab_cancel(struct wlr_seat_touch_grab *grab) {
 	wlr_seat_touch_end_grab(grab->seat);
 }
@@ -140,6 +144,7 @@ static const struct wlr_touch_grab_interface xdg_touch_grab_impl = {
 	.up = xdg_touch_grab_up,
 	.motion = xdg_touch_grab_motion,
 	.enter = xdg_touch_grab_enter,
+	.frame = xdg_touch_grab_frame,
 	.cancel = xdg_touch_grab_cancel
 };
 
@@ -399,39 +404,32 @@ void wlr_xdg_popup_get_toplevel_coords(struct wlr_xdg_popup *popup,
 	*toplevel_sy = popup_sy;
 }
 
+/**
+ * All of the unconstraining logic works in the coordinate system of the
+ * popup's parent, so that the parent chain only needs to be walked once.
+ */
 static void xdg_popup_box_constraints(struct wlr_xdg_popup *popup,
-		const struct wlr_box *toplevel_sx_box, int *offset_x, int *offset_y) {
-	int popup_width = popup->geometry.width;
-	int popup_height = popup->geometry.height;
-	int anchor_sx = 0, anchor_sy = 0;
-	wlr_xdg_popup_get_anchor_point(popup, &anchor_sx, &anchor_sy);
-	int popup_sx = 0, popup_sy = 0;
-	wlr_xdg_popup_get_toplevel_coords(popup, popup->geometry.x,
-		popup->geometry.y, &popup_sx, &popup_sy);
+		const struct wlr_box *box, int *offset_x, int *offset_y) {
+	const struct wlr_box *geo = &popup->geometry;
 	*offset_x = 0, *offset_y = 0;
 
-	if (popup_sx < toplevel_sx_box->x) {
-		*offset_x = toplevel_sx_box->x - popup_sx;
-	} else if (popup_sx + popup_width >
-			toplevel_sx_box->x + toplevel_sx_box->width) {
-		*offset_x = toplevel_sx_box->x + toplevel_sx_box->width -
-			(popup_sx + popup_width);
+	if (geo->x < box->x) {
+		*offset_x = box->x - geo->x;
+	} else if (geo->x + geo->width > box->x + box->width) {
+		*offset_x = box->x + box->width - (geo->x + geo->width);
 	}
 
-	if (popup_sy < toplevel_sx_box->y) {
-		*offset_y = toplevel_sx_box->y - popup_sy;
-	} else if (popup_sy + popup_height >
-			toplevel_sx_box->y + toplevel_sx_box->height) {
-		*offset_y = toplevel_sx_box->y + toplevel_sx_box->height -
-			(popup_sy + popup_height);
+	if (geo->y < box->y) {
+		*offset_y = box->y - geo->y;
+	} else if (geo->y + geo->height > box->y + box->height) {
+		*offset_y = box->y + box->height - (geo->y + geo->height);
 	}
 }
 
 static bool xdg_popup_unconstrain_flip(struct wlr_xdg_popup *popup,
-		const struct wlr_box *toplevel_sx_box) {
+		const struct wlr_box *box) {
 	int offset_x = 0, offset_y = 0;
-	xdg_popup_box_constraints(popup, toplevel_sx_box,
-		&offset_x, &offset_y);
+	xdg_popup_box_constraints(popup, box, &offset_x, &offset_y);
 
 	if (!offset_x && !offset_y) {
 		return true;
@@ -455,8 +453,7 @@ static bool xdg_popup_unconstrain_flip(struct wlr_xdg_popup *popup,
 	popup->geometry =
 		wlr_xdg_positioner_get_geometry(&popup->positioner);
 
-	xdg_popup_box_constraints(popup, toplevel_sx_box,
-		&offset_x, &offset_y);
+	xdg_popup_box_constraints(popup, box, &offset_x, &offset_y);
 
 	if (!offset_x && !offset_y) {
 		// no longer constrained
@@ -478,10 +475,9 @@ static bool xdg_popup_unconstrain_flip(struct wlr_xdg_popup *popup,
 }
 
 static bool xdg_popup_unconstrain_slide(struct wlr_xdg_popup *popup,
-		const struct wlr_box *toplevel_sx_box) {
+		const struct wlr_box *box) {
 	int offset_x = 0, offset_y = 0;
-	xdg_popup_box_constraints(popup, toplevel_sx_box,
-		&offset_x, &offset_y);
+	xdg_popup_box_constraints(popup, box, &offset_x, &offset_y);
 
 	if (!offset_x && !offset_y) {
 		return true;
@@ -503,28 +499,22 @@ static bool xdg_popup_unconstrain_slide(struct wlr_xdg_popup *popup,
 		popup->geometry.y += offset_y;
 	}
 
-	int toplevel_x = 0, toplevel_y = 0;
-	wlr_xdg_popup_get_toplevel_coords(popup, popup->geometry.x,
-		popup->geometry.y, &toplevel_x, &toplevel_y);
-
-	if (slide_x && toplevel_x < toplevel_sx_box->x) {
-		popup->geometry.x += toplevel_sx_box->x - toplevel_x;
+	if (slide_x && popup->geometry.x < box->x) {
+		popup->geometry.x = box->x;
 	}
-	if (slide_y && toplevel_y < toplevel_sx_box->y) {
-		popup->geometry.y += toplevel_sx_box->y - toplevel_y;
+	if (slide_y && popup->geometry.y < box->y) {
+		popup->geometry.y = box->y;
 	}
 
-	xdg_popup_box_constraints(popup, toplevel_sx_box,
-		&offset_x, &offset_y);
+	xdg_popup_box_constraints(popup, box, &offset_x, &offset_y);
 
 	return !offset_x && !offset_y;
 }
 
 static bool xdg_popup_unconstrain_resize(struct wlr_xdg_popup *popup,
-		const struct wlr_box *toplevel_sx_box) {
+		const struct wlr_box *box) {
 	int offset_x, offset_y;
-	xdg_popup_box_constraints(popup, toplevel_sx_box,
-		&offset_x, &offset_y);
+	xdg_popup_box_constraints(popup, box, &offset_x, &offset_y);
 
 	if (!offset_x && !offset_y) {
 		return true;
@@ -545,21 +535,101 @@ static bool xdg_popup_unconstrain_resize(struct wlr_xdg_popup *popup,
 		popup->geometry.height -= offset_y;
 	}
 
-	xdg_popup_box_constraints(popup, toplevel_sx_box,
-		&offset_x, &offset_y);
+	xdg_popup_box_constraints(popup, box, &offset_x, &offset_y);
 
 	return !offset_x && !offset_y;
 }
 
-void wlr_xdg_popup_unconstrain_from_box(struct wlr_xdg_popup *popup,
-		const struct wlr_box *toplevel_sx_box) {
-	if (xdg_popup_unconstrain_flip(popup, toplevel_sx_box)) {
-		return;
+static bool box_equal(const struct wlr_box *a, const struct wlr_box *b) {
+	return a->x == b->x && a->y == b->y &&
+		a->width == b->width && a->height == b->height;
+}
+
+static bool positioner_equal(const struct wlr_xdg_positioner *a,
+		const struct wlr_xdg_positioner *b) {
+	return box_equal(&a->anchor_rect, &b->anchor_rect) &&
+		a->anchor == b->anchor && a->gravity == b->gravity &&
+		a->constraint_adjustment == b->constraint_adjustment &&
+		a->size.width == b->size.width && a->size.height == b->size.height &&
+		a->offset.x == b->offset.x && a->offset.y == b->offset.y;
+}
+
+/**
+ * Unconstrain a popup from a box in its parent's coordinate system. The
+ * result only depends on the positioner, the current geometry and the box, so
+ * it is cached: repeated configures with unchanged inputs are free.
+ */
+static void xdg_popup_unconstrain(struct wlr_xdg_popup *popup,
+		const struct wlr_box *box) {
+	struct wlr_xdg_popup_unconstrain_cache *cache = &popup->unconstrain_cache;
+	if (cache->valid && box_equal(&cache->box, box)) {
+		if (positioner_equal(&cache->result_positioner, &popup->positioner) &&
+				box_equal(&cache->result_geometry, &popup->geometry)) {
+			// Already unconstrained from this box
+			return;
+		}
+		if (positioner_equal(&cache->positioner, &popup->positioner) &&
+				box_equal(&cache->geometry, &popup->geometry)) {
+			popup->positioner = cache->result_positioner;
+			popup->geometry = cache->result_geometry;
+			return;
+		}
 	}
-	if (xdg_popup_unconstrain_slide(popup, toplevel_sx_box)) {
-		return;
+
+	cache->valid = true;
+	cache->box = *box;
+	cache->positioner = popup->positioner;
+	cache->geometry = popup->geometry;
+
+	if (!xdg_popup_unconstrain_flip(popup, box) &&
+			!xdg_popup_unconstrain_slide(popup, box)) {
+		xdg_popup_unconstrain_resize(popup, box);
 	}
-	if (xdg_popup_unconstrain_resize(popup, toplevel_sx_box)) {
-		return;
+
+	cache->result_positioner = popup->positioner;
+	cache->result_geometry = popup->geometry;
+}
+
+void wlr_xdg_popup_unconstrain_from_box(struct wlr_xdg_popup *popup,
+		const struct wlr_box *toplevel_sx_box) {
+	int parent_sx = 0, parent_sy = 0;
+	wlr_xdg_popup_get_toplevel_coords(popup, 0, 0, &parent_sx, &parent_sy);
+	struct wlr_box box = {
+		.x = toplevel_sx_box->x - parent_sx,
+		.y = toplevel_sx_box->y - parent_sy,
+		.width = toplevel_sx_box->width,
+		.height = toplevel_sx_box->height,
+	};
+	xdg_popup_unconstrain(popup, &box);
+}
+
+static void xdg_surface_unconstrain_popups(struct wlr_xdg_surface *surface,
+		int sx, int sy, const struct wlr_box *toplevel_sx_box) {
+	struct wlr_xdg_popup *popup;
+	wl_list_for_each(popup, &surface->popups, link) {
+		struct wlr_box box = {
+			.x = toplevel_sx_box->x - sx,
+			.y = toplevel_sx_box->y - sy,
+			.width = toplevel_sx_box->width,
+			.height = toplevel_sx_box->height,
+		};
+		xdg_popup_unconstrain(popup, &box);
+
+		// Children are unconstrained after their parent has been moved
+		xdg_surface_unconstrain_popups(popup->base,
+			sx + popup->geometry.x, sy + popup->geometry.y, toplevel_sx_box);
+	}
+}
+
+void wlr_xdg_surface_unconstrain_popups(struct wlr_xdg_surface *surface,
+		const struct wlr_box *toplevel_sx_box) {
+	int sx = 0, sy = 0;
+	if (surface->role == WLR_XDG_SURFACE_ROLE_POPUP) {
+		wlr_xdg_popup_get_toplevel_coords(surface->popup,
+			surface->popup->geometry.x, surface->popup->geometry.y, &sx, &sy);
+	} else {
+		sx = surface->geometry.x;
+		sy = surface->geometry.y;
 	}
+	xdg_surface_unconstrain_popups(surface, sx, sy, toplevel_sx_box);
 }
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include "types/wlr_xdg_shell.h"
+#include "util/ping_timer.h"
 #include "util/signal.h"
 
 #define WM_BASE_VERSION 2
@@ -38,7 +39,7 @@ static void xdg_shell_handle_pong(struct wl_client *wl_client,
 		return;
 	}
 
-	wl_event_source_timer_update(client->ping_timer, 0);
+	ping_timer_entry_stop(client->ping_entry);
 	client->ping_serial = 0;
 }
 
@@ -71,15 +72,14 @@ static void xdg_client_handle_resource_destroy(struct wl_resource *resource) {
 		destroy_xdg_surface(surface);
 	}
 
-	if (client->ping_timer != NULL) {
-		wl_event_source_remove(client->ping_timer);
-	}
+	ping_timer_entry_destroy(client->ping_entry);
 
 	wl_list_remove(&client->link);
 	free(client);
 }
 
-static int xdg_client_ping_timeout(void *user_data) {
+static void xdg_client_ping_timeout(struct ping_timer_entry *entry,
+		void *user_data) {
 	struct wlr_xdg_client *client = user_data;
 
 	struct wlr_xdg_surface *surface;
@@ -88,7 +88,6 @@ static int xdg_client_ping_timeout(void *user_data) {
 	}
 
 	client->ping_serial = 0;
-	return 1;
 }
 
 static void xdg_shell_bind(struct wl_client *wl_client, void *data,
@@ -120,10 +119,9 @@ static void xdg_shell_bind(struct wl_client *wl_client, void *data,
 	wl_list_insert(&xdg_shell->clients, &client->link);
 
 	struct wl_display *display = wl_client_get_display(client->client);
-	struct wl_event_loop *loop = wl_display_get_event_loop(display);
-	client->ping_timer = wl_event_loop_add_timer(loop,
+	client->ping_entry = ping_timer_entry_create(display,
 		xdg_client_ping_timeout, client);
-	if (client->ping_timer == NULL) {
+	if (client->ping_entry == NULL) {
 		wl_client_post_no_memory(client->client);
 	}
 }
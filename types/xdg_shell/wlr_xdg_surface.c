@@ -3,6 +3,7 @@
 #include <string.h>
 #include <wlr/util/log.h>
 #include "types/wlr_xdg_shell.h"
+#include "util/ping_timer.h"
 #include "util/signal.h"
 
 bool wlr_surface_is_xdg_surface(struct wlr_surface *surface) {
@@ -214,6 +215,15 @@ static uint32_t schedule_configure(struct wlr_xdg_surface *surface,
 	}
 }
 
+bool flush_xdg_surface_configure(struct wlr_xdg_surface *surface) {
+	if (surface->configure_idle == NULL) {
+		return false;
+	}
+	wl_event_source_remove(surface->configure_idle);
+	surface_send_configure(surface);
+	return true;
+}
+
 uint32_t schedule_xdg_surface_configure(struct wlr_xdg_surface *surface) {
 	bool pending_same = false;
 
@@ -537,12 +547,15 @@ void wlr_xdg_surface_ping(struct wlr_xdg_surface *surface) {
 		return;
 	}
 
-	surface->client->ping_serial =
-		wl_display_next_serial(wl_client_get_display(surface->client->client));
-	wl_event_source_timer_update(surface->client->ping_timer,
-		surface->client->shell->ping_timeout);
-	xdg_wm_base_send_ping(surface->client->resource,
-		surface->client->ping_serial);
+	struct wlr_xdg_client *client = surface->client;
+	if (client->ping_entry == NULL) {
+		return;
+	}
+
+	client->ping_serial =
+		wl_display_next_serial(wl_client_get_display(client->client));
+	ping_timer_entry_start(client->ping_entry, client->shell->ping_timeout);
+	xdg_wm_base_send_ping(client->resource, client->ping_serial);
 }
 
 void wlr_xdg_toplevel_send_close(struct wlr_xdg_surface *surface) {
@@ -0,0 +1,186 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "types/wlr_xdg_shell.h"
+#include "util/signal.h"
+
+static void transaction_surface_destroy(
+		struct wlr_xdg_configure_transaction_surface *tsurface) {
+	wl_list_remove(&tsurface->surface_commit.link);
+	wl_list_remove(&tsurface->surface_destroy.link);
+	wl_list_remove(&tsurface->link);
+	free(tsurface);
+}
+
+static void transaction_complete(
+		struct wlr_xdg_configure_transaction *transaction) {
+	wlr_signal_emit_safe(&transaction->events.ready, transaction);
+	wlr_xdg_configure_transaction_destroy(transaction);
+}
+
+static void transaction_surface_mark_done(
+		struct wlr_xdg_configure_transaction_surface *tsurface) {
+	struct wlr_xdg_configure_transaction *transaction = tsurface->transaction;
+	if (tsurface->done) {
+		return;
+	}
+	tsurface->done = true;
+
+	assert(transaction->pending > 0);
+	transaction->pending--;
+	if (transaction->committed && transaction->pending == 0) {
+		transaction_complete(transaction);
+	}
+}
+
+static void transaction_surface_handle_commit(struct wl_listener *listener,
+		void *data) {
+	struct wlr_xdg_configure_transaction_surface *tsurface =
+		wl_container_of(listener, tsurface, surface_commit);
+	struct wlr_xdg_surface *surface = tsurface->surface;
+
+	if (!tsurface->transaction->committed || tsurface->done) {
+		return;
+	}
+
+	// The surface may have acked a newer configure already
+	if (!surface->configured ||
+			(int32_t)(surface->configure_serial - tsurface->serial) < 0) {
+		return;
+	}
+	if (surface->role == WLR_XDG_SURFACE_ROLE_NONE ||
+			wlr_surface_has_buffer(surface->surface)) {
+		transaction_surface_mark_done(tsurface);
+	}
+}
+
+static void transaction_surface_handle_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_xdg_configure_transaction_surface *tsurface =
+		wl_container_of(listener, tsurface, surface_destroy);
+	struct wlr_xdg_configure_transaction *transaction = tsurface->transaction;
+
+	bool done = tsurface->done;
+	transaction_surface_destroy(tsurface);
+	if (done) {
+		return;
+	}
+
+	assert(transaction->pending > 0);
+	transaction->pending--;
+	if (transaction->committed && transaction->pending == 0) {
+		transaction_complete(transaction);
+	}
+}
+
+static int transaction_handle_timeout(void *data) {
+	struct wlr_xdg_configure_transaction *transaction = data;
+	wlr_log(WLR_DEBUG, "Configure transaction %p timed out with %zu "
+		"surfaces pending", transaction, transaction->pending);
+	transaction->timed_out = true;
+	transaction_complete(transaction);
+	return 0;
+}
+
+struct wlr_xdg_configure_transaction *wlr_xdg_configure_transaction_create(
+		struct wl_display *display) {
+	struct wlr_xdg_configure_transaction *transaction =
+		calloc(1, sizeof(*transaction));
+	if (transaction == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	transaction->display = display;
+	wl_list_init(&transaction->surfaces);
+	wl_signal_init(&transaction->events.ready);
+	wl_signal_init(&transaction->events.destroy);
+	return transaction;
+}
+
+void wlr_xdg_configure_transaction_destroy(
+		struct wlr_xdg_configure_transaction *transaction) {
+	if (transaction == NULL) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&transaction->events.destroy, transaction);
+
+	struct wlr_xdg_configure_transaction_surface *tsurface, *tmp;
+	wl_list_for_each_safe(tsurface, tmp, &transaction->surfaces, link) {
+		transaction_surface_destroy(tsurface);
+	}
+	if (transaction->timer != NULL) {
+		wl_event_source_remove(transaction->timer);
+	}
+	free(transaction);
+}
+
+bool wlr_xdg_configure_transaction_add_surface(
+		struct wlr_xdg_configure_transaction *transaction,
+		struct wlr_xdg_surface *surface) {
+	assert(!transaction->committed);
+
+	struct wlr_xdg_configure_transaction_surface *tsurface;
+	wl_list_for_each(tsurface, &transaction->surfaces, link) {
+		if (tsurface->surface == surface) {
+			return true;
+		}
+	}
+
+	tsurface = calloc(1, sizeof(*tsurface));
+	if (tsurface == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+	tsurface->transaction = transaction;
+	tsurface->surface = surface;
+
+	tsurface->surface_commit.notify = transaction_surface_handle_commit;
+	wl_signal_add(&surface->surface->events.commit, &tsurface->surface_commit);
+	tsurface->surface_destroy.notify = transaction_surface_handle_destroy;
+	wl_signal_add(&surface->events.destroy, &tsurface->surface_destroy);
+
+	wl_list_insert(transaction->surfaces.prev, &tsurface->link);
+	transaction->pending++;
+	return true;
+}
+
+void wlr_xdg_configure_transaction_commit(
+		struct wlr_xdg_configure_transaction *transaction, uint32_t timeout_ms) {
+	assert(!transaction->committed);
+
+	// Send all configures back-to-back, so that clients receive them in the
+	// same dispatch instead of one idle callback at a time
+	struct wlr_xdg_configure_transaction_surface *tsurface, *tmp;
+	wl_list_for_each_safe(tsurface, tmp, &transaction->surfaces, link) {
+		struct wlr_xdg_surface *surface = tsurface->surface;
+		uint32_t serial = surface->configure_next_serial;
+		if (surface->role != WLR_XDG_SURFACE_ROLE_NONE &&
+				flush_xdg_surface_configure(surface)) {
+			tsurface->serial = serial;
+		} else {
+			// Nothing to wait for
+			tsurface->done = true;
+			transaction->pending--;
+		}
+	}
+
+	transaction->committed = true;
+	if (transaction->pending == 0) {
+		transaction_complete(transaction);
+		return;
+	}
+
+	if (timeout_ms > 0) {
+		struct wl_event_loop *loop =
+			wl_display_get_event_loop(transaction->display);
+		transaction->timer = wl_event_loop_add_timer(loop,
+			transaction_handle_timeout, transaction);
+		if (transaction->timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create transaction timer");
+			transaction_complete(transaction);
+			return;
+		}
+		wl_event_source_timer_update(transaction->timer, timeout_ms);
+	}
+}
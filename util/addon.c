@@ -0,0 +1,47 @@
+#include <assert.h>
+#include <stddef.h>
+#include <wlr/util/addon.h>
+
+void wlr_addon_set_init(struct wlr_addon_set *set) {
+	wl_list_init(&set->addons);
+}
+
+void wlr_addon_set_finish(struct wlr_addon_set *set) {
+	struct wlr_addon *addon, *tmp;
+	wl_list_for_each_safe(addon, tmp, &set->addons, link) {
+		addon->impl->destroy(addon);
+	}
+	assert(wl_list_empty(&set->addons));
+}
+
+void wlr_addon_init(struct wlr_addon *addon, struct wlr_addon_set *set,
+		const void *owner, const struct wlr_addon_interface *impl) {
+	assert(owner != NULL && impl != NULL && impl->destroy != NULL);
+	assert(wlr_addon_find(set, owner, impl) == NULL);
+	addon->impl = impl;
+	addon->owner = owner;
+	wl_list_insert(&set->addons, &addon->link);
+}
+
+void wlr_addon_finish(struct wlr_addon *addon) {
+	wl_list_remove(&addon->link);
+	wl_list_init(&addon->link);
+}
+
+struct wlr_addon *wlr_addon_find(struct wlr_addon_set *set, const void *owner,
+		const struct wlr_addon_interface *impl) {
+	struct wlr_addon *addon;
+	wl_list_for_each(addon, &set->addons, link) {
+		if (addon->owner == owner && addon->impl == impl) {
+			// Move to the front: the same addon is usually looked up on
+			// every use of the object, e.g. each time a buffer is rendered
+			// to or scanned out
+			if (addon->link.prev != &set->addons) {
+				wl_list_remove(&addon->link);
+				wl_list_insert(&set->addons, &addon->link);
+			}
+			return addon;
+		}
+	}
+	return NULL;
+}
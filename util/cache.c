@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "util/cache.h"
+
+uint64_t cache_hash_data(uint64_t hash, const void *data, size_t len) {
+	// FNV-1a
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+uint64_t cache_hash_string(uint64_t hash, const char *str) {
+	return cache_hash_data(hash, str, strlen(str) + 1);
+}
+
+char *cache_get_dir(const char *name) {
+	char path[4096];
+	const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int n;
+	if (xdg_cache_home != NULL && xdg_cache_home[0] == '/') {
+		n = snprintf(path, sizeof(path), "%s/wlroots/%s", xdg_cache_home, name);
+	} else if (home != NULL && home[0] != '\0') {
+		n = snprintf(path, sizeof(path), "%s/.cache/wlroots/%s", home, name);
+	} else {
+		return NULL;
+	}
+	if (n < 0 || (size_t)n >= sizeof(path)) {
+		return NULL;
+	}
+	return strdup(path);
+}
+
+static bool mkdir_parents(char *path) {
+	for (char *p = strchr(path + 1, '/'); ; p = strchr(p + 1, '/')) {
+		if (p != NULL) {
+			*p = '\0';
+		}
+		int ret = mkdir(path, 0700);
+		int err = errno;
+		if (p != NULL) {
+			*p = '/';
+		}
+		if (ret != 0 && err != EEXIST) {
+			return false;
+		}
+		if (p == NULL) {
+			return true;
+		}
+	}
+}
+
+bool cache_write_file(const char *path, const void *data, size_t size) {
+	struct iovec iov = { .iov_base = (void *)data, .iov_len = size };
+	return cache_write_filev(path, &iov, 1);
+}
+
+bool cache_write_filev(const char *path, const struct iovec *iov,
+		size_t iov_len) {
+	char tmp_path[4096 + 8];
+	int n = snprintf(tmp_path, sizeof(tmp_path), "%s", path);
+	if (n < 0 || (size_t)n >= sizeof(tmp_path)) {
+		return false;
+	}
+	char *sep = strrchr(tmp_path, '/');
+	if (sep != NULL && sep != tmp_path) {
+		*sep = '\0';
+		bool ok = mkdir_parents(tmp_path);
+		*sep = '/';
+		if (!ok) {
+			return false;
+		}
+	}
+
+	// Write to a temporary file first, so that concurrent compositors never
+	// see a partial file
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+	int fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		return false;
+	}
+	FILE *f = fdopen(fd, "wb");
+	if (f == NULL) {
+		close(fd);
+		unlink(tmp_path);
+		return false;
+	}
+	bool ok = true;
+	for (size_t i = 0; i < iov_len && ok; i++) {
+		ok = iov[i].iov_len == 0 ||
+			fwrite(iov[i].iov_base, iov[i].iov_len, 1, f) == 1;
+	}
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp_path, path) != 0) {
+		unlink(tmp_path);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,169 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util/hash_map.h"
+
+#define MIN_CAPACITY 16
+
+struct hash_map_entry {
+	uint64_t hash;
+	const void *key; // NULL if the slot is empty
+	void *value;
+};
+
+struct wlr_hash_map {
+	bool (*key_equal)(const void *a, const void *b);
+	struct hash_map_entry *entries;
+	size_t len, cap; // cap is zero or a power of two
+};
+
+struct wlr_hash_map *hash_map_create(
+		bool (*key_equal)(const void *a, const void *b)) {
+	struct wlr_hash_map *map = calloc(1, sizeof(*map));
+	if (map == NULL) {
+		return NULL;
+	}
+	map->key_equal = key_equal;
+	return map;
+}
+
+void hash_map_destroy(struct wlr_hash_map *map) {
+	if (map == NULL) {
+		return;
+	}
+	free(map->entries);
+	free(map);
+}
+
+static bool entry_matches(struct wlr_hash_map *map,
+		const struct hash_map_entry *entry, uint64_t hash, const void *key) {
+	if (entry->hash != hash) {
+		return false;
+	}
+	if (map->key_equal == NULL) {
+		return entry->key == key;
+	}
+	return map->key_equal(entry->key, key);
+}
+
+static struct hash_map_entry *find_entry(struct wlr_hash_map *map,
+		uint64_t hash, const void *key) {
+	if (map->cap == 0) {
+		return NULL;
+	}
+	size_t mask = map->cap - 1;
+	for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+		struct hash_map_entry *entry = &map->entries[i];
+		if (entry->key == NULL) {
+			return NULL;
+		}
+		if (entry_matches(map, entry, hash, key)) {
+			return entry;
+		}
+	}
+}
+
+static void insert_entry(struct hash_map_entry *entries, size_t cap,
+		const struct hash_map_entry *entry) {
+	size_t mask = cap - 1;
+	size_t i = entry->hash & mask;
+	while (entries[i].key != NULL) {
+		i = (i + 1) & mask;
+	}
+	entries[i] = *entry;
+}
+
+static bool grow(struct wlr_hash_map *map) {
+	size_t cap = map->cap > 0 ? 2 * map->cap : MIN_CAPACITY;
+	struct hash_map_entry *entries = calloc(cap, sizeof(*entries));
+	if (entries == NULL) {
+		return false;
+	}
+	for (size_t i = 0; i < map->cap; i++) {
+		if (map->entries[i].key != NULL) {
+			insert_entry(entries, cap, &map->entries[i]);
+		}
+	}
+	free(map->entries);
+	map->entries = entries;
+	map->cap = cap;
+	return true;
+}
+
+void *hash_map_get(struct wlr_hash_map *map, uint64_t hash, const void *key) {
+	struct hash_map_entry *entry = find_entry(map, hash, key);
+	return entry != NULL ? entry->value : NULL;
+}
+
+bool hash_map_set(struct wlr_hash_map *map, uint64_t hash, const void *key,
+		void *value) {
+	assert(key != NULL && value != NULL);
+
+	struct hash_map_entry *entry = find_entry(map, hash, key);
+	if (entry != NULL) {
+		entry->key = key;
+		entry->value = value;
+		return true;
+	}
+
+	// Keep the load factor under 1/2, so that probe sequences stay short
+	if (2 * (map->len + 1) > map->cap && !grow(map)) {
+		return false;
+	}
+	insert_entry(map->entries, map->cap, &(struct hash_map_entry){
+		.hash = hash,
+		.key = key,
+		.value = value,
+	});
+	map->len++;
+	return true;
+}
+
+void *hash_map_remove(struct wlr_hash_map *map, uint64_t hash,
+		const void *key) {
+	struct hash_map_entry *entry = find_entry(map, hash, key);
+	if (entry == NULL) {
+		return NULL;
+	}
+	void *value = entry->value;
+
+	// Shift back the following entries of the cluster which would become
+	// unreachable, instead of leaving a tombstone
+	size_t mask = map->cap - 1;
+	size_t hole = entry - map->entries;
+	for (size_t i = (hole + 1) & mask; map->entries[i].key != NULL;
+			i = (i + 1) & mask) {
+		size_t home = map->entries[i].hash & mask;
+		// Move the entry if its home slot isn't in (hole, i]
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			map->entries[hole] = map->entries[i];
+			hole = i;
+		}
+	}
+	map->entries[hole] = (struct hash_map_entry){0};
+	map->len--;
+	return value;
+}
+
+uint64_t hash_pointer(const void *ptr) {
+	// MurmurHash3 finalizer: pointers have their low bits set to zero
+	uint64_t x = (uint64_t)(uintptr_t)ptr;
+	x ^= x >> 33;
+	x *= UINT64_C(0xff51afd7ed558ccd);
+	x ^= x >> 33;
+	return x;
+}
+
+uint64_t hash_string(const char *str) {
+	// FNV-1a
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	for (; *str != '\0'; str++) {
+		hash ^= (uint8_t)*str;
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+bool hash_map_string_equal(const void *a, const void *b) {
+	return strcmp(a, b) == 0;
+}
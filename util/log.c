@@ -1,9 +1,11 @@
 #define _XOPEN_SOURCE 700 // for snprintf
 #include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
@@ -35,36 +37,145 @@ static void init_start_time(void) {
 	clock_gettime(CLOCK_MONOTONIC, &start_time);
 }
 
-static void log_stderr(enum wlr_log_importance verbosity, const char *fmt,
-		va_list args) {
-	init_start_time();
-
-	if (verbosity > log_importance) {
-		return;
+static bool use_colors(void) {
+	// Looking this up for each message is a syscall
+	static int is_tty = -1;
+	if (is_tty < 0) {
+		is_tty = isatty(STDERR_FILENO);
 	}
+	return colored && is_tty;
+}
+
+#define LOG_ENTRY_SIZE 1024
+
+/**
+ * A formatted message: a timestamp followed by the message text, without the
+ * verbosity header nor the trailing newline.
+ */
+struct log_entry {
+	enum wlr_log_importance verbosity;
+	size_t prefix_len, len;
+	char text[LOG_ENTRY_SIZE];
+};
+
+/**
+ * The last messages, kept around so that they can be dumped after a crash
+ * even if they were too verbose to be printed.
+ */
+static struct {
+	pthread_mutex_t lock;
+	enum wlr_log_importance verbosity;
+	struct log_entry *entries;
+	size_t len, next, count;
+} history = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static unsigned verbosity_index(enum wlr_log_importance verbosity) {
+	return (verbosity < WLR_LOG_IMPORTANCE_LAST) ?
+		verbosity : WLR_LOG_IMPORTANCE_LAST - 1;
+}
+
+/**
+ * Format a message into buf. Returns the full length of the text, which may
+ * exceed the size of the buffer.
+ */
+static size_t format_entry(char *buf, size_t size, size_t *prefix_len,
+		const char *fmt, va_list args) {
+	init_start_time();
 
 	struct timespec ts = {0};
 	clock_gettime(CLOCK_MONOTONIC, &ts);
 	timespec_sub(&ts, &ts, &start_time);
 
-	fprintf(stderr, "%02d:%02d:%02d.%03ld ", (int)(ts.tv_sec / 60 / 60),
-		(int)(ts.tv_sec / 60 % 60), (int)(ts.tv_sec % 60),
-		ts.tv_nsec / 1000000);
+	int n = snprintf(buf, size, "%02d:%02d:%02d.%03ld ",
+		(int)(ts.tv_sec / 60 / 60), (int)(ts.tv_sec / 60 % 60),
+		(int)(ts.tv_sec % 60), ts.tv_nsec / 1000000);
+	if (n < 0 || (size_t)n >= size) {
+		n = 0;
+	}
+	*prefix_len = n;
+
+	int m = vsnprintf(buf + n, size - n, fmt, args);
+	if (m < 0) {
+		buf[n] = '\0';
+		return n;
+	}
+	return n + m;
+}
+
+static void write_entry(int fd, enum wlr_log_importance verbosity,
+		const char *text, size_t prefix_len, size_t len, bool colors) {
+	unsigned c = verbosity_index(verbosity);
+	char header[32];
+	snprintf(header, sizeof(header), "%s ", verbosity_headers[c]);
 
-	unsigned c = (verbosity < WLR_LOG_IMPORTANCE_LAST) ? verbosity : WLR_LOG_IMPORTANCE_LAST - 1;
+	// Write the whole line at once: stderr is unbuffered, and messages of
+	// other threads or processes must not be interleaved
+	struct iovec iov[] = {
+		{ .iov_base = (void *)text, .iov_len = prefix_len },
+		{
+			.iov_base = colors ? (void *)verbosity_colors[c] : header,
+			.iov_len = colors ? strlen(verbosity_colors[c]) : strlen(header),
+		},
+		{ .iov_base = (void *)(text + prefix_len), .iov_len = len - prefix_len },
+		{ .iov_base = colors ? "\x1B[0m\n" : "\n", .iov_len = colors ? 5 : 1 },
+	};
+	ssize_t ret;
+	do {
+		ret = writev(fd, iov, sizeof(iov) / sizeof(iov[0]));
+	} while (ret < 0 && errno == EINTR);
+}
+
+static void log_stderr(enum wlr_log_importance verbosity, const char *fmt,
+		va_list args) {
+	if (verbosity > log_importance) {
+		return;
+	}
 
-	if (colored && isatty(STDERR_FILENO)) {
-		fprintf(stderr, "%s", verbosity_colors[c]);
-	} else {
-		fprintf(stderr, "%s ", verbosity_headers[c]);
+	char buf[LOG_ENTRY_SIZE];
+	char *text = buf;
+	size_t prefix_len;
+	va_list args_copy;
+	va_copy(args_copy, args);
+	size_t len = format_entry(buf, sizeof(buf), &prefix_len, fmt, args_copy);
+	va_end(args_copy);
+	if (len >= sizeof(buf)) {
+		// Long messages are uncommon, only allocate for them
+		text = malloc(len + 1);
+		if (text != NULL) {
+			len = format_entry(text, len + 1, &prefix_len, fmt, args);
+		} else {
+			text = buf;
+			len = sizeof(buf) - 1;
+		}
 	}
 
-	vfprintf(stderr, fmt, args);
+	write_entry(STDERR_FILENO, verbosity, text, prefix_len, len,
+		use_colors());
+
+	if (text != buf) {
+		free(text);
+	}
+}
 
-	if (colored && isatty(STDERR_FILENO)) {
-		fprintf(stderr, "\x1B[0m");
+static void history_record(enum wlr_log_importance verbosity,
+		const char *fmt, va_list args) {
+	pthread_mutex_lock(&history.lock);
+	if (history.len > 0 && verbosity <= history.verbosity) {
+		struct log_entry *entry = &history.entries[history.next];
+		entry->verbosity = verbosity;
+		entry->len = format_entry(entry->text, sizeof(entry->text),
+			&entry->prefix_len, fmt, args);
+		if (entry->len >= sizeof(entry->text)) {
+			entry->len = sizeof(entry->text) - 1;
+		}
+		history.next = (history.next + 1) % history.len;
+		if (history.count < history.len) {
+			history.count++;
+		}
 	}
-	fprintf(stderr, "\n");
+	pthread_mutex_unlock(&history.lock);
 }
 
 static wlr_log_func_t log_callback = log_stderr;
@@ -92,16 +203,69 @@ void wlr_log_init(enum wlr_log_importance verbosity, wlr_log_func_t callback) {
 }
 
 void _wlr_vlog(enum wlr_log_importance verbosity, const char *fmt, va_list args) {
+	// Unlocked read: only a hint to skip formatting in the common case
+	if (verbosity <= history.verbosity && history.len > 0) {
+		va_list args_copy;
+		va_copy(args_copy, args);
+		history_record(verbosity, fmt, args_copy);
+		va_end(args_copy);
+	}
+
+	if (verbosity > log_importance) {
+		return;
+	}
 	log_callback(verbosity, fmt, args);
 }
 
 void _wlr_log(enum wlr_log_importance verbosity, const char *fmt, ...) {
 	va_list args;
 	va_start(args, fmt);
-	log_callback(verbosity, fmt, args);
+	_wlr_vlog(verbosity, fmt, args);
 	va_end(args);
 }
 
+bool wlr_log_set_history(enum wlr_log_importance verbosity, size_t len) {
+	struct log_entry *entries = NULL;
+	if (len > 0) {
+		entries = calloc(len, sizeof(*entries));
+		if (entries == NULL) {
+			return false;
+		}
+	}
+
+	pthread_mutex_lock(&history.lock);
+	struct log_entry *prev = history.entries;
+	history.entries = entries;
+	history.len = len;
+	history.next = history.count = 0;
+	history.verbosity = len > 0 ? verbosity : WLR_SILENT;
+	pthread_mutex_unlock(&history.lock);
+
+	free(prev);
+	return true;
+}
+
+void wlr_log_dump_history(int fd) {
+	// This may be called from a signal handler, possibly while the history
+	// is being written to: don't wait for the lock
+	bool locked = pthread_mutex_trylock(&history.lock) == 0;
+
+	size_t start = (history.next + history.len - history.count) %
+		(history.len > 0 ? history.len : 1);
+	for (size_t i = 0; i < history.count; i++) {
+		const struct log_entry *entry =
+			&history.entries[(start + i) % history.len];
+		size_t len = entry->len < sizeof(entry->text) ?
+			entry->len : sizeof(entry->text) - 1;
+		size_t prefix_len = entry->prefix_len <= len ? entry->prefix_len : 0;
+		write_entry(fd, entry->verbosity, entry->text, prefix_len, len, false);
+	}
+
+	if (locked) {
+		pthread_mutex_unlock(&history.lock);
+	}
+}
+
 enum wlr_log_importance wlr_log_get_verbosity(void) {
 	return log_importance;
 }
@@ -0,0 +1,214 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/util/alloc_stats.h>
+#include "util/object_pool.h"
+
+struct pool_display;
+
+struct pool_state {
+	struct pool_display *display;
+	const struct object_pool *pool;
+	union pool_header *free_list;
+	size_t cached;
+	uint64_t allocated, reused, freed;
+};
+
+struct pool_display {
+	struct wl_display *display; // NULL once destroyed
+	struct wl_listener display_destroy;
+
+	struct pool_state **states; // indexed by object_pool.index - 1
+	size_t states_len;
+	size_t live; // objects in use, across all pools
+};
+
+// Prepended to each object
+union pool_header {
+	struct pool_state *state; // while the object is in use
+	union pool_header *next; // while the object is cached
+	max_align_t align;
+};
+
+static size_t pools_len = 0; // pools which have been assigned an index
+static struct pool_display *last_display = NULL; // lookup cache
+
+static void pool_display_release(struct pool_display *pd) {
+	if (pd->display != NULL || pd->live > 0) {
+		return;
+	}
+	for (size_t i = 0; i < pd->states_len; i++) {
+		free(pd->states[i]);
+	}
+	free(pd->states);
+	free(pd);
+}
+
+static void handle_display_destroy(struct wl_listener *listener, void *data) {
+	struct pool_display *pd = wl_container_of(listener, pd, display_destroy);
+
+	for (size_t i = 0; i < pd->states_len; i++) {
+		struct pool_state *state = pd->states[i];
+		if (state == NULL) {
+			continue;
+		}
+		while (state->free_list != NULL) {
+			union pool_header *hdr = state->free_list;
+			state->free_list = hdr->next;
+			free(hdr);
+		}
+		state->cached = 0;
+	}
+
+	wl_list_remove(&pd->display_destroy.link);
+	pd->display = NULL;
+	if (last_display == pd) {
+		last_display = NULL;
+	}
+	pool_display_release(pd);
+}
+
+static struct pool_display *pool_display_find(struct wl_display *display) {
+	if (last_display != NULL && last_display->display == display) {
+		return last_display;
+	}
+
+	struct wl_listener *listener =
+		wl_display_get_destroy_listener(display, handle_display_destroy);
+	if (listener == NULL) {
+		return NULL;
+	}
+
+	struct pool_display *pd = wl_container_of(listener, pd, display_destroy);
+	last_display = pd;
+	return pd;
+}
+
+static struct pool_display *pool_display_get(struct wl_display *display) {
+	struct pool_display *pd = pool_display_find(display);
+	if (pd != NULL) {
+		return pd;
+	}
+
+	pd = calloc(1, sizeof(*pd));
+	if (pd == NULL) {
+		return NULL;
+	}
+	pd->display = display;
+	pd->display_destroy.notify = handle_display_destroy;
+	wl_display_add_destroy_listener(display, &pd->display_destroy);
+
+	last_display = pd;
+	return pd;
+}
+
+static struct pool_state *pool_state_get(struct pool_display *pd,
+		struct object_pool *pool) {
+	if (pool->index == 0) {
+		pool->index = ++pools_len;
+	}
+
+	if (pool->index > pd->states_len) {
+		struct pool_state **states =
+			realloc(pd->states, pools_len * sizeof(states[0]));
+		if (states == NULL) {
+			return NULL;
+		}
+		memset(&states[pd->states_len], 0,
+			(pools_len - pd->states_len) * sizeof(states[0]));
+		pd->states = states;
+		pd->states_len = pools_len;
+	}
+
+	struct pool_state **state = &pd->states[pool->index - 1];
+	if (*state == NULL) {
+		*state = calloc(1, sizeof(**state));
+		if (*state == NULL) {
+			return NULL;
+		}
+		(*state)->display = pd;
+		(*state)->pool = pool;
+	}
+	return *state;
+}
+
+void *object_pool_alloc(struct object_pool *pool, struct wl_display *display) {
+	struct pool_display *pd = pool_display_get(display);
+	if (pd == NULL) {
+		return NULL;
+	}
+	struct pool_state *state = pool_state_get(pd, pool);
+	if (state == NULL) {
+		return NULL;
+	}
+
+	union pool_header *hdr = state->free_list;
+	if (hdr != NULL) {
+		state->free_list = hdr->next;
+		state->cached--;
+		state->reused++;
+		memset(hdr + 1, 0, pool->size);
+	} else {
+		hdr = calloc(1, sizeof(*hdr) + pool->size);
+		if (hdr == NULL) {
+			return NULL;
+		}
+	}
+
+	hdr->state = state;
+	state->allocated++;
+	pd->live++;
+	return hdr + 1;
+}
+
+void object_pool_free(struct object_pool *pool, void *obj) {
+	if (obj == NULL) {
+		return;
+	}
+
+	union pool_header *hdr = (union pool_header *)obj - 1;
+	struct pool_state *state = hdr->state;
+	struct pool_display *pd = state->display;
+	assert(state->pool == pool);
+
+	state->freed++;
+	pd->live--;
+	if (pd->display == NULL || state->cached >= pool->max_cached) {
+		free(hdr);
+		pool_display_release(pd);
+		return;
+	}
+
+	hdr->next = state->free_list;
+	state->free_list = hdr;
+	state->cached++;
+}
+
+size_t wlr_alloc_stats_get(struct wl_display *display,
+		struct wlr_alloc_stats *stats, size_t len) {
+	struct pool_display *pd = pool_display_find(display);
+	if (pd == NULL) {
+		return 0;
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < pd->states_len; i++) {
+		const struct pool_state *state = pd->states[i];
+		if (state == NULL) {
+			continue;
+		}
+		if (n < len) {
+			stats[n] = (struct wlr_alloc_stats){
+				.name = state->pool->name,
+				.object_size = state->pool->size,
+				.allocated = state->allocated,
+				.reused = state->reused,
+				.freed = state->freed,
+				.live = state->allocated - state->freed,
+				.cached = state->cached,
+			};
+		}
+		n++;
+	}
+	return n;
+}
@@ -0,0 +1,209 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <time.h>
+#include <wlr/util/log.h>
+#include "util/ping_timer.h"
+#include "util/time.h"
+
+struct ping_timer {
+	struct wl_event_source *source;
+	struct wl_list entries; // ping_timer_entry.link, by increasing deadline
+	int64_t armed_deadline; // msec, zero if the timer isn't armed
+	size_t refs;
+
+	struct wl_listener display_destroy;
+};
+
+struct ping_timer_entry {
+	struct ping_timer *timer;
+	struct wl_list link; // ping_timer.entries, empty if not pending
+	int64_t deadline; // msec, CLOCK_MONOTONIC
+
+	ping_timer_func_t func;
+	void *data;
+};
+
+static int64_t get_current_time_ms(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_msec(&now);
+}
+
+static void ping_timer_arm(struct ping_timer *timer, int64_t now) {
+	if (wl_list_empty(&timer->entries)) {
+		// Leave an armed timer alone, it'll find nothing to expire
+		return;
+	}
+
+	struct ping_timer_entry *first =
+		wl_container_of(timer->entries.next, first, link);
+	if (timer->armed_deadline != 0 &&
+			timer->armed_deadline <= first->deadline) {
+		return;
+	}
+
+	int64_t delay = first->deadline - now;
+	if (delay < 1) {
+		delay = 1; // zero would disarm the timer
+	}
+	wl_event_source_timer_update(timer->source, delay);
+	timer->armed_deadline = first->deadline;
+}
+
+static void ping_timer_unref(struct ping_timer *timer) {
+	timer->refs--;
+	if (timer->refs > 0) {
+		return;
+	}
+	wl_event_source_remove(timer->source);
+	wl_list_remove(&timer->display_destroy.link);
+	free(timer);
+}
+
+static int ping_timer_handle_timer(void *data) {
+	struct ping_timer *timer = data;
+	timer->armed_deadline = 0;
+
+	int64_t now = get_current_time_ms();
+
+	// Detach the expired entries first: the callbacks may start or stop
+	// entries
+	struct wl_list expired;
+	wl_list_init(&expired);
+	while (!wl_list_empty(&timer->entries)) {
+		struct ping_timer_entry *entry =
+			wl_container_of(timer->entries.next, entry, link);
+		if (entry->deadline > now) {
+			break;
+		}
+		wl_list_remove(&entry->link);
+		wl_list_insert(expired.prev, &entry->link);
+	}
+
+	// Keep a reference, a callback may destroy the last entry
+	timer->refs++;
+	while (!wl_list_empty(&expired)) {
+		struct ping_timer_entry *entry =
+			wl_container_of(expired.next, entry, link);
+		wl_list_remove(&entry->link);
+		wl_list_init(&entry->link);
+		entry->func(entry, entry->data);
+	}
+	if (timer->refs == 1) {
+		ping_timer_unref(timer);
+		return 0;
+	}
+	timer->refs--;
+
+	ping_timer_arm(timer, now);
+	return 0;
+}
+
+static void ping_timer_handle_display_destroy(struct wl_listener *listener,
+		void *data) {
+	struct ping_timer *timer =
+		wl_container_of(listener, timer, display_destroy);
+	// Entries are destroyed along with their globals, the timer goes away
+	// with the last one
+	wl_list_remove(&timer->display_destroy.link);
+	wl_list_init(&timer->display_destroy.link);
+}
+
+static struct ping_timer *ping_timer_get(struct wl_display *display) {
+	struct wl_listener *listener = wl_display_get_destroy_listener(display,
+		ping_timer_handle_display_destroy);
+	if (listener != NULL) {
+		struct ping_timer *timer =
+			wl_container_of(listener, timer, display_destroy);
+		return timer;
+	}
+
+	struct ping_timer *timer = calloc(1, sizeof(*timer));
+	if (timer == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(display);
+	timer->source = wl_event_loop_add_timer(loop, ping_timer_handle_timer,
+		timer);
+	if (timer->source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add ping timer to event loop");
+		free(timer);
+		return NULL;
+	}
+
+	wl_list_init(&timer->entries);
+	timer->display_destroy.notify = ping_timer_handle_display_destroy;
+	wl_display_add_destroy_listener(display, &timer->display_destroy);
+
+	return timer;
+}
+
+struct ping_timer_entry *ping_timer_entry_create(struct wl_display *display,
+		ping_timer_func_t func, void *data) {
+	struct ping_timer_entry *entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	entry->timer = ping_timer_get(display);
+	if (entry->timer == NULL) {
+		free(entry);
+		return NULL;
+	}
+	entry->timer->refs++;
+
+	wl_list_init(&entry->link);
+	entry->func = func;
+	entry->data = data;
+	return entry;
+}
+
+void ping_timer_entry_destroy(struct ping_timer_entry *entry) {
+	if (entry == NULL) {
+		return;
+	}
+
+	struct ping_timer *timer = entry->timer;
+	wl_list_remove(&entry->link);
+	free(entry);
+	ping_timer_unref(timer);
+}
+
+void ping_timer_entry_start(struct ping_timer_entry *entry,
+		uint32_t timeout_ms) {
+	struct ping_timer *timer = entry->timer;
+	int64_t now = get_current_time_ms();
+
+	int64_t deadline = now + timeout_ms;
+	deadline += PING_TIMER_SLOT_MS - 1;
+	deadline -= deadline % PING_TIMER_SLOT_MS;
+
+	wl_list_remove(&entry->link);
+	entry->deadline = deadline;
+
+	// New deadlines are usually the latest, look for the insertion point
+	// from the end
+	struct wl_list *prev = timer->entries.prev;
+	while (prev != &timer->entries) {
+		struct ping_timer_entry *other = wl_container_of(prev, other, link);
+		if (other->deadline <= deadline) {
+			break;
+		}
+		prev = prev->prev;
+	}
+	wl_list_insert(prev, &entry->link);
+
+	ping_timer_arm(timer, now);
+}
+
+void ping_timer_entry_stop(struct ping_timer_entry *entry) {
+	wl_list_remove(&entry->link);
+	wl_list_init(&entry->link);
+}
+
+bool ping_timer_entry_pending(const struct ping_timer_entry *entry) {
+	return !wl_list_empty(&entry->link);
+}
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <wlr/util/event_loop.h>
+#include <wlr/util/log.h>
+#include "util/priority_loop.h"
+
+struct priority_loop {
+	struct wl_event_loop *loop;
+	struct wl_event_source *source; // in the display's event loop
+
+	struct wl_listener parent_destroy;
+};
+
+static int priority_loop_handle_readable(int fd, uint32_t mask, void *data) {
+	struct priority_loop *prio = data;
+	// Drain everything which is ready without blocking
+	wl_event_loop_dispatch(prio->loop, 0);
+	return 0;
+}
+
+static void priority_loop_handle_parent_destroy(struct wl_listener *listener,
+		void *data) {
+	struct priority_loop *prio =
+		wl_container_of(listener, prio, parent_destroy);
+	wl_list_remove(&prio->parent_destroy.link);
+	wl_event_source_remove(prio->source);
+	wl_event_loop_destroy(prio->loop);
+	free(prio);
+}
+
+static struct priority_loop *priority_loop_find(
+		struct wl_event_loop *parent) {
+	struct wl_listener *listener = wl_event_loop_get_destroy_listener(parent,
+		priority_loop_handle_parent_destroy);
+	if (listener == NULL) {
+		return NULL;
+	}
+	struct priority_loop *prio =
+		wl_container_of(listener, prio, parent_destroy);
+	return prio;
+}
+
+struct wl_event_loop *get_priority_event_loop(struct wl_display *display) {
+	struct wl_event_loop *parent = wl_display_get_event_loop(display);
+	struct priority_loop *prio = priority_loop_find(parent);
+	if (prio != NULL) {
+		return prio->loop;
+	}
+
+	prio = calloc(1, sizeof(*prio));
+	if (prio == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	prio->loop = wl_event_loop_create();
+	if (prio->loop == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create priority event loop");
+		free(prio);
+		return NULL;
+	}
+
+	prio->source = wl_event_loop_add_fd(parent,
+		wl_event_loop_get_fd(prio->loop), WL_EVENT_READABLE,
+		priority_loop_handle_readable, prio);
+	if (prio->source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add priority event loop source");
+		wl_event_loop_destroy(prio->loop);
+		free(prio);
+		return NULL;
+	}
+
+	prio->parent_destroy.notify = priority_loop_handle_parent_destroy;
+	wl_event_loop_add_destroy_listener(parent, &prio->parent_destroy);
+
+	return prio->loop;
+}
+
+int wlr_display_dispatch(struct wl_display *display, int timeout) {
+	struct wl_event_loop *parent = wl_display_get_event_loop(display);
+	struct priority_loop *prio = priority_loop_find(parent);
+	if (prio == NULL) {
+		return wl_event_loop_dispatch(parent, timeout);
+	}
+
+	// Client sockets are dispatched by libwayland, at most one epoll batch
+	// per wl_event_loop_dispatch call. Backend events which became ready
+	// while waiting are handled before that batch, and those which arrived
+	// during it right after.
+	if (wl_event_loop_dispatch(prio->loop, 0) < 0) {
+		return -1;
+	}
+	if (wl_event_loop_dispatch(parent, timeout) < 0) {
+		return -1;
+	}
+	return wl_event_loop_dispatch(prio->loop, 0);
+}
@@ -0,0 +1,113 @@
+#define _GNU_SOURCE // sched_setaffinity, SCHED_RESET_ON_FORK
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <wlr/util/log.h>
+#include <wlr/util/realtime.h>
+#include "util/realtime.h"
+
+// Set once a thread has been made real-time, workers are reset to these
+static bool policy_changed = false;
+static bool affinity_changed = false;
+static cpu_set_t default_affinity;
+
+static bool set_policy(int policy, int priority) {
+	int min = sched_get_priority_min(policy);
+	int max = sched_get_priority_max(policy);
+	if (min < 0 || max < 0) {
+		wlr_log_errno(WLR_ERROR, "Invalid scheduling policy %d", policy);
+		return false;
+	}
+	if (priority == 0) {
+		priority = min;
+	}
+	if (priority < min || priority > max) {
+		wlr_log(WLR_ERROR, "Real-time priority %d out of range [%d, %d]",
+			priority, min, max);
+		return false;
+	}
+
+	struct sched_param param = { .sched_priority = priority };
+	// A thread ID of zero refers to the calling thread
+	if (sched_setscheduler(0, policy | SCHED_RESET_ON_FORK, &param) != 0) {
+		wlr_log_errno(WLR_ERROR, "sched_setscheduler failed");
+		return false;
+	}
+	policy_changed = true;
+
+	wlr_log(WLR_INFO, "Using %s scheduling with priority %d",
+		policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR", priority);
+	return true;
+}
+
+static bool set_affinity(const int *cpus, size_t cpus_len) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (size_t i = 0; i < cpus_len; i++) {
+		if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+			wlr_log(WLR_ERROR, "Invalid CPU %d", cpus[i]);
+			return false;
+		}
+		CPU_SET(cpus[i], &set);
+	}
+
+	cpu_set_t prev;
+	if (!affinity_changed && sched_getaffinity(0, sizeof(prev), &prev) != 0) {
+		wlr_log_errno(WLR_ERROR, "sched_getaffinity failed");
+		return false;
+	}
+
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		wlr_log_errno(WLR_ERROR, "sched_setaffinity failed");
+		return false;
+	}
+	if (!affinity_changed) {
+		default_affinity = prev;
+		affinity_changed = true;
+	}
+	return true;
+}
+
+bool wlr_realtime_set_thread(const struct wlr_realtime_options *options) {
+	if (options->cpus_len > 0 &&
+			!set_affinity(options->cpus, options->cpus_len)) {
+		return false;
+	}
+	if (options->policy != SCHED_OTHER &&
+			!set_policy(options->policy, options->priority)) {
+		return false;
+	}
+	return true;
+}
+
+int worker_thread_create(pthread_t *thread, void *(*start)(void *),
+		void *data) {
+	if (!policy_changed && !affinity_changed) {
+		return pthread_create(thread, NULL, start, data);
+	}
+
+	pthread_attr_t attr;
+	int ret = pthread_attr_init(&attr);
+	if (ret != 0) {
+		return ret;
+	}
+	if (policy_changed) {
+		struct sched_param param = { .sched_priority = 0 };
+		ret = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		if (ret == 0) {
+			ret = pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+		}
+		if (ret == 0) {
+			ret = pthread_attr_setschedparam(&attr, &param);
+		}
+	}
+	if (ret == 0 && affinity_changed) {
+		ret = pthread_attr_setaffinity_np(&attr, sizeof(default_affinity),
+			&default_affinity);
+	}
+	if (ret == 0) {
+		ret = pthread_create(thread, &attr, start, data);
+	}
+	pthread_attr_destroy(&attr);
+	return ret;
+}
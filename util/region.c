@@ -2,9 +2,41 @@
 #include <math.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/types/wlr_box.h>
 #include <wlr/util/region.h>
 
+// Most regions only have a few rectangles: transform them on the stack
+#define REGION_STACK_RECTS 16
+
+static pixman_box32_t *region_rects_alloc(pixman_box32_t *stack_rects,
+		int nrects) {
+	if (nrects <= REGION_STACK_RECTS) {
+		return stack_rects;
+	}
+	return malloc(nrects * sizeof(pixman_box32_t));
+}
+
+/**
+ * Replace the contents of dst with the rectangles. dst may be the region the
+ * rectangles have been computed from.
+ */
+static void region_rects_finish(pixman_region32_t *dst,
+		pixman_box32_t *rects, int nrects, pixman_box32_t *stack_rects) {
+	pixman_region32_fini(dst);
+	if (nrects == 1 && rects[0].x1 < rects[0].x2 &&
+			rects[0].y1 < rects[0].y2) {
+		// Skips the validation and sorting of the general case
+		pixman_region32_init_rect(dst, rects[0].x1, rects[0].y1,
+			rects[0].x2 - rects[0].x1, rects[0].y2 - rects[0].y1);
+	} else {
+		pixman_region32_init_rects(dst, rects, nrects);
+	}
+	if (rects != stack_rects) {
+		free(rects);
+	}
+}
+
 void wlr_region_scale(pixman_region32_t *dst, pixman_region32_t *src,
 		float scale) {
 	wlr_region_scale_xy(dst, src, scale, scale);
@@ -17,10 +49,16 @@ void wlr_region_scale_xy(pixman_region32_t *dst, pixman_region32_t *src,
 		return;
 	}
 
+	if (!pixman_region32_not_empty(src)) {
+		pixman_region32_clear(dst);
+		return;
+	}
+
 	int nrects;
 	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	pixman_box32_t stack_rects[REGION_STACK_RECTS];
+	pixman_box32_t *dst_rects = region_rects_alloc(stack_rects, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
@@ -32,9 +70,7 @@ void wlr_region_scale_xy(pixman_region32_t *dst, pixman_region32_t *src,
 		dst_rects[i].y2 = ceil(src_rects[i].y2 * scale_y);
 	}
 
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	region_rects_finish(dst, dst_rects, nrects, stack_rects);
 }
 
 void wlr_region_transform(pixman_region32_t *dst, pixman_region32_t *src,
@@ -44,10 +80,16 @@ void wlr_region_transform(pixman_region32_t *dst, pixman_region32_t *src,
 		return;
 	}
 
+	if (!pixman_region32_not_empty(src)) {
+		pixman_region32_clear(dst);
+		return;
+	}
+
 	int nrects;
 	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	pixman_box32_t stack_rects[REGION_STACK_RECTS];
+	pixman_box32_t *dst_rects = region_rects_alloc(stack_rects, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
@@ -105,9 +147,7 @@ void wlr_region_transform(pixman_region32_t *dst, pixman_region32_t *src,
 		}
 	}
 
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	region_rects_finish(dst, dst_rects, nrects, stack_rects);
 }
 
 void wlr_region_expand(pixman_region32_t *dst, pixman_region32_t *src,
@@ -117,10 +157,16 @@ void wlr_region_expand(pixman_region32_t *dst, pixman_region32_t *src,
 		return;
 	}
 
+	if (!pixman_region32_not_empty(src)) {
+		pixman_region32_clear(dst);
+		return;
+	}
+
 	int nrects;
 	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	pixman_box32_t stack_rects[REGION_STACK_RECTS];
+	pixman_box32_t *dst_rects = region_rects_alloc(stack_rects, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
@@ -132,9 +178,7 @@ void wlr_region_expand(pixman_region32_t *dst, pixman_region32_t *src,
 		dst_rects[i].y2 = src_rects[i].y2 + distance;
 	}
 
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	region_rects_finish(dst, dst_rects, nrects, stack_rects);
 }
 
 void wlr_region_rotated_bounds(pixman_region32_t *dst, pixman_region32_t *src,
@@ -144,10 +188,16 @@ void wlr_region_rotated_bounds(pixman_region32_t *dst, pixman_region32_t *src,
 		return;
 	}
 
+	if (!pixman_region32_not_empty(src)) {
+		pixman_region32_clear(dst);
+		return;
+	}
+
 	int nrects;
 	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	pixman_box32_t stack_rects[REGION_STACK_RECTS];
+	pixman_box32_t *dst_rects = region_rects_alloc(stack_rects, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
@@ -181,13 +231,29 @@ void wlr_region_rotated_bounds(pixman_region32_t *dst, pixman_region32_t *src,
 		dst_rects[i].y2 = ceil(oy + y2);
 	}
 
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	region_rects_finish(dst, dst_rects, nrects, stack_rects);
+}
+
+/**
+ * The region to confine the pointer to, either as a pixman region or with an
+ * index.
+ */
+struct confine_region {
+	pixman_region32_t *region;
+	const struct wlr_region_lookup *lookup;
+};
+
+static bool confine_region_contains_point(const struct confine_region *region,
+		int x, int y, pixman_box32_t *box) {
+	if (region->lookup != NULL) {
+		return wlr_region_lookup_contains_point(region->lookup, x, y, box);
+	}
+	return pixman_region32_contains_point(region->region, x, y, box);
 }
 
-static void region_confine(pixman_region32_t *region, double x1, double y1, double x2,
-		double y2, double *x2_out, double *y2_out, pixman_box32_t box) {
+static void region_confine(const struct confine_region *region, double x1,
+		double y1, double x2, double y2, double *x2_out, double *y2_out,
+		pixman_box32_t box) {
 	double x_clamped = fmax(fmin(x2, box.x2 - 1), box.x1);
 	double y_clamped = fmax(fmin(y2, box.y2 - 1), box.y1);
 
@@ -214,7 +280,7 @@ static void region_confine(pixman_region32_t *region, double x1, double y1, doub
 	int x_ext = floor(x) + (dx == 0 ? 0 : dx > 0 ? 1 : -1);
 	int y_ext = floor(y) + (dy == 0 ? 0 : dy > 0 ? 1 : -1);
 
-	if (pixman_region32_contains_point(region, x_ext, y_ext, &box)) {
+	if (confine_region_contains_point(region, x_ext, y_ext, &box)) {
 		return region_confine(region, x1, y1, x2, y2, x2_out, y2_out, box);
 	} else if (dx == 0 || dy == 0) {
 		*x2_out = x;
@@ -243,13 +309,195 @@ static void region_confine(pixman_region32_t *region, double x1, double y1, doub
 	}
 }
 
-bool wlr_region_confine(pixman_region32_t *region, double x1, double y1, double x2,
-		double y2, double *x2_out, double *y2_out) {
+static bool confine(const struct confine_region *region, double x1, double y1,
+		double x2, double y2, double *x2_out, double *y2_out) {
 	pixman_box32_t box;
-	if (pixman_region32_contains_point(region, floor(x1), floor(y1), &box)) {
+	if (confine_region_contains_point(region, floor(x1), floor(y1), &box)) {
 		region_confine(region, x1, y1, x2, y2, x2_out, y2_out, box);
 		return true;
 	} else {
 		return false;
 	}
 }
+
+bool wlr_region_confine(pixman_region32_t *region, double x1, double y1, double x2,
+		double y2, double *x2_out, double *y2_out) {
+	struct confine_region confine_region = { .region = region };
+	return confine(&confine_region, x1, y1, x2, y2, x2_out, y2_out);
+}
+
+bool wlr_region_lookup_init(struct wlr_region_lookup *lookup,
+		const pixman_region32_t *region) {
+	*lookup = (struct wlr_region_lookup){0};
+
+	int nrects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(
+		(pixman_region32_t *)region, &nrects);
+	if (nrects == 0) {
+		return true;
+	}
+
+	// Bands are runs of rectangles with the same vertical span
+	int nbands = 1;
+	for (int i = 1; i < nrects; i++) {
+		if (rects[i].y1 != rects[i - 1].y1) {
+			nbands++;
+		}
+	}
+
+	lookup->rects = malloc(nrects * sizeof(*lookup->rects));
+	lookup->bands = malloc(nbands * sizeof(*lookup->bands));
+	if (lookup->rects == NULL || lookup->bands == NULL) {
+		wlr_region_lookup_finish(lookup);
+		return false;
+	}
+	memcpy(lookup->rects, rects, nrects * sizeof(*lookup->rects));
+	lookup->nrects = nrects;
+
+	struct wlr_region_lookup_band *band = NULL;
+	for (int i = 0; i < nrects; i++) {
+		if (band == NULL || rects[i].y1 != band->y1) {
+			band = &lookup->bands[lookup->nbands++];
+			band->y1 = rects[i].y1;
+			band->y2 = rects[i].y2;
+			band->start = i;
+		}
+		band->end = i + 1;
+	}
+	assert(lookup->nbands == nbands);
+
+	return true;
+}
+
+void wlr_region_lookup_finish(struct wlr_region_lookup *lookup) {
+	free(lookup->rects);
+	free(lookup->bands);
+	*lookup = (struct wlr_region_lookup){0};
+}
+
+bool wlr_region_lookup_contains_point(const struct wlr_region_lookup *lookup,
+		int x, int y, pixman_box32_t *box) {
+	// Find the band containing y
+	int lo = 0, hi = lookup->nbands;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (lookup->bands[mid].y2 <= y) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == lookup->nbands || lookup->bands[lo].y1 > y) {
+		return false;
+	}
+
+	// Find the rectangle containing x in the band
+	const struct wlr_region_lookup_band *band = &lookup->bands[lo];
+	lo = band->start;
+	hi = band->end;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (lookup->rects[mid].x2 <= x) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == band->end || lookup->rects[lo].x1 > x) {
+		return false;
+	}
+
+	if (box != NULL) {
+		*box = lookup->rects[lo];
+	}
+	return true;
+}
+
+bool wlr_region_lookup_confine(const struct wlr_region_lookup *lookup,
+		double x1, double y1, double x2, double y2, double *x2_out,
+		double *y2_out) {
+	struct confine_region confine_region = { .lookup = lookup };
+	return confine(&confine_region, x1, y1, x2, y2, x2_out, y2_out);
+}
+
+// Extra pixels worth repainting to save a rectangle when coalescing
+#define REGION_COALESCE_RECT_COST (64 * 64)
+
+static int64_t box_area(const pixman_box32_t *box) {
+	return (int64_t)(box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static void box_union(pixman_box32_t *dst, const pixman_box32_t *a,
+		const pixman_box32_t *b) {
+	dst->x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+	dst->y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+	dst->x2 = a->x2 > b->x2 ? a->x2 : b->x2;
+	dst->y2 = a->y2 > b->y2 ? a->y2 : b->y2;
+}
+
+static void region_coalesce(pixman_region32_t *dst, pixman_region32_t *src,
+		int max_rects) {
+	int nrects;
+	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
+
+	pixman_box32_t stack_rects[REGION_STACK_RECTS];
+	pixman_box32_t *dst_rects = region_rects_alloc(stack_rects, max_rects);
+	if (dst_rects == NULL) {
+		pixman_box32_t extents = *pixman_region32_extents(src);
+		pixman_region32_fini(dst);
+		pixman_region32_init_rects(dst, &extents, 1);
+		return;
+	}
+
+	// Rectangles are sorted in bands: neighbours are usually merged together.
+	// Open a new rectangle when merging would cost more than drawing it.
+	int dst_nrects = 0;
+	for (int i = 0; i < nrects; i++) {
+		const pixman_box32_t *rect = &src_rects[i];
+
+		int best = -1;
+		int64_t best_waste = 0;
+		for (int j = 0; j < dst_nrects; j++) {
+			pixman_box32_t merged;
+			box_union(&merged, &dst_rects[j], rect);
+			int64_t waste = box_area(&merged) - box_area(&dst_rects[j]) -
+				box_area(rect);
+			if (best < 0 || waste < best_waste) {
+				best = j;
+				best_waste = waste;
+			}
+		}
+
+		if (best < 0 || (dst_nrects < max_rects &&
+				best_waste > REGION_COALESCE_RECT_COST)) {
+			dst_rects[dst_nrects++] = *rect;
+		} else {
+			box_union(&dst_rects[best], &dst_rects[best], rect);
+		}
+	}
+
+	region_rects_finish(dst, dst_rects, dst_nrects, stack_rects);
+}
+
+void wlr_region_coalesce(pixman_region32_t *dst, pixman_region32_t *src,
+		int max_rects) {
+	assert(max_rects > 0);
+
+	if (pixman_region32_n_rects(src) <= max_rects) {
+		pixman_region32_copy(dst, src);
+		return;
+	}
+
+	region_coalesce(dst, src, max_rects);
+
+	// Merged rectangles may overlap, in which case pixman splits them into
+	// bands again
+	for (int i = 0; i < 2 && pixman_region32_n_rects(dst) > max_rects; i++) {
+		region_coalesce(dst, dst, max_rects);
+	}
+	if (pixman_region32_n_rects(dst) > max_rects) {
+		pixman_box32_t extents = *pixman_region32_extents(dst);
+		pixman_region32_fini(dst);
+		pixman_region32_init_rects(dst, &extents, 1);
+	}
+}
@@ -1,8 +1,9 @@
-#define _POSIX_C_SOURCE 200112L
+#define _GNU_SOURCE // memfd_create, F_ADD_SEALS
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 #include <wlr/config.h>
@@ -18,17 +19,15 @@ static void randname(char *buf) {
 	}
 }
 
-int create_shm_file(void) {
+static int excl_shm_open(char *name) {
 	int retries = 100;
 	do {
-		char name[] = "/wlroots-XXXXXX";
 		randname(name + strlen(name) - 6);
 
 		--retries;
 		// CLOEXEC is guaranteed to be set by shm_open
 		int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
 		if (fd >= 0) {
-			shm_unlink(name);
 			return fd;
 		}
 	} while (retries > 0 && errno == EEXIST);
@@ -36,6 +35,24 @@ int create_shm_file(void) {
 	return -1;
 }
 
+int create_shm_file(void) {
+#ifdef MFD_CLOEXEC
+	// memfd avoids the name collision dance and allows sealing
+	int memfd = memfd_create("wlroots", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd >= 0) {
+		return memfd;
+	}
+#endif
+
+	char name[] = "/wlroots-XXXXXX";
+	int fd = excl_shm_open(name);
+	if (fd < 0) {
+		return -1;
+	}
+	shm_unlink(name);
+	return fd;
+}
+
 int allocate_shm_file(size_t size) {
 	int fd = create_shm_file();
 	if (fd < 0) {
@@ -51,5 +68,49 @@ int allocate_shm_file(size_t size) {
 		return -1;
 	}
 
+#ifdef F_SEAL_SHRINK
+	// Prevent clients from truncating the file under our mapping, which would
+	// make us SIGBUS. This fails harmlessly for shm_open() files.
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK);
+#endif
+
 	return fd;
 }
+
+bool allocate_shm_file_pair(size_t size, int *rw_fd_ptr, int *ro_fd_ptr) {
+	char name[] = "/wlroots-XXXXXX";
+	int rw_fd = excl_shm_open(name);
+	if (rw_fd < 0) {
+		return false;
+	}
+
+	// CLOEXEC is guaranteed to be set by shm_open
+	int ro_fd = shm_open(name, O_RDONLY, 0);
+	shm_unlink(name);
+	if (ro_fd < 0) {
+		close(rw_fd);
+		return false;
+	}
+
+	// Make sure the file can't be re-opened in read-write mode (e.g. via
+	// /proc/self/fd/)
+	if (fchmod(rw_fd, 0) != 0) {
+		close(rw_fd);
+		close(ro_fd);
+		return false;
+	}
+
+	int ret;
+	do {
+		ret = ftruncate(rw_fd, size);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		close(rw_fd);
+		close(ro_fd);
+		return false;
+	}
+
+	*rw_fd_ptr = rw_fd;
+	*ro_fd_ptr = ro_fd;
+	return true;
+}
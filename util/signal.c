@@ -1,4 +1,188 @@
+#define _POSIX_C_SOURCE 200809L
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "util/hash_map.h"
 #include "util/signal.h"
+#include "util/time.h"
+
+#define PROFILE_SUMMARY_INTERVAL_NS (INT64_C(10) * 1000000000)
+#define PROFILE_SUMMARY_LEN 10
+
+struct listener_stats {
+	wl_notify_func_t notify;
+	struct wl_list link; // profile.stats
+	uint64_t calls;
+	int64_t total_ns, max_ns;
+};
+
+/**
+ * Optional instrumentation of signal emissions, enabled with the
+ * WLR_SIGNAL_PROFILE and WLR_SIGNAL_TRACE environment variables. Listeners
+ * are identified by their notify function.
+ */
+static struct {
+	bool initialized, enabled;
+	bool summary;
+	FILE *trace;
+
+	// Keyed by a pointer to listener_stats.notify
+	struct wlr_hash_map *stats_map;
+	struct wl_list stats; // listener_stats.link
+	size_t stats_len;
+	uint64_t emits;
+	int depth, max_depth;
+	int64_t window_start_ns;
+} profile;
+
+static int64_t get_current_time_nsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_nsec(&now);
+}
+
+static void profile_init(void) {
+	profile.initialized = true;
+
+	const char *summary = getenv("WLR_SIGNAL_PROFILE");
+	profile.summary = summary != NULL && strcmp(summary, "1") == 0;
+
+	const char *trace_path = getenv("WLR_SIGNAL_TRACE");
+	if (trace_path != NULL && trace_path[0] != '\0') {
+		profile.trace = fopen(trace_path, "w");
+		if (profile.trace == NULL) {
+			wlr_log_errno(WLR_ERROR, "Failed to open signal trace '%s'",
+				trace_path);
+		} else {
+			// Chrome's JSON array format, the closing bracket is optional
+			fprintf(profile.trace, "[\n");
+		}
+	}
+
+	wl_list_init(&profile.stats);
+	profile.enabled = profile.summary || profile.trace != NULL;
+	profile.window_start_ns = get_current_time_nsec();
+}
+
+static uint64_t hash_notify(wl_notify_func_t notify) {
+	return hash_pointer((const void *)(uintptr_t)notify);
+}
+
+static bool notify_equal(const void *a, const void *b) {
+	return *(const wl_notify_func_t *)a == *(const wl_notify_func_t *)b;
+}
+
+static struct listener_stats *profile_get_stats(wl_notify_func_t notify) {
+	if (profile.stats_map == NULL) {
+		profile.stats_map = hash_map_create(notify_equal);
+		if (profile.stats_map == NULL) {
+			return NULL;
+		}
+	}
+
+	uint64_t hash = hash_notify(notify);
+	struct listener_stats *stats =
+		hash_map_get(profile.stats_map, hash, &notify);
+	if (stats != NULL) {
+		return stats;
+	}
+
+	stats = calloc(1, sizeof(*stats));
+	if (stats == NULL) {
+		return NULL;
+	}
+	stats->notify = notify;
+	if (!hash_map_set(profile.stats_map, hash, &stats->notify, stats)) {
+		free(stats);
+		return NULL;
+	}
+	wl_list_insert(&profile.stats, &stats->link);
+	profile.stats_len++;
+	return stats;
+}
+
+static int compare_stats(const void *a, const void *b) {
+	const struct listener_stats *sa = a, *sb = b;
+	if (sa->total_ns != sb->total_ns) {
+		return sa->total_ns < sb->total_ns ? 1 : -1;
+	}
+	return 0;
+}
+
+static void profile_print_summary(int64_t now_ns) {
+	struct listener_stats *sorted =
+		calloc(profile.stats_len + 1, sizeof(*sorted));
+	if (sorted == NULL) {
+		return;
+	}
+	size_t len = 0;
+	struct listener_stats *stats;
+	wl_list_for_each(stats, &profile.stats, link) {
+		if (stats->calls > 0) {
+			sorted[len++] = *stats;
+		}
+	}
+	qsort(sorted, len, sizeof(*sorted), compare_stats);
+
+	wlr_log(WLR_INFO, "Signal profile over the last %.1f s: %"PRIu64" emits, "
+		"max nesting depth %d", (now_ns - profile.window_start_ns) / 1e9,
+		profile.emits, profile.max_depth);
+	for (size_t i = 0; i < len && i < PROFILE_SUMMARY_LEN; i++) {
+		const struct listener_stats *stats = &sorted[i];
+		wlr_log(WLR_INFO, "  listener %p: %"PRIu64" calls, "
+			"total %.3f ms, max %.3f ms", (void *)stats->notify,
+			stats->calls, stats->total_ns / 1e6, stats->max_ns / 1e6);
+	}
+	free(sorted);
+
+	// Each summary covers its own time window. The listeners are kept, they
+	// are likely to be called again.
+	wl_list_for_each(stats, &profile.stats, link) {
+		stats->calls = 0;
+		stats->total_ns = stats->max_ns = 0;
+	}
+	profile.emits = 0;
+	profile.max_depth = 0;
+	profile.window_start_ns = now_ns;
+}
+
+static void profile_notify(struct wl_listener *l, void *data) {
+	int64_t start_ns = get_current_time_nsec();
+	int depth = ++profile.depth;
+	if (depth > profile.max_depth) {
+		profile.max_depth = depth;
+	}
+
+	wl_notify_func_t notify = l->notify;
+	// The listener may be destroyed by its notify function
+	l->notify(l, data);
+
+	profile.depth--;
+	int64_t end_ns = get_current_time_nsec();
+	int64_t duration_ns = end_ns - start_ns;
+
+	struct listener_stats *stats = profile_get_stats(notify);
+	if (stats != NULL) {
+		stats->calls++;
+		stats->total_ns += duration_ns;
+		if (duration_ns > stats->max_ns) {
+			stats->max_ns = duration_ns;
+		}
+	}
+
+	if (profile.trace != NULL) {
+		fprintf(profile.trace, "{\"name\":\"%p\",\"ph\":\"X\","
+			"\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+			"\"args\":{\"depth\":%d}},\n", (void *)notify,
+			start_ns / 1e3, duration_ns / 1e3, (int)getpid(),
+			(int)getpid(), depth);
+	}
+}
 
 static void handle_noop(struct wl_listener *listener, void *data) {
 	// Do nothing
@@ -8,6 +192,13 @@ void wlr_signal_emit_safe(struct wl_signal *signal, void *data) {
 	struct wl_listener cursor;
 	struct wl_listener end;
 
+	if (!profile.initialized) {
+		profile_init();
+	}
+	if (profile.enabled) {
+		profile.emits++;
+	}
+
 	/* Add two special markers: one cursor and one end marker. This way, we know
 	 * that we've already called listeners on the left of the cursor and that we
 	 * don't want to call listeners on the right of the end marker. The 'it'
@@ -26,9 +217,20 @@ void wlr_signal_emit_safe(struct wl_signal *signal, void *data) {
 		wl_list_remove(&cursor.link);
 		wl_list_insert(pos, &cursor.link);
 
-		l->notify(l, data);
+		if (profile.enabled) {
+			profile_notify(l, data);
+		} else {
+			l->notify(l, data);
+		}
 	}
 
 	wl_list_remove(&cursor.link);
 	wl_list_remove(&end.link);
+
+	if (profile.summary && profile.depth == 0) {
+		int64_t now_ns = get_current_time_nsec();
+		if (now_ns - profile.window_start_ns >= PROFILE_SUMMARY_INTERVAL_NS) {
+			profile_print_summary(now_ns);
+		}
+	}
 }
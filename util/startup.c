@@ -0,0 +1,49 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <time.h>
+#include <wlr/util/log.h>
+#include "util/startup.h"
+#include "util/time.h"
+#include "util/trace.h"
+
+static struct {
+	bool started;
+	bool done;
+	int64_t start_nsec;
+} startup;
+
+static int64_t get_time_nsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_nsec(&now);
+}
+
+int64_t startup_phase_begin(const char *name) {
+	int64_t now = get_time_nsec();
+	if (!startup.started) {
+		startup.started = true;
+		startup.start_nsec = now;
+	}
+	trace_begin("startup: %s", name);
+	return now;
+}
+
+void startup_phase_end(const char *name, int64_t start_nsec) {
+	trace_end();
+	int64_t now = get_time_nsec();
+	wlr_log(WLR_DEBUG, "Startup phase '%s' took %.3f ms (%.3f ms since start)",
+		name, (double)(now - start_nsec) / 1000000,
+		(double)(now - startup.start_nsec) / 1000000);
+}
+
+void startup_first_commit(const char *output_name) {
+	if (startup.done || !startup.started) {
+		return;
+	}
+	startup.done = true;
+	trace_instant("startup: first commit on %s", output_name);
+	int64_t now = get_time_nsec();
+	wlr_log(WLR_DEBUG, "First frame committed on output '%s' %.3f ms "
+		"after start", output_name,
+		(double)(now - startup.start_nsec) / 1000000);
+}
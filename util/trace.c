@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "util/trace.h"
+
+#define TRACE_MARKER_SIZE 256
+
+static const char *const trace_marker_paths[] = {
+	"/sys/kernel/tracing/trace_marker",
+	"/sys/kernel/debug/tracing/trace_marker",
+};
+
+static struct {
+	bool initialized;
+	int fd;
+	pid_t pid;
+} trace = { .fd = -1 };
+
+static void trace_init(void) {
+	trace.initialized = true;
+
+	const char *env = getenv("WLR_TRACE");
+	if (env == NULL || strcmp(env, "1") != 0) {
+		return;
+	}
+
+	size_t paths_len = sizeof(trace_marker_paths) / sizeof(trace_marker_paths[0]);
+	for (size_t i = 0; i < paths_len; i++) {
+		trace.fd = open(trace_marker_paths[i], O_WRONLY | O_CLOEXEC);
+		if (trace.fd >= 0) {
+			break;
+		}
+	}
+	if (trace.fd < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to open ftrace trace_marker, "
+			"tracing disabled");
+		return;
+	}
+
+	trace.pid = getpid();
+	wlr_log(WLR_INFO, "Tracing enabled");
+}
+
+bool trace_enabled(void) {
+	if (!trace.initialized) {
+		trace_init();
+	}
+	return trace.fd >= 0;
+}
+
+static void trace_write(char type, const uint32_t *cookie,
+		const char *fmt, va_list args) {
+	char buf[TRACE_MARKER_SIZE];
+	int n = snprintf(buf, sizeof(buf), "%c|%d|", type, (int)trace.pid);
+	if (fmt != NULL && n >= 0 && (size_t)n < sizeof(buf)) {
+		int m = vsnprintf(buf + n, sizeof(buf) - n, fmt, args);
+		n = m < 0 ? -1 : n + m;
+	}
+	if (cookie != NULL && n >= 0 && (size_t)n < sizeof(buf)) {
+		n += snprintf(buf + n, sizeof(buf) - n, "|%u", *cookie);
+	}
+	if (n < 0) {
+		return;
+	}
+	if ((size_t)n >= sizeof(buf)) {
+		// Truncated, keep markers well-formed
+		n = sizeof(buf) - 1;
+	}
+	if (write(trace.fd, buf, n) < 0) {
+		// Not much we can do here
+	}
+}
+
+void trace_begin(const char *fmt, ...) {
+	if (!trace_enabled()) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	trace_write('B', NULL, fmt, args);
+	va_end(args);
+}
+
+void trace_end(void) {
+	if (!trace_enabled()) {
+		return;
+	}
+	char buf[32];
+	int n = snprintf(buf, sizeof(buf), "E|%d", (int)trace.pid);
+	if (write(trace.fd, buf, n) < 0) {
+		// Not much we can do here
+	}
+}
+
+void trace_async_begin(uint32_t cookie, const char *fmt, ...) {
+	if (!trace_enabled()) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	trace_write('S', &cookie, fmt, args);
+	va_end(args);
+}
+
+void trace_async_end(uint32_t cookie, const char *fmt, ...) {
+	if (!trace_enabled()) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	trace_write('F', &cookie, fmt, args);
+	va_end(args);
+}
+
+void trace_instant(const char *fmt, ...) {
+	if (!trace_enabled()) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	trace_write('B', NULL, fmt, args);
+	va_end(args);
+	trace_end();
+}
@@ -0,0 +1,521 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wayland-util.h>
+#include <wlr/util/log.h>
+#include "util/cache.h"
+#include "xcursor/cache.h"
+
+/*
+ * Cache file layout, in native byte order:
+ *
+ *   struct cache_header
+ *   struct cache_file[files_len]
+ *   struct cache_cursor[cursors_len]
+ *   struct cache_image[images_len]
+ *   strings, NUL-terminated
+ *   pixels, 8-byte aligned, ARGB
+ *
+ * Images with the same pixels share the same data, and are only stored once.
+ */
+
+#define CACHE_MAGIC 0x58524c57 // "WLRX"
+#define CACHE_VERSION 1
+#define CACHE_IMAGE_MAX_SIZE 0x7fff
+
+struct cache_header {
+	uint32_t magic, version;
+	int32_t size;
+	uint32_t files_len, cursors_len, images_len;
+	uint64_t strings_offset, strings_len;
+	uint64_t pixels_offset, pixels_len;
+};
+
+// A file or directory of the theme, used to detect changes
+struct cache_file {
+	uint32_t path; // offset in strings
+	uint32_t exists;
+	int64_t mtime_sec, mtime_nsec;
+};
+
+struct cache_cursor {
+	uint32_t name; // offset in strings
+	uint32_t first_image, images_len;
+	uint32_t total_delay;
+};
+
+struct cache_image {
+	uint32_t width, height;
+	uint32_t hotspot_x, hotspot_y;
+	uint32_t delay;
+	uint32_t pixels_len;
+	uint64_t pixels; // offset in pixels
+};
+
+struct theme_file {
+	char *path;
+	struct cache_file info;
+};
+
+struct theme_files {
+	struct wl_array files; // struct theme_file
+};
+
+static void add_theme_file(const char *path, void *data) {
+	struct theme_files *files = data;
+	struct theme_file *file = wl_array_add(&files->files, sizeof(*file));
+	if (file == NULL) {
+		return;
+	}
+	*file = (struct theme_file){ .path = strdup(path) };
+
+	struct stat st;
+	if (stat(path, &st) == 0) {
+		file->info.exists = 1;
+		file->info.mtime_sec = st.st_mtim.tv_sec;
+		file->info.mtime_nsec = st.st_mtim.tv_nsec;
+	}
+}
+
+static void theme_files_finish(struct theme_files *files) {
+	struct theme_file *file;
+	wl_array_for_each(file, &files->files) {
+		free(file->path);
+	}
+	wl_array_release(&files->files);
+}
+
+static bool get_theme_files(const char *theme, struct theme_files *files) {
+	wl_array_init(&files->files);
+	xcursor_theme_files(theme, add_theme_file, files);
+
+	struct theme_file *file;
+	wl_array_for_each(file, &files->files) {
+		if (file->path == NULL) {
+			theme_files_finish(files);
+			return false;
+		}
+	}
+	return true;
+}
+
+static char *get_cache_path(const char *theme, int size) {
+	char name[256];
+	int n = snprintf(name, sizeof(name), "%s-%d", theme ? theme : "default",
+		size);
+	if (n < 0 || (size_t)n >= sizeof(name)) {
+		return NULL;
+	}
+	for (char *c = name; *c != '\0'; c++) {
+		if (*c == '/') {
+			*c = '_';
+		}
+	}
+
+	char *dir = cache_get_dir("xcursor");
+	if (dir == NULL) {
+		return NULL;
+	}
+	size_t len = strlen(dir) + 1 + strlen(name) + 1;
+	char *path = malloc(len);
+	if (path != NULL) {
+		snprintf(path, len, "%s/%s", dir, name);
+	}
+	free(dir);
+	return path;
+}
+
+static const char *cache_get_string(const struct xcursor_cache *cache,
+		uint64_t offset) {
+	const struct cache_header *header = cache->data;
+	if (offset >= header->strings_len) {
+		return NULL;
+	}
+	return (const char *)cache->data + header->strings_offset + offset;
+}
+
+static bool cache_validate(const struct xcursor_cache *cache, int size,
+		const struct theme_files *files) {
+	const struct cache_header *header = cache->data;
+	if (cache->len < sizeof(*header) || header->magic != CACHE_MAGIC ||
+			header->version != CACHE_VERSION || header->size != size) {
+		return false;
+	}
+
+	uint64_t files_offset = sizeof(*header);
+	uint64_t cursors_offset =
+		files_offset + (uint64_t)header->files_len * sizeof(struct cache_file);
+	uint64_t images_offset = cursors_offset +
+		(uint64_t)header->cursors_len * sizeof(struct cache_cursor);
+	uint64_t strings_offset = images_offset +
+		(uint64_t)header->images_len * sizeof(struct cache_image);
+	if (header->strings_offset != strings_offset ||
+			header->strings_len == 0 ||
+			header->strings_offset + header->strings_len >
+			header->pixels_offset ||
+			header->pixels_offset % 8 != 0 ||
+			header->pixels_offset > cache->len ||
+			header->pixels_len != cache->len - header->pixels_offset) {
+		return false;
+	}
+	const char *strings = (const char *)cache->data + header->strings_offset;
+	if (strings[header->strings_len - 1] != '\0') {
+		return false;
+	}
+
+	// Check that the theme hasn't changed
+	size_t files_len = files->files.size / sizeof(struct theme_file);
+	if (header->files_len != files_len) {
+		return false;
+	}
+	const struct cache_file *cache_files =
+		(const void *)((const char *)cache->data + files_offset);
+	const struct theme_file *file = files->files.data;
+	for (size_t i = 0; i < files_len; i++) {
+		const char *path = cache_get_string(cache, cache_files[i].path);
+		if (path == NULL || strcmp(path, file[i].path) != 0 ||
+				cache_files[i].exists != file[i].info.exists ||
+				cache_files[i].mtime_sec != file[i].info.mtime_sec ||
+				cache_files[i].mtime_nsec != file[i].info.mtime_nsec) {
+			return false;
+		}
+	}
+
+	const struct cache_cursor *cursors =
+		(const void *)((const char *)cache->data + cursors_offset);
+	for (size_t i = 0; i < header->cursors_len; i++) {
+		if (cache_get_string(cache, cursors[i].name) == NULL ||
+				cursors[i].images_len == 0 ||
+				(uint64_t)cursors[i].first_image + cursors[i].images_len >
+				header->images_len) {
+			return false;
+		}
+	}
+
+	const struct cache_image *images =
+		(const void *)((const char *)cache->data + images_offset);
+	for (size_t i = 0; i < header->images_len; i++) {
+		const struct cache_image *image = &images[i];
+		if (image->width == 0 || image->height == 0 ||
+				image->width > CACHE_IMAGE_MAX_SIZE ||
+				image->height > CACHE_IMAGE_MAX_SIZE ||
+				image->pixels_len != image->width * image->height * 4 ||
+				image->pixels > header->pixels_len ||
+				image->pixels_len > header->pixels_len - image->pixels) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct xcursor_cache *xcursor_cache_open(const char *theme, int size) {
+	char *path = get_cache_path(theme, size);
+	if (path == NULL) {
+		return NULL;
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+			(size_t)st.st_size < sizeof(struct cache_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	struct xcursor_cache *cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		close(fd);
+		return NULL;
+	}
+	cache->len = st.st_size;
+	cache->data = mmap(NULL, cache->len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (cache->data == MAP_FAILED) {
+		free(cache);
+		return NULL;
+	}
+
+	struct theme_files files;
+	if (!get_theme_files(theme, &files)) {
+		xcursor_cache_destroy(cache);
+		return NULL;
+	}
+	bool valid = cache_validate(cache, size, &files);
+	theme_files_finish(&files);
+	if (!valid) {
+		wlr_log(WLR_DEBUG, "Cursor cache of theme '%s' is outdated",
+			theme ? theme : "default");
+		xcursor_cache_destroy(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void xcursor_cache_destroy(struct xcursor_cache *cache) {
+	if (cache == NULL) {
+		return;
+	}
+	munmap(cache->data, cache->len);
+	free(cache);
+}
+
+bool xcursor_cache_load_cursors(struct xcursor_cache *cache,
+		struct wlr_xcursor_theme *theme) {
+	const struct cache_header *header = cache->data;
+	const char *data = cache->data;
+	const struct cache_cursor *cursors = (const void *)(data +
+		sizeof(*header) + header->files_len * sizeof(struct cache_file));
+	const struct cache_image *images =
+		(const void *)(cursors + header->cursors_len);
+	uint8_t *pixels = (uint8_t *)cache->data + header->pixels_offset;
+
+	theme->cursors = calloc(header->cursors_len, sizeof(theme->cursors[0]));
+	if (theme->cursors == NULL && header->cursors_len > 0) {
+		return false;
+	}
+
+	for (size_t i = 0; i < header->cursors_len; i++) {
+		const struct cache_cursor *cache_cursor = &cursors[i];
+		struct wlr_xcursor *cursor = calloc(1, sizeof(*cursor));
+		if (cursor == NULL) {
+			return false;
+		}
+		theme->cursors[theme->cursor_count++] = cursor;
+
+		// The name and images are freed with the theme
+		cursor->name = strdup(cache_get_string(cache, cache_cursor->name));
+		cursor->images = calloc(cache_cursor->images_len,
+			sizeof(cursor->images[0]) + sizeof(struct wlr_xcursor_image));
+		if (cursor->name == NULL || cursor->images == NULL) {
+			return false;
+		}
+		struct wlr_xcursor_image *cursor_images =
+			(void *)(cursor->images + cache_cursor->images_len);
+		for (size_t j = 0; j < cache_cursor->images_len; j++) {
+			const struct cache_image *cache_image =
+				&images[cache_cursor->first_image + j];
+			struct wlr_xcursor_image *image = &cursor_images[j];
+			*image = (struct wlr_xcursor_image){
+				.width = cache_image->width,
+				.height = cache_image->height,
+				.hotspot_x = cache_image->hotspot_x,
+				.hotspot_y = cache_image->hotspot_y,
+				.delay = cache_image->delay,
+				.buffer = pixels + cache_image->pixels,
+			};
+			cursor->images[j] = image;
+		}
+		cursor->image_count = cache_cursor->images_len;
+		cursor->total_delay = cache_cursor->total_delay;
+	}
+
+	return true;
+}
+
+struct cache_writer {
+	struct wl_array files; // struct cache_file
+	struct wl_array cursors; // struct cache_cursor
+	struct wl_array images; // struct cache_image
+	struct wl_array strings;
+	struct wl_array pixels;
+	struct wl_array blobs; // struct cache_blob
+};
+
+struct cache_blob {
+	uint64_t hash;
+	uint64_t offset;
+	uint32_t len;
+};
+
+static bool writer_add_string(struct cache_writer *writer, const char *str,
+		uint32_t *offset) {
+	size_t len = strlen(str) + 1;
+	*offset = writer->strings.size;
+	char *dst = wl_array_add(&writer->strings, len);
+	if (dst == NULL) {
+		return false;
+	}
+	memcpy(dst, str, len);
+	return true;
+}
+
+static bool writer_add_pixels(struct cache_writer *writer,
+		const void *data, uint32_t len, uint64_t *offset) {
+	uint64_t hash = cache_hash_data(CACHE_HASH_INIT, data, len);
+	const char *pixels = writer->pixels.data;
+	struct cache_blob *blob;
+	wl_array_for_each(blob, &writer->blobs) {
+		if (blob->hash == hash && blob->len == len &&
+				memcmp(pixels + blob->offset, data, len) == 0) {
+			*offset = blob->offset;
+			return true;
+		}
+	}
+
+	blob = wl_array_add(&writer->blobs, sizeof(*blob));
+	if (blob == NULL) {
+		return false;
+	}
+	*blob = (struct cache_blob){
+		.hash = hash,
+		.offset = writer->pixels.size,
+		.len = len,
+	};
+	void *dst = wl_array_add(&writer->pixels, len);
+	if (dst == NULL) {
+		writer->blobs.size -= sizeof(*blob);
+		return false;
+	}
+	memcpy(dst, data, len);
+	*offset = blob->offset;
+	return true;
+}
+
+static bool writer_add_cursor(struct cache_writer *writer,
+		const XcursorImages *xcimages) {
+	struct cache_cursor cursor = {
+		.first_image = writer->images.size / sizeof(struct cache_image),
+		.images_len = xcimages->nimage,
+	};
+	if (xcimages->nimage <= 0 ||
+			!writer_add_string(writer, xcimages->name, &cursor.name)) {
+		return false;
+	}
+	for (int i = 0; i < xcimages->nimage; i++) {
+		const XcursorImage *xcimage = xcimages->images[i];
+		struct cache_image image = {
+			.width = xcimage->width,
+			.height = xcimage->height,
+			.hotspot_x = xcimage->xhot,
+			.hotspot_y = xcimage->yhot,
+			.delay = xcimage->delay,
+			.pixels_len = xcimage->width * xcimage->height * 4,
+		};
+		if (!writer_add_pixels(writer, xcimage->pixels, image.pixels_len,
+				&image.pixels)) {
+			return false;
+		}
+		struct cache_image *dst = wl_array_add(&writer->images, sizeof(image));
+		if (dst == NULL) {
+			return false;
+		}
+		*dst = image;
+		cursor.total_delay += image.delay;
+	}
+
+	struct cache_cursor *dst = wl_array_add(&writer->cursors, sizeof(cursor));
+	if (dst == NULL) {
+		return false;
+	}
+	*dst = cursor;
+	return true;
+}
+
+static bool writer_save(struct cache_writer *writer, int size,
+		const char *path) {
+	struct cache_header header = {
+		.magic = CACHE_MAGIC,
+		.version = CACHE_VERSION,
+		.size = size,
+		.files_len = writer->files.size / sizeof(struct cache_file),
+		.cursors_len = writer->cursors.size / sizeof(struct cache_cursor),
+		.images_len = writer->images.size / sizeof(struct cache_image),
+		.strings_len = writer->strings.size,
+		.pixels_len = writer->pixels.size,
+	};
+	header.strings_offset = sizeof(header) + writer->files.size +
+		writer->cursors.size + writer->images.size;
+	header.pixels_offset = header.strings_offset + header.strings_len;
+	size_t padding = (8 - header.pixels_offset % 8) % 8;
+	header.pixels_offset += padding;
+
+	static char zeros[8] = {0};
+	const struct iovec iov[] = {
+		{ .iov_base = &header, .iov_len = sizeof(header) },
+		{ .iov_base = writer->files.data, .iov_len = writer->files.size },
+		{ .iov_base = writer->cursors.data, .iov_len = writer->cursors.size },
+		{ .iov_base = writer->images.data, .iov_len = writer->images.size },
+		{ .iov_base = writer->strings.data, .iov_len = writer->strings.size },
+		{ .iov_base = zeros, .iov_len = padding },
+		{ .iov_base = writer->pixels.data, .iov_len = writer->pixels.size },
+	};
+	return cache_write_filev(path, iov, sizeof(iov) / sizeof(iov[0]));
+}
+
+bool xcursor_cache_write(const char *theme, int size,
+		XcursorFileEntry *const *entries, size_t entries_len) {
+	char *path = get_cache_path(theme, size);
+	if (path == NULL) {
+		return false;
+	}
+
+	struct theme_files files;
+	if (!get_theme_files(theme, &files)) {
+		free(path);
+		return false;
+	}
+
+	struct cache_writer writer;
+	wl_array_init(&writer.files);
+	wl_array_init(&writer.cursors);
+	wl_array_init(&writer.images);
+	wl_array_init(&writer.strings);
+	wl_array_init(&writer.pixels);
+	wl_array_init(&writer.blobs);
+
+	bool ok = true;
+	struct theme_file *file;
+	wl_array_for_each(file, &files.files) {
+		struct cache_file *dst = wl_array_add(&writer.files, sizeof(*dst));
+		if (dst == NULL) {
+			ok = false;
+			break;
+		}
+		*dst = file->info;
+		if (!writer_add_string(&writer, file->path, &dst->path)) {
+			ok = false;
+			break;
+		}
+	}
+
+	for (size_t i = 0; ok && i < entries_len; i++) {
+		XcursorImages *images = XcursorFileEntryLoadImages(entries[i]);
+		if (images == NULL) {
+			// Broken cursor files are left out
+			continue;
+		}
+		ok = writer_add_cursor(&writer, images);
+		XcursorImagesDestroy(images);
+	}
+
+	if (ok) {
+		ok = writer_save(&writer, size, path);
+	}
+	if (ok) {
+		wlr_log(WLR_DEBUG, "Wrote cursor cache '%s'", path);
+	} else {
+		wlr_log(WLR_DEBUG, "Failed to write cursor cache '%s'", path);
+	}
+
+	wl_array_release(&writer.files);
+	wl_array_release(&writer.cursors);
+	wl_array_release(&writer.images);
+	wl_array_release(&writer.strings);
+	wl_array_release(&writer.pixels);
+	wl_array_release(&writer.blobs);
+	theme_files_finish(&files);
+	free(path);
+	return ok;
+}
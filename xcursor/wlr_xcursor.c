@@ -30,6 +30,7 @@
 #include <string.h>
 #include <wlr/util/log.h>
 #include <wlr/xcursor.h>
+#include "xcursor/cache.h"
 #include "xcursor/xcursor.h"
 
 static void xcursor_destroy(struct wlr_xcursor *cursor) {
@@ -184,34 +185,103 @@ static struct wlr_xcursor *xcursor_create_from_xcursor_images(
 	return cursor;
 }
 
-static void load_callback(XcursorImages *images, void *data) {
+static int find_entry(struct wlr_xcursor_theme *theme, const char *name) {
+	for (unsigned int i = 0; i < theme->entry_count; i++) {
+		if (strcmp(name, XcursorFileEntryName(theme->entries[i])) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void index_callback(XcursorFileEntry *entry, void *data) {
 	struct wlr_xcursor_theme *theme = data;
-	struct wlr_xcursor *cursor;
 
-	if (wlr_xcursor_theme_get_cursor(theme, images->name)) {
-		XcursorImagesDestroy(images);
+	// Cursors of the theme take precedence over inherited ones
+	if (find_entry(theme, XcursorFileEntryName(entry)) >= 0) {
+		XcursorFileEntryDestroy(entry);
 		return;
 	}
 
-	cursor = xcursor_create_from_xcursor_images(images, theme);
+	XcursorFileEntry **entries = realloc(theme->entries,
+		(theme->entry_count + 1) * sizeof(theme->entries[0]));
+	if (entries == NULL) {
+		XcursorFileEntryDestroy(entry);
+		return;
+	}
+	theme->entries = entries;
+	theme->entries[theme->entry_count++] = entry;
+}
 
-	if (cursor) {
-		struct wlr_xcursor **cursors;
-		theme->cursor_count++;
-		cursors =
-			realloc(theme->cursors,
-				theme->cursor_count * sizeof(theme->cursors[0]));
+static struct wlr_xcursor *load_entry(struct wlr_xcursor_theme *theme,
+		unsigned int index) {
+	XcursorFileEntry *entry = theme->entries[index];
+
+	// The entry is consumed whether decoding succeeds or not, so that broken
+	// files aren't read over and over again
+	theme->entry_count--;
+	memmove(&theme->entries[index], &theme->entries[index + 1],
+		(theme->entry_count - index) * sizeof(theme->entries[0]));
+
+	struct wlr_xcursor *cursor = NULL;
+	XcursorImages *images = XcursorFileEntryLoadImages(entry);
+	if (images != NULL) {
+		cursor = xcursor_create_from_xcursor_images(images, theme);
+		XcursorImagesDestroy(images);
+	}
+	if (cursor == NULL) {
+		wlr_log(WLR_DEBUG, "Failed to load cursor '%s' of theme '%s'",
+			XcursorFileEntryName(entry), theme->name);
+		XcursorFileEntryDestroy(entry);
+		return NULL;
+	}
+	XcursorFileEntryDestroy(entry);
+
+	struct wlr_xcursor **cursors = realloc(theme->cursors,
+		(theme->cursor_count + 1) * sizeof(theme->cursors[0]));
+	if (cursors == NULL) {
+		xcursor_destroy(cursor);
+		return NULL;
+	}
+	theme->cursors = cursors;
+	theme->cursors[theme->cursor_count++] = cursor;
+	return cursor;
+}
 
-		if (cursors == NULL) {
-			theme->cursor_count--;
+static void destroy_cursors(struct wlr_xcursor_theme *theme) {
+	for (unsigned int i = 0; i < theme->cursor_count; i++) {
+		struct wlr_xcursor *cursor = theme->cursors[i];
+		if (theme->cache != NULL) {
+			// Images are allocated along with the array, and their buffers
+			// belong to the cache
+			free(cursor->images);
+			free(cursor->name);
 			free(cursor);
 		} else {
-			theme->cursors = cursors;
-			theme->cursors[theme->cursor_count - 1] = cursor;
+			xcursor_destroy(cursor);
 		}
 	}
+	free(theme->cursors);
+	theme->cursor_count = 0;
+	theme->cursors = NULL;
+}
+
+static bool load_cached_theme(struct wlr_xcursor_theme *theme) {
+	struct xcursor_cache *cache = xcursor_cache_open(theme->name, theme->size);
+	if (cache == NULL) {
+		return false;
+	}
 
-	XcursorImagesDestroy(images);
+	// Cursors which have already been decoded are replaced
+	destroy_cursors(theme);
+	theme->cache = cache;
+	if (!xcursor_cache_load_cursors(cache, theme)) {
+		destroy_cursors(theme);
+		xcursor_cache_destroy(cache);
+		theme->cache = NULL;
+		return false;
+	}
+	return true;
 }
 
 struct wlr_xcursor_theme *wlr_xcursor_theme_load(const char *name, int size) {
@@ -233,15 +303,34 @@ struct wlr_xcursor_theme *wlr_xcursor_theme_load(const char *name, int size) {
 	theme->size = size;
 	theme->cursor_count = 0;
 	theme->cursors = NULL;
+	theme->entry_count = 0;
+	theme->entries = NULL;
+	theme->cache = NULL;
+
+	if (load_cached_theme(theme)) {
+		goto out;
+	}
 
-	xcursor_load_theme(name, size, load_callback, theme);
+	// Only read the table of contents of the cursor files for now, images
+	// are decoded by wlr_xcursor_theme_get_cursor
+	xcursor_index_theme(name, size, index_callback, theme);
 
-	if (theme->cursor_count == 0) {
+	if (theme->entry_count == 0) {
 		load_default_theme(theme);
+	} else if (xcursor_cache_write(name, size, theme->entries,
+			theme->entry_count) && load_cached_theme(theme)) {
+		// Free the index, the cache has everything
+		for (unsigned int i = 0; i < theme->entry_count; i++) {
+			XcursorFileEntryDestroy(theme->entries[i]);
+		}
+		free(theme->entries);
+		theme->entry_count = 0;
+		theme->entries = NULL;
 	}
 
+out:
 	wlr_log(WLR_DEBUG, "Loaded cursor theme '%s' at size %d (%d available cursors)",
-			theme->name, size, theme->cursor_count);
+			theme->name, size, theme->entry_count + theme->cursor_count);
 
 	return theme;
 
@@ -253,12 +342,14 @@ out_error_name:
 void wlr_xcursor_theme_destroy(struct wlr_xcursor_theme *theme) {
 	unsigned int i;
 
-	for (i = 0; i < theme->cursor_count; i++) {
-		xcursor_destroy(theme->cursors[i]);
+	destroy_cursors(theme);
+	for (i = 0; i < theme->entry_count; i++) {
+		XcursorFileEntryDestroy(theme->entries[i]);
 	}
 
+	xcursor_cache_destroy(theme->cache);
+	free(theme->entries);
 	free(theme->name);
-	free(theme->cursors);
 	free(theme);
 }
 
@@ -272,6 +363,11 @@ struct wlr_xcursor *wlr_xcursor_theme_get_cursor(struct wlr_xcursor_theme *theme
 		}
 	}
 
+	int index = find_entry(theme, name);
+	if (index >= 0) {
+		return load_entry(theme, index);
+	}
+
 	return NULL;
 }
 
@@ -25,9 +25,13 @@
 
 #define _DEFAULT_SOURCE
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "xcursor/xcursor.h"
 
 /*
@@ -610,6 +614,218 @@ XcursorFileLoadImages (FILE *file, int size)
     return XcursorXcFileLoadImages (&f, size);
 }
 
+/*
+ * Cursor files are read through a read-only mapping, so that the TOC can be
+ * parsed without reading the rest of the file, and image chunks are read in
+ * place.
+ */
+
+typedef struct _XcursorMapping {
+    unsigned char   *data;
+    size_t	    len;
+    size_t	    pos;
+} XcursorMapping;
+
+static int
+_XcursorMappingRead (XcursorFile *file, unsigned char *buf, int len)
+{
+    XcursorMapping  *m = file->closure;
+    size_t	    avail = m->pos < m->len ? m->len - m->pos : 0;
+
+    if (len < 0)
+	return 0;
+    if ((size_t) len > avail)
+	len = avail;
+    memcpy (buf, m->data + m->pos, len);
+    m->pos += len;
+    return len;
+}
+
+static int
+_XcursorMappingWrite (XcursorFile *file, unsigned char *buf, int len)
+{
+    return 0;
+}
+
+static int
+_XcursorMappingSeek (XcursorFile *file, long offset, int whence)
+{
+    XcursorMapping  *m = file->closure;
+    long	    base;
+
+    switch (whence) {
+    case SEEK_SET:
+	base = 0;
+	break;
+    case SEEK_CUR:
+	base = m->pos;
+	break;
+    case SEEK_END:
+	base = m->len;
+	break;
+    default:
+	return EOF;
+    }
+    if (offset < -base || (size_t) (base + offset) > m->len)
+	return EOF;
+    m->pos = base + offset;
+    return 0;
+}
+
+static XcursorBool
+_XcursorMappingOpen (const char *path, XcursorMapping *m, XcursorFile *file)
+{
+    struct stat	st;
+    int		fd;
+
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+	return XcursorFalse;
+    if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode) || st.st_size == 0)
+    {
+	close (fd);
+	return XcursorFalse;
+    }
+    m->data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (m->data == MAP_FAILED)
+	return XcursorFalse;
+    m->len = st.st_size;
+    m->pos = 0;
+
+    file->closure = m;
+    file->read = _XcursorMappingRead;
+    file->write = _XcursorMappingWrite;
+    file->seek = _XcursorMappingSeek;
+    return XcursorTrue;
+}
+
+static void
+_XcursorMappingClose (XcursorMapping *m)
+{
+    munmap (m->data, m->len);
+}
+
+struct xcursor_file_entry {
+    char		*name;
+    char		*path;
+    XcursorFileHeader	*header;    /* TOC of the images to load */
+};
+
+/*
+ * Parse the TOC of a cursor file, and keep the entries of the images
+ * matching the requested size best.
+ */
+static XcursorFileEntry *
+_XcursorFileEntryCreate (const char *path, const char *name, int size)
+{
+    XcursorMapping	m;
+    XcursorFile		f;
+    XcursorFileHeader	*fileHeader, *header;
+    XcursorFileEntry	*entry;
+    XcursorDim		bestSize;
+    int			nsize, n, toc;
+
+    if (!_XcursorMappingOpen (path, &m, &f))
+	return NULL;
+    fileHeader = _XcursorReadFileHeader (&f);
+    _XcursorMappingClose (&m);
+    if (!fileHeader)
+	return NULL;
+
+    bestSize = _XcursorFindBestSize (fileHeader, (XcursorDim) size, &nsize);
+    if (!bestSize)
+    {
+	_XcursorFileHeaderDestroy (fileHeader);
+	return NULL;
+    }
+    header = _XcursorFileHeaderCreate (nsize);
+    if (!header)
+    {
+	_XcursorFileHeaderDestroy (fileHeader);
+	return NULL;
+    }
+    for (n = 0; n < nsize; n++)
+    {
+	toc = _XcursorFindImageToc (fileHeader, bestSize, n);
+	if (toc < 0)
+	    break;
+	header->tocs[n] = fileHeader->tocs[toc];
+    }
+    header->ntoc = n;
+    _XcursorFileHeaderDestroy (fileHeader);
+
+    entry = calloc (1, sizeof (*entry));
+    if (!entry)
+    {
+	_XcursorFileHeaderDestroy (header);
+	return NULL;
+    }
+    entry->name = strdup (name);
+    entry->path = strdup (path);
+    entry->header = header;
+    if (!entry->name || !entry->path)
+    {
+	XcursorFileEntryDestroy (entry);
+	return NULL;
+    }
+    return entry;
+}
+
+const char *
+XcursorFileEntryName (const XcursorFileEntry *entry)
+{
+    return entry->name;
+}
+
+XcursorImages *
+XcursorFileEntryLoadImages (const XcursorFileEntry *entry)
+{
+    XcursorMapping	m;
+    XcursorFile		f;
+    XcursorImages	*images;
+    XcursorUInt		n;
+
+    if (!entry || entry->header->ntoc == 0)
+	return NULL;
+    if (!_XcursorMappingOpen (entry->path, &m, &f))
+	return NULL;
+    images = XcursorImagesCreate (entry->header->ntoc);
+    if (!images)
+    {
+	_XcursorMappingClose (&m);
+	return NULL;
+    }
+    for (n = 0; n < entry->header->ntoc; n++)
+    {
+	images->images[images->nimage] = _XcursorReadImage (&f, entry->header,
+							    n);
+	if (!images->images[images->nimage])
+	    break;
+	images->nimage++;
+    }
+    _XcursorMappingClose (&m);
+    if ((XcursorUInt) images->nimage != entry->header->ntoc)
+    {
+	XcursorImagesDestroy (images);
+	return NULL;
+    }
+    XcursorImagesSetName (images, entry->name);
+    return images;
+}
+
+void
+XcursorFileEntryDestroy (XcursorFileEntry *entry)
+{
+    if (!entry)
+	return;
+    if (entry->header)
+	_XcursorFileHeaderDestroy (entry->header);
+    free (entry->name);
+    free (entry->path);
+    free (entry);
+}
+
 /*
  * From libXcursor/src/library.c
  */
@@ -982,3 +1198,149 @@ xcursor_load_theme(const char *theme, int size,
 	if (inherits)
 		free(inherits);
 }
+
+static void
+index_all_cursors_from_dir(const char *path, int size,
+			   void (*index_callback)(XcursorFileEntry *, void *),
+			   void *user_data)
+{
+	DIR *dir = opendir(path);
+	struct dirent *ent;
+	char *full;
+	XcursorFileEntry *entry;
+
+	if (!dir)
+		return;
+
+	for (ent = readdir(dir); ent; ent = readdir(dir)) {
+#ifdef _DIRENT_HAVE_D_TYPE
+		if (ent->d_type != DT_UNKNOWN &&
+		    (ent->d_type != DT_REG && ent->d_type != DT_LNK))
+			continue;
+#endif
+
+		full = _XcursorBuildFullname(path, "", ent->d_name);
+		if (!full)
+			continue;
+
+		entry = _XcursorFileEntryCreate(full, ent->d_name, size);
+		if (entry)
+			index_callback(entry, user_data);
+
+		free(full);
+	}
+
+	closedir(dir);
+}
+
+/** Index all the cursors of a theme
+ *
+ * Like xcursor_load_theme(), but only the table of contents of each cursor
+ * file is read. The callback is passed an XcursorFileEntry which can be used
+ * to decode the images later on with XcursorFileEntryLoadImages(). The user
+ * is expected to destroy the entries with XcursorFileEntryDestroy().
+ *
+ * \param theme The name of theme that should be indexed
+ * \param size The desired size of the cursor images
+ * \param index_callback A callback function that will be called
+ * for each cursor file found
+ * \param user_data The data that should be passed to the index callback
+ */
+void
+xcursor_index_theme(const char *theme, int size,
+		    void (*index_callback)(XcursorFileEntry *, void *),
+		    void *user_data)
+{
+	char *full, *dir;
+	char *inherits = NULL;
+	const char *path, *i;
+
+	if (!theme)
+		theme = "default";
+
+	for (path = XcursorLibraryPath();
+	     path;
+	     path = _XcursorNextPath(path)) {
+		dir = _XcursorBuildThemeDir(path, theme);
+		if (!dir)
+			continue;
+
+		full = _XcursorBuildFullname(dir, "cursors", "");
+
+		if (full) {
+			index_all_cursors_from_dir(full, size, index_callback,
+						   user_data);
+			free(full);
+		}
+
+		if (!inherits) {
+			full = _XcursorBuildFullname(dir, "", "index.theme");
+			if (full) {
+				inherits = _XcursorThemeInherits(full);
+				free(full);
+			}
+		}
+
+		free(dir);
+	}
+
+	for (i = inherits; i; i = _XcursorNextPath(i))
+		xcursor_index_theme(i, size, index_callback, user_data);
+
+	if (inherits)
+		free(inherits);
+}
+
+/** List the files and directories a theme is made of
+ *
+ * This function calls the callback with the path of each cursor directory
+ * and index.theme file that xcursor_index_theme() would look at, whether they
+ * exist or not, including the ones of inherited themes. Changes to the theme
+ * can be detected by checking these paths.
+ *
+ * \param theme The name of theme
+ * \param file_callback A callback function that will be called for each path
+ * \param user_data The data that should be passed to the callback
+ */
+void
+xcursor_theme_files(const char *theme,
+		    void (*file_callback)(const char *, void *),
+		    void *user_data)
+{
+	char *full, *dir;
+	char *inherits = NULL;
+	const char *path, *i;
+
+	if (!theme)
+		theme = "default";
+
+	for (path = XcursorLibraryPath();
+	     path;
+	     path = _XcursorNextPath(path)) {
+		dir = _XcursorBuildThemeDir(path, theme);
+		if (!dir)
+			continue;
+
+		full = _XcursorBuildFullname(dir, "cursors", "");
+		if (full) {
+			file_callback(full, user_data);
+			free(full);
+		}
+
+		full = _XcursorBuildFullname(dir, "", "index.theme");
+		if (full) {
+			file_callback(full, user_data);
+			if (!inherits)
+				inherits = _XcursorThemeInherits(full);
+			free(full);
+		}
+
+		free(dir);
+	}
+
+	for (i = inherits; i; i = _XcursorNextPath(i))
+		xcursor_theme_files(i, file_callback, user_data);
+
+	if (inherits)
+		free(inherits);
+}
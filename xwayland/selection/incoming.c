@@ -73,6 +73,7 @@ static bool xwm_selection_transfer_get_incoming_selection_property(
 	transfer->property_start = 0;
 	transfer->property_reply =
 		xcb_get_property_reply(xwm->xcb_conn, cookie, NULL);
+	xwm_schedule_replies(xwm);
 
 	if (!transfer->property_reply) {
 		wlr_log(WLR_ERROR, "cannot get selection property");
@@ -321,8 +322,11 @@ static const struct wlr_primary_selection_source_impl
 	.destroy = primary_selection_source_destroy,
 };
 
-static bool source_get_targets(struct wlr_xwm_selection *selection,
-		struct wl_array *mime_types, struct wl_array *mime_types_atoms) {
+/**
+ * Read the TARGETS of the selection owner, converted into our window
+ * property.
+ */
+static bool selection_read_targets(struct wlr_xwm_selection *selection) {
 	struct wlr_xwm *xwm = selection->xwm;
 
 	xcb_get_property_cookie_t cookie = xcb_get_property(xwm->xcb_conn,
@@ -336,6 +340,7 @@ static bool source_get_targets(struct wlr_xwm_selection *selection,
 
 	xcb_get_property_reply_t *reply =
 		xcb_get_property_reply(xwm->xcb_conn, cookie, NULL);
+	xwm_schedule_replies(xwm);
 	if (reply == NULL) {
 		return false;
 	}
@@ -345,35 +350,79 @@ static bool source_get_targets(struct wlr_xwm_selection *selection,
 		return false;
 	}
 
-	xcb_atom_t *value = xcb_get_property_value(reply);
-	for (uint32_t i = 0; i < reply->value_len; i++) {
+	struct wl_array *atoms = &selection->targets.atoms;
+	atoms->size = 0;
+	size_t size = reply->value_len * sizeof(xcb_atom_t);
+	if (size > 0) {
+		void *dst = wl_array_add(atoms, size);
+		if (dst == NULL) {
+			free(reply);
+			return false;
+		}
+		memcpy(dst, xcb_get_property_value(reply), size);
+	}
+	free(reply);
+
+	selection->targets.valid = true;
+	return true;
+}
+
+static bool source_get_targets(struct wlr_xwm_selection *selection,
+		struct wl_array *mime_types, struct wl_array *mime_types_atoms) {
+	struct wlr_xwm *xwm = selection->xwm;
+
+	const xcb_atom_t *value = selection->targets.atoms.data;
+	size_t value_len = selection->targets.atoms.size / sizeof(xcb_atom_t);
+
+	// Request the names of the atoms we haven't seen yet before waiting for
+	// the first one
+	xcb_get_atom_name_cookie_t *name_cookies =
+		calloc(value_len, sizeof(*name_cookies));
+	if (value_len > 0 && name_cookies == NULL) {
+		return false;
+	}
+	for (size_t i = 0; i < value_len; i++) {
+		if (value[i] != xwm->atoms[UTF8_STRING] &&
+				value[i] != xwm->atoms[TEXT] &&
+				value[i] != xwm->atoms[TARGETS] &&
+				value[i] != xwm->atoms[TIMESTAMP] &&
+				xwm_atom_cache_get_name(xwm, value[i]) == NULL) {
+			name_cookies[i] = xcb_get_atom_name(xwm->xcb_conn, value[i]);
+		}
+	}
+
+	size_t i;
+	for (i = 0; i < value_len; i++) {
 		char *mime_type = NULL;
 
 		if (value[i] == xwm->atoms[UTF8_STRING]) {
 			mime_type = strdup("text/plain;charset=utf-8");
 		} else if (value[i] == xwm->atoms[TEXT]) {
 			mime_type = strdup("text/plain");
-		} else if (value[i] != xwm->atoms[TARGETS] &&
-				value[i] != xwm->atoms[TIMESTAMP]) {
-			xcb_get_atom_name_cookie_t name_cookie =
-				xcb_get_atom_name(xwm->xcb_conn, value[i]);
+		} else if (name_cookies[i].sequence != 0) {
 			xcb_get_atom_name_reply_t *name_reply =
-				xcb_get_atom_name_reply(xwm->xcb_conn, name_cookie, NULL);
+				xcb_get_atom_name_reply(xwm->xcb_conn, name_cookies[i], NULL);
+			xwm_schedule_replies(xwm);
 			if (name_reply == NULL) {
 				continue;
 			}
 			size_t len = xcb_get_atom_name_name_length(name_reply);
 			char *name = xcb_get_atom_name_name(name_reply); // not a C string
+			xwm_atom_cache_add(xwm, value[i], name, len);
 			if (memchr(name, '/', len) != NULL) {
-				mime_type = malloc((len + 1) * sizeof(char));
+				mime_type = strndup(name, len);
 				if (mime_type == NULL) {
 					free(name_reply);
 					continue;
 				}
-				memcpy(mime_type, name, len);
-				mime_type[len] = '\0';
 			}
 			free(name_reply);
+		} else if (value[i] != xwm->atoms[TARGETS] &&
+				value[i] != xwm->atoms[TIMESTAMP]) {
+			const char *name = xwm_atom_cache_get_name(xwm, value[i]);
+			if (strchr(name, '/') != NULL) {
+				mime_type = strdup(name);
+			}
 		}
 
 		if (mime_type != NULL) {
@@ -394,13 +443,39 @@ static bool source_get_targets(struct wlr_xwm_selection *selection,
 		}
 	}
 
-	free(reply);
+	// Don't leave the replies of the remaining requests queued if we bailed
+	// out early
+	for (i++; i < value_len; i++) {
+		if (name_cookies[i].sequence != 0) {
+			xcb_discard_reply(xwm->xcb_conn, name_cookies[i].sequence);
+		}
+	}
+	free(name_cookies);
 	return true;
 }
 
-static void xwm_selection_get_targets(struct wlr_xwm_selection *selection) {
-	// set the wayland selection to the X11 selection
+static bool selection_is_offered(struct wlr_xwm_selection *selection) {
 	struct wlr_xwm *xwm = selection->xwm;
+	if (xwm->seat == NULL) {
+		return false;
+	} else if (selection == &xwm->clipboard_selection) {
+		return xwm->seat->selection_source != NULL &&
+			data_source_is_xwayland(xwm->seat->selection_source);
+	} else if (selection == &xwm->primary_selection) {
+		return xwm->seat->primary_selection_source != NULL &&
+			primary_selection_source_is_xwayland(
+				xwm->seat->primary_selection_source);
+	}
+	return false;
+}
+
+/**
+ * Set the Wayland selection to the X11 selection, with the cached TARGETS of
+ * its owner.
+ */
+static void xwm_selection_offer_targets(struct wlr_xwm_selection *selection) {
+	struct wlr_xwm *xwm = selection->xwm;
+	selection->targets.pending = false;
 
 	if (selection == &xwm->clipboard_selection) {
 		struct x11_data_source *source =
@@ -446,6 +521,22 @@ static void xwm_selection_get_targets(struct wlr_xwm_selection *selection) {
 	}
 }
 
+void xwm_selection_offer_pending(struct wlr_xwm *xwm) {
+	struct wlr_xwm_selection *selections[] = {
+		&xwm->clipboard_selection,
+		&xwm->primary_selection,
+	};
+
+	for (size_t i = 0; i < sizeof(selections)/sizeof(selections[0]); ++i) {
+		struct wlr_xwm_selection *selection = selections[i];
+		if (selection->targets.valid && selection->targets.pending) {
+			wlr_log(WLR_DEBUG, "offering X11 selection held back until "
+				"an xwayland surface got focus");
+			xwm_selection_offer_targets(selection);
+		}
+	}
+}
+
 void xwm_handle_selection_notify(struct wlr_xwm *xwm,
 		xcb_selection_notify_event_t *event) {
 	wlr_log(WLR_DEBUG, "XCB_SELECTION_NOTIFY (selection=%u, property=%u, target=%u)",
@@ -467,15 +558,26 @@ void xwm_handle_selection_notify(struct wlr_xwm *xwm,
 			xwm_selection_transfer_destroy(transfer);
 		}
 	} else if (event->target == xwm->atoms[TARGETS]) {
-		// No xwayland surface focused, deny access to clipboard
+		// Ignore the reply to a conversion request for a previous owner
+		if (event->time != XCB_CURRENT_TIME &&
+				event->time != selection->targets.timestamp) {
+			return;
+		}
+
+		if (!selection_read_targets(selection)) {
+			return;
+		}
+
+		// No xwayland surface focused, deny access to clipboard until one is
 		if (xwm->focus_surface == NULL) {
 			wlr_log(WLR_DEBUG, "denying write access to clipboard: "
 				"no xwayland surface focused");
+			selection->targets.pending = true;
 			return;
 		}
 
 		// This sets the Wayland clipboard (by calling wlr_seat_set_selection)
-		xwm_selection_get_targets(selection);
+		xwm_selection_offer_targets(selection);
 	} else if (transfer) {
 		xwm_selection_transfer_get_data(transfer);
 	}
@@ -510,6 +612,8 @@ int xwm_handle_xfixes_selection_notify(struct wlr_xwm *xwm,
 		}
 
 		selection->owner = XCB_WINDOW_NONE;
+		selection->targets.valid = false;
+		selection->targets.pending = false;
 		return 1;
 	}
 
@@ -525,9 +629,29 @@ int xwm_handle_xfixes_selection_notify(struct wlr_xwm *xwm,
 		// grab the actual timestamp here so we can answer TIMESTAMP conversion
 		// requests correctly.
 		selection->timestamp = event->timestamp;
+		selection->targets.valid = false;
+		selection->targets.pending = false;
 		return 1;
 	}
 
+	if (selection->targets.valid &&
+			selection->targets.owner == event->owner &&
+			selection->targets.timestamp == event->timestamp) {
+		// The owner re-asserted the same selection, its TARGETS haven't
+		// changed
+		if (xwm->focus_surface == NULL) {
+			selection->targets.pending = true;
+		} else if (!selection_is_offered(selection)) {
+			xwm_selection_offer_targets(selection);
+		}
+		return 1;
+	}
+
+	selection->targets.valid = false;
+	selection->targets.pending = false;
+	selection->targets.owner = event->owner;
+	selection->targets.timestamp = event->timestamp;
+
 	// doing this will give a selection notify where we actually handle the sync
 	xcb_convert_selection(
 		xwm->xcb_conn,
@@ -70,19 +70,24 @@ static int xwm_data_source_read(int fd, uint32_t mask, void *data) {
 	struct wlr_xwm_selection_transfer *transfer = data;
 	struct wlr_xwm *xwm = transfer->selection->xwm;
 
-	void *p;
+	size_t chunk_size = xwm->incr_chunk_size;
 	size_t current = transfer->source_data.size;
-	if (transfer->source_data.size < INCR_CHUNK_SIZE) {
-		p = wl_array_add(&transfer->source_data, INCR_CHUNK_SIZE);
-		if (p == NULL) {
+	if (current < chunk_size &&
+			transfer->source_data.alloc - current < INCR_CHUNK_SIZE) {
+		// wl_array grows geometrically, so large selections don't cause
+		// many reallocations
+		if (wl_array_add(&transfer->source_data, INCR_CHUNK_SIZE) == NULL) {
 			wlr_log(WLR_ERROR, "Could not allocate selection source_data");
 			goto error_out;
 		}
-	} else {
-		p = (char *)transfer->source_data.data + transfer->source_data.size;
 	}
+	void *p = (char *)transfer->source_data.data + current;
 
+	// A chunk must fit in a single X request
 	size_t available = transfer->source_data.alloc - current;
+	if (current < chunk_size && available > chunk_size - current) {
+		available = chunk_size - current;
+	}
 	ssize_t len = read(fd, p, available);
 	if (len == -1) {
 		wlr_log_errno(WLR_ERROR, "read error from data source");
@@ -93,12 +98,12 @@ static int xwm_data_source_read(int fd, uint32_t mask, void *data) {
 		available, mask);
 
 	transfer->source_data.size = current + len;
-	if (transfer->source_data.size >= INCR_CHUNK_SIZE) {
+	if (transfer->source_data.size >= chunk_size) {
 		if (!transfer->incr) {
 			wlr_log(WLR_DEBUG, "got %zu bytes, starting incr",
 				transfer->source_data.size);
 
-			size_t incr_chunk_size = INCR_CHUNK_SIZE;
+			uint32_t incr_chunk_size = chunk_size;
 			xcb_change_property(xwm->xcb_conn,
 				XCB_PROP_MODE_REPLACE,
 				transfer->request.requestor,
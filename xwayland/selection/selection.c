@@ -58,6 +58,56 @@ void xwm_selection_transfer_destroy(
 	free(transfer);
 }
 
+const char *xwm_atom_cache_get_name(struct wlr_xwm *xwm, xcb_atom_t atom) {
+	struct xwm_atom_name *entry;
+	wl_array_for_each(entry, &xwm->atom_names) {
+		if (entry->atom == atom) {
+			return entry->name;
+		}
+	}
+	return NULL;
+}
+
+static xcb_atom_t atom_cache_get_atom(struct wlr_xwm *xwm, const char *name) {
+	struct xwm_atom_name *entry;
+	wl_array_for_each(entry, &xwm->atom_names) {
+		if (strcmp(entry->name, name) == 0) {
+			return entry->atom;
+		}
+	}
+	return XCB_ATOM_NONE;
+}
+
+void xwm_atom_cache_add(struct wlr_xwm *xwm, xcb_atom_t atom,
+		const char *name, size_t len) {
+	size_t n = xwm->atom_names.size / sizeof(struct xwm_atom_name);
+	if (n >= MAX_CACHED_ATOM_NAMES ||
+			xwm_atom_cache_get_name(xwm, atom) != NULL) {
+		return;
+	}
+
+	char *dup = strndup(name, len);
+	if (dup == NULL) {
+		return;
+	}
+	struct xwm_atom_name *entry =
+		wl_array_add(&xwm->atom_names, sizeof(*entry));
+	if (entry == NULL) {
+		free(dup);
+		return;
+	}
+	entry->atom = atom;
+	entry->name = dup;
+}
+
+void xwm_atom_cache_finish(struct wlr_xwm *xwm) {
+	struct xwm_atom_name *entry;
+	wl_array_for_each(entry, &xwm->atom_names) {
+		free(entry->name);
+	}
+	wl_array_release(&xwm->atom_names);
+}
+
 xcb_atom_t xwm_mime_type_to_atom(struct wlr_xwm *xwm, char *mime_type) {
 	if (strcmp(mime_type, "text/plain;charset=utf-8") == 0) {
 		return xwm->atoms[UTF8_STRING];
@@ -65,15 +115,22 @@ xcb_atom_t xwm_mime_type_to_atom(struct wlr_xwm *xwm, char *mime_type) {
 		return xwm->atoms[TEXT];
 	}
 
+	xcb_atom_t atom = atom_cache_get_atom(xwm, mime_type);
+	if (atom != XCB_ATOM_NONE) {
+		return atom;
+	}
+
 	xcb_intern_atom_cookie_t cookie =
 		xcb_intern_atom(xwm->xcb_conn, 0, strlen(mime_type), mime_type);
 	xcb_intern_atom_reply_t *reply =
 		xcb_intern_atom_reply(xwm->xcb_conn, cookie, NULL);
+	xwm_schedule_replies(xwm);
 	if (reply == NULL) {
 		return XCB_ATOM_NONE;
 	}
-	xcb_atom_t atom = reply->atom;
+	atom = reply->atom;
 	free(reply);
+	xwm_atom_cache_add(xwm, atom, mime_type, strlen(mime_type));
 	return atom;
 }
 
@@ -82,9 +139,18 @@ char *xwm_mime_type_from_atom(struct wlr_xwm *xwm, xcb_atom_t atom) {
 		return strdup("text/plain;charset=utf-8");
 	} else if (atom == xwm->atoms[TEXT]) {
 		return strdup("text/plain");
-	} else {
-		return xwm_get_atom_name(xwm, atom);
 	}
+
+	const char *cached = xwm_atom_cache_get_name(xwm, atom);
+	if (cached != NULL) {
+		return strdup(cached);
+	}
+
+	char *name = xwm_get_atom_name(xwm, atom);
+	if (name != NULL) {
+		xwm_atom_cache_add(xwm, atom, name, strlen(name));
+	}
+	return name;
 }
 
 struct wlr_xwm_selection *xwm_get_selection(struct wlr_xwm *xwm,
@@ -176,6 +242,7 @@ void xwm_selection_init(struct wlr_xwm_selection *selection,
 		struct wlr_xwm *xwm, xcb_atom_t atom) {
 	wl_list_init(&selection->incoming);
 	wl_list_init(&selection->outgoing);
+	wl_array_init(&selection->targets.atoms);
 
 	selection->xwm = xwm;
 	selection->atom = atom;
@@ -257,6 +324,7 @@ void xwm_selection_finish(struct wlr_xwm_selection *selection) {
 		xwm_selection_transfer_destroy(incoming);
 	}
 
+	wl_array_release(&selection->targets.atoms);
 	xcb_destroy_window(selection->xwm->xcb_conn, selection->window);
 }
 
@@ -18,6 +18,9 @@
 #include "util/signal.h"
 #include "xwayland/config.h"
 
+// Delay before Xwayland is started in standby mode, in milliseconds
+#define STANDBY_DELAY_MS 1000
+
 static void safe_close(int fd) {
 	if (fd >= 0) {
 		close(fd);
@@ -139,6 +142,10 @@ static void server_finish_process(struct wlr_xwayland_server *server) {
 
 		server->x_fd_read_event[0] = server->x_fd_read_event[1] = NULL;
 	}
+	if (server->standby_timer) {
+		wl_event_source_remove(server->standby_timer);
+		server->standby_timer = NULL;
+	}
 
 	if (server->client) {
 		wl_list_remove(&server->client_destroy.link);
@@ -402,15 +409,28 @@ static bool server_start(struct wlr_xwayland_server *server) {
 	return true;
 }
 
-static int xwayland_socket_connected(int fd, uint32_t mask, void *data) {
-	struct wlr_xwayland_server *server = data;
-
+static void server_start_now(struct wlr_xwayland_server *server) {
 	wl_event_source_remove(server->x_fd_read_event[0]);
 	wl_event_source_remove(server->x_fd_read_event[1]);
 	server->x_fd_read_event[0] = server->x_fd_read_event[1] = NULL;
+	if (server->standby_timer) {
+		wl_event_source_remove(server->standby_timer);
+		server->standby_timer = NULL;
+	}
 
 	server_start(server);
+}
+
+static int xwayland_socket_connected(int fd, uint32_t mask, void *data) {
+	struct wlr_xwayland_server *server = data;
+	server_start_now(server);
+	return 0;
+}
 
+static int handle_standby_timer(void *data) {
+	struct wlr_xwayland_server *server = data;
+	wlr_log(WLR_DEBUG, "Starting Xwayland in the background");
+	server_start_now(server);
 	return 0;
 }
 
@@ -429,6 +449,19 @@ static bool server_start_lazy(struct wlr_xwayland_server *server) {
 		return false;
 	}
 
+	if (server->standby) {
+		// Give the compositor some time to finish starting up, X11 clients
+		// connecting meanwhile still start Xwayland right away
+		server->standby_timer = wl_event_loop_add_timer(loop,
+			handle_standby_timer, server);
+		if (server->standby_timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create standby timer");
+		} else {
+			wl_event_source_timer_update(server->standby_timer,
+				STANDBY_DELAY_MS);
+		}
+	}
+
 	return true;
 }
 
@@ -458,7 +491,8 @@ struct wlr_xwayland_server *wlr_xwayland_server_create(
 	}
 
 	server->wl_display = wl_display;
-	server->lazy = options->lazy;
+	server->lazy = options->lazy || options->standby;
+	server->standby = options->standby;
 	server->enable_wm = options->enable_wm;
 
 	server->x_fd[0] = server->x_fd[1] = -1;
@@ -73,6 +73,15 @@ void wlr_xwayland_destroy(struct wlr_xwayland *xwayland) {
 
 struct wlr_xwayland *wlr_xwayland_create(struct wl_display *wl_display,
 		struct wlr_compositor *compositor, bool lazy) {
+	struct wlr_xwayland_server_options options = {
+		.lazy = lazy,
+	};
+	return wlr_xwayland_create_with_options(wl_display, compositor, &options);
+}
+
+struct wlr_xwayland *wlr_xwayland_create_with_options(
+		struct wl_display *wl_display, struct wlr_compositor *compositor,
+		const struct wlr_xwayland_server_options *server_options) {
 	struct wlr_xwayland *xwayland = calloc(1, sizeof(struct wlr_xwayland));
 	if (!xwayland) {
 		return NULL;
@@ -84,10 +93,8 @@ struct wlr_xwayland *wlr_xwayland_create(struct wl_display *wl_display,
 	wl_signal_init(&xwayland->events.new_surface);
 	wl_signal_init(&xwayland->events.ready);
 
-	struct wlr_xwayland_server_options options = {
-		.lazy = lazy,
-		.enable_wm = true,
-	};
+	struct wlr_xwayland_server_options options = *server_options;
+	options.enable_wm = true;
 	xwayland->server = wlr_xwayland_server_create(wl_display, &options);
 	if (xwayland->server == NULL) {
 		free(xwayland);
@@ -3,6 +3,7 @@
 #endif
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <wlr/config.h>
 #include <wlr/types/wlr_data_device.h>
@@ -15,77 +16,18 @@
 #include <xcb/composite.h>
 #include <xcb/render.h>
 #include <xcb/res.h>
+#include <xcb/sync.h>
 #include <xcb/xcb_icccm.h>
 #include <xcb/xfixes.h>
+#include "util/hash_map.h"
+#include "util/ping_timer.h"
 #include "util/signal.h"
 #include "xwayland/xwm.h"
 
 const char *const atom_map[ATOM_LAST] = {
-	[WL_SURFACE_ID] = "WL_SURFACE_ID",
-	[WM_DELETE_WINDOW] = "WM_DELETE_WINDOW",
-	[WM_PROTOCOLS] = "WM_PROTOCOLS",
-	[WM_HINTS] = "WM_HINTS",
-	[WM_NORMAL_HINTS] = "WM_NORMAL_HINTS",
-	[WM_SIZE_HINTS] = "WM_SIZE_HINTS",
-	[WM_WINDOW_ROLE] = "WM_WINDOW_ROLE",
-	[MOTIF_WM_HINTS] = "_MOTIF_WM_HINTS",
-	[UTF8_STRING] = "UTF8_STRING",
-	[WM_S0] = "WM_S0",
-	[NET_SUPPORTED] = "_NET_SUPPORTED",
-	[NET_WM_CM_S0] = "_NET_WM_CM_S0",
-	[NET_WM_PID] = "_NET_WM_PID",
-	[NET_WM_NAME] = "_NET_WM_NAME",
-	[NET_WM_STATE] = "_NET_WM_STATE",
-	[NET_WM_WINDOW_TYPE] = "_NET_WM_WINDOW_TYPE",
-	[WM_TAKE_FOCUS] = "WM_TAKE_FOCUS",
-	[WINDOW] = "WINDOW",
-	[NET_ACTIVE_WINDOW] = "_NET_ACTIVE_WINDOW",
-	[NET_WM_MOVERESIZE] = "_NET_WM_MOVERESIZE",
-	[NET_SUPPORTING_WM_CHECK] = "_NET_SUPPORTING_WM_CHECK",
-	[NET_WM_STATE_FOCUSED] = "_NET_WM_STATE_FOCUSED",
-	[NET_WM_STATE_MODAL] = "_NET_WM_STATE_MODAL",
-	[NET_WM_STATE_FULLSCREEN] = "_NET_WM_STATE_FULLSCREEN",
-	[NET_WM_STATE_MAXIMIZED_VERT] = "_NET_WM_STATE_MAXIMIZED_VERT",
-	[NET_WM_STATE_MAXIMIZED_HORZ] = "_NET_WM_STATE_MAXIMIZED_HORZ",
-	[NET_WM_STATE_HIDDEN] = "_NET_WM_STATE_HIDDEN",
-	[NET_WM_PING] = "_NET_WM_PING",
-	[WM_CHANGE_STATE] = "WM_CHANGE_STATE",
-	[WM_STATE] = "WM_STATE",
-	[CLIPBOARD] = "CLIPBOARD",
-	[PRIMARY] = "PRIMARY",
-	[WL_SELECTION] = "_WL_SELECTION",
-	[TARGETS] = "TARGETS",
-	[CLIPBOARD_MANAGER] = "CLIPBOARD_MANAGER",
-	[INCR] = "INCR",
-	[TEXT] = "TEXT",
-	[TIMESTAMP] = "TIMESTAMP",
-	[DELETE] = "DELETE",
-	[NET_WM_WINDOW_TYPE_NORMAL] = "_NET_WM_WINDOW_TYPE_NORMAL",
-	[NET_WM_WINDOW_TYPE_UTILITY] = "_NET_WM_WINDOW_TYPE_UTILITY",
-	[NET_WM_WINDOW_TYPE_TOOLTIP] = "_NET_WM_WINDOW_TYPE_TOOLTIP",
-	[NET_WM_WINDOW_TYPE_DND] = "_NET_WM_WINDOW_TYPE_DND",
-	[NET_WM_WINDOW_TYPE_DROPDOWN_MENU] = "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU",
-	[NET_WM_WINDOW_TYPE_POPUP_MENU] = "_NET_WM_WINDOW_TYPE_POPUP_MENU",
-	[NET_WM_WINDOW_TYPE_COMBO] = "_NET_WM_WINDOW_TYPE_COMBO",
-	[NET_WM_WINDOW_TYPE_MENU] = "_NET_WM_WINDOW_TYPE_MENU",
-	[NET_WM_WINDOW_TYPE_NOTIFICATION] = "_NET_WM_WINDOW_TYPE_NOTIFICATION",
-	[NET_WM_WINDOW_TYPE_SPLASH] = "_NET_WM_WINDOW_TYPE_SPLASH",
-	[DND_SELECTION] = "XdndSelection",
-	[DND_AWARE] = "XdndAware",
-	[DND_STATUS] = "XdndStatus",
-	[DND_POSITION] = "XdndPosition",
-	[DND_ENTER] = "XdndEnter",
-	[DND_LEAVE] = "XdndLeave",
-	[DND_DROP] = "XdndDrop",
-	[DND_FINISHED] = "XdndFinished",
-	[DND_PROXY] = "XdndProxy",
-	[DND_TYPE_LIST] = "XdndTypeList",
-	[DND_ACTION_MOVE] = "XdndActionMove",
-	[DND_ACTION_COPY] = "XdndActionCopy",
-	[DND_ACTION_ASK] = "XdndActionAsk",
-	[DND_ACTION_PRIVATE] = "XdndActionPrivate",
-	[NET_CLIENT_LIST] = "_NET_CLIENT_LIST",
-	[NET_CLIENT_LIST_STACKING] = "_NET_CLIENT_LIST_STACKING",
+#define ATOM_NAME(name, str) [name] = str,
+	XWM_ATOMS(ATOM_NAME)
+#undef ATOM_NAME
 };
 
 static const struct wlr_surface_role xwayland_surface_role;
@@ -100,10 +42,72 @@ struct wlr_xwayland_surface *wlr_xwayland_surface_from_wlr_surface(
 	return (struct wlr_xwayland_surface *)surface->role_data;
 }
 
-// TODO: replace this with hash table?
+// How long to wait for a client to redraw after a _NET_WM_SYNC_REQUEST
+#define SYNC_REQUEST_TIMEOUT_MS 200
+
+static uint64_t surface_map_hash(uint32_t key) {
+	// Window IDs are allocated sequentially, spread them out
+	key ^= key >> 16;
+	key *= 0x7feb352d;
+	key ^= key >> 15;
+	key *= 0x846ca68b;
+	key ^= key >> 16;
+	return key;
+}
+
+static bool surface_map_key_equal(const void *a, const void *b) {
+	return *(const uint32_t *)a == *(const uint32_t *)b;
+}
+
+/**
+ * Insert a surface. The key must point to the ID stored in the surface.
+ */
+static void surface_map_insert(struct xwm_surface_map *map,
+		const uint32_t *key, struct wlr_xwayland_surface *surface) {
+	assert(*key != 0);
+	if (map->map == NULL) {
+		map->map = hash_map_create(surface_map_key_equal);
+	}
+	if (map->map == NULL ||
+			!hash_map_set(map->map, surface_map_hash(*key), key, surface)) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		map->incomplete = true;
+	}
+}
+
+static void surface_map_remove(struct xwm_surface_map *map, uint32_t key,
+		struct wlr_xwayland_surface *surface) {
+	if (map->map == NULL) {
+		return;
+	}
+	// Another surface may have been inserted with the same key since
+	uint64_t hash = surface_map_hash(key);
+	if (hash_map_get(map->map, hash, &key) == surface) {
+		hash_map_remove(map->map, hash, &key);
+	}
+}
+
+static struct wlr_xwayland_surface *surface_map_get(
+		struct xwm_surface_map *map, uint32_t key) {
+	if (key == 0 || map->map == NULL) {
+		return NULL;
+	}
+	return hash_map_get(map->map, surface_map_hash(key), &key);
+}
+
+static void surface_map_finish(struct xwm_surface_map *map) {
+	hash_map_destroy(map->map);
+	*map = (struct xwm_surface_map){0};
+}
+
 static struct wlr_xwayland_surface *lookup_surface(struct wlr_xwm *xwm,
 		xcb_window_t window_id) {
-	struct wlr_xwayland_surface *surface;
+	struct wlr_xwayland_surface *surface =
+		surface_map_get(&xwm->surfaces_by_window, window_id);
+	if (surface != NULL || !xwm->surfaces_by_window.incomplete) {
+		return surface;
+	}
+
 	wl_list_for_each(surface, &xwm->surfaces, link) {
 		if (surface->window_id == window_id) {
 			return surface;
@@ -112,12 +116,84 @@ static struct wlr_xwayland_surface *lookup_surface(struct wlr_xwm *xwm,
 	return NULL;
 }
 
-static int xwayland_surface_handle_ping_timeout(void *data) {
-	struct wlr_xwayland_surface *surface = data;
+static void xwm_set_unpaired(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *xsurface, uint32_t surface_id) {
+	if (xsurface->surface_id) {
+		wl_list_remove(&xsurface->unpaired_link);
+		surface_map_remove(&xwm->unpaired_by_id, xsurface->surface_id,
+			xsurface);
+	}
+	xsurface->surface_id = surface_id;
+	if (surface_id) {
+		wl_list_insert(&xwm->unpaired_surfaces, &xsurface->unpaired_link);
+		surface_map_insert(&xwm->unpaired_by_id, &xsurface->surface_id,
+			xsurface);
+	}
+}
 
-	wlr_signal_emit_safe(&surface->events.ping_timeout, surface);
+typedef void (*xwm_reply_handler_t)(struct wlr_xwm *xwm,
+	struct wlr_xwayland_surface *xsurface, xcb_atom_t atom, void *reply);
+
+/**
+ * A request whose reply hasn't been processed yet. Replies are polled from the
+ * event loop callback, and from an idle callback after blocking calls (see
+ * xwm_schedule_replies), so that the compositor never blocks on the X server.
+ */
+struct xwm_pending_reply {
+	struct wl_list link; // wlr_xwm::pending_replies
+	unsigned int sequence;
+	xwm_reply_handler_t handler;
+	struct wlr_xwayland_surface *xsurface; // NULL if destroyed meanwhile
+	xcb_atom_t atom;
+};
+
+static void xwm_queue_reply(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *xsurface, unsigned int sequence,
+		xwm_reply_handler_t handler, xcb_atom_t atom) {
+	struct xwm_pending_reply *pending = calloc(1, sizeof(*pending));
+	if (pending == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		xcb_discard_reply(xwm->xcb_conn, sequence);
+		return;
+	}
+	pending->sequence = sequence;
+	pending->handler = handler;
+	pending->xsurface = xsurface;
+	pending->atom = atom;
+	// Replies arrive in request order, keep the queue sorted the same way
+	wl_list_insert(xwm->pending_replies.prev, &pending->link);
+}
+
+static bool xsurface_has_pending_replies(
+		struct wlr_xwayland_surface *xsurface) {
+	struct xwm_pending_reply *pending;
+	wl_list_for_each(pending, &xsurface->xwm->pending_replies, link) {
+		if (pending->xsurface == xsurface) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void read_surface_geometry(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *xsurface, xcb_atom_t atom, void *data) {
+	xcb_get_geometry_reply_t *reply = data;
+	xsurface->has_alpha = reply->depth == 32;
+}
+
+static void xsurface_stop_ping(struct wlr_xwayland_surface *xsurface) {
+	if (!xsurface->pinging) {
+		return;
+	}
+	xsurface->pinging = false;
+	ping_timer_entry_stop(xsurface->ping_entry);
+}
+
+static void xsurface_handle_ping_timeout(struct ping_timer_entry *entry,
+		void *data) {
+	struct wlr_xwayland_surface *surface = data;
 	surface->pinging = false;
-	return 1;
+	wlr_signal_emit_safe(&surface->events.ping_timeout, surface);
 }
 
 static struct wlr_xwayland_surface *xwayland_surface_create(
@@ -130,9 +206,6 @@ static struct wlr_xwayland_surface *xwayland_surface_create(
 		return NULL;
 	}
 
-	xcb_get_geometry_cookie_t geometry_cookie =
-		xcb_get_geometry(xwm->xcb_conn, window_id);
-
 	uint32_t values[1];
 	values[0] =
 		XCB_EVENT_MASK_FOCUS_CHANGE |
@@ -147,6 +220,8 @@ static struct wlr_xwayland_surface *xwayland_surface_create(
 	surface->width = width;
 	surface->height = height;
 	surface->override_redirect = override_redirect;
+	// Always send the first configure, it also resets the border width
+	surface->configure_requested = true;
 	wl_list_init(&surface->children);
 	wl_list_init(&surface->stack_link);
 	wl_list_init(&surface->parent_link);
@@ -171,25 +246,15 @@ static struct wlr_xwayland_surface *xwayland_surface_create(
 	wl_signal_init(&surface->events.set_override_redirect);
 	wl_signal_init(&surface->events.ping_timeout);
 	wl_signal_init(&surface->events.set_geometry);
-
-	xcb_get_geometry_reply_t *geometry_reply =
-		xcb_get_geometry_reply(xwm->xcb_conn, geometry_cookie, NULL);
-	if (geometry_reply != NULL) {
-		surface->has_alpha = geometry_reply->depth == 32;
-	}
-	free(geometry_reply);
-
-	struct wl_display *display = xwm->xwayland->wl_display;
-	struct wl_event_loop *loop = wl_display_get_event_loop(display);
-	surface->ping_timer = wl_event_loop_add_timer(loop,
-		xwayland_surface_handle_ping_timeout, surface);
-	if (surface->ping_timer == NULL) {
-		free(surface);
-		wlr_log(WLR_ERROR, "Could not add timer to event loop");
-		return NULL;
-	}
+	wl_signal_init(&surface->events.configure_acked);
 
 	wl_list_insert(&xwm->surfaces, &surface->link);
+	surface_map_insert(&xwm->surfaces_by_window, &surface->window_id, surface);
+
+	xcb_get_geometry_cookie_t geometry_cookie =
+		xcb_get_geometry(xwm->xcb_conn, window_id);
+	xwm_queue_reply(xwm, surface, geometry_cookie.sequence,
+		read_surface_geometry, XCB_ATOM_NONE);
 
 	wlr_signal_emit_safe(&xwm->xwayland->events.new_surface, surface);
 
@@ -203,6 +268,8 @@ static void xwm_set_net_active_window(struct wlr_xwm *xwm,
 			xwm->atoms[WINDOW], 32, 1, &window);
 }
 
+static void xwm_schedule_flush(struct wlr_xwm *xwm);
+
 static void xwm_send_wm_message(struct wlr_xwayland_surface *surface,
 		xcb_client_message_data_t *data, uint32_t event_mask) {
 	struct wlr_xwm *xwm = surface->xwm;
@@ -221,60 +288,113 @@ static void xwm_send_wm_message(struct wlr_xwayland_surface *surface,
 		surface->window_id,
 		event_mask,
 		(const char *)&event);
-	xcb_flush(xwm->xcb_conn);
-}
-
-static void xwm_set_net_client_list(struct wlr_xwm *xwm) {
-	// FIXME: _NET_CLIENT_LIST is expected to be ordered by map time, but the
-	// order of surfaces in `xwm->surfaces` is by creation time. The order of
-	// windows _NET_CLIENT_LIST exposed by wlroots is wrong.
+	xwm_schedule_flush(xwm);
+}
+
+static void xwm_flush_client_lists(struct wlr_xwm *xwm) {
+	if (xwm->client_list_replace) {
+		xcb_change_property(xwm->xcb_conn, XCB_PROP_MODE_REPLACE,
+			xwm->screen->root, xwm->atoms[NET_CLIENT_LIST], XCB_ATOM_WINDOW,
+			32, xwm->client_list.size / sizeof(xcb_window_t),
+			xwm->client_list.data);
+	} else if (xwm->client_list.size > xwm->client_list_flushed) {
+		// Windows have only been mapped since the last update
+		xcb_change_property(xwm->xcb_conn, XCB_PROP_MODE_APPEND,
+			xwm->screen->root, xwm->atoms[NET_CLIENT_LIST], XCB_ATOM_WINDOW,
+			32, (xwm->client_list.size - xwm->client_list_flushed) /
+				sizeof(xcb_window_t),
+			(char *)xwm->client_list.data + xwm->client_list_flushed);
+	}
+	xwm->client_list_replace = false;
+	xwm->client_list_flushed = xwm->client_list.size;
+
+	if (xwm->client_list_stacking_dirty) {
+		size_t num_surfaces = wl_list_length(&xwm->surfaces_in_stack_order);
+		size_t size = num_surfaces * sizeof(xcb_window_t);
+		xwm->client_list_stacking.size = 0;
+		xcb_window_t *windows =
+			wl_array_add(&xwm->client_list_stacking, size);
+		if (windows == NULL && size > 0) {
+			wlr_log(WLR_ERROR, "Allocation failed");
+			return;
+		}
 
-	size_t mapped_surfaces = 0;
-	struct wlr_xwayland_surface *surface;
-	wl_list_for_each(surface, &xwm->surfaces, link) {
-		if (surface->mapped) {
-			mapped_surfaces++;
+		// Surfaces are stored in bottom-to-top order, as expected by
+		// _NET_CLIENT_LIST_STACKING
+		size_t i = 0;
+		struct wlr_xwayland_surface *xsurface;
+		wl_list_for_each(xsurface, &xwm->surfaces_in_stack_order, stack_link) {
+			windows[i++] = xsurface->window_id;
 		}
+
+		xcb_change_property(xwm->xcb_conn, XCB_PROP_MODE_REPLACE,
+			xwm->screen->root, xwm->atoms[NET_CLIENT_LIST_STACKING],
+			XCB_ATOM_WINDOW, 32, num_surfaces, windows);
+		xwm->client_list_stacking_dirty = false;
 	}
+}
+
+static int xwm_handle_replies(struct wlr_xwm *xwm);
+
+static void handle_flush_idle(void *data) {
+	struct wlr_xwm *xwm = data;
+	// Processed first, mapping surfaces updates the client lists
+	xwm_handle_replies(xwm);
+	xwm->flush_idle = NULL;
+	xwm_flush_client_lists(xwm);
+	xcb_flush(xwm->xcb_conn);
+}
 
-	xcb_window_t *windows = malloc(sizeof(xcb_window_t) * mapped_surfaces);
-	if (!windows) {
+/**
+ * Flushes the X connection once the current event loop iteration is done, so
+ * that requests sent from several places are written with a single syscall.
+ * The updates of _NET_CLIENT_LIST and _NET_CLIENT_LIST_STACKING are coalesced
+ * the same way.
+ */
+static void xwm_schedule_flush(struct wlr_xwm *xwm) {
+	if (xwm->flush_idle != NULL) {
 		return;
 	}
-
-	size_t index = 0;
-	wl_list_for_each(surface, &xwm->surfaces, link) {
-		if (surface->mapped) {
-			windows[index++] = surface->window_id;
-		}
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(xwm->xwayland->wl_display);
+	xwm->flush_idle =
+		wl_event_loop_add_idle(loop, handle_flush_idle, xwm);
+	if (xwm->flush_idle == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add idle event source");
+		xwm_flush_client_lists(xwm);
+		xcb_flush(xwm->xcb_conn);
 	}
+}
 
-	xcb_change_property(xwm->xcb_conn, XCB_PROP_MODE_REPLACE,
-			xwm->screen->root, xwm->atoms[NET_CLIENT_LIST],
-			XCB_ATOM_WINDOW, 32, mapped_surfaces, windows);
-	free(windows);
+void xwm_schedule_replies(struct wlr_xwm *xwm) {
+	if (!wl_list_empty(&xwm->pending_replies)) {
+		xwm_schedule_flush(xwm);
+	}
 }
 
-static void xwm_set_net_client_list_stacking(struct wlr_xwm *xwm) {
-	size_t num_surfaces = wl_list_length(&xwm->surfaces_in_stack_order);
-	xcb_window_t *windows = malloc(sizeof(xcb_window_t) * num_surfaces);
-	if (!windows) {
+static void xwm_client_list_add(struct wlr_xwm *xwm, xcb_window_t window) {
+	xcb_window_t *ptr = wl_array_add(&xwm->client_list, sizeof(*ptr));
+	if (ptr == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
 		return;
 	}
+	*ptr = window;
+	xwm_schedule_flush(xwm);
+}
 
-	// We store surfaces in top-to-bottom order because this is easier to reason
-	// about, but _NET_CLIENT_LIST_STACKING is supposed to be in bottom-to-top
-	// order, so iterate backwards through the list.
-	size_t i = 0;
-	struct wlr_xwayland_surface *xsurface;
-	wl_list_for_each(xsurface, &xwm->surfaces_in_stack_order, stack_link) {
-		windows[i++] = xsurface->window_id;
+static void xwm_client_list_remove(struct wlr_xwm *xwm, xcb_window_t window) {
+	xcb_window_t *windows = xwm->client_list.data;
+	size_t len = xwm->client_list.size / sizeof(xcb_window_t);
+	for (size_t i = 0; i < len; i++) {
+		if (windows[i] == window) {
+			memmove(&windows[i], &windows[i + 1],
+				(len - i - 1) * sizeof(xcb_window_t));
+			xwm->client_list.size -= sizeof(xcb_window_t);
+			xwm->client_list_replace = true;
+			xwm_schedule_flush(xwm);
+			return;
+		}
 	}
-
-	xcb_change_property(xwm->xcb_conn, XCB_PROP_MODE_REPLACE, xwm->screen->root,
-			xwm->atoms[NET_CLIENT_LIST_STACKING], XCB_ATOM_WINDOW, 32, num_surfaces,
-			windows);
-	free(windows);
 }
 
 static void xsurface_set_net_wm_state(struct wlr_xwayland_surface *xsurface);
@@ -298,6 +418,8 @@ static void xwm_set_focus_window(struct wlr_xwm *xwm,
 		return;
 	}
 
+	xwm_selection_offer_pending(xwm);
+
 	if (xsurface->override_redirect) {
 		return;
 	}
@@ -337,7 +459,7 @@ static void xwm_surface_activate(struct wlr_xwm *xwm,
 
 	xwm_set_focus_window(xwm, xsurface);
 
-	xcb_flush(xwm->xcb_conn);
+	xwm_schedule_flush(xwm);
 }
 
 static void xsurface_set_net_wm_state(struct wlr_xwayland_surface *xsurface) {
@@ -365,6 +487,15 @@ static void xsurface_set_net_wm_state(struct wlr_xwayland_surface *xsurface) {
 	}
 	assert(i <= sizeof(property) / sizeof(property[0]));
 
+	if (xsurface->net_wm_state_valid && xsurface->net_wm_state_len == i &&
+			memcmp(xsurface->net_wm_state, property,
+				i * sizeof(property[0])) == 0) {
+		return;
+	}
+	memcpy(xsurface->net_wm_state, property, i * sizeof(property[0]));
+	xsurface->net_wm_state_len = i;
+	xsurface->net_wm_state_valid = true;
+
 	xcb_change_property(xwm->xcb_conn,
 		XCB_PROP_MODE_REPLACE,
 		xsurface->window_id,
@@ -389,6 +520,8 @@ static void xwayland_surface_destroy(
 	wl_list_remove(&xsurface->link);
 	wl_list_remove(&xsurface->stack_link);
 	wl_list_remove(&xsurface->parent_link);
+	surface_map_remove(&xsurface->xwm->surfaces_by_window, xsurface->window_id,
+		xsurface);
 
 	struct wlr_xwayland_surface *child, *next;
 	wl_list_for_each_safe(child, next, &xsurface->children, parent_link) {
@@ -397,8 +530,13 @@ static void xwayland_surface_destroy(
 		child->parent = NULL;
 	}
 
-	if (xsurface->surface_id) {
-		wl_list_remove(&xsurface->unpaired_link);
+	xwm_set_unpaired(xsurface->xwm, xsurface, 0);
+
+	struct xwm_pending_reply *pending;
+	wl_list_for_each(pending, &xsurface->xwm->pending_replies, link) {
+		if (pending->xsurface == xsurface) {
+			pending->xsurface = NULL;
+		}
 	}
 
 	if (xsurface->surface) {
@@ -406,7 +544,13 @@ static void xwayland_surface_destroy(
 		xsurface->surface->role_data = NULL;
 	}
 
-	wl_event_source_remove(xsurface->ping_timer);
+	ping_timer_entry_destroy(xsurface->ping_entry);
+	if (xsurface->sync_timer != NULL) {
+		wl_event_source_remove(xsurface->sync_timer);
+	}
+	if (xsurface->sync_alarm != 0) {
+		xcb_sync_destroy_alarm(xsurface->xwm->xcb_conn, xsurface->sync_alarm);
+	}
 
 	free(xsurface->title);
 	free(xsurface->class);
@@ -542,19 +686,8 @@ static void read_surface_parent(struct wlr_xwm *xwm,
 }
 
 static void read_surface_client_id(struct wlr_xwm *xwm,
-		struct wlr_xwayland_surface *xsurface) {
-	xcb_res_client_id_spec_t spec = {
-		.client = xsurface->window_id,
-		.mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID
-	};
-
-	xcb_res_query_client_ids_cookie_t cookie = xcb_res_query_client_ids(
-		xwm->xcb_conn, 1, &spec);
-	xcb_res_query_client_ids_reply_t *reply = xcb_res_query_client_ids_reply(
-		xwm->xcb_conn, cookie,  NULL);
-	if (reply == NULL) {
-		return;
-	}
+		struct wlr_xwayland_surface *xsurface, xcb_atom_t atom, void *data) {
+	xcb_res_query_client_ids_reply_t *reply = data;
 
 	uint32_t *pid = NULL;
 	xcb_res_client_id_value_iterator_t iter =
@@ -568,12 +701,23 @@ static void read_surface_client_id(struct wlr_xwm *xwm,
 		xcb_res_client_id_value_next(&iter);
 	}
 	if (pid == NULL) {
-		free(reply);
 		return;
 	}
 	xsurface->pid = *pid;
 	wlr_signal_emit_safe(&xsurface->events.set_pid, xsurface);
-	free(reply);
+}
+
+static void query_surface_client_id(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *xsurface) {
+	xcb_res_client_id_spec_t spec = {
+		.client = xsurface->window_id,
+		.mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID
+	};
+
+	xcb_res_query_client_ids_cookie_t cookie =
+		xcb_res_query_client_ids(xwm->xcb_conn, 1, &spec);
+	xwm_queue_reply(xwm, xsurface, cookie.sequence, read_surface_client_id,
+		XCB_ATOM_NONE);
 }
 
 static void read_surface_window_type(struct wlr_xwm *xwm,
@@ -618,6 +762,33 @@ static void read_surface_protocols(struct wlr_xwm *xwm,
 	xsurface->protocols_len = atoms_len;
 }
 
+static void xsurface_sync_done(struct wlr_xwayland_surface *xsurface,
+	bool acked);
+
+static void read_surface_sync_counter(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *xsurface,
+		xcb_get_property_reply_t *reply) {
+	uint32_t counter = 0;
+	if (reply->type == XCB_ATOM_CARDINAL && reply->format == 32 &&
+			reply->value_len >= 1) {
+		// With the extended protocol, the first counter is the basic one
+		counter = *(uint32_t *)xcb_get_property_value(reply);
+	}
+	if (counter == xsurface->sync_counter) {
+		return;
+	}
+
+	if (xsurface->sync_alarm != 0) {
+		xcb_sync_destroy_alarm(xwm->xcb_conn, xsurface->sync_alarm);
+		xsurface->sync_alarm = 0;
+	}
+	xsurface->sync_counter = counter;
+	xsurface->sync_value = 0;
+	if (xsurface->sync_pending) {
+		xsurface_sync_done(xsurface, false);
+	}
+}
+
 static void read_surface_hints(struct wlr_xwm *xwm,
 		struct wlr_xwayland_surface *xsurface,
 		xcb_get_property_reply_t *reply) {
@@ -728,6 +899,18 @@ static void read_surface_net_wm_state(struct wlr_xwm *xwm,
 		xcb_get_property_reply_t *reply) {
 	xsurface->fullscreen = 0;
 	xcb_atom_t *atom = xcb_get_property_value(reply);
+
+	// Keep track of the property value, to avoid rewriting it unchanged
+	size_t max_len = sizeof(xsurface->net_wm_state) /
+		sizeof(xsurface->net_wm_state[0]);
+	xsurface->net_wm_state_valid = reply->format == 32 &&
+		reply->value_len <= max_len;
+	if (xsurface->net_wm_state_valid) {
+		memcpy(xsurface->net_wm_state, atom,
+			reply->value_len * sizeof(xcb_atom_t));
+		xsurface->net_wm_state_len = reply->value_len;
+	}
+
 	for (uint32_t i = 0; i < reply->value_len; i++) {
 		if (atom[i] == xwm->atoms[NET_WM_STATE_MODAL]) {
 			xsurface->modal = true;
@@ -748,6 +931,7 @@ char *xwm_get_atom_name(struct wlr_xwm *xwm, xcb_atom_t atom) {
 		xcb_get_atom_name(xwm->xcb_conn, atom);
 	xcb_get_atom_name_reply_t *name_reply =
 		xcb_get_atom_name_reply(xwm->xcb_conn, name_cookie, NULL);
+	xwm_schedule_replies(xwm);
 	if (name_reply == NULL) {
 		return NULL;
 	}
@@ -759,14 +943,9 @@ char *xwm_get_atom_name(struct wlr_xwm *xwm, xcb_atom_t atom) {
 }
 
 static void read_surface_property(struct wlr_xwm *xwm,
-		struct wlr_xwayland_surface *xsurface, xcb_atom_t property) {
-	xcb_get_property_cookie_t cookie = xcb_get_property(xwm->xcb_conn, 0,
-		xsurface->window_id, property, XCB_ATOM_ANY, 0, 2048);
-	xcb_get_property_reply_t *reply = xcb_get_property_reply(xwm->xcb_conn,
-		cookie, NULL);
-	if (reply == NULL) {
-		return;
-	}
+		struct wlr_xwayland_surface *xsurface, xcb_atom_t property,
+		void *data) {
+	xcb_get_property_reply_t *reply = data;
 
 	if (property == XCB_ATOM_WM_CLASS) {
 		read_surface_class(xwm, xsurface, reply);
@@ -791,14 +970,38 @@ static void read_surface_property(struct wlr_xwm *xwm,
 		read_surface_motif_hints(xwm, xsurface, reply);
 	} else if (property == xwm->atoms[WM_WINDOW_ROLE]) {
 		read_surface_role(xwm, xsurface, reply);
-	} else {
+	} else if (property == xwm->atoms[NET_WM_SYNC_REQUEST_COUNTER]) {
+		read_surface_sync_counter(xwm, xsurface, reply);
+	} else if (wlr_log_get_verbosity() >= WLR_DEBUG) {
 		char *prop_name = xwm_get_atom_name(xwm, property);
 		wlr_log(WLR_DEBUG, "unhandled X11 property %" PRIu32 " (%s) for window %" PRIu32,
 			property, prop_name ? prop_name : "(null)", xsurface->window_id);
 		free(prop_name);
 	}
+}
 
-	free(reply);
+static void query_surface_property(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *xsurface, xcb_atom_t property) {
+	xcb_get_property_cookie_t cookie = xcb_get_property(xwm->xcb_conn, 0,
+		xsurface->window_id, property, XCB_ATOM_ANY, 0, 2048);
+	xwm_queue_reply(xwm, xsurface, cookie.sequence, read_surface_property,
+		property);
+}
+
+/**
+ * Emits the map event once the surface has a buffer and the replies to the
+ * requests sent for the window (e.g. its properties) have been processed.
+ */
+static void xsurface_try_map(struct wlr_xwayland_surface *xsurface) {
+	if (xsurface->mapped || xsurface->surface == NULL ||
+			!wlr_surface_has_buffer(xsurface->surface) ||
+			xsurface_has_pending_replies(xsurface)) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&xsurface->events.map, xsurface);
+	xsurface->mapped = true;
+	xwm_client_list_add(xsurface->xwm, xsurface->window_id);
 }
 
 static void xwayland_surface_role_commit(struct wlr_surface *wlr_surface) {
@@ -808,11 +1011,7 @@ static void xwayland_surface_role_commit(struct wlr_surface *wlr_surface) {
 		return;
 	}
 
-	if (!surface->mapped && wlr_surface_has_buffer(surface->surface)) {
-		wlr_signal_emit_safe(&surface->events.map, surface);
-		surface->mapped = true;
-		xwm_set_net_client_list(surface->xwm);
-	}
+	xsurface_try_map(surface);
 }
 
 static void xwayland_surface_role_precommit(struct wlr_surface *wlr_surface) {
@@ -828,7 +1027,7 @@ static void xwayland_surface_role_precommit(struct wlr_surface *wlr_surface) {
 		if (surface->mapped) {
 			wlr_signal_emit_safe(&surface->events.unmap, surface);
 			surface->mapped = false;
-			xwm_set_net_client_list(surface->xwm);
+			xwm_client_list_remove(surface->xwm, surface->window_id);
 		}
 	}
 }
@@ -867,13 +1066,17 @@ static void xwm_map_shell_surface(struct wlr_xwm *xwm,
 		xwm->atoms[NET_WM_STATE],
 		xwm->atoms[NET_WM_WINDOW_TYPE],
 		xwm->atoms[NET_WM_NAME],
+		xwm->atoms[NET_WM_SYNC_REQUEST_COUNTER],
 	};
-	for (size_t i = 0; i < sizeof(props)/sizeof(xcb_atom_t); i++) {
-		read_surface_property(xwm, xsurface, props[i]);
+	// The replies are processed from the event loop, the surface is mapped
+	// once they have all been received
+	for (size_t i = 0; i < sizeof(props) / sizeof(props[0]); i++) {
+		query_surface_property(xwm, xsurface, props[i]);
 	}
 	if (xwm->xres) {
-		read_surface_client_id(xwm, xsurface);
+		query_surface_client_id(xwm, xsurface);
 	}
+	xcb_flush(xwm->xcb_conn);
 
 	xsurface->surface_destroy.notify = handle_surface_destroy;
 	wl_signal_add(&surface->events.destroy, &xsurface->surface_destroy);
@@ -883,16 +1086,13 @@ static void xsurface_unmap(struct wlr_xwayland_surface *surface) {
 	if (surface->mapped) {
 		wlr_signal_emit_safe(&surface->events.unmap, surface);
 		surface->mapped = false;
-		xwm_set_net_client_list(surface->xwm);
+		xwm_client_list_remove(surface->xwm, surface->window_id);
 	}
 
-	if (surface->surface_id) {
-		// Make sure we're not on the unpaired surface list or we
-		// could be assigned a surface during surface creation that
-		// was mapped before this unmap request.
-		wl_list_remove(&surface->unpaired_link);
-		surface->surface_id = 0;
-	}
+	// Make sure we're not on the unpaired surface list or we could be
+	// assigned a surface during surface creation that was mapped before this
+	// unmap request.
+	xwm_set_unpaired(surface->xwm, surface, 0);
 
 	if (surface->surface) {
 		wl_list_remove(&surface->surface_destroy.link);
@@ -949,6 +1149,7 @@ static void xwm_handle_configure_request(struct wlr_xwm *xwm,
 		.mask = mask,
 	};
 
+	surface->configure_requested = true;
 	wlr_signal_emit_safe(&surface->events.request_configure, &wlr_event);
 }
 
@@ -959,9 +1160,17 @@ static void xwm_handle_configure_notify(struct wlr_xwm *xwm,
 		return;
 	}
 
-	bool geometry_changed =
-		(xsurface->x != ev->x || xsurface->y != ev->y ||
-		 xsurface->width != ev->width || xsurface->height != ev->height);
+	struct wlr_xwayland_surface_set_geometry_event geometry_event = {
+		.surface = xsurface,
+		.old_x = xsurface->x,
+		.old_y = xsurface->y,
+		.old_width = xsurface->width,
+		.old_height = xsurface->height,
+		.moved = xsurface->x != ev->x || xsurface->y != ev->y,
+		.resized = xsurface->width != ev->width ||
+			xsurface->height != ev->height,
+	};
+	bool geometry_changed = geometry_event.moved || geometry_event.resized;
 
 	if (geometry_changed) {
 		xsurface->x = ev->x;
@@ -976,7 +1185,7 @@ static void xwm_handle_configure_notify(struct wlr_xwm *xwm,
 	}
 
 	if (geometry_changed) {
-		wlr_signal_emit_safe(&xsurface->events.set_geometry, NULL);
+		wlr_signal_emit_safe(&xsurface->events.set_geometry, &geometry_event);
 	}
 }
 
@@ -1031,8 +1240,8 @@ void wlr_xwayland_surface_restack(struct wlr_xwayland_surface *xsurface,
 	}
 
 	wl_list_insert(node, &xsurface->stack_link);
-	xwm_set_net_client_list_stacking(xwm);
-	xcb_flush(xwm->xcb_conn);
+	xwm->client_list_stacking_dirty = true;
+	xwm_schedule_flush(xwm);
 }
 
 static void xwm_handle_map_request(struct wlr_xwm *xwm,
@@ -1080,7 +1289,7 @@ static void xwm_handle_property_notify(struct wlr_xwm *xwm,
 		return;
 	}
 
-	read_surface_property(xwm, xsurface, ev->atom);
+	query_surface_property(xwm, xsurface, ev->atom);
 }
 
 static void xwm_handle_surface_id_message(struct wlr_xwm *xwm,
@@ -1098,11 +1307,10 @@ static void xwm_handle_surface_id_message(struct wlr_xwm *xwm,
 		wl_client_get_object(xwm->xwayland->server->client, id);
 	if (resource) {
 		struct wlr_surface *surface = wlr_surface_from_resource(resource);
-		xsurface->surface_id = 0;
+		xwm_set_unpaired(xwm, xsurface, 0);
 		xwm_map_shell_surface(xwm, xsurface, surface);
 	} else {
-		xsurface->surface_id = id;
-		wl_list_insert(&xwm->unpaired_surfaces, &xsurface->unpaired_link);
+		xwm_set_unpaired(xwm, xsurface, id);
 	}
 }
 
@@ -1252,7 +1460,8 @@ static void xwm_handle_net_wm_state_message(struct wlr_xwm *xwm,
 			changed = update_state(action, &xsurface->maximized_horz);
 		} else if (property == xwm->atoms[NET_WM_STATE_HIDDEN]) {
 			changed = update_state(action, &xsurface->minimized);
-		} else if (property != XCB_ATOM_NONE) {
+		} else if (property != XCB_ATOM_NONE &&
+				wlr_log_get_verbosity() >= WLR_DEBUG) {
 			char *prop_name = xwm_get_atom_name(xwm, property);
 			wlr_log(WLR_DEBUG, "Unhandled NET_WM_STATE property change "
 				"%"PRIu32" (%s)", property, prop_name ? prop_name : "(null)");
@@ -1310,13 +1519,8 @@ static void xwm_handle_wm_protocols_message(struct wlr_xwm *xwm,
 			return;
 		}
 
-		if (!surface->pinging) {
-			return;
-		}
-
-		wl_event_source_timer_update(surface->ping_timer, 0);
-		surface->pinging = false;
-	} else {
+		xsurface_stop_ping(surface);
+	} else if (wlr_log_get_verbosity() >= WLR_DEBUG) {
 		char *type_name = xwm_get_atom_name(xwm, type);
 		wlr_log(WLR_DEBUG, "unhandled WM_PROTOCOLS client message %" PRIu32 " (%s)",
 			type, type_name ? type_name : "(null)");
@@ -1373,7 +1577,8 @@ static void xwm_handle_client_message(struct wlr_xwm *xwm,
 		xwm_handle_net_active_window_message(xwm, ev);
 	} else if (ev->type == xwm->atoms[WM_CHANGE_STATE]) {
 		xwm_handle_wm_change_state_message(xwm, ev);
-	} else if (!xwm_handle_selection_client_message(xwm, ev)) {
+	} else if (!xwm_handle_selection_client_message(xwm, ev) &&
+			wlr_log_get_verbosity() >= WLR_DEBUG) {
 		char *type_name = xwm_get_atom_name(xwm, ev->type);
 		wlr_log(WLR_DEBUG, "unhandled x11 client message %" PRIu32 " (%s)", ev->type,
 			type_name ? type_name : "(null)");
@@ -1478,6 +1683,43 @@ static void xwm_handle_unhandled_event(struct wlr_xwm *xwm, xcb_generic_event_t
 #endif
 }
 
+/**
+ * Processes the replies which have been received so far, without waiting for
+ * the others. Returns the number of processed replies.
+ */
+static int xwm_handle_replies(struct wlr_xwm *xwm) {
+	int count = 0;
+	struct xwm_pending_reply *pending, *tmp;
+	wl_list_for_each_safe(pending, tmp, &xwm->pending_replies, link) {
+		void *reply = NULL;
+		xcb_generic_error_t *error = NULL;
+		if (!xcb_poll_for_reply(xwm->xcb_conn, pending->sequence,
+				&reply, &error)) {
+			// Replies are received in order, the next ones are not there
+			// either
+			break;
+		}
+		count++;
+
+		wl_list_remove(&pending->link);
+		struct wlr_xwayland_surface *xsurface = pending->xsurface;
+		if (xsurface != NULL && reply != NULL) {
+			pending->handler(xwm, xsurface, pending->atom, reply);
+		}
+		if (xsurface != NULL) {
+			xsurface_try_map(xsurface);
+		}
+
+		free(reply);
+		free(error);
+		free(pending);
+	}
+	return count;
+}
+
+static void xwm_handle_sync_alarm_notify(struct wlr_xwm *xwm,
+	xcb_sync_alarm_notify_event_t *ev);
+
 static int x11_event_handler(int fd, uint32_t mask, void *data) {
 	int count = 0;
 	xcb_generic_event_t *event;
@@ -1501,6 +1743,15 @@ static int x11_event_handler(int fd, uint32_t mask, void *data) {
 			continue;
 		}
 
+		if (xwm->xsync != NULL &&
+				(event->response_type & XCB_EVENT_RESPONSE_TYPE_MASK) ==
+				xwm->xsync->first_event + XCB_SYNC_ALARM_NOTIFY) {
+			xwm_handle_sync_alarm_notify(xwm,
+				(xcb_sync_alarm_notify_event_t *)event);
+			free(event);
+			continue;
+		}
+
 		switch (event->response_type & XCB_EVENT_RESPONSE_TYPE_MASK) {
 		case XCB_CREATE_NOTIFY:
 			xwm_handle_create_notify(xwm, (xcb_create_notify_event_t *)event);
@@ -1545,6 +1796,10 @@ static int x11_event_handler(int fd, uint32_t mask, void *data) {
 		free(event);
 	}
 
+	// xcb_poll_for_event() has read everything available from the socket,
+	// including replies
+	count += xwm_handle_replies(xwm);
+
 	if (count) {
 		xcb_flush(xwm->xcb_conn);
 	}
@@ -1566,16 +1821,22 @@ static void handle_compositor_new_surface(struct wl_listener *listener,
 	wlr_log(WLR_DEBUG, "New xwayland surface: %p", surface);
 
 	uint32_t surface_id = wl_resource_get_id(surface->resource);
-	struct wlr_xwayland_surface *xsurface;
-	wl_list_for_each(xsurface, &xwm->unpaired_surfaces, unpaired_link) {
-		if (xsurface->surface_id == surface_id) {
-			xwm_map_shell_surface(xwm, xsurface, surface);
-			xsurface->surface_id = 0;
-			wl_list_remove(&xsurface->unpaired_link);
-			xcb_flush(xwm->xcb_conn);
-			return;
+	struct wlr_xwayland_surface *xsurface =
+		surface_map_get(&xwm->unpaired_by_id, surface_id);
+	if (xsurface == NULL && xwm->unpaired_by_id.incomplete) {
+		struct wlr_xwayland_surface *unpaired;
+		wl_list_for_each(unpaired, &xwm->unpaired_surfaces, unpaired_link) {
+			if (unpaired->surface_id == surface_id) {
+				xsurface = unpaired;
+				break;
+			}
 		}
 	}
+	if (xsurface != NULL) {
+		xwm_map_shell_surface(xwm, xsurface, surface);
+		xwm_set_unpaired(xwm, xsurface, 0);
+		xcb_flush(xwm->xcb_conn);
+	}
 }
 
 static void handle_compositor_destroy(struct wl_listener *listener,
@@ -1598,20 +1859,160 @@ void wlr_xwayland_surface_activate(struct wlr_xwayland_surface *xsurface,
 	}
 }
 
+static bool xsurface_supports_sync(struct wlr_xwayland_surface *xsurface) {
+	struct wlr_xwm *xwm = xsurface->xwm;
+	if (xwm->xsync == NULL || xsurface->sync_counter == 0) {
+		return false;
+	}
+	for (size_t i = 0; i < xsurface->protocols_len; i++) {
+		if (xsurface->protocols[i] == xwm->atoms[NET_WM_SYNC_REQUEST]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int xsurface_handle_sync_timeout(void *data) {
+	struct wlr_xwayland_surface *xsurface = data;
+	wlr_log(WLR_DEBUG, "Window %" PRIu32 " didn't reply to a sync request "
+		"in time", xsurface->window_id);
+	xsurface_sync_done(xsurface, false);
+	return 0;
+}
+
+static void xsurface_send_sync_request(struct wlr_xwayland_surface *xsurface) {
+	struct wlr_xwm *xwm = xsurface->xwm;
+
+	if (xsurface->sync_timer == NULL) {
+		struct wl_event_loop *event_loop =
+			wl_display_get_event_loop(xwm->xwayland->wl_display);
+		xsurface->sync_timer = wl_event_loop_add_timer(event_loop,
+			xsurface_handle_sync_timeout, xsurface);
+		if (xsurface->sync_timer == NULL) {
+			// Without a timeout, an unresponsive client would block resizes
+			return;
+		}
+	}
+
+	xsurface->sync_value++;
+	uint32_t value_hi = xsurface->sync_value >> 32;
+	uint32_t value_lo = xsurface->sync_value & 0xFFFFFFFF;
+
+	xcb_client_message_data_t message_data = { 0 };
+	message_data.data32[0] = xwm->atoms[NET_WM_SYNC_REQUEST];
+	message_data.data32[1] = XCB_CURRENT_TIME;
+	message_data.data32[2] = value_lo;
+	message_data.data32[3] = value_hi;
+	xwm_send_wm_message(xsurface, &message_data, XCB_EVENT_MASK_NO_EVENT);
+
+	// Get notified once the client sets the counter to the new value
+	if (xsurface->sync_alarm == 0) {
+		xsurface->sync_alarm = xcb_generate_id(xwm->xcb_conn);
+		uint32_t mask = XCB_SYNC_CA_COUNTER | XCB_SYNC_CA_VALUE_TYPE |
+			XCB_SYNC_CA_VALUE | XCB_SYNC_CA_TEST_TYPE | XCB_SYNC_CA_DELTA |
+			XCB_SYNC_CA_EVENTS;
+		uint32_t values[] = {
+			xsurface->sync_counter,
+			XCB_SYNC_VALUETYPE_ABSOLUTE,
+			value_hi, value_lo,
+			XCB_SYNC_TESTTYPE_POSITIVE_COMPARISON,
+			0, 1, // delta
+			1, // events
+		};
+		xcb_sync_create_alarm(xwm->xcb_conn, xsurface->sync_alarm, mask,
+			values);
+	} else {
+		uint32_t values[] = { value_hi, value_lo };
+		xcb_sync_change_alarm(xwm->xcb_conn, xsurface->sync_alarm,
+			XCB_SYNC_CA_VALUE, values);
+	}
+
+	xsurface->sync_pending = true;
+	wl_event_source_timer_update(xsurface->sync_timer,
+		SYNC_REQUEST_TIMEOUT_MS);
+}
+
+static void xsurface_sync_done(struct wlr_xwayland_surface *xsurface,
+		bool acked) {
+	xsurface->sync_pending = false;
+	if (xsurface->sync_timer != NULL) {
+		wl_event_source_timer_update(xsurface->sync_timer, 0);
+	}
+
+	// The configure_acked listeners may send a newer configure
+	bool has_next = xsurface->sync_next_configure.set;
+	int16_t x = xsurface->sync_next_configure.x;
+	int16_t y = xsurface->sync_next_configure.y;
+	uint16_t width = xsurface->sync_next_configure.width;
+	uint16_t height = xsurface->sync_next_configure.height;
+	xsurface->sync_next_configure.set = false;
+
+	if (acked) {
+		wlr_signal_emit_safe(&xsurface->events.configure_acked, xsurface);
+	}
+
+	if (has_next && !xsurface->sync_pending) {
+		wlr_xwayland_surface_configure(xsurface, x, y, width, height);
+	}
+}
+
+static void xwm_handle_sync_alarm_notify(struct wlr_xwm *xwm,
+		xcb_sync_alarm_notify_event_t *ev) {
+	struct wlr_xwayland_surface *xsurface;
+	wl_list_for_each(xsurface, &xwm->surfaces, link) {
+		if (xsurface->sync_alarm != ev->alarm) {
+			continue;
+		}
+
+		uint64_t value = ((uint64_t)(uint32_t)ev->counter_value.hi << 32) |
+			ev->counter_value.lo;
+		if (xsurface->sync_pending && value >= xsurface->sync_value) {
+			xsurface_sync_done(xsurface, true);
+		}
+		return;
+	}
+}
+
 void wlr_xwayland_surface_configure(struct wlr_xwayland_surface *xsurface,
 		int16_t x, int16_t y, uint16_t width, uint16_t height) {
+	if (xsurface->sync_pending) {
+		// The client hasn't redrawn after the previous resize yet, only
+		// keep the latest configure
+		xsurface->sync_next_configure.set = true;
+		xsurface->sync_next_configure.x = x;
+		xsurface->sync_next_configure.y = y;
+		xsurface->sync_next_configure.width = width;
+		xsurface->sync_next_configure.height = height;
+		return;
+	}
+
+	// The client expects an answer to its ConfigureRequest, even if the
+	// geometry doesn't change
+	if (!xsurface->configure_requested && xsurface->x == x &&
+			xsurface->y == y && xsurface->width == width &&
+			xsurface->height == height) {
+		return;
+	}
+	xsurface->configure_requested = false;
+
+	bool resized = xsurface->width != width || xsurface->height != height;
 	xsurface->x = x;
 	xsurface->y = y;
 	xsurface->width = width;
 	xsurface->height = height;
 
 	struct wlr_xwm *xwm = xsurface->xwm;
+	if (resized && xsurface->mapped && xsurface_supports_sync(xsurface)) {
+		// Must be sent before the ConfigureNotify
+		xsurface_send_sync_request(xsurface);
+	}
+
 	uint32_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
 		XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT |
 		XCB_CONFIG_WINDOW_BORDER_WIDTH;
 	uint32_t values[] = {x, y, width, height, 0};
 	xcb_configure_window(xwm->xcb_conn, xsurface->window_id, mask, values);
-	xcb_flush(xwm->xcb_conn);
+	xwm_schedule_flush(xwm);
 }
 
 void wlr_xwayland_surface_close(struct wlr_xwayland_surface *xsurface) {
@@ -1632,7 +2033,7 @@ void wlr_xwayland_surface_close(struct wlr_xwayland_surface *xsurface) {
 		xwm_send_wm_message(xsurface, &message_data, XCB_EVENT_MASK_NO_EVENT);
 	} else {
 		xcb_kill_client(xwm->xcb_conn, xsurface->window_id);
-		xcb_flush(xwm->xcb_conn);
+		xwm_schedule_flush(xwm);
 	}
 }
 
@@ -1686,6 +2087,19 @@ void xwm_destroy(struct wlr_xwm *xwm) {
 	wl_list_for_each_safe(xsurface, tmp, &xwm->unpaired_surfaces, unpaired_link) {
 		xwayland_surface_destroy(xsurface);
 	}
+	if (xwm->flush_idle) {
+		wl_event_source_remove(xwm->flush_idle);
+	}
+	wl_array_release(&xwm->client_list);
+	wl_array_release(&xwm->client_list_stacking);
+	xwm_atom_cache_finish(xwm);
+	struct xwm_pending_reply *pending, *pending_tmp;
+	wl_list_for_each_safe(pending, pending_tmp, &xwm->pending_replies, link) {
+		wl_list_remove(&pending->link);
+		free(pending);
+	}
+	surface_map_finish(&xwm->surfaces_by_window);
+	surface_map_finish(&xwm->unpaired_by_id);
 	wl_list_remove(&xwm->compositor_new_surface.link);
 	wl_list_remove(&xwm->compositor_destroy.link);
 	xcb_disconnect(xwm->xcb_conn);
@@ -1694,10 +2108,43 @@ void xwm_destroy(struct wlr_xwm *xwm) {
 	free(xwm);
 }
 
+static void xwm_get_render_format(struct wlr_xwm *xwm,
+		xcb_render_query_pict_formats_cookie_t cookie) {
+	xcb_render_query_pict_formats_reply_t *reply =
+		xcb_render_query_pict_formats_reply(xwm->xcb_conn, cookie, NULL);
+	if (!reply) {
+		wlr_log(WLR_ERROR, "Did not get any reply from xcb_render_query_pict_formats");
+		return;
+	}
+	xcb_render_pictforminfo_iterator_t iter =
+		xcb_render_query_pict_formats_formats_iterator(reply);
+	xcb_render_pictforminfo_t *format = NULL;
+	while (iter.rem > 0) {
+		if (iter.data->depth == 32) {
+			format = iter.data;
+			break;
+		}
+
+		xcb_render_pictforminfo_next(&iter);
+	}
+
+	if (format == NULL) {
+		wlr_log(WLR_DEBUG, "No 32 bit render format");
+		free(reply);
+		return;
+	}
+
+	xwm->render_format_id = format->id;
+	free(reply);
+}
+
 static void xwm_get_resources(struct wlr_xwm *xwm) {
 	xcb_prefetch_extension_data(xwm->xcb_conn, &xcb_xfixes_id);
 	xcb_prefetch_extension_data(xwm->xcb_conn, &xcb_composite_id);
 	xcb_prefetch_extension_data(xwm->xcb_conn, &xcb_res_id);
+	xcb_prefetch_extension_data(xwm->xcb_conn, &xcb_render_id);
+	xcb_prefetch_extension_data(xwm->xcb_conn, &xcb_sync_id);
+	xcb_prefetch_maximum_request_length(xwm->xcb_conn);
 
 	size_t i;
 	xcb_intern_atom_cookie_t cookies[ATOM_LAST];
@@ -1706,6 +2153,42 @@ static void xwm_get_resources(struct wlr_xwm *xwm) {
 		cookies[i] =
 			xcb_intern_atom(xwm->xcb_conn, 0, strlen(atom_map[i]), atom_map[i]);
 	}
+
+	// All requests above are answered in a single round-trip. Extension
+	// requests can only be sent once the extension data has been received,
+	// they make up a second round-trip.
+	xwm->xfixes = xcb_get_extension_data(xwm->xcb_conn, &xcb_xfixes_id);
+	const xcb_query_extension_reply_t *xres =
+		xcb_get_extension_data(xwm->xcb_conn, &xcb_res_id);
+	const xcb_query_extension_reply_t *render =
+		xcb_get_extension_data(xwm->xcb_conn, &xcb_render_id);
+	const xcb_query_extension_reply_t *xsync =
+		xcb_get_extension_data(xwm->xcb_conn, &xcb_sync_id);
+
+	xcb_xfixes_query_version_cookie_t xfixes_cookie = {0};
+	if (xwm->xfixes && xwm->xfixes->present) {
+		xfixes_cookie = xcb_xfixes_query_version(xwm->xcb_conn,
+			XCB_XFIXES_MAJOR_VERSION, XCB_XFIXES_MINOR_VERSION);
+	} else {
+		wlr_log(WLR_DEBUG, "xfixes not available");
+	}
+	xcb_res_query_version_cookie_t xres_cookie = {0};
+	if (xres && xres->present) {
+		xres_cookie = xcb_res_query_version(xwm->xcb_conn,
+			XCB_RES_MAJOR_VERSION, XCB_RES_MINOR_VERSION);
+	}
+	xcb_sync_initialize_cookie_t xsync_cookie = {0};
+	if (xsync && xsync->present) {
+		xsync_cookie = xcb_sync_initialize(xwm->xcb_conn,
+			XCB_SYNC_MAJOR_VERSION, XCB_SYNC_MINOR_VERSION);
+	}
+	xcb_render_query_pict_formats_cookie_t render_cookie = {0};
+	if (render && render->present) {
+		render_cookie = xcb_render_query_pict_formats(xwm->xcb_conn);
+	} else {
+		wlr_log(WLR_ERROR, "render not available");
+	}
+
 	for (i = 0; i < ATOM_LAST; i++) {
 		xcb_generic_error_t *error;
 		xcb_intern_atom_reply_t *reply =
@@ -1719,51 +2202,59 @@ static void xwm_get_resources(struct wlr_xwm *xwm) {
 			wlr_log(WLR_ERROR, "could not resolve atom %s, x11 error code %d",
 				atom_map[i], error->error_code);
 			free(error);
-			return;
 		}
 	}
 
-	xwm->xfixes = xcb_get_extension_data(xwm->xcb_conn, &xcb_xfixes_id);
-
-	if (!xwm->xfixes || !xwm->xfixes->present) {
-		wlr_log(WLR_DEBUG, "xfixes not available");
+	// In 4-byte units, leave room for the ChangeProperty request header
+	size_t max_request_size =
+		(size_t)xcb_get_maximum_request_length(xwm->xcb_conn) * 4;
+	xwm->incr_chunk_size = INCR_CHUNK_SIZE;
+	if (max_request_size > MAX_INCR_CHUNK_SIZE + 32) {
+		xwm->incr_chunk_size = MAX_INCR_CHUNK_SIZE;
+	} else if (max_request_size > INCR_CHUNK_SIZE + 32) {
+		xwm->incr_chunk_size = max_request_size - 32;
 	}
+	wlr_log(WLR_DEBUG, "Selection chunk size: %zu bytes", xwm->incr_chunk_size);
 
-	xcb_xfixes_query_version_cookie_t xfixes_cookie;
-	xcb_xfixes_query_version_reply_t *xfixes_reply;
-	xfixes_cookie =
-		xcb_xfixes_query_version(xwm->xcb_conn, XCB_XFIXES_MAJOR_VERSION,
-			XCB_XFIXES_MINOR_VERSION);
-	xfixes_reply =
-		xcb_xfixes_query_version_reply(xwm->xcb_conn, xfixes_cookie, NULL);
-
-	wlr_log(WLR_DEBUG, "xfixes version: %" PRIu32 ".%" PRIu32,
-		xfixes_reply->major_version, xfixes_reply->minor_version);
-
-	free(xfixes_reply);
-
-	const xcb_query_extension_reply_t *xres =
-		xcb_get_extension_data(xwm->xcb_conn, &xcb_res_id);
-	if (!xres || !xres->present) {
-		return;
+	if (xfixes_cookie.sequence != 0) {
+		xcb_xfixes_query_version_reply_t *xfixes_reply =
+			xcb_xfixes_query_version_reply(xwm->xcb_conn, xfixes_cookie, NULL);
+		if (xfixes_reply != NULL) {
+			wlr_log(WLR_DEBUG, "xfixes version: %" PRIu32 ".%" PRIu32,
+				xfixes_reply->major_version, xfixes_reply->minor_version);
+		}
+		free(xfixes_reply);
+	}
+
+	if (xres_cookie.sequence != 0) {
+		xcb_res_query_version_reply_t *xres_reply =
+			xcb_res_query_version_reply(xwm->xcb_conn, xres_cookie, NULL);
+		if (xres_reply != NULL) {
+			wlr_log(WLR_DEBUG, "xres version: %" PRIu32 ".%" PRIu32,
+				xres_reply->server_major, xres_reply->server_minor);
+			if (xres_reply->server_major > 1 ||
+					(xres_reply->server_major == 1 &&
+					xres_reply->server_minor >= 2)) {
+				xwm->xres = xres;
+			}
+		}
+		free(xres_reply);
 	}
 
-	xcb_res_query_version_cookie_t xres_cookie =
-		xcb_res_query_version(xwm->xcb_conn, XCB_RES_MAJOR_VERSION,
-			XCB_RES_MINOR_VERSION);
-	xcb_res_query_version_reply_t *xres_reply =
-		xcb_res_query_version_reply(xwm->xcb_conn, xres_cookie, NULL);
-	if (xres_reply == NULL) {
-		return;
+	if (xsync_cookie.sequence != 0) {
+		xcb_sync_initialize_reply_t *xsync_reply =
+			xcb_sync_initialize_reply(xwm->xcb_conn, xsync_cookie, NULL);
+		if (xsync_reply != NULL) {
+			wlr_log(WLR_DEBUG, "sync version: %" PRIu8 ".%" PRIu8,
+				xsync_reply->major_version, xsync_reply->minor_version);
+			xwm->xsync = xsync;
+		}
+		free(xsync_reply);
 	}
 
-	wlr_log(WLR_DEBUG, "xres version: %" PRIu32 ".%" PRIu32,
-		xres_reply->server_major, xres_reply->server_minor);
-	if (xres_reply->server_major > 1 ||
-			(xres_reply->server_major == 1 && xres_reply->server_minor >= 2)) {
-		xwm->xres = xres;
+	if (render_cookie.sequence != 0) {
+		xwm_get_render_format(xwm, render_cookie);
 	}
-	free(xres_reply);
 }
 
 static void xwm_create_wm_window(struct wlr_xwm *xwm) {
@@ -1849,37 +2340,6 @@ static void xwm_get_visual_and_colormap(struct wlr_xwm *xwm) {
 		xwm->visual_id);
 }
 
-static void xwm_get_render_format(struct wlr_xwm *xwm) {
-	xcb_render_query_pict_formats_cookie_t cookie =
-		xcb_render_query_pict_formats(xwm->xcb_conn);
-	xcb_render_query_pict_formats_reply_t *reply =
-		xcb_render_query_pict_formats_reply(xwm->xcb_conn, cookie, NULL);
-	if (!reply) {
-		wlr_log(WLR_ERROR, "Did not get any reply from xcb_render_query_pict_formats");
-		return;
-	}
-	xcb_render_pictforminfo_iterator_t iter =
-		xcb_render_query_pict_formats_formats_iterator(reply);
-	xcb_render_pictforminfo_t *format = NULL;
-	while (iter.rem > 0) {
-		if (iter.data->depth == 32) {
-			format = iter.data;
-			break;
-		}
-
-		xcb_render_pictforminfo_next(&iter);
-	}
-
-	if (format == NULL) {
-		wlr_log(WLR_DEBUG, "No 32 bit render format");
-		free(reply);
-		return;
-	}
-
-	xwm->render_format_id = format->id;
-	free(reply);
-}
-
 void xwm_set_cursor(struct wlr_xwm *xwm, const uint8_t *pixels, uint32_t stride,
 		uint32_t width, uint32_t height, int32_t hotspot_x, int32_t hotspot_y) {
 	if (!xwm->render_format_id) {
@@ -1930,6 +2390,11 @@ struct wlr_xwm *xwm_create(struct wlr_xwayland *xwayland, int wm_fd) {
 	wl_list_init(&xwm->surfaces);
 	wl_list_init(&xwm->surfaces_in_stack_order);
 	wl_list_init(&xwm->unpaired_surfaces);
+	wl_list_init(&xwm->pending_replies);
+	wl_array_init(&xwm->client_list);
+	wl_array_init(&xwm->client_list_stacking);
+	wl_array_init(&xwm->atom_names);
+	xwm->client_list_replace = true;
 	xwm->ping_timeout = 10000;
 
 	xwm->xcb_conn = xcb_connect_to_fd(wm_fd, NULL);
@@ -1961,7 +2426,6 @@ struct wlr_xwm *xwm_create(struct wlr_xwayland *xwayland, int wm_fd) {
 
 	xwm_get_resources(xwm);
 	xwm_get_visual_and_colormap(xwm);
-	xwm_get_render_format(xwm);
 
 	uint32_t values[] = {
 		XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY |
@@ -1989,14 +2453,19 @@ struct wlr_xwm *xwm_create(struct wlr_xwayland *xwayland, int wm_fd) {
 		xwm->atoms[NET_WM_STATE_HIDDEN],
 		xwm->atoms[NET_CLIENT_LIST],
 		xwm->atoms[NET_CLIENT_LIST_STACKING],
+		xwm->atoms[NET_WM_SYNC_REQUEST], // must be last
 	};
+	size_t supported_len = sizeof(supported)/sizeof(*supported);
+	if (xwm->xsync == NULL) {
+		supported_len--;
+	}
 	xcb_change_property(xwm->xcb_conn,
 		XCB_PROP_MODE_REPLACE,
 		xwm->screen->root,
 		xwm->atoms[NET_SUPPORTED],
 		XCB_ATOM_ATOM,
 		32,
-		sizeof(supported)/sizeof(*supported),
+		supported_len,
 		supported);
 
 	xcb_flush(xwm->xcb_conn);
@@ -2032,7 +2501,7 @@ void wlr_xwayland_surface_set_minimized(struct wlr_xwayland_surface *surface,
 	}
 
 	xsurface_set_net_wm_state(surface);
-	xcb_flush(surface->xwm->xcb_conn);
+	xwm_schedule_flush(surface->xwm);
 }
 
 void wlr_xwayland_surface_set_maximized(struct wlr_xwayland_surface *surface,
@@ -2040,14 +2509,14 @@ void wlr_xwayland_surface_set_maximized(struct wlr_xwayland_surface *surface,
 	surface->maximized_horz = maximized;
 	surface->maximized_vert = maximized;
 	xsurface_set_net_wm_state(surface);
-	xcb_flush(surface->xwm->xcb_conn);
+	xwm_schedule_flush(surface->xwm);
 }
 
 void wlr_xwayland_surface_set_fullscreen(struct wlr_xwayland_surface *surface,
 		bool fullscreen) {
 	surface->fullscreen = fullscreen;
 	xsurface_set_net_wm_state(surface);
-	xcb_flush(surface->xwm->xcb_conn);
+	xwm_schedule_flush(surface->xwm);
 }
 
 bool xwm_atoms_contains(struct wlr_xwm *xwm, xcb_atom_t *atoms,
@@ -2071,8 +2540,15 @@ void wlr_xwayland_surface_ping(struct wlr_xwayland_surface *surface) {
 
 	xwm_send_wm_message(surface, &data, XCB_EVENT_MASK_NO_EVENT);
 
-	wl_event_source_timer_update(surface->ping_timer,
-		surface->xwm->ping_timeout);
+	struct wlr_xwm *xwm = surface->xwm;
+	if (surface->ping_entry == NULL) {
+		surface->ping_entry = ping_timer_entry_create(
+			xwm->xwayland->wl_display, xsurface_handle_ping_timeout, surface);
+		if (surface->ping_entry == NULL) {
+			return;
+		}
+	}
+	ping_timer_entry_start(surface->ping_entry, xwm->ping_timeout);
 	surface->pinging = true;
 }
 